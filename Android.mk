@@ -4,16 +4,26 @@ include $(CLEAR_VARS)
 LOCAL_ARM_MODE := arm
 
 LOCAL_SRC_FILES := \
+    src/concurrent.c \
     src/dump.c \
     src/error.c \
     src/hashtable.c \
     src/hashtable_seed.c \
     src/load.c \
+    src/load_binary.c \
+    src/load_lines.c \
+    src/load_parallel.c \
     src/memory.c \
     src/pack_unpack.c \
+    src/patch.c \
+    src/path.c \
+    src/stats.c \
     src/strbuffer.c \
     src/strconv.c \
+    src/tape.c \
+    src/thread.c \
     src/utf.c \
+    src/validate.c \
     src/value.c
 
 LOCAL_C_INCLUDES += \
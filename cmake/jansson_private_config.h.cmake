@@ -2,21 +2,32 @@
 #cmakedefine HAVE_FCNTL_H 1
 #cmakedefine HAVE_SCHED_H 1
 #cmakedefine HAVE_UNISTD_H 1
+#cmakedefine HAVE_SYS_MMAN_H 1
 #cmakedefine HAVE_SYS_PARAM_H 1
+#cmakedefine HAVE_SYS_RESOURCE_H 1
 #cmakedefine HAVE_SYS_STAT_H 1
 #cmakedefine HAVE_SYS_TIME_H 1
 #cmakedefine HAVE_SYS_TYPES_H 1
+#cmakedefine HAVE_SYS_UIO_H 1
 #cmakedefine HAVE_STDINT_H 1
 
 #cmakedefine HAVE_CLOSE 1
 #cmakedefine HAVE_GETPID 1
+#cmakedefine HAVE_GETRUSAGE 1
 #cmakedefine HAVE_GETTIMEOFDAY 1
+#cmakedefine HAVE_MADVISE 1
+#cmakedefine HAVE_MMAP 1
 #cmakedefine HAVE_OPEN 1
 #cmakedefine HAVE_READ 1
 #cmakedefine HAVE_SCHED_YIELD 1
+#cmakedefine HAVE_WRITEV 1
 
 #cmakedefine HAVE_SYNC_BUILTINS 1
 #cmakedefine HAVE_ATOMIC_BUILTINS 1
+#cmakedefine HAVE_AVX2_DISPATCH 1
+#cmakedefine HAVE_PTHREAD 1
+
+#cmakedefine JSON_THREAD_LOCAL @JSON_THREAD_LOCAL@
 
 #cmakedefine HAVE_LOCALE_H 1
 #cmakedefine HAVE_SETLOCALE 1
@@ -52,6 +63,10 @@
 #cmakedefine USE_URANDOM 1
 #cmakedefine USE_WINDOWS_CRYPTOAPI 1
 
+#cmakedefine USE_WYHASH 1
+
+#cmakedefine USE_STATS 1
+
 #cmakedefine USE_DTOA 1
 #if USE_DTOA
 #  define DTOA_ENABLED 1
@@ -60,3 +75,5 @@
 #endif
 
 #define INITIAL_HASHTABLE_ORDER @JANSSON_INITIAL_HASHTABLE_ORDER@
+
+#define DUMP_BUFFER_SIZE @JANSSON_DUMP_BUFFER_SIZE@
@@ -0,0 +1,724 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "jansson.h"
+#include "jansson_private.h"
+#include "thread.h"
+
+/* Objects from json_object_concurrent(). Their members are kept in the
+   hashtable like those of any object, and also in an index that
+   readers search without taking a lock. Writers take the object's lock
+   and update both.
+
+   The index is an open addressing table of pointers to nodes. A node
+   has a key, which never changes, and a reference to a value, which is
+   replaced atomically. A slot goes from empty to a node to deleted and
+   never back, so a reader probing the table while a writer changes it
+   sees each slot either before or after the change.
+
+   A table that gets full is replaced by a larger one incrementally:
+   the new table refers back to the old one, and each write moves a few
+   nodes over. No node is added to the old table after that, so a
+   reader that looks at the old table first and at the new one after it
+   finds every member that exists for the whole lookup.
+
+   Whatever a writer replaces or removes is retired instead of being
+   released, because readers may still be looking at it. It's released
+   once that's no longer possible, which is decided with epochs: a
+   thread reading notes the global epoch when it starts, and the epoch
+   is only advanced when all threads that are reading have noted it.
+   Two epochs after something was retired, no reader can see it. */
+
+#if defined(JSON_THREAD_LOCAL) && (JSON_HAVE_ATOMIC_BUILTINS || JSON_HAVE_SYNC_BUILTINS)
+#define HAVE_CONCURRENT 1
+
+#if JSON_HAVE_ATOMIC_BUILTINS
+#define load_acquire(ptr_)        __atomic_load_n(ptr_, __ATOMIC_ACQUIRE)
+#define store_release(ptr_, val_) __atomic_store_n(ptr_, val_, __ATOMIC_RELEASE)
+#define full_fence()              __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define atomic_inc(ptr_)          __atomic_add_fetch(ptr_, 1, __ATOMIC_SEQ_CST)
+#define atomic_dec(ptr_)          __atomic_sub_fetch(ptr_, 1, __ATOMIC_RELEASE)
+#define readers_lock()   while (__atomic_test_and_set(&readers_spin, __ATOMIC_ACQUIRE))
+#define readers_unlock() __atomic_clear(&readers_spin, __ATOMIC_RELEASE)
+#else
+#define load_acquire(ptr_)        __sync_fetch_and_add(ptr_, 0)
+#define store_release(ptr_, val_) (__sync_synchronize(), (void)(*(ptr_) = (val_)))
+#define full_fence()              __sync_synchronize()
+#define atomic_inc(ptr_)          __sync_add_and_fetch(ptr_, 1)
+#define atomic_dec(ptr_)          __sync_sub_and_fetch(ptr_, 1)
+#define readers_lock()   while (__sync_lock_test_and_set(&readers_spin, 1))
+#define readers_unlock() __sync_lock_release(&readers_spin)
+#endif
+
+#else
+/* Without thread-local storage and atomic operations, concurrent
+   objects can't be created, and there are no readers to wait for */
+#define HAVE_CONCURRENT 0
+
+#define load_acquire(ptr_)        (*(ptr_))
+#define store_release(ptr_, val_) ((void)(*(ptr_) = (val_)))
+#define full_fence()              ((void)0)
+#endif
+
+#define MIN_ORDER     3  /* an empty index has 8 slots */
+#define MIGRATE_STEP  64 /* slots of the old table moved by each write */
+#define RECLAIM_BATCH 16 /* retired items that make a write try to release them */
+
+struct cnode {
+    json_t *volatile value; /* a reference of the index's own */
+    size_t key_len;
+    char key[1];
+};
+
+struct cslot {
+    size_t hash;
+    struct cnode *volatile node; /* NULL if empty, or DELETED */
+};
+
+struct ctable {
+    struct ctable *volatile old; /* being moved to this one, or NULL */
+    size_t order;                /* the table has pow(2, order) slots */
+    size_t used;                 /* slots that aren't empty */
+    struct cslot slots[1];
+};
+
+/* The kinds of retired items, and how they are released */
+#define RETIRED_VALUE    0 /* decref'd */
+#define RETIRED_NODE     1 /* freed with its value */
+#define RETIRED_TABLE    2 /* freed, but not its nodes */
+#define RETIRED_CONTENTS 3 /* freed with its nodes */
+
+struct retired {
+    void *ptr;
+    size_t epoch; /* when it was retired */
+    int kind;
+};
+
+struct jsonp_concurrent {
+    jsonp_mutex_t lock; /* taken by writers */
+    struct ctable *volatile table;
+    volatile size_t size;
+    size_t migrated; /* the slots of table->old that have been moved */
+    struct retired *retired;
+    size_t nretired;
+    size_t retired_size;
+};
+
+static struct cnode deleted_node;
+#define DELETED (&deleted_node)
+
+#define table_slots(table_) ((size_t)1 << (table_)->order)
+
+/* Whether a node can't be added without making the table too slow */
+#define table_full(table_) ((table_)->used + 1 > table_slots(table_) / 2)
+
+/*** epochs ***/
+
+#if HAVE_CONCURRENT
+
+/* The state of a thread that reads concurrent objects. Like the blocks
+   of statistics in stats.c, they are kept on a list and never freed,
+   and the block of a thread that exits is reused by the next new one.
+   Each is allocated with room to spare, so that threads entering and
+   leaving don't write to each other's cache lines. */
+struct reader {
+    volatile size_t epoch; /* the epoch it started reading in, 0 if not reading */
+    struct reader *next;
+    int in_use;
+};
+
+#define READER_BLOCK_SIZE 128
+
+static JSON_THREAD_LOCAL struct reader *current_reader = NULL;
+static JSON_THREAD_LOCAL size_t read_depth = 0;
+
+static struct reader *readers = NULL;
+static volatile char readers_spin = 0;
+static volatile size_t global_epoch = 1;
+
+/* The threads reading without a block, because it couldn't be
+   allocated. While there are any, the epoch isn't advanced. */
+static volatile size_t lost_readers = 0;
+
+/* C89 allows this to be a macro */
+#undef malloc
+
+#ifdef HAVE_PTHREAD
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+static int have_exit_key = 0;
+
+/* Called when a thread that has a block exits */
+static void release_reader(void *reader) {
+    readers_lock();
+    store_release(&((struct reader *)reader)->epoch, 0);
+    ((struct reader *)reader)->in_use = 0;
+    readers_unlock();
+    current_reader = NULL;
+}
+
+static void create_exit_key(void) {
+    have_exit_key = !pthread_key_create(&exit_key, release_reader);
+}
+#endif
+
+static struct reader *reader_register(void) {
+    struct reader *reader;
+
+    readers_lock();
+    for (reader = readers; reader; reader = reader->next) {
+        if (!reader->in_use)
+            break;
+    }
+    if (!reader) {
+        /* it must not come from an arena, and it's never freed, like
+           the blocks of statistics */
+        reader = malloc(READER_BLOCK_SIZE);
+        if (reader) {
+            memset(reader, 0, sizeof(struct reader));
+            reader->next = readers;
+            readers = reader;
+        }
+    }
+    if (reader)
+        reader->in_use = 1;
+    readers_unlock();
+
+    if (!reader)
+        return NULL;
+
+#ifdef HAVE_PTHREAD
+    pthread_once(&exit_key_once, create_exit_key);
+    if (have_exit_key)
+        pthread_setspecific(exit_key, reader);
+#endif
+
+    current_reader = reader;
+    return reader;
+}
+
+void json_concurrent_enter(void) {
+    struct reader *reader;
+
+    if (read_depth++)
+        return;
+
+    reader = current_reader ? current_reader : reader_register();
+    if (reader)
+        store_release(&reader->epoch, load_acquire(&global_epoch));
+    else
+        atomic_inc(&lost_readers);
+
+    /* the epoch must be seen by writers before anything is read */
+    full_fence();
+}
+
+void json_concurrent_leave(void) {
+    if (!read_depth || --read_depth)
+        return;
+
+    if (current_reader)
+        store_release(&current_reader->epoch, 0);
+    else
+        atomic_dec(&lost_readers);
+}
+
+/* Advance the global epoch if all threads that are reading have seen
+   it, and return the global epoch */
+static size_t epoch_advance(void) {
+    struct reader *reader;
+    size_t epoch;
+
+    full_fence();
+    readers_lock();
+    epoch = global_epoch;
+    if (!load_acquire(&lost_readers)) {
+        for (reader = readers; reader; reader = reader->next) {
+            size_t seen = load_acquire(&reader->epoch);
+            if (seen && seen != epoch)
+                break;
+        }
+        if (!reader)
+            store_release(&global_epoch, ++epoch);
+    }
+    readers_unlock();
+    return epoch;
+}
+
+static size_t epoch_current(void) {
+    /* what was unlinked must be seen before the epoch is read */
+    full_fence();
+    return load_acquire(&global_epoch);
+}
+
+#else
+
+void json_concurrent_enter(void) {}
+void json_concurrent_leave(void) {}
+
+static size_t epoch_advance(void) { return (size_t)-1; }
+static size_t epoch_current(void) { return 0; }
+
+#endif /* HAVE_CONCURRENT */
+
+/*** the index ***/
+
+static struct ctable *table_new(size_t order) {
+    struct ctable *table;
+    size_t slots;
+
+    if (order >= sizeof(size_t) * 8 - 5)
+        return NULL;
+
+    slots = (size_t)1 << order;
+    table = jsonp_malloc(offsetof(struct ctable, slots) + slots * sizeof(struct cslot));
+    if (!table)
+        return NULL;
+
+    table->old = NULL;
+    table->order = order;
+    table->used = 0;
+    memset(table->slots, 0, slots * sizeof(struct cslot));
+    return table;
+}
+
+static struct cnode *node_new(const char *key, size_t key_len) {
+    struct cnode *node;
+
+    if (key_len >= (size_t)-1 - offsetof(struct cnode, key))
+        return NULL;
+
+    node = jsonp_malloc(offsetof(struct cnode, key) + key_len + 1);
+    if (!node)
+        return NULL;
+
+    node->value = NULL;
+    node->key_len = key_len;
+    memcpy(node->key, key, key_len);
+    node->key[key_len] = '\0';
+    return node;
+}
+
+static void node_free(struct cnode *node) {
+    json_decref(node->value);
+    jsonp_free(node);
+}
+
+static void table_free_nodes(struct ctable *table) {
+    size_t i;
+
+    for (i = 0; i < table_slots(table); i++) {
+        struct cnode *node = table->slots[i].node;
+        if (node && node != DELETED)
+            node_free(node);
+    }
+}
+
+/* Find the slot of key in table, or return NULL. *node is set to the
+   node in it, or NULL. Readers may call this. */
+static struct cslot *table_find(struct ctable *table, const char *key, size_t key_len,
+                                size_t hash, struct cnode **node) {
+    size_t mask = table_slots(table) - 1, i = hash & mask;
+
+    while (1) {
+        struct cslot *slot = &table->slots[i];
+        struct cnode *n = load_acquire(&slot->node);
+
+        if (!n)
+            break;
+        if (n != DELETED && slot->hash == hash && n->key_len == key_len &&
+            !memcmp(n->key, key, key_len)) {
+            *node = n;
+            return slot;
+        }
+        i = (i + 1) & mask;
+    }
+
+    *node = NULL;
+    return NULL;
+}
+
+/* Add a node whose key isn't in table. Readers see it at once. */
+static void table_insert(struct ctable *table, struct cnode *node, size_t hash) {
+    size_t mask = table_slots(table) - 1, i = hash & mask;
+
+    while (table->slots[i].node)
+        i = (i + 1) & mask;
+
+    table->slots[i].hash = hash;
+    store_release(&table->slots[i].node, node);
+    table->used++;
+}
+
+/* Find the node of key in the current or the old table */
+static struct cnode *index_find(jsonp_concurrent_t *cc, const char *key, size_t key_len,
+                                size_t hash) {
+    struct cnode *node;
+
+    table_find(cc->table, key, key_len, hash, &node);
+    if (!node && cc->table->old)
+        table_find(cc->table->old, key, key_len, hash, &node);
+    return node;
+}
+
+/* Move up to count slots of the old table to the current one. Returns
+   the old table if it's done with, or NULL. */
+static struct ctable *migrate(jsonp_concurrent_t *cc, size_t count) {
+    struct ctable *table = cc->table, *old = table->old;
+    size_t end;
+
+    if (!old)
+        return NULL;
+
+    end = table_slots(old) - cc->migrated > count ? cc->migrated + count
+                                                  : table_slots(old);
+    for (; cc->migrated < end; cc->migrated++) {
+        struct cslot *slot = &old->slots[cc->migrated];
+        if (slot->node && slot->node != DELETED)
+            table_insert(table, slot->node, slot->hash);
+    }
+
+    if (cc->migrated < table_slots(old))
+        return NULL;
+
+    store_release(&table->old, NULL);
+    return old;
+}
+
+/* Make room for count retired items, so that a write doesn't fail
+   halfway */
+static int retired_reserve(jsonp_concurrent_t *cc, size_t count) {
+    struct retired *retired;
+    size_t size;
+
+    if (cc->nretired + count <= cc->retired_size)
+        return 0;
+
+    size = max(cc->retired_size * 2, max(cc->nretired + count, RECLAIM_BATCH * 2));
+    retired = jsonp_malloc(size * sizeof(struct retired));
+    if (!retired)
+        return -1;
+
+    if (cc->nretired)
+        memcpy(retired, cc->retired, cc->nretired * sizeof(struct retired));
+    jsonp_free(cc->retired);
+    cc->retired = retired;
+    cc->retired_size = size;
+    return 0;
+}
+
+/* Release ptr once no reader can see it. There must be room for it. */
+static void retire(jsonp_concurrent_t *cc, void *ptr, int kind) {
+    struct retired *retired = &cc->retired[cc->nretired++];
+
+    retired->ptr = ptr;
+    retired->kind = kind;
+    retired->epoch = epoch_current();
+}
+
+static void release(struct retired *retired) {
+    switch (retired->kind) {
+        case RETIRED_VALUE:
+            json_decref((json_t *)retired->ptr);
+            break;
+        case RETIRED_NODE:
+            node_free(retired->ptr);
+            break;
+        case RETIRED_CONTENTS:
+            table_free_nodes(retired->ptr);
+            jsonp_free(retired->ptr);
+            break;
+        default:
+            jsonp_free(retired->ptr);
+            break;
+    }
+}
+
+/* Release the retired items that no reader can see any more */
+static void reclaim(jsonp_concurrent_t *cc) {
+    size_t epoch, i, kept = 0;
+
+    if (cc->nretired < RECLAIM_BATCH)
+        return;
+
+    epoch = epoch_advance();
+    for (i = 0; i < cc->nretired; i++) {
+        if (cc->retired[i].epoch + 2 <= epoch)
+            release(&cc->retired[i]);
+        else
+            cc->retired[kept++] = cc->retired[i];
+    }
+    cc->nretired = kept;
+}
+
+/* Finish moving to the current table, if that's in progress */
+static void migrate_all(jsonp_concurrent_t *cc) {
+    struct ctable *old = migrate(cc, (size_t)-1);
+    if (old)
+        retire(cc, old, RETIRED_TABLE);
+}
+
+/* Start moving to a new table of at least slots slots. Needs room for
+   one retired item. */
+static int index_grow(jsonp_concurrent_t *cc, size_t slots) {
+    struct ctable *table;
+    size_t order = MIN_ORDER;
+
+    while (((size_t)1 << order) < slots) {
+        if (++order >= sizeof(size_t) * 8 - 5)
+            return -1;
+    }
+
+    table = table_new(order);
+    if (!table)
+        return -1;
+
+    /* one move at a time */
+    migrate_all(cc);
+
+    table->old = cc->table;
+    cc->migrated = 0;
+    store_release(&cc->table, table);
+    return 0;
+}
+
+/*** concurrent objects ***/
+
+int jsonp_concurrent_init(json_object_t *object) {
+#if HAVE_CONCURRENT
+    jsonp_concurrent_t *cc;
+
+    if (!jsonp_extra_get(&object->json))
+        return -1;
+
+    cc = jsonp_malloc(sizeof(jsonp_concurrent_t));
+    if (!cc)
+        return -1;
+
+    cc->table = table_new(MIN_ORDER);
+    if (!cc->table || jsonp_mutex_init(&cc->lock)) {
+        jsonp_free(cc->table);
+        jsonp_free(cc);
+        return -1;
+    }
+
+    cc->size = 0;
+    cc->migrated = 0;
+    cc->retired = NULL;
+    cc->nretired = 0;
+    cc->retired_size = 0;
+
+    object->extra->concurrent = cc;
+    return 0;
+#else
+    (void)object;
+    return -1;
+#endif
+}
+
+void jsonp_concurrent_close(json_object_t *object) {
+    jsonp_concurrent_t *cc = object->extra->concurrent;
+    size_t i;
+
+    /* nobody refers to the object any more, so nobody reads it */
+    for (i = 0; i < cc->nretired; i++)
+        release(&cc->retired[i]);
+    jsonp_free(migrate(cc, (size_t)-1));
+    table_free_nodes(cc->table);
+    jsonp_free(cc->table);
+
+    jsonp_free(cc->retired);
+    jsonp_mutex_destroy(&cc->lock);
+    jsonp_free(cc);
+    object->extra->concurrent = NULL;
+}
+
+void jsonp_concurrent_lock(const json_object_t *object) {
+    jsonp_mutex_lock(&object->extra->concurrent->lock);
+}
+
+void jsonp_concurrent_unlock(const json_object_t *object) {
+    jsonp_mutex_unlock(&object->extra->concurrent->lock);
+}
+
+size_t jsonp_concurrent_size(const json_object_t *object) {
+    return load_acquire(&object->extra->concurrent->size);
+}
+
+json_t *jsonp_concurrent_get(const json_object_t *object, const char *key,
+                             size_t key_len, size_t hash) {
+    jsonp_concurrent_t *cc = object->extra->concurrent;
+    struct ctable *table, *old;
+    struct cnode *node = NULL;
+    json_t *value = NULL;
+
+    json_concurrent_enter();
+
+    table = load_acquire(&cc->table);
+    old = load_acquire(&table->old);
+    if (old)
+        table_find(old, key, key_len, hash, &node);
+    if (!node)
+        table_find(table, key, key_len, hash, &node);
+    if (node)
+        value = load_acquire(&node->value);
+
+    json_concurrent_leave();
+    return value;
+}
+
+int jsonp_concurrent_set(json_object_t *object, const char *key, size_t key_len,
+                         int shared, json_t *value) {
+    jsonp_concurrent_t *cc = object->extra->concurrent;
+    struct cnode *node, *added = NULL;
+    size_t hash = shared ? hashtable_shared_key(key)->hash : hashtable_hash(key, key_len);
+    struct ctable *old;
+    int rv;
+
+    jsonp_mutex_lock(&cc->lock);
+
+    /* a replaced value and up to two tables */
+    if (retired_reserve(cc, 3))
+        goto failed;
+
+    old = migrate(cc, MIGRATE_STEP);
+    if (old)
+        retire(cc, old, RETIRED_TABLE);
+
+    node = index_find(cc, key, key_len, hash);
+    if (!node) {
+        if (table_full(cc->table) && index_grow(cc, 4 * (cc->size + 1)))
+            goto failed;
+        added = node_new(key, key_len);
+        if (!added)
+            goto failed;
+    }
+
+    if (shared)
+        rv = hashtable_set_shared(&object->hashtable, key, value);
+    else
+        rv = hashtable_set(&object->hashtable, key, key_len, value);
+    if (rv) {
+        jsonp_free(added);
+        goto failed;
+    }
+
+    json_incref(value);
+    if (added) {
+        added->value = value;
+        table_insert(cc->table, added, hash);
+        store_release(&cc->size, cc->size + 1);
+    } else {
+        json_t *replaced = node->value;
+        store_release(&node->value, value);
+        retire(cc, replaced, RETIRED_VALUE);
+    }
+
+    reclaim(cc);
+    jsonp_mutex_unlock(&cc->lock);
+    return 0;
+
+failed:
+    jsonp_mutex_unlock(&cc->lock);
+    json_decref(value);
+    return -1;
+}
+
+int jsonp_concurrent_del(json_object_t *object, const char *key, size_t key_len) {
+    jsonp_concurrent_t *cc = object->extra->concurrent;
+    struct cslot *slot;
+    struct cnode *node, *old_node = NULL;
+    size_t hash = hashtable_hash(key, key_len);
+    struct ctable *old;
+
+    jsonp_mutex_lock(&cc->lock);
+
+    /* the node and a table */
+    if (retired_reserve(cc, 2)) {
+        jsonp_mutex_unlock(&cc->lock);
+        return -1;
+    }
+
+    old = migrate(cc, MIGRATE_STEP);
+    if (old)
+        retire(cc, old, RETIRED_TABLE);
+
+    /* readers look at the old table first, so the node is removed from
+       it last */
+    slot = table_find(cc->table, key, key_len, hash, &node);
+    if (slot)
+        store_release(&slot->node, DELETED);
+    if (cc->table->old) {
+        slot = table_find(cc->table->old, key, key_len, hash, &old_node);
+        if (slot)
+            store_release(&slot->node, DELETED);
+    }
+    if (!node)
+        node = old_node;
+
+    if (!node) {
+        jsonp_mutex_unlock(&cc->lock);
+        return -1;
+    }
+
+    hashtable_del(&object->hashtable, key, key_len);
+    store_release(&cc->size, cc->size - 1);
+    retire(cc, node, RETIRED_NODE);
+
+    reclaim(cc);
+    jsonp_mutex_unlock(&cc->lock);
+    return 0;
+}
+
+int jsonp_concurrent_clear(json_object_t *object) {
+    jsonp_concurrent_t *cc = object->extra->concurrent;
+    struct ctable *table, *cleared;
+
+    jsonp_mutex_lock(&cc->lock);
+
+    /* two tables */
+    table = retired_reserve(cc, 2) ? NULL : table_new(MIN_ORDER);
+    if (!table) {
+        jsonp_mutex_unlock(&cc->lock);
+        return -1;
+    }
+
+    migrate_all(cc);
+    cleared = cc->table;
+    store_release(&cc->table, table);
+    store_release(&cc->size, 0);
+    retire(cc, cleared, RETIRED_CONTENTS);
+    hashtable_clear(&object->hashtable);
+
+    reclaim(cc);
+    jsonp_mutex_unlock(&cc->lock);
+    return 0;
+}
+
+int jsonp_concurrent_reserve(json_object_t *object, size_t capacity) {
+    jsonp_concurrent_t *cc = object->extra->concurrent;
+    int rv = 0;
+
+    if (capacity > (size_t)-1 / 8)
+        return -1;
+
+    jsonp_mutex_lock(&cc->lock);
+
+    /* up to two tables */
+    if (retired_reserve(cc, 2))
+        rv = -1;
+    else if (capacity >= table_slots(cc->table) / 2)
+        rv = index_grow(cc, 2 * capacity + 2);
+    if (!rv)
+        rv = hashtable_reserve(&object->hashtable, capacity);
+
+    jsonp_mutex_unlock(&cc->lock);
+    return rv;
+}
@@ -12,43 +12,45 @@
 #include "jansson_private.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <float.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
 
 #include "jansson.h"
 #include "strbuffer.h"
+#include "thread.h"
 #include "utf.h"
 
 #define MAX_INTEGER_STR_LENGTH 25
 #define MAX_REAL_STR_LENGTH    25
 
+#ifndef DUMP_BUFFER_SIZE
+#define DUMP_BUFFER_SIZE 4096
+#endif
+
+/* json_dumpv() refers to runs of text at least this long instead of
+   copying them */
+#ifndef DUMPV_MIN_REFERENCE
+#define DUMPV_MIN_REFERENCE 256
+#endif
+
 #define FLAGS_TO_INDENT(f)    ((f)&0x1F)
 #define FLAGS_TO_PRECISION(f) (((f) >> 11) & 0x1F)
 
-struct buffer {
-    const size_t size;
-    size_t used;
-    char *data;
-};
+#define BINARY_FLAGS (JSON_ENCODE_CBOR | JSON_ENCODE_MSGPACK)
 
 static int dump_to_strbuffer(const char *buffer, size_t size, void *data) {
     return strbuffer_append_bytes((strbuffer_t *)data, buffer, size);
 }
 
-static int dump_to_buffer(const char *buffer, size_t size, void *data) {
-    struct buffer *buf = (struct buffer *)data;
-
-    if (buf->used + size <= buf->size)
-        memcpy(&buf->data[buf->used], buffer, size);
-
-    buf->used += size;
-    return 0;
-}
-
 static int dump_to_file(const char *buffer, size_t size, void *data) {
     FILE *dest = (FILE *)data;
     if (fwrite(buffer, size, 1, dest) != 1)
@@ -65,38 +67,167 @@ static int dump_to_fd(const char *buffer, size_t size, void *data) {
     return -1;
 }
 
+/* The output of do_dump() is gathered in a buffer and passed to the
+   callback in blocks of up to DUMP_BUFFER_SIZE bytes, instead of one
+   callback per token. Without a buffer, writes go straight to the
+   callback.
+
+   A sink without a callback writes in place: the output goes directly
+   to the buffer, and whatever doesn't fit is only counted in
+   overflow. With no buffer at all this measures the output.
+
+   A gathering sink is the sink of json_dumpv(): its callback copies
+   the output to the scratch buffer, and sink_write_ref() adds long
+   runs of text that outlive the dump as segments of their own. */
+struct dump_sink {
+    json_dump_callback_t dump;
+    void *data;
+    char *buffer;
+    size_t size;
+    size_t used;
+    size_t overflow;
+    size_t written; /* passed to the callback */
+    json_dumpv_t *gather;
+};
+
+struct json_dumpv {
+    strbuffer_t scratch;
+    json_iovec_t *iov;
+    size_t count;
+    size_t capacity;
+    size_t size;
+};
+
+/* Add a segment to the output of json_dumpv(). Segments with a NULL
+   base are in the scratch buffer, which may still move, and adjacent
+   ones are merged. */
+static int gather_segment(json_dumpv_t *dv, const char *base, size_t len) {
+    if (!len)
+        return 0;
+
+    if (!base && dv->count && !dv->iov[dv->count - 1].base) {
+        dv->iov[dv->count - 1].len += len;
+        return 0;
+    }
+
+    if (dv->count == dv->capacity) {
+        size_t capacity = dv->capacity ? dv->capacity * 2 : 16;
+        json_iovec_t *iov;
+
+        if (capacity > (size_t)-1 / sizeof(json_iovec_t))
+            return -1;
+        iov = jsonp_malloc(capacity * sizeof(json_iovec_t));
+        if (!iov)
+            return -1;
+        if (dv->count)
+            memcpy(iov, dv->iov, dv->count * sizeof(json_iovec_t));
+        jsonp_free(dv->iov);
+        dv->iov = iov;
+        dv->capacity = capacity;
+    }
+
+    dv->iov[dv->count].base = base;
+    dv->iov[dv->count].len = len;
+    dv->count++;
+    return 0;
+}
+
+static int dump_to_gather(const char *buffer, size_t size, void *data) {
+    json_dumpv_t *dv = (json_dumpv_t *)data;
+
+    if (strbuffer_append_bytes(&dv->scratch, buffer, size))
+        return -1;
+    return gather_segment(dv, NULL, size);
+}
+
+static int sink_flush(struct dump_sink *sink) {
+    if (sink->used && sink->dump) {
+        if (sink->dump(sink->buffer, sink->used, sink->data))
+            return -1;
+        sink->written += sink->used;
+        sink->used = 0;
+    }
+    return 0;
+}
+
+static int sink_write_slow(struct dump_sink *sink, const char *text, size_t len) {
+    if (!sink->dump) {
+        if (len <= sink->size - sink->used) {
+            memcpy(sink->buffer + sink->used, text, len);
+            sink->used += len;
+        } else {
+            /* Stop writing at the first token that doesn't fit */
+            sink->overflow += len;
+            sink->size = sink->used;
+        }
+        return 0;
+    }
+
+    if (sink_flush(sink))
+        return -1;
+
+    if (len >= sink->size) {
+        sink->written += len;
+        return sink->dump(text, len, sink->data);
+    }
+
+    memcpy(sink->buffer, text, len);
+    sink->used = len;
+    return 0;
+}
+
+static JSON_INLINE int sink_write(struct dump_sink *sink, const char *text, size_t len) {
+    if (len < sink->size - sink->used) {
+        memcpy(sink->buffer + sink->used, text, len);
+        sink->used += len;
+        return 0;
+    }
+    return sink_write_slow(sink, text, len);
+}
+
+/* Write text that stays valid as long as the value being dumped */
+static int sink_write_ref(struct dump_sink *sink, const char *text, size_t len) {
+    if (!sink->gather || len < DUMPV_MIN_REFERENCE)
+        return sink_write(sink, text, len);
+
+    if (sink_flush(sink) || gather_segment(sink->gather, text, len))
+        return -1;
+    sink->written += len;
+    return 0;
+}
+
 /* 32 spaces (the maximum indentation size) */
 static const char whitespace[] = "                                ";
 
-static int dump_indent(size_t flags, int depth, int space, json_dump_callback_t dump,
-                       void *data) {
+static int dump_indent(size_t flags, int depth, int space, struct dump_sink *sink) {
     if (FLAGS_TO_INDENT(flags) > 0) {
         unsigned int ws_count = FLAGS_TO_INDENT(flags), n_spaces = depth * ws_count;
 
-        if (dump("\n", 1, data))
+        if (sink_write(sink, "\n", 1))
             return -1;
 
         while (n_spaces > 0) {
             int cur_n =
                 n_spaces < sizeof whitespace - 1 ? n_spaces : sizeof whitespace - 1;
 
-            if (dump(whitespace, cur_n, data))
+            if (sink_write(sink, whitespace, cur_n))
                 return -1;
 
             n_spaces -= cur_n;
         }
     } else if (space && !(flags & JSON_COMPACT)) {
-        return dump(" ", 1, data);
+        return sink_write(sink, " ", 1);
     }
     return 0;
 }
 
-static int dump_string(const char *str, size_t len, json_dump_callback_t dump, void *data,
+static int dump_string(const char *str, size_t len, struct dump_sink *sink,
                        size_t flags) {
     const char *pos, *end, *lim;
     int32_t codepoint = 0;
+    int plain = (flags & JSON_ESCAPE_SLASH) ? UTF8_PLAIN_SLASH : 0;
 
-    if (dump("\"", 1, data))
+    if (sink_write(sink, "\"", 1))
         return -1;
 
     end = pos = str;
@@ -107,6 +238,21 @@ static int dump_string(const char *str, size_t len, json_dump_callback_t dump, v
         int length;
 
         while (end < lim) {
+            /* skip runs of characters that never need escaping */
+            pos += utf8_plain_prefix(pos, lim - pos, plain);
+            end = pos;
+            if (pos == lim)
+                break;
+
+            if (!(flags & JSON_ENSURE_ASCII) && (unsigned char)*pos >= 0x80) {
+                /* validate a whole run of UTF-8 text at once */
+                size_t n = utf8_plain_prefix(pos, lim - pos, plain | UTF8_PLAIN_UTF8);
+                if (!utf8_check_string(pos, n))
+                    return -1;
+                end = pos = pos + n;
+                continue;
+            }
+
             end = utf8_iterate(pos, lim - pos, &codepoint);
             if (!end)
                 return -1;
@@ -127,7 +273,7 @@ static int dump_string(const char *str, size_t len, json_dump_callback_t dump, v
         }
 
         if (pos != str) {
-            if (dump(str, pos - str, data))
+            if (sink_write_ref(sink, str, pos - str))
                 return -1;
         }
 
@@ -186,305 +332,1626 @@ static int dump_string(const char *str, size_t len, json_dump_callback_t dump, v
             }
         }
 
-        if (dump(text, length, data))
+        if (sink_write(sink, text, length))
             return -1;
 
         str = pos = end;
     }
 
-    return dump("\"", 1, data);
+    return sink_write(sink, "\"", 1);
 }
 
-struct key_len {
-    const char *key;
-    int len;
-};
+static int dump_integer(json_int_t value, struct dump_sink *sink) {
+    char buffer[MAX_INTEGER_STR_LENGTH];
+    int size;
 
-static int compare_keys(const void *key1, const void *key2) {
-    const struct key_len *k1 = key1;
-    const struct key_len *k2 = key2;
-    const size_t min_size = k1->len < k2->len ? k1->len : k2->len;
-    int res = memcmp(k1->key, k2->key, min_size);
+    size = jsonp_itostr(buffer, MAX_INTEGER_STR_LENGTH, value);
+    if (size < 0)
+        return -1;
 
-    if (res)
-        return res;
+    return sink_write(sink, buffer, size);
+}
 
-    return k1->len - k2->len;
+static int dump_real(double value, size_t flags, struct dump_sink *sink) {
+    char buffer[MAX_REAL_STR_LENGTH];
+    int size;
+
+    size = jsonp_dtostr(buffer, MAX_REAL_STR_LENGTH, value, FLAGS_TO_PRECISION(flags));
+    if (size < 0)
+        return -1;
+
+    return sink_write(sink, buffer, size);
 }
 
-static int do_dump(const json_t *json, size_t flags, int depth, hashtable_t *parents,
-                   json_dump_callback_t dump, void *data) {
-    int embed = flags & JSON_EMBED;
+/*** CBOR and MessagePack ***/
 
-    flags &= ~JSON_EMBED;
+/* The kinds of heads that precede the data of binary items */
+enum binary_head { HEAD_UINT, HEAD_NEGINT, HEAD_STRING, HEAD_ARRAY, HEAD_OBJECT };
 
-    if (!json)
+/* Write the byte prefix followed by value as a size-byte big-endian
+   number */
+static int dump_big_endian(int prefix, uint64_t value, size_t size,
+                           struct dump_sink *sink) {
+    char buffer[9];
+    size_t i;
+
+    buffer[0] = (char)prefix;
+    for (i = size; i > 0; i--) {
+        buffer[i] = (char)(value & 0xFF);
+        value >>= 8;
+    }
+    return sink_write(sink, buffer, size + 1);
+}
+
+/* The head of a CBOR data item (RFC 8949, section 3) is its major type
+   and an argument of 0 to 8 bytes */
+static int dump_cbor_head(int kind, uint64_t value, struct dump_sink *sink) {
+    static const int majors[] = {0, 1, 3, 4, 5};
+    int major = majors[kind] << 5;
+
+    if (value < 24)
+        return dump_big_endian(major | (int)value, 0, 0, sink);
+    if (value <= 0xFF)
+        return dump_big_endian(major | 24, value, 1, sink);
+    if (value <= 0xFFFF)
+        return dump_big_endian(major | 25, value, 2, sink);
+    if (value <= 0xFFFFFFFF)
+        return dump_big_endian(major | 26, value, 4, sink);
+    return dump_big_endian(major | 27, value, 8, sink);
+}
+
+/* MessagePack has fixed-size formats for short strings and small
+   containers, whose length is in the first byte, and 16 and 32-bit
+   lengths otherwise */
+static int dump_msgpack_head(int kind, uint64_t value, struct dump_sink *sink) {
+    if (kind == HEAD_STRING) {
+        if (value < 32)
+            return dump_big_endian(0xA0 | (int)value, 0, 0, sink);
+        if (value <= 0xFF)
+            return dump_big_endian(0xD9, value, 1, sink);
+    } else if (value < 16)
+        return dump_big_endian((kind == HEAD_ARRAY ? 0x90 : 0x80) | (int)value, 0, 0,
+                               sink);
+
+    if (value <= 0xFFFF)
+        return dump_big_endian(kind == HEAD_STRING  ? 0xDA
+                               : kind == HEAD_ARRAY ? 0xDC
+                                                    : 0xDE,
+                               value, 2, sink);
+    if (value <= 0xFFFFFFFF)
+        return dump_big_endian(kind == HEAD_STRING  ? 0xDB
+                               : kind == HEAD_ARRAY ? 0xDD
+                                                    : 0xDF,
+                               value, 4, sink);
+    return -1;
+}
+
+static int dump_head(int kind, uint64_t value, size_t flags, struct dump_sink *sink) {
+    if (flags & JSON_ENCODE_CBOR)
+        return dump_cbor_head(kind, value, sink);
+    return dump_msgpack_head(kind, value, sink);
+}
+
+static int dump_binary_integer(json_int_t value, size_t flags, struct dump_sink *sink) {
+    uint64_t bits = (uint64_t)value;
+
+    if (flags & JSON_ENCODE_CBOR) {
+        /* a negative integer n is encoded as -1 - n */
+        if (value < 0)
+            return dump_cbor_head(HEAD_NEGINT, ~bits, sink);
+        return dump_cbor_head(HEAD_UINT, bits, sink);
+    }
+
+    /* MessagePack has unsigned formats for non-negative integers, and
+       the value of a format byte from 0xE0 up is a negative integer */
+    if (value >= 0) {
+        if (value < 128)
+            return dump_big_endian((int)value, 0, 0, sink);
+        if (bits <= 0xFF)
+            return dump_big_endian(0xCC, bits, 1, sink);
+        if (bits <= 0xFFFF)
+            return dump_big_endian(0xCD, bits, 2, sink);
+        if (bits <= 0xFFFFFFFF)
+            return dump_big_endian(0xCE, bits, 4, sink);
+        return dump_big_endian(0xCF, bits, 8, sink);
+    }
+    if (value >= -32)
+        return dump_big_endian((int)(bits & 0xFF), 0, 0, sink);
+    if (value >= -128)
+        return dump_big_endian(0xD0, bits, 1, sink);
+    if (value >= -32768)
+        return dump_big_endian(0xD1, bits, 2, sink);
+    if (value >= -2147483647 - 1)
+        return dump_big_endian(0xD2, bits, 4, sink);
+    return dump_big_endian(0xD3, bits, 8, sink);
+}
+
+/* Reals are written in single precision if that doesn't change them */
+static int dump_binary_real(double value, size_t flags, struct dump_sink *sink) {
+    int cbor = flags & JSON_ENCODE_CBOR;
+    union {
+        float value;
+        uint32_t bits;
+    } single;
+    union {
+        double value;
+        uint64_t bits;
+    } real;
+
+    if (value >= -FLT_MAX && value <= FLT_MAX) {
+        single.value = (float)value;
+        if ((double)single.value == value)
+            return dump_big_endian(cbor ? 0xFA : 0xCA, single.bits, 4, sink);
+    }
+
+    real.value = value;
+    return dump_big_endian(cbor ? 0xFB : 0xCB, real.bits, 8, sink);
+}
+
+static int dump_binary_string(const char *str, size_t len, size_t flags,
+                              struct dump_sink *sink) {
+    if (dump_head(HEAD_STRING, len, flags, sink))
         return -1;
+    return sink_write_ref(sink, str, len);
+}
+
+/* Write a value that isn't an object or an array */
+static int dump_binary_scalar(const json_t *json, size_t flags, struct dump_sink *sink) {
+    int cbor = flags & JSON_ENCODE_CBOR;
 
     switch (json_typeof(json)) {
         case JSON_NULL:
-            return dump("null", 4, data);
+            return dump_big_endian(cbor ? 0xF6 : 0xC0, 0, 0, sink);
 
         case JSON_TRUE:
-            return dump("true", 4, data);
+            return dump_big_endian(cbor ? 0xF5 : 0xC3, 0, 0, sink);
 
         case JSON_FALSE:
-            return dump("false", 5, data);
+            return dump_big_endian(cbor ? 0xF4 : 0xC2, 0, 0, sink);
 
-        case JSON_INTEGER: {
-            char buffer[MAX_INTEGER_STR_LENGTH];
-            int size;
+        case JSON_INTEGER:
+            return dump_binary_integer(json_integer_value(json), flags, sink);
 
-            size = snprintf(buffer, MAX_INTEGER_STR_LENGTH, "%" JSON_INTEGER_FORMAT,
-                            json_integer_value(json));
-            if (size < 0 || size >= MAX_INTEGER_STR_LENGTH)
-                return -1;
+        case JSON_REAL:
+            return dump_binary_real(json_real_value(json), flags, sink);
 
-            return dump(buffer, size, data);
-        }
+        case JSON_STRING:
+            return dump_binary_string(json_string_value(json), json_string_length(json),
+                                      flags, sink);
 
-        case JSON_REAL: {
-            char buffer[MAX_REAL_STR_LENGTH];
-            int size;
-            double value = json_real_value(json);
+        default:
+            /* not reached */
+            return -1;
+    }
+}
 
-            size = jsonp_dtostr(buffer, MAX_REAL_STR_LENGTH, value,
-                                FLAGS_TO_PRECISION(flags));
-            if (size < 0)
-                return -1;
+struct key_len {
+    const char *key;
+    int len;
+    json_t *value;
+};
 
-            return dump(buffer, size, data);
-        }
+/* Sorting the keys of an object takes an array of them. All objects
+   of a dump share one array: an object uses the entries after those
+   of the objects it's in, and gives them back when it's done. */
+struct dump_keys {
+    struct key_len *keys;
+    size_t size;
+    size_t used;
+};
 
-        case JSON_STRING:
-            return dump_string(json_string_value(json), json_string_length(json), dump,
-                               data, flags);
-
-        case JSON_ARRAY: {
-            size_t n;
-            size_t i;
-            /* Space for "0x", double the sizeof a pointer for the hex and a
-             * terminator. */
-            char key[2 + (sizeof(json) * 2) + 1];
-            size_t key_len;
-
-            /* detect circular references */
-            if (jsonp_loop_check(parents, json, key, sizeof(key), &key_len))
-                return -1;
+static void dump_keys_init(struct dump_keys *keys) {
+    keys->keys = NULL;
+    keys->size = 0;
+    keys->used = 0;
+}
 
-            n = json_array_size(json);
+static void dump_keys_close(struct dump_keys *keys) { jsonp_free(keys->keys); }
 
-            if (!embed && dump("[", 1, data))
-                return -1;
-            if (n == 0) {
-                hashtable_del(parents, key, key_len);
-                return embed ? 0 : dump("]", 1, data);
-            }
-            if (dump_indent(flags, depth + 1, 0, dump, data))
-                return -1;
+static int reserve_keys(struct dump_keys *keys, size_t n) {
+    struct key_len *new_keys;
+    size_t new_size;
 
-            for (i = 0; i < n; ++i) {
-                if (do_dump(json_array_get(json, i), flags, depth + 1, parents, dump,
-                            data))
-                    return -1;
+    if (n <= keys->size - keys->used)
+        return 0;
 
-                if (i < n - 1) {
-                    if (dump(",", 1, data) ||
-                        dump_indent(flags, depth + 1, 1, dump, data))
-                        return -1;
-                } else {
-                    if (dump_indent(flags, depth, 0, dump, data))
-                        return -1;
-                }
-            }
+    if (n > (size_t)-1 / 2 / sizeof(struct key_len) - keys->used)
+        return -1;
 
-            hashtable_del(parents, key, key_len);
-            return embed ? 0 : dump("]", 1, data);
-        }
+    new_size = keys->size ? keys->size : 16;
+    while (new_size - keys->used < n)
+        new_size *= 2;
 
-        case JSON_OBJECT: {
-            void *iter;
-            const char *separator;
-            int separator_length;
-            char loop_key[LOOP_KEY_LEN];
-            size_t loop_key_len;
-
-            if (flags & JSON_COMPACT) {
-                separator = ":";
-                separator_length = 1;
-            } else {
-                separator = ": ";
-                separator_length = 2;
-            }
+    new_keys = jsonp_malloc(new_size * sizeof(struct key_len));
+    if (!new_keys)
+        return -1;
 
-            /* detect circular references */
-            if (jsonp_loop_check(parents, json, loop_key, sizeof(loop_key),
-                                 &loop_key_len))
-                return -1;
+    if (keys->used)
+        memcpy(new_keys, keys->keys, keys->used * sizeof(struct key_len));
+    jsonp_free(keys->keys);
+    keys->keys = new_keys;
+    keys->size = new_size;
+    return 0;
+}
 
-            iter = json_object_iter((json_t *)json);
+/* The byte of a key at depth, plus one. The end of the key is 0, so
+   that a key sorts before the longer keys it's a prefix of. */
+#define key_byte(k, depth)                                                               \
+    ((depth) < (size_t)(k)->len ? (unsigned char)(k)->key[depth] + 1 : 0)
 
-            if (!embed && dump("{", 1, data))
-                return -1;
-            if (!iter) {
-                hashtable_del(parents, loop_key, loop_key_len);
-                return embed ? 0 : dump("}", 1, data);
-            }
-            if (dump_indent(flags, depth + 1, 0, dump, data))
-                return -1;
+/* Compare two keys whose first depth bytes are equal */
+static int compare_keys_at(const struct key_len *k1, const struct key_len *k2,
+                           size_t depth) {
+    const size_t min_size = k1->len < k2->len ? k1->len : k2->len;
+    int res = memcmp(k1->key + depth, k2->key + depth, min_size - depth);
 
-            if (flags & JSON_SORT_KEYS) {
-                struct key_len *keys;
-                size_t size, i;
+    if (res)
+        return res;
 
-                size = json_object_size(json);
-                keys = jsonp_malloc(size * sizeof(struct key_len));
-                if (!keys)
-                    return -1;
+    return k1->len - k2->len;
+}
 
-                i = 0;
-                while (iter) {
-                    struct key_len *keylen = &keys[i];
+static void swap_keys(struct key_len *k1, struct key_len *k2) {
+    struct key_len tmp = *k1;
+    *k1 = *k2;
+    *k2 = tmp;
+}
 
-                    keylen->key = json_object_iter_key(iter);
-                    keylen->len = json_object_iter_key_len(iter);
+static int median_of_three(int a, int b, int c) {
+    if (a < b)
+        return b < c ? b : (a < c ? c : a);
+    return a < c ? a : (b < c ? c : b);
+}
 
-                    iter = json_object_iter_next((json_t *)json, iter);
-                    i++;
-                }
-                assert(i == size);
-
-                qsort(keys, size, sizeof(struct key_len), compare_keys);
-
-                for (i = 0; i < size; i++) {
-                    const struct key_len *key;
-                    json_t *value;
-
-                    key = &keys[i];
-                    value = json_object_getn(json, key->key, key->len);
-                    assert(value);
-
-                    dump_string(key->key, key->len, dump, data, flags);
-                    if (dump(separator, separator_length, data) ||
-                        do_dump(value, flags, depth + 1, parents, dump, data)) {
-                        jsonp_free(keys);
-                        return -1;
-                    }
-
-                    if (i < size - 1) {
-                        if (dump(",", 1, data) ||
-                            dump_indent(flags, depth + 1, 1, dump, data)) {
-                            jsonp_free(keys);
-                            return -1;
-                        }
-                    } else {
-                        if (dump_indent(flags, depth, 0, dump, data)) {
-                            jsonp_free(keys);
-                            return -1;
-                        }
-                    }
-                }
+/* Fewer keys than this are sorted by insertion */
+#define SORT_KEYS_MIN_PARTITION 16
+
+/* Sort keys whose first depth bytes are equal, in the order of
+   memcmp() and then length. This is a three-way radix quicksort, which
+   looks at each byte of a common prefix only once instead of in every
+   comparison. Only the smaller partitions are sorted recursively, so
+   the recursion is at most log2(n) deep. */
+static void sort_keys(struct key_len *keys, size_t n, size_t depth) {
+    size_t i;
+
+    while (n >= SORT_KEYS_MIN_PARTITION) {
+        struct key_len *parts[3];
+        size_t sizes[3], depths[3], lt = 0, gt = n, j, largest;
+        int pivot, c;
+
+        pivot = median_of_three(key_byte(&keys[0], depth), key_byte(&keys[n / 2], depth),
+                                key_byte(&keys[n - 1], depth));
+
+        i = 0;
+        while (i < gt) {
+            c = key_byte(&keys[i], depth);
+            if (c < pivot)
+                swap_keys(&keys[lt++], &keys[i++]);
+            else if (c > pivot)
+                swap_keys(&keys[i], &keys[--gt]);
+            else
+                i++;
+        }
 
-                jsonp_free(keys);
-            } else {
-                /* Don't sort keys */
-
-                while (iter) {
-                    void *next = json_object_iter_next((json_t *)json, iter);
-                    const char *key = json_object_iter_key(iter);
-                    const size_t key_len = json_object_iter_key_len(iter);
-
-                    dump_string(key, key_len, dump, data, flags);
-                    if (dump(separator, separator_length, data) ||
-                        do_dump(json_object_iter_value(iter), flags, depth + 1, parents,
-                                dump, data))
-                        return -1;
-
-                    if (next) {
-                        if (dump(",", 1, data) ||
-                            dump_indent(flags, depth + 1, 1, dump, data))
-                            return -1;
-                    } else {
-                        if (dump_indent(flags, depth, 0, dump, data))
-                            return -1;
-                    }
-
-                    iter = next;
-                }
-            }
+        parts[0] = keys;
+        sizes[0] = lt;
+        depths[0] = depth;
 
-            hashtable_del(parents, loop_key, loop_key_len);
-            return embed ? 0 : dump("}", 1, data);
+        /* keys that end at depth are all the same */
+        parts[1] = keys + lt;
+        sizes[1] = pivot ? gt - lt : 0;
+        depths[1] = depth + 1;
+
+        parts[2] = keys + gt;
+        sizes[2] = n - gt;
+        depths[2] = depth;
+
+        largest = 0;
+        for (j = 1; j < 3; j++) {
+            if (sizes[j] > sizes[largest])
+                largest = j;
+        }
+        for (j = 0; j < 3; j++) {
+            if (j != largest)
+                sort_keys(parts[j], sizes[j], depths[j]);
         }
 
-        default:
-            /* not reached */
-            return -1;
+        keys = parts[largest];
+        n = sizes[largest];
+        depth = depths[largest];
     }
-}
 
-char *json_dumps(const json_t *json, size_t flags) {
-    strbuffer_t strbuff;
-    char *result;
+    for (i = 1; i < n; i++) {
+        struct key_len key = keys[i];
+        size_t j = i;
 
-    if (strbuffer_init(&strbuff))
-        return NULL;
+        while (j > 0 && compare_keys_at(&keys[j - 1], &key, depth) > 0) {
+            keys[j] = keys[j - 1];
+            j--;
+        }
+        keys[j] = key;
+    }
+}
 
-    if (json_dump_callback(json, dump_to_strbuffer, (void *)&strbuff, flags))
-        result = NULL;
-    else
-        result = jsonp_strdup(strbuffer_value(&strbuff));
+/* Detect circular references, unless the caller has ruled them out */
+static JSON_INLINE int enter_container(jsonp_parents_t *parents, const json_t *json,
+                                       size_t flags) {
+    return flags & JSON_NO_CYCLE_CHECK ? 0 : jsonp_parents_push(parents, json);
+}
 
-    strbuffer_close(&strbuff);
-    return result;
+static JSON_INLINE void leave_container(jsonp_parents_t *parents, const json_t *json,
+                                        size_t flags) {
+    if (!(flags & JSON_NO_CYCLE_CHECK))
+        jsonp_parents_pop(parents, json);
 }
 
-size_t json_dumpb(const json_t *json, char *buffer, size_t size, size_t flags) {
-    struct buffer buf = {size, 0, buffer};
+/* An object or array whose members are being encoded */
+struct dump_frame {
+    const json_t *json;
+    size_t index;     /* the number of members written */
+    size_t size;      /* the number of members */
+    void *iter;       /* the next member of an object whose keys aren't sorted */
+    size_t keys_base; /* the first of its sorted keys in the shared array */
+    int embed;
+};
 
-    if (json_dump_callback(json, dump_to_buffer, (void *)&buf, flags))
-        return 0;
+/* The state of a dump. Instead of recursing for nested values,
+   do_dump() keeps the containers it's in on a stack of frames, so the
+   C stack doesn't grow with the nesting depth. */
+struct dump_state {
+    jsonp_parents_t parents;
+    struct dump_keys keys;
+    struct dump_frame *frames;
+    size_t nframes;
+    size_t frames_size;
+};
 
-    return buf.used;
+static void dump_state_init(struct dump_state *state) {
+    jsonp_parents_init(&state->parents);
+    dump_keys_init(&state->keys);
+    state->frames = NULL;
+    state->nframes = 0;
+    state->frames_size = 0;
 }
 
-int json_dumpf(const json_t *json, FILE *output, size_t flags) {
-    return json_dump_callback(json, dump_to_file, (void *)output, flags);
+static void dump_state_close(struct dump_state *state) {
+    jsonp_free(state->frames);
+    dump_keys_close(&state->keys);
+    jsonp_parents_close(&state->parents);
 }
 
-int json_dumpfd(const json_t *json, int output, size_t flags) {
-    return json_dump_callback(json, dump_to_fd, (void *)&output, flags);
+static struct dump_frame *push_frame(struct dump_state *state) {
+    if (state->nframes == state->frames_size) {
+        size_t new_size = state->frames_size ? 2 * state->frames_size : 16;
+        struct dump_frame *new_frames;
+
+        new_frames = jsonp_malloc(new_size * sizeof(struct dump_frame));
+        if (!new_frames)
+            return NULL;
+
+        if (state->nframes)
+            memcpy(new_frames, state->frames, state->nframes * sizeof(struct dump_frame));
+        jsonp_free(state->frames);
+        state->frames = new_frames;
+        state->frames_size = new_size;
+    }
+    return &state->frames[state->nframes++];
 }
 
-int json_dump_file(const json_t *json, const char *path, size_t flags) {
-    int result;
+/* Write the opening bracket of a container, and open a frame for its
+   members unless it's empty */
+static int dump_open(const json_t *json, size_t flags, int embed, int depth,
+                     struct dump_state *state, struct dump_sink *sink) {
+    int object = json_is_object(json);
+    struct dump_keys *keys = &state->keys;
+    struct dump_frame *frame;
+    size_t size;
 
-    FILE *output = fopen(path, "w");
-    if (!output)
+    if (enter_container(&state->parents, json, flags))
         return -1;
 
-    result = json_dumpf(json, output, flags);
+    size = object ? json_object_size(json) : json_array_size(json);
 
-    if (fclose(output) != 0)
+    if (size == 0) {
+        leave_container(&state->parents, json, flags);
+        if (embed)
+            return 0;
+        if (flags & BINARY_FLAGS)
+            return dump_head(object ? HEAD_OBJECT : HEAD_ARRAY, 0, flags, sink);
+        return sink_write(sink, object ? "{}" : "[]", 2);
+    }
+
+    frame = push_frame(state);
+    if (!frame) {
+        leave_container(&state->parents, json, flags);
         return -1;
+    }
 
-    return result;
+    frame->json = json;
+    frame->index = 0;
+    frame->size = size;
+    frame->iter = object ? json_object_iter((json_t *)json) : NULL;
+    frame->keys_base = keys->used;
+    frame->embed = embed;
+
+    if (object && (flags & JSON_SORT_KEYS)) {
+        void *iter = frame->iter;
+        size_t i = 0;
+
+        if (reserve_keys(keys, size))
+            return -1;
+
+        while (iter) {
+            struct key_len *keylen = &keys->keys[keys->used + i];
+
+            keylen->key = json_object_iter_key(iter);
+            keylen->len = json_object_iter_key_len(iter);
+            keylen->value = json_object_iter_value(iter);
+
+            iter = json_object_iter_next((json_t *)json, iter);
+            i++;
+        }
+        assert(i == size);
+
+        keys->used += size;
+        sort_keys(keys->keys + frame->keys_base, size, 0);
+    }
+
+    /* binary formats have the number of members where the text has
+       the opening bracket, and nothing between and after them */
+    if (flags & BINARY_FLAGS)
+        return embed ? 0
+                     : dump_head(object ? HEAD_OBJECT : HEAD_ARRAY, size, flags, sink);
+
+    if (!embed && sink_write(sink, object ? "{" : "[", 1))
+        return -1;
+    return dump_indent(flags, depth + 1, 0, sink);
 }
 
-int json_dump_callback(const json_t *json, json_dump_callback_t callback, void *data,
-                       size_t flags) {
-    int res;
-    hashtable_t parents_set;
+/* Write what comes before the next member of the innermost open
+   container, and set *json to it. If the container is complete, write
+   its closing bracket instead and close its frame. Returns 1 if there
+   was a next member, 0 if not, and -1 on error. */
+static int dump_next(size_t flags, int depth, struct dump_state *state,
+                     struct dump_sink *sink, const json_t **json) {
+    struct dump_frame *frame = &state->frames[state->nframes - 1];
+    int object = json_is_object(frame->json);
+    const char *key;
+    size_t key_len;
 
-    if (!(flags & JSON_ENCODE_ANY)) {
-        if (!json_is_array(json) && !json_is_object(json))
+    /* the members are one level deeper than the container */
+    depth += (int)state->nframes;
+
+    if (frame->index == frame->size) {
+        state->keys.used = frame->keys_base;
+        leave_container(&state->parents, frame->json, flags);
+        state->nframes--;
+        if (flags & BINARY_FLAGS)
+            return 0;
+
+        if (dump_indent(flags, depth - 1, 0, sink) ||
+            (!frame->embed && sink_write(sink, object ? "}" : "]", 1)))
             return -1;
+        return 0;
     }
 
-    if (hashtable_init(&parents_set))
+    if (frame->index > 0 && !(flags & BINARY_FLAGS) &&
+        (sink_write(sink, ",", 1) || dump_indent(flags, depth, 1, sink)))
         return -1;
-    res = do_dump(json, flags, 0, &parents_set, callback, data);
-    hashtable_close(&parents_set);
 
-    return res;
+    if (!object) {
+        *json = json_array_get(frame->json, frame->index++);
+        return 1;
+    }
+
+    if (flags & JSON_SORT_KEYS) {
+        /* the array may have moved while the previous value was dumped */
+        const struct key_len *keylen = &state->keys.keys[frame->keys_base + frame->index];
+
+        key = keylen->key;
+        key_len = keylen->len;
+        *json = keylen->value;
+    } else {
+        key = json_object_iter_key(frame->iter);
+        key_len = json_object_iter_key_len(frame->iter);
+        *json = json_object_iter_value(frame->iter);
+        frame->iter = json_object_iter_next((json_t *)frame->json, frame->iter);
+    }
+    frame->index++;
+
+    if (flags & BINARY_FLAGS)
+        return dump_binary_string(key, key_len, flags, sink) ? -1 : 1;
+
+    dump_string(key, key_len, sink, flags);
+    if (flags & JSON_COMPACT)
+        return sink_write(sink, ":", 1) ? -1 : 1;
+    return sink_write(sink, ": ", 2) ? -1 : 1;
+}
+
+/* Write all of a packed array at depth, without boxing its numbers */
+static int dump_packed(const json_t *json, size_t flags, int embed, int depth,
+                       struct dump_sink *sink) {
+    const json_int_t *integers = json_array_int_data(json);
+    const double *reals = json_array_real_data(json);
+    size_t i, size = json_array_size(json);
+    int binary = flags & BINARY_FLAGS, rv;
+
+    if (binary) {
+        if (!embed && dump_head(HEAD_ARRAY, size, flags, sink))
+            return -1;
+    } else if (size == 0)
+        return embed ? 0 : sink_write(sink, "[]", 2);
+    else if ((!embed && sink_write(sink, "[", 1)) ||
+             dump_indent(flags, depth + 1, 0, sink))
+        return -1;
+
+    for (i = 0; i < size; i++) {
+        if (i > 0 && !binary &&
+            (sink_write(sink, ",", 1) || dump_indent(flags, depth + 1, 1, sink)))
+            return -1;
+
+        if (binary)
+            rv = integers ? dump_binary_integer(integers[i], flags, sink)
+                          : dump_binary_real(reals[i], flags, sink);
+        else
+            rv = integers ? dump_integer(integers[i], sink)
+                          : dump_real(reals[i], flags, sink);
+        if (rv)
+            return -1;
+    }
+
+    if (binary)
+        return 0;
+    if (dump_indent(flags, depth, 0, sink) || (!embed && sink_write(sink, "]", 1)))
+        return -1;
+    return 0;
+}
+
+/* Write a value at depth, or the opening bracket of a container */
+static int dump_value(const json_t *json, size_t flags, int embed, int depth,
+                      struct dump_state *state, struct dump_sink *sink) {
+    const jsonp_lazy_t *lazy;
+
+    if (!json)
+        return -1;
+
+    /* a copy from json_deep_copy_cow() is written from its original,
+       instead of copying the members that it hasn't copied yet */
+    if (jsonp_cow_source(json))
+        json = jsonp_cow_source(json);
+
+    /* a container that hasn't been decoded is written as it was
+       loaded, unless the flags ask for changes to its text or its
+       integers are decoded as reals */
+    lazy = jsonp_lazy(json);
+    if (lazy && !(lazy->flags & JSON_DECODE_INT_AS_REAL) && !FLAGS_TO_INDENT(flags) &&
+        !FLAGS_TO_PRECISION(flags) &&
+        !(flags &
+          (JSON_ENSURE_ASCII | JSON_SORT_KEYS | JSON_ESCAPE_SLASH | BINARY_FLAGS))) {
+        if (embed)
+            return sink_write_ref(sink, lazy->text + 1, lazy->length - 2);
+        return sink_write_ref(sink, lazy->text, lazy->length);
+    }
+
+    if (json_array_int_data(json) || json_array_real_data(json))
+        return dump_packed(json, flags, embed, depth, sink);
+
+    if ((flags & BINARY_FLAGS) && !json_is_object(json) && !json_is_array(json))
+        return dump_binary_scalar(json, flags, sink);
+
+    switch (json_typeof(json)) {
+        case JSON_NULL:
+            return sink_write(sink, "null", 4);
+
+        case JSON_TRUE:
+            return sink_write(sink, "true", 4);
+
+        case JSON_FALSE:
+            return sink_write(sink, "false", 5);
+
+        case JSON_INTEGER:
+            return dump_integer(json_integer_value(json), sink);
+
+        case JSON_REAL:
+            return dump_real(json_real_value(json), flags, sink);
+
+        case JSON_STRING:
+            return dump_string(json_string_value(json), json_string_length(json), sink,
+                               flags);
+
+        case JSON_ARRAY:
+        case JSON_OBJECT:
+            return dump_open(json, flags, embed, depth, state, sink);
+
+        default:
+            /* not reached */
+            return -1;
+    }
+}
+
+static int do_dump(const json_t *json, size_t flags, int depth, struct dump_state *state,
+                   struct dump_sink *sink) {
+    size_t base = state->nframes, keys_used = state->keys.used;
+    int embed = flags & JSON_EMBED, rv;
+
+    flags &= ~JSON_EMBED;
+
+    while (1) {
+        if (dump_value(json, flags, embed, depth + (int)(state->nframes - base), state,
+                       sink))
+            goto failed;
+        embed = 0;
+
+        do {
+            if (state->nframes == base)
+                return 0;
+            rv = dump_next(flags, depth - (int)base, state, sink, &json);
+            if (rv < 0)
+                goto failed;
+        } while (!rv);
+    }
+
+failed:
+    while (state->nframes > base) {
+        state->nframes--;
+        leave_container(&state->parents, state->frames[state->nframes].json, flags);
+    }
+    state->keys.used = keys_used;
+    return -1;
+}
+
+/* The number of bytes that have been output */
+#define sink_total(sink_) ((sink_)->written + (sink_)->used + (sink_)->overflow)
+
+static int dump_to_sink(const json_t *json, size_t flags, struct dump_sink *sink) {
+    double start = jsonp_stats_now();
+    struct dump_state state;
+    int res;
+
+    if ((flags & BINARY_FLAGS) == BINARY_FLAGS)
+        return -1;
+
+    if (!(flags & JSON_ENCODE_ANY)) {
+        if (!json_is_array(json) && !json_is_object(json))
+            return -1;
+    }
+
+    dump_state_init(&state);
+    res = do_dump(json, flags, 0, &state, sink);
+    if (!res)
+        res = sink_flush(sink);
+    dump_state_close(&state);
+
+    jsonp_stats_dump(sink_total(sink), start);
+    return res;
+}
+
+static void sink_init_in_place(struct dump_sink *sink, char *buffer, size_t size) {
+    sink->dump = NULL;
+    sink->data = NULL;
+    sink->buffer = buffer;
+    sink->size = size;
+    sink->used = 0;
+    sink->overflow = 0;
+    sink->written = 0;
+    sink->gather = NULL;
+}
+
+static int measure(const json_t *json, size_t flags, size_t *size) {
+    struct dump_sink sink;
+
+    sink_init_in_place(&sink, NULL, 0);
+    if (dump_to_sink(json, flags, &sink))
+        return -1;
+
+    *size = sink.overflow;
+    return 0;
+}
+
+size_t json_dump_size(const json_t *json, size_t flags) {
+    size_t size;
+
+    if (measure(json, flags, &size))
+        return 0;
+
+    return size;
+}
+
+static char *dumps_exact(const json_t *json, size_t flags) {
+    struct dump_sink sink;
+    size_t size;
+    char *result;
+
+    if (measure(json, flags, &size))
+        return NULL;
+
+    result = jsonp_malloc(size + 1);
+    if (!result)
+        return NULL;
+
+    sink_init_in_place(&sink, result, size);
+    if (dump_to_sink(json, flags, &sink) || sink.overflow) {
+        jsonp_free(result);
+        return NULL;
+    }
+
+    result[sink.used] = '\0';
+    return result;
+}
+
+char *json_dumps(const json_t *json, size_t flags) {
+    strbuffer_t strbuff;
+    char *result;
+
+    /* the output of binary formats contains null bytes */
+    if (flags & BINARY_FLAGS)
+        return NULL;
+
+    if (flags & JSON_EXACT_SIZE)
+        return dumps_exact(json, flags);
+
+    if (strbuffer_init(&strbuff))
+        return NULL;
+
+    if (json_dump_callback(json, dump_to_strbuffer, (void *)&strbuff, flags))
+        result = NULL;
+    else
+        result = jsonp_strdup(strbuffer_value(&strbuff));
+
+    strbuffer_close(&strbuff);
+    return result;
+}
+
+size_t json_dumpb(const json_t *json, char *buffer, size_t size, size_t flags) {
+    struct dump_sink sink;
+
+    sink_init_in_place(&sink, buffer, buffer ? size : 0);
+    if (dump_to_sink(json, flags, &sink))
+        return 0;
+
+    return sink.used + sink.overflow;
+}
+
+size_t json_dumpb_cbor(const json_t *json, char *buffer, size_t size, size_t flags) {
+    return json_dumpb(json, buffer, size,
+                      (flags & ~(size_t)BINARY_FLAGS) | JSON_ENCODE_CBOR);
+}
+
+size_t json_dumpb_msgpack(const json_t *json, char *buffer, size_t size, size_t flags) {
+    return json_dumpb(json, buffer, size,
+                      (flags & ~(size_t)BINARY_FLAGS) | JSON_ENCODE_MSGPACK);
+}
+
+int json_dumpf(const json_t *json, FILE *output, size_t flags) {
+    return json_dump_callback(json, dump_to_file, (void *)output, flags);
+}
+
+int json_dumpfd(const json_t *json, int output, size_t flags) {
+    return json_dump_callback(json, dump_to_fd, (void *)&output, flags);
+}
+
+int json_dump_file(const json_t *json, const char *path, size_t flags) {
+    int result;
+
+    FILE *output = fopen(path, flags & BINARY_FLAGS ? "wb" : "w");
+    if (!output)
+        return -1;
+
+    result = json_dumpf(json, output, flags);
+
+    if (fclose(output) != 0)
+        return -1;
+
+    return result;
+}
+
+static void sink_init_buffered(struct dump_sink *sink, json_dump_callback_t callback,
+                               void *data) {
+    sink->dump = callback;
+    sink->data = data;
+    sink->used = 0;
+    sink->overflow = 0;
+    sink->written = 0;
+    sink->gather = NULL;
+
+    /* Dump unbuffered if the buffer can't be allocated */
+    sink->size = DUMP_BUFFER_SIZE;
+    sink->buffer = sink->size ? jsonp_malloc_as(sink->size, json_stats_buffers) : NULL;
+    if (!sink->buffer)
+        sink->size = 0;
+}
+
+int json_dump_callback(const json_t *json, json_dump_callback_t callback, void *data,
+                       size_t flags) {
+    int res;
+    struct dump_sink sink;
+
+    if (!callback)
+        return -1;
+
+    sink_init_buffered(&sink, callback, data);
+    res = dump_to_sink(json, flags, &sink);
+    jsonp_free(sink.buffer);
+
+    return res;
+}
+
+/*** scatter-gather output ***/
+
+json_dumpv_t *json_dumpv(const json_t *json, size_t flags) {
+    json_dumpv_t *dv;
+    struct dump_sink sink;
+    size_t i, offset = 0;
+    int res;
+
+    dv = jsonp_malloc(sizeof(json_dumpv_t));
+    if (!dv)
+        return NULL;
+    if (strbuffer_init(&dv->scratch)) {
+        jsonp_free(dv);
+        return NULL;
+    }
+    dv->iov = NULL;
+    dv->count = 0;
+    dv->capacity = 0;
+
+    sink_init_buffered(&sink, dump_to_gather, dv);
+    sink.gather = dv;
+    res = dump_to_sink(json, flags, &sink);
+    jsonp_free(sink.buffer);
+    if (res) {
+        json_dumpv_free(dv);
+        return NULL;
+    }
+    dv->size = sink.written;
+
+    /* the scratch buffer is complete, so its segments can point to it */
+    for (i = 0; i < dv->count; i++) {
+        if (!dv->iov[i].base) {
+            dv->iov[i].base = strbuffer_value(&dv->scratch) + offset;
+            offset += dv->iov[i].len;
+        }
+    }
+    return dv;
+}
+
+size_t json_dumpv_count(const json_dumpv_t *dv) { return dv ? dv->count : 0; }
+
+const json_iovec_t *json_dumpv_iov(const json_dumpv_t *dv) { return dv ? dv->iov : NULL; }
+
+size_t json_dumpv_size(const json_dumpv_t *dv) { return dv ? dv->size : 0; }
+
+void json_dumpv_free(json_dumpv_t *dv) {
+    if (!dv)
+        return;
+    strbuffer_close(&dv->scratch);
+    jsonp_free(dv->iov);
+    jsonp_free(dv);
+}
+
+#if defined(HAVE_WRITEV) && defined(HAVE_SYS_UIO_H)
+/* The number of segments passed to one writev() call */
+#define WRITEV_BATCH 64
+
+static int writev_all(int output, const json_dumpv_t *dv) {
+    struct iovec batch[WRITEV_BATCH];
+    size_t i = 0, skip = 0, n;
+    ssize_t written;
+
+    while (i < dv->count) {
+        /* skip is the part of the first segment that has been written */
+        for (n = 0; n < WRITEV_BATCH && i + n < dv->count; n++) {
+            batch[n].iov_base = (char *)dv->iov[i + n].base + (n ? 0 : skip);
+            batch[n].iov_len = dv->iov[i + n].len - (n ? 0 : skip);
+        }
+
+        written = writev(output, batch, (int)n);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return -1;
+
+        skip += (size_t)written;
+        while (i < dv->count && skip >= dv->iov[i].len) {
+            skip -= dv->iov[i].len;
+            i++;
+        }
+    }
+    return 0;
+}
+#endif
+
+int json_dumpfd_writev(const json_t *json, int output, size_t flags) {
+#if defined(HAVE_WRITEV) && defined(HAVE_SYS_UIO_H)
+    json_dumpv_t *dv = json_dumpv(json, flags);
+    int res;
+
+    if (!dv)
+        return -1;
+    res = writev_all(output, dv);
+    json_dumpv_free(dv);
+    return res;
+#else
+    return json_dumpfd(json, output, flags);
+#endif
+}
+
+/*** newline-delimited JSON ***/
+
+static int dump_lines_to_sink(const json_t *records, size_t flags,
+                              struct dump_sink *sink) {
+    double start = jsonp_stats_now();
+    struct dump_state state;
+    size_t i;
+    int res = 0;
+
+    if (!json_is_array(records) || (flags & BINARY_FLAGS) == BINARY_FLAGS)
+        return -1;
+
+    /* Each record goes on a line of its own, so no indentation */
+    flags = (flags & ~(size_t)JSON_MAX_INDENT) | JSON_ENCODE_ANY;
+
+    dump_state_init(&state);
+
+    for (i = 0; i < json_array_size(records) && !res; i++) {
+        res = do_dump(json_array_get(records, i), flags, 0, &state, sink);
+        /* binary records follow each other, like in a CBOR sequence */
+        if (!res && !(flags & BINARY_FLAGS))
+            res = sink_write(sink, "\n", 1);
+    }
+    if (!res)
+        res = sink_flush(sink);
+
+    dump_state_close(&state);
+    jsonp_stats_dump(sink_total(sink), start);
+    return res;
+}
+
+int json_dump_lines_callback(const json_t *records, json_dump_callback_t callback,
+                             void *data, size_t flags) {
+    int res;
+    struct dump_sink sink;
+
+    if (!callback)
+        return -1;
+
+    sink_init_buffered(&sink, callback, data);
+    res = dump_lines_to_sink(records, flags, &sink);
+    jsonp_free(sink.buffer);
+
+    return res;
+}
+
+int json_dumpf_lines(const json_t *records, FILE *output, size_t flags) {
+    return json_dump_lines_callback(records, dump_to_file, (void *)output, flags);
+}
+
+int json_dumpfd_lines(const json_t *records, int output, size_t flags) {
+    return json_dump_lines_callback(records, dump_to_fd, (void *)&output, flags);
+}
+
+int json_dump_file_lines(const json_t *records, const char *path, size_t flags) {
+    int result;
+
+    FILE *output = fopen(path, flags & BINARY_FLAGS ? "wb" : "w");
+    if (!output)
+        return -1;
+
+    result = json_dumpf_lines(records, output, flags);
+
+    if (fclose(output) != 0)
+        return -1;
+
+    return result;
+}
+
+/*** parallel encoding of one large array or object ***/
+
+/* The members of the top level array or object are split to about
+   this many chunks per thread, and each thread encodes one chunk at a
+   time to a buffer of its own */
+#define DUMP_CHUNKS_PER_THREAD 16
+
+/* The number of chunks per thread that may be encoded ahead of the
+   one being written */
+#define DUMP_WINDOW 4
+
+typedef struct {
+    size_t first; /* the index of the first member */
+    int done;     /* encoded, waiting to be written */
+    strbuffer_t text;
+} dump_chunk_t;
+
+typedef struct {
+    const json_t *json;
+    const struct key_len *members; /* the members of an object */
+    size_t size;
+    size_t flags;
+    size_t nchunks;
+    size_t chunk_size; /* members per chunk */
+    json_dump_callback_t callback;
+    void *data;
+
+    jsonp_mutex_t mutex;
+    jsonp_cond_t cond;
+    size_t next_index; /* the next chunk to encode */
+    int failed;
+
+    /* ordered writing */
+    dump_chunk_t *window;
+    size_t window_size;
+    size_t delivered; /* the number of chunks written */
+    int delivering;   /* a thread is writing a chunk */
+} dump_job_t;
+
+/* Encode a chunk of the members as do_dump() would encode them, with
+   the separators before them */
+static int dump_chunk(dump_job_t *job, dump_chunk_t *chunk) {
+    size_t flags = job->flags & ~JSON_EMBED, end, i;
+    struct dump_state state;
+    struct dump_sink sink;
+    int res = 0;
+
+    end = chunk->first + job->chunk_size;
+    if (end > job->size)
+        end = job->size;
+
+    dump_state_init(&state);
+    sink_init_buffered(&sink, dump_to_strbuffer, &chunk->text);
+
+    /* the members are inside the top level container */
+    res = enter_container(&state.parents, job->json, flags);
+
+    for (i = chunk->first; i < end && !res; i++) {
+        if (i > 0 && (sink_write(&sink, ",", 1) || dump_indent(flags, 1, 1, &sink))) {
+            res = -1;
+            break;
+        }
+
+        if (job->members) {
+            const struct key_len *member = &job->members[i];
+
+            dump_string(member->key, member->len, &sink, flags);
+            res = sink_write(&sink, flags & JSON_COMPACT ? ":" : ": ",
+                             flags & JSON_COMPACT ? 1 : 2) ||
+                  do_dump(member->value, flags, 1, &state, &sink);
+        } else
+            res = do_dump(json_array_get(job->json, i), flags, 1, &state, &sink);
+    }
+    if (!res)
+        res = sink_flush(&sink);
+
+    jsonp_free(sink.buffer);
+    dump_state_close(&state);
+    return res;
+}
+
+/* Write the encoded chunks in order, as long as the next one is
+   ready. Called with the mutex held, which is released while the
+   callback runs. */
+static void write_chunks(dump_job_t *job) {
+    dump_chunk_t *chunk;
+    int res;
+
+    while (!job->delivering && !job->failed) {
+        chunk = &job->window[job->delivered % job->window_size];
+        if (!chunk->done)
+            break;
+
+        job->delivering = 1;
+        jsonp_mutex_unlock(&job->mutex);
+
+        res = job->callback(strbuffer_value(&chunk->text), chunk->text.length, job->data);
+        strbuffer_clear(&chunk->text);
+
+        jsonp_mutex_lock(&job->mutex);
+        job->delivering = 0;
+        if (res)
+            job->failed = 1;
+        chunk->done = 0;
+        job->delivered++;
+        jsonp_cond_broadcast(&job->cond);
+    }
+}
+
+static void dump_worker_main(void *arg) {
+    dump_job_t *job = arg;
+    dump_chunk_t *chunk;
+    size_t index;
+    int res;
+
+    jsonp_mutex_lock(&job->mutex);
+    while (!job->failed && job->next_index < job->nchunks) {
+        if (job->next_index >= job->delivered + job->window_size) {
+            /* Wait until the oldest chunk has been written */
+            jsonp_cond_wait(&job->cond, &job->mutex);
+            continue;
+        }
+
+        index = job->next_index++;
+        chunk = &job->window[index % job->window_size];
+        chunk->first = index * job->chunk_size;
+        jsonp_mutex_unlock(&job->mutex);
+
+        res = dump_chunk(job, chunk);
+
+        jsonp_mutex_lock(&job->mutex);
+        if (res) {
+            job->failed = 1;
+            jsonp_cond_broadcast(&job->cond);
+        } else {
+            chunk->done = 1;
+            write_chunks(job);
+        }
+    }
+
+    jsonp_cond_broadcast(&job->cond);
+    jsonp_mutex_unlock(&job->mutex);
+}
+
+/* Collect the members of an object in the order they are written */
+static struct key_len *dump_members(const json_t *object, size_t flags) {
+    size_t size = json_object_size(object), i = 0;
+    struct key_len *members;
+    void *iter;
+
+    members = jsonp_malloc(size * sizeof(struct key_len));
+    if (!members)
+        return NULL;
+
+    for (iter = json_object_iter((json_t *)object); iter;
+         iter = json_object_iter_next((json_t *)object, iter)) {
+        members[i].key = json_object_iter_key(iter);
+        members[i].len = json_object_iter_key_len(iter);
+        members[i].value = json_object_iter_value(iter);
+        i++;
+    }
+    assert(i == size);
+
+    if (flags & JSON_SORT_KEYS)
+        sort_keys(members, size, 0);
+
+    return members;
+}
+
+static int dump_job_run(dump_job_t *job, size_t nthreads) {
+    size_t i;
+    int res = -1;
+
+    job->next_index = 0;
+    job->failed = 0;
+    job->delivered = 0;
+    job->delivering = 0;
+    job->window_size = nthreads * DUMP_WINDOW;
+    job->window = jsonp_malloc(job->window_size * sizeof(dump_chunk_t));
+    if (!job->window)
+        return -1;
+
+    for (i = 0; i < job->window_size; i++) {
+        job->window[i].done = 0;
+        if (strbuffer_init(&job->window[i].text))
+            break;
+    }
+
+    if (i == job->window_size && !jsonp_mutex_init(&job->mutex)) {
+        if (!jsonp_cond_init(&job->cond)) {
+            jsonp_run_threads(nthreads, dump_worker_main, job);
+            res = job->failed || job->delivered != job->nchunks ? -1 : 0;
+            jsonp_cond_destroy(&job->cond);
+        }
+        jsonp_mutex_destroy(&job->mutex);
+    }
+
+    while (i > 0)
+        strbuffer_close(&job->window[--i].text);
+    jsonp_free(job->window);
+    return res;
+}
+
+int json_dump_callback_parallel(const json_t *json, json_dump_callback_t callback,
+                                void *data, size_t flags, size_t nthreads) {
+    struct key_len *members = NULL;
+    struct dump_sink sink;
+    dump_job_t job;
+    int embed = flags & JSON_EMBED;
+    int object = json_is_object(json);
+    size_t size;
+    int res;
+
+    if (!callback)
+        return -1;
+
+    if (nthreads == 0)
+        nthreads = jsonp_cpu_count();
+
+    if (jsonp_cow_source(json))
+        json = jsonp_cow_source(json);
+
+    /* packed arrays are written in one go */
+    size = 0;
+    if ((object || json_is_array(json)) && !jsonp_lazy(json) &&
+        !json_array_int_data(json) && !json_array_real_data(json))
+        size = object ? json_object_size(json) : json_array_size(json);
+
+    if (nthreads < 2 || size < 2 || !JSONP_HAVE_THREADS || (flags & BINARY_FLAGS))
+        return json_dump_callback(json, callback, data, flags);
+
+    if (object) {
+        members = dump_members(json, flags);
+        if (!members)
+            return -1;
+    }
+
+    job.json = json;
+    job.members = members;
+    job.size = size;
+    job.flags = flags;
+    job.callback = callback;
+    job.data = data;
+    job.nchunks = nthreads * DUMP_CHUNKS_PER_THREAD;
+    if (job.nchunks > size)
+        job.nchunks = size;
+    job.chunk_size = (size + job.nchunks - 1) / job.nchunks;
+    job.nchunks = (size + job.chunk_size - 1) / job.chunk_size;
+    if (nthreads > job.nchunks)
+        nthreads = job.nchunks;
+
+    /* the brackets are written here, and the members in between on
+       the threads */
+    sink_init_buffered(&sink, callback, data);
+    res = -1;
+    if ((embed || !sink_write(&sink, object ? "{" : "[", 1)) &&
+        !dump_indent(flags, 1, 0, &sink) && !sink_flush(&sink) &&
+        !dump_job_run(&job, nthreads) && !dump_indent(flags, 0, 0, &sink) &&
+        (embed || !sink_write(&sink, object ? "}" : "]", 1)) && !sink_flush(&sink))
+        res = 0;
+
+    jsonp_free(sink.buffer);
+    jsonp_free(members);
+    return res;
+}
+
+char *json_dumps_parallel(const json_t *json, size_t flags, size_t nthreads) {
+    strbuffer_t strbuff;
+    char *result;
+
+    if (flags & BINARY_FLAGS)
+        return NULL;
+
+    if (strbuffer_init(&strbuff))
+        return NULL;
+
+    if (json_dump_callback_parallel(json, dump_to_strbuffer, (void *)&strbuff, flags,
+                                    nthreads))
+        result = NULL;
+    else
+        result = jsonp_strdup(strbuffer_value(&strbuff));
+
+    strbuffer_close(&strbuff);
+    return result;
+}
+
+/*** streaming writer ***/
+
+typedef struct {
+    int object;      /* 1 for an object, 0 for an array */
+    int key;         /* in an object, a key is waiting for its value */
+    size_t nmembers; /* number of values written so far */
+} writer_frame_t;
+
+struct json_writer {
+    struct dump_sink sink;
+    size_t flags;
+    int fd;     /* output of json_writer_newfd() */
+    int failed; /* sticky, the output is incomplete after an error */
+    int done;   /* the top level value is complete */
+    struct dump_state state; /* for json_writer_value() */
+    writer_frame_t *stack; /* the open containers, innermost last */
+    size_t depth;
+    size_t capacity;
+};
+
+json_writer_t *json_writer_new(json_dump_callback_t callback, void *data, size_t flags) {
+    json_writer_t *writer;
+
+    if (!callback || (flags & BINARY_FLAGS))
+        return NULL;
+
+    writer = jsonp_malloc(sizeof(json_writer_t));
+    if (!writer)
+        return NULL;
+
+    dump_state_init(&writer->state);
+    sink_init_buffered(&writer->sink, callback, data);
+    writer->flags = flags;
+    writer->fd = -1;
+    writer->failed = 0;
+    writer->done = 0;
+    writer->stack = NULL;
+    writer->depth = 0;
+    writer->capacity = 0;
+    return writer;
+}
+
+json_writer_t *json_writer_newf(FILE *output, size_t flags) {
+    if (!output)
+        return NULL;
+    return json_writer_new(dump_to_file, (void *)output, flags);
+}
+
+json_writer_t *json_writer_newfd(int output, size_t flags) {
+    json_writer_t *writer;
+
+    if (output < 0)
+        return NULL;
+
+    /* the callback data must stay valid, so point it into the writer */
+    writer = json_writer_new(dump_to_fd, NULL, flags);
+    if (writer) {
+        writer->fd = output;
+        writer->sink.data = &writer->fd;
+    }
+    return writer;
+}
+
+static int writer_fail(json_writer_t *writer) {
+    writer->failed = 1;
+    return -1;
+}
+
+void jsonp_writer_fail(json_writer_t *writer) { writer->failed = 1; }
+
+/* Write the comma and indentation before a member of the innermost
+   container */
+static int writer_separator(json_writer_t *writer, writer_frame_t *frame) {
+    if (frame->nmembers++) {
+        return sink_write(&writer->sink, ",", 1) ||
+               dump_indent(writer->flags, writer->depth, 1, &writer->sink);
+    }
+    return dump_indent(writer->flags, writer->depth, 0, &writer->sink);
+}
+
+/* Write what comes before a value: the separator and indentation in an
+   array. In an object, the key has written them already. */
+static int writer_begin_value(json_writer_t *writer, int container) {
+    writer_frame_t *frame;
+
+    if (writer->failed)
+        return -1;
+
+    if (!writer->depth) {
+        /* a single top level value, an object or an array unless
+           JSON_ENCODE_ANY is used */
+        if (writer->done || (!container && !(writer->flags & JSON_ENCODE_ANY)))
+            return writer_fail(writer);
+        return 0;
+    }
+
+    frame = &writer->stack[writer->depth - 1];
+    if (frame->object) {
+        if (!frame->key)
+            return writer_fail(writer);
+        frame->key = 0;
+        return 0;
+    }
+
+    if (writer_separator(writer, frame))
+        return writer_fail(writer);
+    return 0;
+}
+
+static int writer_end_value(json_writer_t *writer, int res) {
+    if (res)
+        return writer_fail(writer);
+    if (!writer->depth)
+        writer->done = 1;
+    return 0;
+}
+
+/* JSON_EMBED only omits the brackets of the top level value */
+static size_t writer_flags(const json_writer_t *writer) {
+    return writer->depth ? writer->flags & ~JSON_EMBED : writer->flags;
+}
+
+static int writer_begin(json_writer_t *writer, int object) {
+    writer_frame_t *frame;
+
+    if (writer_begin_value(writer, 1))
+        return -1;
+
+    if (!(writer_flags(writer) & JSON_EMBED) &&
+        sink_write(&writer->sink, object ? "{" : "[", 1))
+        return writer_fail(writer);
+
+    if (writer->depth == writer->capacity) {
+        size_t new_capacity = writer->capacity ? 2 * writer->capacity : 8;
+        writer_frame_t *new_stack = jsonp_malloc(new_capacity * sizeof(writer_frame_t));
+        if (!new_stack)
+            return writer_fail(writer);
+
+        if (writer->depth)
+            memcpy(new_stack, writer->stack, writer->depth * sizeof(writer_frame_t));
+        jsonp_free(writer->stack);
+        writer->stack = new_stack;
+        writer->capacity = new_capacity;
+    }
+
+    frame = &writer->stack[writer->depth++];
+    frame->object = object;
+    frame->key = 0;
+    frame->nmembers = 0;
+    return 0;
+}
+
+static int writer_end(json_writer_t *writer, int object) {
+    writer_frame_t *frame;
+    int res = 0;
+
+    if (writer->failed)
+        return -1;
+
+    if (!writer->depth)
+        return writer_fail(writer);
+
+    frame = &writer->stack[writer->depth - 1];
+    if (frame->object != object || frame->key)
+        return writer_fail(writer);
+
+    writer->depth--;
+    if (frame->nmembers)
+        res = dump_indent(writer->flags, writer->depth, 0, &writer->sink);
+    if (!res && !(writer_flags(writer) & JSON_EMBED))
+        res = sink_write(&writer->sink, object ? "}" : "]", 1);
+
+    return writer_end_value(writer, res);
+}
+
+int json_writer_begin_object(json_writer_t *writer) {
+    if (!writer)
+        return -1;
+    return writer_begin(writer, 1);
+}
+
+int json_writer_end_object(json_writer_t *writer) {
+    if (!writer)
+        return -1;
+    return writer_end(writer, 1);
+}
+
+int json_writer_begin_array(json_writer_t *writer) {
+    if (!writer)
+        return -1;
+    return writer_begin(writer, 0);
+}
+
+int json_writer_end_array(json_writer_t *writer) {
+    if (!writer)
+        return -1;
+    return writer_end(writer, 0);
+}
+
+int json_writer_key(json_writer_t *writer, const char *key) {
+    if (!key)
+        return writer ? writer_fail(writer) : -1;
+    return json_writer_keyn(writer, key, strlen(key));
+}
+
+int json_writer_keyn(json_writer_t *writer, const char *key, size_t len) {
+    writer_frame_t *frame;
+    struct dump_sink *sink;
+
+    if (!writer)
+        return -1;
+    if (writer->failed)
+        return -1;
+
+    if (!key || !writer->depth)
+        return writer_fail(writer);
+
+    frame = &writer->stack[writer->depth - 1];
+    if (!frame->object || frame->key)
+        return writer_fail(writer);
+
+    sink = &writer->sink;
+    if (writer_separator(writer, frame) || dump_string(key, len, sink, writer->flags) ||
+        ((writer->flags & JSON_COMPACT) ? sink_write(sink, ":", 1)
+                                        : sink_write(sink, ": ", 2)))
+        return writer_fail(writer);
+
+    frame->key = 1;
+    return 0;
+}
+
+int json_writer_string(json_writer_t *writer, const char *value) {
+    if (!value)
+        return writer ? writer_fail(writer) : -1;
+    return json_writer_stringn(writer, value, strlen(value));
+}
+
+int json_writer_stringn(json_writer_t *writer, const char *value, size_t len) {
+    if (!writer)
+        return -1;
+    if (!value)
+        return writer_fail(writer);
+    if (writer_begin_value(writer, 0))
+        return -1;
+    return writer_end_value(writer,
+                            dump_string(value, len, &writer->sink, writer->flags));
+}
+
+int json_writer_integer(json_writer_t *writer, json_int_t value) {
+    if (!writer || writer_begin_value(writer, 0))
+        return -1;
+    return writer_end_value(writer, dump_integer(value, &writer->sink));
+}
+
+int json_writer_real(json_writer_t *writer, double value) {
+    if (!writer)
+        return -1;
+
+    /* like json_real(), reject NaN and infinities */
+    if (value != value || value - value != 0.0)
+        return writer_fail(writer);
+
+    if (writer_begin_value(writer, 0))
+        return -1;
+    return writer_end_value(writer, dump_real(value, writer->flags, &writer->sink));
+}
+
+int json_writer_boolean(json_writer_t *writer, int value) {
+    if (!writer || writer_begin_value(writer, 0))
+        return -1;
+    return writer_end_value(writer, value ? sink_write(&writer->sink, "true", 4)
+                                          : sink_write(&writer->sink, "false", 5));
+}
+
+int json_writer_null(json_writer_t *writer) {
+    if (!writer || writer_begin_value(writer, 0))
+        return -1;
+    return writer_end_value(writer, sink_write(&writer->sink, "null", 4));
+}
+
+int json_writer_value(json_writer_t *writer, const json_t *value) {
+    int res;
+
+    if (!writer)
+        return -1;
+    if (!value)
+        return writer_fail(writer);
+
+    if (writer_begin_value(writer, json_is_object(value) || json_is_array(value)))
+        return -1;
+
+    res = do_dump(value, writer_flags(writer), (int)writer->depth, &writer->state,
+                  &writer->sink);
+    return writer_end_value(writer, res);
+}
+
+int json_writer_flush(json_writer_t *writer) {
+    if (!writer || writer->failed)
+        return -1;
+    if (sink_flush(&writer->sink))
+        return writer_fail(writer);
+    return 0;
+}
+
+int json_writer_finish(json_writer_t *writer) {
+    if (!writer || writer->failed)
+        return -1;
+
+    /* the document must be complete */
+    if (!writer->done)
+        return writer_fail(writer);
+
+    return json_writer_flush(writer);
+}
+
+void json_writer_free(json_writer_t *writer) {
+    if (!writer)
+        return;
+
+    dump_state_close(&writer->state);
+    jsonp_free(writer->sink.buffer);
+    jsonp_free(writer->stack);
+    jsonp_free(writer);
 }
@@ -24,248 +24,421 @@
 #define INITIAL_HASHTABLE_ORDER 3
 #endif
 
-typedef struct hashtable_list list_t;
 typedef struct hashtable_pair pair_t;
-typedef struct hashtable_bucket bucket_t;
+typedef struct hashtable_slot slot_t;
 
 extern volatile uint32_t hashtable_seed;
 
 /* Implementation of the hash function */
+#ifdef USE_WYHASH
+#include "wyhash.h"
+#define hash_str(key, len) ((size_t)wyhash((key), len, hashtable_seed))
+#define hashsize(n)        ((size_t)1 << (n))
+#define hashmask(n)        (hashsize(n) - 1)
+#else
 #include "lookup3.h"
+#define hash_str(key, len) ((size_t)hashlittle((key), len, hashtable_seed))
+#endif
+
+/* The load ratio of the index is kept below 1/2, so the entries array
+   has room for half as many pairs as there are slots */
+#define entries_size(order_) (hashsize(order_) / 2)
+
+/* Small tables don't have an index. They are searched linearly
+   without hashing the key. */
+#ifndef HASHTABLE_SMALL_SIZE
+#define HASHTABLE_SMALL_SIZE 8
+#endif
+
+/* The bytes after a pair hold its key unless it's shared */
+#define pair_key(pair_)       ((char *)((pair_) + 1))
+#define pair_is_shared(pair_) ((pair_)->key != pair_key(pair_))
+#define shared_key(key_)      hashtable_shared_key(key_)
+
+#if JSON_HAVE_ATOMIC_BUILTINS
+#define key_incref(key_) __atomic_add_fetch(&(key_)->refcount, 1, __ATOMIC_ACQUIRE)
+#define key_decref(key_) __atomic_sub_fetch(&(key_)->refcount, 1, __ATOMIC_RELEASE)
+#elif JSON_HAVE_SYNC_BUILTINS
+#define key_incref(key_) __sync_add_and_fetch(&(key_)->refcount, 1)
+#define key_decref(key_) __sync_sub_and_fetch(&(key_)->refcount, 1)
+#else
+#define key_incref(key_) (++(key_)->refcount)
+#define key_decref(key_) (--(key_)->refcount)
+#endif
 
-#define list_to_pair(list_)         container_of(list_, pair_t, list)
-#define ordered_list_to_pair(list_) container_of(list_, pair_t, ordered_list)
-#define hash_str(key, len)          ((size_t)hashlittle((key), len, hashtable_seed))
+/* Shared keys are compared by address before comparing the bytes */
+#define pair_has_key(pair_, key_, key_len_)                                              \
+    ((pair_)->key_len == (key_len_) &&                                                   \
+     ((pair_)->key == (key_) || memcmp((pair_)->key, key_, key_len_) == 0))
 
-static JSON_INLINE void list_init(list_t *list) {
-    list->next = list;
-    list->prev = list;
+#define order_is_small(order_)   (entries_size(order_) <= HASHTABLE_SMALL_SIZE)
+#define hashtable_is_small(ht_)  (!(ht_)->slots)
+#define hashtable_block(ht_)     ((ht_)->slots ? (void *)(ht_)->slots : (void *)(ht_)->entries)
+
+/* The slots and the entries array share one allocation */
+static int hashtable_alloc(hashtable_t *hashtable, size_t order) {
+    size_t slots_size = order_is_small(order) ? 0 : hashsize(order) * sizeof(slot_t);
+    char *block;
+
+    block = jsonp_malloc_as(slots_size + entries_size(order) * sizeof(pair_t *),
+                            json_stats_buckets);
+    if (!block)
+        return -1;
+
+    memset(block, 0, slots_size);
+    hashtable->slots = slots_size ? (slot_t *)block : NULL;
+    hashtable->entries = (pair_t **)(block + slots_size);
+    hashtable->order = order;
+    return 0;
 }
 
-static JSON_INLINE void list_insert(list_t *list, list_t *node) {
-    node->next = list;
-    node->prev = list->prev;
-    list->prev->next = node;
-    list->prev = node;
+static pair_t *hashtable_find_small(hashtable_t *hashtable, const char *key,
+                                    size_t key_len) {
+    pair_t *pair;
+    size_t i;
+
+    for (i = 0; i < hashtable->entries_used; i++) {
+        pair = hashtable->entries[i];
+        if (pair && pair_has_key(pair, key, key_len))
+            return pair;
+    }
+    return NULL;
 }
 
-static JSON_INLINE void list_remove(list_t *list) {
-    list->prev->next = list->next;
-    list->next->prev = list->prev;
+/* Returns the slot of the key, or the empty slot where it would be
+   inserted */
+static slot_t *hashtable_find_slot(hashtable_t *hashtable, const char *key,
+                                   size_t key_len, size_t hash) {
+    size_t mask = hashmask(hashtable->order);
+    size_t index = hash & mask;
+    slot_t *slot;
+
+    while (1) {
+        slot = &hashtable->slots[index];
+        if (!slot->pair)
+            return slot;
+
+        if (slot->hash == hash && pair_has_key(slot->pair, key, key_len))
+            return slot;
+
+        index = (index + 1) & mask;
+    }
 }
 
-static JSON_INLINE int bucket_is_empty(hashtable_t *hashtable, bucket_t *bucket) {
-    return bucket->first == &hashtable->list && bucket->first == bucket->last;
+static pair_t *hashtable_find_pair(hashtable_t *hashtable, const char *key,
+                                   size_t key_len) {
+    if (hashtable_is_small(hashtable))
+        return hashtable_find_small(hashtable, key, key_len);
+
+    return hashtable_find_slot(hashtable, key, key_len, hash_str(key, key_len))->pair;
+}
+
+size_t hashtable_hash(const char *key, size_t key_len) { return hash_str(key, key_len); }
+
+static void free_shared_key(struct hashtable_key *shared) {
+    if (key_decref(shared) == 0)
+        jsonp_free(shared);
 }
 
-static void insert_to_bucket(hashtable_t *hashtable, bucket_t *bucket, list_t *list) {
-    if (bucket_is_empty(hashtable, bucket)) {
-        list_insert(&hashtable->list, list);
-        bucket->first = bucket->last = list;
+/* Pairs with a shared key have a fixed size */
+static void free_pair(pair_t *pair) {
+    if (pair_is_shared(pair)) {
+        free_shared_key(shared_key(pair->key));
+        jsonp_free_node(pair, sizeof(pair_t));
     } else {
-        list_insert(bucket->first, list);
-        bucket->first = list;
+        jsonp_free(pair);
     }
 }
 
-static pair_t *hashtable_find_pair(hashtable_t *hashtable, bucket_t *bucket,
-                                   const char *key, size_t key_len, size_t hash) {
-    list_t *list;
-    pair_t *pair;
+/* Stores pair in the first free slot from the home slot of hash */
+static void hashtable_insert_slot(hashtable_t *hashtable, size_t hash, pair_t *pair) {
+    slot_t *slot = &hashtable->slots[hash & hashmask(hashtable->order)];
 
-    if (bucket_is_empty(hashtable, bucket))
-        return NULL;
+    while (slot->pair) {
+        if (++slot == hashtable->slots + hashsize(hashtable->order))
+            slot = hashtable->slots;
+    }
+    slot->hash = hash;
+    slot->pair = pair;
+}
 
-    list = bucket->first;
-    while (1) {
-        pair = list_to_pair(list);
-        if (pair->hash == hash && pair->key_len == key_len &&
-            memcmp(pair->key, key, key_len) == 0)
-            return pair;
+/* Empties a slot. The following slots are shifted back so that no
+   slot is left between a key's home slot and the slot it's stored
+   in. */
+static void hashtable_remove_slot(hashtable_t *hashtable, slot_t *slot) {
+    size_t mask = hashmask(hashtable->order);
+    size_t hole = (size_t)(slot - hashtable->slots);
+    size_t index = hole, home;
 
-        if (list == bucket->last)
+    while (1) {
+        index = (index + 1) & mask;
+        if (!hashtable->slots[index].pair)
             break;
 
-        list = list->next;
+        /* The pair may be moved to the hole if its home slot isn't
+           cyclically between the hole and its current slot */
+        home = hashtable->slots[index].hash & mask;
+        if (((index - home) & mask) >= ((index - hole) & mask)) {
+            hashtable->slots[hole] = hashtable->slots[index];
+            hole = index;
+        }
     }
 
-    return NULL;
+    hashtable->slots[hole].pair = NULL;
 }
 
 /* returns 0 on success, -1 if key was not found */
-static int hashtable_do_del(hashtable_t *hashtable, const char *key, size_t key_len,
-                            size_t hash) {
+static int hashtable_do_del(hashtable_t *hashtable, const char *key, size_t key_len) {
     pair_t *pair;
-    bucket_t *bucket;
-    size_t index;
-
-    index = hash & hashmask(hashtable->order);
-    bucket = &hashtable->buckets[index];
+    slot_t *slot;
 
-    pair = hashtable_find_pair(hashtable, bucket, key, key_len, hash);
-    if (!pair)
-        return -1;
-
-    if (&pair->list == bucket->first && &pair->list == bucket->last)
-        bucket->first = bucket->last = &hashtable->list;
+    if (hashtable_is_small(hashtable)) {
+        pair = hashtable_find_small(hashtable, key, key_len);
+        if (!pair)
+            return -1;
+    } else {
+        slot = hashtable_find_slot(hashtable, key, key_len, hash_str(key, key_len));
+        pair = slot->pair;
+        if (!pair)
+            return -1;
 
-    else if (&pair->list == bucket->first)
-        bucket->first = pair->list.next;
+        hashtable_remove_slot(hashtable, slot);
+    }
 
-    else if (&pair->list == bucket->last)
-        bucket->last = pair->list.prev;
+    hashtable->entries[pair->index] = NULL;
+    while (hashtable->entries_used && !hashtable->entries[hashtable->entries_used - 1])
+        hashtable->entries_used--;
 
-    list_remove(&pair->list);
-    list_remove(&pair->ordered_list);
     json_decref(pair->value);
-
-    jsonp_free(pair);
+    free_pair(pair);
     hashtable->size--;
 
     return 0;
 }
 
 static void hashtable_do_clear(hashtable_t *hashtable) {
-    list_t *list, *next;
+    size_t i;
     pair_t *pair;
 
-    for (list = hashtable->list.next; list != &hashtable->list; list = next) {
-        next = list->next;
-        pair = list_to_pair(list);
-        json_decref(pair->value);
-        jsonp_free(pair);
+    for (i = 0; i < hashtable->entries_used; i++) {
+        pair = hashtable->entries[i];
+        if (pair) {
+            json_decref(pair->value);
+            free_pair(pair);
+        }
     }
 }
 
-static int hashtable_do_rehash(hashtable_t *hashtable) {
-    list_t *list, *next;
+/* Rebuilds the table for pow(2, new_order) slots, dropping the
+   holes of deleted pairs from the entries array. The index is
+   created when the table stops being small, and the pairs are only
+   hashed then, as the hashes are kept in the slots. */
+static int hashtable_do_rehash(hashtable_t *hashtable, size_t new_order) {
+    slot_t *old_slots = hashtable->slots;
+    pair_t **old_entries = hashtable->entries;
+    void *old_block = hashtable_block(hashtable);
+    size_t i, hash, old_used = hashtable->entries_used;
+    size_t old_order = hashtable->order;
     pair_t *pair;
-    size_t i, index, new_size, new_order;
-    struct hashtable_bucket *new_buckets;
 
-    new_order = hashtable->order + 1;
-    new_size = hashsize(new_order);
+    jsonp_stats_add(rehashes, 1);
 
-    new_buckets = jsonp_malloc(new_size * sizeof(bucket_t));
-    if (!new_buckets)
+    if (hashtable_alloc(hashtable, new_order)) {
+        hashtable->slots = old_slots;
+        hashtable->entries = old_entries;
+        hashtable->order = old_order;
         return -1;
+    }
 
-    jsonp_free(hashtable->buckets);
-    hashtable->buckets = new_buckets;
-    hashtable->order = new_order;
+    hashtable->entries_used = 0;
+    for (i = 0; i < old_used; i++) {
+        pair = old_entries[i];
+        if (!pair)
+            continue;
 
-    for (i = 0; i < hashsize(hashtable->order); i++) {
-        hashtable->buckets[i].first = hashtable->buckets[i].last = &hashtable->list;
+        pair->index = hashtable->entries_used;
+        hashtable->entries[hashtable->entries_used++] = pair;
     }
 
-    list = hashtable->list.next;
-    list_init(&hashtable->list);
-
-    for (; list != &hashtable->list; list = next) {
-        next = list->next;
-        pair = list_to_pair(list);
-        index = pair->hash % new_size;
-        insert_to_bucket(hashtable, &hashtable->buckets[index], &pair->list);
+    if (hashtable_is_small(hashtable)) {
+        /* no index */
+    } else if (old_slots) {
+        for (i = 0; i < hashsize(old_order); i++) {
+            if (old_slots[i].pair)
+                hashtable_insert_slot(hashtable, old_slots[i].hash, old_slots[i].pair);
+        }
+    } else {
+        for (i = 0; i < hashtable->entries_used; i++) {
+            pair = hashtable->entries[i];
+            if (pair_is_shared(pair))
+                hash = shared_key(pair->key)->hash;
+            else
+                hash = hash_str(pair->key, pair->key_len);
+            hashtable_insert_slot(hashtable, hash, pair);
+        }
     }
 
+    jsonp_free(old_block);
     return 0;
 }
 
 int hashtable_init(hashtable_t *hashtable) {
-    size_t i;
-
+    /* The arrays are allocated when the first pair is added */
     hashtable->size = 0;
+    hashtable->slots = NULL;
     hashtable->order = INITIAL_HASHTABLE_ORDER;
-    hashtable->buckets = jsonp_malloc(hashsize(hashtable->order) * sizeof(bucket_t));
-    if (!hashtable->buckets)
-        return -1;
-
-    list_init(&hashtable->list);
-    list_init(&hashtable->ordered_list);
-
-    for (i = 0; i < hashsize(hashtable->order); i++) {
-        hashtable->buckets[i].first = hashtable->buckets[i].last = &hashtable->list;
-    }
-
+    hashtable->entries = NULL;
+    hashtable->entries_used = 0;
     return 0;
 }
 
 void hashtable_close(hashtable_t *hashtable) {
     hashtable_do_clear(hashtable);
-    jsonp_free(hashtable->buckets);
+    jsonp_free(hashtable_block(hashtable));
+}
+
+int hashtable_reserve(hashtable_t *hashtable, size_t size) {
+    size_t order = hashtable->order;
+
+    if (size <= hashtable->size)
+        return 0;
+
+    /* Avoid an overflow in the size of the arrays */
+    if (size > (size_t)-1 / 4 / sizeof(slot_t))
+        return -1;
+
+    while (entries_size(order) < size)
+        order++;
+
+    /* Already enough room after the last pair */
+    if (hashtable->entries && order == hashtable->order &&
+        entries_size(order) - hashtable->entries_used >= size - hashtable->size)
+        return 0;
+
+    return hashtable_do_rehash(hashtable, order);
 }
 
-static pair_t *init_pair(json_t *value, const char *key, size_t key_len, size_t hash) {
+/* A pair with a shared key refers to it, others have a copy of the
+   key after the pair */
+static pair_t *init_pair(json_t *value, const char *key, size_t key_len, int shared) {
     pair_t *pair;
 
-    /* offsetof(...) returns the size of pair_t without the last,
-   flexible member. This way, the correct amount is
-   allocated. */
+    if (shared) {
+        pair = jsonp_malloc_node(sizeof(pair_t));
+        if (!pair)
+            return NULL;
 
-    if (key_len >= (size_t)-1 - offsetof(pair_t, key)) {
-        /* Avoid an overflow if the key is very long */
-        return NULL;
-    }
+        key_incref(shared_key(key));
+        pair->key = key;
+    } else {
+        if (key_len >= (size_t)-1 - sizeof(pair_t)) {
+            /* Avoid an overflow if the key is very long */
+            return NULL;
+        }
 
-    pair = jsonp_malloc(offsetof(pair_t, key) + key_len + 1);
+        pair = jsonp_malloc_as(sizeof(pair_t) + key_len + 1, json_stats_pairs);
+        if (!pair)
+            return NULL;
 
-    if (!pair)
-        return NULL;
+        memcpy(pair_key(pair), key, key_len);
+        pair_key(pair)[key_len] = '\0';
+        pair->key = pair_key(pair);
+    }
 
-    pair->hash = hash;
-    memcpy(pair->key, key, key_len);
-    pair->key[key_len] = '\0';
     pair->key_len = key_len;
     pair->value = value;
 
-    list_init(&pair->list);
-    list_init(&pair->ordered_list);
-
     return pair;
 }
 
-int hashtable_set(hashtable_t *hashtable, const char *key, size_t key_len,
-                  json_t *value) {
+static int hashtable_do_set(hashtable_t *hashtable, const char *key, size_t key_len,
+                            int shared, json_t *value) {
     pair_t *pair;
-    bucket_t *bucket;
-    size_t hash, index;
+    slot_t *slot = NULL;
+    size_t hash = 0, order;
 
-    /* rehash if the load ratio exceeds 1 */
-    if (hashtable->size >= hashsize(hashtable->order))
-        if (hashtable_do_rehash(hashtable))
-            return -1;
+    /* A shared key has been hashed already */
+    if (shared)
+        hash = shared_key(key)->hash;
 
-    hash = hash_str(key, key_len);
-    index = hash & hashmask(hashtable->order);
-    bucket = &hashtable->buckets[index];
-    pair = hashtable_find_pair(hashtable, bucket, key, key_len, hash);
+    if (hashtable_is_small(hashtable)) {
+        pair = hashtable_find_small(hashtable, key, key_len);
+    } else {
+        if (!shared)
+            hash = hash_str(key, key_len);
+        slot = hashtable_find_slot(hashtable, key, key_len, hash);
+        pair = slot->pair;
+    }
 
     if (pair) {
         json_decref(pair->value);
         pair->value = value;
-    } else {
-        pair = init_pair(value, key, key_len, hash);
+        return 0;
+    }
 
-        if (!pair)
+    if (!hashtable->entries || hashtable->entries_used == entries_size(hashtable->order)) {
+        /* Grow the table if it's at least half full. Otherwise just
+           drop the holes left by deleted pairs. */
+        order = hashtable->order;
+        if (!entries_size(order) ||
+            (hashtable->entries && hashtable->size >= entries_size(order) / 2))
+            order++;
+
+        if (hashtable_do_rehash(hashtable, order))
             return -1;
 
-        insert_to_bucket(hashtable, bucket, &pair->list);
-        list_insert(&hashtable->ordered_list, &pair->ordered_list);
+        if (!hashtable_is_small(hashtable)) {
+            if (!shared)
+                hash = hash_str(key, key_len);
+            slot = hashtable_find_slot(hashtable, key, key_len, hash);
+        }
+    }
 
-        hashtable->size++;
+    pair = init_pair(value, key, key_len, shared);
+    if (!pair)
+        return -1;
+
+    if (slot) {
+        slot->hash = hash;
+        slot->pair = pair;
     }
+
+    pair->index = hashtable->entries_used;
+    hashtable->entries[hashtable->entries_used++] = pair;
+
+    hashtable->size++;
     return 0;
 }
 
+int hashtable_set(hashtable_t *hashtable, const char *key, size_t key_len,
+                  json_t *value) {
+    return hashtable_do_set(hashtable, key, key_len, 0, value);
+}
+
+int hashtable_set_shared(hashtable_t *hashtable, const char *key, json_t *value) {
+    return hashtable_do_set(hashtable, key, hashtable_key_to_iter(key)->key_len, 1,
+                            value);
+}
+
 void *hashtable_get(hashtable_t *hashtable, const char *key, size_t key_len) {
     pair_t *pair;
-    size_t hash;
-    bucket_t *bucket;
 
-    hash = hash_str(key, key_len);
-    bucket = &hashtable->buckets[hash & hashmask(hashtable->order)];
+    pair = hashtable_find_pair(hashtable, key, key_len);
+    if (!pair)
+        return NULL;
+
+    return pair->value;
+}
+
+void *hashtable_get_hashed(hashtable_t *hashtable, const char *key, size_t key_len,
+                           size_t hash) {
+    pair_t *pair;
+
+    if (hashtable_is_small(hashtable))
+        pair = hashtable_find_small(hashtable, key, key_len);
+    else
+        pair = hashtable_find_slot(hashtable, key, key_len, hash)->pair;
 
-    pair = hashtable_find_pair(hashtable, bucket, key, key_len, hash);
     if (!pair)
         return NULL;
 
@@ -273,68 +446,199 @@ void *hashtable_get(hashtable_t *hashtable, const char *key, size_t key_len) {
 }
 
 int hashtable_del(hashtable_t *hashtable, const char *key, size_t key_len) {
-    size_t hash = hash_str(key, key_len);
-    return hashtable_do_del(hashtable, key, key_len, hash);
+    return hashtable_do_del(hashtable, key, key_len);
 }
 
 void hashtable_clear(hashtable_t *hashtable) {
-    size_t i;
-
     hashtable_do_clear(hashtable);
 
-    for (i = 0; i < hashsize(hashtable->order); i++) {
-        hashtable->buckets[i].first = hashtable->buckets[i].last = &hashtable->list;
-    }
-
-    list_init(&hashtable->list);
-    list_init(&hashtable->ordered_list);
+    if (hashtable->slots)
+        memset(hashtable->slots, 0, hashsize(hashtable->order) * sizeof(slot_t));
+    hashtable->entries_used = 0;
     hashtable->size = 0;
 }
 
-void *hashtable_iter(hashtable_t *hashtable) {
-    return hashtable_iter_next(hashtable, &hashtable->ordered_list);
+static void *hashtable_iter_from(hashtable_t *hashtable, size_t index) {
+    for (; index < hashtable->entries_used; index++) {
+        if (hashtable->entries[index])
+            return hashtable->entries[index];
+    }
+    return NULL;
 }
 
+void *hashtable_iter(hashtable_t *hashtable) { return hashtable_iter_from(hashtable, 0); }
+
 void *hashtable_iter_at(hashtable_t *hashtable, const char *key, size_t key_len) {
-    pair_t *pair;
-    size_t hash;
-    bucket_t *bucket;
+    return hashtable_find_pair(hashtable, key, key_len);
+}
 
-    hash = hash_str(key, key_len);
-    bucket = &hashtable->buckets[hash & hashmask(hashtable->order)];
+void *hashtable_iter_of_key(hashtable_t *hashtable, const char *key) {
+    pair_t *pair = hashtable_key_to_iter(key);
+    slot_t *slot;
+    size_t i;
 
-    pair = hashtable_find_pair(hashtable, bucket, key, key_len, hash);
-    if (!pair)
-        return NULL;
+    if (pair->index != HASHTABLE_SHARED)
+        return pair;
 
-    return &pair->ordered_list;
+    /* pair is the header of a shared key */
+    if (hashtable_is_small(hashtable)) {
+        for (i = 0; i < hashtable->entries_used; i++) {
+            if (hashtable->entries[i] && hashtable->entries[i]->key == key)
+                return hashtable->entries[i];
+        }
+        return NULL;
+    }
+    slot = hashtable_find_slot(hashtable, key, pair->key_len, shared_key(key)->hash);
+    return slot->pair;
 }
 
 void *hashtable_iter_next(hashtable_t *hashtable, void *iter) {
-    list_t *list = (list_t *)iter;
-    if (list->next == &hashtable->ordered_list)
-        return NULL;
-    return list->next;
+    pair_t *pair = (pair_t *)iter;
+    return hashtable_iter_from(hashtable, pair->index + 1);
 }
 
 void *hashtable_iter_key(void *iter) {
-    pair_t *pair = ordered_list_to_pair((list_t *)iter);
-    return pair->key;
+    pair_t *pair = (pair_t *)iter;
+    return (void *)pair->key;
 }
 
 size_t hashtable_iter_key_len(void *iter) {
-    pair_t *pair = ordered_list_to_pair((list_t *)iter);
+    pair_t *pair = (pair_t *)iter;
     return pair->key_len;
 }
 
 void *hashtable_iter_value(void *iter) {
-    pair_t *pair = ordered_list_to_pair((list_t *)iter);
+    pair_t *pair = (pair_t *)iter;
     return pair->value;
 }
 
 void hashtable_iter_set(void *iter, json_t *value) {
-    pair_t *pair = ordered_list_to_pair((list_t *)iter);
+    pair_t *pair = (pair_t *)iter;
 
     json_decref(pair->value);
     pair->value = value;
 }
+
+const char *hashtable_iter_shared_key(void *iter) {
+    pair_t *pair = (pair_t *)iter;
+    return pair_is_shared(pair) ? pair->key : NULL;
+}
+
+/*** shared keys ***/
+
+/* The table of shared keys uses open addressing like the index of a
+   hashtable, and is kept at most half full. Keys are never removed
+   from it. */
+
+void hashtable_keys_init(struct json_keys *keys) {
+    keys->slots = NULL;
+    keys->order = 0;
+    keys->size = 0;
+}
+
+void hashtable_keys_close(struct json_keys *keys) {
+    size_t i;
+
+    if (!keys->slots)
+        return;
+
+    for (i = 0; i < hashsize(keys->order); i++) {
+        if (keys->slots[i])
+            free_shared_key(keys->slots[i]);
+    }
+    jsonp_free(keys->slots);
+    keys->slots = NULL;
+    keys->size = 0;
+}
+
+static struct hashtable_key **keys_find_slot(struct json_keys *keys, const char *key,
+                                             size_t key_len, size_t hash) {
+    size_t mask = hashmask(keys->order);
+    size_t index = hash & mask;
+    struct hashtable_key **slot;
+
+    while (1) {
+        slot = &keys->slots[index];
+        if (!*slot || ((*slot)->hash == hash &&
+                       pair_has_key(&(*slot)->header, key, key_len)))
+            return slot;
+
+        index = (index + 1) & mask;
+    }
+}
+
+static int keys_grow(struct json_keys *keys) {
+    struct hashtable_key **old_slots = keys->slots, **slot;
+    size_t i, old_order = keys->order;
+    size_t order = keys->slots ? old_order + 1 : INITIAL_HASHTABLE_ORDER;
+
+    if (hashsize(order) > (size_t)-1 / sizeof(struct hashtable_key *))
+        return -1;
+
+    keys->slots = jsonp_malloc_as(hashsize(order) * sizeof(struct hashtable_key *),
+                                  json_stats_buckets);
+    if (!keys->slots) {
+        keys->slots = old_slots;
+        return -1;
+    }
+    memset(keys->slots, 0, hashsize(order) * sizeof(struct hashtable_key *));
+    keys->order = order;
+
+    if (!old_slots)
+        return 0;
+
+    for (i = 0; i < hashsize(old_order); i++) {
+        if (!old_slots[i])
+            continue;
+
+        slot = &keys->slots[old_slots[i]->hash & hashmask(order)];
+        while (*slot) {
+            if (++slot == keys->slots + hashsize(order))
+                slot = keys->slots;
+        }
+        *slot = old_slots[i];
+    }
+    jsonp_free(old_slots);
+    return 0;
+}
+
+const char *hashtable_keys_intern(struct json_keys *keys, const char *key,
+                                  size_t key_len) {
+    struct hashtable_key **slot, *shared;
+    size_t hash = hash_str(key, key_len);
+    char *bytes;
+
+    if (keys->slots) {
+        slot = keys_find_slot(keys, key, key_len, hash);
+        if (*slot)
+            return (*slot)->header.key;
+    }
+
+    if ((!keys->slots || keys->size >= hashsize(keys->order) / 2) && keys_grow(keys))
+        return NULL;
+
+    if (key_len >= (size_t)-1 - sizeof(struct hashtable_key))
+        return NULL;
+
+    shared = jsonp_malloc_as(sizeof(struct hashtable_key) + key_len + 1,
+                             json_stats_strings);
+    if (!shared)
+        return NULL;
+
+    bytes = (char *)(&shared->header + 1);
+    memcpy(bytes, key, key_len);
+    bytes[key_len] = '\0';
+
+    /* The table holds a reference */
+    shared->refcount = 1;
+    shared->hash = hash;
+    shared->header.value = NULL;
+    shared->header.index = HASHTABLE_SHARED;
+    shared->header.key_len = key_len;
+    shared->header.key = bytes;
+
+    slot = keys_find_slot(keys, key, key_len, hash);
+    *slot = shared;
+    keys->size++;
+    return bytes;
+}
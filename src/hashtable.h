@@ -11,38 +11,58 @@
 #include "jansson.h"
 #include <stdlib.h>
 
-struct hashtable_list {
-    struct hashtable_list *prev;
-    struct hashtable_list *next;
-};
-
 /* "pair" may be a bit confusing a name, but think of it as a
    key-value pair. In this case, it just encodes some extra data,
    too */
 struct hashtable_pair {
-    struct hashtable_list list;
-    struct hashtable_list ordered_list;
-    size_t hash;
     json_t *value;
+    size_t index; /* position in the entries array */
     size_t key_len;
-    char key[1];
+    const char *key; /* the bytes after the pair, or a shared key */
 };
 
-struct hashtable_bucket {
-    struct hashtable_list *first;
-    struct hashtable_list *last;
+/* A key that's shared by pairs of any number of tables. The key
+   follows the header, which has the layout of a pair with
+   HASHTABLE_SHARED as its index, so that a key can be told apart
+   from one stored in a pair by looking at the header before it. */
+struct hashtable_key {
+    volatile size_t refcount;
+    size_t hash;
+    struct hashtable_pair header;
+};
+
+#define HASHTABLE_SHARED ((size_t)-1)
+
+/* A slot of the open addressing index. The hash is kept next to the
+   pair pointer so that probing doesn't have to look at the pairs. */
+struct hashtable_slot {
+    size_t hash;
+    struct hashtable_pair *pair; /* NULL if the slot is empty */
 };
 
 typedef struct hashtable {
     size_t size;
-    struct hashtable_bucket *buckets;
-    size_t order; /* hashtable has pow(2, order) buckets */
-    struct hashtable_list list;
-    struct hashtable_list ordered_list;
+    struct hashtable_slot *slots;
+    size_t order; /* hashtable has pow(2, order) slots */
+
+    /* The pairs in insertion order. Deleted pairs leave a NULL
+       behind, which is removed when the table is resized. */
+    struct hashtable_pair **entries;
+    size_t entries_used;
 } hashtable_t;
 
-#define hashtable_key_to_iter(key_)                                                      \
-    (&(container_of(key_, struct hashtable_pair, key)->ordered_list))
+/* A table of shared keys, see hashtable_keys_intern() */
+struct json_keys {
+    struct hashtable_key **slots; /* pow(2, order) slots, NULL if none */
+    size_t order;
+    size_t size;
+};
+
+#define hashtable_key_to_iter(key_) ((struct hashtable_pair *)(key_)-1)
+#define hashtable_key_is_shared(key_)                                                    \
+    (hashtable_key_to_iter(key_)->index == HASHTABLE_SHARED)
+#define hashtable_shared_key(key_)                                                       \
+    container_of(hashtable_key_to_iter(key_), struct hashtable_key, header)
 
 /**
  * hashtable_init - Initialize a hashtable object
@@ -65,6 +85,19 @@ int hashtable_init(hashtable_t *hashtable) JANSSON_ATTRS((warn_unused_result));
  */
 void hashtable_close(hashtable_t *hashtable);
 
+/**
+ * hashtable_reserve - Make room for pairs in a hashtable
+ *
+ * @hashtable: The hashtable object
+ * @size: The number of pairs
+ *
+ * Grows the hashtable so that it can hold size pairs in total
+ * without being resized.
+ *
+ * Returns 0 on success, -1 on failure (out of memory).
+ */
+int hashtable_reserve(hashtable_t *hashtable, size_t size);
+
 /**
  * hashtable_set - Add/modify value in hashtable
  *
@@ -83,6 +116,20 @@ void hashtable_close(hashtable_t *hashtable);
  */
 int hashtable_set(hashtable_t *hashtable, const char *key, size_t key_len, json_t *value);
 
+/**
+ * hashtable_set_shared - Add/modify value in hashtable with a shared key
+ *
+ * @hashtable: The hashtable object
+ * @key: A key returned by hashtable_keys_intern()
+ * @value: The value
+ *
+ * Like hashtable_set(), but a new pair refers to key instead of
+ * copying it.
+ *
+ * Returns 0 on success, -1 on failure (out of memory).
+ */
+int hashtable_set_shared(hashtable_t *hashtable, const char *key, json_t *value);
+
 /**
  * hashtable_get - Get a value associated with a key
  *
@@ -94,6 +141,30 @@ int hashtable_set(hashtable_t *hashtable, const char *key, size_t key_len, json_
  */
 void *hashtable_get(hashtable_t *hashtable, const char *key, size_t key_len);
 
+/**
+ * hashtable_hash - Compute the hash of a key
+ *
+ * @key: The key
+ * @key_len: The length of key
+ *
+ * Returns the hash that hashtable_get_hashed() expects. The hash
+ * depends on the hashtable seed, which must be set beforehand.
+ */
+size_t hashtable_hash(const char *key, size_t key_len);
+
+/**
+ * hashtable_get_hashed - Get a value associated with a hashed key
+ *
+ * @hashtable: The hashtable object
+ * @key: The key
+ * @key_len: The length of key
+ * @hash: The hash of key, as returned by hashtable_hash()
+ *
+ * Like hashtable_get() but doesn't hash the key again.
+ */
+void *hashtable_get_hashed(hashtable_t *hashtable, const char *key, size_t key_len,
+                           size_t hash);
+
 /**
  * hashtable_del - Remove a value from the hashtable
  *
@@ -121,7 +192,7 @@ void hashtable_clear(hashtable_t *hashtable);
  *
  * Returns an opaque iterator to the first element in the hashtable.
  * The iterator should be passed to hashtable_iter_* functions.
- * The hashtable items are not iterated over in any particular order.
+ * The hashtable items are iterated over in insertion order.
  *
  * There's no need to free the iterator in any way. The iterator is
  * valid as long as the item that is referenced by the iterator is not
@@ -143,6 +214,17 @@ void *hashtable_iter(hashtable_t *hashtable);
  */
 void *hashtable_iter_at(hashtable_t *hashtable, const char *key, size_t key_len);
 
+/**
+ * hashtable_iter_of_key - Return the iterator of a key
+ *
+ * @hashtable: The hashtable object
+ * @key: A key returned by hashtable_iter_key() for this hashtable
+ *
+ * Like hashtable_key_to_iter(), but also works for shared keys, which
+ * are looked up by address.
+ */
+void *hashtable_iter_of_key(hashtable_t *hashtable, const char *key);
+
 /**
  * hashtable_iter_next - Advance an iterator
  *
@@ -183,4 +265,48 @@ void *hashtable_iter_value(void *iter);
  */
 void hashtable_iter_set(void *iter, json_t *value);
 
+/**
+ * hashtable_iter_shared_key - Retrieve the shared key pointed by an iterator
+ *
+ * @iter: The iterator
+ *
+ * Returns the key if it's a shared key, or NULL otherwise.
+ */
+const char *hashtable_iter_shared_key(void *iter);
+
+/**
+ * hashtable_keys_init - Initialize a table of shared keys
+ *
+ * @keys: The (statically allocated) table
+ *
+ * The table should be cleared with hashtable_keys_close when it's no
+ * longer used.
+ */
+void hashtable_keys_init(struct json_keys *keys);
+
+/**
+ * hashtable_keys_close - Release a table of shared keys
+ *
+ * @keys: The table
+ *
+ * The keys stay valid for as long as pairs refer to them.
+ */
+void hashtable_keys_close(struct json_keys *keys);
+
+/**
+ * hashtable_keys_intern - Return the shared key for a key
+ *
+ * @keys: The table
+ * @key: The key
+ * @key_len: The length of key
+ *
+ * Returns the shared key that's equal to key, adding it to the table
+ * if it's not there, or NULL on failure (out of memory). The shared
+ * key is null-terminated and stays valid for as long as the table or
+ * a pair refers to it. The hash of the key is computed once and kept
+ * with it, so the hashtable seed must be set beforehand.
+ */
+const char *hashtable_keys_intern(struct json_keys *keys, const char *key,
+                                  size_t key_len);
+
 #endif
@@ -93,7 +93,11 @@ typedef long json_int_t;
 /* construction, destruction, reference counting */
 
 json_t *json_object(void);
+json_t *json_object_with_capacity(size_t capacity);
 json_t *json_array(void);
+json_t *json_array_with_capacity(size_t capacity);
+json_t *json_array_of_integers(const json_int_t *values, size_t count);
+json_t *json_array_of_reals(const double *values, size_t count);
 json_t *json_string(const char *value);
 json_t *json_stringn(const char *value, size_t len);
 json_t *json_string_nocheck(const char *value);
@@ -175,7 +179,9 @@ enum json_error_code {
     json_error_duplicate_key,
     json_error_numeric_overflow,
     json_error_item_not_found,
-    json_error_index_out_of_range
+    json_error_index_out_of_range,
+    json_error_test_failed,
+    json_error_limit_exceeded
 };
 
 static JSON_INLINE enum json_error_code json_error_code(const json_error_t *e) {
@@ -190,6 +196,31 @@ json_t *json_object_get(const json_t *object, const char *key)
     JANSSON_ATTRS((warn_unused_result));
 json_t *json_object_getn(const json_t *object, const char *key, size_t key_len)
     JANSSON_ATTRS((warn_unused_result));
+
+/* A key with its hash computed in advance. The members are private. */
+typedef struct json_key_t {
+    const char *key;
+    size_t key_len;
+    size_t hash;
+} json_key_t;
+
+json_key_t json_key(const char *key);
+json_key_t json_keyn(const char *key, size_t key_len);
+json_t *json_object_get_key(const json_t *object, json_key_t key)
+    JANSSON_ATTRS((warn_unused_result));
+
+/* A table of keys that are shared by the objects that use them */
+typedef struct json_keys json_keys_t;
+
+json_keys_t *json_keys_new(void) JANSSON_ATTRS((warn_unused_result));
+void json_keys_free(json_keys_t *keys);
+size_t json_keys_size(const json_keys_t *keys);
+json_key_t json_keys_intern(json_keys_t *keys, const char *key, size_t key_len);
+int json_object_set_new_interned(json_t *object, json_keys_t *keys, const char *key,
+                                 json_t *value);
+int json_object_setn_new_interned(json_t *object, json_keys_t *keys, const char *key,
+                                  size_t key_len, json_t *value);
+
 int json_object_set_new(json_t *object, const char *key, json_t *value);
 int json_object_setn_new(json_t *object, const char *key, size_t key_len, json_t *value);
 int json_object_set_new_nocheck(json_t *object, const char *key, json_t *value);
@@ -198,6 +229,7 @@ int json_object_setn_new_nocheck(json_t *object, const char *key, size_t key_len
 int json_object_del(json_t *object, const char *key);
 int json_object_deln(json_t *object, const char *key, size_t key_len);
 int json_object_clear(json_t *object);
+int json_object_reserve(json_t *object, size_t capacity);
 int json_object_update(json_t *object, json_t *other);
 int json_object_update_existing(json_t *object, json_t *other);
 int json_object_update_missing(json_t *object, json_t *other);
@@ -205,40 +237,47 @@ int json_object_update_recursive(json_t *object, json_t *other);
 void *json_object_iter(json_t *object);
 void *json_object_iter_at(json_t *object, const char *key);
 void *json_object_key_to_iter(const char *key);
+void *json_object_iter_from_key(json_t *object, const char *key);
 void *json_object_iter_next(json_t *object, void *iter);
 const char *json_object_iter_key(void *iter);
 size_t json_object_iter_key_len(void *iter);
 json_t *json_object_iter_value(void *iter);
 int json_object_iter_set_new(json_t *object, void *iter, json_t *value);
 
+/* The macros below use json_object_iter_from_key() so that they also
+   work for objects with shared keys */
 #define json_object_foreach(object, key, value)                                          \
     for (key = json_object_iter_key(json_object_iter(object));                           \
-         key && (value = json_object_iter_value(json_object_key_to_iter(key)));          \
+         key &&                                                                          \
+         (value = json_object_iter_value(json_object_iter_from_key(object, key)));       \
          key = json_object_iter_key(                                                     \
-             json_object_iter_next(object, json_object_key_to_iter(key))))
+             json_object_iter_next(object, json_object_iter_from_key(object, key))))
 
 #define json_object_keylen_foreach(object, key, key_len, value)                          \
     for (key = json_object_iter_key(json_object_iter(object)),                           \
-        key_len = json_object_iter_key_len(json_object_key_to_iter(key));                \
-         key && (value = json_object_iter_value(json_object_key_to_iter(key)));          \
+        key_len = json_object_iter_key_len(json_object_iter_from_key(object, key));      \
+         key &&                                                                          \
+         (value = json_object_iter_value(json_object_iter_from_key(object, key)));       \
          key = json_object_iter_key(                                                     \
-             json_object_iter_next(object, json_object_key_to_iter(key))),               \
-        key_len = json_object_iter_key_len(json_object_key_to_iter(key)))
+             json_object_iter_next(object, json_object_iter_from_key(object, key))),     \
+        key_len = json_object_iter_key_len(json_object_iter_from_key(object, key)))
 
 #define json_object_foreach_safe(object, n, key, value)                                  \
     for (key = json_object_iter_key(json_object_iter(object)),                           \
-        n = json_object_iter_next(object, json_object_key_to_iter(key));                 \
-         key && (value = json_object_iter_value(json_object_key_to_iter(key)));          \
+        n = json_object_iter_next(object, json_object_iter_from_key(object, key));       \
+         key &&                                                                          \
+         (value = json_object_iter_value(json_object_iter_from_key(object, key)));       \
          key = json_object_iter_key(n),                                                  \
-        n = json_object_iter_next(object, json_object_key_to_iter(key)))
+        n = json_object_iter_next(object, json_object_iter_from_key(object, key)))
 
 #define json_object_keylen_foreach_safe(object, n, key, key_len, value)                  \
     for (key = json_object_iter_key(json_object_iter(object)),                           \
-        n = json_object_iter_next(object, json_object_key_to_iter(key)),                 \
-        key_len = json_object_iter_key_len(json_object_key_to_iter(key));                \
-         key && (value = json_object_iter_value(json_object_key_to_iter(key)));          \
+        n = json_object_iter_next(object, json_object_iter_from_key(object, key)),       \
+        key_len = json_object_iter_key_len(json_object_iter_from_key(object, key));      \
+         key &&                                                                          \
+         (value = json_object_iter_value(json_object_iter_from_key(object, key)));       \
          key = json_object_iter_key(n), key_len = json_object_iter_key_len(n),           \
-        n = json_object_iter_next(object, json_object_key_to_iter(key)))
+        n = json_object_iter_next(object, json_object_iter_from_key(object, key)))
 
 #define json_array_foreach(array, index, value)                                          \
     for (index = 0;                                                                      \
@@ -294,7 +333,16 @@ int json_array_append_new(json_t *array, json_t *value);
 int json_array_insert_new(json_t *array, size_t index, json_t *value);
 int json_array_remove(json_t *array, size_t index);
 int json_array_clear(json_t *array);
+int json_array_reserve(json_t *array, size_t capacity);
 int json_array_extend(json_t *array, json_t *other);
+int json_array_splice_new(json_t *array, size_t index, size_t count,
+                          json_t *const *values, size_t nvalues);
+int json_array_remove_range(json_t *array, size_t index, size_t count);
+
+typedef int (*json_array_filter_t)(json_t *value, size_t index, void *data);
+int json_array_filter(json_t *array, json_array_filter_t filter, void *data);
+const json_int_t *json_array_int_data(const json_t *array);
+const double *json_array_real_data(const json_t *array);
 
 static JSON_INLINE int json_array_set(json_t *array, size_t ind, json_t *value) {
     return json_array_set_new(array, ind, json_incref(value));
@@ -308,6 +356,24 @@ static JSON_INLINE int json_array_insert(json_t *array, size_t ind, json_t *valu
     return json_array_insert_new(array, ind, json_incref(value));
 }
 
+static JSON_INLINE int json_array_splice(json_t *array, size_t ind, size_t count,
+                                         json_t *const *values, size_t nvalues) {
+    size_t i;
+    for (i = 0; i < nvalues; i++)
+        json_incref(values[i]);
+    return json_array_splice_new(array, ind, count, values, nvalues);
+}
+
+static JSON_INLINE int json_array_append_many_new(json_t *array, json_t *const *values,
+                                                  size_t nvalues) {
+    return json_array_splice_new(array, json_array_size(array), 0, values, nvalues);
+}
+
+static JSON_INLINE int json_array_append_many(json_t *array, json_t *const *values,
+                                              size_t nvalues) {
+    return json_array_splice(array, json_array_size(array), 0, values, nvalues);
+}
+
 const char *json_string_value(const json_t *string);
 size_t json_string_length(const json_t *string);
 json_int_t json_integer_value(const json_t *integer);
@@ -337,6 +403,32 @@ int json_unpack_ex(json_t *root, json_error_t *error, size_t flags, const char *
 int json_vunpack_ex(json_t *root, json_error_t *error, size_t flags, const char *fmt,
                     va_list ap);
 
+/* compiled pack and unpack formats */
+
+typedef struct json_pack_plan json_pack_plan_t;
+
+json_pack_plan_t *json_pack_compile(const char *fmt, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+void json_pack_plan_free(json_pack_plan_t *plan);
+json_t *json_pack_plan(const json_pack_plan_t *plan, ...)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_pack_plan_ex(json_error_t *error, size_t flags, const json_pack_plan_t *plan,
+                          ...) JANSSON_ATTRS((warn_unused_result));
+json_t *json_vpack_plan_ex(json_error_t *error, size_t flags,
+                           const json_pack_plan_t *plan, va_list ap)
+    JANSSON_ATTRS((warn_unused_result));
+
+typedef struct json_unpack_plan json_unpack_plan_t;
+
+json_unpack_plan_t *json_unpack_compile(const char *fmt, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+void json_unpack_plan_free(json_unpack_plan_t *plan);
+int json_unpack_plan(json_t *root, const json_unpack_plan_t *plan, ...);
+int json_unpack_plan_ex(json_t *root, json_error_t *error, size_t flags,
+                        const json_unpack_plan_t *plan, ...);
+int json_vunpack_plan_ex(json_t *root, json_error_t *error, size_t flags,
+                         const json_unpack_plan_t *plan, va_list ap);
+
 /* sprintf */
 
 json_t *json_sprintf(const char *fmt, ...)
@@ -347,11 +439,61 @@ json_t *json_vsprintf(const char *fmt, va_list ap)
 /* equality */
 
 int json_equal(const json_t *value1, const json_t *value2);
+size_t json_hash(const json_t *value);
 
 /* copying */
 
 json_t *json_copy(json_t *value) JANSSON_ATTRS((warn_unused_result));
 json_t *json_deep_copy(const json_t *value) JANSSON_ATTRS((warn_unused_result));
+json_t *json_deep_copy_cow(const json_t *value) JANSSON_ATTRS((warn_unused_result));
+
+/* freezing */
+
+int json_freeze(json_t *value);
+json_t *json_thaw(json_t *value);
+
+/* concurrent objects */
+
+json_t *json_object_concurrent(void) JANSSON_ATTRS((warn_unused_result));
+void json_concurrent_enter(void);
+void json_concurrent_leave(void);
+
+/* patches */
+
+json_t *json_diff(const json_t *source, const json_t *target)
+    JANSSON_ATTRS((warn_unused_result));
+int json_patch_apply(json_t *json, const json_t *patch, json_error_t *error);
+json_t *json_merge_diff(const json_t *source, const json_t *target)
+    JANSSON_ATTRS((warn_unused_result));
+int json_merge_patch_apply(json_t *json, const json_t *patch);
+
+/* JSON Pointers */
+
+#define JSON_PATH_WILDCARDS 0x1
+
+typedef struct json_path json_path_t;
+
+json_path_t *json_path_compile(const char *path, size_t flags, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+void json_path_free(json_path_t *path);
+json_t *json_path_eval(const json_t *json, const json_path_t *path);
+json_t *json_path_eval_all(const json_t *json, const json_path_t *path)
+    JANSSON_ATTRS((warn_unused_result));
+
+/* arenas */
+
+typedef struct json_arena json_arena_t;
+
+json_arena_t *json_arena_new(void) JANSSON_ATTRS((warn_unused_result));
+void json_arena_reset(json_arena_t *arena);
+void json_arena_free(json_arena_t *arena);
+
+/* reusable decoding contexts */
+
+typedef struct json_load_ctx json_load_ctx_t;
+
+json_load_ctx_t *json_load_ctx_new(void) JANSSON_ATTRS((warn_unused_result));
+void json_load_ctx_free(json_load_ctx_t *ctx);
 
 /* decoding */
 
@@ -360,6 +502,9 @@ json_t *json_deep_copy(const json_t *value) JANSSON_ATTRS((warn_unused_result));
 #define JSON_DECODE_ANY         0x4
 #define JSON_DECODE_INT_AS_REAL 0x8
 #define JSON_ALLOW_NUL          0x10
+#define JSON_DECODE_CBOR        0x40
+#define JSON_DECODE_MSGPACK     0x80
+#define JSON_PARSER_DEPTH(n)    (((size_t)(n)&0xFFFFFF) << 8)
 
 typedef size_t (*json_load_callback_t)(void *buffer, size_t buflen, void *data);
 
@@ -367,6 +512,43 @@ json_t *json_loads(const char *input, size_t flags, json_error_t *error)
     JANSSON_ATTRS((warn_unused_result));
 json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t *error)
     JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadb_cbor(const char *buffer, size_t buflen, size_t flags,
+                        json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadb_msgpack(const char *buffer, size_t buflen, size_t flags,
+                           json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadb_insitu(char *buffer, size_t buflen, size_t flags,
+                          json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadb_arena(const char *buffer, size_t buflen, size_t flags,
+                         json_arena_t *arena, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadb_interned(const char *buffer, size_t buflen, size_t flags,
+                            json_keys_t *keys, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadb_lazy(const char *buffer, size_t buflen, size_t flags,
+                        json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadb_packed(const char *buffer, size_t buflen, size_t flags,
+                          json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+json_t *json_path_loadb(const char *buffer, size_t buflen, size_t flags,
+                        const json_path_t *path, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+int json_expand(json_t *json, json_error_t *error);
+
+/* limits of a single load, 0 for no limit */
+typedef struct json_load_limits_t {
+    size_t max_bytes;          /* memory allocated while decoding */
+    size_t max_values;         /* values, including objects and arrays */
+    size_t max_string_length;  /* bytes in a string or key */
+    size_t max_container_size; /* members of an object or an array */
+} json_load_limits_t;
+
+json_t *json_loadb_limited(const char *buffer, size_t buflen, size_t flags,
+                           const json_load_limits_t *limits, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_load_callback_limited(json_load_callback_t callback, void *arg, size_t flags,
+                                   const json_load_limits_t *limits,
+                                   json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+int json_validate(const char *buffer, size_t buflen, size_t flags, json_error_t *error);
 json_t *json_loadf(FILE *input, size_t flags, json_error_t *error)
     JANSSON_ATTRS((warn_unused_result));
 json_t *json_loadfd(int input, size_t flags, json_error_t *error)
@@ -375,6 +557,119 @@ json_t *json_load_file(const char *path, size_t flags, json_error_t *error)
     JANSSON_ATTRS((warn_unused_result));
 json_t *json_load_callback(json_load_callback_t callback, void *data, size_t flags,
                            json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadb_ctx(const char *buffer, size_t buflen, size_t flags,
+                       json_load_ctx_t *ctx, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadf_ctx(FILE *input, size_t flags, json_load_ctx_t *ctx,
+                       json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadfd_ctx(int input, size_t flags, json_load_ctx_t *ctx,
+                        json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+json_t *json_load_file_ctx(const char *path, size_t flags, json_load_ctx_t *ctx,
+                           json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+json_t *json_load_callback_ctx(json_load_callback_t callback, void *data, size_t flags,
+                               json_load_ctx_t *ctx, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+
+/* incremental decoding */
+
+typedef struct json_parser json_parser_t;
+
+#define JSON_PARSER_ERROR     -1
+#define JSON_PARSER_NEED_MORE 0
+#define JSON_PARSER_DONE      1
+
+json_parser_t *json_parser_new(size_t flags) JANSSON_ATTRS((warn_unused_result));
+int json_parser_feed(json_parser_t *parser, const char *buffer, size_t buflen);
+int json_parser_finish(json_parser_t *parser);
+json_t *json_parser_result(json_parser_t *parser, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+void json_parser_free(json_parser_t *parser);
+
+/* event callbacks */
+
+typedef struct json_sax_callbacks_t {
+    int (*start_object)(void *data);
+    int (*end_object)(void *data);
+    int (*key)(void *data, const char *key, size_t len);
+    int (*start_array)(void *data);
+    int (*end_array)(void *data);
+    int (*string)(void *data, const char *value, size_t len);
+    int (*integer)(void *data, json_int_t value);
+    int (*real)(void *data, double value);
+    int (*boolean)(void *data, int value);
+    int (*null)(void *data);
+} json_sax_callbacks_t;
+
+int json_sax_loadb(const char *buffer, size_t buflen, size_t flags,
+                   const json_sax_callbacks_t *callbacks, void *data,
+                   json_error_t *error);
+int json_sax_loadf(FILE *input, size_t flags, const json_sax_callbacks_t *callbacks,
+                   void *data, json_error_t *error);
+int json_sax_load_file(const char *path, size_t flags,
+                       const json_sax_callbacks_t *callbacks, void *data,
+                       json_error_t *error);
+int json_sax_load_callback(json_load_callback_t callback, void *arg, size_t flags,
+                           const json_sax_callbacks_t *callbacks, void *data,
+                           json_error_t *error);
+json_parser_t *json_parser_new_sax(size_t flags, const json_sax_callbacks_t *callbacks,
+                                   void *data) JANSSON_ATTRS((warn_unused_result));
+
+/* newline-delimited JSON */
+
+#define JSON_LINES_UNORDERED 0x20
+
+typedef int (*json_line_callback_t)(json_t *record, size_t position, void *data);
+
+int json_loadb_lines(const char *buffer, size_t buflen, size_t flags,
+                     json_line_callback_t callback, void *data, json_error_t *error);
+int json_loadf_lines(FILE *input, size_t flags, json_line_callback_t callback,
+                     void *data, json_error_t *error);
+int json_loadfd_lines(int input, size_t flags, json_line_callback_t callback,
+                      void *data, json_error_t *error);
+int json_load_file_lines(const char *path, size_t flags, json_line_callback_t callback,
+                         void *data, json_error_t *error);
+int json_loadb_lines_parallel(const char *buffer, size_t buflen, size_t flags,
+                              size_t nthreads, json_line_callback_t callback,
+                              void *data, json_error_t *error);
+json_t *json_loadb_parallel(const char *buffer, size_t buflen, size_t flags,
+                            size_t nthreads, json_error_t *error);
+
+/* read-only documents */
+
+typedef struct json_tape json_tape_t;
+
+typedef struct {
+    const json_tape_t *tape; /* NULL if the cursor doesn't point to a value */
+    size_t index;            /* private */
+    size_t key;              /* private */
+} json_cursor_t;
+
+json_tape_t *json_tape_loadb(const char *buffer, size_t buflen, size_t flags,
+                             json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+void json_tape_free(json_tape_t *tape);
+json_cursor_t json_tape_root(const json_tape_t *tape);
+json_t *json_tape_to_value(json_cursor_t cursor) JANSSON_ATTRS((warn_unused_result));
+
+#define json_cursor_valid(cursor) ((cursor).tape != NULL)
+
+int json_cursor_type(json_cursor_t cursor);
+size_t json_cursor_size(json_cursor_t cursor);
+json_cursor_t json_cursor_first(json_cursor_t cursor);
+json_cursor_t json_cursor_next(json_cursor_t cursor);
+json_cursor_t json_cursor_at(json_cursor_t array, size_t index);
+json_cursor_t json_cursor_get(json_cursor_t object, const char *key);
+json_cursor_t json_cursor_getn(json_cursor_t object, const char *key, size_t key_len);
+const char *json_cursor_key(json_cursor_t cursor);
+size_t json_cursor_key_len(json_cursor_t cursor);
+const char *json_cursor_string_value(json_cursor_t cursor);
+size_t json_cursor_string_length(json_cursor_t cursor);
+json_int_t json_cursor_integer_value(json_cursor_t cursor);
+double json_cursor_real_value(json_cursor_t cursor);
+double json_cursor_number_value(json_cursor_t cursor);
+
+#define json_cursor_foreach(container, cursor)                                           \
+    for (cursor = json_cursor_first(container); json_cursor_valid(cursor);               \
+         cursor = json_cursor_next(cursor))
 
 /* encoding */
 
@@ -388,17 +683,84 @@ json_t *json_load_callback(json_load_callback_t callback, void *data, size_t fla
 #define JSON_ESCAPE_SLASH      0x400
 #define JSON_REAL_PRECISION(n) (((n)&0x1F) << 11)
 #define JSON_EMBED             0x10000
+#define JSON_EXACT_SIZE        0x20000
+#define JSON_NO_CYCLE_CHECK    0x40000
+#define JSON_ENCODE_CBOR       0x80000
+#define JSON_ENCODE_MSGPACK    0x100000
 
 typedef int (*json_dump_callback_t)(const char *buffer, size_t size, void *data);
 
 char *json_dumps(const json_t *json, size_t flags) JANSSON_ATTRS((warn_unused_result));
 size_t json_dumpb(const json_t *json, char *buffer, size_t size, size_t flags);
+size_t json_dumpb_cbor(const json_t *json, char *buffer, size_t size, size_t flags);
+size_t json_dumpb_msgpack(const json_t *json, char *buffer, size_t size, size_t flags);
+size_t json_dump_size(const json_t *json, size_t flags);
 int json_dumpf(const json_t *json, FILE *output, size_t flags);
 int json_dumpfd(const json_t *json, int output, size_t flags);
 int json_dump_file(const json_t *json, const char *path, size_t flags);
 int json_dump_callback(const json_t *json, json_dump_callback_t callback, void *data,
                        size_t flags);
 
+int json_dumpf_lines(const json_t *records, FILE *output, size_t flags);
+int json_dumpfd_lines(const json_t *records, int output, size_t flags);
+int json_dump_file_lines(const json_t *records, const char *path, size_t flags);
+int json_dump_lines_callback(const json_t *records, json_dump_callback_t callback,
+                             void *data, size_t flags);
+
+char *json_dumps_parallel(const json_t *json, size_t flags, size_t nthreads)
+    JANSSON_ATTRS((warn_unused_result));
+int json_dump_callback_parallel(const json_t *json, json_dump_callback_t callback,
+                                void *data, size_t flags, size_t nthreads);
+
+/* scatter-gather encoding */
+
+typedef struct {
+    const char *base;
+    size_t len;
+} json_iovec_t;
+
+typedef struct json_dumpv json_dumpv_t;
+
+json_dumpv_t *json_dumpv(const json_t *json, size_t flags)
+    JANSSON_ATTRS((warn_unused_result));
+size_t json_dumpv_count(const json_dumpv_t *dv);
+const json_iovec_t *json_dumpv_iov(const json_dumpv_t *dv);
+size_t json_dumpv_size(const json_dumpv_t *dv);
+void json_dumpv_free(json_dumpv_t *dv);
+int json_dumpfd_writev(const json_t *json, int output, size_t flags);
+
+/* streaming encoding */
+
+typedef struct json_writer json_writer_t;
+
+json_writer_t *json_writer_new(json_dump_callback_t callback, void *data, size_t flags)
+    JANSSON_ATTRS((warn_unused_result));
+json_writer_t *json_writer_newf(FILE *output, size_t flags)
+    JANSSON_ATTRS((warn_unused_result));
+json_writer_t *json_writer_newfd(int output, size_t flags)
+    JANSSON_ATTRS((warn_unused_result));
+int json_writer_begin_object(json_writer_t *writer);
+int json_writer_end_object(json_writer_t *writer);
+int json_writer_begin_array(json_writer_t *writer);
+int json_writer_end_array(json_writer_t *writer);
+int json_writer_key(json_writer_t *writer, const char *key);
+int json_writer_keyn(json_writer_t *writer, const char *key, size_t len);
+int json_writer_string(json_writer_t *writer, const char *value);
+int json_writer_stringn(json_writer_t *writer, const char *value, size_t len);
+int json_writer_integer(json_writer_t *writer, json_int_t value);
+int json_writer_real(json_writer_t *writer, double value);
+int json_writer_boolean(json_writer_t *writer, int value);
+int json_writer_null(json_writer_t *writer);
+int json_writer_value(json_writer_t *writer, const json_t *value);
+int json_writer_flush(json_writer_t *writer);
+int json_writer_finish(json_writer_t *writer);
+void json_writer_free(json_writer_t *writer);
+
+int json_pack_plan_write(json_writer_t *writer, json_error_t *error,
+                         const json_pack_plan_t *plan, ...);
+int json_vpack_plan_write(json_writer_t *writer, json_error_t *error,
+                          const json_pack_plan_t *plan, va_list ap);
+
 /* custom memory allocation */
 
 typedef void *(*json_malloc_t)(size_t);
@@ -406,6 +768,37 @@ typedef void (*json_free_t)(void *);
 
 void json_set_alloc_funcs(json_malloc_t malloc_fn, json_free_t free_fn);
 void json_get_alloc_funcs(json_malloc_t *malloc_fn, json_free_t *free_fn);
+int json_set_alloc_pools(int enable);
+
+/* statistics */
+
+enum json_stats_category {
+    json_stats_nodes,   /* values */
+    json_stats_strings, /* string values and keys */
+    json_stats_buckets, /* hash tables of objects */
+    json_stats_pairs,   /* members of objects */
+    json_stats_arrays,  /* tables of arrays */
+    json_stats_buffers, /* buffers for decoding and encoding */
+    json_stats_other
+};
+
+#define JSON_STATS_CATEGORIES 7
+
+typedef struct json_stats {
+    size_t allocs[JSON_STATS_CATEGORIES];
+    size_t alloc_bytes[JSON_STATS_CATEGORIES];
+    size_t frees;
+    size_t rehashes;
+    size_t array_grows;
+    size_t parse_calls;
+    size_t parse_bytes;
+    double parse_seconds;
+    size_t dump_calls;
+    size_t dump_bytes;
+    double dump_seconds;
+} json_stats_t;
+
+int json_get_stats(json_stats_t *stats);
 
 /* runtime version checking */
 
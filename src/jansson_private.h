@@ -32,9 +32,39 @@
 #endif
 #endif
 
+/* The text of a container that json_loadb_lazy() hasn't decoded yet,
+   and where in the input it is, for error messages */
+typedef struct {
+    const char *text; /* from the opening to the closing bracket */
+    size_t length;
+    size_t flags;
+    size_t depth;
+    size_t position;
+    int line;
+    int column;
+} jsonp_lazy_t;
+
+/* The lock-free index of an object from json_object_concurrent(),
+   see concurrent.c */
+typedef struct jsonp_concurrent jsonp_concurrent_t;
+
+/* The state of an object or array that is used in one of the less
+   common ways. Most containers don't have it, and it's freed once
+   nothing in it is used any more, see jsonp_extra_trim(). */
+typedef struct {
+    jsonp_lazy_t *lazy;             /* NULL once decoded */
+    json_t *source;                 /* of a copy-on-write copy, NULL once copied */
+    jsonp_concurrent_t *concurrent; /* NULL for other objects */
+    void *packed;       /* the entries of a packed array, NULL once boxed */
+    size_t packed_size; /* the room for entries in packed */
+    int packed_type;    /* JSON_INTEGER or JSON_REAL */
+} jsonp_extra_t;
+
 typedef struct {
     json_t json;
     hashtable_t hashtable;
+    size_t hash;          /* of a value that can't change, 0 if not known */
+    jsonp_extra_t *extra; /* NULL for ordinary objects */
 } json_object_t;
 
 typedef struct {
@@ -42,12 +72,21 @@ typedef struct {
     size_t size;
     size_t entries;
     json_t **table;
+    size_t hash;          /* of a value that can't change, 0 if not known */
+    jsonp_extra_t *extra; /* NULL for ordinary arrays */
 } json_array_t;
 
+/* A field of the extra state of an object or array, or 0 if it has
+   none */
+#define jsonp_extra(container_, field_)                                                  \
+    ((container_)->extra ? (container_)->extra->field_ : 0)
+
 typedef struct {
     json_t json;
     char *value;
     size_t length;
+    int borrowed;      /* value points into memory owned by someone else */
+    unsigned int room; /* for a short value right after the struct */
 } json_string_t;
 
 typedef struct {
@@ -60,15 +99,92 @@ typedef struct {
     json_int_t value;
 } json_integer_t;
 
+/* A reference token of a compiled JSON Pointer, see path.c */
+#define JSONP_PATH_KEY      0 /* refers to a member of an object */
+#define JSONP_PATH_INDEX    1 /* to a member or an element of an array */
+#define JSONP_PATH_WILDCARD 2 /* to every member or element */
+
+typedef struct {
+    json_key_t key; /* the decoded token */
+    size_t index;
+    int type;
+} jsonp_path_segment_t;
+
+struct json_path {
+    const char *text; /* the pointer it was compiled from */
+    size_t length;
+    jsonp_path_segment_t *segments;
+};
+
+/* Whether segment refers to the member key of an object */
+#define jsonp_path_match_key(segment, key_, len_)                                        \
+    ((segment)->type == JSONP_PATH_WILDCARD ||                                           \
+     ((segment)->key.key_len == (len_) && !memcmp((segment)->key.key, key_, len_)))
+
 #define json_to_object(json_)  container_of(json_, json_object_t, json)
 #define json_to_array(json_)   container_of(json_, json_array_t, json)
 #define json_to_string(json_)  container_of(json_, json_string_t, json)
 #define json_to_real(json_)    container_of(json_, json_real_t, json)
 #define json_to_integer(json_) container_of(json_, json_integer_t, json)
 
+/* Strings shorter than this, with the terminating null byte, are
+   stored in the same allocation as their json_string_t */
+#define JSONP_STRING_INLINE_MAX 24
+
 /* Create a string by taking ownership of an existing buffer */
 json_t *jsonp_stringn_nocheck_own(const char *value, size_t len);
 
+/* Decode the members of a container loaded by json_loadb_lazy(), if
+   that hasn't been done yet. On error, the container is left as it
+   was and error is set, if not NULL. */
+int jsonp_lazy_expand(json_t *json, json_error_t *error);
+
+/* The text of a container that hasn't been decoded yet, or NULL */
+const jsonp_lazy_t *jsonp_lazy(const json_t *json);
+
+/* Append a number to an array that's empty or packed with numbers of
+   the same type, keeping it packed, see json_loadb_packed() */
+int jsonp_array_pack_integer(json_t *array, json_int_t value);
+int jsonp_array_pack_real(json_t *array, double value);
+
+/* The value that a container from json_deep_copy_cow() will copy its
+   members from when it's first used, or NULL if it already has */
+const json_t *jsonp_cow_source(const json_t *json);
+
+/* The extra state of an object or array, which is allocated when it's
+   first needed. Returns NULL if memory runs out. jsonp_extra_trim()
+   frees it again once none of it is used. */
+jsonp_extra_t *jsonp_extra_get(json_t *json);
+void jsonp_extra_trim(json_t *json);
+
+/* Create a string that refers to an existing buffer without copying
+   or ever freeing it. The buffer must outlive the value. */
+json_t *jsonp_stringn_nocheck_borrow(const char *value, size_t len);
+
+/* Set a member with a key returned by hashtable_keys_intern(). Steals
+   the value. */
+int jsonp_object_set_shared(json_t *object, const char *key, json_t *value);
+
+/* The members of a concurrent object, see concurrent.c. The setters
+   steal the value, and shared tells whether key is a shared key. The
+   hashtable may only be read by others while the lock is held. */
+int jsonp_concurrent_init(json_object_t *object);
+void jsonp_concurrent_close(json_object_t *object);
+void jsonp_concurrent_lock(const json_object_t *object);
+void jsonp_concurrent_unlock(const json_object_t *object);
+size_t jsonp_concurrent_size(const json_object_t *object);
+json_t *jsonp_concurrent_get(const json_object_t *object, const char *key,
+                             size_t key_len, size_t hash);
+int jsonp_concurrent_set(json_object_t *object, const char *key, size_t key_len,
+                         int shared, json_t *value);
+int jsonp_concurrent_del(json_object_t *object, const char *key, size_t key_len);
+int jsonp_concurrent_clear(json_object_t *object);
+int jsonp_concurrent_reserve(json_object_t *object, size_t capacity);
+
+/* Make all further calls on a writer fail, after the output has been
+   left incomplete */
+void jsonp_writer_fail(json_writer_t *writer);
+
 /* Error message formatting */
 void jsonp_error_init(json_error_t *error, const char *source);
 void jsonp_error_set_source(json_error_t *error, const char *source);
@@ -79,20 +195,101 @@ void jsonp_error_vset(json_error_t *error, int line, int column, size_t position
 
 /* Locale independent string<->double conversions */
 int jsonp_strtod(strbuffer_t *strbuffer, double *out);
+int jsonp_strtoint(strbuffer_t *strbuffer, json_int_t *out);
 int jsonp_dtostr(char *buffer, size_t size, double value, int prec);
+int jsonp_itostr(char *buffer, size_t size, json_int_t value);
+
+/* Loading into an arena. While a thread is between jsonp_arena_enter()
+   and jsonp_arena_leave(), jsonp_malloc() allocates from the arena,
+   jsonp_free() does nothing and new values are immortal. */
+int jsonp_arena_enter(json_arena_t *arena);
+void jsonp_arena_leave(void);
+int jsonp_in_arena(void);
+
+/* A memory budget. While a thread is between jsonp_budget_enter() and
+   jsonp_budget_leave(), its allocations fail once they would take more
+   than the remaining bytes, and exceeded is set. Memory that is freed
+   isn't given back. */
+typedef struct {
+    size_t remaining;
+    int exceeded;
+} jsonp_budget_t;
+
+int jsonp_budget_enter(jsonp_budget_t *budget);
+void jsonp_budget_leave(void);
 
 /* Wrappers for custom memory functions */
 void *jsonp_malloc(size_t size) JANSSON_ATTRS((warn_unused_result));
 void jsonp_free(void *ptr);
 char *jsonp_strndup(const char *str, size_t length) JANSSON_ATTRS((warn_unused_result));
 char *jsonp_strdup(const char *str) JANSSON_ATTRS((warn_unused_result));
+
+/* Statistics for json_get_stats(), see stats.c. Each thread counts
+   in a json_stats_t of its own. Without USE_STATS, which is off by
+   default, everything here compiles to nothing. */
+#if defined(USE_STATS) && defined(JSON_THREAD_LOCAL) &&                                  \
+    (JSON_HAVE_ATOMIC_BUILTINS || JSON_HAVE_SYNC_BUILTINS)
+#define JSONP_STATS 1
+
+extern JSON_THREAD_LOCAL json_stats_t *jsonp_thread_stats;
+json_stats_t *jsonp_stats_register(void);
+
+#define jsonp_stats() (jsonp_thread_stats ? jsonp_thread_stats : jsonp_stats_register())
+#define jsonp_stats_add(field_, n_) ((void)(jsonp_stats()->field_ += (n_)))
+#define jsonp_stats_alloc(category_, size_)                                              \
+    do {                                                                                 \
+        json_stats_t *stats_ = jsonp_stats();                                            \
+        stats_->allocs[category_]++;                                                     \
+        stats_->alloc_bytes[category_] += (size_);                                       \
+    } while (0)
+
+/* A time in seconds for measuring how long parsing and dumping take */
+double jsonp_stats_now(void);
+
+/* Count decoding or encoding bytes, which began at start */
+void jsonp_stats_parse(size_t bytes, double start);
+void jsonp_stats_dump(size_t bytes, double start);
+
+/* Like jsonp_malloc(), counting the allocation in category instead of
+   json_stats_other */
+void *jsonp_malloc_as(size_t size, int category) JANSSON_ATTRS((warn_unused_result));
+
+#else
+#define JSONP_STATS 0
+
+#define jsonp_stats_add(field_, n_)           ((void)0)
+#define jsonp_stats_alloc(category_, size_)   ((void)0)
+#define jsonp_stats_now()                     0.0
+#define jsonp_stats_parse(bytes_, start_)     ((void)(bytes_), (void)(start_))
+#define jsonp_stats_dump(bytes_, start_)      ((void)(bytes_), (void)(start_))
+#define jsonp_malloc_as(size_, category_)     jsonp_malloc(size_)
+#endif
+
+/* Allocate and free fixed-size values. These use the pools if they
+   are enabled, and jsonp_malloc() and jsonp_free() otherwise. The
+   size passed to jsonp_free_node() must be the allocated size. */
+void *jsonp_malloc_node(size_t size) JANSSON_ATTRS((warn_unused_result));
+void jsonp_free_node(void *ptr, size_t size);
 char *jsonp_strndup(const char *str, size_t len) JANSSON_ATTRS((warn_unused_result));
 
-/* Circular reference check*/
-/* Space for "0x", double the sizeof a pointer for the hex and a terminator. */
-#define LOOP_KEY_LEN (2 + (sizeof(json_t *) * 2) + 1)
-int jsonp_loop_check(hashtable_t *parents, const json_t *json, char *key, size_t key_size,
-                     size_t *key_len_out);
+/* Circular reference check. The containers that a recursive operation
+   is inside of are kept on a stack. The first levels are searched
+   linearly, which is cheaper than hashing for documents that aren't
+   deeply nested, and the levels after them go to a hash table. */
+#define JSONP_PARENTS_STACK 32
+
+typedef struct {
+    const json_t *stack[JSONP_PARENTS_STACK];
+    size_t depth;
+    hashtable_t deep; /* the levels after the stack */
+    int has_deep;
+} jsonp_parents_t;
+
+void jsonp_parents_init(jsonp_parents_t *parents);
+void jsonp_parents_close(jsonp_parents_t *parents);
+/* Returns -1 if json is one of the parents already, or on error */
+int jsonp_parents_push(jsonp_parents_t *parents, const json_t *json);
+void jsonp_parents_pop(jsonp_parents_t *parents, const json_t *json);
 
 /* Windows compatibility */
 #if defined(_WIN32) || defined(WIN32)
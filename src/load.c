@@ -20,70 +20,36 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #include "jansson.h"
 #include "strbuffer.h"
+#include "tape.h"
+#include "thread.h"
 #include "utf.h"
 
-#define STREAM_STATE_OK    0
-#define STREAM_STATE_EOF   -1
-#define STREAM_STATE_ERROR -2
-
-#define TOKEN_INVALID -1
-#define TOKEN_EOF     0
-#define TOKEN_STRING  256
-#define TOKEN_INTEGER 257
-#define TOKEN_REAL    258
-#define TOKEN_TRUE    259
-#define TOKEN_FALSE   260
-#define TOKEN_NULL    261
-
-/* Locale independent versions of isxxx() functions */
-#define l_isupper(c) ('A' <= (c) && (c) <= 'Z')
-#define l_islower(c) ('a' <= (c) && (c) <= 'z')
-#define l_isalpha(c) (l_isupper(c) || l_islower(c))
-#define l_isdigit(c) ('0' <= (c) && (c) <= '9')
-#define l_isxdigit(c)                                                                    \
-    (l_isdigit(c) || ('A' <= (c) && (c) <= 'F') || ('a' <= (c) && (c) <= 'f'))
-
-/* Read one byte from stream, convert to unsigned char, then int, and
-   return. return EOF on end of file. This corresponds to the
-   behaviour of fgetc(). */
-typedef int (*get_func)(void *data);
+#include "load.h"
 
-typedef struct {
-    get_func get;
-    void *data;
-    char buffer[5];
-    size_t buffer_pos;
-    int state;
-    int line;
-    int column, last_column;
-    size_t position;
-} stream_t;
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && defined(HAVE_SYS_STAT_H) &&        \
+    defined(HAVE_FCNTL_H) && defined(HAVE_UNISTD_H)
+#define USE_MMAP 1
+#endif
 
-typedef struct {
-    stream_t stream;
-    strbuffer_t saved_text;
-    size_t flags;
-    size_t depth;
-    int token;
-    union {
-        struct {
-            char *val;
-            size_t len;
-        } string;
-        json_int_t integer;
-        double real;
-    } value;
-} lex_t;
-
-#define stream_to_lex(stream) container_of(stream, lex_t, stream)
+/* Files smaller than this are read rather than mapped to memory */
+#define MAP_MIN_SIZE STREAM_BLOCK_SIZE
 
 /*** error reporting ***/
 
-static void error_set(json_error_t *error, const lex_t *lex, enum json_error_code code,
-                      const char *msg, ...) {
+void error_set(json_error_t *error, const lex_t *lex, enum json_error_code code,
+               const char *msg, ...) {
     va_list ap;
     char msg_text[JSON_ERROR_TEXT_LENGTH];
     char msg_with_context[JSON_ERROR_TEXT_LENGTH];
@@ -136,9 +102,15 @@ static void error_set(json_error_t *error, const lex_t *lex, enum json_error_cod
 
 /*** lexical analyzer ***/
 
-static void stream_init(stream_t *stream, get_func get, void *data) {
-    stream->get = get;
+/* block is the storage for the window, or NULL to allocate it */
+static int stream_init(stream_t *stream, const char *buffer, size_t buflen,
+                       read_func read, void *data, char *block, size_t block_size) {
+    stream->pos = buffer;
+    stream->end = buffer + buflen;
+    stream->read = read;
     stream->data = data;
+    stream->block = NULL;
+    stream->block_size = block_size;
     stream->buffer[0] = '\0';
     stream->buffer_pos = 0;
 
@@ -146,6 +118,55 @@ static void stream_init(stream_t *stream, get_func get, void *data) {
     stream->line = 1;
     stream->column = 0;
     stream->position = 0;
+
+    if (read) {
+        stream->block = block ? block : jsonp_malloc_as(block_size, json_stats_buffers);
+        if (!stream->block)
+            return -1;
+        stream->pos = stream->end = stream->block;
+    }
+    return 0;
+}
+
+static void stream_close(stream_t *stream) {
+    jsonp_free(stream->block);
+    stream->block = NULL;
+}
+
+/* Return the number of bytes that have been read from the source but
+   not consumed by the lexer */
+static size_t stream_unread(const stream_t *stream) {
+    size_t unread = stream->end - stream->pos;
+
+    if (stream->state == STREAM_STATE_OK)
+        unread += strlen(&stream->buffer[stream->buffer_pos]);
+
+    return unread;
+}
+
+int stream_refill(stream_t *stream) {
+    size_t len;
+
+    if (!stream->read)
+        return -1;
+
+    len = stream->read(stream->block, stream->block_size, stream->data);
+    if (len == 0 || len == (size_t)-1)
+        return -1;
+
+    stream->pos = stream->block;
+    stream->end = stream->block + len;
+    return 0;
+}
+
+/* Read one byte from the window, convert to unsigned char, then int,
+   and return. Return EOF on end of input. This corresponds to the
+   behaviour of fgetc(). */
+static JSON_INLINE int stream_read_byte(stream_t *stream) {
+    if (stream->pos == stream->end && stream_refill(stream))
+        return EOF;
+
+    return (unsigned char)*stream->pos++;
 }
 
 static int stream_get(stream_t *stream, json_error_t *error) {
@@ -155,7 +176,7 @@ static int stream_get(stream_t *stream, json_error_t *error) {
         return stream->state;
 
     if (!stream->buffer[stream->buffer_pos]) {
-        c = stream->get(stream->data);
+        c = stream_read_byte(stream);
         if (c == EOF) {
             stream->state = STREAM_STATE_EOF;
             return STREAM_STATE_EOF;
@@ -175,7 +196,7 @@ static int stream_get(stream_t *stream, json_error_t *error) {
             assert(count >= 2);
 
             for (i = 1; i < count; i++)
-                stream->buffer[i] = stream->get(stream->data);
+                stream->buffer[i] = stream_read_byte(stream);
 
             if (!utf8_check_full(stream->buffer, count, NULL))
                 goto out;
@@ -223,10 +244,42 @@ static void stream_unget(stream_t *stream, int c) {
     assert(stream->buffer[stream->buffer_pos] == c);
 }
 
-static int lex_get(lex_t *lex, json_error_t *error) {
-    return stream_get(&lex->stream, error);
+/* The window can be scanned directly only when no bytes are pending
+   in the UTF-8 lookahead buffer of stream_get() */
+#define stream_window_ready(stream)                                                      \
+    ((stream)->state == STREAM_STATE_OK && !(stream)->buffer[(stream)->buffer_pos])
+
+/* Consume len bytes that form chars characters and contain no
+   newlines from the window */
+static JSON_INLINE void stream_skip(stream_t *stream, size_t len, size_t chars) {
+    stream->pos += len;
+    stream->position += len;
+    stream->column += chars;
+}
+
+void stream_skip_whitespace(stream_t *stream) {
+    const char *p;
+
+    if (!stream_window_ready(stream))
+        return;
+
+    for (p = stream->pos; p < stream->end; p++) {
+        if (*p == '\n') {
+            stream->line++;
+            stream->last_column = stream->column;
+            stream->column = 0;
+        } else if (*p == ' ' || *p == '\t' || *p == '\r')
+            stream->column++;
+        else
+            break;
+    }
+
+    stream->position += p - stream->pos;
+    stream->pos = p;
 }
 
+int lex_get(lex_t *lex, json_error_t *error) { return stream_get(&lex->stream, error); }
+
 static void lex_save(lex_t *lex, int c) { strbuffer_append_byte(&lex->saved_text, c); }
 
 static int lex_get_save(lex_t *lex, json_error_t *error) {
@@ -236,7 +289,7 @@ static int lex_get_save(lex_t *lex, json_error_t *error) {
     return c;
 }
 
-static void lex_unget(lex_t *lex, int c) { stream_unget(&lex->stream, c); }
+void lex_unget(lex_t *lex, int c) { stream_unget(&lex->stream, c); }
 
 static void lex_unget_unsave(lex_t *lex, int c) {
     if (c != STREAM_STATE_EOF && c != STREAM_STATE_ERROR) {
@@ -264,14 +317,127 @@ static void lex_save_cached(lex_t *lex) {
     }
 }
 
+/* Free a string taken from a string token */
+void lex_release_string(lex_t *lex, char *str) {
+    if (!lex->insitu && str != lex->short_string)
+        jsonp_free(str);
+}
+
+/* Where to decode a string token of at most size bytes, with the null
+   byte. Short ones are decoded without an allocation, because most
+   of them are copied into a value anyway, see lex_steal_string(). */
+static char *lex_string_buffer(lex_t *lex, size_t size) {
+    if (size <= sizeof(lex->short_string))
+        return lex->short_string;
+    return jsonp_malloc_as(size, json_stats_strings);
+}
+
 static void lex_free_string(lex_t *lex) {
-    jsonp_free(lex->value.string.val);
+    lex_release_string(lex, lex->value.string.val);
     lex->value.string.val = NULL;
     lex->value.string.len = 0;
 }
 
+/* Scan a string that has no escapes or control characters directly
+   from the window, without going through stream_get() and
+   saved_text. Returns 1 if the string token is complete, or 0 if the
+   general lexer has to continue. In the latter case, the plain prefix
+   that was scanned has been consumed and saved. A string that is
+   longer than allowed is skipped without copying it, with error set. */
+static int lex_scan_plain_string(lex_t *lex, json_error_t *error) {
+    stream_t *stream = &lex->stream;
+    const char *start = stream->pos;
+    const char *p = start, *end;
+    size_t chars = 0, len, count;
+
+    if (!stream_window_ready(stream))
+        return 0;
+
+    while (1) {
+        unsigned char u;
+
+        count = utf8_plain_prefix(p, stream->end - p, 0);
+        p += count;
+        chars += count;
+
+        if (p == stream->end)
+            goto fallback;
+
+        u = *p;
+        if (u == '"')
+            break;
+        if (u == '\\' || u <= 0x1F)
+            goto fallback;
+
+        /* validate a whole run of UTF-8 text at once */
+        count = utf8_plain_prefix(p, stream->end - p, UTF8_PLAIN_UTF8);
+        if (!utf8_check_string(p, count))
+            goto fallback;
+
+        for (end = p + count; p < end; p++) {
+            /* count characters for the column, i.e. all bytes
+               except continuation bytes */
+            if (((unsigned char)*p & 0xC0) != 0x80)
+                chars++;
+        }
+    }
+
+    len = p - start;
+
+    /* error_set() shows the token as context only if it is at most 20
+       bytes long, so a prefix is enough to decide on that */
+    strbuffer_append_bytes(&lex->saved_text, start, len + 2 <= 20 ? len + 1 : 20);
+
+    if (len > lex_max_string_length(lex)) {
+        stream_skip(stream, len + 1, chars + 1);
+        error_set(error, lex, json_error_limit_exceeded,
+                  "maximum string length reached");
+        return 1;
+    }
+
+    if (lex->insitu) {
+        /* terminate the string in place of the closing quote */
+        lex->value.string.val = (char *)start;
+        lex->value.string.val[len] = '\0';
+    } else {
+        lex->value.string.val = lex_string_buffer(lex, len + 1);
+        if (lex->value.string.val) {
+            memcpy(lex->value.string.val, start, len);
+            lex->value.string.val[len] = '\0';
+        }
+    }
+    if (lex->value.string.val) {
+        lex->value.string.len = len;
+        lex->token = TOKEN_STRING;
+    }
+
+    stream_skip(stream, len + 1, chars + 1);
+    return 1;
+
+fallback:
+    strbuffer_append_bytes(&lex->saved_text, start, p - start);
+    stream_skip(stream, p - start, chars);
+    return 0;
+}
+
+/* Save the run of plain ASCII characters at the start of the window
+   in one go */
+static void lex_save_plain(lex_t *lex) {
+    stream_t *stream = &lex->stream;
+    size_t len;
+
+    if (!stream_window_ready(stream))
+        return;
+
+    len = utf8_plain_prefix(stream->pos, stream->end - stream->pos, 0);
+    if (len) {
+        strbuffer_append_bytes(&lex->saved_text, stream->pos, len);
+        stream_skip(stream, len, len);
+    }
+}
+
 /* assumes that str points to 'u' plus at least 4 valid hex digits */
-static int32_t decode_unicode_escape(const char *str) {
+int32_t decode_unicode_escape(const char *str) {
     int i;
     int32_t value = 0;
 
@@ -295,19 +461,36 @@ static int32_t decode_unicode_escape(const char *str) {
 
 static void lex_scan_string(lex_t *lex, json_error_t *error) {
     int c;
-    const char *p;
-    char *t;
+    const char *p, *end;
+    char *t, *start = NULL;
     int i;
 
     lex->value.string.val = NULL;
     lex->token = TOKEN_INVALID;
 
+    if (lex->insitu) {
+        /* the opening quote came straight from the buffer */
+        assert(stream_window_ready(&lex->stream));
+        start = (char *)lex->stream.pos;
+    }
+
+    if (lex_scan_plain_string(lex, error))
+        return;
+
     c = lex_get_save(lex, error);
 
     while (c != '"') {
         if (c == STREAM_STATE_ERROR)
             goto out;
 
+        /* every byte of the value takes at most 6 bytes of source, so
+           give up as soon as the source is sure to be too long */
+        else if ((lex->saved_text.length - 1) / 6 > lex_max_string_length(lex)) {
+            error_set(error, lex, json_error_limit_exceeded,
+                      "maximum string length reached");
+            goto out;
+        }
+
         else if (c == STREAM_STATE_EOF) {
             error_set(error, lex, json_error_premature_end_of_input,
                       "premature end of input");
@@ -338,14 +521,17 @@ static void lex_scan_string(lex_t *lex, json_error_t *error) {
                     c = lex_get_save(lex, error);
                 }
             } else if (c == '"' || c == '\\' || c == '/' || c == 'b' || c == 'f' ||
-                       c == 'n' || c == 'r' || c == 't')
+                       c == 'n' || c == 'r' || c == 't') {
+                lex_save_plain(lex);
                 c = lex_get_save(lex, error);
-            else {
+            } else {
                 error_set(error, lex, json_error_invalid_syntax, "invalid escape");
                 goto out;
             }
-        } else
+        } else {
+            lex_save_plain(lex);
             c = lex_get_save(lex, error);
+        }
     }
 
     /* the actual value is at most of the same length as the source
@@ -354,8 +540,10 @@ static void lex_scan_string(lex_t *lex, json_error_t *error) {
          - a single \uXXXX escape (length 6) is converted to at most 3 bytes
          - two \uXXXX escapes (length 12) forming an UTF-16 surrogate pair
            are converted to 4 bytes
+       so in place, the value never overtakes the source it's decoded
+       from, which is also in saved_text anyway
     */
-    t = jsonp_malloc(lex->saved_text.length + 1);
+    t = start ? start : lex_string_buffer(lex, lex->saved_text.length + 1);
     if (!t) {
         /* this is not very nice, since TOKEN_INVALID is returned */
         goto out;
@@ -364,6 +552,7 @@ static void lex_scan_string(lex_t *lex, json_error_t *error) {
 
     /* + 1 to skip the " */
     p = strbuffer_value(&lex->saved_text) + 1;
+    end = strbuffer_value(&lex->saved_text) + lex->saved_text.length;
 
     while (*p != '"') {
         if (*p == '\\') {
@@ -444,11 +633,23 @@ static void lex_scan_string(lex_t *lex, json_error_t *error) {
                 t++;
                 p++;
             }
-        } else
-            *(t++) = *(p++);
+        } else {
+            size_t len = utf8_plain_prefix(p, end - p, 0);
+            if (len) {
+                memcpy(t, p, len);
+                t += len;
+                p += len;
+            } else
+                *(t++) = *(p++);
+        }
     }
     *t = '\0';
     lex->value.string.len = t - lex->value.string.val;
+    if (lex->value.string.len > lex_max_string_length(lex)) {
+        error_set(error, lex, json_error_limit_exceeded,
+                  "maximum string length reached");
+        goto out;
+    }
     lex->token = TOKEN_STRING;
     return;
 
@@ -456,25 +657,85 @@ out:
     lex_free_string(lex);
 }
 
-#ifndef JANSSON_USING_CMAKE /* disabled if using cmake */
-#if JSON_INTEGER_IS_LONG_LONG
-#ifdef _MSC_VER /* Microsoft Visual Studio */
-#define json_strtoint _strtoi64
-#else
-#define json_strtoint strtoll
-#endif
-#else
-#define json_strtoint strtol
-#endif
-#endif
+/* Scan the rest of a number whose first character c has already been
+   consumed directly from the window. Returns 1 if a valid number was
+   found and saved, with *is_real telling whether it has a fraction or
+   an exponent, or 0 if the general lexer has to handle it. */
+static int lex_scan_plain_number(lex_t *lex, int c, int *is_real) {
+    stream_t *stream = &lex->stream;
+    const char *p = stream->pos;
+    const char *end = stream->end;
+
+    if (!stream_window_ready(stream))
+        return 0;
+
+    *is_real = 0;
+
+    if (c == '-') {
+        if (p == end)
+            return 0;
+        c = *p++;
+    }
+
+    if (c == '0') {
+        if (p < end && l_isdigit(*p))
+            return 0;
+    } else if (l_isdigit(c)) {
+        while (p < end && l_isdigit(*p))
+            p++;
+    } else
+        return 0;
+
+    if (p < end && *p == '.') {
+        p++;
+        if (p == end || !l_isdigit(*p))
+            return 0;
+        while (p < end && l_isdigit(*p))
+            p++;
+        *is_real = 1;
+    }
+
+    if (p < end && (*p == 'E' || *p == 'e')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-'))
+            p++;
+        if (p == end || !l_isdigit(*p))
+            return 0;
+        while (p < end && l_isdigit(*p))
+            p++;
+        *is_real = 1;
+    }
+
+    /* the number may continue in the next block, and a non-ASCII byte
+       after it has to be decoded by stream_get() to report an error in
+       the number's context */
+    if ((p == end && stream->read) || (p < end && (unsigned char)*p >= 0x80))
+        return 0;
+
+    strbuffer_append_bytes(&lex->saved_text, stream->pos, p - stream->pos);
+    stream_skip(stream, p - stream->pos, p - stream->pos);
+
+    /* stream_get() drops a null byte that is given back to it after a
+       number, so the general lexer reports an error near the token
+       after it. Do the same. */
+    if (p < end && *p == '\0')
+        stream->pos++;
+    return 1;
+}
 
 static int lex_scan_number(lex_t *lex, int c, json_error_t *error) {
-    const char *saved_text;
-    char *end;
     double doubleval;
+    json_int_t intval;
+    int is_real;
 
     lex->token = TOKEN_INVALID;
 
+    if (lex_scan_plain_number(lex, c, &is_real)) {
+        if (!is_real && !(lex->flags & JSON_DECODE_INT_AS_REAL))
+            goto integer;
+        goto real;
+    }
+
     if (c == '-')
         c = lex_get_save(lex, error);
 
@@ -494,28 +755,8 @@ static int lex_scan_number(lex_t *lex, int c, json_error_t *error) {
     }
 
     if (!(lex->flags & JSON_DECODE_INT_AS_REAL) && c != '.' && c != 'E' && c != 'e') {
-        json_int_t intval;
-
         lex_unget_unsave(lex, c);
-
-        saved_text = strbuffer_value(&lex->saved_text);
-
-        errno = 0;
-        intval = json_strtoint(saved_text, &end, 10);
-        if (errno == ERANGE) {
-            if (intval < 0)
-                error_set(error, lex, json_error_numeric_overflow,
-                          "too big negative integer");
-            else
-                error_set(error, lex, json_error_numeric_overflow, "too big integer");
-            goto out;
-        }
-
-        assert(end == saved_text + lex->saved_text.length);
-
-        lex->token = TOKEN_INTEGER;
-        lex->value.integer = intval;
-        return 0;
+        goto integer;
     }
 
     if (c == '.') {
@@ -548,6 +789,7 @@ static int lex_scan_number(lex_t *lex, int c, json_error_t *error) {
 
     lex_unget_unsave(lex, c);
 
+real:
     if (jsonp_strtod(&lex->saved_text, &doubleval)) {
         error_set(error, lex, json_error_numeric_overflow, "real number overflow");
         goto out;
@@ -557,11 +799,25 @@ static int lex_scan_number(lex_t *lex, int c, json_error_t *error) {
     lex->value.real = doubleval;
     return 0;
 
+integer:
+    if (jsonp_strtoint(&lex->saved_text, &intval)) {
+        if (strbuffer_value(&lex->saved_text)[0] == '-')
+            error_set(error, lex, json_error_numeric_overflow,
+                      "too big negative integer");
+        else
+            error_set(error, lex, json_error_numeric_overflow, "too big integer");
+        goto out;
+    }
+
+    lex->token = TOKEN_INTEGER;
+    lex->value.integer = intval;
+    return 0;
+
 out:
     return -1;
 }
 
-static int lex_scan(lex_t *lex, json_error_t *error) {
+int lex_scan(lex_t *lex, json_error_t *error) {
     int c;
 
     strbuffer_clear(&lex->saved_text);
@@ -569,6 +825,8 @@ static int lex_scan(lex_t *lex, json_error_t *error) {
     if (lex->token == TOKEN_STRING)
         lex_free_string(lex);
 
+    stream_skip_whitespace(&lex->stream);
+
     do
         c = lex_get(lex, error);
     while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
@@ -633,40 +891,178 @@ static char *lex_steal_string(lex_t *lex, size_t *out_len) {
     if (lex->token == TOKEN_STRING) {
         result = lex->value.string.val;
         *out_len = lex->value.string.len;
+
+        /* the next token reuses the buffer of a short string */
+        if (result == lex->short_string)
+            result = jsonp_strndup(result, *out_len);
         lex->value.string.val = NULL;
         lex->value.string.len = 0;
     }
     return result;
 }
 
-static int lex_init(lex_t *lex, get_func get, size_t flags, void *data) {
-    stream_init(&lex->stream, get, data);
-    if (strbuffer_init(&lex->saved_text))
+/*** reusable contexts ***/
+
+/* Buffers larger than this aren't kept for the next document */
+#define CTX_MAX_SAVED_TEXT STREAM_BLOCK_SIZE
+
+/* The buffers that a lexer would allocate and free, between loads */
+struct json_load_ctx {
+    strbuffer_t saved_text; /* value is NULL if there's none */
+    parse_frame_t *frames;
+    size_t frames_size;
+    char *block; /* a stream window */
+    size_t block_size;
+};
+
+json_load_ctx_t *json_load_ctx_new(void) {
+    json_load_ctx_t *ctx = jsonp_malloc(sizeof(json_load_ctx_t));
+    if (!ctx)
+        return NULL;
+
+    ctx->saved_text.value = NULL;
+    ctx->frames = NULL;
+    ctx->frames_size = 0;
+    ctx->block = NULL;
+    ctx->block_size = 0;
+    return ctx;
+}
+
+void json_load_ctx_free(json_load_ctx_t *ctx) {
+    if (!ctx)
+        return;
+
+    if (ctx->saved_text.value)
+        strbuffer_close(&ctx->saved_text);
+    jsonp_free(ctx->frames);
+    jsonp_free(ctx->block);
+    jsonp_free(ctx);
+}
+
+/* Take back the buffers that lex borrowed from its context, or the
+   ones that replaced them */
+static void ctx_return(json_load_ctx_t *ctx, lex_t *lex) {
+    ctx->saved_text = lex->saved_text;
+    if (ctx->saved_text.size > CTX_MAX_SAVED_TEXT) {
+        strbuffer_close(&ctx->saved_text);
+        ctx->saved_text.value = NULL;
+    }
+
+    ctx->frames = lex->frames;
+    ctx->frames_size = lex->frames_size;
+
+    if (lex->stream.block && lex->stream.block != ctx->block) {
+        jsonp_free(ctx->block);
+        ctx->block = lex->stream.block;
+        ctx->block_size = lex->stream.block_size;
+    }
+}
+
+static int lex_init_ctx(lex_t *lex, json_load_ctx_t *ctx, const char *buffer,
+                        size_t buflen, read_func read, void *data, size_t block_size,
+                        size_t flags) {
+    char *block = NULL;
+
+    if (ctx && ctx->block_size >= block_size)
+        block = ctx->block;
+
+    if (stream_init(&lex->stream, buffer, buflen, read, data, block, block_size))
+        return -1;
+
+    if (ctx && ctx->saved_text.value) {
+        lex->saved_text = ctx->saved_text;
+        strbuffer_clear(&lex->saved_text);
+    } else if (strbuffer_init(&lex->saved_text)) {
+        if (lex->stream.block != block)
+            stream_close(&lex->stream);
         return -1;
+    }
 
     lex->flags = flags;
+    lex->max_depth = FLAGS_TO_DEPTH(flags);
+    if (!lex->max_depth)
+        lex->max_depth = JSON_PARSER_MAX_DEPTH;
+    lex->frames = ctx ? ctx->frames : NULL;
+    lex->nframes = 0;
+    lex->frames_size = ctx ? ctx->frames_size : 0;
+    lex->insitu = 0;
+    lex->lazy = 0;
+    lex->packed = 0;
+    lex->keys = NULL;
+    lex->ctx = ctx;
+    lex->limits = NULL;
+    lex->nvalues = 0;
     lex->token = TOKEN_INVALID;
     return 0;
 }
 
-static void lex_close(lex_t *lex) {
+int lex_init(lex_t *lex, const char *buffer, size_t buflen, read_func read, void *data,
+             size_t block_size, size_t flags) {
+    return lex_init_ctx(lex, NULL, buffer, buflen, read, data, block_size, flags);
+}
+
+void lex_close(lex_t *lex) {
     if (lex->token == TOKEN_STRING)
         lex_free_string(lex);
+
+    if (lex->ctx) {
+        ctx_return(lex->ctx, lex);
+        return;
+    }
+
+    jsonp_free(lex->frames);
     strbuffer_close(&lex->saved_text);
+    stream_close(&lex->stream);
 }
 
 /*** parser ***/
 
-static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error);
+/* Take the key of a new member of object from the current string
+   token. Returns NULL with error set if the key is not allowed. */
+char *parse_object_key(lex_t *lex, json_t *object, size_t flags, size_t *len,
+                       json_error_t *error) {
+    char *key = lex_steal_string(lex, len);
+    if (!key)
+        return NULL;
 
-static json_t *parse_object(lex_t *lex, size_t flags, json_error_t *error) {
-    json_t *object = json_object();
-    if (!object)
+    if (memchr(key, '\0', *len)) {
+        lex_release_string(lex, key);
+        error_set(error, lex, json_error_null_byte_in_key,
+                  "NUL byte in object key not supported");
         return NULL;
+    }
 
+    if (flags & JSON_REJECT_DUPLICATES) {
+        if (json_object_getn(object, key, *len)) {
+            lex_release_string(lex, key);
+            error_set(error, lex, json_error_duplicate_key, "duplicate object key");
+            return NULL;
+        }
+    }
+
+    return key;
+}
+
+/* Add a member to object, stealing the reference to value */
+int parse_add_member(lex_t *lex, json_t *object, const char *key, size_t len,
+                     json_t *value) {
+    if (lex->keys) {
+        const char *shared = hashtable_keys_intern(lex->keys, key, len);
+        if (!shared) {
+            json_decref(value);
+            return -1;
+        }
+        return jsonp_object_set_shared(object, shared, value);
+    }
+    return json_object_setn_new_nocheck(object, key, len, value);
+}
+
+/* Parse the members of object after its opening brace */
+static int parse_members(lex_t *lex, json_t *object, size_t flags,
+                         json_error_t *error) {
     lex_scan(lex, error);
     if (lex->token == '}')
-        return object;
+        return 0;
 
     while (1) {
         char *key;
@@ -675,47 +1071,33 @@ static json_t *parse_object(lex_t *lex, size_t flags, json_error_t *error) {
 
         if (lex->token != TOKEN_STRING) {
             error_set(error, lex, json_error_invalid_syntax, "string or '}' expected");
-            goto error;
+            return -1;
         }
 
-        key = lex_steal_string(lex, &len);
+        key = parse_object_key(lex, object, flags, &len, error);
         if (!key)
-            return NULL;
-        if (memchr(key, '\0', len)) {
-            jsonp_free(key);
-            error_set(error, lex, json_error_null_byte_in_key,
-                      "NUL byte in object key not supported");
-            goto error;
-        }
-
-        if (flags & JSON_REJECT_DUPLICATES) {
-            if (json_object_getn(object, key, len)) {
-                jsonp_free(key);
-                error_set(error, lex, json_error_duplicate_key, "duplicate object key");
-                goto error;
-            }
-        }
+            return -1;
 
         lex_scan(lex, error);
         if (lex->token != ':') {
-            jsonp_free(key);
+            lex_release_string(lex, key);
             error_set(error, lex, json_error_invalid_syntax, "':' expected");
-            goto error;
+            return -1;
         }
 
         lex_scan(lex, error);
         value = parse_value(lex, flags, error);
         if (!value) {
-            jsonp_free(key);
-            goto error;
+            lex_release_string(lex, key);
+            return -1;
         }
 
-        if (json_object_setn_new_nocheck(object, key, len, value)) {
-            jsonp_free(key);
-            goto error;
+        if (parse_add_member(lex, object, key, len, value)) {
+            lex_release_string(lex, key);
+            return -1;
         }
 
-        jsonp_free(key);
+        lex_release_string(lex, key);
 
         lex_scan(lex, error);
         if (lex->token != ',')
@@ -726,33 +1108,26 @@ static json_t *parse_object(lex_t *lex, size_t flags, json_error_t *error) {
 
     if (lex->token != '}') {
         error_set(error, lex, json_error_invalid_syntax, "'}' expected");
-        goto error;
+        return -1;
     }
 
-    return object;
-
-error:
-    json_decref(object);
-    return NULL;
+    return 0;
 }
 
-static json_t *parse_array(lex_t *lex, size_t flags, json_error_t *error) {
-    json_t *array = json_array();
-    if (!array)
-        return NULL;
-
+/* Parse the elements of array after its opening bracket */
+static int parse_elements(lex_t *lex, json_t *array, size_t flags,
+                          json_error_t *error) {
     lex_scan(lex, error);
     if (lex->token == ']')
-        return array;
+        return 0;
 
     while (lex->token) {
         json_t *elem = parse_value(lex, flags, error);
         if (!elem)
-            goto error;
+            return -1;
 
-        if (json_array_append_new(array, elem)) {
-            goto error;
-        }
+        if (json_array_append_new(array, elem))
+            return -1;
 
         lex_scan(lex, error);
         if (lex->token != ',')
@@ -763,91 +1138,446 @@ static json_t *parse_array(lex_t *lex, size_t flags, json_error_t *error) {
 
     if (lex->token != ']') {
         error_set(error, lex, json_error_invalid_syntax, "']' expected");
-        goto error;
+        return -1;
     }
 
-    return array;
+    return 0;
+}
 
-error:
-    json_decref(array);
-    return NULL;
+static json_t *parse_object(lex_t *lex, size_t flags, json_error_t *error) {
+    json_t *object = json_object();
+    if (!object)
+        return NULL;
+
+    if (parse_members(lex, object, flags, error)) {
+        json_decref(object);
+        return NULL;
+    }
+    return object;
 }
 
-static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error) {
-    json_t *json;
+static json_t *parse_array(lex_t *lex, size_t flags, json_error_t *error) {
+    json_t *array = json_array();
+    if (!array)
+        return NULL;
 
-    lex->depth++;
-    if (lex->depth > JSON_PARSER_MAX_DEPTH) {
-        error_set(error, lex, json_error_stack_overflow, "maximum parsing depth reached");
+    if (parse_elements(lex, array, flags, error)) {
+        json_decref(array);
         return NULL;
     }
+    return array;
+}
 
-    switch (lex->token) {
-        case TOKEN_STRING: {
-            const char *value = lex->value.string.val;
-            size_t len = lex->value.string.len;
+/* Find the end of the container whose opening bracket was just
+   scanned, checking only that brackets match and strings end. Returns
+   the length of the rest of its text, or 0 if it's malformed or nested
+   too deeply, in which case it has to be parsed to get the error. */
+size_t lex_skip_container(lex_t *lex) {
+    stream_t *stream = &lex->stream;
+    const char *start = stream->pos, *p = start, *end = stream->end;
+    char closing[JSON_PARSER_MAX_DEPTH];
+    size_t open = 0, max = lex->max_depth - lex->depth + 1;
+
+    if (!stream_window_ready(stream))
+        return 0;
 
-            if (!(flags & JSON_ALLOW_NUL)) {
-                if (memchr(value, '\0', len)) {
-                    error_set(error, lex, json_error_null_character,
-                              "\\u0000 is not allowed without JSON_ALLOW_NUL");
-                    return NULL;
+    if (max > JSON_PARSER_MAX_DEPTH)
+        max = JSON_PARSER_MAX_DEPTH;
+
+    closing[open++] = lex->token == '{' ? '}' : ']';
+
+    while (p < end) {
+        switch (*p++) {
+            case '"':
+                /* the quote ends the string unless it's escaped, i.e.
+                   preceded by an odd number of backslashes */
+                while (1) {
+                    const char *q = memchr(p, '"', end - p), *b;
+                    if (!q)
+                        return 0;
+                    for (b = q; b > p && b[-1] == '\\'; b--)
+                        ;
+                    p = q + 1;
+                    if ((q - b) % 2 == 0)
+                        break;
                 }
-            }
-
-            json = jsonp_stringn_nocheck_own(value, len);
-            lex->value.string.val = NULL;
-            lex->value.string.len = 0;
-            break;
+                break;
+
+            case '{':
+            case '[':
+                if (open == max)
+                    return 0;
+                closing[open++] = p[-1] == '{' ? '}' : ']';
+                break;
+
+            case '}':
+            case ']':
+                if (p[-1] != closing[--open])
+                    return 0;
+                if (!open)
+                    return p - start;
+                break;
         }
+    }
 
-        case TOKEN_INTEGER: {
-            json = json_integer(lex->value.integer);
-            break;
-        }
+    return 0;
+}
 
-        case TOKEN_REAL: {
-            json = json_real(lex->value.real);
-            break;
-        }
+/* Consume len bytes of text found by lex_skip_container(), keeping
+   track of lines and columns as if the text was scanned */
+static void lex_skip_text(lex_t *lex, size_t len) {
+    stream_t *stream = &lex->stream;
+    const char *p, *end;
+
+    for (p = stream->pos, end = p + len; p < end; p++) {
+        if (*p == '\n') {
+            stream->line++;
+            stream->last_column = stream->column;
+            stream->column = 0;
+        } else if (((unsigned char)*p & 0xC0) != 0x80)
+            stream->column++;
+    }
+    stream->pos = end;
+    stream->position += len;
+    lex->token = end[-1];
+}
 
-        case TOKEN_TRUE:
-            json = json_true();
-            break;
+/* Consume the text of the container whose opening bracket was just
+   scanned without decoding it. Its members are decoded when it's
+   first used, see jsonp_lazy_expand(). The grammar of the text is
+   checked first, unless it's in a container that was checked
+   already. */
+static json_t *parse_deferred(lex_t *lex, size_t flags, json_error_t *error) {
+    stream_t *stream = &lex->stream;
+    jsonp_extra_t *extra;
+    jsonp_lazy_t *lazy;
+    size_t len = 0;
+    json_t *json;
 
-        case TOKEN_FALSE:
-            json = json_false();
-            break;
+    if (lex->lazy == LEX_LAZY_CHECKED)
+        len = lex_skip_container(lex);
+    else if (stream_window_ready(stream)) {
+        len = validate_container(stream->pos - 1, stream->end, flags,
+                                 lex->max_depth - lex->depth + 1);
+        if (len)
+            len--;
+    }
 
-        case TOKEN_NULL:
-            json = json_null();
-            break;
+    if (!len) {
+        /* invalid, or the validator couldn't tell. Decode all of it to
+           get the error, without checking the nested containers
+           again. */
+        int lazy_mode = lex->lazy;
+
+        lex->lazy = 0;
+        json = lex->token == '{' ? parse_object(lex, flags, error)
+                                 : parse_array(lex, flags, error);
+        lex->lazy = lazy_mode;
+        return json;
+    }
 
-        case '{':
-            json = parse_object(lex, flags, error);
-            break;
+    lazy = jsonp_malloc(sizeof(jsonp_lazy_t));
+    if (!lazy)
+        return NULL;
 
-        case '[':
-            json = parse_array(lex, flags, error);
-            break;
+    json = lex->token == '{' ? json_object() : json_array();
+    extra = json ? jsonp_extra_get(json) : NULL;
+    if (!extra) {
+        json_decref(json);
+        jsonp_free(lazy);
+        return NULL;
+    }
+
+    /* where the opening bracket is */
+    lazy->text = stream->pos - 1;
+    lazy->length = len + 1;
+    lazy->flags = flags;
+    lazy->depth = lex->depth;
+    lazy->position = stream->position - 1;
+    lazy->line = stream->line;
+    lazy->column = stream->column - 1;
+
+    extra->lazy = lazy;
+    lex_skip_text(lex, len);
+    return json;
+}
+
+/* Check that the current token is a valid value other than an
+   object or an array */
+static int check_scalar(lex_t *lex, size_t flags, json_error_t *error) {
+    switch (lex->token) {
+        case TOKEN_STRING:
+            if (!(flags & JSON_ALLOW_NUL)) {
+                if (memchr(lex->value.string.val, '\0', lex->value.string.len)) {
+                    error_set(error, lex, json_error_null_character,
+                              "\\u0000 is not allowed without JSON_ALLOW_NUL");
+                    return -1;
+                }
+            }
+            return 0;
+
+        case TOKEN_INTEGER:
+        case TOKEN_REAL:
+        case TOKEN_TRUE:
+        case TOKEN_FALSE:
+        case TOKEN_NULL:
+            return 0;
 
         case TOKEN_INVALID:
             error_set(error, lex, json_error_invalid_syntax, "invalid token");
-            return NULL;
+            return -1;
 
         default:
             error_set(error, lex, json_error_invalid_syntax, "unexpected token");
-            return NULL;
+            return -1;
     }
+}
 
-    if (!json)
+/* Convert the current token to a value, for anything but '{' and '[' */
+static json_t *parse_scalar(lex_t *lex, size_t flags, json_error_t *error) {
+    json_t *json;
+
+    if (check_scalar(lex, flags, error))
         return NULL;
 
-    lex->depth--;
-    return json;
+    switch (lex->token) {
+        case TOKEN_STRING:
+            if (lex->insitu)
+                json = jsonp_stringn_nocheck_borrow(lex->value.string.val,
+                                                    lex->value.string.len);
+            else if (lex->value.string.val == lex->short_string)
+                json = json_stringn_nocheck(lex->value.string.val, lex->value.string.len);
+            else
+                json = jsonp_stringn_nocheck_own(lex->value.string.val,
+                                                 lex->value.string.len);
+            lex->value.string.val = NULL;
+            lex->value.string.len = 0;
+            return json;
+
+        case TOKEN_INTEGER:
+            return json_integer(lex->value.integer);
+
+        case TOKEN_REAL:
+            return json_real(lex->value.real);
+
+        case TOKEN_TRUE:
+            return json_true();
+
+        case TOKEN_FALSE:
+            return json_false();
+
+        default: /* TOKEN_NULL */
+            return json_null();
+    }
 }
 
-static json_t *parse_json(lex_t *lex, size_t flags, json_error_t *error) {
+int push_frame(lex_t *lex, json_t *container) {
+    parse_frame_t *frame;
+
+    if (lex->nframes == lex->frames_size) {
+        size_t new_size = lex->frames_size ? 2 * lex->frames_size : 16;
+        parse_frame_t *new_frames = jsonp_malloc(new_size * sizeof(parse_frame_t));
+        if (!new_frames)
+            return -1;
+
+        if (lex->nframes)
+            memcpy(new_frames, lex->frames, lex->nframes * sizeof(parse_frame_t));
+        jsonp_free(lex->frames);
+        lex->frames = new_frames;
+        lex->frames_size = new_size;
+    }
+
+    frame = &lex->frames[lex->nframes++];
+    frame->container = container;
+    frame->key = NULL;
+    frame->key_len = 0;
+    return 0;
+}
+
+/* Parse the key of the next member of the object in frame, and the
+   colon after it */
+static int parse_frame_key(lex_t *lex, parse_frame_t *frame, size_t flags,
+                           json_error_t *error) {
+    if (lex->token != TOKEN_STRING) {
+        error_set(error, lex, json_error_invalid_syntax, "string or '}' expected");
+        return -1;
+    }
+
+    frame->key = parse_object_key(lex, frame->container, flags, &frame->key_len, error);
+    if (!frame->key)
+        return -1;
+
+    lex_scan(lex, error);
+    if (lex->token != ':') {
+        error_set(error, lex, json_error_invalid_syntax, "':' expected");
+        return -1;
+    }
+
+    lex_scan(lex, error);
+    return 0;
+}
+
+/* Parse the first elements of array while they're all integers or all
+   reals, packing them, see json_loadb_packed(). Returns 1 if some other
+   element follows them, which is then the current token, 0 if there's
+   nothing more to the array, and -1 on error. */
+static int parse_packed(lex_t *lex, json_t *array, json_error_t *error) {
+    int type = lex->token;
+
+    /* the numbers are nested one level deeper than the array */
+    if ((type != TOKEN_INTEGER && type != TOKEN_REAL) || lex->depth >= lex->max_depth)
+        return 0;
+
+    while (lex->token == type) {
+        if (type == TOKEN_INTEGER ? jsonp_array_pack_integer(array, lex->value.integer)
+                                  : jsonp_array_pack_real(array, lex->value.real))
+            return -1;
+
+        lex_scan(lex, error);
+        if (lex->token != ',') {
+            if (lex->token != ']') {
+                error_set(error, lex, json_error_invalid_syntax, "']' expected");
+                return -1;
+            }
+            return 0;
+        }
+        lex_scan(lex, error);
+    }
+
+    /* the array is boxed when the next element is added to it */
+    return 1;
+}
+
+/* Parse the value that starts at the current token. Instead of
+   recursing for nested values, the objects and arrays that are being
+   parsed are kept on a stack in lex, so the C stack doesn't grow with
+   the nesting depth. The stack is shared by nested calls from
+   parse_deferred(), which use the frames above the caller's. */
+json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error) {
+    size_t base = lex->nframes;
+    parse_frame_t *frame;
+    json_t *json;
+
+    while (1) {
+        /* the start of a value */
+        lex->depth++;
+        if (lex->depth > lex->max_depth) {
+            error_set(error, lex, json_error_stack_overflow,
+                      "maximum parsing depth reached");
+            goto failed;
+        }
+        if (lex->limits && lex->limits->max_values &&
+            ++lex->nvalues > lex->limits->max_values) {
+            error_set(error, lex, json_error_limit_exceeded,
+                      "maximum number of values reached");
+            goto failed;
+        }
+
+        if (lex->lazy && lex->depth > 1 && (lex->token == '{' || lex->token == '['))
+            json = parse_deferred(lex, flags, error);
+        else if (lex->token == '{' || lex->token == '[') {
+            int object = lex->token == '{', more = 0;
+
+            json = object ? json_object() : json_array();
+            if (!json)
+                goto failed;
+
+            lex_scan(lex, error);
+            if (!object && lex->packed) {
+                more = parse_packed(lex, json, error);
+                if (more < 0) {
+                    json_decref(json);
+                    goto failed;
+                }
+            }
+
+            if (more || lex->token != (object ? '}' : ']')) {
+                /* parse the first member */
+                if (push_frame(lex, json)) {
+                    json_decref(json);
+                    goto failed;
+                }
+
+                frame = &lex->frames[lex->nframes - 1];
+                if (object && parse_frame_key(lex, frame, flags, error))
+                    goto failed;
+                if (!object && !lex->token) {
+                    error_set(error, lex, json_error_invalid_syntax, "']' expected");
+                    goto failed;
+                }
+                continue;
+            }
+        } else
+            json = parse_scalar(lex, flags, error);
+
+        if (!json)
+            goto failed;
+
+        /* the end of a value, which is added to the container it's in */
+        while (1) {
+            lex->depth--;
+            if (lex->nframes == base)
+                return json;
+
+            frame = &lex->frames[lex->nframes - 1];
+            if (json_is_object(frame->container)) {
+                int rv = parse_add_member(lex, frame->container, frame->key,
+                                          frame->key_len, json);
+                lex_release_string(lex, frame->key);
+                frame->key = NULL;
+                if (rv)
+                    goto failed;
+            } else if (json_array_append_new(frame->container, json))
+                goto failed;
+
+            lex_scan(lex, error);
+            if (lex->token == ',') {
+                if (lex->limits && lex->limits->max_container_size &&
+                    (json_is_object(frame->container)
+                         ? json_object_size(frame->container)
+                         : json_array_size(frame->container)) >=
+                        lex->limits->max_container_size) {
+                    error_set(error, lex, json_error_limit_exceeded,
+                              "maximum container size reached");
+                    goto failed;
+                }
+                lex_scan(lex, error);
+                if (json_is_object(frame->container) &&
+                    parse_frame_key(lex, frame, flags, error))
+                    goto failed;
+                if (json_is_array(frame->container) && !lex->token) {
+                    error_set(error, lex, json_error_invalid_syntax, "']' expected");
+                    goto failed;
+                }
+                break;
+            }
+
+            if (json_is_object(frame->container) && lex->token != '}') {
+                error_set(error, lex, json_error_invalid_syntax, "'}' expected");
+                goto failed;
+            }
+            if (json_is_array(frame->container) && lex->token != ']') {
+                error_set(error, lex, json_error_invalid_syntax, "']' expected");
+                goto failed;
+            }
+
+            /* the container is complete */
+            json = frame->container;
+            lex->nframes--;
+        }
+    }
+
+failed:
+    while (lex->nframes > base) {
+        frame = &lex->frames[--lex->nframes];
+        if (frame->key)
+            lex_release_string(lex, frame->key);
+        json_decref(frame->container);
+    }
+    return NULL;
+}
+
+static json_t *parse_text_json(lex_t *lex, size_t flags, json_error_t *error) {
     json_t *result;
 
     lex->depth = 0;
@@ -882,39 +1612,62 @@ static json_t *parse_json(lex_t *lex, size_t flags, json_error_t *error) {
     return result;
 }
 
-typedef struct {
-    const char *data;
-    size_t pos;
-} string_data_t;
-
-static int string_get(void *data) {
-    char c;
-    string_data_t *stream = (string_data_t *)data;
-    c = stream->data[stream->pos];
-    if (c == '\0')
-        return EOF;
-    else {
-        stream->pos++;
-        return (unsigned char)c;
+static json_t *parse_json(lex_t *lex, size_t flags, json_error_t *error) {
+    double start = jsonp_stats_now();
+    json_t *result;
+
+    if (flags & BINARY_FLAGS)
+        result = parse_binary_json(lex, flags, error);
+    else
+        result = parse_text_json(lex, flags, error);
+
+    jsonp_stats_parse(lex->stream.position, start);
+    return result;
+}
+
+/* Decode with the limits of json_loadb_limited(). The memory that the
+   lexer sets up before starting is not counted. */
+static json_t *parse_limited(lex_t *lex, size_t flags, const json_load_limits_t *limits,
+                             json_error_t *error) {
+    jsonp_budget_t budget;
+    json_t *result;
+
+    lex->limits = limits;
+    if (!limits->max_bytes)
+        return parse_json(lex, flags, error);
+
+    budget.remaining = limits->max_bytes;
+    budget.exceeded = 0;
+    if (jsonp_budget_enter(&budget)) {
+        error_set(error, NULL, json_error_invalid_argument,
+                  "memory limits are not supported");
+        return NULL;
+    }
+
+    result = parse_json(lex, flags, error);
+    jsonp_budget_leave();
+
+    if (!result && budget.exceeded) {
+        /* replace whatever running out of memory caused */
+        if (error)
+            error->text[0] = '\0';
+        error_set(error, lex, json_error_limit_exceeded, "maximum memory size reached");
     }
+    return result;
 }
 
 json_t *json_loads(const char *string, size_t flags, json_error_t *error) {
     lex_t lex;
     json_t *result;
-    string_data_t stream_data;
 
     jsonp_error_init(error, "<string>");
 
-    if (string == NULL) {
+    if (string == NULL || (flags & BINARY_FLAGS)) {
         error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
         return NULL;
     }
 
-    stream_data.data = string;
-    stream_data.pos = 0;
-
-    if (lex_init(&lex, string_get, flags, (void *)&stream_data))
+    if (lex_init(&lex, string, strlen(string), NULL, NULL, 0, flags))
         return NULL;
 
     result = parse_json(&lex, flags, error);
@@ -923,27 +1676,14 @@ json_t *json_loads(const char *string, size_t flags, json_error_t *error) {
     return result;
 }
 
-typedef struct {
-    const char *data;
-    size_t len;
-    size_t pos;
-} buffer_data_t;
-
-static int buffer_get(void *data) {
-    char c;
-    buffer_data_t *stream = data;
-    if (stream->pos >= stream->len)
-        return EOF;
-
-    c = stream->data[stream->pos];
-    stream->pos++;
-    return (unsigned char)c;
+json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t *error) {
+    return json_loadb_ctx(buffer, buflen, flags, NULL, error);
 }
 
-json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t *error) {
+json_t *json_loadb_ctx(const char *buffer, size_t buflen, size_t flags,
+                       json_load_ctx_t *ctx, json_error_t *error) {
     lex_t lex;
     json_t *result;
-    buffer_data_t stream_data;
 
     jsonp_error_init(error, "<buffer>");
 
@@ -952,11 +1692,7 @@ json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t
         return NULL;
     }
 
-    stream_data.data = buffer;
-    stream_data.pos = 0;
-    stream_data.len = buflen;
-
-    if (lex_init(&lex, buffer_get, flags, (void *)&stream_data))
+    if (lex_init_ctx(&lex, ctx, buffer, buflen, NULL, NULL, 0, flags))
         return NULL;
 
     result = parse_json(&lex, flags, error);
@@ -965,142 +1701,1761 @@ json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t
     return result;
 }
 
-json_t *json_loadf(FILE *input, size_t flags, json_error_t *error) {
+json_t *json_loadb_limited(const char *buffer, size_t buflen, size_t flags,
+                           const json_load_limits_t *limits, json_error_t *error) {
     lex_t lex;
-    const char *source;
     json_t *result;
 
-    if (input == stdin)
-        source = "<stdin>";
-    else
-        source = "<stream>";
-
-    jsonp_error_init(error, source);
+    jsonp_error_init(error, "<buffer>");
 
-    if (input == NULL) {
+    if (buffer == NULL || limits == NULL) {
         error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
         return NULL;
     }
 
-    if (lex_init(&lex, (get_func)fgetc, flags, input))
+    if (lex_init(&lex, buffer, buflen, NULL, NULL, 0, flags))
         return NULL;
 
-    result = parse_json(&lex, flags, error);
+    result = parse_limited(&lex, flags, limits, error);
 
     lex_close(&lex);
     return result;
 }
 
-static int fd_get_func(int *fd) {
-#ifdef HAVE_UNISTD_H
-    uint8_t c;
-    if (read(*fd, &c, 1) == 1)
-        return c;
-#endif
-    return EOF;
+json_t *json_loadb_cbor(const char *buffer, size_t buflen, size_t flags,
+                        json_error_t *error) {
+    return json_loadb(buffer, buflen, (flags & ~(size_t)BINARY_FLAGS) | JSON_DECODE_CBOR,
+                      error);
 }
 
-json_t *json_loadfd(int input, size_t flags, json_error_t *error) {
+json_t *json_loadb_msgpack(const char *buffer, size_t buflen, size_t flags,
+                           json_error_t *error) {
+    return json_loadb(buffer, buflen,
+                      (flags & ~(size_t)BINARY_FLAGS) | JSON_DECODE_MSGPACK, error);
+}
+
+json_t *json_loadb_insitu(char *buffer, size_t buflen, size_t flags,
+                          json_error_t *error) {
     lex_t lex;
-    const char *source;
     json_t *result;
 
-#ifdef HAVE_UNISTD_H
-    if (input == STDIN_FILENO)
-        source = "<stdin>";
-    else
-#endif
-        source = "<stream>";
-
-    jsonp_error_init(error, source);
+    jsonp_error_init(error, "<buffer>");
 
-    if (input < 0) {
+    if (buffer == NULL) {
         error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
         return NULL;
     }
 
-    if (lex_init(&lex, (get_func)fd_get_func, flags, &input))
+    if (lex_init(&lex, buffer, buflen, NULL, NULL, 0, flags))
         return NULL;
 
+    /* String values and keys are decoded over their source text, and
+       string values refer to the buffer instead of owning a copy */
+    lex.insitu = 1;
     result = parse_json(&lex, flags, error);
 
     lex_close(&lex);
     return result;
 }
 
-json_t *json_load_file(const char *path, size_t flags, json_error_t *error) {
+json_t *json_loadb_interned(const char *buffer, size_t buflen, size_t flags,
+                            json_keys_t *keys, json_error_t *error) {
+    lex_t lex;
     json_t *result;
-    FILE *fp;
 
-    jsonp_error_init(error, path);
+    jsonp_error_init(error, "<buffer>");
 
-    if (path == NULL) {
+    if (buffer == NULL || keys == NULL) {
         error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
         return NULL;
     }
 
-    fp = fopen(path, "rb");
-    if (!fp) {
-        error_set(error, NULL, json_error_cannot_open_file, "unable to open %s: %s", path,
-                  strerror(errno));
+    if (lex_init(&lex, buffer, buflen, NULL, NULL, 0, flags))
         return NULL;
-    }
 
-    result = json_loadf(fp, flags, error);
+    lex.keys = keys;
+    result = parse_json(&lex, flags, error);
 
-    fclose(fp);
+    lex_close(&lex);
     return result;
 }
 
-#define MAX_BUF_LEN 1024
-
-typedef struct {
-    char data[MAX_BUF_LEN];
-    size_t len;
-    size_t pos;
-    json_load_callback_t callback;
-    void *arg;
-} callback_data_t;
+json_t *json_loadb_lazy(const char *buffer, size_t buflen, size_t flags,
+                        json_error_t *error) {
+    lex_t lex;
+    json_t *result;
 
-static int callback_get(void *data) {
-    char c;
-    callback_data_t *stream = data;
+    jsonp_error_init(error, "<buffer>");
 
-    if (stream->pos >= stream->len) {
-        stream->pos = 0;
-        stream->len = stream->callback(stream->data, MAX_BUF_LEN, stream->arg);
-        if (stream->len == 0 || stream->len == (size_t)-1)
-            return EOF;
+    if (buffer == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
     }
 
-    c = stream->data[stream->pos];
-    stream->pos++;
-    return (unsigned char)c;
+    if (lex_init(&lex, buffer, buflen, NULL, NULL, 0, flags))
+        return NULL;
+
+    lex.lazy = LEX_LAZY_CHECK;
+    result = parse_json(&lex, flags, error);
+
+    lex_close(&lex);
+    return result;
 }
 
-json_t *json_load_callback(json_load_callback_t callback, void *arg, size_t flags,
-                           json_error_t *error) {
+json_t *json_loadb_packed(const char *buffer, size_t buflen, size_t flags,
+                          json_error_t *error) {
     lex_t lex;
     json_t *result;
 
-    callback_data_t stream_data;
-
-    memset(&stream_data, 0, sizeof(stream_data));
-    stream_data.callback = callback;
-    stream_data.arg = arg;
-
-    jsonp_error_init(error, "<callback>");
+    jsonp_error_init(error, "<buffer>");
 
-    if (callback == NULL) {
+    if (buffer == NULL) {
         error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
         return NULL;
     }
 
-    if (lex_init(&lex, (get_func)callback_get, flags, &stream_data))
+    if (lex_init(&lex, buffer, buflen, NULL, NULL, 0, flags))
         return NULL;
 
+    lex.packed = 1;
     result = parse_json(&lex, flags, error);
 
     lex_close(&lex);
     return result;
 }
+
+/* Consume the value at the current token without decoding it. Only
+   the brackets and strings of containers are checked, see
+   lex_skip_container(). */
+static int path_skip(lex_t *lex, size_t flags, json_error_t *error) {
+    size_t len = 0;
+    json_t *json;
+
+    if (lex->token != '{' && lex->token != '[')
+        return check_scalar(lex, flags, error);
+
+    lex->depth++;
+    if (lex->depth <= lex->max_depth)
+        len = lex_skip_container(lex);
+    lex->depth--;
+
+    if (len) {
+        lex_skip_text(lex, len);
+        return 0;
+    }
+
+    /* malformed, get the error */
+    json = parse_value(lex, flags, error);
+    if (!json)
+        return -1;
+    json_decref(json);
+    return 0;
+}
+
+/* Decode the value that the segments refer to in the value at the
+   current token into *result. Returns 1 if it was found and -1 on
+   error. Otherwise the value has been consumed and 0 is returned. */
+static int path_find(lex_t *lex, size_t flags, const jsonp_path_segment_t *segment,
+                     size_t length, json_t **result, json_error_t *error) {
+    int object = lex->token == '{';
+    size_t index = 0;
+
+    if (!length) {
+        *result = parse_value(lex, flags, error);
+        return *result ? 1 : -1;
+    }
+
+    if (lex->token != '{' && lex->token != '[')
+        return path_skip(lex, flags, error);
+
+    lex->depth++;
+    if (lex->depth > lex->max_depth) {
+        error_set(error, lex, json_error_stack_overflow,
+                  "maximum parsing depth reached");
+        return -1;
+    }
+
+    lex_scan(lex, error);
+    if (lex->token == (object ? '}' : ']')) {
+        lex->depth--;
+        return 0;
+    }
+
+    while (1) {
+        int match, found;
+
+        if (object) {
+            if (lex->token != TOKEN_STRING) {
+                error_set(error, lex, json_error_invalid_syntax,
+                          "string or '}' expected");
+                return -1;
+            }
+            match = jsonp_path_match_key(segment, lex->value.string.val,
+                                         lex->value.string.len);
+
+            lex_scan(lex, error);
+            if (lex->token != ':') {
+                error_set(error, lex, json_error_invalid_syntax, "':' expected");
+                return -1;
+            }
+            lex_scan(lex, error);
+        } else {
+            if (!lex->token) {
+                error_set(error, lex, json_error_invalid_syntax, "']' expected");
+                return -1;
+            }
+            match = segment->type == JSONP_PATH_WILDCARD ||
+                    (segment->type == JSONP_PATH_INDEX && segment->index == index);
+            index++;
+        }
+
+        if (match)
+            found = path_find(lex, flags, segment + 1, length - 1, result, error);
+        else
+            found = path_skip(lex, flags, error);
+        if (found)
+            return found;
+
+        lex_scan(lex, error);
+        if (lex->token != ',')
+            break;
+        lex_scan(lex, error);
+    }
+
+    if (lex->token != (object ? '}' : ']')) {
+        error_set(error, lex, json_error_invalid_syntax,
+                  object ? "'}' expected" : "']' expected");
+        return -1;
+    }
+
+    lex->depth--;
+    return 0;
+}
+
+json_t *json_path_loadb(const char *buffer, size_t buflen, size_t flags,
+                        const json_path_t *path, json_error_t *error) {
+    lex_t lex;
+    json_t *result = NULL;
+    int found;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL || path == NULL || (flags & BINARY_FLAGS)) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (lex_init(&lex, buffer, buflen, NULL, NULL, 0, flags))
+        return NULL;
+
+    lex.depth = 0;
+    lex_scan(&lex, error);
+    if (!(flags & JSON_DECODE_ANY) && lex.token != '[' && lex.token != '{') {
+        error_set(error, &lex, json_error_invalid_syntax, "'[' or '{' expected");
+        lex_close(&lex);
+        return NULL;
+    }
+
+    found = path_find(&lex, flags, path->segments, path->length, &result, error);
+    if (!found)
+        error_set(error, NULL, json_error_item_not_found, "'%s' not found", path->text);
+    else if (found == 1 && error)
+        error->position = (int)lex.stream.position;
+
+    lex_close(&lex);
+    return result;
+}
+
+int jsonp_lazy_expand(json_t *json, json_error_t *error) {
+    jsonp_extra_t *extra;
+    jsonp_lazy_t *lazy;
+    lex_t lex;
+    int rv;
+
+    extra = json_is_object(json) ? json_to_object(json)->extra
+                                 : json_to_array(json)->extra;
+    lazy = extra ? extra->lazy : NULL;
+    if (!lazy)
+        return 0;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (lex_init(&lex, lazy->text, lazy->length, NULL, NULL, 0, lazy->flags)) {
+        error_set(error, NULL, json_error_out_of_memory, "Out of memory");
+        return -1;
+    }
+
+    /* continue where the container was in the input, so that errors
+       are reported there. Its text was checked by parse_deferred(). */
+    lex.lazy = LEX_LAZY_CHECKED;
+    lex.depth = lazy->depth;
+    lex.stream.position = lazy->position;
+    lex.stream.line = lazy->line;
+    lex.stream.column = lazy->column;
+
+    /* the container can be filled as usual once it's not lazy */
+    extra->lazy = NULL;
+    lex_scan(&lex, error);
+    if (json_is_object(json))
+        rv = parse_members(&lex, json, lazy->flags, error);
+    else
+        rv = parse_elements(&lex, json, lazy->flags, error);
+    lex_close(&lex);
+
+    if (rv) {
+        if (json_is_object(json))
+            json_object_clear(json);
+        else
+            json_array_clear(json);
+        extra->lazy = lazy;
+        return -1;
+    }
+
+    jsonp_free(lazy);
+    jsonp_extra_trim(json);
+    return 0;
+}
+
+static int expand_tree(json_t *json, jsonp_parents_t *parents, json_error_t *error) {
+    int rv = 0;
+
+    /* packed arrays have nothing to decode */
+    if ((!json_is_object(json) && !json_is_array(json)) || json_array_int_data(json) ||
+        json_array_real_data(json))
+        return 0;
+
+    if (jsonp_lazy_expand(json, error))
+        return -1;
+
+    /* a value that contains itself is already being expanded further
+       up */
+    if (jsonp_parents_push(parents, json))
+        return 0;
+
+    if (json_is_object(json)) {
+        const char *key;
+        json_t *value;
+
+        json_object_foreach(json, key, value) {
+            if ((rv = expand_tree(value, parents, error)))
+                break;
+        }
+    } else {
+        size_t i;
+
+        for (i = 0; i < json_array_size(json); i++) {
+            if ((rv = expand_tree(json_array_get(json, i), parents, error)))
+                break;
+        }
+    }
+
+    jsonp_parents_pop(parents, json);
+    return rv;
+}
+
+int json_expand(json_t *json, json_error_t *error) {
+    jsonp_parents_t parents;
+    int rv;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (!json) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    jsonp_parents_init(&parents);
+    rv = expand_tree(json, &parents, error);
+    jsonp_parents_close(&parents);
+    return rv;
+}
+
+json_t *json_loadb_arena(const char *buffer, size_t buflen, size_t flags,
+                         json_arena_t *arena, json_error_t *error) {
+    json_t *result;
+
+    if (!arena) {
+        jsonp_error_init(error, "<buffer>");
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    /* Everything the decoder allocates, including its own buffers,
+       comes from the arena until it's left */
+    if (jsonp_arena_enter(arena)) {
+        jsonp_error_init(error, "<buffer>");
+        error_set(error, NULL, json_error_unknown, "arenas are not supported");
+        return NULL;
+    }
+
+    result = json_loadb(buffer, buflen, flags, error);
+
+    jsonp_arena_leave();
+    return result;
+}
+
+/*** tapes ***/
+
+/* An object or array whose members are being decoded */
+typedef struct {
+    size_t start; /* the index of its opening entry */
+    size_t count;
+} tape_frame_t;
+
+typedef struct {
+    strbuffer_t entries;
+    strbuffer_t strings;
+    strbuffer_t frames; /* the open containers, an array of tape_frame_t */
+} tape_builder_t;
+
+static size_t tape_size(const tape_builder_t *builder) {
+    return builder->entries.length / sizeof(uint64_t);
+}
+
+static uint64_t *tape_entries(const tape_builder_t *builder) {
+    return (uint64_t *)builder->entries.value;
+}
+
+static int tape_push(tape_builder_t *builder, uint64_t entry, json_error_t *error) {
+    if (strbuffer_append_bytes(&builder->entries, (const char *)&entry, sizeof(entry))) {
+        error_set(error, NULL, json_error_out_of_memory, "Out of memory");
+        return -1;
+    }
+    return 0;
+}
+
+/* Push the current string token as an entry with tag */
+static int tape_push_string(tape_builder_t *builder, int tag, lex_t *lex,
+                            json_error_t *error) {
+    size_t offset = builder->strings.length, len = lex->value.string.len;
+
+    if (offset > TAPE_MAX_PAYLOAD ||
+        strbuffer_append_bytes(&builder->strings, (const char *)&len, sizeof(len)) ||
+        strbuffer_append_bytes(&builder->strings, lex->value.string.val, len + 1)) {
+        error_set(error, NULL, json_error_out_of_memory, "Out of memory");
+        return -1;
+    }
+    return tape_push(builder, TAPE_ENTRY(tag, offset), error);
+}
+
+/* Check whether the object that starts at entry start has a member
+   with the key of the current string token */
+static int tape_has_key(const tape_builder_t *builder, size_t start, lex_t *lex) {
+    const uint64_t *entries = tape_entries(builder);
+    size_t i = start + 1, size = tape_size(builder);
+
+    while (i < size) {
+        const char *key = builder->strings.value + TAPE_PAYLOAD(entries[i]);
+        size_t len;
+
+        memcpy(&len, key, sizeof(len));
+        if (len == lex->value.string.len &&
+            !memcmp(key + sizeof(len), lex->value.string.val, len))
+            return 1;
+
+        /* skip the key and the value after it */
+        i++;
+        switch (TAPE_TAG(entries[i])) {
+            case '{':
+            case '[':
+                i = (size_t)TAPE_PAYLOAD(entries[i]);
+                break;
+            case 'l':
+            case 'd':
+                i += 2;
+                break;
+            default:
+                i++;
+        }
+    }
+    return 0;
+}
+
+static tape_frame_t *tape_top(const tape_builder_t *builder) {
+    return (tape_frame_t *)(builder->frames.value + builder->frames.length) - 1;
+}
+
+/* Push the opening entry of an object or array, and open a frame for it */
+static int tape_open(tape_builder_t *builder, int tag, json_error_t *error) {
+    tape_frame_t frame;
+
+    frame.start = tape_size(builder);
+    frame.count = 0;
+    if (tape_push(builder, TAPE_ENTRY(tag, 0), error))
+        return -1;
+    if (strbuffer_append_bytes(&builder->frames, (const char *)&frame, sizeof(frame))) {
+        error_set(error, NULL, json_error_out_of_memory, "Out of memory");
+        return -1;
+    }
+    return 0;
+}
+
+/* Push the closing entry of the innermost open container, and point
+   its opening entry past it */
+static int tape_close(tape_builder_t *builder, json_error_t *error) {
+    tape_frame_t frame = *tape_top(builder);
+    uint64_t *entries;
+    int tag;
+
+    builder->frames.length -= sizeof(frame);
+    tag = TAPE_TAG(tape_entries(builder)[frame.start]);
+    if (tape_push(builder, TAPE_ENTRY(tag == '{' ? '}' : ']', frame.count), error))
+        return -1;
+
+    entries = tape_entries(builder);
+    entries[frame.start] = TAPE_ENTRY(tag, tape_size(builder));
+    return 0;
+}
+
+/* Push the key of the next member of the innermost open object, and
+   scan past the colon after it */
+static int tape_key(lex_t *lex, tape_builder_t *builder, size_t flags,
+                    json_error_t *error) {
+    if (lex->token != TOKEN_STRING) {
+        error_set(error, lex, json_error_invalid_syntax, "string or '}' expected");
+        return -1;
+    }
+
+    if (memchr(lex->value.string.val, '\0', lex->value.string.len)) {
+        error_set(error, lex, json_error_null_byte_in_key,
+                  "NUL byte in object key not supported");
+        return -1;
+    }
+
+    if ((flags & JSON_REJECT_DUPLICATES) &&
+        tape_has_key(builder, tape_top(builder)->start, lex)) {
+        error_set(error, lex, json_error_duplicate_key, "duplicate object key");
+        return -1;
+    }
+
+    if (tape_push_string(builder, 'k', lex, error))
+        return -1;
+
+    lex_scan(lex, error);
+    if (lex->token != ':') {
+        error_set(error, lex, json_error_invalid_syntax, "':' expected");
+        return -1;
+    }
+
+    lex_scan(lex, error);
+    return 0;
+}
+
+static int tape_scalar(lex_t *lex, tape_builder_t *builder, size_t flags,
+                       json_error_t *error) {
+    uint64_t bits;
+
+    if (check_scalar(lex, flags, error))
+        return -1;
+
+    switch (lex->token) {
+        case TOKEN_STRING:
+            return tape_push_string(builder, '"', lex, error);
+
+        case TOKEN_INTEGER:
+            return tape_push(builder, TAPE_ENTRY('l', 0), error) ||
+                   tape_push(builder, (uint64_t)lex->value.integer, error);
+
+        case TOKEN_REAL:
+            memcpy(&bits, &lex->value.real, sizeof(bits));
+            return tape_push(builder, TAPE_ENTRY('d', 0), error) ||
+                   tape_push(builder, bits, error);
+
+        case TOKEN_TRUE:
+            return tape_push(builder, TAPE_ENTRY('t', 0), error);
+
+        case TOKEN_FALSE:
+            return tape_push(builder, TAPE_ENTRY('f', 0), error);
+
+        default: /* TOKEN_NULL */
+            return tape_push(builder, TAPE_ENTRY('n', 0), error);
+    }
+}
+
+/* Decode the value that starts at the current token like parse_value()
+   does, reporting errors in the same way. The open containers are kept
+   on the frame stack of builder instead of the C stack. */
+static int tape_value(lex_t *lex, tape_builder_t *builder, size_t flags,
+                      json_error_t *error) {
+    int object;
+
+    while (1) {
+        /* the start of a value */
+        lex->depth++;
+        if (lex->depth > lex->max_depth) {
+            error_set(error, lex, json_error_stack_overflow,
+                      "maximum parsing depth reached");
+            return -1;
+        }
+
+        if (lex->token == '{' || lex->token == '[') {
+            object = lex->token == '{';
+            if (tape_open(builder, lex->token, error))
+                return -1;
+
+            lex_scan(lex, error);
+            if (lex->token != (object ? '}' : ']')) {
+                /* decode the first member */
+                if (object && tape_key(lex, builder, flags, error))
+                    return -1;
+                if (!object && !lex->token) {
+                    error_set(error, lex, json_error_invalid_syntax, "']' expected");
+                    return -1;
+                }
+                continue;
+            }
+
+            if (tape_close(builder, error))
+                return -1;
+        } else if (tape_scalar(lex, builder, flags, error))
+            return -1;
+
+        /* the end of a value, which is a member of the innermost
+           open container */
+        while (1) {
+            tape_frame_t *frame;
+
+            lex->depth--;
+            if (!builder->frames.length)
+                return 0;
+
+            frame = tape_top(builder);
+            frame->count++;
+            object = TAPE_TAG(tape_entries(builder)[frame->start]) == '{';
+
+            lex_scan(lex, error);
+            if (lex->token == ',') {
+                lex_scan(lex, error);
+                if (object && tape_key(lex, builder, flags, error))
+                    return -1;
+                if (!object && !lex->token) {
+                    error_set(error, lex, json_error_invalid_syntax, "']' expected");
+                    return -1;
+                }
+                break;
+            }
+
+            if (lex->token != (object ? '}' : ']')) {
+                error_set(error, lex, json_error_invalid_syntax,
+                          object ? "'}' expected" : "']' expected");
+                return -1;
+            }
+
+            if (tape_close(builder, error))
+                return -1;
+        }
+    }
+}
+
+static int tape_json(lex_t *lex, tape_builder_t *builder, size_t flags,
+                     json_error_t *error) {
+    lex->depth = 0;
+
+    lex_scan(lex, error);
+    if (!(flags & JSON_DECODE_ANY)) {
+        if (lex->token != '[' && lex->token != '{') {
+            error_set(error, lex, json_error_invalid_syntax, "'[' or '{' expected");
+            return -1;
+        }
+    }
+
+    if (tape_value(lex, builder, flags, error))
+        return -1;
+
+    if (!(flags & JSON_DISABLE_EOF_CHECK)) {
+        lex_scan(lex, error);
+        if (lex->token != TOKEN_EOF) {
+            error_set(error, lex, json_error_end_of_input_expected,
+                      "end of file expected");
+            return -1;
+        }
+    }
+
+    if (error) {
+        /* Save the position even though there was no error */
+        error->position = (int)lex->stream.position;
+    }
+
+    return 0;
+}
+
+json_tape_t *json_tape_loadb(const char *buffer, size_t buflen, size_t flags,
+                             json_error_t *error) {
+    tape_builder_t builder;
+    json_tape_t *tape = NULL;
+    lex_t lex;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (lex_init(&lex, buffer, buflen, NULL, NULL, 0, flags))
+        return NULL;
+
+    if (strbuffer_init(&builder.entries)) {
+        lex_close(&lex);
+        return NULL;
+    }
+    if (strbuffer_init(&builder.strings)) {
+        strbuffer_close(&builder.entries);
+        lex_close(&lex);
+        return NULL;
+    }
+    if (strbuffer_init(&builder.frames)) {
+        strbuffer_close(&builder.strings);
+        strbuffer_close(&builder.entries);
+        lex_close(&lex);
+        return NULL;
+    }
+
+    if (!tape_json(&lex, &builder, flags, error)) {
+        tape = jsonp_malloc(sizeof(json_tape_t));
+        if (tape) {
+            tape->size = tape_size(&builder);
+            tape->strings_size = builder.strings.length;
+            tape->entries = (uint64_t *)strbuffer_steal_value(&builder.entries);
+            tape->strings = strbuffer_steal_value(&builder.strings);
+        } else
+            error_set(error, NULL, json_error_out_of_memory, "Out of memory");
+    }
+
+    strbuffer_close(&builder.entries);
+    strbuffer_close(&builder.strings);
+    strbuffer_close(&builder.frames);
+    lex_close(&lex);
+    return tape;
+}
+
+size_t file_read(void *buffer, size_t size, void *data) {
+    return fread(buffer, 1, size, (FILE *)data);
+}
+
+/* Without the EOF check, the bytes read past the end of the JSON text
+   must be given back to the caller. This is only possible if the
+   stream is seekable; otherwise read one byte at a time. */
+static size_t file_block_size(FILE *input, size_t flags) {
+    if ((flags & JSON_DISABLE_EOF_CHECK) && ftell(input) < 0)
+        return 1;
+    return STREAM_BLOCK_SIZE;
+}
+
+static void file_give_back(FILE *input, const stream_t *stream, size_t flags,
+                           size_t block_size) {
+    if ((flags & JSON_DISABLE_EOF_CHECK) && block_size > 1) {
+        long unread = (long)stream_unread(stream);
+        if (unread)
+            fseek(input, -unread, SEEK_CUR);
+    }
+}
+
+json_t *json_loadf(FILE *input, size_t flags, json_error_t *error) {
+    return json_loadf_ctx(input, flags, NULL, error);
+}
+
+json_t *json_loadf_ctx(FILE *input, size_t flags, json_load_ctx_t *ctx,
+                       json_error_t *error) {
+    lex_t lex;
+    const char *source;
+    json_t *result;
+    size_t block_size;
+
+    if (input == stdin)
+        source = "<stdin>";
+    else
+        source = "<stream>";
+
+    jsonp_error_init(error, source);
+
+    if (input == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    block_size = file_block_size(input, flags);
+    if (lex_init_ctx(&lex, ctx, NULL, 0, file_read, input, block_size, flags))
+        return NULL;
+
+    result = parse_json(&lex, flags, error);
+
+    if (result)
+        file_give_back(input, &lex.stream, flags, block_size);
+
+    lex_close(&lex);
+    return result;
+}
+
+size_t fd_read(void *buffer, size_t size, void *data) {
+#ifdef HAVE_UNISTD_H
+    int *fd = (int *)data;
+    ssize_t len;
+
+    do
+        len = read(*fd, buffer, size);
+    while (len < 0 && errno == EINTR);
+
+    if (len >= 0)
+        return (size_t)len;
+#else
+    (void)buffer;
+    (void)size;
+    (void)data;
+#endif
+    return (size_t)-1;
+}
+
+json_t *json_loadfd(int input, size_t flags, json_error_t *error) {
+    return json_loadfd_ctx(input, flags, NULL, error);
+}
+
+json_t *json_loadfd_ctx(int input, size_t flags, json_load_ctx_t *ctx,
+                        json_error_t *error) {
+    lex_t lex;
+    const char *source;
+    json_t *result;
+    size_t block_size = STREAM_BLOCK_SIZE;
+
+#ifdef HAVE_UNISTD_H
+    if (input == STDIN_FILENO)
+        source = "<stdin>";
+    else
+#endif
+        source = "<stream>";
+
+    jsonp_error_init(error, source);
+
+    if (input < 0) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+#ifdef HAVE_UNISTD_H
+    /* See file_block_size() */
+    if ((flags & JSON_DISABLE_EOF_CHECK) && lseek(input, 0, SEEK_CUR) < 0)
+        block_size = 1;
+#endif
+
+    if (lex_init_ctx(&lex, ctx, NULL, 0, fd_read, &input, block_size, flags))
+        return NULL;
+
+    result = parse_json(&lex, flags, error);
+
+#ifdef HAVE_UNISTD_H
+    if (result && (flags & JSON_DISABLE_EOF_CHECK) && block_size > 1) {
+        off_t unread = (off_t)stream_unread(&lex.stream);
+        if (unread)
+            lseek(input, -unread, SEEK_CUR);
+    }
+#endif
+
+    lex_close(&lex);
+    return result;
+}
+
+/* Map the regular file at path to memory, so that it can be decoded
+   like a buffer without copying it first. Returns -1 if the file is
+   small or can't be mapped, and should be read instead. */
+int file_map(file_map_t *map, const char *path) {
+#ifdef USE_MMAP
+    struct stat st;
+    void *addr;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size < MAP_MIN_SIZE ||
+        (off_t)(size_t)st.st_size != st.st_size) {
+        close(fd);
+        return -1;
+    }
+
+    addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return -1;
+
+#if defined(HAVE_MADVISE) && defined(MADV_SEQUENTIAL)
+    madvise(addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+
+    map->data = addr;
+    map->size = (size_t)st.st_size;
+    return 0;
+#else
+    (void)map;
+    (void)path;
+    return -1;
+#endif
+}
+
+void file_unmap(file_map_t *map) {
+#ifdef USE_MMAP
+    munmap((void *)map->data, map->size);
+#else
+    (void)map;
+#endif
+}
+
+json_t *json_load_file(const char *path, size_t flags, json_error_t *error) {
+    return json_load_file_ctx(path, flags, NULL, error);
+}
+
+json_t *json_load_file_ctx(const char *path, size_t flags, json_load_ctx_t *ctx,
+                           json_error_t *error) {
+    file_map_t map;
+    lex_t lex;
+    json_t *result;
+    FILE *fp;
+
+    jsonp_error_init(error, path);
+
+    if (path == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (!file_map(&map, path)) {
+        /* errors are reported as if the file was read by json_loadf() */
+        jsonp_error_init(error, "<stream>");
+        result = NULL;
+        if (!lex_init_ctx(&lex, ctx, map.data, map.size, NULL, NULL, 0, flags)) {
+            result = parse_json(&lex, flags, error);
+            lex_close(&lex);
+        }
+        file_unmap(&map);
+        return result;
+    }
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        error_set(error, NULL, json_error_cannot_open_file, "unable to open %s: %s", path,
+                  strerror(errno));
+        return NULL;
+    }
+
+    result = json_loadf_ctx(fp, flags, ctx, error);
+
+    fclose(fp);
+    return result;
+}
+
+json_t *json_load_callback(json_load_callback_t callback, void *arg, size_t flags,
+                           json_error_t *error) {
+    return json_load_callback_ctx(callback, arg, flags, NULL, error);
+}
+
+json_t *json_load_callback_ctx(json_load_callback_t callback, void *arg, size_t flags,
+                               json_load_ctx_t *ctx, json_error_t *error) {
+    lex_t lex;
+    json_t *result;
+
+    jsonp_error_init(error, "<callback>");
+
+    if (callback == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (lex_init_ctx(&lex, ctx, NULL, 0, callback, arg, STREAM_BLOCK_SIZE, flags))
+        return NULL;
+
+    result = parse_json(&lex, flags, error);
+
+    lex_close(&lex);
+    return result;
+}
+
+json_t *json_load_callback_limited(json_load_callback_t callback, void *arg, size_t flags,
+                                   const json_load_limits_t *limits,
+                                   json_error_t *error) {
+    lex_t lex;
+    json_t *result;
+
+    jsonp_error_init(error, "<callback>");
+
+    if (callback == NULL || limits == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (lex_init(&lex, NULL, 0, callback, arg, STREAM_BLOCK_SIZE, flags))
+        return NULL;
+
+    result = parse_limited(&lex, flags, limits, error);
+
+    lex_close(&lex);
+    return result;
+}
+
+/*** incremental parser ***/
+
+/* What the innermost open container expects next */
+#define FRAME_OBJECT_FIRST 0 /* a key or '}' after '{' */
+#define FRAME_OBJECT_KEY   1 /* a key after ',' */
+#define FRAME_OBJECT_COLON 2
+#define FRAME_OBJECT_VALUE 3
+#define FRAME_OBJECT_NEXT  4 /* ',' or '}' after a member */
+#define FRAME_ARRAY_FIRST  5 /* a value or ']' after '[' */
+#define FRAME_ARRAY_VALUE  6 /* a value after ',' */
+#define FRAME_ARRAY_NEXT   7 /* ',' or ']' after an element */
+
+typedef struct {
+    json_t *container;
+    char *key; /* key of the member whose value is being parsed */
+    size_t key_len;
+    int state;
+} parser_frame_t;
+
+/* Progress of finding the end of a token that may continue in the
+   next feed */
+typedef struct {
+    int first;   /* the first byte of the token */
+    int escape;  /* in a string, the previous byte was a backslash */
+    size_t need; /* for other tokens, the bytes still missing */
+} token_scan_t;
+
+struct json_parser {
+    lex_t lex;
+    size_t flags;
+    int status;
+    json_t *result;
+    json_error_t error;
+    parser_frame_t *stack; /* the open containers, innermost last */
+    size_t stack_size;
+    size_t stack_capacity;
+    strbuffer_t partial; /* a token that was split between feeds */
+    token_scan_t scan;
+    const json_sax_callbacks_t *sax; /* NULL if a tree is built */
+    void *sax_data;
+};
+
+/* The bytes of a number, and of a literal that follows it directly */
+#define l_isnumber(c)                                                                    \
+    (l_isdigit(c) || l_isalpha(c) || (c) == '.' || (c) == '+' || (c) == '-')
+
+/* Continue scanning a token in [p, end). Return the end of the token,
+   or NULL if it may continue past end. Numbers and literals end only
+   at a byte that can't be a part of them, so such a byte must follow
+   them in the window. If it starts a UTF-8 sequence, the lexer reads
+   the whole sequence, so that's needed too. */
+static const char *token_end(token_scan_t *scan, const char *p, const char *end) {
+    size_t count;
+
+    if (scan->first == '"') {
+        for (; p < end; p++) {
+            if (scan->escape)
+                scan->escape = 0;
+            else if (*p == '\\')
+                scan->escape = 1;
+            else if (*p == '"')
+                return p + 1;
+        }
+        return NULL;
+    }
+
+    if (l_isdigit(scan->first) || scan->first == '-' || l_isalpha(scan->first)) {
+        if (l_isalpha(scan->first)) {
+            while (p < end && l_isalpha(*p))
+                p++;
+        } else {
+            while (p < end && l_isnumber(*p))
+                p++;
+        }
+
+        if (p == end)
+            return NULL;
+        if ((unsigned char)*p < 0x80)
+            return p;
+
+        count = utf8_check_first(*p);
+        scan->first = 0;
+        scan->need = count ? count : 1;
+    }
+
+    /* punctuation, an invalid token whose UTF-8 sequence is needed for
+       the error message, or the sequence after a number or literal */
+    if ((size_t)(end - p) >= scan->need)
+        return p + scan->need;
+    scan->need -= end - p;
+    return NULL;
+}
+
+static const char *token_start(token_scan_t *scan, const char *p, const char *end) {
+    size_t count = utf8_check_first(*p);
+
+    scan->first = (unsigned char)*p;
+    scan->escape = 0;
+    scan->need = count > 1 ? count - 1 : 0;
+    return token_end(scan, p + 1, end);
+}
+
+static void parser_out_of_memory(json_parser_t *parser) {
+    error_set(&parser->error, NULL, json_error_out_of_memory, "Out of memory");
+}
+
+static int parser_stopped_by_callback(json_parser_t *parser) {
+    error_set(&parser->error, &parser->lex, json_error_unknown, "stopped by callback");
+    return -1;
+}
+
+/* Move on after a complete value. When a tree is being built, the
+   value is stored to the innermost container, or as the result if
+   there is none. With event callbacks, value is NULL. */
+static int parser_add(json_parser_t *parser, json_t *value) {
+    parser_frame_t *frame;
+    int rv = 0;
+
+    if (!parser->stack_size) {
+        parser->result = value;
+        parser->status = JSON_PARSER_DONE;
+        return 0;
+    }
+
+    frame = &parser->stack[parser->stack_size - 1];
+    if (frame->state == FRAME_OBJECT_VALUE) {
+        if (value)
+            rv = json_object_setn_new_nocheck(frame->container, frame->key,
+                                              frame->key_len, value);
+        jsonp_free(frame->key);
+        frame->key = NULL;
+        frame->state = FRAME_OBJECT_NEXT;
+    } else {
+        if (value)
+            rv = json_array_append_new(frame->container, value);
+        frame->state = FRAME_ARRAY_NEXT;
+    }
+
+    if (rv)
+        parser_out_of_memory(parser);
+    return rv;
+}
+
+static int parser_push(json_parser_t *parser, int object) {
+    const json_sax_callbacks_t *sax = parser->sax;
+    parser_frame_t *frame;
+    json_t *container = NULL;
+
+    /* With event callbacks, only the keys of an object are kept, and
+       only if duplicates are rejected */
+    if (!sax || (object && (parser->flags & JSON_REJECT_DUPLICATES))) {
+        container = object ? json_object() : json_array();
+        if (!container)
+            goto oom;
+    }
+
+    if (parser->stack_size == parser->stack_capacity) {
+        size_t new_capacity = parser->stack_capacity ? 2 * parser->stack_capacity : 8;
+        parser_frame_t *new_stack = jsonp_malloc(new_capacity * sizeof(parser_frame_t));
+        if (!new_stack) {
+            json_decref(container);
+            goto oom;
+        }
+
+        if (parser->stack_size)
+            memcpy(new_stack, parser->stack, parser->stack_size * sizeof(parser_frame_t));
+        jsonp_free(parser->stack);
+        parser->stack = new_stack;
+        parser->stack_capacity = new_capacity;
+    }
+
+    frame = &parser->stack[parser->stack_size++];
+    frame->container = container;
+    frame->key = NULL;
+    frame->key_len = 0;
+    frame->state = object ? FRAME_OBJECT_FIRST : FRAME_ARRAY_FIRST;
+
+    if (sax) {
+        int (*start)(void *) = object ? sax->start_object : sax->start_array;
+        if (start && start(parser->sax_data))
+            return parser_stopped_by_callback(parser);
+    }
+    return 0;
+
+oom:
+    parser_out_of_memory(parser);
+    return -1;
+}
+
+static int parser_pop(json_parser_t *parser) {
+    const json_sax_callbacks_t *sax = parser->sax;
+    parser_frame_t *frame = &parser->stack[--parser->stack_size];
+    int (*end)(void *);
+
+    if (!sax)
+        return parser_add(parser, frame->container);
+
+    json_decref(frame->container);
+    end = frame->state < FRAME_ARRAY_FIRST ? sax->end_object : sax->end_array;
+    if (end && end(parser->sax_data))
+        return parser_stopped_by_callback(parser);
+    return parser_add(parser, NULL);
+}
+
+/* Pass the key of a new member to the callback */
+static int parser_key(json_parser_t *parser, parser_frame_t *frame) {
+    const json_sax_callbacks_t *sax = parser->sax;
+    char *key = frame->key;
+    int rv = 0;
+
+    frame->key = NULL;
+    if (sax->key && sax->key(parser->sax_data, key, frame->key_len))
+        rv = parser_stopped_by_callback(parser);
+    else if (frame->container && json_object_setn_new_nocheck(frame->container, key,
+                                                              frame->key_len,
+                                                              json_null())) {
+        parser_out_of_memory(parser);
+        rv = -1;
+    }
+
+    jsonp_free(key);
+    return rv;
+}
+
+/* Pass a value other than an object or an array to the callback */
+static int parser_event(json_parser_t *parser) {
+    const json_sax_callbacks_t *sax = parser->sax;
+    void *data = parser->sax_data;
+    lex_t *lex = &parser->lex;
+    int rv = 0;
+
+    switch (lex->token) {
+        case TOKEN_STRING:
+            if (sax->string)
+                rv = sax->string(data, lex->value.string.val, lex->value.string.len);
+            break;
+
+        case TOKEN_INTEGER:
+            if (sax->integer)
+                rv = sax->integer(data, lex->value.integer);
+            break;
+
+        case TOKEN_REAL:
+            if (sax->real)
+                rv = sax->real(data, lex->value.real);
+            break;
+
+        case TOKEN_TRUE:
+        case TOKEN_FALSE:
+            if (sax->boolean)
+                rv = sax->boolean(data, lex->token == TOKEN_TRUE);
+            break;
+
+        default: /* TOKEN_NULL */
+            if (sax->null)
+                rv = sax->null(data);
+            break;
+    }
+
+    if (rv)
+        return parser_stopped_by_callback(parser);
+    return parser_add(parser, NULL);
+}
+
+static int parser_value(json_parser_t *parser) {
+    lex_t *lex = &parser->lex;
+    json_t *value;
+
+    /* the same depth that parse_value() would be at */
+    if (parser->stack_size + 1 > lex->max_depth) {
+        error_set(&parser->error, lex, json_error_stack_overflow,
+                  "maximum parsing depth reached");
+        return -1;
+    }
+
+    if (lex->token == '{' || lex->token == '[')
+        return parser_push(parser, lex->token == '{');
+
+    if (parser->sax) {
+        if (check_scalar(lex, parser->flags, &parser->error))
+            return -1;
+        return parser_event(parser);
+    }
+
+    value = parse_scalar(lex, parser->flags, &parser->error);
+    if (!value)
+        return -1;
+
+    return parser_add(parser, value);
+}
+
+/* Advance the state machine by the current token. This accepts the
+   same input and reports the same errors as parse_json(). */
+static int parser_token(json_parser_t *parser) {
+    lex_t *lex = &parser->lex;
+    json_error_t *error = &parser->error;
+    parser_frame_t *frame;
+
+    if (!parser->stack_size) {
+        if (parser->status == JSON_PARSER_DONE) {
+            if (lex->token != TOKEN_EOF) {
+                error_set(error, lex, json_error_end_of_input_expected,
+                          "end of file expected");
+                return -1;
+            }
+            return 0;
+        }
+
+        if (!(parser->flags & JSON_DECODE_ANY)) {
+            if (lex->token != '[' && lex->token != '{') {
+                error_set(error, lex, json_error_invalid_syntax, "'[' or '{' expected");
+                return -1;
+            }
+        }
+        return parser_value(parser);
+    }
+
+    frame = &parser->stack[parser->stack_size - 1];
+    switch (frame->state) {
+        case FRAME_OBJECT_FIRST:
+            if (lex->token == '}')
+                break;
+            /* fall through */
+
+        case FRAME_OBJECT_KEY:
+            if (lex->token != TOKEN_STRING) {
+                error_set(error, lex, json_error_invalid_syntax,
+                          "string or '}' expected");
+                return -1;
+            }
+            frame->key = parse_object_key(lex, frame->container, parser->flags,
+                                          &frame->key_len, error);
+            if (!frame->key)
+                return -1;
+            frame->state = FRAME_OBJECT_COLON;
+            return parser->sax ? parser_key(parser, frame) : 0;
+
+        case FRAME_OBJECT_COLON:
+            if (lex->token != ':') {
+                error_set(error, lex, json_error_invalid_syntax, "':' expected");
+                return -1;
+            }
+            frame->state = FRAME_OBJECT_VALUE;
+            return 0;
+
+        case FRAME_OBJECT_VALUE:
+            return parser_value(parser);
+
+        case FRAME_OBJECT_NEXT:
+            if (lex->token == ',') {
+                frame->state = FRAME_OBJECT_KEY;
+                return 0;
+            }
+            if (lex->token != '}') {
+                error_set(error, lex, json_error_invalid_syntax, "'}' expected");
+                return -1;
+            }
+            break;
+
+        case FRAME_ARRAY_FIRST:
+            if (lex->token == ']')
+                break;
+            /* fall through */
+
+        case FRAME_ARRAY_VALUE:
+            if (lex->token == TOKEN_EOF) {
+                error_set(error, lex, json_error_invalid_syntax, "']' expected");
+                return -1;
+            }
+            return parser_value(parser);
+
+        default: /* FRAME_ARRAY_NEXT */
+            if (lex->token == ',') {
+                frame->state = FRAME_ARRAY_VALUE;
+                return 0;
+            }
+            if (lex->token != ']') {
+                error_set(error, lex, json_error_invalid_syntax, "']' expected");
+                return -1;
+            }
+            break;
+    }
+
+    /* the innermost container is complete */
+    return parser_pop(parser);
+}
+
+/* With JSON_DISABLE_EOF_CHECK, nothing after the value is consumed */
+#define parser_stopped(parser)                                                           \
+    ((parser)->status == JSON_PARSER_DONE && ((parser)->flags & JSON_DISABLE_EOF_CHECK))
+
+/* Parse the tokens in [p, end). If complete is zero, a token that
+   reaches end may continue in the next feed, and it's saved to
+   parser->partial instead. */
+static int parser_run(json_parser_t *parser, const char *p, const char *end,
+                      int complete) {
+    stream_t *stream = &parser->lex.stream;
+
+    stream->pos = p;
+    stream->end = end;
+    stream->state = STREAM_STATE_OK;
+
+    while (!parser_stopped(parser)) {
+        stream_skip_whitespace(stream);
+        if (stream->pos == stream->end)
+            break;
+
+        if (!complete && !token_start(&parser->scan, stream->pos, end)) {
+            size_t len = end - stream->pos;
+
+            if (strbuffer_append_bytes(&parser->partial, stream->pos, len)) {
+                parser_out_of_memory(parser);
+                return -1;
+            }
+            stream->pos = end;
+            break;
+        }
+
+        lex_scan(&parser->lex, &parser->error);
+
+        if (stream->state != STREAM_STATE_ERROR) {
+            /* Give the lookahead of stream_get() back to the window,
+               so that the next token can be scanned from there */
+            stream->pos -= strlen(&stream->buffer[stream->buffer_pos]);
+            stream->buffer[0] = '\0';
+            stream->buffer_pos = 0;
+        }
+
+        if (parser_token(parser))
+            return -1;
+
+        /* A token may end at invalid UTF-8. The error has been set,
+           and parse_json() would fail at the next token. */
+        if (stream->state == STREAM_STATE_ERROR && !parser_stopped(parser))
+            return -1;
+    }
+    return 0;
+}
+
+static int parser_init(json_parser_t *parser, const char *buffer, size_t buflen,
+                       read_func read, void *data, size_t block_size, size_t flags,
+                       const char *source) {
+    if (lex_init(&parser->lex, buffer, buflen, read, data, block_size, flags))
+        return -1;
+
+    if (strbuffer_init(&parser->partial)) {
+        lex_close(&parser->lex);
+        return -1;
+    }
+
+    parser->lex.depth = 0;
+    parser->flags = flags;
+    parser->status = JSON_PARSER_NEED_MORE;
+    parser->result = NULL;
+    parser->stack = NULL;
+    parser->stack_size = 0;
+    parser->stack_capacity = 0;
+    parser->sax = NULL;
+    parser->sax_data = NULL;
+    jsonp_error_init(&parser->error, source);
+    return 0;
+}
+
+static void parser_close(json_parser_t *parser) {
+    size_t i;
+
+    for (i = 0; i < parser->stack_size; i++) {
+        json_decref(parser->stack[i].container);
+        jsonp_free(parser->stack[i].key);
+    }
+    jsonp_free(parser->stack);
+    json_decref(parser->result);
+    strbuffer_close(&parser->partial);
+    lex_close(&parser->lex);
+}
+
+/* Parse everything from the stream at once, like parse_json() */
+static int parser_parse(json_parser_t *parser) {
+    lex_t *lex = &parser->lex;
+
+    do {
+        lex_scan(lex, &parser->error);
+        if (parser_token(parser))
+            return -1;
+    } while (parser->status != JSON_PARSER_DONE);
+
+    if (!(parser->flags & JSON_DISABLE_EOF_CHECK)) {
+        lex_scan(lex, &parser->error);
+        if (parser_token(parser))
+            return -1;
+    }
+    return 0;
+}
+
+json_parser_t *json_parser_new(size_t flags) {
+    json_parser_t *parser = jsonp_malloc(sizeof(json_parser_t));
+    if (!parser)
+        return NULL;
+
+    if (parser_init(parser, "", 0, NULL, NULL, 0, flags, "<buffer>")) {
+        jsonp_free(parser);
+        return NULL;
+    }
+    return parser;
+}
+
+json_parser_t *json_parser_new_sax(size_t flags, const json_sax_callbacks_t *callbacks,
+                                   void *data) {
+    json_parser_t *parser;
+
+    if (!callbacks)
+        return NULL;
+
+    parser = json_parser_new(flags);
+    if (parser) {
+        parser->sax = callbacks;
+        parser->sax_data = data;
+    }
+    return parser;
+}
+
+int json_parser_feed(json_parser_t *parser, const char *buffer, size_t buflen) {
+    const char *end;
+
+    if (!parser)
+        return JSON_PARSER_ERROR;
+    if (parser->status == JSON_PARSER_ERROR)
+        return JSON_PARSER_ERROR;
+
+    if (!buffer && buflen) {
+        error_set(&parser->error, NULL, json_error_invalid_argument, "wrong arguments");
+        goto error;
+    }
+    if (!buflen)
+        return parser->status;
+
+    end = buffer + buflen;
+
+    if (parser->partial.length) {
+        /* Complete the token that was split. Only its own bytes are
+           copied, the rest is parsed from the caller's buffer. */
+        const char *p = token_end(&parser->scan, buffer, end);
+
+        if (strbuffer_append_bytes(&parser->partial, buffer, (p ? p : end) - buffer)) {
+            parser_out_of_memory(parser);
+            goto error;
+        }
+        if (!p)
+            return parser->status;
+
+        if (parser_run(parser, parser->partial.value,
+                       parser->partial.value + parser->partial.length, 1))
+            goto error;
+        strbuffer_clear(&parser->partial);
+        buffer = p;
+    }
+
+    if (parser_run(parser, buffer, end, 0))
+        goto error;
+    return parser->status;
+
+error:
+    parser->status = JSON_PARSER_ERROR;
+    return JSON_PARSER_ERROR;
+}
+
+int json_parser_finish(json_parser_t *parser) {
+    lex_t *lex;
+
+    if (!parser)
+        return JSON_PARSER_ERROR;
+    if (parser->status == JSON_PARSER_ERROR)
+        return JSON_PARSER_ERROR;
+
+    lex = &parser->lex;
+    if (parser->partial.length) {
+        if (parser_run(parser, parser->partial.value,
+                       parser->partial.value + parser->partial.length, 1))
+            goto error;
+        strbuffer_clear(&parser->partial);
+    }
+
+    if (parser_stopped(parser))
+        return JSON_PARSER_DONE;
+
+    /* the end of input token */
+    lex->stream.pos = lex->stream.end;
+    lex->stream.state = STREAM_STATE_OK;
+    lex_scan(lex, &parser->error);
+    if (parser_token(parser))
+        goto error;
+    return parser->status;
+
+error:
+    parser->status = JSON_PARSER_ERROR;
+    return JSON_PARSER_ERROR;
+}
+
+json_t *json_parser_result(json_parser_t *parser, json_error_t *error) {
+    json_t *result;
+
+    if (!parser) {
+        jsonp_error_init(error, "<buffer>");
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (error)
+        *error = parser->error;
+
+    if (parser->status != JSON_PARSER_DONE)
+        return NULL;
+
+    if (error) {
+        /* Save the position even though there was no error */
+        error->position = (int)parser->lex.stream.position;
+    }
+
+    result = parser->result;
+    parser->result = NULL;
+    return result;
+}
+
+void json_parser_free(json_parser_t *parser) {
+    if (!parser)
+        return;
+
+    parser_close(parser);
+    jsonp_free(parser);
+}
+
+/*** event callbacks ***/
+
+/* Decode with event callbacks from a stream that parser has been
+   initialized with */
+static int sax_load(json_parser_t *parser, const json_sax_callbacks_t *callbacks,
+                    void *data, json_error_t *error) {
+    int rv;
+
+    parser->sax = callbacks;
+    parser->sax_data = data;
+    rv = parser_parse(parser);
+
+    if (error) {
+        *error = parser->error;
+        if (!rv) {
+            /* Save the position even though there was no error */
+            error->position = (int)parser->lex.stream.position;
+        }
+    }
+    return rv;
+}
+
+int json_sax_loadb(const char *buffer, size_t buflen, size_t flags,
+                   const json_sax_callbacks_t *callbacks, void *data,
+                   json_error_t *error) {
+    json_parser_t parser;
+    int rv;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL || callbacks == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    if (parser_init(&parser, buffer, buflen, NULL, NULL, 0, flags, "<buffer>"))
+        return -1;
+
+    rv = sax_load(&parser, callbacks, data, error);
+
+    parser_close(&parser);
+    return rv;
+}
+
+int json_sax_loadf(FILE *input, size_t flags, const json_sax_callbacks_t *callbacks,
+                   void *data, json_error_t *error) {
+    json_parser_t parser;
+    const char *source;
+    size_t block_size;
+    int rv;
+
+    if (input == stdin)
+        source = "<stdin>";
+    else
+        source = "<stream>";
+
+    jsonp_error_init(error, source);
+
+    if (input == NULL || callbacks == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    block_size = file_block_size(input, flags);
+    if (parser_init(&parser, NULL, 0, file_read, input, block_size, flags, source))
+        return -1;
+
+    rv = sax_load(&parser, callbacks, data, error);
+    if (!rv)
+        file_give_back(input, &parser.lex.stream, flags, block_size);
+
+    parser_close(&parser);
+    return rv;
+}
+
+int json_sax_load_file(const char *path, size_t flags,
+                       const json_sax_callbacks_t *callbacks, void *data,
+                       json_error_t *error) {
+    json_parser_t parser;
+    file_map_t map;
+    FILE *fp;
+    int rv;
+
+    jsonp_error_init(error, path);
+
+    if (path == NULL || callbacks == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    if (!file_map(&map, path)) {
+        /* errors are reported as if the file was read by json_sax_loadf() */
+        jsonp_error_init(error, "<stream>");
+        rv = -1;
+        if (!parser_init(&parser, map.data, map.size, NULL, NULL, 0, flags, "<stream>")) {
+            rv = sax_load(&parser, callbacks, data, error);
+            parser_close(&parser);
+        }
+        file_unmap(&map);
+        return rv;
+    }
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        error_set(error, NULL, json_error_cannot_open_file, "unable to open %s: %s", path,
+                  strerror(errno));
+        return -1;
+    }
+
+    rv = json_sax_loadf(fp, flags, callbacks, data, error);
+
+    fclose(fp);
+    return rv;
+}
+
+int json_sax_load_callback(json_load_callback_t callback, void *arg, size_t flags,
+                           const json_sax_callbacks_t *callbacks, void *data,
+                           json_error_t *error) {
+    json_parser_t parser;
+    int rv;
+
+    jsonp_error_init(error, "<callback>");
+
+    if (callback == NULL || callbacks == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    if (parser_init(&parser, NULL, 0, callback, arg, STREAM_BLOCK_SIZE, flags,
+                    "<callback>"))
+        return -1;
+
+    rv = sax_load(&parser, callbacks, data, error);
+
+    parser_close(&parser);
+    return rv;
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef LOAD_H
+#define LOAD_H
+
+#include "jansson.h"
+#include "jansson_private.h"
+#include "strbuffer.h"
+#include <stddef.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+/* The decoder that load.c implements, shared with the other ways of
+   reading JSON text */
+
+#define STREAM_STATE_OK    0
+#define STREAM_STATE_EOF   -1
+#define STREAM_STATE_ERROR -2
+
+/* The nesting limit set with JSON_PARSER_DEPTH(), or 0 for the default */
+#define FLAGS_TO_DEPTH(f) (((f) >> 8) & 0xFFFFFF)
+
+#define BINARY_FLAGS (JSON_DECODE_CBOR | JSON_DECODE_MSGPACK)
+
+#define TOKEN_INVALID -1
+#define TOKEN_EOF     0
+#define TOKEN_STRING  256
+#define TOKEN_INTEGER 257
+#define TOKEN_REAL    258
+#define TOKEN_TRUE    259
+#define TOKEN_FALSE   260
+#define TOKEN_NULL    261
+
+/* Locale independent versions of isxxx() functions */
+#define l_isupper(c) ('A' <= (c) && (c) <= 'Z')
+#define l_islower(c) ('a' <= (c) && (c) <= 'z')
+#define l_isalpha(c) (l_isupper(c) || l_islower(c))
+#define l_isdigit(c) ('0' <= (c) && (c) <= '9')
+#define l_isxdigit(c)                                                                    \
+    (l_isdigit(c) || ('A' <= (c) && (c) <= 'F') || ('a' <= (c) && (c) <= 'f'))
+
+/* Read at most size bytes of input to buffer. Return the number of
+   bytes read, 0 on end of input or (size_t)-1 on error. This
+   corresponds to the behaviour of json_load_callback_t. */
+typedef size_t (*read_func)(void *buffer, size_t size, void *data);
+
+/* Size of the window that is refilled from fds, FILEs and callbacks */
+#define STREAM_BLOCK_SIZE 65536
+
+typedef struct {
+    const char *pos; /* next unread byte of the current window */
+    const char *end; /* end of the current window */
+    read_func read;  /* NULL if the whole input is in the window */
+    void *data;
+    char *block; /* storage for the window, used with read */
+    size_t block_size;
+    char buffer[5];
+    size_t buffer_pos;
+    int state;
+    int line;
+    int column, last_column;
+    size_t position;
+} stream_t;
+
+/* An object or array whose members are being parsed */
+typedef struct {
+    json_t *container;
+    char *key; /* the key of the member being parsed */
+    size_t key_len;
+    size_t remaining; /* members left in a binary container */
+} parse_frame_t;
+
+/* The values of lex_t.lazy other than 0. The text of a container
+   that's deferred is checked, unless it's in a container whose text
+   was checked already. */
+#define LEX_LAZY_CHECK   1
+#define LEX_LAZY_CHECKED 2
+
+typedef struct {
+    stream_t stream;
+    strbuffer_t saved_text;
+    size_t flags;
+    size_t depth;
+    size_t max_depth;
+    parse_frame_t *frames; /* the containers being parsed, see parse_value() */
+    size_t nframes;
+    size_t frames_size;
+    int insitu; /* strings are decoded in place in the input buffer */
+    int lazy;   /* containers below the root are decoded when used, see
+                   LEX_LAZY_CHECK */
+    int packed; /* arrays of only integers or only reals are packed */
+    json_keys_t *keys; /* object keys are shared through this table */
+    json_load_ctx_t *ctx; /* lends its buffers to the lexer, or NULL */
+    const json_load_limits_t *limits; /* see json_loadb_limited(), or NULL */
+    size_t nvalues;                   /* the values parsed so far */
+    int token;
+    union {
+        struct {
+            char *val;
+            size_t len;
+        } string;
+        json_int_t integer;
+        double real;
+    } value;
+    char short_string[JSONP_STRING_INLINE_MAX]; /* the val of a short string */
+} lex_t;
+
+#define stream_to_lex(stream) container_of(stream, lex_t, stream)
+
+/* The longest string or key that may be decoded */
+#define lex_max_string_length(lex)                                                       \
+    ((lex)->limits && (lex)->limits->max_string_length                                   \
+         ? (lex)->limits->max_string_length                                              \
+         : (size_t)-1)
+
+typedef struct {
+    const char *data;
+    size_t size;
+} file_map_t;
+
+/* Set error from the position of lex, which may be NULL */
+void error_set(json_error_t *error, const lex_t *lex, enum json_error_code code,
+               const char *msg, ...);
+
+/* Read the next window from the source, or return -1 at its end */
+int stream_refill(stream_t *stream);
+void stream_skip_whitespace(stream_t *stream);
+
+int lex_init(lex_t *lex, const char *buffer, size_t buflen, read_func read, void *data,
+             size_t block_size, size_t flags);
+void lex_close(lex_t *lex);
+
+int lex_get(lex_t *lex, json_error_t *error);
+void lex_unget(lex_t *lex, int c);
+
+/* Decode a \u escape. str points to 'u' plus at least 4 valid hex
+   digits. */
+int32_t decode_unicode_escape(const char *str);
+
+/* Free a string taken from a string token */
+void lex_release_string(lex_t *lex, char *str);
+
+/* Scan the next token to lex->token and return it */
+int lex_scan(lex_t *lex, json_error_t *error);
+
+/* Decode the value that starts at the current token */
+json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error);
+
+/* Push container to the frames of the containers being parsed */
+int push_frame(lex_t *lex, json_t *container);
+
+/* read_func for FILEs and file descriptors */
+size_t file_read(void *buffer, size_t size, void *data);
+size_t fd_read(void *buffer, size_t size, void *data);
+
+/* Map the regular file at path to memory, or return -1 if it should
+   be read instead */
+int file_map(file_map_t *map, const char *path);
+void file_unmap(file_map_t *map);
+
+/* Find the end of the container whose opening bracket was just
+   scanned, see load.c */
+size_t lex_skip_container(lex_t *lex);
+
+/* Take the key of a new member of object from the current string
+   token */
+char *parse_object_key(lex_t *lex, json_t *object, size_t flags, size_t *len,
+                       json_error_t *error);
+
+/* Add a member to object, stealing the reference to value */
+int parse_add_member(lex_t *lex, json_t *object, const char *key, size_t len,
+                     json_t *value);
+
+/* Check the grammar of the object or array that starts at text, see
+   validate.c. Returns its length, or 0 if it's invalid, nested more
+   than max_depth levels deep or can't be checked without decoding
+   it. */
+size_t validate_container(const char *text, const char *end, size_t flags,
+                          size_t max_depth);
+
+/* Decode CBOR or MessagePack, see load_binary.c */
+json_t *parse_binary_json(lex_t *lex, size_t flags, json_error_t *error);
+
+#endif
@@ -0,0 +1,621 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "jansson_private.h"
+
+#include <string.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "jansson.h"
+#include "load.h"
+#include "strbuffer.h"
+#include "utf.h"
+
+/* The kinds of binary items that have an equivalent in JSON, and the
+   end of an indefinite-length CBOR item */
+enum {
+    BINARY_NULL,
+    BINARY_TRUE,
+    BINARY_FALSE,
+    BINARY_INTEGER,
+    BINARY_REAL,
+    BINARY_STRING,
+    BINARY_ARRAY,
+    BINARY_OBJECT,
+    BINARY_BREAK
+};
+
+/* What the head of a binary item says */
+typedef struct {
+    int kind;
+    size_t position; /* of the first byte, for errors */
+    size_t length;   /* of a string, or the number of members */
+    int indefinite;  /* CBOR only: the length isn't known in advance */
+    json_int_t integer;
+    double real;
+} binary_head_t;
+
+/* Binary input has no lines or columns, errors only have a position */
+static void binary_error(json_error_t *error, size_t position, enum json_error_code code,
+                         const char *msg, ...) {
+    va_list ap;
+
+    va_start(ap, msg);
+    jsonp_error_vset(error, -1, -1, position, code, msg, ap);
+    va_end(ap);
+}
+
+/* Read len bytes of input to dst, or append them to text if dst is
+   NULL */
+static int binary_read(lex_t *lex, void *dst, strbuffer_t *text, size_t len,
+                       json_error_t *error) {
+    stream_t *stream = &lex->stream;
+    char *out = dst;
+
+    while (len) {
+        size_t n = stream->end - stream->pos;
+
+        if (!n) {
+            if (stream_refill(stream)) {
+                binary_error(error, stream->position, json_error_premature_end_of_input,
+                             "unexpected end of input");
+                return -1;
+            }
+            continue;
+        }
+
+        if (n > len)
+            n = len;
+        if (out) {
+            memcpy(out, stream->pos, n);
+            out += n;
+        } else if (strbuffer_append_bytes(text, stream->pos, n))
+            return -1;
+
+        stream->pos += n;
+        stream->position += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Read a big-endian number of size bytes */
+static int binary_uint(lex_t *lex, size_t size, uint64_t *value, json_error_t *error) {
+    unsigned char bytes[8];
+    size_t i;
+
+    if (binary_read(lex, bytes, NULL, size, error))
+        return -1;
+
+    *value = 0;
+    for (i = 0; i < size; i++)
+        *value = *value << 8 | bytes[i];
+    return 0;
+}
+
+/* Set head to the integer value, or to -1 - value if negative */
+static int binary_integer(binary_head_t *head, uint64_t value, int negative,
+                          json_error_t *error) {
+    json_int_t integer = (json_int_t)value;
+
+    if (integer < 0 || (uint64_t)integer != value) {
+        binary_error(error, head->position, json_error_numeric_overflow,
+                     negative ? "too big negative integer" : "too big integer");
+        return -1;
+    }
+
+    head->kind = BINARY_INTEGER;
+    head->integer = negative ? -1 - integer : integer;
+    return 0;
+}
+
+/* Set head to the IEEE 754 number of size bytes whose bits are given */
+static int binary_float(binary_head_t *head, uint64_t bits, size_t size,
+                        json_error_t *error) {
+    union {
+        float value;
+        uint32_t bits;
+    } single;
+    union {
+        double value;
+        uint64_t bits;
+    } real;
+    int exponent = (int)(bits >> 10) & 0x1F;
+
+    if (size == 8) {
+        real.bits = bits;
+        head->real = real.value;
+    } else if (size == 4) {
+        single.bits = (uint32_t)bits;
+        head->real = single.value;
+    } else if (exponent == 0x1F)
+        head->real = 0.0; /* infinity or NaN, rejected below */
+    else {
+        /* half precision: a sign, 5 bits of exponent and 10 of mantissa */
+        head->real = (double)(bits & 0x3FF);
+        if (exponent)
+            head->real = (head->real + 1024.0) * (double)(1L << (exponent - 1));
+        head->real /= 16777216.0;
+        if (bits & 0x8000)
+            head->real = -head->real;
+    }
+
+    /* infinity and NaN aren't numbers in JSON */
+    if ((size == 2 && exponent == 0x1F) || head->real - head->real != 0.0) {
+        binary_error(error, head->position, json_error_numeric_overflow,
+                     "real number is infinite or NaN");
+        return -1;
+    }
+
+    head->kind = BINARY_REAL;
+    return 0;
+}
+
+static int binary_length(binary_head_t *head, int kind, uint64_t length,
+                         json_error_t *error) {
+    if (length > (size_t)-1) {
+        binary_error(error, head->position, json_error_premature_end_of_input,
+                     "unexpected end of input");
+        return -1;
+    }
+
+    head->kind = kind;
+    head->length = (size_t)length;
+    return 0;
+}
+
+/* Read the head of a CBOR data item (RFC 8949, section 3): three bits
+   of major type and five of additional information, followed by an
+   argument of up to 8 bytes. Tags are skipped. */
+static int cbor_head(lex_t *lex, binary_head_t *head, json_error_t *error) {
+    unsigned char byte;
+    int major, info;
+    uint64_t value;
+
+    do {
+        head->position = lex->stream.position;
+        if (binary_read(lex, &byte, NULL, 1, error))
+            return -1;
+
+        major = byte >> 5;
+        info = byte & 0x1F;
+        head->indefinite = info == 31;
+
+        if (info < 24)
+            value = (uint64_t)info;
+        else if (info <= 27) {
+            if (binary_uint(lex, (size_t)1 << (info - 24), &value, error))
+                return -1;
+        } else if (info == 31 && major != 0 && major != 1 && major != 6)
+            value = 0;
+        else {
+            binary_error(error, head->position, json_error_invalid_syntax,
+                         "invalid CBOR item 0x%02x", byte);
+            return -1;
+        }
+    } while (major == 6);
+
+    switch (major) {
+        case 0:
+        case 1:
+            return binary_integer(head, value, major == 1, error);
+        case 2:
+            binary_error(error, head->position, json_error_wrong_type,
+                         "byte strings are not supported");
+            return -1;
+        case 3:
+            return binary_length(head, BINARY_STRING, value, error);
+        case 4:
+            return binary_length(head, BINARY_ARRAY, value, error);
+        case 5:
+            return binary_length(head, BINARY_OBJECT, value, error);
+        default:
+            break;
+    }
+
+    /* major type 7: floats and simple values */
+    if (info >= 25 && info <= 27)
+        return binary_float(head, value, (size_t)1 << (info - 24), error);
+
+    if (info == 31)
+        head->kind = BINARY_BREAK;
+    else if (value == 20)
+        head->kind = BINARY_FALSE;
+    else if (value == 21)
+        head->kind = BINARY_TRUE;
+    else if (value == 22)
+        head->kind = BINARY_NULL;
+    else {
+        binary_error(error, head->position, json_error_wrong_type,
+                     "simple value %d is not supported", (int)value);
+        return -1;
+    }
+    return 0;
+}
+
+/* Read the head of a MessagePack value. The first byte is the format,
+   which of the fixed-size formats includes the value or length. */
+static int msgpack_head(lex_t *lex, binary_head_t *head, json_error_t *error) {
+    unsigned char byte;
+    uint64_t value;
+    size_t size;
+
+    head->position = lex->stream.position;
+    head->indefinite = 0;
+    if (binary_read(lex, &byte, NULL, 1, error))
+        return -1;
+
+    if (byte < 0x80)
+        return binary_integer(head, byte, 0, error);
+    if (byte >= 0xE0)
+        return binary_integer(head, 0xFF - byte, 1, error);
+    if (byte < 0x90)
+        return binary_length(head, BINARY_OBJECT, byte & 0x0F, error);
+    if (byte < 0xA0)
+        return binary_length(head, BINARY_ARRAY, byte & 0x0F, error);
+    if (byte < 0xC0)
+        return binary_length(head, BINARY_STRING, byte & 0x1F, error);
+
+    switch (byte) {
+        case 0xC0:
+            head->kind = BINARY_NULL;
+            return 0;
+        case 0xC2:
+            head->kind = BINARY_FALSE;
+            return 0;
+        case 0xC3:
+            head->kind = BINARY_TRUE;
+            return 0;
+        case 0xC4:
+        case 0xC5:
+        case 0xC6:
+            binary_error(error, head->position, json_error_wrong_type,
+                         "binary data is not supported");
+            return -1;
+        case 0xC1:
+            binary_error(error, head->position, json_error_invalid_syntax,
+                         "invalid MessagePack format 0xc1");
+            return -1;
+        default:
+            break;
+    }
+
+    if ((byte >= 0xC7 && byte <= 0xC9) || (byte >= 0xD4 && byte <= 0xD8)) {
+        binary_error(error, head->position, json_error_wrong_type,
+                     "extension types are not supported");
+        return -1;
+    }
+
+    /* the rest have a 1, 2, 4 or 8-byte value or length */
+    if (byte == 0xCA)
+        size = 4;
+    else if (byte == 0xCB)
+        size = 8;
+    else if (byte <= 0xD3)
+        size = (size_t)1 << ((byte - 0xCC) & 3);
+    else if (byte == 0xD9)
+        size = 1;
+    else
+        size = (size_t)2 << ((byte - 0xDA) & 1);
+    if (binary_uint(lex, size, &value, error))
+        return -1;
+
+    if (byte == 0xCA || byte == 0xCB)
+        return binary_float(head, value, size, error);
+    if (byte >= 0xCC && byte <= 0xCF)
+        return binary_integer(head, value, 0, error);
+    if (byte >= 0xD0 && byte <= 0xD3) {
+        /* two's complement of size bytes */
+        uint64_t mask = size == 8 ? ~(uint64_t)0 : ((uint64_t)1 << (8 * size)) - 1;
+        if (value >> (8 * size - 1))
+            return binary_integer(head, mask ^ value, 1, error);
+        return binary_integer(head, value, 0, error);
+    }
+    if (byte <= 0xDB)
+        return binary_length(head, BINARY_STRING, value, error);
+    if (byte <= 0xDD)
+        return binary_length(head, BINARY_ARRAY, value, error);
+    return binary_length(head, BINARY_OBJECT, value, error);
+}
+
+static int binary_head(lex_t *lex, binary_head_t *head, size_t flags,
+                       json_error_t *error) {
+    if (flags & JSON_DECODE_CBOR)
+        return cbor_head(lex, head, error);
+    return msgpack_head(lex, head, error);
+}
+
+/* Read the bytes of the string whose head was just read. They are
+   used straight from the input if it's all in memory, otherwise they
+   are gathered in text. Indefinite-length CBOR strings are made of
+   chunks that are definite-length strings. */
+static const char *binary_string(lex_t *lex, const binary_head_t *head, size_t flags,
+                                 strbuffer_t *text, size_t *len, json_error_t *error) {
+    stream_t *stream = &lex->stream;
+    binary_head_t chunk;
+
+    if (!head->indefinite && !stream->read) {
+        const char *str = stream->pos;
+
+        if ((size_t)(stream->end - str) < head->length) {
+            binary_error(error, stream->end - str + stream->position,
+                         json_error_premature_end_of_input, "unexpected end of input");
+            return NULL;
+        }
+        stream->pos += head->length;
+        stream->position += head->length;
+        *len = head->length;
+        return str;
+    }
+
+    strbuffer_clear(text);
+    if (!head->indefinite) {
+        if (binary_read(lex, NULL, text, head->length, error))
+            return NULL;
+    } else {
+        while (1) {
+            if (binary_head(lex, &chunk, flags, error))
+                return NULL;
+            if (chunk.kind == BINARY_BREAK)
+                break;
+            if (chunk.kind != BINARY_STRING || chunk.indefinite) {
+                binary_error(error, chunk.position, json_error_invalid_syntax,
+                             "invalid chunk of a string");
+                return NULL;
+            }
+            if (binary_read(lex, NULL, text, chunk.length, error))
+                return NULL;
+        }
+    }
+
+    *len = text->length;
+    return text->value;
+}
+
+/* Create the value of a head. Objects and arrays are created empty. */
+static json_t *binary_value(lex_t *lex, const binary_head_t *head, size_t flags,
+                            json_error_t *error) {
+    const char *str;
+    size_t len;
+    json_t *json;
+
+    switch (head->kind) {
+        case BINARY_NULL:
+            return json_null();
+        case BINARY_TRUE:
+            return json_true();
+        case BINARY_FALSE:
+            return json_false();
+        case BINARY_INTEGER:
+            if (flags & JSON_DECODE_INT_AS_REAL)
+                return json_real((double)head->integer);
+            return json_integer(head->integer);
+        case BINARY_REAL:
+            return json_real(head->real);
+        case BINARY_STRING:
+            break;
+        case BINARY_OBJECT:
+            json = json_object();
+            if (json && !head->indefinite && !lex->stream.read &&
+                head->length <= (size_t)(lex->stream.end - lex->stream.pos) / 2)
+                json_object_reserve(json, head->length);
+            return json;
+        case BINARY_ARRAY:
+            json = json_array();
+            if (json && !head->indefinite && !lex->stream.read &&
+                head->length <= (size_t)(lex->stream.end - lex->stream.pos))
+                json_array_reserve(json, head->length);
+            return json;
+        default:
+            binary_error(error, head->position, json_error_invalid_syntax,
+                         "unexpected break");
+            return NULL;
+    }
+
+    str = binary_string(lex, head, flags, &lex->saved_text, &len, error);
+    if (!str)
+        return NULL;
+
+    if (!utf8_check_string(str, len)) {
+        binary_error(error, head->position, json_error_invalid_utf8,
+                     "string is not valid UTF-8");
+        return NULL;
+    }
+    if (!(flags & JSON_ALLOW_NUL) && memchr(str, '\0', len)) {
+        binary_error(error, head->position, json_error_null_character,
+                     "NUL byte is not allowed without JSON_ALLOW_NUL");
+        return NULL;
+    }
+    return json_stringn_nocheck(str, len);
+}
+
+/* Read the key of the next member of object into key */
+static const char *binary_key(lex_t *lex, json_t *object, size_t flags, strbuffer_t *key,
+                              size_t *len, json_error_t *error) {
+    binary_head_t head;
+    const char *str;
+
+    if (binary_head(lex, &head, flags, error))
+        return NULL;
+
+    if (head.kind != BINARY_STRING) {
+        binary_error(error, head.position, json_error_wrong_type,
+                     "object key must be a string");
+        return NULL;
+    }
+
+    str = binary_string(lex, &head, flags, key, len, error);
+    if (!str)
+        return NULL;
+
+    if (!utf8_check_string(str, *len)) {
+        binary_error(error, head.position, json_error_invalid_utf8,
+                     "object key is not valid UTF-8");
+        return NULL;
+    }
+    if (memchr(str, '\0', *len)) {
+        binary_error(error, head.position, json_error_null_byte_in_key,
+                     "NUL byte in object key not supported");
+        return NULL;
+    }
+    if ((flags & JSON_REJECT_DUPLICATES) && json_object_getn(object, str, *len)) {
+        binary_error(error, head.position, json_error_duplicate_key,
+                     "duplicate object key");
+        return NULL;
+    }
+    return str;
+}
+
+/* Decode a binary value. Objects and arrays are added to their
+   container as soon as their head is read and filled in afterwards,
+   with the ones that are being filled kept on the frame stack like in
+   parse_value(). */
+static json_t *parse_binary(lex_t *lex, size_t flags, json_error_t *error) {
+    size_t base = lex->nframes;
+    json_t *root = NULL, *json;
+    binary_head_t head;
+    strbuffer_t key;
+    const char *key_text = NULL;
+    size_t key_len = 0;
+
+    if (strbuffer_init(&key))
+        return NULL;
+
+    if (binary_head(lex, &head, flags, error))
+        goto failed;
+
+    if (!(flags & JSON_DECODE_ANY) && head.kind != BINARY_ARRAY &&
+        head.kind != BINARY_OBJECT) {
+        binary_error(error, head.position, json_error_invalid_syntax,
+                     "array or object expected");
+        goto failed;
+    }
+
+    while (1) {
+        parse_frame_t *frame;
+
+        if (lex->nframes - base + 1 > lex->max_depth) {
+            binary_error(error, head.position, json_error_stack_overflow,
+                         "maximum parsing depth reached");
+            goto failed;
+        }
+
+        json = binary_value(lex, &head, flags, error);
+        if (!json)
+            goto failed;
+
+        if (lex->nframes == base)
+            root = json;
+        else {
+            frame = &lex->frames[lex->nframes - 1];
+            if (json_is_object(frame->container)) {
+                if (parse_add_member(lex, frame->container, key_text, key_len, json))
+                    goto failed;
+            } else if (json_array_append_new(frame->container, json))
+                goto failed;
+        }
+
+        if ((head.kind == BINARY_ARRAY || head.kind == BINARY_OBJECT) &&
+            (head.indefinite || head.length)) {
+            if (push_frame(lex, json))
+                goto failed;
+            lex->frames[lex->nframes - 1].remaining =
+                head.indefinite ? (size_t)-1 : head.length;
+        }
+
+        /* find the next member, closing the containers that are complete */
+        while (1) {
+            if (lex->nframes == base)
+                goto done;
+
+            frame = &lex->frames[lex->nframes - 1];
+            if (frame->remaining == 0) {
+                lex->nframes--;
+                continue;
+            }
+
+            if (json_is_object(frame->container)) {
+                /* the break of an indefinite-length map is where a key
+                   would be, a string is a key */
+                if (frame->remaining == (size_t)-1) {
+                    stream_t *stream = &lex->stream;
+                    if (stream->pos == stream->end && stream_refill(stream)) {
+                        binary_error(error, stream->position,
+                                     json_error_premature_end_of_input,
+                                     "unexpected end of input");
+                        goto failed;
+                    }
+                    if ((unsigned char)*stream->pos == 0xFF) {
+                        stream->pos++;
+                        stream->position++;
+                        lex->nframes--;
+                        continue;
+                    }
+                }
+
+                key_text =
+                    binary_key(lex, frame->container, flags, &key, &key_len, error);
+                if (!key_text)
+                    goto failed;
+            }
+
+            if (binary_head(lex, &head, flags, error))
+                goto failed;
+
+            if (head.kind == BINARY_BREAK && frame->remaining == (size_t)-1 &&
+                json_is_array(frame->container)) {
+                lex->nframes--;
+                continue;
+            }
+
+            if (frame->remaining != (size_t)-1)
+                frame->remaining--;
+            break;
+        }
+    }
+
+done:
+    strbuffer_close(&key);
+    return root;
+
+failed:
+    lex->nframes = base;
+    json_decref(root);
+    strbuffer_close(&key);
+    return NULL;
+}
+
+json_t *parse_binary_json(lex_t *lex, size_t flags, json_error_t *error) {
+    stream_t *stream = &lex->stream;
+    json_t *result;
+
+    if ((flags & BINARY_FLAGS) == BINARY_FLAGS) {
+        binary_error(error, 0, json_error_invalid_argument,
+                     "JSON_DECODE_CBOR and JSON_DECODE_MSGPACK can't be used together");
+        return NULL;
+    }
+
+    result = parse_binary(lex, flags, error);
+    if (!result)
+        return NULL;
+
+    if (!(flags & JSON_DISABLE_EOF_CHECK)) {
+        if (stream->pos != stream->end || !stream_refill(stream)) {
+            binary_error(error, stream->position, json_error_end_of_input_expected,
+                         "end of input expected");
+            json_decref(result);
+            return NULL;
+        }
+    }
+
+    if (error)
+        error->position = (int)stream->position;
+
+    return result;
+}
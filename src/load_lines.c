@@ -0,0 +1,534 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "jansson_private.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "jansson.h"
+#include "load.h"
+#include "thread.h"
+
+/* Called for each record with its position, line and column */
+typedef int (*record_func_t)(void *arg, json_t *record, size_t position, int line,
+                             int column);
+
+static void error_set_stopped(json_error_t *error, int line, int column,
+                              size_t position) {
+    jsonp_error_set(error, line, column, position, json_error_unknown, "%s",
+                    "stopped by callback");
+}
+
+/* Decode records, each on a line of its own, until the end of input.
+   The lexer and its buffers are reused for all of them. */
+static int parse_lines(lex_t *lex, size_t flags, record_func_t func, void *arg,
+                       json_error_t *error) {
+    json_t *record;
+    size_t position;
+    int c, line, column, last_line = 0, rv;
+
+    for (;;) {
+        /* Skip empty lines */
+        stream_skip_whitespace(&lex->stream);
+        do
+            c = lex_get(lex, error);
+        while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+        lex_unget(lex, c);
+
+        if (c == STREAM_STATE_EOF)
+            return 0;
+
+        if (lex->stream.line == last_line) {
+            lex_scan(lex, error);
+            error_set(error, lex, json_error_end_of_input_expected,
+                      "end of line expected");
+            return -1;
+        }
+
+        position = lex->stream.position;
+        line = lex->stream.line;
+        column = lex->stream.column;
+
+        lex->depth = 0;
+        lex_scan(lex, error);
+        record = parse_value(lex, flags, error);
+        if (!record)
+            return -1;
+
+        if (lex->stream.line != line) {
+            error_set(error, lex, json_error_invalid_syntax,
+                      "record spans more than one line");
+            json_decref(record);
+            return -1;
+        }
+        last_line = line;
+
+        rv = func(arg, record, position, line, column);
+        json_decref(record);
+        if (rv) {
+            error_set_stopped(error, line, column, position);
+            return -1;
+        }
+    }
+}
+
+struct lines_callback {
+    json_line_callback_t callback;
+    void *data;
+};
+
+static int call_line_callback(void *arg, json_t *record, size_t position, int line,
+                              int column) {
+    struct lines_callback *lines = arg;
+    (void)line;
+    (void)column;
+    return lines->callback(record, position, lines->data);
+}
+
+static int load_lines(const char *buffer, size_t buflen, read_func read, void *read_data,
+                      size_t flags, json_line_callback_t callback, void *data,
+                      json_error_t *error) {
+    struct lines_callback lines;
+    lex_t lex;
+    int rv;
+
+    if (lex_init(&lex, buffer, buflen, read, read_data, STREAM_BLOCK_SIZE, flags))
+        return -1;
+
+    lines.callback = callback;
+    lines.data = data;
+    rv = parse_lines(&lex, flags, call_line_callback, &lines, error);
+
+    if (!rv && error) {
+        /* Save the position even though there was no error */
+        error->position = (int)lex.stream.position;
+    }
+
+    lex_close(&lex);
+    return rv;
+}
+
+int json_loadb_lines(const char *buffer, size_t buflen, size_t flags,
+                     json_line_callback_t callback, void *data, json_error_t *error) {
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL || callback == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    return load_lines(buffer, buflen, NULL, NULL, flags, callback, data, error);
+}
+
+int json_loadf_lines(FILE *input, size_t flags, json_line_callback_t callback,
+                     void *data, json_error_t *error) {
+    jsonp_error_init(error, input == stdin ? "<stdin>" : "<stream>");
+
+    if (input == NULL || callback == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    return load_lines(NULL, 0, file_read, input, flags, callback, data, error);
+}
+
+int json_loadfd_lines(int input, size_t flags, json_line_callback_t callback,
+                      void *data, json_error_t *error) {
+    const char *source;
+
+#ifdef HAVE_UNISTD_H
+    if (input == STDIN_FILENO)
+        source = "<stdin>";
+    else
+#endif
+        source = "<stream>";
+
+    jsonp_error_init(error, source);
+
+    if (input < 0 || callback == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    return load_lines(NULL, 0, fd_read, &input, flags, callback, data, error);
+}
+
+int json_load_file_lines(const char *path, size_t flags, json_line_callback_t callback,
+                         void *data, json_error_t *error) {
+    file_map_t map;
+    FILE *fp;
+    int rv;
+
+    jsonp_error_init(error, path);
+
+    if (path == NULL || callback == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    if (!file_map(&map, path)) {
+        /* errors are reported as if the file was read by json_loadf_lines() */
+        jsonp_error_init(error, "<stream>");
+        rv = load_lines(map.data, map.size, NULL, NULL, flags, callback, data, error);
+        file_unmap(&map);
+        return rv;
+    }
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        error_set(error, NULL, json_error_cannot_open_file, "unable to open %s: %s", path,
+                  strerror(errno));
+        return -1;
+    }
+
+    rv = json_loadf_lines(fp, flags, callback, data, error);
+
+    fclose(fp);
+    return rv;
+}
+
+/* The parallel decoder splits its input to chunks of about this size,
+   ending at a newline, and each thread decodes one chunk at a time */
+#ifndef LINES_CHUNK_SIZE
+#define LINES_CHUNK_SIZE (1024 * 1024)
+#endif
+
+/* With ordered delivery, the number of chunks per thread that may be
+   decoded ahead of the one being delivered */
+#define LINES_WINDOW 4
+
+typedef struct {
+    json_t *record;
+    size_t position;
+    int line, column;
+} line_record_t;
+
+typedef struct {
+    size_t start; /* offset of the chunk in the input */
+    int done;     /* decoded, waiting to be delivered */
+    line_record_t *records;
+    size_t nrecords;
+    size_t capacity;
+} lines_chunk_t;
+
+typedef struct {
+    const char *buffer;
+    size_t buflen;
+    size_t flags;
+    json_line_callback_t callback;
+    void *data;
+
+    jsonp_mutex_t mutex;
+    jsonp_cond_t cond;
+    size_t next_start; /* offset of the next chunk to decode */
+    size_t next_index;
+    int stop;
+
+    /* ordered delivery */
+    lines_chunk_t *window;
+    size_t window_size;
+    size_t delivered; /* the number of chunks delivered */
+    int delivering;   /* a thread is delivering records */
+
+    /* the error that is earliest in the input */
+    int failed;
+    size_t error_start; /* offset of the chunk of the error */
+    size_t error_position;
+    json_error_t error;
+} lines_job_t;
+
+typedef struct {
+    lines_job_t *job;
+    lines_chunk_t *chunk;
+    size_t start;
+    int out_of_memory;
+} lines_worker_t;
+
+static int collect_record(void *arg, json_t *record, size_t position, int line,
+                          int column) {
+    lines_worker_t *worker = arg;
+    lines_chunk_t *chunk = worker->chunk;
+    line_record_t *entry;
+
+    if (chunk->nrecords == chunk->capacity) {
+        size_t new_capacity = chunk->capacity ? 2 * chunk->capacity : 64;
+        line_record_t *new_records = jsonp_malloc(new_capacity * sizeof(line_record_t));
+        if (!new_records) {
+            worker->out_of_memory = 1;
+            return -1;
+        }
+
+        if (chunk->nrecords)
+            memcpy(new_records, chunk->records, chunk->nrecords * sizeof(line_record_t));
+        jsonp_free(chunk->records);
+        chunk->records = new_records;
+        chunk->capacity = new_capacity;
+    }
+
+    entry = &chunk->records[chunk->nrecords++];
+    entry->record = json_incref(record);
+    entry->position = position;
+    entry->line = line;
+    entry->column = column;
+    return 0;
+}
+
+static int deliver_record(void *arg, json_t *record, size_t position, int line,
+                          int column) {
+    lines_worker_t *worker = arg;
+    (void)line;
+    (void)column;
+    return worker->job->callback(record, worker->start + position, worker->job->data);
+}
+
+/* Keep the error if it's earlier in the input than the one found so
+   far. Called with the mutex held. */
+static void lines_job_fail(lines_job_t *job, size_t start, const json_error_t *error) {
+    size_t position = start + (size_t)error->position;
+
+    if (!job->failed || position < job->error_position) {
+        job->failed = 1;
+        job->error_start = start;
+        job->error_position = position;
+        job->error = *error;
+    }
+    job->stop = 1;
+    jsonp_cond_broadcast(&job->cond);
+}
+
+static void free_chunk_records(lines_chunk_t *chunk) {
+    size_t i;
+
+    for (i = 0; i < chunk->nrecords; i++)
+        json_decref(chunk->records[i].record);
+    chunk->nrecords = 0;
+}
+
+/* Pass the decoded chunks to the callback in order, as long as the
+   next one is ready. Called with the mutex held, which is released
+   while the callback runs. */
+static void deliver_chunks(lines_job_t *job) {
+    json_error_t error;
+    lines_chunk_t *chunk;
+    size_t i;
+    int rv;
+
+    while (!job->delivering) {
+        chunk = &job->window[job->delivered % job->window_size];
+        if (!chunk->done)
+            break;
+
+        /* All chunks before this one have been decoded, so an error
+           that comes before it is already known. Nothing after the
+           error is delivered. */
+        rv = 0;
+        if (!job->failed || chunk->start <= job->error_start) {
+            job->delivering = 1;
+            jsonp_mutex_unlock(&job->mutex);
+
+            for (i = 0; i < chunk->nrecords && !rv; i++) {
+                line_record_t *entry = &chunk->records[i];
+                rv = job->callback(entry->record, chunk->start + entry->position,
+                                   job->data);
+                if (rv) {
+                    jsonp_error_init(&error, "<buffer>");
+                    error_set_stopped(&error, entry->line, entry->column,
+                                      entry->position);
+                }
+            }
+            free_chunk_records(chunk);
+
+            jsonp_mutex_lock(&job->mutex);
+            job->delivering = 0;
+        } else
+            free_chunk_records(chunk);
+
+        if (rv)
+            lines_job_fail(job, chunk->start, &error);
+        chunk->done = 0;
+        job->delivered++;
+        jsonp_cond_broadcast(&job->cond);
+    }
+}
+
+static void decode_chunk(lines_job_t *job, lines_chunk_t *chunk, size_t start,
+                         size_t end) {
+    lines_worker_t worker;
+    json_error_t error;
+    lex_t lex;
+    int rv = -1;
+
+    jsonp_error_init(&error, "<buffer>");
+    worker.job = job;
+    worker.chunk = chunk;
+    worker.start = start;
+    worker.out_of_memory = 0;
+
+    if (!lex_init(&lex, job->buffer + start, end - start, NULL, NULL, 0, job->flags)) {
+        rv = parse_lines(&lex, job->flags, chunk ? collect_record : deliver_record,
+                         &worker, &error);
+        lex_close(&lex);
+    } else
+        worker.out_of_memory = 1;
+
+    if (worker.out_of_memory) {
+        jsonp_error_init(&error, "<buffer>");
+        error_set(&error, NULL, json_error_out_of_memory, "Out of memory");
+    }
+
+    jsonp_mutex_lock(&job->mutex);
+    if (rv)
+        lines_job_fail(job, start, &error);
+    if (chunk) {
+        chunk->done = 1;
+        deliver_chunks(job);
+    }
+}
+
+static void lines_worker_main(void *arg) {
+    lines_job_t *job = arg;
+    lines_chunk_t *chunk = NULL;
+    size_t start, end, index;
+    const char *newline;
+
+    jsonp_mutex_lock(&job->mutex);
+    while (!job->stop && job->next_start < job->buflen) {
+        if (job->window) {
+            if (job->next_index >= job->delivered + job->window_size) {
+                /* Wait until the oldest chunk has been delivered */
+                jsonp_cond_wait(&job->cond, &job->mutex);
+                continue;
+            }
+        }
+
+        start = job->next_start;
+        end = job->buflen;
+        if (end - start > LINES_CHUNK_SIZE) {
+            newline = memchr(job->buffer + start + LINES_CHUNK_SIZE, '\n',
+                             end - start - LINES_CHUNK_SIZE);
+            if (newline)
+                end = newline - job->buffer + 1;
+        }
+        index = job->next_index++;
+        job->next_start = end;
+
+        if (job->window) {
+            chunk = &job->window[index % job->window_size];
+            chunk->start = start;
+        }
+        jsonp_mutex_unlock(&job->mutex);
+
+        /* decode_chunk() returns with the mutex held */
+        decode_chunk(job, chunk, start, end);
+    }
+
+    jsonp_cond_broadcast(&job->cond);
+    jsonp_mutex_unlock(&job->mutex);
+}
+
+static int count_lines(const char *buffer, size_t len) {
+    const char *end = buffer + len;
+    int lines = 0;
+
+    while ((buffer = memchr(buffer, '\n', end - buffer)) != NULL) {
+        buffer++;
+        lines++;
+    }
+    return lines;
+}
+
+int json_loadb_lines_parallel(const char *buffer, size_t buflen, size_t flags,
+                              size_t nthreads, json_line_callback_t callback,
+                              void *data, json_error_t *error) {
+    lines_job_t job;
+    size_t i;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL || callback == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    if (nthreads == 0)
+        nthreads = jsonp_cpu_count();
+    if (nthreads == 1 || buflen <= LINES_CHUNK_SIZE || !JSONP_HAVE_THREADS)
+        return load_lines(buffer, buflen, NULL, NULL, flags, callback, data, error);
+
+    job.buffer = buffer;
+    job.buflen = buflen;
+    job.flags = flags;
+    job.callback = callback;
+    job.data = data;
+    job.next_start = 0;
+    job.next_index = 0;
+    job.stop = 0;
+    job.window = NULL;
+    job.window_size = 0;
+    job.delivered = 0;
+    job.delivering = 0;
+    job.failed = 0;
+
+    if (!(flags & JSON_LINES_UNORDERED)) {
+        job.window_size = nthreads * LINES_WINDOW;
+        job.window = jsonp_malloc(job.window_size * sizeof(lines_chunk_t));
+        if (!job.window) {
+            error_set(error, NULL, json_error_out_of_memory, "Out of memory");
+            return -1;
+        }
+        for (i = 0; i < job.window_size; i++) {
+            job.window[i].done = 0;
+            job.window[i].records = NULL;
+            job.window[i].nrecords = 0;
+            job.window[i].capacity = 0;
+        }
+    }
+
+    if (jsonp_mutex_init(&job.mutex)) {
+        jsonp_free(job.window);
+        error_set(error, NULL, json_error_out_of_memory, "Out of memory");
+        return -1;
+    }
+    if (jsonp_cond_init(&job.cond)) {
+        jsonp_mutex_destroy(&job.mutex);
+        jsonp_free(job.window);
+        error_set(error, NULL, json_error_out_of_memory, "Out of memory");
+        return -1;
+    }
+
+    jsonp_run_threads(nthreads, lines_worker_main, &job);
+
+    jsonp_cond_destroy(&job.cond);
+    jsonp_mutex_destroy(&job.mutex);
+    if (job.window) {
+        /* Chunks after an error were not delivered */
+        for (i = 0; i < job.window_size; i++) {
+            free_chunk_records(&job.window[i]);
+            jsonp_free(job.window[i].records);
+        }
+        jsonp_free(job.window);
+    }
+
+    if (job.failed) {
+        if (error) {
+            *error = job.error;
+            if (error->line > 0)
+                error->line += count_lines(buffer, job.error_start);
+            error->position = (int)job.error_position;
+        }
+        return -1;
+    }
+
+    if (error)
+        error->position = (int)buflen;
+    return 0;
+}
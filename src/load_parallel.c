@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <string.h>
+
+#include "jansson.h"
+#include "jansson_private.h"
+#include "load.h"
+#include "thread.h"
+
+/* The members of the top level array or object are split to spans of
+   about this size, and each thread decodes one span at a time into a
+   container of its own. The containers are merged in order. */
+#ifndef SPLIT_CHUNK_SIZE
+#define SPLIT_CHUNK_SIZE (1024 * 1024)
+#endif
+
+typedef struct {
+    size_t start;
+    size_t end;
+} split_span_t;
+
+typedef struct {
+    const char *buffer;
+    size_t flags;
+    int object;
+    const split_span_t *spans;
+    json_t **parts;
+    size_t nparts;
+
+    jsonp_mutex_t mutex;
+    size_t next; /* the next span to decode */
+    int failed;
+} split_job_t;
+
+static int push_span(split_span_t **spans, size_t *nspans, size_t *capacity,
+                     size_t start, size_t end) {
+    if (*nspans == *capacity) {
+        size_t new_capacity = *capacity ? 2 * *capacity : 64;
+        split_span_t *new_spans = jsonp_malloc(new_capacity * sizeof(split_span_t));
+        if (!new_spans)
+            return -1;
+
+        if (*nspans)
+            memcpy(new_spans, *spans, *nspans * sizeof(split_span_t));
+        jsonp_free(*spans);
+        *spans = new_spans;
+        *capacity = new_capacity;
+    }
+
+    (*spans)[*nspans].start = start;
+    (*spans)[*nspans].end = end;
+    (*nspans)++;
+    return 0;
+}
+
+#define is_json_space(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+
+/* Split the members of the top level container of buffer at the
+   commas between them. Like lex_skip_container(), this only checks
+   that brackets match and strings end. Returns the number of spans,
+   or 0 if there's only one or the input doesn't look valid, in which
+   case it's decoded as a whole to get the result or the error. */
+static size_t split_members(const char *buffer, size_t buflen, size_t flags,
+                            split_span_t **spans, int *object, size_t *root_end) {
+    const char *p = buffer, *end = buffer + buflen, *span_start;
+    char closing[JSON_PARSER_MAX_DEPTH];
+    size_t open = 0, nspans = 0, capacity = 0;
+
+    *spans = NULL;
+    while (p < end && is_json_space(*p))
+        p++;
+    if (p == end || (*p != '[' && *p != '{'))
+        return 0;
+
+    *object = *p == '{';
+    closing[open++] = *p == '{' ? '}' : ']';
+    span_start = ++p;
+
+    while (p < end && open) {
+        switch (*p++) {
+            case '"':
+                /* the quote ends the string unless it's escaped */
+                while (1) {
+                    const char *q = memchr(p, '"', end - p), *b;
+                    if (!q)
+                        goto invalid;
+                    for (b = q; b > p && b[-1] == '\\'; b--)
+                        ;
+                    p = q + 1;
+                    if ((q - b) % 2 == 0)
+                        break;
+                }
+                break;
+
+            case '{':
+            case '[':
+                if (open == JSON_PARSER_MAX_DEPTH)
+                    goto invalid;
+                closing[open++] = p[-1] == '{' ? '}' : ']';
+                break;
+
+            case '}':
+            case ']':
+                if (p[-1] != closing[--open])
+                    goto invalid;
+                break;
+
+            case ',':
+                if (open == 1 && (size_t)(p - span_start) > SPLIT_CHUNK_SIZE) {
+                    if (push_span(spans, &nspans, &capacity, span_start - buffer,
+                                  p - 1 - buffer))
+                        goto invalid;
+                    span_start = p;
+                }
+                break;
+        }
+    }
+
+    if (open || push_span(spans, &nspans, &capacity, span_start - buffer,
+                          p - 1 - buffer))
+        goto invalid;
+    *root_end = p - buffer;
+
+    if (!(flags & JSON_DISABLE_EOF_CHECK)) {
+        while (p < end && is_json_space(*p))
+            p++;
+        if (p != end)
+            goto invalid;
+    }
+
+    if (nspans > 1)
+        return nspans;
+
+invalid:
+    jsonp_free(*spans);
+    *spans = NULL;
+    return 0;
+}
+
+/* Parse the members in a span of the top level container, which are
+   like its text without the brackets */
+static int parse_span(lex_t *lex, json_t *container, size_t flags, json_error_t *error) {
+    lex->depth = 1;
+    lex_scan(lex, error);
+
+    while (1) {
+        json_t *value;
+
+        if (json_is_object(container)) {
+            char *key;
+            size_t len;
+
+            if (lex->token != TOKEN_STRING)
+                return -1;
+
+            key = parse_object_key(lex, container, flags, &len, error);
+            if (!key)
+                return -1;
+
+            lex_scan(lex, error);
+            if (lex->token != ':') {
+                lex_release_string(lex, key);
+                return -1;
+            }
+
+            lex_scan(lex, error);
+            value = parse_value(lex, flags, error);
+            if (!value || json_object_setn_new_nocheck(container, key, len, value)) {
+                lex_release_string(lex, key);
+                return -1;
+            }
+            lex_release_string(lex, key);
+        } else {
+            value = parse_value(lex, flags, error);
+            if (!value || json_array_append_new(container, value))
+                return -1;
+        }
+
+        lex_scan(lex, error);
+        if (lex->token != ',')
+            break;
+
+        lex_scan(lex, error);
+    }
+
+    return lex->token == TOKEN_EOF ? 0 : -1;
+}
+
+static void split_worker_main(void *arg) {
+    split_job_t *job = arg;
+    json_error_t error;
+    json_t *part;
+    size_t index;
+    lex_t lex;
+    int rv;
+
+    while (1) {
+        jsonp_mutex_lock(&job->mutex);
+        if (job->failed || job->next == job->nparts) {
+            jsonp_mutex_unlock(&job->mutex);
+            return;
+        }
+        index = job->next++;
+        jsonp_mutex_unlock(&job->mutex);
+
+        rv = -1;
+        part = job->object ? json_object() : json_array();
+        if (part && !lex_init(&lex, job->buffer + job->spans[index].start,
+                              job->spans[index].end - job->spans[index].start, NULL,
+                              NULL, 0, job->flags)) {
+            rv = parse_span(&lex, part, job->flags, &error);
+            lex_close(&lex);
+        }
+
+        if (rv) {
+            json_decref(part);
+            jsonp_mutex_lock(&job->mutex);
+            job->failed = 1;
+            jsonp_mutex_unlock(&job->mutex);
+            return;
+        }
+        job->parts[index] = part;
+    }
+}
+
+/* Merge the decoded spans in order into one container */
+static json_t *merge_parts(json_t **parts, size_t nparts, int object, size_t flags) {
+    json_t *result;
+    size_t i, total = 0;
+
+    for (i = 0; i < nparts; i++)
+        total += object ? json_object_size(parts[i]) : json_array_size(parts[i]);
+
+    result = object ? json_object_with_capacity(total) : json_array_with_capacity(total);
+    if (!result)
+        return NULL;
+
+    for (i = 0; i < nparts; i++) {
+        if (object) {
+            const char *key;
+            size_t key_len;
+            json_t *value;
+
+            /* a duplicate key keeps its first position, like with
+               json_object_set() */
+            json_object_keylen_foreach(parts[i], key, key_len, value) {
+                if (((flags & JSON_REJECT_DUPLICATES) &&
+                     json_object_getn(result, key, key_len)) ||
+                    json_object_setn_new_nocheck(result, key, key_len,
+                                                 json_incref(value))) {
+                    json_decref(result);
+                    return NULL;
+                }
+            }
+        } else {
+            /* move the elements */
+            json_array_t *array = json_to_array(result), *part = json_to_array(parts[i]);
+
+            memcpy(array->table + array->entries, part->table,
+                   part->entries * sizeof(json_t *));
+            array->entries += part->entries;
+            part->entries = 0;
+        }
+    }
+
+    return result;
+}
+
+json_t *json_loadb_parallel(const char *buffer, size_t buflen, size_t flags,
+                            size_t nthreads, json_error_t *error) {
+    split_job_t job;
+    split_span_t *spans;
+    json_t *result = NULL;
+    size_t i, nspans, root_end;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (nthreads == 0)
+        nthreads = jsonp_cpu_count();
+    if (nthreads == 1 || buflen <= SPLIT_CHUNK_SIZE || !JSONP_HAVE_THREADS ||
+        (flags & BINARY_FLAGS))
+        return json_loadb(buffer, buflen, flags, error);
+
+    nspans = split_members(buffer, buflen, flags, &spans, &job.object, &root_end);
+    if (!nspans)
+        return json_loadb(buffer, buflen, flags, error);
+
+    job.buffer = buffer;
+    job.flags = flags;
+    job.spans = spans;
+    job.nparts = nspans;
+    job.next = 0;
+    job.failed = 0;
+    job.parts = jsonp_malloc(nspans * sizeof(json_t *));
+    if (!job.parts || jsonp_mutex_init(&job.mutex)) {
+        jsonp_free(job.parts);
+        jsonp_free(spans);
+        error_set(error, NULL, json_error_out_of_memory, "Out of memory");
+        return NULL;
+    }
+    for (i = 0; i < nspans; i++)
+        job.parts[i] = NULL;
+
+    jsonp_run_threads(nthreads < nspans ? nthreads : nspans, split_worker_main, &job);
+    jsonp_mutex_destroy(&job.mutex);
+
+    if (!job.failed)
+        result = merge_parts(job.parts, nspans, job.object, flags);
+
+    for (i = 0; i < nspans; i++)
+        json_decref(job.parts[i]);
+    jsonp_free(job.parts);
+    jsonp_free(spans);
+
+    /* Errors are rare, so instead of translating the position of an
+       error in a span, the whole input is decoded again to get the
+       same error as json_loadb() */
+    if (!result)
+        return json_loadb(buffer, buflen, flags, error);
+
+    if (error) {
+        /* Save the position even though there was no error */
+        error->position = (int)(flags & JSON_DISABLE_EOF_CHECK ? root_end : buflen);
+    }
+    return result;
+}
@@ -12,6 +12,10 @@
 #include "jansson.h"
 #include "jansson_private.h"
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 /* C89 allows these to be macros */
 #undef malloc
 #undef free
@@ -20,17 +24,520 @@
 static json_malloc_t do_malloc = malloc;
 static json_free_t do_free = free;
 
-void *jsonp_malloc(size_t size) {
+/*** arenas ***/
+
+struct arena_block {
+    struct arena_block *next;
+};
+
+struct json_arena {
+    struct arena_block *blocks;
+    struct arena_block *current; /* the block that pos and end point to */
+    char *pos, *end;
+    size_t next_size;
+};
+
+/* All values are aligned to this */
+typedef union {
+    void *pointer;
+    double real;
+    json_int_t integer;
+    size_t size;
+} arena_align_t;
+
+#define ARENA_ALIGN        sizeof(arena_align_t)
+#define ARENA_ROUND(size)  (((size) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+#define ARENA_HEADER       ARENA_ROUND(sizeof(struct arena_block))
+#define ARENA_FIRST_BLOCK  4096
+#define ARENA_MAX_BLOCK    (1024 * 1024)
+#define block_data(block_) ((char *)(block_) + ARENA_HEADER)
+
+#ifdef JSON_THREAD_LOCAL
+/* The arena that the current thread is loading into, and its memory
+   budget, see below */
+static JSON_THREAD_LOCAL json_arena_t *current_arena = NULL;
+static JSON_THREAD_LOCAL jsonp_budget_t *current_budget = NULL;
+
+#if JSON_HAVE_ATOMIC_BUILTINS || JSON_HAVE_SYNC_BUILTINS
+/* The number of threads that are loading into an arena or have a
+   budget. While it's zero, which is the common case, the thread-local
+   variables don't have to be looked at. */
+static volatile int arena_threads = 0;
+
+#if JSON_HAVE_ATOMIC_BUILTINS
+#define arena_threads_inc() __atomic_add_fetch(&arena_threads, 1, __ATOMIC_ACQUIRE)
+#define arena_threads_dec() __atomic_sub_fetch(&arena_threads, 1, __ATOMIC_RELEASE)
+#define arena_threads_get() __atomic_load_n(&arena_threads, __ATOMIC_RELAXED)
+#else
+#define arena_threads_inc() __sync_add_and_fetch(&arena_threads, 1)
+#define arena_threads_dec() __sync_sub_and_fetch(&arena_threads, 1)
+#define arena_threads_get() (arena_threads)
+#endif
+
+#define in_arena()  (arena_threads_get() && current_arena)
+#define in_budget() (arena_threads_get() && current_budget)
+#else
+#define arena_threads_inc()
+#define arena_threads_dec()
+#define in_arena()  (current_arena != NULL)
+#define in_budget() (current_budget != NULL)
+#endif
+
+int jsonp_arena_enter(json_arena_t *arena) {
+    arena_threads_inc();
+    current_arena = arena;
+    return 0;
+}
+
+void jsonp_arena_leave(void) {
+    current_arena = NULL;
+    arena_threads_dec();
+}
+
+int jsonp_in_arena(void) { return in_arena(); }
+
+int jsonp_budget_enter(jsonp_budget_t *budget) {
+    arena_threads_inc();
+    current_budget = budget;
+    return 0;
+}
+
+void jsonp_budget_leave(void) {
+    current_budget = NULL;
+    arena_threads_dec();
+}
+
+#else /* JSON_THREAD_LOCAL */
+
+/* Arenas and budgets can't be used without thread-local storage */
+#define current_arena  NULL
+#define in_arena()     0
+#define current_budget ((jsonp_budget_t *)NULL)
+#define in_budget()    0
+
+int jsonp_arena_enter(json_arena_t *arena) {
+    (void)arena;
+    return -1;
+}
+
+void jsonp_arena_leave(void) {}
+
+int jsonp_in_arena(void) { return 0; }
+
+int jsonp_budget_enter(jsonp_budget_t *budget) {
+    (void)budget;
+    return -1;
+}
+
+void jsonp_budget_leave(void) {}
+
+#endif /* JSON_THREAD_LOCAL */
+
+/* Take size bytes from the budget of the current thread, or return -1
+   if it doesn't have that much left */
+static int budget_charge(size_t size) {
+    if (size > current_budget->remaining) {
+        current_budget->exceeded = 1;
+        return -1;
+    }
+    current_budget->remaining -= size;
+    return 0;
+}
+
+static void *arena_alloc(json_arena_t *arena, size_t size) {
+    struct arena_block *block;
+    size_t block_size;
+
+    if (size > (size_t)-1 - ARENA_HEADER - ARENA_ALIGN)
+        return NULL;
+    size = ARENA_ROUND(size);
+
+    if (size <= (size_t)(arena->end - arena->pos)) {
+        void *ptr = arena->pos;
+        arena->pos += size;
+        return ptr;
+    }
+
+    if (size > arena->next_size / 4) {
+        /* Give large allocations a block of their own, so that the
+           rest of the current block isn't wasted */
+        block = (*do_malloc)(ARENA_HEADER + size);
+        if (!block)
+            return NULL;
+
+        if (arena->blocks) {
+            block->next = arena->blocks->next;
+            arena->blocks->next = block;
+        } else {
+            block->next = NULL;
+            arena->blocks = block;
+        }
+        return block_data(block);
+    }
+
+    block_size = arena->next_size;
+    block = (*do_malloc)(ARENA_HEADER + block_size);
+    if (!block)
+        return NULL;
+
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->current = block;
+    arena->pos = block_data(block) + size;
+    arena->end = block_data(block) + block_size;
+
+    if (arena->next_size < ARENA_MAX_BLOCK)
+        arena->next_size *= 2;
+
+    return block_data(block);
+}
+
+json_arena_t *json_arena_new(void) {
+    json_arena_t *arena = jsonp_malloc(sizeof(json_arena_t));
+    if (!arena)
+        return NULL;
+
+    arena->blocks = arena->current = NULL;
+    arena->pos = arena->end = NULL;
+    arena->next_size = ARENA_FIRST_BLOCK;
+    return arena;
+}
+
+static void arena_free_blocks(json_arena_t *arena, struct arena_block *keep) {
+    struct arena_block *block, *next;
+
+    for (block = arena->blocks; block; block = next) {
+        next = block->next;
+        if (block != keep)
+            (*do_free)(block);
+    }
+}
+
+void json_arena_reset(json_arena_t *arena) {
+    if (!arena)
+        return;
+
+    /* Keep the newest block, which is also the largest one */
+    arena_free_blocks(arena, arena->current);
+    arena->blocks = arena->current;
+
+    if (arena->current) {
+        arena->current->next = NULL;
+        arena->pos = block_data(arena->current);
+    }
+}
+
+void json_arena_free(json_arena_t *arena) {
+    if (!arena)
+        return;
+
+    arena_free_blocks(arena, NULL);
+    jsonp_free(arena);
+}
+
+/*** pools ***/
+
+/* If pools are enabled, values of the fixed-size types are allocated
+   from size-class pools. Each thread keeps free chunks of every class
+   in a cache of its own and exchanges them with a shared depot in
+   batches, so most allocations and frees don't touch any lock. The
+   chunks are allocated in slabs, which are never released. When a
+   thread exits, its cache is handed to the depot. Without pthreads,
+   the caches of threads that exit are left unused. */
+
+#define POOL_GRANULE       16
+#define POOL_CLASSES       8 /* chunks of 16, 32, ..., 128 bytes */
+#define POOL_BATCH         32
+#define POOL_SLAB_BATCHES  8
+#define pool_class(size_)  (((size_) + POOL_GRANULE - 1) / POOL_GRANULE - 1)
+#define pool_chunk(class_) (((class_) + 1) * POOL_GRANULE)
+
+/* Free chunks are linked through their first word. In the depot, the
+   first chunk of each batch links to the next batch with its second
+   word. */
+struct pool_chunk {
+    struct pool_chunk *next;
+    struct pool_chunk *next_batch;
+};
+
+struct pool_slab {
+    struct pool_slab *next;
+};
+
+struct pool_depot {
+    volatile char lock;
+    struct pool_chunk *batches;
+    struct pool_slab *slabs;
+    struct pool_chunk *partial; /* a batch being filled by exiting threads */
+    size_t partial_count;
+};
+
+struct pool_cache {
+    struct pool_chunk *head;
+    size_t count;
+};
+
+#if defined(JSON_THREAD_LOCAL) && (JSON_HAVE_ATOMIC_BUILTINS || JSON_HAVE_SYNC_BUILTINS)
+
+#if JSON_HAVE_ATOMIC_BUILTINS
+#define pool_lock(depot_)                                                                \
+    while (__atomic_test_and_set(&(depot_)->lock, __ATOMIC_ACQUIRE))
+#define pool_unlock(depot_) __atomic_clear(&(depot_)->lock, __ATOMIC_RELEASE)
+#else
+#define pool_lock(depot_)   while (__sync_lock_test_and_set(&(depot_)->lock, 1))
+#define pool_unlock(depot_) __sync_lock_release(&(depot_)->lock)
+#endif
+
+static int pools_enabled = 0;
+static struct pool_depot pool_depots[POOL_CLASSES];
+static JSON_THREAD_LOCAL struct pool_cache pool_caches[POOL_CLASSES];
+
+#ifdef HAVE_PTHREAD
+static JSON_THREAD_LOCAL int pool_thread_registered = 0;
+static pthread_key_t pool_exit_key;
+static pthread_once_t pool_exit_key_once = PTHREAD_ONCE_INIT;
+static int have_pool_exit_key = 0;
+
+/* Called when a thread that has cached chunks exits. The chunks are
+   put in whole batches in the depot, and the rest of them in its
+   partial batch, which becomes a whole one when it's full. */
+static void pool_release_caches(void *caches) {
+    struct pool_cache *cache;
+    struct pool_depot *depot;
+    struct pool_chunk *chunk;
+    size_t i;
+
+    for (i = 0; i < POOL_CLASSES; i++) {
+        cache = &((struct pool_cache *)caches)[i];
+        depot = &pool_depots[i];
+
+        pool_lock(depot);
+        while (cache->head) {
+            chunk = cache->head;
+            cache->head = chunk->next;
+
+            chunk->next = depot->partial;
+            depot->partial = chunk;
+            if (++depot->partial_count == POOL_BATCH) {
+                chunk->next_batch = depot->batches;
+                depot->batches = chunk;
+                depot->partial = NULL;
+                depot->partial_count = 0;
+            }
+        }
+        pool_unlock(depot);
+        cache->count = 0;
+    }
+
+    /* a destructor that runs after this one may free values again */
+    pool_thread_registered = 0;
+}
+
+static void pool_create_exit_key(void) {
+    have_pool_exit_key = !pthread_key_create(&pool_exit_key, pool_release_caches);
+}
+
+/* Called when the cache of the current thread gets its first chunks */
+static void pool_register_thread(void) {
+    pool_thread_registered = 1;
+    pthread_once(&pool_exit_key_once, pool_create_exit_key);
+    if (have_pool_exit_key)
+        pthread_setspecific(pool_exit_key, pool_caches);
+}
+
+#define pool_check_thread()                                                              \
+    do {                                                                                 \
+        if (!pool_thread_registered)                                                     \
+            pool_register_thread();                                                      \
+    } while (0)
+#else
+#define pool_check_thread() ((void)0)
+#endif
+
+/* Allocate a slab and split it into batches. The first batch is
+   returned, the others are handed to the depot. */
+static struct pool_chunk *pool_new_slab(struct pool_depot *depot, size_t chunk) {
+    struct pool_slab *slab;
+    struct pool_chunk *batch, *first = NULL, *last = NULL;
+    char *pos;
+    size_t i, j;
+
+    slab = (*do_malloc)(ARENA_HEADER + chunk * POOL_BATCH * POOL_SLAB_BATCHES);
+    if (!slab)
+        return NULL;
+
+    pos = (char *)slab + ARENA_HEADER;
+    for (i = 0; i < POOL_SLAB_BATCHES; i++) {
+        batch = (struct pool_chunk *)pos;
+        for (j = 0; j < POOL_BATCH - 1; j++, pos += chunk)
+            ((struct pool_chunk *)pos)->next = (struct pool_chunk *)(pos + chunk);
+        ((struct pool_chunk *)pos)->next = NULL;
+        pos += chunk;
+
+        if (i == 0)
+            continue;
+        batch->next_batch = NULL;
+        if (last)
+            last->next_batch = batch;
+        else
+            first = batch;
+        last = batch;
+    }
+
+    pool_lock(depot);
+    slab->next = depot->slabs;
+    depot->slabs = slab;
+    if (last) {
+        last->next_batch = depot->batches;
+        depot->batches = first;
+    }
+    pool_unlock(depot);
+
+    return (struct pool_chunk *)((char *)slab + ARENA_HEADER);
+}
+
+static void *pool_alloc(size_t class_) {
+    struct pool_cache *cache = &pool_caches[class_];
+    struct pool_depot *depot;
+    struct pool_chunk *chunk;
+
+    if (!cache->head) {
+        depot = &pool_depots[class_];
+
+        pool_lock(depot);
+        chunk = depot->batches;
+        if (chunk)
+            depot->batches = chunk->next_batch;
+        pool_unlock(depot);
+
+        if (!chunk) {
+            chunk = pool_new_slab(depot, pool_chunk(class_));
+            if (!chunk)
+                return NULL;
+        }
+
+        cache->head = chunk;
+        cache->count = POOL_BATCH;
+        pool_check_thread();
+    }
+
+    chunk = cache->head;
+    cache->head = chunk->next;
+    cache->count--;
+    return chunk;
+}
+
+static void pool_free(void *ptr, size_t class_) {
+    struct pool_cache *cache = &pool_caches[class_];
+    struct pool_depot *depot;
+    struct pool_chunk *chunk = ptr, *batch;
+    size_t i;
+
+    if (!cache->head)
+        pool_check_thread();
+
+    chunk->next = cache->head;
+    cache->head = chunk;
+    cache->count++;
+
+    if (cache->count < 2 * POOL_BATCH)
+        return;
+
+    /* Hand a batch over to the depot, keeping the most recently freed
+       chunks */
+    for (i = 1; i < POOL_BATCH; i++)
+        chunk = chunk->next;
+    batch = chunk->next;
+    chunk->next = NULL;
+    cache->count = POOL_BATCH;
+
+    depot = &pool_depots[class_];
+    pool_lock(depot);
+    batch->next_batch = depot->batches;
+    depot->batches = batch;
+    pool_unlock(depot);
+}
+
+int json_set_alloc_pools(int enable) {
+    pools_enabled = enable;
+    return 0;
+}
+
+#define use_pool(size_) (pools_enabled && pool_class(size_) < POOL_CLASSES)
+
+#else
+
+/* Pools need thread-local storage and atomic operations */
+int json_set_alloc_pools(int enable) { return enable ? -1 : 0; }
+
+#define use_pool(size_)         ((void)(size_), 0)
+#define pool_alloc(class_)      NULL
+#define pool_free(ptr_, class_) ((void)0)
+
+#endif
+
+void *jsonp_malloc_node(size_t size) {
+    jsonp_stats_alloc(json_stats_nodes, size);
+
+    if (use_pool(size) && !in_arena()) {
+        if (in_budget() && budget_charge(size))
+            return NULL;
+        return pool_alloc(pool_class(size));
+    }
+
+    return jsonp_malloc(size);
+}
+
+void jsonp_free_node(void *ptr, size_t size) {
+    if (!ptr)
+        return;
+
+    if (use_pool(size) && !in_arena()) {
+        jsonp_stats_add(frees, 1);
+        pool_free(ptr, pool_class(size));
+        return;
+    }
+
+    jsonp_free(ptr);
+}
+
+/*** allocation ***/
+
+static void *allocate(size_t size) {
     if (!size)
         return NULL;
 
+    if (in_budget() && budget_charge(size))
+        return NULL;
+
+    if (in_arena())
+        return arena_alloc(current_arena, size);
+
     return (*do_malloc)(size);
 }
 
+void *jsonp_malloc(size_t size) {
+    jsonp_stats_alloc(json_stats_other, size);
+    return allocate(size);
+}
+
+#if JSONP_STATS
+void *jsonp_malloc_as(size_t size, int category) {
+    jsonp_stats_alloc(category, size);
+    return allocate(size);
+}
+#endif
+
 void jsonp_free(void *ptr) {
     if (!ptr)
         return;
 
+    /* While loading into an arena, everything is allocated from and
+       released with the arena */
+    if (in_arena())
+        return;
+
+    jsonp_stats_add(frees, 1);
     (*do_free)(ptr);
 }
 
@@ -39,7 +546,7 @@ char *jsonp_strdup(const char *str) { return jsonp_strndup(str, strlen(str)); }
 char *jsonp_strndup(const char *str, size_t len) {
     char *new_str;
 
-    new_str = jsonp_malloc(len + 1);
+    new_str = jsonp_malloc_as(len + 1, json_stats_strings);
     if (!new_str)
         return NULL;
 
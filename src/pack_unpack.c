@@ -934,3 +934,1318 @@ int json_unpack(json_t *root, const char *fmt, ...) {
 
     return ret;
 }
+
+/* Compiled unpacking. The format is checked and turned into a flat
+   list of operations once, in the same way as unpack() walks it, and
+   the errors of the arguments and of root are reported at the same
+   positions as json_unpack_ex() would report them. */
+
+typedef struct {
+    char op;      /* a format character, or 'k' for an object key */
+    char flag;    /* 'k': '?' if optional, 's': '%' if there's a length,
+                     '}' and ']': 1 for '!', -1 for '*' and 0 for none */
+    size_t count; /* '{': the number of keys */
+    token_t token;
+    token_t value_token; /* 'k': the token of the value, 's': the '%' */
+} plan_op_t;
+
+struct json_unpack_plan {
+    plan_op_t *ops;
+    size_t size;
+};
+
+static int compile_value(scanner_t *s, strbuffer_t *ops);
+
+static int compile_op(scanner_t *s, strbuffer_t *ops, char op) {
+    plan_op_t entry;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.op = op;
+    entry.token = s->token;
+    if (strbuffer_append_bytes(ops, (const char *)&entry, sizeof(entry))) {
+        set_error(s, "<internal>", json_error_out_of_memory, "Out of memory");
+        return -1;
+    }
+    return 0;
+}
+
+#define last_op(ops_) ((plan_op_t *)((ops_)->value + (ops_)->length) - 1)
+#define op_at(ops_, index_) ((plan_op_t *)(ops_)->value + (index_))
+
+static int compile_object(scanner_t *s, strbuffer_t *ops) {
+    size_t start = ops->length / sizeof(plan_op_t);
+    int strict = 0;
+
+    if (compile_op(s, ops, '{'))
+        return -1;
+    next_token(s);
+
+    while (token(s) != '}') {
+        if (strict != 0) {
+            set_error(s, "<format>", json_error_invalid_format,
+                      "Expected '}' after '%c', got '%c'", (strict == 1 ? '!' : '*'),
+                      token(s));
+            return -1;
+        }
+
+        if (!token(s)) {
+            set_error(s, "<format>", json_error_invalid_format,
+                      "Unexpected end of format string");
+            return -1;
+        }
+
+        if (token(s) == '!' || token(s) == '*') {
+            strict = (token(s) == '!' ? 1 : -1);
+            next_token(s);
+            continue;
+        }
+
+        if (token(s) != 's') {
+            set_error(s, "<format>", json_error_invalid_format,
+                      "Expected format 's', got '%c'", token(s));
+            return -1;
+        }
+
+        if (compile_op(s, ops, 'k'))
+            return -1;
+        op_at(ops, start)->count++;
+
+        next_token(s);
+        if (token(s) == '?') {
+            last_op(ops)->flag = '?';
+            next_token(s);
+        }
+        last_op(ops)->value_token = s->token;
+
+        if (compile_value(s, ops))
+            return -1;
+        next_token(s);
+    }
+
+    if (compile_op(s, ops, '}'))
+        return -1;
+    last_op(ops)->flag = (char)strict;
+    return 0;
+}
+
+static int compile_array(scanner_t *s, strbuffer_t *ops) {
+    int strict = 0;
+
+    if (compile_op(s, ops, '['))
+        return -1;
+    next_token(s);
+
+    while (token(s) != ']') {
+        if (strict != 0) {
+            set_error(s, "<format>", json_error_invalid_format,
+                      "Expected ']' after '%c', got '%c'", (strict == 1 ? '!' : '*'),
+                      token(s));
+            return -1;
+        }
+
+        if (!token(s)) {
+            set_error(s, "<format>", json_error_invalid_format,
+                      "Unexpected end of format string");
+            return -1;
+        }
+
+        if (token(s) == '!' || token(s) == '*') {
+            strict = (token(s) == '!' ? 1 : -1);
+            next_token(s);
+            continue;
+        }
+
+        if (!strchr(unpack_value_starters, token(s))) {
+            set_error(s, "<format>", json_error_invalid_format,
+                      "Unexpected format character '%c'", token(s));
+            return -1;
+        }
+
+        if (compile_value(s, ops))
+            return -1;
+        next_token(s);
+    }
+
+    if (compile_op(s, ops, ']'))
+        return -1;
+    last_op(ops)->flag = (char)strict;
+    return 0;
+}
+
+static int compile_value(scanner_t *s, strbuffer_t *ops) {
+    switch (token(s)) {
+        case '{':
+            return compile_object(s, ops);
+
+        case '[':
+            return compile_array(s, ops);
+
+        case 's':
+            if (compile_op(s, ops, 's'))
+                return -1;
+
+            next_token(s);
+            if (token(s) == '%') {
+                last_op(ops)->flag = '%';
+                last_op(ops)->value_token = s->token;
+            } else
+                prev_token(s);
+            return 0;
+
+        case 'i':
+        case 'I':
+        case 'b':
+        case 'f':
+        case 'F':
+        case 'O':
+        case 'o':
+        case 'n':
+            return compile_op(s, ops, token(s));
+
+        default:
+            set_error(s, "<format>", json_error_invalid_format,
+                      "Unexpected format character '%c'", token(s));
+            return -1;
+    }
+}
+
+json_unpack_plan_t *json_unpack_compile(const char *fmt, json_error_t *error) {
+    json_unpack_plan_t *plan;
+    strbuffer_t ops;
+    scanner_t s;
+
+    if (!fmt || !*fmt) {
+        jsonp_error_init(error, "<format>");
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument,
+                        "NULL or empty format string");
+        return NULL;
+    }
+    jsonp_error_init(error, NULL);
+
+    scanner_init(&s, error, 0, fmt);
+    if (strbuffer_init(&ops)) {
+        set_error(&s, "<internal>", json_error_out_of_memory, "Out of memory");
+        return NULL;
+    }
+
+    next_token(&s);
+    if (compile_value(&s, &ops))
+        goto error;
+
+    next_token(&s);
+    if (token(&s)) {
+        set_error(&s, "<format>", json_error_invalid_format,
+                  "Garbage after format string");
+        goto error;
+    }
+
+    plan = jsonp_malloc(sizeof(json_unpack_plan_t));
+    if (!plan) {
+        set_error(&s, "<internal>", json_error_out_of_memory, "Out of memory");
+        goto error;
+    }
+    plan->size = ops.length / sizeof(plan_op_t);
+    plan->ops = (plan_op_t *)strbuffer_steal_value(&ops);
+    return plan;
+
+error:
+    strbuffer_close(&ops);
+    return NULL;
+}
+
+void json_unpack_plan_free(json_unpack_plan_t *plan) {
+    if (!plan)
+        return;
+
+    jsonp_free(plan->ops);
+    jsonp_free(plan);
+}
+
+typedef struct {
+    const plan_op_t *op; /* the next operation */
+    json_error_t *error;
+    size_t flags;
+} plan_exec_t;
+
+static void exec_error(plan_exec_t *x, const token_t *token, const char *source,
+                       enum json_error_code code, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+
+    jsonp_error_vset(x->error, token->line, token->column, token->pos, code, fmt, ap);
+    jsonp_error_set_source(x->error, source);
+
+    va_end(ap);
+}
+
+static int exec_value(plan_exec_t *x, json_t *root, va_list *ap);
+
+/* Returns the number of different keys in keys */
+static size_t count_distinct(const char **keys, size_t count) {
+    size_t i, j, distinct = 0;
+
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < i; j++) {
+            if (!strcmp(keys[i], keys[j]))
+                break;
+        }
+        if (j == i)
+            distinct++;
+    }
+    return distinct;
+}
+
+static int exec_unpacked_error(plan_exec_t *x, const token_t *token, json_t *root,
+                               const char **found, size_t count) {
+    const char *key;
+    size_t key_len, i;
+    /* keys_res is 1 for uninitialized, 0 for success, -1 for error. */
+    int keys_res = 1;
+    strbuffer_t unrecognized_keys;
+    json_t *value;
+    long unpacked = 0;
+
+    json_object_keylen_foreach(root, key, key_len, value) {
+        for (i = 0; i < count; i++) {
+            if (strlen(found[i]) == key_len && !memcmp(found[i], key, key_len))
+                break;
+        }
+        if (i < count)
+            continue;
+
+        unpacked++;
+
+        /* Save unrecognized keys for the error message */
+        if (keys_res == 1) {
+            keys_res = strbuffer_init(&unrecognized_keys);
+        } else if (!keys_res) {
+            keys_res = strbuffer_append_bytes(&unrecognized_keys, ", ", 2);
+        }
+
+        if (!keys_res)
+            keys_res = strbuffer_append_bytes(&unrecognized_keys, key, key_len);
+    }
+
+    exec_error(x, token, "<validation>", json_error_end_of_input_expected,
+               "%li object item(s) left unpacked: %s", unpacked,
+               keys_res ? "<unknown>" : strbuffer_value(&unrecognized_keys));
+    if (keys_res != 1)
+        strbuffer_close(&unrecognized_keys);
+    return -1;
+}
+
+/* Instead of a set of the unpacked keys, the keys that were found are
+   collected to a small array, and all keys have been unpacked if
+   there are as many different ones as there are members */
+#define EXEC_FOUND_KEYS 16
+
+static int exec_object(plan_exec_t *x, json_t *root, va_list *ap) {
+    const plan_op_t *open = x->op++;
+    const char *stack[EXEC_FOUND_KEYS], **found = stack;
+    size_t count = 0;
+    int strict, ret = -1;
+
+    if (root && !json_is_object(root)) {
+        exec_error(x, &open->token, "<validation>", json_error_wrong_type,
+                   "Expected object, got %s", type_name(root));
+        return -1;
+    }
+
+    if (root && open->count > EXEC_FOUND_KEYS) {
+        found = jsonp_malloc(open->count * sizeof(const char *));
+        if (!found) {
+            exec_error(x, &open->token, "<internal>", json_error_out_of_memory,
+                       "Out of memory");
+            return -1;
+        }
+    }
+
+    while (x->op->op == 'k') {
+        const plan_op_t *op = x->op++;
+        const char *key;
+        json_t *value;
+
+        key = va_arg(*ap, const char *);
+        if (!key) {
+            exec_error(x, &op->token, "<args>", json_error_null_value,
+                       "NULL object key");
+            goto out;
+        }
+
+        if (!root) {
+            /* skipping */
+            value = NULL;
+        } else {
+            value = json_object_get(root, key);
+            if (!value && op->flag != '?') {
+                exec_error(x, &op->value_token, "<validation>",
+                           json_error_item_not_found, "Object item not found: %s", key);
+                goto out;
+            }
+        }
+
+        if (exec_value(x, value, ap))
+            goto out;
+
+        if (value)
+            found[count++] = key;
+    }
+
+    strict = x->op->flag;
+    if (strict == 0 && (x->flags & JSON_STRICT))
+        strict = 1;
+
+    if (root && strict == 1 && count_distinct(found, count) != json_object_size(root)) {
+        exec_unpacked_error(x, &x->op->token, root, found, count);
+        goto out;
+    }
+
+    x->op++;
+    ret = 0;
+
+out:
+    if (found != stack)
+        jsonp_free(found);
+    return ret;
+}
+
+static int exec_array(plan_exec_t *x, json_t *root, va_list *ap) {
+    const plan_op_t *open = x->op++;
+    size_t i = 0;
+    int strict;
+
+    if (root && !json_is_array(root)) {
+        exec_error(x, &open->token, "<validation>", json_error_wrong_type,
+                   "Expected array, got %s", type_name(root));
+        return -1;
+    }
+
+    while (x->op->op != ']') {
+        json_t *value;
+
+        if (!root) {
+            /* skipping */
+            value = NULL;
+        } else {
+            value = json_array_get(root, i);
+            if (!value) {
+                exec_error(x, &x->op->token, "<validation>",
+                           json_error_index_out_of_range, "Array index %lu out of range",
+                           (unsigned long)i);
+                return -1;
+            }
+        }
+
+        if (exec_value(x, value, ap))
+            return -1;
+        i++;
+    }
+
+    strict = x->op->flag;
+    if (strict == 0 && (x->flags & JSON_STRICT))
+        strict = 1;
+
+    if (root && strict == 1 && i != json_array_size(root)) {
+        long diff = (long)json_array_size(root) - (long)i;
+        exec_error(x, &x->op->token, "<validation>", json_error_end_of_input_expected,
+                   "%li array item(s) left unpacked", diff);
+        return -1;
+    }
+
+    x->op++;
+    return 0;
+}
+
+/* Checks the type of a scalar like unpack() */
+static int exec_check_type(plan_exec_t *x, const plan_op_t *op, json_t *root) {
+    const char *expected;
+
+    if (!root)
+        return 0;
+
+    switch (op->op) {
+        case 's':
+            if (json_is_string(root))
+                return 0;
+            expected = "string";
+            break;
+        case 'i':
+        case 'I':
+            if (json_is_integer(root))
+                return 0;
+            expected = "integer";
+            break;
+        case 'b':
+            if (json_is_boolean(root))
+                return 0;
+            expected = "true or false";
+            break;
+        case 'f':
+            if (json_is_real(root))
+                return 0;
+            expected = "real";
+            break;
+        case 'F':
+            if (json_is_number(root))
+                return 0;
+            expected = "real or integer";
+            break;
+        case 'n':
+            if (json_is_null(root))
+                return 0;
+            expected = "null";
+            break;
+        default:
+            return 0;
+    }
+
+    exec_error(x, &op->token, "<validation>", json_error_wrong_type,
+               "Expected %s, got %s", expected, type_name(root));
+    return -1;
+}
+
+static int exec_value(plan_exec_t *x, json_t *root, va_list *ap) {
+    const plan_op_t *op = x->op;
+
+    if (op->op == '{')
+        return exec_object(x, root, ap);
+    if (op->op == '[')
+        return exec_array(x, root, ap);
+
+    x->op++;
+    if (exec_check_type(x, op, root))
+        return -1;
+    if ((x->flags & JSON_VALIDATE_ONLY) || op->op == 'n')
+        return 0;
+
+    switch (op->op) {
+        case 's': {
+            const char **str_target = va_arg(*ap, const char **);
+            size_t *len_target = NULL;
+
+            if (!str_target) {
+                exec_error(x, &op->token, "<args>", json_error_null_value,
+                           "NULL string argument");
+                return -1;
+            }
+
+            if (op->flag == '%') {
+                len_target = va_arg(*ap, size_t *);
+                if (!len_target) {
+                    exec_error(x, &op->value_token, "<args>", json_error_null_value,
+                               "NULL string length argument");
+                    return -1;
+                }
+            }
+
+            if (root) {
+                *str_target = json_string_value(root);
+                if (len_target)
+                    *len_target = json_string_length(root);
+            }
+            return 0;
+        }
+
+        case 'i': {
+            int *target = va_arg(*ap, int *);
+            if (root)
+                *target = (int)json_integer_value(root);
+            return 0;
+        }
+
+        case 'I': {
+            json_int_t *target = va_arg(*ap, json_int_t *);
+            if (root)
+                *target = json_integer_value(root);
+            return 0;
+        }
+
+        case 'b': {
+            int *target = va_arg(*ap, int *);
+            if (root)
+                *target = json_is_true(root);
+            return 0;
+        }
+
+        case 'f':
+        case 'F': {
+            double *target = va_arg(*ap, double *);
+            if (root)
+                *target = op->op == 'f' ? json_real_value(root) : json_number_value(root);
+            return 0;
+        }
+
+        default: {
+            /* 'O' or 'o' */
+            json_t **target = va_arg(*ap, json_t **);
+            if (root) {
+                if (op->op == 'O')
+                    json_incref(root);
+                *target = root;
+            }
+            return 0;
+        }
+    }
+}
+
+int json_vunpack_plan_ex(json_t *root, json_error_t *error, size_t flags,
+                         const json_unpack_plan_t *plan, va_list ap) {
+    plan_exec_t x;
+    va_list ap_copy;
+    int ret;
+
+    if (!root) {
+        jsonp_error_init(error, "<root>");
+        jsonp_error_set(error, -1, -1, 0, json_error_null_value, "NULL root value");
+        return -1;
+    }
+
+    if (!plan) {
+        jsonp_error_init(error, "<format>");
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "NULL plan");
+        return -1;
+    }
+    jsonp_error_init(error, NULL);
+
+    x.op = plan->ops;
+    x.error = error;
+    x.flags = flags;
+
+    va_copy(ap_copy, ap);
+    ret = exec_value(&x, root, &ap_copy);
+    va_end(ap_copy);
+
+    return ret;
+}
+
+int json_unpack_plan_ex(json_t *root, json_error_t *error, size_t flags,
+                        const json_unpack_plan_t *plan, ...) {
+    int ret;
+    va_list ap;
+
+    va_start(ap, plan);
+    ret = json_vunpack_plan_ex(root, error, flags, plan, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+int json_unpack_plan(json_t *root, const json_unpack_plan_t *plan, ...) {
+    int ret;
+    va_list ap;
+
+    va_start(ap, plan);
+    ret = json_vunpack_plan_ex(root, NULL, 0, plan, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+/* Compiled packing. Like with unpacking, the format is turned into a
+   flat list of operations in the same way as pack() walks it. The
+   operations of a string are 's' or 'k' with 'flag' set to '?' or '*'
+   if it's optional and 'count' set to the number of pieces, followed
+   by a '+' operation for each piece with 'flag' set to '#' or '%' if
+   the length is given. A plain string has no pieces. */
+
+struct json_pack_plan {
+    plan_op_t *ops;
+    size_t size;
+};
+
+static int compile_pack_value(scanner_t *s, strbuffer_t *ops);
+
+/* Like read_string(); s->token is the 's' or the '?' or '*' after it */
+static int compile_pack_string(scanner_t *s, strbuffer_t *ops, char op, char optional) {
+    size_t start = ops->length / sizeof(plan_op_t);
+    char t;
+
+    if (compile_op(s, ops, op))
+        return -1;
+    last_op(ops)->flag = optional;
+    last_op(ops)->value_token = s->token;
+
+    next_token(s);
+    t = token(s);
+    prev_token(s);
+
+    if (t != '#' && t != '%' && t != '+')
+        return 0;
+
+    if (optional) {
+        set_error(s, "<format>", json_error_invalid_format,
+                  "Cannot use '%c' on optional strings", t);
+        return -1;
+    }
+
+    while (1) {
+        if (compile_op(s, ops, '+'))
+            return -1;
+        op_at(ops, start)->count++;
+
+        next_token(s);
+        if (token(s) == '#' || token(s) == '%')
+            last_op(ops)->flag = token(s);
+        else
+            prev_token(s);
+
+        next_token(s);
+        if (token(s) != '+') {
+            prev_token(s);
+            break;
+        }
+    }
+
+    /* invalid UTF-8 is reported at the last token of the string */
+    op_at(ops, start)->value_token = s->token;
+    return 0;
+}
+
+static int compile_pack_object(scanner_t *s, strbuffer_t *ops) {
+    size_t start = ops->length / sizeof(plan_op_t);
+
+    if (compile_op(s, ops, '{'))
+        return -1;
+    next_token(s);
+
+    while (token(s) != '}') {
+        if (!token(s)) {
+            set_error(s, "<format>", json_error_invalid_format,
+                      "Unexpected end of format string");
+            return -1;
+        }
+
+        if (token(s) != 's') {
+            set_error(s, "<format>", json_error_invalid_format,
+                      "Expected format 's', got '%c'", token(s));
+            return -1;
+        }
+
+        if (compile_pack_string(s, ops, 'k', 0))
+            return -1;
+        op_at(ops, start)->count++;
+
+        next_token(s);
+        if (compile_pack_value(s, ops))
+            return -1;
+        next_token(s);
+    }
+
+    return compile_op(s, ops, '}');
+}
+
+static int compile_pack_array(scanner_t *s, strbuffer_t *ops) {
+    size_t start = ops->length / sizeof(plan_op_t);
+
+    if (compile_op(s, ops, '['))
+        return -1;
+    next_token(s);
+
+    while (token(s) != ']') {
+        if (!token(s)) {
+            set_error(s, "<format>", json_error_invalid_format,
+                      "Unexpected end of format string");
+            return -1;
+        }
+
+        op_at(ops, start)->count++;
+        if (compile_pack_value(s, ops))
+            return -1;
+        next_token(s);
+    }
+
+    return compile_op(s, ops, ']');
+}
+
+static int compile_pack_value(scanner_t *s, strbuffer_t *ops) {
+    char t;
+
+    switch (token(s)) {
+        case '{':
+            return compile_pack_object(s, ops);
+
+        case '[':
+            return compile_pack_array(s, ops);
+
+        case 's':
+            next_token(s);
+            t = token(s);
+            if (t != '?' && t != '*') {
+                prev_token(s);
+                t = 0;
+            }
+            return compile_pack_string(s, ops, 's', t);
+
+        case 'O':
+        case 'o':
+            if (compile_op(s, ops, token(s)))
+                return -1;
+
+            next_token(s);
+            if (token(s) == '?' || token(s) == '*')
+                last_op(ops)->flag = token(s);
+            else
+                prev_token(s);
+            return 0;
+
+        case 'n':
+        case 'b':
+        case 'i':
+        case 'I':
+        case 'f':
+            return compile_op(s, ops, token(s));
+
+        default:
+            set_error(s, "<format>", json_error_invalid_format,
+                      "Unexpected format character '%c'", token(s));
+            return -1;
+    }
+}
+
+json_pack_plan_t *json_pack_compile(const char *fmt, json_error_t *error) {
+    json_pack_plan_t *plan;
+    strbuffer_t ops;
+    scanner_t s;
+
+    if (!fmt || !*fmt) {
+        jsonp_error_init(error, "<format>");
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument,
+                        "NULL or empty format string");
+        return NULL;
+    }
+    jsonp_error_init(error, NULL);
+
+    scanner_init(&s, error, 0, fmt);
+    if (strbuffer_init(&ops)) {
+        set_error(&s, "<internal>", json_error_out_of_memory, "Out of memory");
+        return NULL;
+    }
+
+    next_token(&s);
+    if (compile_pack_value(&s, &ops))
+        goto error;
+
+    next_token(&s);
+    if (token(&s)) {
+        set_error(&s, "<format>", json_error_invalid_format,
+                  "Garbage after format string");
+        goto error;
+    }
+
+    plan = jsonp_malloc(sizeof(json_pack_plan_t));
+    if (!plan) {
+        set_error(&s, "<internal>", json_error_out_of_memory, "Out of memory");
+        goto error;
+    }
+    plan->size = ops.length / sizeof(plan_op_t);
+    plan->ops = (plan_op_t *)strbuffer_steal_value(&ops);
+    return plan;
+
+error:
+    strbuffer_close(&ops);
+    return NULL;
+}
+
+void json_pack_plan_free(json_pack_plan_t *plan) {
+    if (!plan)
+        return;
+
+    jsonp_free(plan->ops);
+    jsonp_free(plan);
+}
+
+/* As in pack(), the arguments are consumed to the end after an error
+   so that the references of 'o' values are always stolen */
+typedef struct {
+    const plan_op_t *op; /* the next operation */
+    json_error_t *error;
+    int has_error;
+    json_writer_t *writer; /* NULL when building a value */
+} pack_exec_t;
+
+static void pack_error(pack_exec_t *x, const token_t *token, const char *source,
+                       enum json_error_code code, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+
+    jsonp_error_vset(x->error, token->line, token->column, token->pos, code, fmt, ap);
+    jsonp_error_set_source(x->error, source);
+    x->has_error = 1;
+
+    va_end(ap);
+}
+
+/* Read the string of the operation at x->op like read_string(). A
+   single piece is returned as is, so it's not NUL terminated if its
+   length was given. */
+static const char *pack_exec_string(pack_exec_t *x, va_list *ap, const char *purpose,
+                                    size_t *out_len, char **ours) {
+    const plan_op_t *op = x->op++;
+    const plan_op_t *piece, *end = x->op + op->count;
+    strbuffer_t strbuff;
+    const char *str;
+    size_t length;
+
+    *ours = NULL;
+    if (!op->count) {
+        /* the simple case */
+        str = va_arg(*ap, const char *);
+        if (!str) {
+            if (!op->flag)
+                pack_error(x, &op->token, "<args>", json_error_null_value, "NULL %s",
+                           purpose);
+            return NULL;
+        }
+
+        length = strlen(str);
+    } else if (op->count == 1) {
+        /* a single piece with a length doesn't need to be copied */
+        piece = x->op++;
+        str = va_arg(*ap, const char *);
+        if (!str)
+            pack_error(x, &piece->token, "<args>", json_error_null_value, "NULL %s",
+                       purpose);
+
+        /* a single piece always has a length */
+        if (piece->flag == '#')
+            length = va_arg(*ap, int);
+        else
+            length = va_arg(*ap, size_t);
+
+        if (x->has_error)
+            return NULL;
+    } else {
+        if (strbuffer_init(&strbuff))
+            pack_error(x, &op->token, "<internal>", json_error_out_of_memory,
+                       "Out of memory");
+
+        for (piece = x->op; piece < end; piece++) {
+            str = va_arg(*ap, const char *);
+            if (!str)
+                pack_error(x, &piece->token, "<args>", json_error_null_value,
+                           "NULL %s", purpose);
+
+            if (piece->flag == '#')
+                length = va_arg(*ap, int);
+            else if (piece->flag == '%')
+                length = va_arg(*ap, size_t);
+            else
+                length = x->has_error ? 0 : strlen(str);
+
+            if (!x->has_error && strbuffer_append_bytes(&strbuff, str, length) == -1)
+                pack_error(x, &piece->token, "<internal>", json_error_out_of_memory,
+                           "Out of memory");
+        }
+        x->op = end;
+
+        if (x->has_error) {
+            strbuffer_close(&strbuff);
+            return NULL;
+        }
+
+        length = strbuff.length;
+        *ours = strbuffer_steal_value(&strbuff);
+        str = *ours;
+    }
+
+    if (!utf8_check_string(str, length)) {
+        pack_error(x, &op->value_token, "<args>", json_error_invalid_utf8,
+                   "Invalid UTF-8 %s", purpose);
+        jsonp_free(*ours);
+        *ours = NULL;
+        return NULL;
+    }
+
+    *out_len = length;
+    return str;
+}
+
+static json_t *pack_exec_value(pack_exec_t *x, va_list *ap);
+
+static json_t *pack_exec_object(pack_exec_t *x, va_list *ap) {
+    /* the number of members is known, so the object is sized once */
+    json_t *object = json_object_with_capacity(x->op->count);
+
+    x->op++;
+    while (x->op->op == 'k') {
+        const char *key;
+        size_t len;
+        char *ours;
+        const plan_op_t *value_op;
+        json_t *value;
+
+        key = pack_exec_string(x, ap, "object key", &len, &ours);
+
+        value_op = x->op;
+        value = pack_exec_value(x, ap);
+        if (!value) {
+            jsonp_free(ours);
+
+            if (value_op->flag != '*')
+                pack_error(x, &value_op->token, "<args>", json_error_null_value,
+                           "NULL object value");
+            continue;
+        }
+
+        if (x->has_error)
+            json_decref(value);
+        else if (json_object_setn_new_nocheck(object, key, len, value))
+            pack_error(x, &value_op->token, "<internal>", json_error_out_of_memory,
+                       "Unable to add key \"%.*s\"", (int)len, key);
+
+        jsonp_free(ours);
+    }
+    x->op++;
+
+    if (!x->has_error)
+        return object;
+
+    json_decref(object);
+    return NULL;
+}
+
+static json_t *pack_exec_array(pack_exec_t *x, va_list *ap) {
+    json_t *array = json_array_with_capacity(x->op->count);
+
+    x->op++;
+    while (x->op->op != ']') {
+        const plan_op_t *value_op = x->op;
+        json_t *value = pack_exec_value(x, ap);
+
+        if (!value) {
+            if (value_op->flag != '*')
+                x->has_error = 1;
+            continue;
+        }
+
+        if (x->has_error)
+            json_decref(value);
+        else if (json_array_append_new(array, value))
+            pack_error(x, &value_op->token, "<internal>", json_error_out_of_memory,
+                       "Unable to append to array");
+    }
+    x->op++;
+
+    if (!x->has_error)
+        return array;
+
+    json_decref(array);
+    return NULL;
+}
+
+static json_t *pack_exec_value(pack_exec_t *x, va_list *ap) {
+    const plan_op_t *op = x->op;
+    json_t *json;
+
+    switch (op->op) {
+        case '{':
+            return pack_exec_object(x, ap);
+
+        case '[':
+            return pack_exec_array(x, ap);
+
+        case 's': {
+            const char *str;
+            size_t len;
+            char *ours;
+
+            str = pack_exec_string(x, ap, "string", &len, &ours);
+            if (!str)
+                return op->flag == '?' && !x->has_error ? json_null() : NULL;
+
+            if (x->has_error)
+                return NULL;
+
+            if (ours)
+                return jsonp_stringn_nocheck_own(ours, len);
+            return json_stringn_nocheck(str, len);
+        }
+    }
+
+    x->op++;
+    switch (op->op) {
+        case 'n':
+            return json_null();
+
+        case 'b':
+            return va_arg(*ap, int) ? json_true() : json_false();
+
+        case 'i':
+        case 'I':
+            json = json_integer(op->op == 'i' ? va_arg(*ap, int)
+                                              : va_arg(*ap, json_int_t));
+            if (!json)
+                pack_error(x, &op->token, "<internal>", json_error_out_of_memory,
+                           "Out of memory");
+            return json;
+
+        case 'f': {
+            double value = va_arg(*ap, double);
+
+            json = json_real(0.0);
+            if (!json) {
+                pack_error(x, &op->token, "<internal>", json_error_out_of_memory,
+                           "Out of memory");
+                return NULL;
+            }
+
+            if (json_real_set(json, value)) {
+                json_decref(json);
+                pack_error(x, &op->token, "<args>", json_error_numeric_overflow,
+                           "Invalid floating point value");
+                return NULL;
+            }
+            return json;
+        }
+
+        default:
+            /* 'O' or 'o' */
+            json = va_arg(*ap, json_t *);
+            if (json)
+                return op->op == 'O' ? json_incref(json) : json;
+
+            if (op->flag == '?')
+                return json_null();
+            if (op->flag != '*')
+                pack_error(x, &op->token, "<args>", json_error_null_value, "NULL object");
+            return NULL;
+    }
+}
+
+json_t *json_vpack_plan_ex(json_error_t *error, size_t flags,
+                           const json_pack_plan_t *plan, va_list ap) {
+    pack_exec_t x;
+    va_list ap_copy;
+    json_t *value;
+
+    (void)flags;
+
+    if (!plan) {
+        jsonp_error_init(error, "<format>");
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "NULL plan");
+        return NULL;
+    }
+    jsonp_error_init(error, NULL);
+
+    x.op = plan->ops;
+    x.error = error;
+    x.has_error = 0;
+    x.writer = NULL;
+
+    va_copy(ap_copy, ap);
+    value = pack_exec_value(&x, &ap_copy);
+    va_end(ap_copy);
+
+    return value;
+}
+
+json_t *json_pack_plan_ex(json_error_t *error, size_t flags, const json_pack_plan_t *plan,
+                          ...) {
+    json_t *value;
+    va_list ap;
+
+    va_start(ap, plan);
+    value = json_vpack_plan_ex(error, flags, plan, ap);
+    va_end(ap);
+
+    return value;
+}
+
+json_t *json_pack_plan(const json_pack_plan_t *plan, ...) {
+    json_t *value;
+    va_list ap;
+
+    va_start(ap, plan);
+    value = json_vpack_plan_ex(NULL, 0, plan, ap);
+    va_end(ap);
+
+    return value;
+}
+
+/* Writing a plan to a writer. The member key is passed down to the
+   value, so that it's only written if the value is. */
+
+static void pack_write_check(pack_exec_t *x, const plan_op_t *op, int res) {
+    if (res)
+        pack_error(x, &op->token, "<output>", json_error_unknown,
+                   "Unable to write output");
+}
+
+static int pack_write_key(pack_exec_t *x, const plan_op_t *op, const char *key,
+                          size_t key_len) {
+    if (x->has_error)
+        return -1;
+    if (key)
+        pack_write_check(x, op, json_writer_keyn(x->writer, key, key_len));
+    return x->has_error ? -1 : 0;
+}
+
+static void pack_write_value(pack_exec_t *x, va_list *ap, const char *key,
+                             size_t key_len);
+
+static void pack_write_object(pack_exec_t *x, va_list *ap) {
+    const plan_op_t *open = x->op++;
+
+    if (!x->has_error)
+        pack_write_check(x, open, json_writer_begin_object(x->writer));
+
+    while (x->op->op == 'k') {
+        const char *key;
+        size_t len;
+        char *ours;
+
+        key = pack_exec_string(x, ap, "object key", &len, &ours);
+        pack_write_value(x, ap, key, len);
+        jsonp_free(ours);
+    }
+
+    if (!x->has_error)
+        pack_write_check(x, x->op, json_writer_end_object(x->writer));
+    x->op++;
+}
+
+static void pack_write_array(pack_exec_t *x, va_list *ap) {
+    const plan_op_t *open = x->op++;
+
+    if (!x->has_error)
+        pack_write_check(x, open, json_writer_begin_array(x->writer));
+
+    while (x->op->op != ']')
+        pack_write_value(x, ap, NULL, 0);
+
+    if (!x->has_error)
+        pack_write_check(x, x->op, json_writer_end_array(x->writer));
+    x->op++;
+}
+
+static void pack_write_value(pack_exec_t *x, va_list *ap, const char *key,
+                             size_t key_len) {
+    const plan_op_t *op = x->op;
+    json_writer_t *writer = x->writer;
+
+    switch (op->op) {
+        case '{':
+            pack_write_key(x, op, key, key_len);
+            pack_write_object(x, ap);
+            return;
+
+        case '[':
+            pack_write_key(x, op, key, key_len);
+            pack_write_array(x, ap);
+            return;
+
+        case 's': {
+            const char *str;
+            size_t len;
+            char *ours;
+
+            str = pack_exec_string(x, ap, "string", &len, &ours);
+            if (!str) {
+                if (op->flag == '?' && !pack_write_key(x, op, key, key_len))
+                    pack_write_check(x, op, json_writer_null(writer));
+            } else if (!pack_write_key(x, op, key, key_len))
+                pack_write_check(x, op, json_writer_stringn(writer, str, len));
+            jsonp_free(ours);
+            return;
+        }
+    }
+
+    x->op++;
+    switch (op->op) {
+        case 'n':
+            if (!pack_write_key(x, op, key, key_len))
+                pack_write_check(x, op, json_writer_null(writer));
+            return;
+
+        case 'b': {
+            int value = va_arg(*ap, int);
+            if (!pack_write_key(x, op, key, key_len))
+                pack_write_check(x, op, json_writer_boolean(writer, value));
+            return;
+        }
+
+        case 'i':
+        case 'I': {
+            json_int_t value = op->op == 'i' ? va_arg(*ap, int) : va_arg(*ap, json_int_t);
+            if (!pack_write_key(x, op, key, key_len))
+                pack_write_check(x, op, json_writer_integer(writer, value));
+            return;
+        }
+
+        case 'f': {
+            double value = va_arg(*ap, double);
+
+            /* like json_real_set(), reject NaN and infinities */
+            if (value != value || value - value != 0.0)
+                pack_error(x, &op->token, "<args>", json_error_numeric_overflow,
+                           "Invalid floating point value");
+            else if (!pack_write_key(x, op, key, key_len))
+                pack_write_check(x, op, json_writer_real(writer, value));
+            return;
+        }
+
+        default: {
+            /* 'O' or 'o' */
+            json_t *json = va_arg(*ap, json_t *);
+
+            if (json) {
+                if (!pack_write_key(x, op, key, key_len))
+                    pack_write_check(x, op, json_writer_value(writer, json));
+                if (op->op == 'o')
+                    json_decref(json);
+            } else if (op->flag == '?') {
+                if (!pack_write_key(x, op, key, key_len))
+                    pack_write_check(x, op, json_writer_null(writer));
+            } else if (op->flag != '*')
+                pack_error(x, &op->token, "<args>", json_error_null_value, "NULL object");
+            return;
+        }
+    }
+}
+
+int json_vpack_plan_write(json_writer_t *writer, json_error_t *error,
+                          const json_pack_plan_t *plan, va_list ap) {
+    pack_exec_t x;
+    va_list ap_copy;
+
+    if (!writer) {
+        jsonp_error_init(error, "<output>");
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "NULL writer");
+        return -1;
+    }
+
+    if (!plan) {
+        jsonp_error_init(error, "<format>");
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "NULL plan");
+        return -1;
+    }
+    jsonp_error_init(error, NULL);
+
+    x.op = plan->ops;
+    x.error = error;
+    x.has_error = 0;
+    x.writer = writer;
+
+    va_copy(ap_copy, ap);
+    pack_write_value(&x, &ap_copy, NULL, 0);
+    va_end(ap_copy);
+
+    if (x.has_error) {
+        /* the output is incomplete */
+        jsonp_writer_fail(writer);
+        return -1;
+    }
+    return 0;
+}
+
+int json_pack_plan_write(json_writer_t *writer, json_error_t *error,
+                         const json_pack_plan_t *plan, ...) {
+    int ret;
+    va_list ap;
+
+    va_start(ap, plan);
+    ret = json_vpack_plan_write(writer, error, plan, ap);
+    va_end(ap);
+
+    return ret;
+}
@@ -0,0 +1,861 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "jansson.h"
+#include "jansson_private.h"
+#include "strbuffer.h"
+
+/*** JSON Pointer paths ***/
+
+/* Append the reference token of key to path, escaping '~' as "~0"
+   and '/' as "~1" */
+static int path_push_key(strbuffer_t *path, const char *key, size_t len) {
+    size_t i, start = 0;
+
+    if (strbuffer_append_byte(path, '/'))
+        return -1;
+
+    for (i = 0; i < len; i++) {
+        if (key[i] != '~' && key[i] != '/')
+            continue;
+        if (strbuffer_append_bytes(path, key + start, i - start) ||
+            strbuffer_append_bytes(path, key[i] == '~' ? "~0" : "~1", 2))
+            return -1;
+        start = i + 1;
+    }
+    return strbuffer_append_bytes(path, key + start, len - start);
+}
+
+static int path_push_index(strbuffer_t *path, size_t index) {
+    char buffer[32];
+    int len = snprintf(buffer, sizeof(buffer), "/%" JSON_INTEGER_FORMAT,
+                       (json_int_t)index);
+
+    return strbuffer_append_bytes(path, buffer, len);
+}
+
+static void path_pop(strbuffer_t *path, size_t length) {
+    path->length = length;
+    path->value[length] = '\0';
+}
+
+/*** diffs ***/
+
+typedef struct {
+    json_t *patch;
+    strbuffer_t path;
+    jsonp_parents_t parents;
+} diff_t;
+
+/* Append an operation on the current path to the patch. The value is
+   shared with the target, not copied. */
+static int diff_op(diff_t *diff, const char *op, const json_t *value) {
+    json_t *operation = json_object();
+
+    if (json_array_append_new(diff->patch, operation))
+        return -1;
+
+    if (json_object_set_new_nocheck(operation, "op", json_string_nocheck(op)) ||
+        json_object_set_new_nocheck(
+            operation, "path", json_stringn_nocheck(diff->path.value, diff->path.length)))
+        return -1;
+
+    if (value && json_object_set_nocheck(operation, "value", (json_t *)value))
+        return -1;
+    return 0;
+}
+
+static int do_diff(diff_t *diff, const json_t *source, const json_t *target);
+
+static int diff_objects(diff_t *diff, const json_t *source, const json_t *target) {
+    json_t *object, *value;
+    size_t length = diff->path.length, key_len;
+    const char *key;
+
+    /* members that are gone */
+    object = (json_t *)source;
+    json_object_keylen_foreach(object, key, key_len, value) {
+        if (json_object_getn(target, key, key_len))
+            continue;
+        if (path_push_key(&diff->path, key, key_len) || diff_op(diff, "remove", NULL))
+            return -1;
+        path_pop(&diff->path, length);
+    }
+
+    /* members that are new or have changed */
+    object = (json_t *)target;
+    json_object_keylen_foreach(object, key, key_len, value) {
+        const json_t *old = json_object_getn(source, key, key_len);
+
+        if (old == value)
+            continue;
+        if (path_push_key(&diff->path, key, key_len) ||
+            (old ? do_diff(diff, old, value) : diff_op(diff, "add", value)))
+            return -1;
+        path_pop(&diff->path, length);
+    }
+
+    return 0;
+}
+
+static int same_value(const json_t *value1, const json_t *value2) {
+    return value1 == value2 || json_equal(value1, value2);
+}
+
+/* The elements that both arrays start and end with are skipped, so
+   that inserting or removing elements only changes the ones in
+   between. Those are compared pairwise, and the extra elements of the
+   longer array are removed or added. */
+static int diff_arrays(diff_t *diff, const json_t *source, const json_t *target) {
+    size_t n = json_array_size(source), m = json_array_size(target);
+    size_t length = diff->path.length, prefix = 0, suffix = 0, i;
+
+    while (prefix < n && prefix < m &&
+           same_value(json_array_get(source, prefix), json_array_get(target, prefix)))
+        prefix++;
+    while (suffix < n - prefix && suffix < m - prefix &&
+           same_value(json_array_get(source, n - 1 - suffix),
+                      json_array_get(target, m - 1 - suffix)))
+        suffix++;
+    n -= prefix + suffix;
+    m -= prefix + suffix;
+
+    for (i = 0; i < n && i < m; i++) {
+        if (path_push_index(&diff->path, prefix + i) ||
+            do_diff(diff, json_array_get(source, prefix + i),
+                    json_array_get(target, prefix + i)))
+            return -1;
+        path_pop(&diff->path, length);
+    }
+
+    /* the elements after the removed ones move down */
+    for (; i < n; i++) {
+        if (path_push_index(&diff->path, prefix + m) || diff_op(diff, "remove", NULL))
+            return -1;
+        path_pop(&diff->path, length);
+    }
+
+    for (; i < m; i++) {
+        if (path_push_index(&diff->path, prefix + i) ||
+            diff_op(diff, "add", json_array_get(target, prefix + i)))
+            return -1;
+        path_pop(&diff->path, length);
+    }
+
+    return 0;
+}
+
+static int do_diff(diff_t *diff, const json_t *source, const json_t *target) {
+    int res;
+
+    /* values that are shared by both documents are equal */
+    if (source == target)
+        return 0;
+
+    if (json_is_object(source) && json_is_object(target)) {
+        if (jsonp_parents_push(&diff->parents, source))
+            return -1;
+        res = diff_objects(diff, source, target);
+        jsonp_parents_pop(&diff->parents, source);
+        return res;
+    }
+
+    if (json_is_array(source) && json_is_array(target)) {
+        if (jsonp_parents_push(&diff->parents, source))
+            return -1;
+        res = diff_arrays(diff, source, target);
+        jsonp_parents_pop(&diff->parents, source);
+        return res;
+    }
+
+    if (json_equal(source, target))
+        return 0;
+    return diff_op(diff, "replace", target);
+}
+
+json_t *json_diff(const json_t *source, const json_t *target) {
+    diff_t diff;
+    int res;
+
+    if (!source || !target)
+        return NULL;
+
+    diff.patch = json_array();
+    if (!diff.patch)
+        return NULL;
+    if (strbuffer_init(&diff.path)) {
+        json_decref(diff.patch);
+        return NULL;
+    }
+    jsonp_parents_init(&diff.parents);
+
+    res = do_diff(&diff, source, target);
+
+    jsonp_parents_close(&diff.parents);
+    strbuffer_close(&diff.path);
+    if (res) {
+        json_decref(diff.patch);
+        return NULL;
+    }
+    return diff.patch;
+}
+
+static json_t *do_merge_diff(const json_t *source, const json_t *target,
+                             jsonp_parents_t *parents) {
+    json_t *patch, *object, *value;
+    const char *key;
+    size_t key_len;
+
+    if (!json_is_object(source) || !json_is_object(target))
+        return json_incref((json_t *)target);
+
+    patch = json_object();
+    if (!patch || jsonp_parents_push(parents, source)) {
+        json_decref(patch);
+        return NULL;
+    }
+
+    object = (json_t *)source;
+    json_object_keylen_foreach(object, key, key_len, value) {
+        if (!json_object_getn(target, key, key_len) &&
+            json_object_setn_new_nocheck(patch, key, key_len, json_null()))
+            goto error;
+    }
+
+    object = (json_t *)target;
+    json_object_keylen_foreach(object, key, key_len, value) {
+        json_t *old = json_object_getn(source, key, key_len), *member;
+
+        if (old && same_value(old, value))
+            continue;
+
+        if (json_is_object(old) && json_is_object(value)) {
+            member = do_merge_diff(old, value, parents);
+            if (!member)
+                goto error;
+        } else
+            member = json_incref(value);
+
+        if (json_object_setn_new_nocheck(patch, key, key_len, member))
+            goto error;
+    }
+
+    jsonp_parents_pop(parents, source);
+    return patch;
+
+error:
+    jsonp_parents_pop(parents, source);
+    json_decref(patch);
+    return NULL;
+}
+
+json_t *json_merge_diff(const json_t *source, const json_t *target) {
+    jsonp_parents_t parents;
+    json_t *patch;
+
+    if (!source || !target)
+        return NULL;
+
+    jsonp_parents_init(&parents);
+    patch = do_merge_diff(source, target, &parents);
+    jsonp_parents_close(&parents);
+    return patch;
+}
+
+/*** merge patches ***/
+
+static int do_merge_patch(json_t *object, json_t *patch, jsonp_parents_t *parents) {
+    const char *key;
+    size_t key_len;
+    json_t *value;
+    int res = 0;
+
+    if (jsonp_parents_push(parents, patch))
+        return -1;
+
+    json_object_keylen_foreach(patch, key, key_len, value) {
+        json_t *member;
+
+        if (json_is_null(value)) {
+            json_object_deln(object, key, key_len);
+            continue;
+        }
+
+        if (!json_is_object(value)) {
+            if (json_object_setn_nocheck(object, key, key_len, value)) {
+                res = -1;
+                break;
+            }
+            continue;
+        }
+
+        /* an object patch turns other values into objects */
+        member = json_object_getn(object, key, key_len);
+        if (!json_is_object(member)) {
+            member = json_object();
+            if (json_object_setn_new_nocheck(object, key, key_len, member)) {
+                res = -1;
+                break;
+            }
+        }
+
+        if (do_merge_patch(member, value, parents)) {
+            res = -1;
+            break;
+        }
+    }
+
+    jsonp_parents_pop(parents, patch);
+    return res;
+}
+
+int json_merge_patch_apply(json_t *json, const json_t *patch) {
+    jsonp_parents_t parents;
+    int res;
+
+    if (!json_is_object(json) || !json_is_object(patch))
+        return -1;
+
+    jsonp_parents_init(&parents);
+    res = do_merge_patch(json, (json_t *)patch, &parents);
+    jsonp_parents_close(&parents);
+    return res;
+}
+
+/*** patches ***/
+
+#define UNDO_SET      0 /* restore old, or delete the member if there was none */
+#define UNDO_INSERTED 1 /* remove the array element */
+#define UNDO_REMOVED  2 /* insert old back into the array */
+#define UNDO_ROOT     3 /* restore the contents of the root from old */
+
+/* A change made by an operation, recorded so that it can be undone if
+   a later operation fails */
+typedef struct {
+    int type;
+    json_t *container;
+    char *key; /* of an object member */
+    size_t key_len;
+    size_t index; /* of an array element */
+    json_t *old;
+} undo_t;
+
+typedef struct {
+    json_t *root;
+    undo_t *undo;
+    size_t nundo;
+    size_t undo_size;
+    strbuffer_t token; /* the last decoded reference token */
+    size_t index;      /* of the operation being applied */
+    json_error_t *error;
+} patcher_t;
+
+static void patch_error(patcher_t *patcher, enum json_error_code code, const char *msg,
+                        ...) {
+    va_list ap;
+
+    va_start(ap, msg);
+    jsonp_error_vset(patcher->error, -1, -1, patcher->index, code, msg, ap);
+    va_end(ap);
+}
+
+/* Record a change to container before it's made. The record is
+   dropped with undo_drop() if making the change fails. */
+static undo_t *undo_push(patcher_t *patcher, int type, json_t *container) {
+    undo_t *undo;
+
+    if (patcher->nundo == patcher->undo_size) {
+        size_t new_size = patcher->undo_size ? 2 * patcher->undo_size : 16;
+        undo_t *new_undo = jsonp_malloc(new_size * sizeof(undo_t));
+
+        if (!new_undo) {
+            patch_error(patcher, json_error_out_of_memory, "Out of memory");
+            return NULL;
+        }
+        if (patcher->nundo)
+            memcpy(new_undo, patcher->undo, patcher->nundo * sizeof(undo_t));
+        jsonp_free(patcher->undo);
+        patcher->undo = new_undo;
+        patcher->undo_size = new_size;
+    }
+
+    undo = &patcher->undo[patcher->nundo++];
+    undo->type = type;
+    undo->container = json_incref(container);
+    undo->key = NULL;
+    undo->key_len = 0;
+    undo->index = 0;
+    undo->old = NULL;
+    return undo;
+}
+
+static void undo_free(undo_t *undo) {
+    json_decref(undo->container);
+    json_decref(undo->old);
+    jsonp_free(undo->key);
+}
+
+static void undo_drop(patcher_t *patcher) {
+    undo_free(&patcher->undo[--patcher->nundo]);
+    patch_error(patcher, json_error_out_of_memory, "Out of memory");
+}
+
+/* Undo the changes in reverse order, which restores the document as
+   it was before the patch */
+static void undo_all(patcher_t *patcher) {
+    while (patcher->nundo) {
+        undo_t *undo = &patcher->undo[--patcher->nundo];
+
+        switch (undo->type) {
+            case UNDO_SET:
+                if (json_is_array(undo->container))
+                    json_array_set(undo->container, undo->index, undo->old);
+                else if (undo->old)
+                    json_object_setn_nocheck(undo->container, undo->key, undo->key_len,
+                                             undo->old);
+                else
+                    json_object_deln(undo->container, undo->key, undo->key_len);
+                break;
+
+            case UNDO_INSERTED:
+                json_array_remove(undo->container, undo->index);
+                break;
+
+            case UNDO_REMOVED:
+                json_array_insert(undo->container, undo->index, undo->old);
+                break;
+
+            case UNDO_ROOT:
+                if (json_is_object(undo->container)) {
+                    json_object_clear(undo->container);
+                    json_object_update(undo->container, undo->old);
+                } else {
+                    json_array_clear(undo->container);
+                    json_array_extend(undo->container, undo->old);
+                }
+                break;
+        }
+
+        undo_free(undo);
+    }
+}
+
+/* Decode the reference token at *p into patcher->token, and move *p
+   to the slash after it or to end */
+static int next_token(patcher_t *patcher, const char **p, const char *end) {
+    strbuffer_t *token = &patcher->token;
+
+    strbuffer_clear(token);
+    while (*p < end && **p != '/') {
+        char c = *(*p)++;
+
+        if (c == '~') {
+            if (*p == end || (**p != '0' && **p != '1'))
+                return -1;
+            c = *(*p)++ == '0' ? '~' : '/';
+        }
+        if (strbuffer_append_byte(token, c))
+            return -1;
+    }
+    return 0;
+}
+
+/* Parse patcher->token as an index of array. "-" is the index after
+   the last element, which is only valid when adding one. */
+static int parse_index(patcher_t *patcher, const json_t *array, int add,
+                       size_t *index) {
+    const char *token = patcher->token.value;
+    size_t len = patcher->token.length, size = json_array_size(array), i;
+
+    if (add && len == 1 && token[0] == '-') {
+        *index = size;
+        return 0;
+    }
+
+    if (len == 0 || (len > 1 && token[0] == '0'))
+        return -1;
+
+    *index = 0;
+    for (i = 0; i < len; i++) {
+        if (token[i] < '0' || token[i] > '9' || *index > ((size_t)-1 - 9) / 10)
+            return -1;
+        *index = *index * 10 + (size_t)(token[i] - '0');
+    }
+
+    return *index < size + (add ? 1 : 0) ? 0 : -1;
+}
+
+/* Find the container that path refers to a member of, and decode the
+   last reference token of path into patcher->token. *parent is set to
+   NULL if path refers to the root. */
+static int resolve(patcher_t *patcher, const json_t *path, json_t **parent) {
+    const char *p = json_string_value(path), *end = p + json_string_length(path);
+    json_t *json = patcher->root;
+    size_t index;
+
+    *parent = NULL;
+    if (p == end)
+        return 0;
+
+    if (*p != '/') {
+        patch_error(patcher, json_error_invalid_format, "invalid JSON Pointer '%s'",
+                    json_string_value(path));
+        return -1;
+    }
+
+    while (1) {
+        p++;
+        if (next_token(patcher, &p, end)) {
+            patch_error(patcher, json_error_invalid_format, "invalid JSON Pointer '%s'",
+                        json_string_value(path));
+            return -1;
+        }
+
+        if (p == end) {
+            *parent = json;
+            return 0;
+        }
+
+        if (json_is_object(json))
+            json = json_object_getn(json, patcher->token.value, patcher->token.length);
+        else if (json_is_array(json) && !parse_index(patcher, json, 0, &index))
+            json = json_array_get(json, index);
+        else
+            json = NULL;
+
+        if (!json) {
+            patch_error(patcher, json_error_item_not_found, "'%s' not found",
+                        json_string_value(path));
+            return -1;
+        }
+    }
+}
+
+/* Return the value that path refers to, or NULL if there's none */
+static json_t *lookup(patcher_t *patcher, const json_t *path) {
+    json_t *parent, *json = NULL;
+    size_t index;
+
+    if (resolve(patcher, path, &parent))
+        return NULL;
+
+    if (!parent)
+        return patcher->root;
+
+    if (json_is_object(parent))
+        json = json_object_getn(parent, patcher->token.value, patcher->token.length);
+    else if (json_is_array(parent) && !parse_index(patcher, parent, 0, &index))
+        json = json_array_get(parent, index);
+
+    if (!json)
+        patch_error(patcher, json_error_item_not_found, "'%s' not found",
+                    json_string_value(path));
+    return json;
+}
+
+/* The root can't be replaced in place, but its contents can if the
+   value is a container of the same type */
+static int replace_root(patcher_t *patcher, json_t *value) {
+    json_t *root = patcher->root;
+    undo_t *undo;
+    int res;
+
+    if (value == root)
+        return 0;
+
+    if (!(json_is_object(root) && json_is_object(value)) &&
+        !(json_is_array(root) && json_is_array(value))) {
+        patch_error(patcher, json_error_wrong_type,
+                    "the root can only be replaced with a value of the same type");
+        return -1;
+    }
+
+    undo = undo_push(patcher, UNDO_ROOT, root);
+    if (!undo)
+        return -1;
+    undo->old = json_copy(root);
+    if (!undo->old) {
+        undo_drop(patcher);
+        return -1;
+    }
+
+    if (json_is_object(root))
+        res = json_object_clear(root) || json_object_update(root, value);
+    else
+        res = json_array_clear(root) || json_array_extend(root, value);
+
+    if (res) {
+        patch_error(patcher, json_error_out_of_memory, "Out of memory");
+        return -1;
+    }
+    return 0;
+}
+
+/* Add or replace the value at path, stealing the reference to value */
+static int add_value(patcher_t *patcher, const json_t *path, json_t *value,
+                     int replace) {
+    json_t *parent, *old;
+    undo_t *undo;
+    size_t index;
+    int res;
+
+    if (!value) {
+        patch_error(patcher, json_error_out_of_memory, "Out of memory");
+        return -1;
+    }
+
+    if (resolve(patcher, path, &parent))
+        goto error;
+
+    if (!parent) {
+        res = replace_root(patcher, value);
+        json_decref(value);
+        return res;
+    }
+
+    if (json_is_object(parent)) {
+        old = json_object_getn(parent, patcher->token.value, patcher->token.length);
+        if (replace && !old) {
+            patch_error(patcher, json_error_item_not_found, "'%s' not found",
+                        json_string_value(path));
+            goto error;
+        }
+
+        undo = undo_push(patcher, UNDO_SET, parent);
+        if (!undo)
+            goto error;
+        undo->key = jsonp_strndup(patcher->token.value, patcher->token.length);
+        undo->key_len = patcher->token.length;
+        undo->old = json_incref(old);
+        if (!undo->key) {
+            undo_drop(patcher);
+            goto error;
+        }
+        if (json_object_setn_new(parent, undo->key, undo->key_len, value)) {
+            undo_drop(patcher);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (!json_is_array(parent)) {
+        patch_error(patcher, json_error_item_not_found, "'%s' not found",
+                    json_string_value(path));
+        goto error;
+    }
+
+    if (parse_index(patcher, parent, !replace, &index)) {
+        patch_error(patcher, json_error_index_out_of_range,
+                    "'%s' is not a valid array index", json_string_value(path));
+        goto error;
+    }
+
+    undo = undo_push(patcher, replace ? UNDO_SET : UNDO_INSERTED, parent);
+    if (!undo)
+        goto error;
+    undo->index = index;
+    undo->old = json_incref(json_array_get(parent, index));
+
+    if (replace)
+        res = json_array_set_new(parent, index, value);
+    else
+        res = json_array_insert_new(parent, index, value);
+    if (res) {
+        undo_drop(patcher);
+        return -1;
+    }
+    return 0;
+
+error:
+    json_decref(value);
+    return -1;
+}
+
+static int remove_value(patcher_t *patcher, const json_t *path) {
+    json_t *parent, *old = NULL;
+    undo_t *undo;
+    size_t index = 0;
+
+    if (resolve(patcher, path, &parent))
+        return -1;
+
+    if (!parent) {
+        patch_error(patcher, json_error_invalid_argument, "the root can't be removed");
+        return -1;
+    }
+
+    if (json_is_object(parent))
+        old = json_object_getn(parent, patcher->token.value, patcher->token.length);
+    else if (json_is_array(parent) && !parse_index(patcher, parent, 0, &index))
+        old = json_array_get(parent, index);
+
+    if (!old) {
+        patch_error(patcher, json_error_item_not_found, "'%s' not found",
+                    json_string_value(path));
+        return -1;
+    }
+
+    if (json_is_object(parent)) {
+        undo = undo_push(patcher, UNDO_SET, parent);
+        if (!undo)
+            return -1;
+        undo->key = jsonp_strndup(patcher->token.value, patcher->token.length);
+        undo->key_len = patcher->token.length;
+        undo->old = json_incref(old);
+        if (!undo->key) {
+            undo_drop(patcher);
+            return -1;
+        }
+        return json_object_deln(parent, undo->key, undo->key_len);
+    }
+
+    undo = undo_push(patcher, UNDO_REMOVED, parent);
+    if (!undo)
+        return -1;
+    undo->index = index;
+    undo->old = json_incref(old);
+    return json_array_remove(parent, index);
+}
+
+/* Check that from isn't a proper prefix of path, i.e. that a value
+   isn't moved into itself */
+static int moves_into_itself(const json_t *from, const json_t *path) {
+    size_t len = json_string_length(from);
+
+    return len < json_string_length(path) &&
+           !memcmp(json_string_value(from), json_string_value(path), len) &&
+           json_string_value(path)[len] == '/';
+}
+
+static int apply_operation(patcher_t *patcher, const json_t *operation) {
+    const json_t *op, *path, *value, *from;
+    const char *name;
+    json_t *json;
+
+    op = json_object_get(operation, "op");
+    path = json_object_get(operation, "path");
+    if (!json_is_string(op) || !json_is_string(path)) {
+        patch_error(patcher, json_error_wrong_type,
+                    "an operation must be an object with string 'op' and 'path'");
+        return -1;
+    }
+
+    name = json_string_value(op);
+    value = json_object_get(operation, "value");
+    from = json_object_get(operation, "from");
+
+    if (!strcmp(name, "add") || !strcmp(name, "replace") || !strcmp(name, "test")) {
+        if (!value) {
+            patch_error(patcher, json_error_item_not_found,
+                        "'%s' operation without 'value'", name);
+            return -1;
+        }
+    } else if (!strcmp(name, "move") || !strcmp(name, "copy")) {
+        if (!json_is_string(from)) {
+            patch_error(patcher, json_error_item_not_found,
+                        "'%s' operation without string 'from'", name);
+            return -1;
+        }
+    } else if (strcmp(name, "remove")) {
+        patch_error(patcher, json_error_invalid_format, "unknown operation '%s'", name);
+        return -1;
+    }
+
+    switch (name[0]) {
+        case 'a':
+            /* the value is copied, because later operations may
+               change it in the document */
+            return add_value(patcher, path, json_deep_copy(value), 0);
+
+        case 'r':
+            if (name[2] == 'm')
+                return remove_value(patcher, path);
+            return add_value(patcher, path, json_deep_copy(value), 1);
+
+        case 't':
+            json = lookup(patcher, path);
+            if (!json)
+                return -1;
+            if (!json_equal(json, value)) {
+                patch_error(patcher, json_error_test_failed, "test of '%s' failed",
+                            json_string_value(path));
+                return -1;
+            }
+            return 0;
+
+        case 'c':
+            json = lookup(patcher, from);
+            if (!json)
+                return -1;
+            return add_value(patcher, path, json_deep_copy(json), 0);
+
+        default: /* move */
+            if (moves_into_itself(from, path)) {
+                patch_error(patcher, json_error_invalid_argument,
+                            "'%s' can't be moved into itself", json_string_value(from));
+                return -1;
+            }
+
+            json = json_incref(lookup(patcher, from));
+            if (!json)
+                return -1;
+            if (json_equal(from, path)) {
+                json_decref(json);
+                return 0;
+            }
+
+            if (remove_value(patcher, from)) {
+                json_decref(json);
+                return -1;
+            }
+            return add_value(patcher, path, json, 0);
+    }
+}
+
+int json_patch_apply(json_t *json, const json_t *patch, json_error_t *error) {
+    patcher_t patcher;
+    size_t i;
+    int res = 0;
+
+    jsonp_error_init(error, "<patch>");
+
+    if (!json || !json_is_array(patch)) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument,
+                        "wrong arguments");
+        return -1;
+    }
+
+    patcher.root = json;
+    patcher.undo = NULL;
+    patcher.nundo = 0;
+    patcher.undo_size = 0;
+    patcher.index = 0;
+    patcher.error = error;
+    if (strbuffer_init(&patcher.token)) {
+        jsonp_error_set(error, -1, -1, 0, json_error_out_of_memory, "Out of memory");
+        return -1;
+    }
+
+    for (i = 0; i < json_array_size(patch) && !res; i++) {
+        patcher.index = i;
+        res = apply_operation(&patcher, json_array_get(patch, i));
+    }
+
+    /* a patch is applied completely or not at all */
+    if (res)
+        undo_all(&patcher);
+    while (patcher.nundo)
+        undo_free(&patcher.undo[--patcher.nundo]);
+
+    jsonp_free(patcher.undo);
+    strbuffer_close(&patcher.token);
+    return res;
+}
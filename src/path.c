@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <string.h>
+
+#include "jansson.h"
+#include "jansson_private.h"
+
+/*** compiling ***/
+
+/* Parse a reference token as an array index: decimal digits without
+   leading zeros */
+static int parse_index(const char *token, size_t len, size_t *index) {
+    size_t i;
+
+    if (len == 0 || (len > 1 && token[0] == '0'))
+        return -1;
+
+    *index = 0;
+    for (i = 0; i < len; i++) {
+        if (token[i] < '0' || token[i] > '9' || *index > ((size_t)-1 - 9) / 10)
+            return -1;
+        *index = *index * 10 + (size_t)(token[i] - '0');
+    }
+    return 0;
+}
+
+json_path_t *json_path_compile(const char *text, size_t flags, json_error_t *error) {
+    size_t text_len, length = 0, i;
+    json_path_t *path;
+    const char *p;
+    char *out;
+
+    jsonp_error_init(error, "<path>");
+
+    if (!text) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "NULL path");
+        return NULL;
+    }
+
+    text_len = strlen(text);
+    if (text_len && text[0] != '/') {
+        jsonp_error_set(error, 1, 1, 1, json_error_invalid_format, "'/' expected");
+        return NULL;
+    }
+
+    for (p = text; *p; p++) {
+        if (*p == '/')
+            length++;
+        else if (*p == '~' && p[1] != '0' && p[1] != '1') {
+            jsonp_error_set(error, 1, (int)(p - text + 1), p - text + 1,
+                            json_error_invalid_format, "'~' must be followed by 0 or 1");
+            return NULL;
+        }
+    }
+
+    /* The segments are followed by the text and the decoded tokens,
+       which are never longer than the text */
+    path = jsonp_malloc(sizeof(json_path_t) + length * sizeof(jsonp_path_segment_t) +
+                        2 * text_len + 1);
+    if (!path)
+        return NULL;
+
+    path->length = length;
+    path->segments = (jsonp_path_segment_t *)(path + 1);
+    out = (char *)(path->segments + length);
+    memcpy(out, text, text_len + 1);
+    path->text = out;
+    out += text_len + 1;
+
+    for (p = text, i = 0; i < length; i++) {
+        jsonp_path_segment_t *segment = &path->segments[i];
+        const char *token = out;
+        size_t len;
+
+        /* skip the slash, and decode "~0" to '~' and "~1" to '/' */
+        for (p++; *p && *p != '/'; p++) {
+            if (*p == '~')
+                *out++ = *++p == '0' ? '~' : '/';
+            else
+                *out++ = *p;
+        }
+
+        len = out - token;
+        segment->key = json_keyn(token, len);
+        if ((flags & JSON_PATH_WILDCARDS) && len == 1 && token[0] == '*')
+            segment->type = JSONP_PATH_WILDCARD;
+        else if (!parse_index(token, len, &segment->index))
+            segment->type = JSONP_PATH_INDEX;
+        else
+            segment->type = JSONP_PATH_KEY;
+    }
+
+    return path;
+}
+
+void json_path_free(json_path_t *path) { jsonp_free(path); }
+
+/*** evaluation ***/
+
+/* Find the values that the segments refer to in json. The first one
+   is stored in *result. If matches isn't NULL, all of them are
+   appended to it, otherwise the search stops at the first one. */
+static int walk(const json_t *json, const jsonp_path_segment_t *segment, size_t length,
+                json_t *matches, json_t **result) {
+    for (; length; segment++, length--) {
+        if (segment->type == JSONP_PATH_WILDCARD)
+            break;
+
+        if (json_is_object(json))
+            json = json_object_get_key(json, segment->key);
+        else if (json_is_array(json) && segment->type == JSONP_PATH_INDEX)
+            json = json_array_get(json, segment->index);
+        else
+            json = NULL;
+
+        if (!json)
+            return 0;
+    }
+
+    if (!length) {
+        if (!*result)
+            *result = (json_t *)json;
+        return matches ? json_array_append(matches, (json_t *)json) : 0;
+    }
+
+    /* a wildcard, nesting is bounded by the length of the path */
+    if (json_is_object(json)) {
+        void *iter = json_object_iter((json_t *)json);
+
+        while (iter && (matches || !*result)) {
+            if (walk(json_object_iter_value(iter), segment + 1, length - 1, matches,
+                     result))
+                return -1;
+            iter = json_object_iter_next((json_t *)json, iter);
+        }
+    } else if (json_is_array(json)) {
+        size_t i;
+
+        for (i = 0; i < json_array_size(json) && (matches || !*result); i++) {
+            if (walk(json_array_get(json, i), segment + 1, length - 1, matches, result))
+                return -1;
+        }
+    }
+    return 0;
+}
+
+json_t *json_path_eval(const json_t *json, const json_path_t *path) {
+    json_t *result = NULL;
+
+    if (!json || !path)
+        return NULL;
+
+    walk(json, path->segments, path->length, NULL, &result);
+    return result;
+}
+
+json_t *json_path_eval_all(const json_t *json, const json_path_t *path) {
+    json_t *matches, *result = NULL;
+
+    if (!json || !path)
+        return NULL;
+
+    matches = json_array();
+    if (!matches)
+        return NULL;
+
+    if (walk(json, path->segments, path->length, matches, &result)) {
+        json_decref(matches);
+        return NULL;
+    }
+    return matches;
+}
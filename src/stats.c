@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "jansson.h"
+#include "jansson_private.h"
+
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#if JSONP_STATS
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/* C89 allows this to be a macro */
+#undef malloc
+
+/* The counters of each thread are in a block of their own, so that
+   counting needs no atomic operations. json_get_stats() adds up the
+   blocks on a list. Blocks are never freed: when a thread exits, its
+   block is left for the next new thread to continue counting in, so
+   the totals still include the threads that are gone. Without
+   pthreads, the blocks of threads that exit aren't reused. */
+struct stats_block {
+    json_stats_t stats;
+    struct stats_block *next;
+    int in_use;
+};
+
+JSON_THREAD_LOCAL json_stats_t *jsonp_thread_stats = NULL;
+
+static struct stats_block *blocks = NULL;
+static volatile char blocks_lock = 0;
+
+/* Counts of the threads whose block couldn't be allocated */
+static struct stats_block lost_block;
+
+#if JSON_HAVE_ATOMIC_BUILTINS
+#define stats_lock()   while (__atomic_test_and_set(&blocks_lock, __ATOMIC_ACQUIRE))
+#define stats_unlock() __atomic_clear(&blocks_lock, __ATOMIC_RELEASE)
+#define stats_load(counter_) __atomic_load_n(&(counter_), __ATOMIC_RELAXED)
+#else
+#define stats_lock()   while (__sync_lock_test_and_set(&blocks_lock, 1))
+#define stats_unlock() __sync_lock_release(&blocks_lock)
+#define stats_load(counter_) (*(volatile size_t *)&(counter_))
+#endif
+
+#ifdef HAVE_PTHREAD
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+static int have_exit_key = 0;
+
+/* Called when a thread that has a block exits */
+static void release_block(void *block) {
+    stats_lock();
+    ((struct stats_block *)block)->in_use = 0;
+    stats_unlock();
+    jsonp_thread_stats = NULL;
+}
+
+static void create_exit_key(void) {
+    have_exit_key = !pthread_key_create(&exit_key, release_block);
+}
+#endif
+
+json_stats_t *jsonp_stats_register(void) {
+    struct stats_block *block;
+
+    stats_lock();
+    for (block = blocks; block; block = block->next) {
+        if (!block->in_use)
+            break;
+    }
+    if (!block) {
+        /* the allocation functions of the library would count this,
+           and in an arena it would be freed with the arena */
+        block = malloc(sizeof(struct stats_block));
+        if (block) {
+            memset(block, 0, sizeof(struct stats_block));
+            block->next = blocks;
+            blocks = block;
+        }
+    }
+    if (block)
+        block->in_use = 1;
+    stats_unlock();
+
+    if (!block)
+        return &lost_block.stats;
+
+#ifdef HAVE_PTHREAD
+    pthread_once(&exit_key_once, create_exit_key);
+    if (have_exit_key)
+        pthread_setspecific(exit_key, block);
+#endif
+
+    jsonp_thread_stats = &block->stats;
+    return jsonp_thread_stats;
+}
+
+double jsonp_stats_now(void) {
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#elif defined(HAVE_GETTIMEOFDAY)
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec + (double)tv.tv_usec * 1e-6;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+void jsonp_stats_parse(size_t bytes, double start) {
+    json_stats_t *stats = jsonp_stats();
+
+    stats->parse_calls++;
+    stats->parse_bytes += bytes;
+    stats->parse_seconds += jsonp_stats_now() - start;
+}
+
+void jsonp_stats_dump(size_t bytes, double start) {
+    json_stats_t *stats = jsonp_stats();
+
+    stats->dump_calls++;
+    stats->dump_bytes += bytes;
+    stats->dump_seconds += jsonp_stats_now() - start;
+}
+
+static void add_stats(json_stats_t *total, json_stats_t *stats) {
+    size_t i;
+
+    for (i = 0; i < JSON_STATS_CATEGORIES; i++) {
+        total->allocs[i] += stats_load(stats->allocs[i]);
+        total->alloc_bytes[i] += stats_load(stats->alloc_bytes[i]);
+    }
+    total->frees += stats_load(stats->frees);
+    total->rehashes += stats_load(stats->rehashes);
+    total->array_grows += stats_load(stats->array_grows);
+    total->parse_calls += stats_load(stats->parse_calls);
+    total->parse_bytes += stats_load(stats->parse_bytes);
+    total->parse_seconds += stats->parse_seconds;
+    total->dump_calls += stats_load(stats->dump_calls);
+    total->dump_bytes += stats_load(stats->dump_bytes);
+    total->dump_seconds += stats->dump_seconds;
+}
+
+int json_get_stats(json_stats_t *stats) {
+    struct stats_block *block;
+
+    if (!stats)
+        return -1;
+
+    memset(stats, 0, sizeof(json_stats_t));
+
+    /* the counters of other threads may be a little behind */
+    stats_lock();
+    for (block = blocks; block; block = block->next)
+        add_stats(stats, &block->stats);
+    stats_unlock();
+
+    add_stats(stats, &lost_block.stats);
+    return 0;
+}
+
+#else /* JSONP_STATS */
+
+/* Statistics are only kept if they were enabled at build time */
+int json_get_stats(json_stats_t *stats) {
+    if (stats)
+        memset(stats, 0, sizeof(json_stats_t));
+    return -1;
+}
+
+#endif /* JSONP_STATS */
@@ -22,7 +22,7 @@ int strbuffer_init(strbuffer_t *strbuff) {
     strbuff->size = STRBUFFER_MIN_SIZE;
     strbuff->length = 0;
 
-    strbuff->value = jsonp_malloc(strbuff->size);
+    strbuff->value = jsonp_malloc_as(strbuff->size, json_stats_buffers);
     if (!strbuff->value)
         return -1;
 
@@ -70,7 +70,7 @@ int strbuffer_append_bytes(strbuffer_t *strbuff, const char *data, size_t size)
 
         new_size = max(strbuff->size * STRBUFFER_FACTOR, strbuff->length + size + 1);
 
-        new_value = jsonp_malloc(new_size);
+        new_value = jsonp_malloc_as(new_size, json_stats_buffers);
         if (!new_value)
             return -1;
 
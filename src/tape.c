@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <string.h>
+
+#include "jansson.h"
+#include "jansson_private.h"
+#include "tape.h"
+
+/* key is the index of the key entry of an object member, or 0 */
+static json_cursor_t cursor_make(const json_tape_t *tape, size_t index, size_t key) {
+    json_cursor_t cursor;
+
+    cursor.tape = tape;
+    cursor.index = index;
+    cursor.key = key;
+    return cursor;
+}
+
+static json_cursor_t cursor_none(void) { return cursor_make(NULL, 0, 0); }
+
+static int tag_at(const json_tape_t *tape, size_t index) {
+    return TAPE_TAG(tape->entries[index]);
+}
+
+/* Return the index of the entry after the value at index */
+static size_t skip_value(const json_tape_t *tape, size_t index) {
+    uint64_t entry = tape->entries[index];
+
+    switch (TAPE_TAG(entry)) {
+        case '{':
+        case '[':
+            return (size_t)TAPE_PAYLOAD(entry);
+        case 'l':
+        case 'd':
+            return index + 2;
+        default:
+            return index + 1;
+    }
+}
+
+static const char *string_at(const json_tape_t *tape, size_t index, size_t *len) {
+    const char *p = tape->strings + TAPE_PAYLOAD(tape->entries[index]);
+
+    memcpy(len, p, sizeof(size_t));
+    return p + sizeof(size_t);
+}
+
+void json_tape_free(json_tape_t *tape) {
+    if (!tape)
+        return;
+
+    jsonp_free(tape->entries);
+    jsonp_free(tape->strings);
+    jsonp_free(tape);
+}
+
+json_cursor_t json_tape_root(const json_tape_t *tape) {
+    if (!tape)
+        return cursor_none();
+
+    return cursor_make(tape, 0, 0);
+}
+
+int json_cursor_type(json_cursor_t cursor) {
+    if (!cursor.tape)
+        return -1;
+
+    switch (tag_at(cursor.tape, cursor.index)) {
+        case '{':
+            return JSON_OBJECT;
+        case '[':
+            return JSON_ARRAY;
+        case '"':
+            return JSON_STRING;
+        case 'l':
+            return JSON_INTEGER;
+        case 'd':
+            return JSON_REAL;
+        case 't':
+            return JSON_TRUE;
+        case 'f':
+            return JSON_FALSE;
+        default:
+            return JSON_NULL;
+    }
+}
+
+size_t json_cursor_size(json_cursor_t cursor) {
+    const json_tape_t *tape = cursor.tape;
+    int tag;
+
+    if (!tape)
+        return 0;
+
+    tag = tag_at(tape, cursor.index);
+    if (tag != '{' && tag != '[')
+        return 0;
+
+    /* the count is in the closing entry */
+    return (size_t)TAPE_PAYLOAD(tape->entries[skip_value(tape, cursor.index) - 1]);
+}
+
+json_cursor_t json_cursor_first(json_cursor_t cursor) {
+    const json_tape_t *tape = cursor.tape;
+    size_t next = cursor.index + 1;
+
+    if (!tape)
+        return cursor_none();
+
+    switch (tag_at(tape, cursor.index)) {
+        case '[':
+            if (tag_at(tape, next) == ']')
+                return cursor_none();
+            return cursor_make(tape, next, 0);
+
+        case '{':
+            if (tag_at(tape, next) == '}')
+                return cursor_none();
+            return cursor_make(tape, next + 1, next);
+
+        default:
+            return cursor_none();
+    }
+}
+
+json_cursor_t json_cursor_next(json_cursor_t cursor) {
+    const json_tape_t *tape = cursor.tape;
+    size_t next;
+
+    if (!tape)
+        return cursor_none();
+
+    /* the root has no siblings */
+    next = skip_value(tape, cursor.index);
+    if (next >= tape->size)
+        return cursor_none();
+
+    switch (tag_at(tape, next)) {
+        case '}':
+        case ']':
+            return cursor_none();
+        case 'k':
+            return cursor_make(tape, next + 1, next);
+        default:
+            return cursor_make(tape, next, 0);
+    }
+}
+
+json_cursor_t json_cursor_at(json_cursor_t array, size_t index) {
+    json_cursor_t cursor;
+
+    if (json_cursor_type(array) != JSON_ARRAY)
+        return cursor_none();
+
+    cursor = json_cursor_first(array);
+    while (index-- && json_cursor_valid(cursor))
+        cursor = json_cursor_next(cursor);
+
+    return cursor;
+}
+
+json_cursor_t json_cursor_get(json_cursor_t object, const char *key) {
+    if (!key)
+        return cursor_none();
+
+    return json_cursor_getn(object, key, strlen(key));
+}
+
+json_cursor_t json_cursor_getn(json_cursor_t object, const char *key, size_t key_len) {
+    const json_tape_t *tape = object.tape;
+    json_cursor_t result = cursor_none();
+    size_t i;
+
+    if (!key || json_cursor_type(object) != JSON_OBJECT)
+        return result;
+
+    /* like json_loads(), let the last one of duplicate keys win */
+    i = object.index + 1;
+    while (tag_at(tape, i) != '}') {
+        size_t len;
+        const char *k = string_at(tape, i, &len);
+
+        if (len == key_len && !memcmp(k, key, len))
+            result = cursor_make(tape, i + 1, i);
+        i = skip_value(tape, i + 1);
+    }
+
+    return result;
+}
+
+const char *json_cursor_key(json_cursor_t cursor) {
+    size_t len;
+
+    if (!cursor.tape || !cursor.key)
+        return NULL;
+
+    return string_at(cursor.tape, cursor.key, &len);
+}
+
+size_t json_cursor_key_len(json_cursor_t cursor) {
+    size_t len;
+
+    if (!cursor.tape || !cursor.key)
+        return 0;
+
+    string_at(cursor.tape, cursor.key, &len);
+    return len;
+}
+
+const char *json_cursor_string_value(json_cursor_t cursor) {
+    size_t len;
+
+    if (json_cursor_type(cursor) != JSON_STRING)
+        return NULL;
+
+    return string_at(cursor.tape, cursor.index, &len);
+}
+
+size_t json_cursor_string_length(json_cursor_t cursor) {
+    size_t len;
+
+    if (json_cursor_type(cursor) != JSON_STRING)
+        return 0;
+
+    string_at(cursor.tape, cursor.index, &len);
+    return len;
+}
+
+json_int_t json_cursor_integer_value(json_cursor_t cursor) {
+    if (json_cursor_type(cursor) != JSON_INTEGER)
+        return 0;
+
+    return (json_int_t)cursor.tape->entries[cursor.index + 1];
+}
+
+double json_cursor_real_value(json_cursor_t cursor) {
+    double value;
+
+    if (json_cursor_type(cursor) != JSON_REAL)
+        return 0.0;
+
+    memcpy(&value, &cursor.tape->entries[cursor.index + 1], sizeof(double));
+    return value;
+}
+
+double json_cursor_number_value(json_cursor_t cursor) {
+    if (json_cursor_type(cursor) == JSON_INTEGER)
+        return (double)json_cursor_integer_value(cursor);
+    return json_cursor_real_value(cursor);
+}
+
+static json_t *tape_to_value(const json_tape_t *tape, size_t index) {
+    json_cursor_t cursor = cursor_make(tape, index, 0);
+    json_t *json;
+    size_t i, len;
+    const char *str;
+
+    switch (tag_at(tape, index)) {
+        case '{':
+            json = json_object_with_capacity(json_cursor_size(cursor));
+            if (!json)
+                return NULL;
+
+            for (i = index + 1; tag_at(tape, i) != '}'; i = skip_value(tape, i + 1)) {
+                str = string_at(tape, i, &len);
+                if (json_object_setn_new_nocheck(json, str, len,
+                                                 tape_to_value(tape, i + 1))) {
+                    json_decref(json);
+                    return NULL;
+                }
+            }
+            return json;
+
+        case '[':
+            json = json_array_with_capacity(json_cursor_size(cursor));
+            if (!json)
+                return NULL;
+
+            for (i = index + 1; tag_at(tape, i) != ']'; i = skip_value(tape, i)) {
+                if (json_array_append_new(json, tape_to_value(tape, i))) {
+                    json_decref(json);
+                    return NULL;
+                }
+            }
+            return json;
+
+        case '"':
+            str = string_at(tape, index, &len);
+            return json_stringn_nocheck(str, len);
+
+        case 'l':
+            return json_integer((json_int_t)tape->entries[index + 1]);
+
+        case 'd':
+            return json_real(json_cursor_real_value(cursor));
+
+        case 't':
+            return json_true();
+
+        case 'f':
+            return json_false();
+
+        default:
+            return json_null();
+    }
+}
+
+json_t *json_tape_to_value(json_cursor_t cursor) {
+    if (!cursor.tape)
+        return NULL;
+
+    return tape_to_value(cursor.tape, cursor.index);
+}
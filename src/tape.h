@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef TAPE_H
+#define TAPE_H
+
+#include "jansson.h"
+#include "jansson_private_config.h"
+#include <stddef.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+/* A tape is the document as a flat array of 64-bit entries in
+   document order. The top byte of an entry is its tag and the rest is
+   the payload:
+
+     '{', '['  index of the entry after the matching '}' or ']'
+     '}', ']'  number of members or elements
+     'k', '"'  offset of an object key or a string in the string area
+     'l', 'd'  none, the next entry holds the integer or the bits of
+               the real
+     't', 'f', 'n'
+               none
+
+   The string area holds each string as its length (a size_t, not
+   aligned), its bytes and a terminating NUL byte. */
+
+#define TAPE_TAG(entry)            ((int)((entry) >> 56))
+#define TAPE_PAYLOAD(entry)        ((entry) & (((uint64_t)1 << 56) - 1))
+#define TAPE_ENTRY(tag, payload)   (((uint64_t)(tag) << 56) | (uint64_t)(payload))
+#define TAPE_MAX_PAYLOAD           (((uint64_t)1 << 56) - 1)
+
+struct json_tape {
+    uint64_t *entries;
+    size_t size; /* number of entries */
+    char *strings;
+    size_t strings_size;
+};
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "thread.h"
+#include "jansson_private.h"
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/* Threads beyond this are not started by jsonp_run_threads() */
+#define MAX_THREADS 256
+
+#if defined(_WIN32)
+
+int jsonp_mutex_init(jsonp_mutex_t *mutex) {
+    InitializeCriticalSection(mutex);
+    return 0;
+}
+
+void jsonp_mutex_destroy(jsonp_mutex_t *mutex) { DeleteCriticalSection(mutex); }
+void jsonp_mutex_lock(jsonp_mutex_t *mutex) { EnterCriticalSection(mutex); }
+void jsonp_mutex_unlock(jsonp_mutex_t *mutex) { LeaveCriticalSection(mutex); }
+
+int jsonp_cond_init(jsonp_cond_t *cond) {
+    InitializeConditionVariable(cond);
+    return 0;
+}
+
+void jsonp_cond_destroy(jsonp_cond_t *cond) { (void)cond; }
+
+void jsonp_cond_wait(jsonp_cond_t *cond, jsonp_mutex_t *mutex) {
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+void jsonp_cond_broadcast(jsonp_cond_t *cond) { WakeAllConditionVariable(cond); }
+
+size_t jsonp_cpu_count(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (size_t)info.dwNumberOfProcessors : 1;
+}
+
+typedef HANDLE thread_t;
+
+struct thread_start {
+    jsonp_thread_func_t func;
+    void *arg;
+};
+
+static DWORD WINAPI thread_main(LPVOID param) {
+    struct thread_start *start = param;
+    start->func(start->arg);
+    return 0;
+}
+
+static int thread_create(thread_t *thread, struct thread_start *start) {
+    *thread = CreateThread(NULL, 0, thread_main, start, 0, NULL);
+    return *thread ? 0 : -1;
+}
+
+static void thread_join(thread_t thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+#elif defined(HAVE_PTHREAD)
+
+int jsonp_mutex_init(jsonp_mutex_t *mutex) {
+    return pthread_mutex_init(mutex, NULL) ? -1 : 0;
+}
+
+void jsonp_mutex_destroy(jsonp_mutex_t *mutex) { pthread_mutex_destroy(mutex); }
+void jsonp_mutex_lock(jsonp_mutex_t *mutex) { pthread_mutex_lock(mutex); }
+void jsonp_mutex_unlock(jsonp_mutex_t *mutex) { pthread_mutex_unlock(mutex); }
+
+int jsonp_cond_init(jsonp_cond_t *cond) { return pthread_cond_init(cond, NULL) ? -1 : 0; }
+void jsonp_cond_destroy(jsonp_cond_t *cond) { pthread_cond_destroy(cond); }
+
+void jsonp_cond_wait(jsonp_cond_t *cond, jsonp_mutex_t *mutex) {
+    pthread_cond_wait(cond, mutex);
+}
+
+void jsonp_cond_broadcast(jsonp_cond_t *cond) { pthread_cond_broadcast(cond); }
+
+size_t jsonp_cpu_count(void) {
+#if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > 0)
+        return (size_t)count;
+#endif
+    return 1;
+}
+
+typedef pthread_t thread_t;
+
+struct thread_start {
+    jsonp_thread_func_t func;
+    void *arg;
+};
+
+static void *thread_main(void *param) {
+    struct thread_start *start = param;
+    start->func(start->arg);
+    return NULL;
+}
+
+static int thread_create(thread_t *thread, struct thread_start *start) {
+    return pthread_create(thread, NULL, thread_main, start) ? -1 : 0;
+}
+
+static void thread_join(thread_t thread) { pthread_join(thread, NULL); }
+
+#else
+
+int jsonp_mutex_init(jsonp_mutex_t *mutex) {
+    (void)mutex;
+    return 0;
+}
+
+void jsonp_mutex_destroy(jsonp_mutex_t *mutex) { (void)mutex; }
+void jsonp_mutex_lock(jsonp_mutex_t *mutex) { (void)mutex; }
+void jsonp_mutex_unlock(jsonp_mutex_t *mutex) { (void)mutex; }
+
+int jsonp_cond_init(jsonp_cond_t *cond) {
+    (void)cond;
+    return 0;
+}
+
+void jsonp_cond_destroy(jsonp_cond_t *cond) { (void)cond; }
+
+void jsonp_cond_wait(jsonp_cond_t *cond, jsonp_mutex_t *mutex) {
+    (void)cond;
+    (void)mutex;
+}
+
+void jsonp_cond_broadcast(jsonp_cond_t *cond) { (void)cond; }
+
+size_t jsonp_cpu_count(void) { return 1; }
+
+#endif
+
+#if JSONP_HAVE_THREADS
+size_t jsonp_run_threads(size_t nthreads, jsonp_thread_func_t func, void *arg) {
+    thread_t *threads;
+    struct thread_start start;
+    size_t i, started = 0;
+
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+
+    threads = nthreads > 1 ? jsonp_malloc((nthreads - 1) * sizeof(thread_t)) : NULL;
+    start.func = func;
+    start.arg = arg;
+
+    if (threads) {
+        for (started = 0; started < nthreads - 1; started++) {
+            if (thread_create(&threads[started], &start))
+                break;
+        }
+    }
+
+    func(arg);
+
+    for (i = 0; i < started; i++)
+        thread_join(threads[i]);
+
+    jsonp_free(threads);
+    return started + 1;
+}
+#else
+size_t jsonp_run_threads(size_t nthreads, jsonp_thread_func_t func, void *arg) {
+    (void)nthreads;
+    func(arg);
+    return 1;
+}
+#endif
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "jansson_private_config.h"
+#include <stddef.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#define JSONP_HAVE_THREADS 1
+typedef CRITICAL_SECTION jsonp_mutex_t;
+typedef CONDITION_VARIABLE jsonp_cond_t;
+#elif defined(HAVE_PTHREAD)
+#include <pthread.h>
+#define JSONP_HAVE_THREADS 1
+typedef pthread_mutex_t jsonp_mutex_t;
+typedef pthread_cond_t jsonp_cond_t;
+#else
+/* Without threads, everything runs in the calling thread and the
+   locks do nothing */
+#define JSONP_HAVE_THREADS 0
+typedef int jsonp_mutex_t;
+typedef int jsonp_cond_t;
+#endif
+
+typedef void (*jsonp_thread_func_t)(void *arg);
+
+int jsonp_mutex_init(jsonp_mutex_t *mutex);
+void jsonp_mutex_destroy(jsonp_mutex_t *mutex);
+void jsonp_mutex_lock(jsonp_mutex_t *mutex);
+void jsonp_mutex_unlock(jsonp_mutex_t *mutex);
+
+int jsonp_cond_init(jsonp_cond_t *cond);
+void jsonp_cond_destroy(jsonp_cond_t *cond);
+void jsonp_cond_wait(jsonp_cond_t *cond, jsonp_mutex_t *mutex);
+void jsonp_cond_broadcast(jsonp_cond_t *cond);
+
+/* The number of processors online, at least 1 */
+size_t jsonp_cpu_count(void);
+
+/* Run func(arg) on nthreads threads, one of which is the calling
+   thread, and return when all of them have returned. If threads can't
+   be started, func runs on fewer threads, at least on the calling
+   one. Returns the number of threads that were used. */
+size_t jsonp_run_threads(size_t nthreads, jsonp_thread_func_t func, void *arg);
+
+#endif
@@ -6,8 +6,27 @@
  */
 
 #include "utf.h"
+#include <jansson_config.h> /* for JSON_INLINE */
 #include <string.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTF_USE_SSE2 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(UTF_USE_SSE2) && defined(HAVE_AVX2_DISPATCH)
+#define UTF_USE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define UTF_USE_NEON 1
+#include <arm_neon.h>
+#endif
+
 int utf8_encode(int32_t codepoint, char *buffer, size_t *size) {
     if (codepoint < 0)
         return -1;
@@ -137,23 +156,457 @@ const char *utf8_iterate(const char *buffer, size_t bufsize, int32_t *codepoint)
     return buffer + count;
 }
 
-int utf8_check_string(const char *string, size_t length) {
-    size_t i;
+/* Word-at-a-time helpers for the portable code paths. ONES has 0x01
+   in every byte of a size_t, HIGHS has 0x80. */
+#define ONES  ((size_t)-1 / 0xFF)
+#define HIGHS (ONES * 0x80)
 
-    for (i = 0; i < length; i++) {
-        size_t count = utf8_check_first(string[i]);
-        if (count == 0)
-            return 0;
-        else if (count > 1) {
-            if (count > length - i)
-                return 0;
+/* nonzero if some byte of x is less than n, for n <= 0x80 */
+#define has_byte_less(x, n) (((x) - ONES * (n)) & ~(x) & HIGHS)
+
+/* nonzero if some byte of x equals b */
+#define has_byte(x, b) has_byte_less((x) ^ (ONES * (b)), 1)
+
+#ifdef UTF_USE_SSE2
+static JSON_INLINE unsigned int first_bit(unsigned int mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+/* Return the length of the leading run of ASCII bytes */
+static size_t ascii_prefix(const char *buffer, size_t size) {
+    size_t i = 0;
+
+#ifdef UTF_USE_SSE2
+    for (; size - i >= 16; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buffer + i));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(v);
+        if (mask)
+            return i + first_bit(mask);
+    }
+#endif
 
-            if (!utf8_check_full(&string[i], count, NULL))
-                return 0;
+    while (size - i >= sizeof(size_t)) {
+        size_t w;
+        memcpy(&w, buffer + i, sizeof(w));
+        if (w & HIGHS)
+            break;
+        i += sizeof(w);
+    }
+
+    while (i < size && (unsigned char)buffer[i] < 0x80)
+        i++;
+
+    return i;
+}
+
+/* Validate one sequence at a time against the table of well-formed
+   byte sequences in the Unicode standard, skipping ASCII runs in
+   bulk */
+static int check_string_scalar(const char *string, size_t length) {
+    const unsigned char *s = (const unsigned char *)string;
+    size_t i = 0;
+
+    while (i < length) {
+        unsigned char u = s[i], lo = 0x80, hi = 0xBF;
+        size_t count;
 
-            i += count - 1;
+        if (u < 0x80) {
+            i += ascii_prefix(string + i, length - i);
+            continue;
         }
+
+        if (0xC2 <= u && u <= 0xDF)
+            count = 2;
+        else if (0xE0 <= u && u <= 0xEF) {
+            count = 3;
+            if (u == 0xE0)
+                lo = 0xA0; /* overlong */
+            else if (u == 0xED)
+                hi = 0x9F; /* UTF-16 surrogate halves */
+        } else if (0xF0 <= u && u <= 0xF4) {
+            count = 4;
+            if (u == 0xF0)
+                lo = 0x90; /* overlong */
+            else if (u == 0xF4)
+                hi = 0x8F; /* above U+10FFFF */
+        } else
+            return 0;
+
+        if (count > length - i || s[i + 1] < lo || s[i + 1] > hi)
+            return 0;
+        if (count >= 3 && (s[i + 2] & 0xC0) != 0x80)
+            return 0;
+        if (count == 4 && (s[i + 3] & 0xC0) != 0x80)
+            return 0;
+
+        i += count;
     }
 
     return 1;
 }
+
+#if defined(UTF_USE_AVX2) || defined(UTF_USE_NEON)
+/* Tables of the lookup algorithm by Keiser and Lemire, "Validating
+   UTF-8 In Less Than One Instruction Per Byte". Every pair of
+   adjacent bytes is classified by the high nibble of the first byte,
+   the low nibble of the first byte and the high nibble of the second
+   byte. The pair is invalid if the three lookups share an error bit.
+   Whether continuation bytes are where lead bytes require them is
+   checked separately. */
+#define TOO_SHORT      (1 << 0) /* lead byte or ASCII after a lead byte */
+#define TOO_LONG       (1 << 1) /* continuation byte after ASCII */
+#define OVERLONG_3     (1 << 2)
+#define TOO_LARGE      (1 << 3)
+#define SURROGATE      (1 << 4)
+#define OVERLONG_2     (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4     (1 << 6)
+#define TWO_CONTS      (1 << 7) /* continuation byte after continuation byte */
+#define CARRY          (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+static const unsigned char byte_1_high[16] = {
+    /* 0_______ */
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    /* 10______ */
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    /* 1100____ */
+    TOO_SHORT | OVERLONG_2,
+    /* 1101____ */
+    TOO_SHORT,
+    /* 1110____ */
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    /* 1111____ */
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4};
+
+static const unsigned char byte_1_low[16] = {
+    /* ____0000 */
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    /* ____0001 */
+    CARRY | OVERLONG_2,
+    /* ____001_ */
+    CARRY, CARRY,
+    /* ____0100 */
+    CARRY | TOO_LARGE,
+    /* ____0101 to ____1100 */
+    CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+    /* ____1101 */
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    /* ____111_ */
+    CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000};
+
+static const unsigned char byte_2_high[16] = {
+    /* 0_______ */
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_SHORT,
+    /* 1000____ */
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    /* 1001____ */
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    /* 101_____ */
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    /* 11______ */
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT};
+
+/* A lead byte in one of the last three positions of a block is
+   incomplete if it is larger than the corresponding value here */
+static const unsigned char max_complete[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xEF, 0xDF, 0xBF};
+#endif
+
+#ifdef UTF_USE_AVX2
+#define avx2_prev(input, prev_input, n)                                                  \
+    _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev_input, input, 0x21), 16 - n)
+
+__attribute__((target("avx2"))) static int check_string_avx2(const char *string,
+                                                              size_t length) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i high = _mm256_set1_epi8((char)0x80);
+    const __m256i t1h =
+        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)byte_1_high));
+    const __m256i t1l =
+        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)byte_1_low));
+    const __m256i t2h =
+        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)byte_2_high));
+    const __m256i max = _mm256_loadu_si256((const __m256i *)max_complete);
+    __m256i error = _mm256_setzero_si256();
+    __m256i prev_input = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+    char tail[32];
+    size_t i = 0;
+
+    while (1) {
+        __m256i input;
+
+        if (length - i >= 32)
+            input = _mm256_loadu_si256((const __m256i *)(string + i));
+        else {
+            /* pad the last block with ASCII */
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, string + i, length - i);
+            input = _mm256_loadu_si256((const __m256i *)tail);
+        }
+
+        if (!_mm256_movemask_epi8(input)) {
+            /* all ASCII, only a sequence from the previous block may
+               be cut short */
+            error = _mm256_or_si256(error, prev_incomplete);
+            prev_incomplete = _mm256_setzero_si256();
+        } else {
+            __m256i prev1 = avx2_prev(input, prev_input, 1);
+            __m256i prev2 = avx2_prev(input, prev_input, 2);
+            __m256i prev3 = avx2_prev(input, prev_input, 3);
+            __m256i prev1_high = _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble);
+            __m256i input_high = _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble);
+            __m256i special = _mm256_and_si256(
+                _mm256_and_si256(_mm256_shuffle_epi8(t1h, prev1_high),
+                                 _mm256_shuffle_epi8(t1l, _mm256_and_si256(prev1, nibble))),
+                _mm256_shuffle_epi8(t2h, input_high));
+
+            /* bytes 2 and 3 positions after a 3 or 4 byte lead must
+               be continuation bytes; those are exactly the pairs
+               flagged TWO_CONTS */
+            __m256i must23 = _mm256_and_si256(
+                _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8(0xE0 - 0x80)),
+                                _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xF0 - 0x80))),
+                high);
+
+            error = _mm256_or_si256(error, _mm256_xor_si256(must23, special));
+            prev_incomplete = _mm256_subs_epu8(input, max);
+        }
+
+        prev_input = input;
+
+        if (length - i <= 32)
+            break;
+        i += 32;
+    }
+
+    error = _mm256_or_si256(error, prev_incomplete);
+    return _mm256_testz_si256(error, error);
+}
+#endif
+
+#ifdef UTF_USE_NEON
+static int check_string_neon(const char *string, size_t length) {
+    const uint8x16_t nibble = vdupq_n_u8(0x0F);
+    const uint8x16_t high = vdupq_n_u8(0x80);
+    const uint8x16_t t1h = vld1q_u8(byte_1_high);
+    const uint8x16_t t1l = vld1q_u8(byte_1_low);
+    const uint8x16_t t2h = vld1q_u8(byte_2_high);
+    const uint8x16_t max = vld1q_u8(max_complete + 16);
+    uint8x16_t error = vdupq_n_u8(0);
+    uint8x16_t prev_input = vdupq_n_u8(0);
+    uint8x16_t prev_incomplete = vdupq_n_u8(0);
+    uint8_t tail[16];
+    size_t i = 0;
+
+    while (1) {
+        uint8x16_t input;
+
+        if (length - i >= 16)
+            input = vld1q_u8((const uint8_t *)string + i);
+        else {
+            /* pad the last block with ASCII */
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, string + i, length - i);
+            input = vld1q_u8(tail);
+        }
+
+        if (vmaxvq_u8(input) < 0x80) {
+            /* all ASCII, only a sequence from the previous block may
+               be cut short */
+            error = vorrq_u8(error, prev_incomplete);
+            prev_incomplete = vdupq_n_u8(0);
+        } else {
+            uint8x16_t prev1 = vextq_u8(prev_input, input, 16 - 1);
+            uint8x16_t prev2 = vextq_u8(prev_input, input, 16 - 2);
+            uint8x16_t prev3 = vextq_u8(prev_input, input, 16 - 3);
+            uint8x16_t special =
+                vandq_u8(vandq_u8(vqtbl1q_u8(t1h, vshrq_n_u8(prev1, 4)),
+                                  vqtbl1q_u8(t1l, vandq_u8(prev1, nibble))),
+                         vqtbl1q_u8(t2h, vshrq_n_u8(input, 4)));
+
+            /* bytes 2 and 3 positions after a 3 or 4 byte lead must
+               be continuation bytes; those are exactly the pairs
+               flagged TWO_CONTS */
+            uint8x16_t must23 =
+                vandq_u8(vorrq_u8(vqsubq_u8(prev2, vdupq_n_u8(0xE0 - 0x80)),
+                                  vqsubq_u8(prev3, vdupq_n_u8(0xF0 - 0x80))),
+                         high);
+
+            error = vorrq_u8(error, veorq_u8(must23, special));
+            prev_incomplete = vqsubq_u8(input, max);
+        }
+
+        prev_input = input;
+
+        if (length - i <= 16)
+            break;
+        i += 16;
+    }
+
+    error = vorrq_u8(error, prev_incomplete);
+    return vmaxvq_u8(error) == 0;
+}
+#endif
+
+int utf8_check_string(const char *string, size_t length) {
+    /* most strings are ASCII only */
+    size_t i = ascii_prefix(string, length);
+    if (i == length)
+        return 1;
+
+    /* a sequence can't start with a continuation byte, so validation
+       can begin at the first byte that is not ASCII */
+    string += i;
+    length -= i;
+
+#if defined(UTF_USE_AVX2)
+    if (length >= 32 && __builtin_cpu_supports("avx2"))
+        return check_string_avx2(string, length);
+#elif defined(UTF_USE_NEON)
+    if (length >= 16)
+        return check_string_neon(string, length);
+#endif
+    return check_string_scalar(string, length);
+}
+
+static size_t plain_prefix_scalar(const char *buffer, size_t size, int flags) {
+    int slash = flags & UTF8_PLAIN_SLASH;
+    int utf8 = flags & UTF8_PLAIN_UTF8;
+    size_t i = 0;
+
+    while (size - i >= sizeof(size_t)) {
+        size_t w;
+        memcpy(&w, buffer + i, sizeof(w));
+
+        if ((utf8 ? 0 : w & HIGHS) | has_byte_less(w, 0x20) | has_byte(w, '"') |
+            has_byte(w, '\\') | (slash ? has_byte(w, '/') : 0))
+            break;
+
+        i += sizeof(w);
+    }
+
+    for (; i < size; i++) {
+        unsigned char u = (unsigned char)buffer[i];
+        if (u < 0x20 || (!utf8 && u >= 0x80) || u == '"' || u == '\\' ||
+            (slash && u == '/'))
+            break;
+    }
+
+    return i;
+}
+
+#ifdef UTF_USE_SSE2
+/* Bytes below 0x20 and from 0x80 up are both negative when compared
+   as signed 0x20, so one comparison catches control characters and
+   non-ASCII. When slash is not requested, the slash comparison is
+   simply a second comparison with '"'. */
+static size_t plain_prefix_sse2(const char *buffer, size_t size, int flags) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i control = _mm_set1_epi8(0x1F);
+    const __m128i solidus = _mm_set1_epi8(flags & UTF8_PLAIN_SLASH ? '/' : '"');
+    size_t i;
+
+    for (i = 0; size - i >= 16; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buffer + i));
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+        unsigned int mask;
+
+        if (flags & UTF8_PLAIN_UTF8)
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+        else
+            m = _mm_or_si128(m, _mm_cmplt_epi8(v, space));
+
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, solidus));
+        mask = (unsigned int)_mm_movemask_epi8(m);
+        if (mask)
+            return i + first_bit(mask);
+    }
+
+    return i + plain_prefix_scalar(buffer + i, size - i, flags);
+}
+#endif
+
+#ifdef UTF_USE_AVX2
+__attribute__((target("avx2"))) static size_t plain_prefix_avx2(const char *buffer,
+                                                                size_t size, int flags) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i control = _mm256_set1_epi8(0x1F);
+    const __m256i solidus = _mm256_set1_epi8(flags & UTF8_PLAIN_SLASH ? '/' : '"');
+    size_t i;
+
+    for (i = 0; size - i >= 32; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buffer + i));
+        __m256i m =
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash));
+        unsigned int mask;
+
+        if (flags & UTF8_PLAIN_UTF8)
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v));
+        else
+            m = _mm256_or_si256(m, _mm256_cmpgt_epi8(space, v));
+
+        mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_or_si256(m, _mm256_cmpeq_epi8(v, solidus)));
+        if (mask)
+            return i + first_bit(mask);
+    }
+
+    return i + plain_prefix_sse2(buffer + i, size - i, flags);
+}
+#endif
+
+#ifdef UTF_USE_NEON
+static size_t plain_prefix_neon(const char *buffer, size_t size, int flags) {
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t space = vdupq_n_u8(0x20);
+    const uint8x16_t ascii = vdupq_n_u8(flags & UTF8_PLAIN_UTF8 ? 0xFF : 0x7F);
+    const uint8x16_t solidus = vdupq_n_u8(flags & UTF8_PLAIN_SLASH ? '/' : '"');
+    size_t i;
+
+    for (i = 0; size - i >= 16; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)buffer + i);
+        uint8x16_t m =
+            vorrq_u8(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash)),
+                     vorrq_u8(vorrq_u8(vcltq_u8(v, space), vcgtq_u8(v, ascii)),
+                              vceqq_u8(v, solidus)));
+        if (vmaxvq_u8(m))
+            break;
+    }
+
+    return i + plain_prefix_scalar(buffer + i, size - i, flags);
+}
+#endif
+
+size_t utf8_plain_prefix(const char *buffer, size_t size, int flags) {
+#if defined(UTF_USE_AVX2)
+    if (size >= 32 && __builtin_cpu_supports("avx2"))
+        return plain_prefix_avx2(buffer, size, flags);
+#endif
+#if defined(UTF_USE_SSE2)
+    return plain_prefix_sse2(buffer, size, flags);
+#elif defined(UTF_USE_NEON)
+    return plain_prefix_neon(buffer, size, flags);
+#else
+    return plain_prefix_scalar(buffer, size, flags);
+#endif
+}
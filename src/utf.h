@@ -25,4 +25,14 @@ const char *utf8_iterate(const char *buffer, size_t size, int32_t *codepoint);
 
 int utf8_check_string(const char *string, size_t length);
 
+/* Flags for utf8_plain_prefix() */
+#define UTF8_PLAIN_SLASH 0x1 /* '/' ends the run */
+#define UTF8_PLAIN_UTF8  0x2 /* bytes from 0x80 up belong to the run */
+
+/* Return the length of the leading run of bytes in buffer that can
+   appear in a JSON string as is, i.e. that are not control
+   characters, '"' or '\\'. By default the run consists of ASCII
+   only; with UTF8_PLAIN_UTF8 it has to be validated separately. */
+size_t utf8_plain_prefix(const char *buffer, size_t size, int flags);
+
 #endif
@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "jansson_private.h"
+
+#include <string.h>
+
+#include "jansson.h"
+#include "load.h"
+#include "utf.h"
+
+/* json_validate() checks for duplicate keys without allocating as
+   long as the open objects have at most this many keys in total */
+#define VALIDATE_MAX_KEYS 256
+
+typedef struct {
+    const char *key; /* NULL at the start of an object */
+    size_t len;
+} validate_key_t;
+
+/* The state of validate_text(). Containers that are open are kept in
+   a bit stack, and the keys of open objects only if duplicates are
+   rejected. */
+typedef struct {
+    const char *pos;
+    const char *end;
+    size_t flags;
+    unsigned char objects[(JSON_PARSER_MAX_DEPTH + 7) / 8];
+    validate_key_t keys[VALIDATE_MAX_KEYS];
+    size_t nkeys;
+} validator_t;
+
+static void validate_whitespace(validator_t *v) {
+    const char *p = v->pos;
+
+    while (p < v->end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+    v->pos = p;
+}
+
+/* Decode the \uXXXX escape whose u str points to, or return -1 if it
+   doesn't have four hex digits */
+static int32_t validate_unicode_escape(const char *str) {
+    int i;
+
+    for (i = 1; i <= 4; i++) {
+        if (!l_isxdigit(str[i]))
+            return -1;
+    }
+    return decode_unicode_escape(str);
+}
+
+/* Consume the string token at v->pos. *escaped is set if it has any
+   escapes. */
+static int validate_string(validator_t *v, int key, int *escaped) {
+    const char *p = v->pos + 1, *end = v->end;
+    int32_t value, value2;
+
+    *escaped = 0;
+    while (1) {
+        p += utf8_plain_prefix(p, end - p, 0);
+        if (p == end)
+            return -1;
+
+        if (*p == '"')
+            break;
+
+        if ((unsigned char)*p >= 0x80) {
+            /* validate a whole run of UTF-8 text at once */
+            size_t n = utf8_plain_prefix(p, end - p, UTF8_PLAIN_UTF8);
+            if (!utf8_check_string(p, n))
+                return -1;
+            p += n;
+            continue;
+        }
+
+        /* a control character */
+        if (*p != '\\' || ++p == end)
+            return -1;
+
+        *escaped = 1;
+        if (*p != 'u') {
+            if (!*p || !strchr("\"\\/bfnrt", *p))
+                return -1;
+            p++;
+            continue;
+        }
+
+        if (end - p < 5 || (value = validate_unicode_escape(p)) < 0)
+            return -1;
+        p += 5;
+
+        if (0xD800 <= value && value <= 0xDBFF) {
+            if (end - p < 6 || p[0] != '\\' || p[1] != 'u' ||
+                (value2 = validate_unicode_escape(p + 1)) < 0 || value2 < 0xDC00 ||
+                value2 > 0xDFFF)
+                return -1;
+            p += 6;
+        } else if (0xDC00 <= value && value <= 0xDFFF)
+            return -1;
+        else if (!value && (key || !(v->flags & JSON_ALLOW_NUL)))
+            return -1;
+    }
+
+    v->pos = p + 1;
+    return 0;
+}
+
+static int validate_number(validator_t *v) {
+    const char *p = v->pos, *end = v->end;
+    char copy[64];
+    strbuffer_t text;
+    json_int_t integer;
+    double real;
+    int is_real = 0;
+
+    if (*p == '-')
+        p++;
+
+    if (p < end && *p == '0') {
+        p++;
+        if (p < end && l_isdigit(*p))
+            return -1;
+    } else if (p < end && l_isdigit(*p)) {
+        while (p < end && l_isdigit(*p))
+            p++;
+    } else
+        return -1;
+
+    if (p < end && *p == '.') {
+        p++;
+        if (p == end || !l_isdigit(*p))
+            return -1;
+        while (p < end && l_isdigit(*p))
+            p++;
+        is_real = 1;
+    }
+
+    if (p < end && (*p == 'E' || *p == 'e')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-'))
+            p++;
+        if (p == end || !l_isdigit(*p))
+            return -1;
+        while (p < end && l_isdigit(*p))
+            p++;
+        is_real = 1;
+    }
+
+    /* the lexer decodes a non-ASCII byte after a number */
+    if (p < end && (unsigned char)*p >= 0x80)
+        return -1;
+
+    /* check for overflow like the lexer does */
+    text.length = p - v->pos;
+    text.size = 0;
+    if (!is_real && !(v->flags & JSON_DECODE_INT_AS_REAL)) {
+        text.value = (char *)v->pos;
+        if (jsonp_strtoint(&text, &integer))
+            return -1;
+    } else {
+        /* jsonp_strtod() may change its input */
+        if (text.length >= sizeof(copy))
+            return -1;
+        memcpy(copy, v->pos, text.length);
+        copy[text.length] = '\0';
+        text.value = copy;
+        text.size = sizeof(copy);
+        if (jsonp_strtod(&text, &real))
+            return -1;
+    }
+
+    v->pos = p;
+    return 0;
+}
+
+static int validate_literal(validator_t *v, const char *literal, size_t len) {
+    if ((size_t)(v->end - v->pos) < len || memcmp(v->pos, literal, len))
+        return -1;
+    v->pos += len;
+
+    /* the lexer reads the whole identifier */
+    if (v->pos < v->end && l_isalpha(*v->pos))
+        return -1;
+    return 0;
+}
+
+static int validate_scalar(validator_t *v) {
+    int escaped;
+
+    switch (*v->pos) {
+        case '"':
+            return validate_string(v, 0, &escaped);
+        case 't':
+            return validate_literal(v, "true", 4);
+        case 'f':
+            return validate_literal(v, "false", 5);
+        case 'n':
+            return validate_literal(v, "null", 4);
+        default:
+            return validate_number(v);
+    }
+}
+
+static int validate_push_key(validator_t *v, const char *key, size_t len) {
+    if (v->nkeys == VALIDATE_MAX_KEYS)
+        return -1;
+    v->keys[v->nkeys].key = key;
+    v->keys[v->nkeys].len = len;
+    v->nkeys++;
+    return 0;
+}
+
+/* Consume the key of the next member of the innermost open object
+   and the colon after it */
+static int validate_key(validator_t *v) {
+    const char *key = v->pos + 1;
+    size_t i, len;
+    int escaped;
+
+    if (v->pos == v->end || *v->pos != '"' || validate_string(v, 1, &escaped))
+        return -1;
+    len = v->pos - 1 - key;
+
+    if (v->flags & JSON_REJECT_DUPLICATES) {
+        /* only keys without escapes can be compared as they are */
+        if (escaped)
+            return -1;
+        for (i = v->nkeys; v->keys[i - 1].key; i--) {
+            if (v->keys[i - 1].len == len && !memcmp(v->keys[i - 1].key, key, len))
+                return -1;
+        }
+        if (validate_push_key(v, key, len))
+            return -1;
+    }
+
+    validate_whitespace(v);
+    if (v->pos == v->end || *v->pos != ':')
+        return -1;
+    v->pos++;
+    validate_whitespace(v);
+    return 0;
+}
+
+static void validate_close_object(validator_t *v) {
+    if (v->flags & JSON_REJECT_DUPLICATES) {
+        while (v->keys[--v->nkeys].key)
+            ;
+    }
+}
+
+/* Consume the value at v->pos, nested at most max_depth levels deep.
+   Returns 0 if it's valid, or -1 if it's invalid or can't be checked
+   this way, so that the parser has to decide. */
+static int validate_value(validator_t *v, size_t max_depth) {
+    size_t depth = 0;
+    int object;
+
+    while (1) {
+        /* the start of a value */
+        if (++depth > max_depth || v->pos == v->end)
+            return -1;
+
+        if (*v->pos == '{' || *v->pos == '[') {
+            object = *v->pos == '{';
+            if (object) {
+                v->objects[(depth - 1) / 8] |= 1 << (depth - 1) % 8;
+                if ((v->flags & JSON_REJECT_DUPLICATES) && validate_push_key(v, NULL, 0))
+                    return -1;
+            } else
+                v->objects[(depth - 1) / 8] &= ~(1 << (depth - 1) % 8);
+
+            v->pos++;
+            validate_whitespace(v);
+            if (v->pos == v->end || *v->pos != (object ? '}' : ']')) {
+                if (object && validate_key(v))
+                    return -1;
+                continue;
+            }
+
+            v->pos++;
+            if (object)
+                validate_close_object(v);
+        } else if (validate_scalar(v))
+            return -1;
+
+        /* the end of a value, which is a member of the innermost open
+           container */
+        while (1) {
+            if (!--depth)
+                return 0;
+            object = v->objects[(depth - 1) / 8] & (1 << (depth - 1) % 8);
+
+            validate_whitespace(v);
+            if (v->pos == v->end)
+                return -1;
+            if (*v->pos == ',') {
+                v->pos++;
+                validate_whitespace(v);
+                if (object && validate_key(v))
+                    return -1;
+                break;
+            }
+
+            if (*v->pos != (object ? '}' : ']'))
+                return -1;
+            v->pos++;
+            if (object)
+                validate_close_object(v);
+        }
+    }
+}
+
+/* Check that the text at v->pos is valid, following the grammar of
+   parse_text_json() without decoding anything. Returns 0 if it's
+   valid, or -1 if it's invalid or can't be checked this way. */
+static int validate_text(validator_t *v) {
+    size_t max_depth = FLAGS_TO_DEPTH(v->flags);
+
+    if (!max_depth || max_depth > JSON_PARSER_MAX_DEPTH)
+        max_depth = JSON_PARSER_MAX_DEPTH;
+
+    validate_whitespace(v);
+    if (v->pos == v->end)
+        return -1;
+    if (!(v->flags & JSON_DECODE_ANY) && *v->pos != '[' && *v->pos != '{')
+        return -1;
+
+    if (validate_value(v, max_depth))
+        return -1;
+
+    if (!(v->flags & JSON_DISABLE_EOF_CHECK)) {
+        validate_whitespace(v);
+        if (v->pos != v->end)
+            return -1;
+    }
+    return 0;
+}
+
+size_t validate_container(const char *text, const char *end, size_t flags,
+                          size_t max_depth) {
+    validator_t v;
+
+    if (max_depth > JSON_PARSER_MAX_DEPTH)
+        max_depth = JSON_PARSER_MAX_DEPTH;
+
+    v.pos = text;
+    v.end = end;
+    v.flags = flags;
+    v.nkeys = 0;
+    if (validate_value(&v, max_depth))
+        return 0;
+    return v.pos - text;
+}
+
+/* Events are only parsed to find errors */
+static const json_sax_callbacks_t validate_callbacks = {0};
+
+int json_validate(const char *buffer, size_t buflen, size_t flags, json_error_t *error) {
+    validator_t v;
+    json_t *json;
+
+    if (buffer && !(flags & BINARY_FLAGS)) {
+        v.pos = buffer;
+        v.end = buffer + buflen;
+        v.flags = flags;
+        v.nkeys = 0;
+        if (!validate_text(&v)) {
+            jsonp_error_init(error, "<buffer>");
+            if (error)
+                error->position = (int)(v.pos - buffer);
+            return 0;
+        }
+
+        /* parse with the same lexer, without building a tree, to get
+           the parser's error or its verdict on what validate_text()
+           couldn't check */
+        return json_sax_loadb(buffer, buflen, flags, &validate_callbacks, NULL, error);
+    }
+
+    /* binary input, or NULL for the error */
+    json = json_loadb(buffer, buflen, flags, error);
+    if (!json)
+        return -1;
+    json_decref(json);
+    return 0;
+}
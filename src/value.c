@@ -37,32 +37,173 @@ static JSON_INLINE int isnan(double x) { return x != x; }
 static JSON_INLINE int isinf(double x) { return !isnan(x) && isnan(x - x); }
 #endif
 
-json_t *do_deep_copy(const json_t *json, hashtable_t *parents);
+json_t *do_deep_copy(const json_t *json, jsonp_parents_t *parents);
+static int cow_expand(json_t *json);
+static int array_unpack(json_array_t *array);
 
 static JSON_INLINE void json_init(json_t *json, json_type type) {
     json->type = type;
-    json->refcount = 1;
+
+    /* values in an arena are released with the arena, not by
+       reference counting */
+    json->refcount = jsonp_in_arena() ? (size_t)-1 : 1;
+}
+
+/* Values in an arena can't be modified once loading has finished,
+   because their memory can't be released separately. The only other
+   immortal values are true, false and null, which have no setters. */
+static JSON_INLINE int json_is_readonly(const json_t *json) {
+    return json->refcount == (size_t)-1 && !jsonp_in_arena();
+}
+
+/* Containers from json_loadb_lazy() are decoded when they're first
+   used. One that can't be decoded because memory runs out acts as if
+   it were empty, and can't be modified. Likewise, the containers of a
+   copy from json_deep_copy_cow() copy their members when they're
+   first looked at, because the members that are returned may be
+   modified, and the numbers of a packed array are boxed into values.
+   Reading these containers thus writes to them. */
+static JSON_INLINE int object_expand(const json_t *json) {
+    const jsonp_extra_t *extra = json_to_object(json)->extra;
+
+    if (!extra)
+        return 0;
+    if (extra->source)
+        return cow_expand((json_t *)json);
+    return extra->lazy ? jsonp_lazy_expand((json_t *)json, NULL) : 0;
+}
+
+static JSON_INLINE int array_expand(const json_t *json) {
+    const jsonp_extra_t *extra = json_to_array(json)->extra;
+
+    if (!extra)
+        return 0;
+    if (extra->source)
+        return cow_expand((json_t *)json);
+    if (extra->packed)
+        return array_unpack(json_to_array(json));
+    return extra->lazy ? jsonp_lazy_expand((json_t *)json, NULL) : 0;
+}
+
+static jsonp_extra_t **extra_slot(json_t *json) {
+    if (json_is_object(json))
+        return &json_to_object(json)->extra;
+    return &json_to_array(json)->extra;
+}
+
+jsonp_extra_t *jsonp_extra_get(json_t *json) {
+    jsonp_extra_t **slot = extra_slot(json);
+
+    if (!*slot) {
+        *slot = jsonp_malloc(sizeof(jsonp_extra_t));
+        if (!*slot)
+            return NULL;
+        memset(*slot, 0, sizeof(jsonp_extra_t));
+        (*slot)->packed_type = JSON_INTEGER;
+    }
+    return *slot;
+}
+
+void jsonp_extra_trim(json_t *json) {
+    jsonp_extra_t **slot = extra_slot(json), *extra = *slot;
+
+    if (extra && !extra->lazy && !extra->source && !extra->concurrent &&
+        !extra->packed) {
+        jsonp_free(extra);
+        *slot = NULL;
+    }
+}
+
+static void extra_delete(jsonp_extra_t *extra) {
+    if (!extra)
+        return;
+
+    jsonp_free(extra->lazy);
+    json_decref(extra->source);
+    jsonp_free(extra->packed);
+    jsonp_free(extra);
+}
+
+const jsonp_lazy_t *jsonp_lazy(const json_t *json) {
+    if (json_is_object(json))
+        return jsonp_extra(json_to_object(json), lazy);
+    if (json_is_array(json))
+        return jsonp_extra(json_to_array(json), lazy);
+    return NULL;
+}
+
+const json_t *jsonp_cow_source(const json_t *json) {
+    if (json_is_object(json))
+        return jsonp_extra(json_to_object(json), source);
+    if (json_is_array(json))
+        return jsonp_extra(json_to_array(json), source);
+    return NULL;
+}
+
+/* Space for "0x", double the sizeof a pointer for the hex and a terminator. */
+#define LOOP_KEY_LEN (2 + (sizeof(json_t *) * 2) + 1)
+
+void jsonp_parents_init(jsonp_parents_t *parents) {
+    parents->depth = 0;
+    parents->has_deep = 0;
+}
+
+void jsonp_parents_close(jsonp_parents_t *parents) {
+    if (parents->has_deep)
+        hashtable_close(&parents->deep);
 }
 
-int jsonp_loop_check(hashtable_t *parents, const json_t *json, char *key, size_t key_size,
-                     size_t *key_len_out) {
-    size_t key_len = snprintf(key, key_size, "%p", json);
+int jsonp_parents_push(jsonp_parents_t *parents, const json_t *json) {
+    char key[LOOP_KEY_LEN];
+    size_t i, key_len;
+
+    if (parents->depth < JSONP_PARENTS_STACK) {
+        for (i = 0; i < parents->depth; i++) {
+            if (parents->stack[i] == json)
+                return -1;
+        }
+        parents->stack[parents->depth++] = json;
+        return 0;
+    }
+
+    for (i = 0; i < JSONP_PARENTS_STACK; i++) {
+        if (parents->stack[i] == json)
+            return -1;
+    }
 
-    if (key_len_out)
-        *key_len_out = key_len;
+    if (!parents->has_deep) {
+        if (hashtable_init(&parents->deep))
+            return -1;
+        parents->has_deep = 1;
+    }
 
-    if (hashtable_get(parents, key, key_len))
+    key_len = snprintf(key, sizeof(key), "%p", json);
+    if (hashtable_get(&parents->deep, key, key_len) ||
+        hashtable_set(&parents->deep, key, key_len, json_null()))
         return -1;
 
-    return hashtable_set(parents, key, key_len, json_null());
+    parents->depth++;
+    return 0;
+}
+
+void jsonp_parents_pop(jsonp_parents_t *parents, const json_t *json) {
+    char key[LOOP_KEY_LEN];
+    size_t key_len;
+
+    if (--parents->depth >= JSONP_PARENTS_STACK) {
+        key_len = snprintf(key, sizeof(key), "%p", json);
+        hashtable_del(&parents->deep, key, key_len);
+    }
 }
 
 /*** object ***/
 
 extern volatile uint32_t hashtable_seed;
 
-json_t *json_object(void) {
-    json_object_t *object = jsonp_malloc(sizeof(json_object_t));
+json_t *json_object(void) { return json_object_with_capacity(0); }
+
+json_t *json_object_with_capacity(size_t capacity) {
+    json_object_t *object = jsonp_malloc_node(sizeof(json_object_t));
     if (!object)
         return NULL;
 
@@ -72,18 +213,51 @@ json_t *json_object(void) {
     }
 
     json_init(&object->json, JSON_OBJECT);
+    object->hash = 0;
+    object->extra = NULL;
 
     if (hashtable_init(&object->hashtable)) {
-        jsonp_free(object);
+        jsonp_free_node(object, sizeof(json_object_t));
+        return NULL;
+    }
+
+    if (capacity && hashtable_reserve(&object->hashtable, capacity)) {
+        hashtable_close(&object->hashtable);
+        jsonp_free_node(object, sizeof(json_object_t));
         return NULL;
     }
 
     return &object->json;
 }
 
+int json_object_reserve(json_t *json, size_t capacity) {
+    json_object_t *object;
+
+    if (!json_is_object(json) || json_is_readonly(json) || object_expand(json))
+        return -1;
+
+    object = json_to_object(json);
+    if (jsonp_extra(object, concurrent))
+        return jsonp_concurrent_reserve(object, capacity);
+    return hashtable_reserve(&object->hashtable, capacity);
+}
+
+json_t *json_object_concurrent(void) {
+    json_t *json = json_object();
+
+    if (json && jsonp_concurrent_init(json_to_object(json))) {
+        json_decref(json);
+        return NULL;
+    }
+    return json;
+}
+
 static void json_delete_object(json_object_t *object) {
+    if (jsonp_extra(object, concurrent))
+        jsonp_concurrent_close(object);
+    extra_delete(object->extra);
     hashtable_close(&object->hashtable);
-    jsonp_free(object);
+    jsonp_free_node(object, sizeof(json_object_t));
 }
 
 size_t json_object_size(const json_t *json) {
@@ -92,7 +266,16 @@ size_t json_object_size(const json_t *json) {
     if (!json_is_object(json))
         return 0;
 
+    /* a copy from json_deep_copy_cow() has the size of its original */
+    if (jsonp_extra(json_to_object(json), source))
+        return json_object_size(json_to_object(json)->extra->source);
+
+    if (object_expand(json))
+        return 0;
+
     object = json_to_object(json);
+    if (jsonp_extra(object, concurrent))
+        return jsonp_concurrent_size(object);
     return object->hashtable.size;
 }
 
@@ -106,13 +289,43 @@ json_t *json_object_get(const json_t *json, const char *key) {
 json_t *json_object_getn(const json_t *json, const char *key, size_t key_len) {
     json_object_t *object;
 
-    if (!key || !json_is_object(json))
+    if (!key || !json_is_object(json) || object_expand(json))
         return NULL;
 
     object = json_to_object(json);
+    if (jsonp_extra(object, concurrent))
+        return jsonp_concurrent_get(object, key, key_len, hashtable_hash(key, key_len));
     return hashtable_get(&object->hashtable, key, key_len);
 }
 
+json_key_t json_keyn(const char *key, size_t key_len) {
+    json_key_t result;
+
+    if (!hashtable_seed) {
+        /* Autoseed */
+        json_object_seed(0);
+    }
+
+    result.key = key;
+    result.key_len = key ? key_len : 0;
+    result.hash = key ? hashtable_hash(key, key_len) : 0;
+    return result;
+}
+
+json_key_t json_key(const char *key) { return json_keyn(key, key ? strlen(key) : 0); }
+
+json_t *json_object_get_key(const json_t *json, json_key_t key) {
+    json_object_t *object;
+
+    if (!key.key || !json_is_object(json) || object_expand(json))
+        return NULL;
+
+    object = json_to_object(json);
+    if (jsonp_extra(object, concurrent))
+        return jsonp_concurrent_get(object, key.key, key.key_len, key.hash);
+    return hashtable_get_hashed(&object->hashtable, key.key, key.key_len, key.hash);
+}
+
 int json_object_set_new_nocheck(json_t *json, const char *key, json_t *value) {
     if (!key) {
         json_decref(value);
@@ -128,11 +341,14 @@ int json_object_setn_new_nocheck(json_t *json, const char *key, size_t key_len,
     if (!value)
         return -1;
 
-    if (!key || !json_is_object(json) || json == value) {
+    if (!key || !json_is_object(json) || json == value || json_is_readonly(json) ||
+        object_expand(json)) {
         json_decref(value);
         return -1;
     }
     object = json_to_object(json);
+    if (jsonp_extra(object, concurrent))
+        return jsonp_concurrent_set(object, key, key_len, 0, value);
 
     if (hashtable_set(&object->hashtable, key, key_len, value)) {
         json_decref(value);
@@ -142,6 +358,40 @@ int json_object_setn_new_nocheck(json_t *json, const char *key, size_t key_len,
     return 0;
 }
 
+int jsonp_object_set_shared(json_t *json, const char *key, json_t *value) {
+    json_object_t *object;
+
+    if (!value)
+        return -1;
+
+    if (!key || !json_is_object(json) || json == value || json_is_readonly(json) ||
+        object_expand(json)) {
+        json_decref(value);
+        return -1;
+    }
+    object = json_to_object(json);
+    if (jsonp_extra(object, concurrent))
+        return jsonp_concurrent_set(object, key, hashtable_key_to_iter(key)->key_len, 1,
+                                    value);
+
+    if (hashtable_set_shared(&object->hashtable, key, value)) {
+        json_decref(value);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Set a member of a copy with a key that was returned by iterating
+   over the original. A shared key stays shared. */
+static int object_set_iter_key(json_t *json, const char *key, size_t key_len,
+                               json_t *value) {
+    if (hashtable_key_is_shared(key))
+        return jsonp_object_set_shared(json, key, value);
+
+    return json_object_setn_new_nocheck(json, key, key_len, value);
+}
+
 int json_object_set_new(json_t *json, const char *key, json_t *value) {
     if (!key) {
         json_decref(value);
@@ -170,20 +420,31 @@ int json_object_del(json_t *json, const char *key) {
 int json_object_deln(json_t *json, const char *key, size_t key_len) {
     json_object_t *object;
 
-    if (!key || !json_is_object(json))
+    if (!key || !json_is_object(json) || json_is_readonly(json) || object_expand(json))
         return -1;
 
     object = json_to_object(json);
+    if (jsonp_extra(object, concurrent))
+        return jsonp_concurrent_del(object, key, key_len);
     return hashtable_del(&object->hashtable, key, key_len);
 }
 
 int json_object_clear(json_t *json) {
     json_object_t *object;
 
-    if (!json_is_object(json))
+    if (!json_is_object(json) || json_is_readonly(json))
         return -1;
 
+    /* no need to decode what is thrown away */
     object = json_to_object(json);
+    if (jsonp_extra(object, concurrent))
+        return jsonp_concurrent_clear(object);
+    if (object->extra) {
+        jsonp_free(object->extra->lazy);
+        object->extra->lazy = NULL;
+        json_decref(object->extra->source);
+        object->extra->source = NULL;
+    }
     hashtable_clear(&object->hashtable);
 
     return 0;
@@ -197,8 +458,13 @@ int json_object_update(json_t *object, json_t *other) {
     if (!json_is_object(object) || !json_is_object(other))
         return -1;
 
+    /* Keys that are already present make this an overestimate */
+    if (json_object_reserve(object, json_object_size(object) + json_object_size(other)))
+        return -1;
+
+    /* object gets keys of its own, also if those of other are shared */
     json_object_keylen_foreach(other, key, key_len, value) {
-        if (json_object_setn_nocheck(object, key, key_len, value))
+        if (json_object_setn_new_nocheck(object, key, key_len, json_incref(value)))
             return -1;
     }
 
@@ -215,7 +481,7 @@ int json_object_update_existing(json_t *object, json_t *other) {
 
     json_object_keylen_foreach(other, key, key_len, value) {
         if (json_object_getn(object, key, key_len))
-            json_object_setn_nocheck(object, key, key_len, value);
+            json_object_setn_new_nocheck(object, key, key_len, json_incref(value));
     }
 
     return 0;
@@ -231,24 +497,22 @@ int json_object_update_missing(json_t *object, json_t *other) {
 
     json_object_keylen_foreach(other, key, key_len, value) {
         if (!json_object_getn(object, key, key_len))
-            json_object_setn_nocheck(object, key, key_len, value);
+            json_object_setn_new_nocheck(object, key, key_len, json_incref(value));
     }
 
     return 0;
 }
 
-int do_object_update_recursive(json_t *object, json_t *other, hashtable_t *parents) {
+int do_object_update_recursive(json_t *object, json_t *other, jsonp_parents_t *parents) {
     const char *key;
     size_t key_len;
     json_t *value;
-    char loop_key[LOOP_KEY_LEN];
     int res = 0;
-    size_t loop_key_len;
 
     if (!json_is_object(object) || !json_is_object(other))
         return -1;
 
-    if (jsonp_loop_check(parents, other, loop_key, sizeof(loop_key), &loop_key_len))
+    if (jsonp_parents_push(parents, other))
         return -1;
 
     json_object_keylen_foreach(other, key, key_len, value) {
@@ -267,19 +531,18 @@ int do_object_update_recursive(json_t *object, json_t *other, hashtable_t *paren
         }
     }
 
-    hashtable_del(parents, loop_key, loop_key_len);
+    jsonp_parents_pop(parents, other);
 
     return res;
 }
 
 int json_object_update_recursive(json_t *object, json_t *other) {
     int res;
-    hashtable_t parents_set;
+    jsonp_parents_t parents;
 
-    if (hashtable_init(&parents_set))
-        return -1;
-    res = do_object_update_recursive(object, other, &parents_set);
-    hashtable_close(&parents_set);
+    jsonp_parents_init(&parents);
+    res = do_object_update_recursive(object, other, &parents);
+    jsonp_parents_close(&parents);
 
     return res;
 }
@@ -287,7 +550,7 @@ int json_object_update_recursive(json_t *object, json_t *other) {
 void *json_object_iter(json_t *json) {
     json_object_t *object;
 
-    if (!json_is_object(json))
+    if (!json_is_object(json) || object_expand(json))
         return NULL;
 
     object = json_to_object(json);
@@ -297,7 +560,7 @@ void *json_object_iter(json_t *json) {
 void *json_object_iter_at(json_t *json, const char *key) {
     json_object_t *object;
 
-    if (!key || !json_is_object(json))
+    if (!key || !json_is_object(json) || object_expand(json))
         return NULL;
 
     object = json_to_object(json);
@@ -336,22 +599,105 @@ json_t *json_object_iter_value(void *iter) {
 }
 
 int json_object_iter_set_new(json_t *json, void *iter, json_t *value) {
-    if (!json_is_object(json) || !iter || !value) {
+    if (!json_is_object(json) || !iter || !value || json_is_readonly(json)) {
         json_decref(value);
         return -1;
     }
 
+    if (jsonp_extra(json_to_object(json), concurrent))
+        return jsonp_concurrent_set(json_to_object(json), hashtable_iter_key(iter),
+                                    hashtable_iter_key_len(iter),
+                                    hashtable_iter_shared_key(iter) != NULL, value);
+
     hashtable_iter_set(iter, value);
     return 0;
 }
 
 void *json_object_key_to_iter(const char *key) {
-    if (!key)
+    /* A shared key has no pair of its own */
+    if (!key || hashtable_key_is_shared(key))
         return NULL;
 
     return hashtable_key_to_iter(key);
 }
 
+void *json_object_iter_from_key(json_t *json, const char *key) {
+    json_object_t *object;
+
+    if (!key || !json_is_object(json))
+        return NULL;
+
+    object = json_to_object(json);
+    return hashtable_iter_of_key(&object->hashtable, key);
+}
+
+/*** shared keys ***/
+
+json_keys_t *json_keys_new(void) {
+    json_keys_t *keys = jsonp_malloc(sizeof(json_keys_t));
+    if (!keys)
+        return NULL;
+
+    if (!hashtable_seed) {
+        /* Autoseed, as the keys are hashed once when added */
+        json_object_seed(0);
+    }
+
+    hashtable_keys_init(keys);
+    return keys;
+}
+
+void json_keys_free(json_keys_t *keys) {
+    if (!keys)
+        return;
+
+    hashtable_keys_close(keys);
+    jsonp_free(keys);
+}
+
+size_t json_keys_size(const json_keys_t *keys) { return keys ? keys->size : 0; }
+
+json_key_t json_keys_intern(json_keys_t *keys, const char *key, size_t key_len) {
+    json_key_t result;
+    const char *shared = NULL;
+
+    if (keys && key)
+        shared = hashtable_keys_intern(keys, key, key_len);
+
+    result.key = shared;
+    result.key_len = shared ? key_len : 0;
+    result.hash = shared ? hashtable_shared_key(shared)->hash : 0;
+    return result;
+}
+
+int json_object_set_new_interned(json_t *json, json_keys_t *keys, const char *key,
+                                 json_t *value) {
+    if (!key) {
+        json_decref(value);
+        return -1;
+    }
+
+    return json_object_setn_new_interned(json, keys, key, strlen(key), value);
+}
+
+int json_object_setn_new_interned(json_t *json, json_keys_t *keys, const char *key,
+                                  size_t key_len, json_t *value) {
+    const char *shared;
+
+    if (!keys || !key || !json_is_object(json) || !utf8_check_string(key, key_len)) {
+        json_decref(value);
+        return -1;
+    }
+
+    shared = hashtable_keys_intern(keys, key, key_len);
+    if (!shared) {
+        json_decref(value);
+        return -1;
+    }
+
+    return jsonp_object_set_shared(json, shared, value);
+}
+
 static int json_object_equal(const json_t *object1, const json_t *object2) {
     const char *key;
     size_t key_len;
@@ -370,33 +716,41 @@ static int json_object_equal(const json_t *object1, const json_t *object2) {
     return 1;
 }
 
+/* A copy of a concurrent object is an ordinary object, taken while no
+   writer changes the original */
 static json_t *json_object_copy(json_t *object) {
+    json_object_t *source = json_to_object(object);
     json_t *result;
 
     const char *key;
     size_t key_len;
     json_t *value;
 
-    result = json_object();
-    if (!result)
-        return NULL;
+    if (jsonp_extra(source, concurrent))
+        jsonp_concurrent_lock(source);
 
-    json_object_keylen_foreach(object, key, key_len, value)
-        json_object_setn_nocheck(result, key, key_len, value);
+    result = json_object_with_capacity(json_object_size(object));
+    if (result) {
+        json_object_keylen_foreach(object, key, key_len, value)
+            object_set_iter_key(result, key, key_len, json_incref(value));
+    }
 
+    if (jsonp_extra(source, concurrent))
+        jsonp_concurrent_unlock(source);
     return result;
 }
 
-static json_t *json_object_deep_copy(const json_t *object, hashtable_t *parents) {
+static json_t *json_object_deep_copy(const json_t *object, jsonp_parents_t *parents) {
     json_t *result;
     void *iter;
-    char loop_key[LOOP_KEY_LEN];
-    size_t loop_key_len;
 
-    if (jsonp_loop_check(parents, object, loop_key, sizeof(loop_key), &loop_key_len))
+    if (jsonp_parents_push(parents, object))
         return NULL;
 
-    result = json_object();
+    if (jsonp_extra(json_to_object(object), concurrent))
+        jsonp_concurrent_lock(json_to_object(object));
+
+    result = json_object_with_capacity(json_object_size(object));
     if (!result)
         goto out;
 
@@ -411,8 +765,7 @@ static json_t *json_object_deep_copy(const json_t *object, hashtable_t *parents)
         key_len = json_object_iter_key_len(iter);
         value = json_object_iter_value(iter);
 
-        if (json_object_setn_new_nocheck(result, key, key_len,
-                                         do_deep_copy(value, parents))) {
+        if (object_set_iter_key(result, key, key_len, do_deep_copy(value, parents))) {
             json_decref(result);
             result = NULL;
             break;
@@ -421,25 +774,36 @@ static json_t *json_object_deep_copy(const json_t *object, hashtable_t *parents)
     }
 
 out:
-    hashtable_del(parents, loop_key, loop_key_len);
+    if (jsonp_extra(json_to_object(object), concurrent))
+        jsonp_concurrent_unlock(json_to_object(object));
+    jsonp_parents_pop(parents, object);
 
     return result;
 }
 
 /*** array ***/
 
-json_t *json_array(void) {
-    json_array_t *array = jsonp_malloc(sizeof(json_array_t));
+json_t *json_array(void) { return json_array_with_capacity(0); }
+
+json_t *json_array_with_capacity(size_t capacity) {
+    json_array_t *array;
+
+    if (capacity > (size_t)-1 / sizeof(json_t *))
+        return NULL;
+
+    array = jsonp_malloc_node(sizeof(json_array_t));
     if (!array)
         return NULL;
     json_init(&array->json, JSON_ARRAY);
 
+    array->hash = 0;
+    array->extra = NULL;
     array->entries = 0;
-    array->size = 8;
+    array->size = capacity ? capacity : 8;
 
-    array->table = jsonp_malloc(array->size * sizeof(json_t *));
+    array->table = jsonp_malloc_as(array->size * sizeof(json_t *), json_stats_arrays);
     if (!array->table) {
-        jsonp_free(array);
+        jsonp_free_node(array, sizeof(json_array_t));
         return NULL;
     }
 
@@ -449,23 +813,33 @@ json_t *json_array(void) {
 static void json_delete_array(json_array_t *array) {
     size_t i;
 
-    for (i = 0; i < array->entries; i++)
-        json_decref(array->table[i]);
+    if (!jsonp_extra(array, packed)) {
+        for (i = 0; i < array->entries; i++)
+            json_decref(array->table[i]);
+    }
 
+    extra_delete(array->extra);
     jsonp_free(array->table);
-    jsonp_free(array);
+    jsonp_free_node(array, sizeof(json_array_t));
 }
 
 size_t json_array_size(const json_t *json) {
     if (!json_is_array(json))
         return 0;
 
+    /* the size of a packed array is known without boxing it, and a
+       copy from json_deep_copy_cow() has the size of its original */
+    if (jsonp_extra(json_to_array(json), source))
+        return json_array_size(json_to_array(json)->extra->source);
+    if (!jsonp_extra(json_to_array(json), packed) && array_expand(json))
+        return 0;
+
     return json_to_array(json)->entries;
 }
 
 json_t *json_array_get(const json_t *json, size_t index) {
     json_array_t *array;
-    if (!json_is_array(json))
+    if (!json_is_array(json) || array_expand(json))
         return NULL;
     array = json_to_array(json);
 
@@ -481,7 +855,8 @@ int json_array_set_new(json_t *json, size_t index, json_t *value) {
     if (!value)
         return -1;
 
-    if (!json_is_array(json) || json == value) {
+    if (!json_is_array(json) || json == value || json_is_readonly(json) ||
+        array_expand(json)) {
         json_decref(value);
         return -1;
     }
@@ -516,8 +891,10 @@ static json_t **json_array_grow(json_array_t *array, size_t amount, int copy) {
 
     old_table = array->table;
 
+    jsonp_stats_add(array_grows, 1);
+
     new_size = max(array->size + amount, array->size * 2);
-    new_table = jsonp_malloc(new_size * sizeof(json_t *));
+    new_table = jsonp_malloc_as(new_size * sizeof(json_t *), json_stats_arrays);
     if (!new_table)
         return NULL;
 
@@ -533,13 +910,40 @@ static json_t **json_array_grow(json_array_t *array, size_t amount, int copy) {
     return old_table;
 }
 
+int json_array_reserve(json_t *json, size_t capacity) {
+    json_array_t *array;
+    json_t **new_table;
+
+    if (!json_is_array(json) || json_is_readonly(json) || array_expand(json))
+        return -1;
+    array = json_to_array(json);
+
+    if (capacity <= array->size)
+        return 0;
+
+    if (capacity > (size_t)-1 / sizeof(json_t *))
+        return -1;
+
+    new_table = jsonp_malloc_as(capacity * sizeof(json_t *), json_stats_arrays);
+    if (!new_table)
+        return -1;
+
+    array_copy(new_table, 0, array->table, 0, array->entries);
+    jsonp_free(array->table);
+    array->table = new_table;
+    array->size = capacity;
+
+    return 0;
+}
+
 int json_array_append_new(json_t *json, json_t *value) {
     json_array_t *array;
 
     if (!value)
         return -1;
 
-    if (!json_is_array(json) || json == value) {
+    if (!json_is_array(json) || json == value || json_is_readonly(json) ||
+        array_expand(json)) {
         json_decref(value);
         return -1;
     }
@@ -563,7 +967,8 @@ int json_array_insert_new(json_t *json, size_t index, json_t *value) {
     if (!value)
         return -1;
 
-    if (!json_is_array(json) || json == value) {
+    if (!json_is_array(json) || json == value || json_is_readonly(json) ||
+        array_expand(json)) {
         json_decref(value);
         return -1;
     }
@@ -596,7 +1001,7 @@ int json_array_insert_new(json_t *json, size_t index, json_t *value) {
 int json_array_remove(json_t *json, size_t index) {
     json_array_t *array;
 
-    if (!json_is_array(json))
+    if (!json_is_array(json) || json_is_readonly(json) || array_expand(json))
         return -1;
     array = json_to_array(json);
 
@@ -618,9 +1023,23 @@ int json_array_clear(json_t *json) {
     json_array_t *array;
     size_t i;
 
-    if (!json_is_array(json))
+    if (!json_is_array(json) || json_is_readonly(json))
         return -1;
+
+    /* no need to decode what is thrown away */
     array = json_to_array(json);
+    if (array->extra) {
+        jsonp_free(array->extra->lazy);
+        array->extra->lazy = NULL;
+        json_decref(array->extra->source);
+        array->extra->source = NULL;
+    }
+
+    if (jsonp_extra(array, packed)) {
+        jsonp_free(array->extra->packed);
+        array->extra->packed = NULL;
+        array->entries = 0;
+    }
 
     for (i = 0; i < array->entries; i++)
         json_decref(array->table[i]);
@@ -633,7 +1052,8 @@ int json_array_extend(json_t *json, json_t *other_json) {
     json_array_t *array, *other;
     size_t i;
 
-    if (!json_is_array(json) || !json_is_array(other_json))
+    if (!json_is_array(json) || !json_is_array(other_json) || json_is_readonly(json) ||
+        array_expand(json) || array_expand(other_json))
         return -1;
     array = json_to_array(json);
     other = json_to_array(other_json);
@@ -650,6 +1070,308 @@ int json_array_extend(json_t *json, json_t *other_json) {
     return 0;
 }
 
+int json_array_splice_new(json_t *json, size_t index, size_t count,
+                          json_t *const *values, size_t nvalues) {
+    json_array_t *array;
+    json_t **old_table;
+    size_t i, tail;
+
+    for (i = 0; i < nvalues; i++) {
+        if (!values[i] || values[i] == json)
+            goto error;
+    }
+
+    if (!json_is_array(json) || json_is_readonly(json) || array_expand(json))
+        goto error;
+    array = json_to_array(json);
+
+    if (index > array->entries || count > array->entries - index)
+        goto error;
+
+    if (nvalues > count &&
+        nvalues - count > (size_t)-1 / sizeof(json_t *) - array->entries)
+        goto error;
+
+    old_table = array->table;
+    if (nvalues > count) {
+        old_table = json_array_grow(array, nvalues - count, 0);
+        if (!old_table)
+            goto error;
+    }
+
+    for (i = index; i < index + count; i++)
+        json_decref(old_table[i]);
+
+    /* The tail is moved once, however many values come and go */
+    tail = array->entries - index - count;
+    if (old_table != array->table) {
+        array_copy(array->table, 0, old_table, 0, index);
+        array_copy(array->table, index + nvalues, old_table, index + count, tail);
+        jsonp_free(old_table);
+    } else if (nvalues != count)
+        array_move(array, index + nvalues, index + count, tail);
+
+    if (nvalues)
+        array_copy(array->table, index, (json_t **)values, 0, nvalues);
+    array->entries = array->entries - count + nvalues;
+
+    return 0;
+
+error:
+    for (i = 0; i < nvalues; i++)
+        json_decref(values[i]);
+    return -1;
+}
+
+int json_array_remove_range(json_t *json, size_t index, size_t count) {
+    return json_array_splice_new(json, index, count, NULL, 0);
+}
+
+int json_array_filter(json_t *json, json_array_filter_t filter, void *data) {
+    json_array_t *array;
+    size_t i, kept;
+
+    if (!filter || !json_is_array(json) || json_is_readonly(json) ||
+        array_expand(json))
+        return -1;
+    array = json_to_array(json);
+
+    kept = 0;
+    for (i = 0; i < array->entries; i++) {
+        json_t *value = array->table[i];
+
+        if (filter(value, i, data))
+            array->table[kept++] = value;
+        else
+            json_decref(value);
+    }
+
+    array->entries = kept;
+    return 0;
+}
+
+/*** packed arrays ***/
+
+/* The numbers of a packed array are stored next to each other instead
+   of in values of their own. They are boxed into values when the array
+   is used in any other way than reading its size or its numbers. */
+
+#define packed_width(type_)                                                              \
+    ((type_) == JSON_INTEGER ? sizeof(json_int_t) : sizeof(double))
+
+static json_t *packed_box(const json_array_t *array, size_t index) {
+    const jsonp_extra_t *extra = array->extra;
+
+    if (extra->packed_type == JSON_INTEGER)
+        return json_integer(((const json_int_t *)extra->packed)[index]);
+    return json_real(((const double *)extra->packed)[index]);
+}
+
+static int array_unpack(json_array_t *array) {
+    json_t **table;
+    size_t i, size = max(array->entries, array->size);
+
+    table = jsonp_malloc_as(size * sizeof(json_t *), json_stats_arrays);
+    if (!table)
+        return -1;
+
+    for (i = 0; i < array->entries; i++) {
+        table[i] = packed_box(array, i);
+        if (!table[i]) {
+            while (i > 0)
+                json_decref(table[--i]);
+            jsonp_free(table);
+            return -1;
+        }
+    }
+
+    jsonp_free(array->table);
+    jsonp_free(array->extra->packed);
+    array->table = table;
+    array->size = size;
+    array->extra->packed = NULL;
+    jsonp_extra_trim(&array->json);
+    return 0;
+}
+
+/* Make room for another number of type at the end of array, which is
+   packed first if it's empty. Returns NULL if it holds anything else. */
+static void *packed_grow(json_array_t *array, int type) {
+    size_t width = packed_width(type), new_size;
+    jsonp_extra_t *extra;
+    void *new_packed;
+
+    if (!jsonp_extra(array, packed)) {
+        if (array->entries || jsonp_extra(array, lazy) || jsonp_extra(array, source))
+            return NULL;
+        extra = jsonp_extra_get(&array->json);
+        if (!extra)
+            return NULL;
+        extra->packed_size = 0;
+        extra->packed_type = type;
+    } else if (array->extra->packed_type != type)
+        return NULL;
+    extra = array->extra;
+
+    if (array->entries == extra->packed_size) {
+        new_size = extra->packed_size ? 2 * extra->packed_size : 8;
+        if (new_size > (size_t)-1 / width)
+            goto failed;
+
+        new_packed = jsonp_malloc_as(new_size * width, json_stats_arrays);
+        if (!new_packed)
+            goto failed;
+
+        if (array->entries)
+            memcpy(new_packed, extra->packed, array->entries * width);
+        jsonp_free(extra->packed);
+        extra->packed = new_packed;
+        extra->packed_size = new_size;
+    }
+
+    return (char *)extra->packed + array->entries * width;
+
+failed:
+    jsonp_extra_trim(&array->json);
+    return NULL;
+}
+
+int jsonp_array_pack_integer(json_t *json, json_int_t value) {
+    json_int_t *slot;
+
+    if (!json_is_array(json) || json_is_readonly(json))
+        return -1;
+
+    slot = packed_grow(json_to_array(json), JSON_INTEGER);
+    if (!slot)
+        return -1;
+
+    *slot = value;
+    json_to_array(json)->entries++;
+    return 0;
+}
+
+int jsonp_array_pack_real(json_t *json, double value) {
+    double *slot;
+
+    if (!json_is_array(json) || json_is_readonly(json) || isnan(value) || isinf(value))
+        return -1;
+
+    slot = packed_grow(json_to_array(json), JSON_REAL);
+    if (!slot)
+        return -1;
+
+    *slot = value;
+    json_to_array(json)->entries++;
+    return 0;
+}
+
+static json_t *json_array_packed(const void *values, size_t count, int type) {
+    size_t width = packed_width(type), size = count ? count : 1;
+    json_array_t *array;
+    jsonp_extra_t *extra;
+    json_t *json;
+
+    if (count > (size_t)-1 / width)
+        return NULL;
+
+    json = json_array();
+    if (!json)
+        return NULL;
+    array = json_to_array(json);
+
+    extra = jsonp_extra_get(json);
+    if (extra)
+        extra->packed = jsonp_malloc_as(size * width, json_stats_arrays);
+    if (!extra || !extra->packed) {
+        json_decref(json);
+        return NULL;
+    }
+
+    if (count)
+        memcpy(extra->packed, values, count * width);
+    extra->packed_size = size;
+    extra->packed_type = type;
+    array->entries = count;
+    return json;
+}
+
+json_t *json_array_of_integers(const json_int_t *values, size_t count) {
+    if (!values && count)
+        return NULL;
+
+    return json_array_packed(values, count, JSON_INTEGER);
+}
+
+json_t *json_array_of_reals(const double *values, size_t count) {
+    size_t i;
+
+    if (!values && count)
+        return NULL;
+
+    for (i = 0; i < count; i++) {
+        if (isnan(values[i]) || isinf(values[i]))
+            return NULL;
+    }
+
+    return json_array_packed(values, count, JSON_REAL);
+}
+
+const json_int_t *json_array_int_data(const json_t *json) {
+    if (!json_is_array(json) || !jsonp_extra(json_to_array(json), packed) ||
+        json_to_array(json)->extra->packed_type != JSON_INTEGER)
+        return NULL;
+
+    return json_to_array(json)->extra->packed;
+}
+
+const double *json_array_real_data(const json_t *json) {
+    if (!json_is_array(json) || !jsonp_extra(json_to_array(json), packed) ||
+        json_to_array(json)->extra->packed_type != JSON_REAL)
+        return NULL;
+
+    return json_to_array(json)->extra->packed;
+}
+
+static int packed_equal(const json_array_t *array1, const json_array_t *array2) {
+    const jsonp_extra_t *extra1 = array1->extra, *extra2 = array2->extra;
+    const double *reals1 = extra1->packed, *reals2 = extra2->packed;
+    size_t i;
+
+    if (extra1->packed_type != extra2->packed_type)
+        return array1->entries == 0;
+
+    if (extra1->packed_type == JSON_INTEGER)
+        return !memcmp(extra1->packed, extra2->packed,
+                       array1->entries * sizeof(json_int_t));
+
+    /* -0.0 == 0.0, so they can't be compared bytewise */
+    for (i = 0; i < array1->entries; i++) {
+        if (reals1[i] != reals2[i])
+            return 0;
+    }
+    return 1;
+}
+
+/* Compare a packed array with one that isn't, of the same size */
+static int packed_equal_boxed(const json_array_t *packed, const json_t *boxed) {
+    const jsonp_extra_t *extra = packed->extra;
+    size_t i;
+
+    for (i = 0; i < packed->entries; i++) {
+        const json_t *value = json_array_get(boxed, i);
+
+        if (extra->packed_type == JSON_INTEGER) {
+            if (!json_is_integer(value) ||
+                json_integer_value(value) != ((const json_int_t *)extra->packed)[i])
+                return 0;
+        } else if (!json_is_real(value) ||
+                   json_real_value(value) != ((const double *)extra->packed)[i])
+            return 0;
+    }
+    return 1;
+}
+
 static int json_array_equal(const json_t *array1, const json_t *array2) {
     size_t i, size;
 
@@ -657,6 +1379,14 @@ static int json_array_equal(const json_t *array1, const json_t *array2) {
     if (size != json_array_size(array2))
         return 0;
 
+    if (jsonp_extra(json_to_array(array1), packed) &&
+        jsonp_extra(json_to_array(array2), packed))
+        return packed_equal(json_to_array(array1), json_to_array(array2));
+    if (jsonp_extra(json_to_array(array1), packed))
+        return packed_equal_boxed(json_to_array(array1), array2);
+    if (jsonp_extra(json_to_array(array2), packed))
+        return packed_equal_boxed(json_to_array(array2), array1);
+
     for (i = 0; i < size; i++) {
         json_t *value1, *value2;
 
@@ -671,10 +1401,15 @@ static int json_array_equal(const json_t *array1, const json_t *array2) {
 }
 
 static json_t *json_array_copy(json_t *array) {
+    const jsonp_extra_t *extra = json_to_array(array)->extra;
     json_t *result;
     size_t i;
 
-    result = json_array();
+    if (extra && extra->packed)
+        return json_array_packed(extra->packed, json_array_size(array),
+                                 extra->packed_type);
+
+    result = json_array_with_capacity(json_array_size(array));
     if (!result)
         return NULL;
 
@@ -684,16 +1419,18 @@ static json_t *json_array_copy(json_t *array) {
     return result;
 }
 
-static json_t *json_array_deep_copy(const json_t *array, hashtable_t *parents) {
+static json_t *json_array_deep_copy(const json_t *array, jsonp_parents_t *parents) {
     json_t *result;
     size_t i;
-    char loop_key[LOOP_KEY_LEN];
-    size_t loop_key_len;
 
-    if (jsonp_loop_check(parents, array, loop_key, sizeof(loop_key), &loop_key_len))
+    /* the numbers of a packed array don't refer to anything */
+    if (jsonp_extra(json_to_array(array), packed))
+        return json_array_copy((json_t *)array);
+
+    if (jsonp_parents_push(parents, array))
         return NULL;
 
-    result = json_array();
+    result = json_array_with_capacity(json_array_size(array));
     if (!result)
         goto out;
 
@@ -707,21 +1444,38 @@ static json_t *json_array_deep_copy(const json_t *array, hashtable_t *parents) {
     }
 
 out:
-    hashtable_del(parents, loop_key, loop_key_len);
+    jsonp_parents_pop(parents, array);
 
     return result;
 }
 
 /*** string ***/
 
-static json_t *string_create(const char *value, size_t len, int own) {
+#define STRING_COPY   0
+#define STRING_OWN    1
+#define STRING_BORROW 2
+
+/* Short values are stored right after the json_string_t, so that a
+   string takes only one allocation. It keeps the room if it's later
+   set to a longer value, and the value goes back there if it fits
+   again. */
+#define string_inline(string_) ((char *)((string_) + 1))
+#define string_is_inline(string_)                                                        \
+    ((string_)->room && (string_)->value == string_inline(string_))
+
+static json_t *string_create(const char *value, size_t len, int mode) {
     char *v;
     json_string_t *string;
+    unsigned int room = 0;
 
     if (!value)
         return NULL;
 
-    if (own)
+    /* borrowed values stay where they are */
+    if (mode != STRING_BORROW && len < JSONP_STRING_INLINE_MAX)
+        room = (unsigned int)len + 1;
+
+    if (mode != STRING_COPY || room)
         v = (char *)value;
     else {
         v = jsonp_strndup(value, len);
@@ -729,14 +1483,25 @@ static json_t *string_create(const char *value, size_t len, int own) {
             return NULL;
     }
 
-    string = jsonp_malloc(sizeof(json_string_t));
+    string = jsonp_malloc_node(sizeof(json_string_t) + room);
     if (!string) {
-        jsonp_free(v);
+        if (mode == STRING_OWN || (mode == STRING_COPY && !room))
+            jsonp_free(v);
         return NULL;
     }
     json_init(&string->json, JSON_STRING);
-    string->value = v;
     string->length = len;
+    string->borrowed = mode == STRING_BORROW;
+    string->room = room;
+
+    if (room) {
+        string->value = string_inline(string);
+        memcpy(string->value, value, len);
+        string->value[len] = '\0';
+        if (mode == STRING_OWN)
+            jsonp_free(v);
+    } else
+        string->value = v;
 
     return &string->json;
 }
@@ -745,16 +1510,20 @@ json_t *json_string_nocheck(const char *value) {
     if (!value)
         return NULL;
 
-    return string_create(value, strlen(value), 0);
+    return string_create(value, strlen(value), STRING_COPY);
 }
 
 json_t *json_stringn_nocheck(const char *value, size_t len) {
-    return string_create(value, len, 0);
+    return string_create(value, len, STRING_COPY);
 }
 
 /* this is private; "steal" is not a public API concept */
 json_t *jsonp_stringn_nocheck_own(const char *value, size_t len) {
-    return string_create(value, len, 1);
+    return string_create(value, len, STRING_OWN);
+}
+
+json_t *jsonp_stringn_nocheck_borrow(const char *value, size_t len) {
+    return string_create(value, len, STRING_BORROW);
 }
 
 json_t *json_string(const char *value) {
@@ -796,17 +1565,26 @@ int json_string_setn_nocheck(json_t *json, const char *value, size_t len) {
     char *dup;
     json_string_t *string;
 
-    if (!json_is_string(json) || !value)
+    if (!json_is_string(json) || !value || json_is_readonly(json))
         return -1;
+    string = json_to_string(json);
 
-    dup = jsonp_strndup(value, len);
-    if (!dup)
-        return -1;
+    if (len < string->room) {
+        /* value may be a part of the old value */
+        dup = string_inline(string);
+        memmove(dup, value, len);
+        dup[len] = '\0';
+    } else {
+        dup = jsonp_strndup(value, len);
+        if (!dup)
+            return -1;
+    }
 
-    string = json_to_string(json);
-    jsonp_free(string->value);
+    if (!string->borrowed && string->value != dup && !string_is_inline(string))
+        jsonp_free(string->value);
     string->value = dup;
     string->length = len;
+    string->borrowed = 0;
 
     return 0;
 }
@@ -826,8 +1604,9 @@ int json_string_setn(json_t *json, const char *value, size_t len) {
 }
 
 static void json_delete_string(json_string_t *string) {
-    jsonp_free(string->value);
-    jsonp_free(string);
+    if (!string->borrowed && !string_is_inline(string))
+        jsonp_free(string->value);
+    jsonp_free_node(string, sizeof(json_string_t) + string->room);
 }
 
 static int json_string_equal(const json_t *string1, const json_t *string2) {
@@ -860,7 +1639,7 @@ json_t *json_vsprintf(const char *fmt, va_list ap) {
         goto out;
     }
 
-    buf = jsonp_malloc((size_t)length + 1);
+    buf = jsonp_malloc_as((size_t)length + 1, json_stats_strings);
     if (!buf)
         goto out;
 
@@ -891,7 +1670,7 @@ json_t *json_sprintf(const char *fmt, ...) {
 /*** integer ***/
 
 json_t *json_integer(json_int_t value) {
-    json_integer_t *integer = jsonp_malloc(sizeof(json_integer_t));
+    json_integer_t *integer = jsonp_malloc_node(sizeof(json_integer_t));
     if (!integer)
         return NULL;
     json_init(&integer->json, JSON_INTEGER);
@@ -908,7 +1687,7 @@ json_int_t json_integer_value(const json_t *json) {
 }
 
 int json_integer_set(json_t *json, json_int_t value) {
-    if (!json_is_integer(json))
+    if (!json_is_integer(json) || json_is_readonly(json))
         return -1;
 
     json_to_integer(json)->value = value;
@@ -916,7 +1695,9 @@ int json_integer_set(json_t *json, json_int_t value) {
     return 0;
 }
 
-static void json_delete_integer(json_integer_t *integer) { jsonp_free(integer); }
+static void json_delete_integer(json_integer_t *integer) {
+    jsonp_free_node(integer, sizeof(json_integer_t));
+}
 
 static int json_integer_equal(const json_t *integer1, const json_t *integer2) {
     return json_integer_value(integer1) == json_integer_value(integer2);
@@ -934,7 +1715,7 @@ json_t *json_real(double value) {
     if (isnan(value) || isinf(value))
         return NULL;
 
-    real = jsonp_malloc(sizeof(json_real_t));
+    real = jsonp_malloc_node(sizeof(json_real_t));
     if (!real)
         return NULL;
     json_init(&real->json, JSON_REAL);
@@ -951,7 +1732,7 @@ double json_real_value(const json_t *json) {
 }
 
 int json_real_set(json_t *json, double value) {
-    if (!json_is_real(json) || isnan(value) || isinf(value))
+    if (!json_is_real(json) || isnan(value) || isinf(value) || json_is_readonly(json))
         return -1;
 
     json_to_real(json)->value = value;
@@ -959,7 +1740,9 @@ int json_real_set(json_t *json, double value) {
     return 0;
 }
 
-static void json_delete_real(json_real_t *real) { jsonp_free(real); }
+static void json_delete_real(json_real_t *real) {
+    jsonp_free_node(real, sizeof(json_real_t));
+}
 
 static int json_real_equal(const json_t *real1, const json_t *real2) {
     return json_real_value(real1) == json_real_value(real2);
@@ -1026,6 +1809,144 @@ void json_delete(json_t *json) {
     /* json_delete is not called for true, false or null */
 }
 
+/*** hashing ***/
+
+/* The hashes of containers that can't change are remembered. Other
+   containers can't remember them, because any of the values in them
+   could be modified without them knowing. Frozen documents are read
+   by many threads at once, so the hashes are stored atomically. */
+#if JSON_HAVE_ATOMIC_BUILTINS
+#define hash_load(hash_)         __atomic_load_n(&(hash_), __ATOMIC_RELAXED)
+#define hash_store(hash_, value) __atomic_store_n(&(hash_), value, __ATOMIC_RELAXED)
+#else
+#define hash_load(hash_)         (*(volatile size_t *)&(hash_))
+#define hash_store(hash_, value) (*(volatile size_t *)&(hash_) = (value))
+#endif
+
+static size_t *json_hash_cache(const json_t *json) {
+    if (!json_is_readonly(json))
+        return NULL;
+    if (json_is_object(json))
+        return &json_to_object(json)->hash;
+    if (json_is_array(json))
+        return &json_to_array(json)->hash;
+    return NULL;
+}
+
+static size_t hash_combine(size_t hash1, size_t hash2) {
+    size_t words[2];
+
+    words[0] = hash1;
+    words[1] = hash2;
+    return hashtable_hash((const char *)words, sizeof(words));
+}
+
+static size_t hash_key(const char *key, size_t key_len) {
+    /* shared keys know their hashes */
+    if (hashtable_key_is_shared(key))
+        return hashtable_shared_key(key)->hash;
+    return hashtable_hash(key, key_len);
+}
+
+static size_t json_object_hash(const json_t *object) {
+    size_t hash = 0;
+    void *iter;
+
+    /* the sum doesn't depend on the order of the members */
+    iter = json_object_iter((json_t *)object);
+    while (iter) {
+        const char *key = json_object_iter_key(iter);
+        size_t key_len = json_object_iter_key_len(iter);
+
+        hash += hash_combine(hash_key(key, key_len),
+                             json_hash(json_object_iter_value(iter)));
+        iter = json_object_iter_next((json_t *)object, iter);
+    }
+
+    return hash_combine(hash_combine(JSON_OBJECT, json_object_size(object)), hash);
+}
+
+static size_t hash_integer(json_int_t integer) {
+    return hash_combine(JSON_INTEGER,
+                        hashtable_hash((const char *)&integer, sizeof(integer)));
+}
+
+static size_t hash_real(double real) {
+    /* -0.0 == 0.0 */
+    if (real == 0.0)
+        real = 0.0;
+    return hash_combine(JSON_REAL, hashtable_hash((const char *)&real, sizeof(real)));
+}
+
+/* 0 means that the hash isn't known */
+#define hash_known(hash_) ((hash_) ? (hash_) : 1)
+
+static size_t json_array_hash(const json_t *array) {
+    const json_int_t *integers = json_array_int_data(array);
+    const double *reals = json_array_real_data(array);
+    size_t i, hash, member;
+
+    hash = hash_combine(JSON_ARRAY, json_array_size(array));
+    for (i = 0; i < json_array_size(array); i++) {
+        /* the same as if the numbers of a packed array were boxed */
+        if (integers)
+            member = hash_known(hash_integer(integers[i]));
+        else if (reals)
+            member = hash_known(hash_real(reals[i]));
+        else
+            member = json_hash(json_array_get(array, i));
+        hash = hash_combine(hash, member);
+    }
+
+    return hash;
+}
+
+size_t json_hash(const json_t *json) {
+    size_t *cache, hash;
+
+    if (!json)
+        return 0;
+
+    /* the parts of copy-on-write copies that haven't been copied are
+       equal to their originals */
+    if (jsonp_cow_source(json))
+        json = jsonp_cow_source(json);
+
+    cache = json_hash_cache(json);
+    if (cache) {
+        hash = hash_load(*cache);
+        if (hash)
+            return hash;
+    }
+
+    switch (json_typeof(json)) {
+        case JSON_OBJECT:
+            hash = json_object_hash(json);
+            break;
+        case JSON_ARRAY:
+            hash = json_array_hash(json);
+            break;
+        case JSON_STRING:
+            hash = hash_combine(JSON_STRING, hashtable_hash(json_string_value(json),
+                                                            json_string_length(json)));
+            break;
+        case JSON_INTEGER:
+            hash = hash_integer(json_integer_value(json));
+            break;
+        case JSON_REAL:
+            hash = hash_real(json_real_value(json));
+            break;
+        default:
+            hash = hash_combine(json_typeof(json), 0);
+            break;
+    }
+
+    hash = hash_known(hash);
+    if (cache)
+        hash_store(*cache, hash);
+    return hash;
+}
+
 /*** equality ***/
 
 int json_equal(const json_t *json1, const json_t *json2) {
@@ -1035,10 +1956,22 @@ int json_equal(const json_t *json1, const json_t *json2) {
     if (json_typeof(json1) != json_typeof(json2))
         return 0;
 
+    /* compare the parts of copy-on-write copies that haven't been
+       copied with their originals, without copying them */
+    if (jsonp_cow_source(json1))
+        json1 = jsonp_cow_source(json1);
+    if (jsonp_cow_source(json2))
+        json2 = jsonp_cow_source(json2);
+
     /* this covers true, false and null as they are singletons */
     if (json1 == json2)
         return 1;
 
+    /* compare the hashes of containers that remember them */
+    if (json_hash_cache(json1) && json_hash_cache(json2) &&
+        json_hash(json1) != json_hash(json2))
+        return 0;
+
     switch (json_typeof(json1)) {
         case JSON_OBJECT:
             return json_object_equal(json1, json2);
@@ -1083,17 +2016,16 @@ json_t *json_copy(json_t *json) {
 
 json_t *json_deep_copy(const json_t *json) {
     json_t *res;
-    hashtable_t parents_set;
+    jsonp_parents_t parents;
 
-    if (hashtable_init(&parents_set))
-        return NULL;
-    res = do_deep_copy(json, &parents_set);
-    hashtable_close(&parents_set);
+    jsonp_parents_init(&parents);
+    res = do_deep_copy(json, &parents);
+    jsonp_parents_close(&parents);
 
     return res;
 }
 
-json_t *do_deep_copy(const json_t *json, hashtable_t *parents) {
+json_t *do_deep_copy(const json_t *json, jsonp_parents_t *parents) {
     if (!json)
         return NULL;
 
@@ -1118,3 +2050,203 @@ json_t *do_deep_copy(const json_t *json, hashtable_t *parents) {
             return NULL;
     }
 }
+
+/* A copy of json for json_deep_copy_cow(): an empty container that
+   refers to the original until it's used, or a copy of a scalar */
+static json_t *cow_copy(json_t *json) {
+    const json_t *source = jsonp_cow_source(json);
+    jsonp_extra_t *extra;
+    json_t *result;
+
+    /* don't make copies of copies, which would expand the first copy */
+    if (source)
+        json = (json_t *)source;
+
+    switch (json_typeof(json)) {
+        case JSON_OBJECT:
+            /* writers would change a concurrent object under the copy */
+            if (jsonp_extra(json_to_object(json), concurrent))
+                return json_deep_copy(json);
+            result = json_object();
+            break;
+        case JSON_ARRAY:
+            /* copying the numbers of a packed array is cheap enough */
+            if (jsonp_extra(json_to_array(json), packed))
+                return json_copy(json);
+            result = json_array();
+            break;
+        default:
+            return json_copy(json);
+    }
+
+    if (!result)
+        return NULL;
+    extra = jsonp_extra_get(result);
+    if (!extra) {
+        json_decref(result);
+        return NULL;
+    }
+    extra->source = json_incref(json);
+    return result;
+}
+
+/* Give a container from cow_copy() the members of its original, each
+   of them as another such copy. On error, it's left as it was. */
+static int cow_expand_object(json_object_t *object) {
+    json_t *source = object->extra->source;
+    void *iter;
+
+    object->extra->source = NULL;
+    if (hashtable_reserve(&object->hashtable, json_object_size(source)))
+        goto failed;
+
+    iter = json_object_iter(source);
+    while (iter) {
+        if (object_set_iter_key(&object->json, json_object_iter_key(iter),
+                                json_object_iter_key_len(iter),
+                                cow_copy(json_object_iter_value(iter))))
+            goto failed;
+        iter = json_object_iter_next(source, iter);
+    }
+
+    json_decref(source);
+    jsonp_extra_trim(&object->json);
+    return 0;
+
+failed:
+    hashtable_clear(&object->hashtable);
+    object->extra->source = source;
+    return -1;
+}
+
+static int cow_expand_array(json_array_t *array) {
+    json_t *source = array->extra->source;
+    size_t i, size = json_array_size(source);
+
+    array->extra->source = NULL;
+    if (json_array_reserve(&array->json, size))
+        goto failed;
+
+    for (i = 0; i < size; i++) {
+        if (json_array_append_new(&array->json, cow_copy(json_array_get(source, i))))
+            goto failed;
+    }
+
+    json_decref(source);
+    jsonp_extra_trim(&array->json);
+    return 0;
+
+failed:
+    json_array_clear(&array->json);
+    array->extra->source = source;
+    return -1;
+}
+
+static int cow_expand(json_t *json) {
+    if (json_is_object(json))
+        return cow_expand_object(json_to_object(json));
+    return cow_expand_array(json_to_array(json));
+}
+
+json_t *json_deep_copy_cow(const json_t *json) {
+    if (!json)
+        return NULL;
+
+    return cow_copy((json_t *)json);
+}
+
+/*** freezing ***/
+
+#define json_is_singleton(json_)                                                         \
+    (json_typeof(json_) == JSON_TRUE || json_typeof(json_) == JSON_FALSE ||             \
+     json_typeof(json_) == JSON_NULL)
+
+/* A value can be frozen if nothing but its parent refers to it. The
+   containers from json_loadb_lazy() are decoded here, because readers
+   in other threads would otherwise race to decode them. */
+static int json_can_freeze(json_t *json) {
+    const char *key;
+    json_t *value;
+    size_t i;
+
+    if (json_is_singleton(json))
+        return 1;
+    if (json->refcount != 1)
+        return 0;
+
+    switch (json_typeof(json)) {
+        case JSON_OBJECT:
+            /* a concurrent object is meant to change */
+            if (jsonp_extra(json_to_object(json), concurrent) || object_expand(json))
+                return 0;
+            json_object_foreach(json, key, value) {
+                if (!json_can_freeze(value))
+                    return 0;
+            }
+            break;
+        case JSON_ARRAY:
+            if (array_expand(json))
+                return 0;
+            for (i = 0; i < json_to_array(json)->entries; i++) {
+                if (!json_can_freeze(json_to_array(json)->table[i]))
+                    return 0;
+            }
+            break;
+        default:
+            break;
+    }
+    return 1;
+}
+
+static void json_set_refcount(json_t *json, size_t refcount) {
+    const char *key;
+    json_t *value;
+    size_t i;
+
+    if (json_is_singleton(json))
+        return;
+
+    json->refcount = refcount;
+
+    /* a thawed value can change */
+    if (json_is_object(json))
+        json_to_object(json)->hash = 0;
+    else if (json_is_array(json))
+        json_to_array(json)->hash = 0;
+
+    if (json_is_object(json)) {
+        json_object_foreach(json, key, value)
+            json_set_refcount(value, refcount);
+    } else if (json_is_array(json)) {
+        for (i = 0; i < json_to_array(json)->entries; i++)
+            json_set_refcount(json_to_array(json)->table[i], refcount);
+    }
+}
+
+int json_freeze(json_t *json) {
+    if (!json)
+        return -1;
+
+    if (json_is_singleton(json))
+        return 0;
+
+    /* already frozen, or in an arena */
+    if (json->refcount == (size_t)-1)
+        return -1;
+
+    if (!json_can_freeze(json))
+        return -1;
+
+    /* the same marker as for the values in an arena: reference
+       counting skips them, and the setters refuse to modify them */
+    json_set_refcount(json, (size_t)-1);
+    return 0;
+}
+
+json_t *json_thaw(json_t *json) {
+    if (!json)
+        return NULL;
+
+    json_set_refcount(json, 1);
+    return json;
+}
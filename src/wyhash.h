@@ -0,0 +1,118 @@
+/*
+ * wyhash, by Wang Yi, released into the public domain (The Unlicense).
+ * https://github.com/wangyi-fudan/wyhash
+ *
+ * This is the final version 4 of the hash function, reduced to what
+ * is needed for hashing object keys: the 64-bit multiply-and-mix
+ * primitive, the bulk loop and the default secret.
+ */
+
+#ifndef WYHASH_H
+#define WYHASH_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include <jansson_config.h> /* for JSON_INLINE */
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#pragma intrinsic(_umul128)
+#endif
+
+static const uint64_t wyhash_secret[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+                                          0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+/* 128-bit product of *a and *b, low half in *a and high half in *b */
+static JSON_INLINE void wyhash_mum(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = *a;
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    *a = _umul128(*a, *b, b);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32);
+    uint64_t c = t < rl, lo, hi;
+    lo = t + (rm1 << 32);
+    c += lo < t;
+    hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+static JSON_INLINE uint64_t wyhash_mix(uint64_t a, uint64_t b) {
+    wyhash_mum(&a, &b);
+    return a ^ b;
+}
+
+/* Native byte order reads. The hashes don't need to be portable. */
+static JSON_INLINE uint64_t wyhash_r8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static JSON_INLINE uint64_t wyhash_r4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static JSON_INLINE uint64_t wyhash_r3(const uint8_t *p, size_t k) {
+    return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+static uint64_t wyhash(const void *key, size_t len, uint64_t seed) {
+    const uint8_t *p = (const uint8_t *)key;
+    const uint64_t *secret = wyhash_secret;
+    uint64_t a, b;
+
+    seed ^= wyhash_mix(seed ^ secret[0], secret[1]);
+
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wyhash_r4(p) << 32) | wyhash_r4(p + ((len >> 3) << 2));
+            b = (wyhash_r4(p + len - 4) << 32) | wyhash_r4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = wyhash_r3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wyhash_mix(wyhash_r8(p) ^ secret[1], wyhash_r8(p + 8) ^ seed);
+                see1 = wyhash_mix(wyhash_r8(p + 16) ^ secret[2], wyhash_r8(p + 24) ^ see1);
+                see2 = wyhash_mix(wyhash_r8(p + 32) ^ secret[3], wyhash_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wyhash_mix(wyhash_r8(p) ^ secret[1], wyhash_r8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyhash_r8(p + i - 16);
+        b = wyhash_r8(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    wyhash_mum(&a, &b);
+    return wyhash_mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+#endif
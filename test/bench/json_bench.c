@@ -0,0 +1,839 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/* Benchmarks for the common operations on generated corpora, and on
+   files given on the command line. Each benchmark is run until it
+   takes long enough to time, then timed a few more times, and the
+   median is reported together with the allocations it made. With
+   --json the results are written as JSON, and --compare checks them
+   against such a file written earlier, failing if something got
+   slower or allocates more. Build in release mode for meaningful
+   numbers. */
+
+#ifdef HAVE_CONFIG_H
+#include <jansson_private_config.h>
+#endif
+
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#if defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE)
+#include <sys/resource.h>
+#define HAVE_PEAK_RSS 1
+#endif
+
+#define MAX_FILES   16
+#define MAX_SAMPLES 100
+
+struct config {
+    double min_time; /* seconds that a sample must at least take */
+    int repeat;
+    const char *filter;
+    const char *files[MAX_FILES];
+    int nfiles;
+    int json;
+    const char *compare;
+    double threshold; /* percent */
+} conf;
+
+/*** allocation tracking ***/
+
+/* Each allocation is prefixed with its size, aligned like malloc() */
+typedef union {
+    size_t size;
+    long double ld;
+    void *p;
+} header_t;
+
+static struct {
+    size_t count;
+    size_t bytes;
+    size_t in_use;
+    size_t peak;
+} allocs;
+
+static void *counting_malloc(size_t size) {
+    header_t *header = malloc(sizeof(header_t) + size);
+
+    if (!header)
+        return NULL;
+
+    header->size = size;
+    allocs.count++;
+    allocs.bytes += size;
+    allocs.in_use += size;
+    if (allocs.in_use > allocs.peak)
+        allocs.peak = allocs.in_use;
+    return header + 1;
+}
+
+static void counting_free(void *ptr) {
+    header_t *header;
+
+    if (!ptr)
+        return;
+
+    header = (header_t *)ptr - 1;
+    allocs.in_use -= header->size;
+    free(header);
+}
+
+/*** timing ***/
+
+static double now(void) {
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#elif defined(HAVE_GETTIMEOFDAY)
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec + (double)tv.tv_usec * 1e-6;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* The peak resident set size of the process so far, or -1 */
+static long peak_rss_kb(void) {
+#ifdef HAVE_PEAK_RSS
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage))
+        return -1;
+#ifdef __APPLE__
+    return (long)(usage.ru_maxrss / 1024);
+#else
+    return (long)usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+/*** corpora ***/
+
+struct corpus {
+    char *name;
+    char *text;
+    size_t length;
+    json_t *json;
+    json_t *copy;      /* an equal value for json_equal() */
+    json_t *packed;    /* loaded with json_loadb_packed() */
+    json_t *concurrent; /* json as a concurrent object, if it's an object */
+    const char **keys; /* the keys of json if it's an object */
+    size_t nkeys;
+};
+
+static unsigned long random_state = 1;
+
+/* A deterministic generator, so that each run measures the same data */
+static unsigned long next_random(void) {
+    random_state = random_state * 1103515245UL + 12345UL;
+    return (random_state >> 16) & 0x7fff;
+}
+
+static const char *const words[] = {
+    "request", "served", "cache", "miss", "user", "timeout", "\"quoted\"", "path\\to",
+    "tab\there", "caf\xc3\xa9", "\xe6\xb0\xb4", "\xf0\x9f\x98\x80", "retry", "upstream"};
+
+#define NWORDS (sizeof(words) / sizeof(words[0]))
+
+/* A body of a typical API response. bench_pack() and bench_unpack()
+   build and take apart the same value. */
+#define API_FORMAT                                                                       \
+    "{s:i, s:s, s:s, s:b, s:f, s:{s:s, s:s, s:s}, s:[s, s, s], s:[i, i, i, i], s:n}"
+
+static json_t *api_body(void) {
+    return json_pack(API_FORMAT, "id", 123456, "name", "Jane Doe", "email",
+                     "jane.doe@example.com", "active", 1, "balance", 1234.56, "address",
+                     "street", "123 Main Street", "city", "Springfield", "country", "US",
+                     "tags", "admin", "beta", "newsletter", "scores", 10, 20, 30, 40,
+                     "manager", NULL);
+}
+
+static json_t *numbers(void) {
+    json_t *array = json_array();
+    size_t i;
+
+    for (i = 0; i < 100000; i++) {
+        if (i % 2)
+            json_array_append_new(array, json_integer((json_int_t)next_random() *
+                                                      (json_int_t)next_random()));
+        else
+            json_array_append_new(array, json_real((double)next_random() / 7.0));
+    }
+    return array;
+}
+
+/* Columns of a time series, which json_loadb_packed() packs */
+static json_t *series(void) {
+    json_t *times = json_array(), *values = json_array();
+    size_t i;
+
+    for (i = 0; i < 100000; i++) {
+        json_array_append_new(times, json_integer((json_int_t)1700000000000LL +
+                                                  (json_int_t)i * 1000));
+        json_array_append_new(values, json_real((double)next_random() / 7.0));
+    }
+    return json_pack("{s:o, s:o}", "time", times, "value", values);
+}
+
+static json_t *logs(void) {
+    json_t *array = json_array();
+    static const char *const levels[] = {"debug", "info", "warning", "error"};
+    char message[1024];
+    size_t i;
+
+    for (i = 0; i < 5000; i++) {
+        size_t nwords = 5 + next_random() % 50, j;
+
+        message[0] = '\0';
+        for (j = 0; j < nwords; j++) {
+            strcat(message, words[next_random() % NWORDS]);
+            strcat(message, " ");
+        }
+        json_array_append_new(
+            array, json_pack("{s:I, s:s, s:s, s:s, s:{s:i, s:s}}", "timestamp",
+                             (json_int_t)1700000000000LL + (json_int_t)i * 37, "level",
+                             levels[next_random() % 4], "host", "web-03.example.com",
+                             "message", message, "fields", "status", 200 + (int)(i % 5),
+                             "route", "/api/v1/items"));
+    }
+    return array;
+}
+
+/* Records with large payloads that need no escaping, which
+   json_dumpv() doesn't copy */
+static json_t *blobs(void) {
+    json_t *array = json_array();
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    static char payload[32768 + 1];
+    size_t i, j;
+
+    for (i = 0; i < 100; i++) {
+        for (j = 0; j < sizeof(payload) - 1; j++)
+            payload[j] = alphabet[next_random() % 64];
+        payload[sizeof(payload) - 1] = '\0';
+        json_array_append_new(array, json_pack("{s:i, s:s, s:s}", "id", (int)i, "type",
+                                               "image/png", "data", payload));
+    }
+    return array;
+}
+
+static json_t *deep(void) {
+    json_t *array = json_array();
+    size_t i, j;
+
+    for (i = 0; i < 20; i++) {
+        json_t *value = json_integer((json_int_t)i);
+
+        /* alternating objects and arrays, 1000 levels deep */
+        for (j = 0; j < 1000; j++) {
+            if (j % 2)
+                value = json_pack("{s:o, s:i}", "child", value, "level", (int)j);
+            else
+                value = json_pack("[o, s]", value, "x");
+        }
+        json_array_append_new(array, value);
+    }
+    return array;
+}
+
+static json_t *wide(void) {
+    json_t *object = json_object();
+    char key[32];
+    size_t i;
+
+    for (i = 0; i < 100000; i++) {
+        sprintf(key, "property_%lu_%lu", (unsigned long)i, next_random());
+        json_object_set_new(object, key, json_integer((json_int_t)i));
+    }
+    return object;
+}
+
+static int corpus_init(struct corpus *corpus, const char *name, json_t *json,
+                       char *text) {
+    size_t flags = JSON_COMPACT | JSON_ENCODE_ANY;
+
+    corpus->name = malloc(strlen(name) + 1);
+    if (!corpus->name)
+        return -1;
+    strcpy(corpus->name, name);
+
+    if (!json) {
+        json = json_loads(text, JSON_DECODE_ANY, NULL);
+        if (!json)
+            return -1;
+    }
+    if (!text) {
+        /* kept with the allocator of the library, like the trees */
+        text = json_dumps(json, flags);
+        if (!text)
+            return -1;
+    }
+    corpus->json = json;
+    corpus->text = text;
+    corpus->length = strlen(text);
+    corpus->copy = json_deep_copy(json);
+    corpus->packed = json_loadb_packed(text, corpus->length, JSON_DECODE_ANY, NULL);
+    corpus->concurrent = NULL;
+    corpus->keys = NULL;
+    corpus->nkeys = 0;
+
+    if (json_is_object(json) && json_object_size(json)) {
+        const char *key;
+        json_t *value;
+
+        corpus->keys = malloc(json_object_size(json) * sizeof(const char *));
+        if (!corpus->keys)
+            return -1;
+        json_object_foreach(json, key, value) { corpus->keys[corpus->nkeys++] = key; }
+
+        /* NULL without thread-local storage or atomic operations */
+        corpus->concurrent = json_object_concurrent();
+        if (corpus->concurrent && json_object_update(corpus->concurrent, json))
+            return -1;
+    }
+    return corpus->copy && corpus->packed ? 0 : -1;
+}
+
+static char *load_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    char *text;
+    long size;
+
+    if (!file)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    text = size < 0 ? NULL : counting_malloc((size_t)size + 1);
+    if (text && fread(text, 1, (size_t)size, file) != (size_t)size) {
+        counting_free(text);
+        text = NULL;
+    }
+    if (text)
+        text[size] = '\0';
+
+    fclose(file);
+    return text;
+}
+
+static void corpus_close(struct corpus *corpus) {
+    json_decref(corpus->concurrent);
+    json_decref(corpus->packed);
+    json_decref(corpus->copy);
+    json_decref(corpus->json);
+    counting_free(corpus->text);
+    free(corpus->keys);
+    free(corpus->name);
+}
+
+/*** benchmarks ***/
+
+/* Makes sure that results are used */
+static volatile size_t sink;
+
+static void bench_parse(struct corpus *corpus, size_t iterations) {
+    size_t i;
+    for (i = 0; i < iterations; i++)
+        json_decref(json_loadb(corpus->text, corpus->length, JSON_DECODE_ANY, NULL));
+}
+
+/* The same, reusing the buffers of the decoder between documents */
+static void bench_parse_ctx(struct corpus *corpus, size_t iterations) {
+    json_load_ctx_t *ctx = json_load_ctx_new();
+    size_t i;
+
+    for (i = 0; i < iterations; i++)
+        json_decref(
+            json_loadb_ctx(corpus->text, corpus->length, JSON_DECODE_ANY, ctx, NULL));
+    json_load_ctx_free(ctx);
+}
+
+/* The same, packing the arrays of numbers */
+static void bench_parse_packed(struct corpus *corpus, size_t iterations) {
+    size_t i;
+    for (i = 0; i < iterations; i++)
+        json_decref(
+            json_loadb_packed(corpus->text, corpus->length, JSON_DECODE_ANY, NULL));
+}
+
+/* The same, with every limit checked */
+static void bench_parse_limited(struct corpus *corpus, size_t iterations) {
+    json_load_limits_t limits;
+    size_t i;
+
+    limits.max_bytes = (size_t)-1 / 2;
+    limits.max_values = (size_t)-1;
+    limits.max_string_length = (size_t)-1;
+    limits.max_container_size = (size_t)-1;
+    for (i = 0; i < iterations; i++)
+        json_decref(json_loadb_limited(corpus->text, corpus->length, JSON_DECODE_ANY,
+                                       &limits, NULL));
+}
+
+static void bench_validate(struct corpus *corpus, size_t iterations) {
+    size_t i;
+    for (i = 0; i < iterations; i++)
+        sink +=
+            (size_t)json_validate(corpus->text, corpus->length, JSON_DECODE_ANY, NULL);
+}
+
+static void bench_dump(struct corpus *corpus, size_t iterations) {
+    size_t i;
+    for (i = 0; i < iterations; i++)
+        counting_free(json_dumps(corpus->json, JSON_COMPACT | JSON_ENCODE_ANY));
+}
+
+static void bench_dump_packed(struct corpus *corpus, size_t iterations) {
+    size_t i;
+    for (i = 0; i < iterations; i++)
+        counting_free(json_dumps(corpus->packed, JSON_COMPACT | JSON_ENCODE_ANY));
+}
+
+static void bench_dumpv(struct corpus *corpus, size_t iterations) {
+    size_t i;
+    for (i = 0; i < iterations; i++)
+        json_dumpv_free(json_dumpv(corpus->json, JSON_COMPACT | JSON_ENCODE_ANY));
+}
+
+static void bench_dump_sorted(struct corpus *corpus, size_t iterations) {
+    size_t i;
+    for (i = 0; i < iterations; i++)
+        counting_free(
+            json_dumps(corpus->json, JSON_COMPACT | JSON_ENCODE_ANY | JSON_SORT_KEYS));
+}
+
+static void bench_deep_copy(struct corpus *corpus, size_t iterations) {
+    size_t i;
+    for (i = 0; i < iterations; i++)
+        json_decref(json_deep_copy(corpus->json));
+}
+
+/* A copy-on-write copy in which one member of the root is changed */
+static void bench_cow_copy(struct corpus *corpus, size_t iterations) {
+    size_t i;
+    for (i = 0; i < iterations; i++) {
+        json_t *copy = json_deep_copy_cow(corpus->json);
+
+        if (json_is_object(copy))
+            json_object_set_new(copy, "bench", json_true());
+        else
+            json_array_append_new(copy, json_true());
+        json_decref(copy);
+    }
+}
+
+static void bench_equal(struct corpus *corpus, size_t iterations) {
+    size_t i;
+    for (i = 0; i < iterations; i++)
+        sink += (size_t)json_equal(corpus->json, corpus->copy);
+}
+
+/* One lookup per operation, going through all the keys */
+static void bench_object_get(struct corpus *corpus, size_t iterations) {
+    size_t i;
+    for (i = 0; i < iterations; i++)
+        sink += (size_t)json_object_get(corpus->json, corpus->keys[i % corpus->nkeys]);
+}
+
+/* The same lookups in a concurrent object, each one in a section of its own */
+static void bench_concurrent(struct corpus *corpus, size_t iterations) {
+    size_t i;
+    for (i = 0; i < iterations; i++) {
+        json_concurrent_enter();
+        sink += (size_t)json_object_get(corpus->concurrent,
+                                        corpus->keys[i % corpus->nkeys]);
+        json_concurrent_leave();
+    }
+}
+
+/* One insertion per operation, into an object that is replaced with
+   an empty one once it has all the keys */
+static void bench_object_set(struct corpus *corpus, size_t iterations) {
+    json_t *object = json_object();
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        size_t k = i % corpus->nkeys;
+
+        if (k == 0 && i) {
+            json_decref(object);
+            object = json_object();
+        }
+        json_object_set_new(object, corpus->keys[k], json_integer((json_int_t)i));
+    }
+    json_decref(object);
+}
+
+static void bench_pack(struct corpus *corpus, size_t iterations) {
+    size_t i;
+
+    (void)corpus;
+    for (i = 0; i < iterations; i++)
+        json_decref(api_body());
+}
+
+static void bench_unpack(struct corpus *corpus, size_t iterations) {
+    const char *name, *email, *street, *city, *country, *tags[3];
+    int id, active, scores[4];
+    double balance;
+    size_t i;
+
+    for (i = 0; i < iterations; i++) {
+        json_t *manager;
+
+        if (json_unpack(corpus->json, API_FORMAT, "id", &id, "name", &name, "email",
+                        &email, "active", &active, "balance", &balance, "address",
+                        "street", &street, "city", &city, "country", &country, "tags",
+                        &tags[0], &tags[1], &tags[2], "scores", &scores[0], &scores[1],
+                        &scores[2], &scores[3], "manager", &manager))
+            sink++;
+        sink += (size_t)id;
+    }
+}
+
+#define ANY_CORPUS    0
+#define OBJECT_CORPUS 1 /* needs keys */
+#define API_CORPUS    2
+#define CONCURRENT    3 /* needs keys and concurrent objects */
+
+struct bench {
+    const char *name;
+    void (*run)(struct corpus *corpus, size_t iterations);
+    int corpora;
+    int throughput; /* whether MB/s of text is meaningful */
+};
+
+static const struct bench benches[] = {
+    {"parse", bench_parse, ANY_CORPUS, 1},
+    {"parse_ctx", bench_parse_ctx, ANY_CORPUS, 1},
+    {"parse_packed", bench_parse_packed, ANY_CORPUS, 1},
+    {"parse_limits", bench_parse_limited, ANY_CORPUS, 1},
+    {"validate", bench_validate, ANY_CORPUS, 1},
+    {"dump", bench_dump, ANY_CORPUS, 1},
+    {"dump_packed", bench_dump_packed, ANY_CORPUS, 1},
+    {"dumpv", bench_dumpv, ANY_CORPUS, 1},
+    {"dump_sorted", bench_dump_sorted, ANY_CORPUS, 1},
+    {"deep_copy", bench_deep_copy, ANY_CORPUS, 1},
+    {"cow_copy", bench_cow_copy, ANY_CORPUS, 1},
+    {"equal", bench_equal, ANY_CORPUS, 1},
+    {"object_get", bench_object_get, OBJECT_CORPUS, 0},
+    {"object_set", bench_object_set, OBJECT_CORPUS, 0},
+    {"concurrent", bench_concurrent, CONCURRENT, 0},
+    {"pack", bench_pack, API_CORPUS, 0},
+    {"unpack", bench_unpack, API_CORPUS, 0},
+};
+
+#define NBENCHES (sizeof(benches) / sizeof(benches[0]))
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Run a benchmark and return its results, or NULL if it doesn't
+   apply to the corpus */
+static json_t *measure(const struct bench *bench, struct corpus *corpus) {
+    double samples[MAX_SAMPLES], elapsed, start, median;
+    size_t iterations = 1, count, bytes, peak = 0;
+    char name[256];
+    long rss;
+    int i;
+
+    if ((bench->corpora == OBJECT_CORPUS && !corpus->nkeys) ||
+        (bench->corpora == API_CORPUS && strcmp(corpus->name, "api")) ||
+        (bench->corpora == CONCURRENT && !corpus->concurrent))
+        return NULL;
+
+    sprintf(name, "%.120s/%.120s", corpus->name, bench->name);
+    if (conf.filter && !strstr(name, conf.filter))
+        return NULL;
+
+    /* warm up, and find how many iterations take long enough */
+    while (1) {
+        start = now();
+        bench->run(corpus, iterations);
+        elapsed = now() - start;
+        if (elapsed >= conf.min_time || iterations > (size_t)-1 / 100)
+            break;
+        if (elapsed <= conf.min_time / 100)
+            iterations *= 100;
+        else
+            iterations = (size_t)((double)iterations * conf.min_time * 1.2 / elapsed) + 1;
+    }
+
+    count = allocs.count;
+    bytes = allocs.bytes;
+    for (i = 0; i < conf.repeat; i++) {
+        size_t base = allocs.in_use;
+
+        allocs.peak = base;
+        start = now();
+        bench->run(corpus, iterations);
+        samples[i] = (now() - start) * 1e9 / (double)iterations;
+        if (allocs.peak - base > peak)
+            peak = allocs.peak - base;
+    }
+    count = allocs.count - count;
+    bytes = allocs.bytes - bytes;
+
+    qsort(samples, (size_t)conf.repeat, sizeof(double), compare_doubles);
+    median = samples[conf.repeat / 2];
+    rss = peak_rss_kb();
+
+    return json_pack("{s:s, s:s, s:I, s:I, s:i, s:f, s:f, s:o, s:f, s:f, s:I, s:o}",
+                     "corpus", corpus->name, "op", bench->name, "bytes",
+                     (json_int_t)corpus->length, "iterations", (json_int_t)iterations,
+                     "samples", conf.repeat, "ns_per_op", median, "min_ns_per_op",
+                     samples[0], "mb_per_s",
+                     bench->throughput && median > 0
+                         ? json_real((double)corpus->length * 1e3 / median)
+                         : json_null(),
+                     "allocs_per_op",
+                     (double)count / (double)iterations / (double)conf.repeat,
+                     "alloc_bytes_per_op",
+                     (double)bytes / (double)iterations / (double)conf.repeat,
+                     "peak_heap_bytes", (json_int_t)peak, "peak_rss_kb",
+                     rss < 0 ? json_null() : json_integer(rss));
+}
+
+static void print_header(void) {
+    printf("%-12s %-12s %10s %14s %10s %12s %12s\n", "corpus", "op", "MB/s", "ns/op",
+           "allocs/op", "peak heap", "peak RSS");
+}
+
+static void print_result(const json_t *result) {
+    const json_t *mbps = json_object_get(result, "mb_per_s");
+    const json_t *rss = json_object_get(result, "peak_rss_kb");
+    json_int_t peak = json_integer_value(json_object_get(result, "peak_heap_bytes"));
+    char throughput[32], rss_text[32];
+
+    if (json_is_real(mbps))
+        sprintf(throughput, "%.1f", json_real_value(mbps));
+    else
+        strcpy(throughput, "-");
+    if (json_is_integer(rss))
+        sprintf(rss_text, "%.1f MB", (double)json_integer_value(rss) / 1024.0);
+    else
+        strcpy(rss_text, "-");
+
+    printf("%-12s %-12s %10s %14.1f %10.1f %9.1f KB %12s\n",
+           json_string_value(json_object_get(result, "corpus")),
+           json_string_value(json_object_get(result, "op")), throughput,
+           json_real_value(json_object_get(result, "ns_per_op")),
+           json_real_value(json_object_get(result, "allocs_per_op")),
+           (double)peak / 1024.0, rss_text);
+    fflush(stdout);
+}
+
+/*** comparing ***/
+
+static const json_t *find_result(const json_t *results, const json_t *result) {
+    const json_t *other;
+    size_t i;
+
+    json_array_foreach(results, i, other) {
+        if (json_equal(json_object_get(other, "corpus"),
+                       json_object_get(result, "corpus")) &&
+            json_equal(json_object_get(other, "op"), json_object_get(result, "op")))
+            return other;
+    }
+    return NULL;
+}
+
+/* Whether a metric of result is worse than in baseline by more than
+   the threshold */
+static int regressed(const json_t *result, const json_t *baseline, const char *metric) {
+    const char *corpus = json_string_value(json_object_get(result, "corpus"));
+    const char *op = json_string_value(json_object_get(result, "op"));
+    double value = json_number_value(json_object_get(result, metric));
+    double base = json_number_value(json_object_get(baseline, metric));
+    double change = base > 0 ? (value - base) * 100.0 / base : 0;
+
+    if (change <= conf.threshold)
+        return 0;
+
+    fprintf(stderr, "regression: %s/%s %s %.1f -> %.1f (%+.1f%%)\n", corpus, op, metric,
+            base, value, change);
+    return 1;
+}
+
+/* Returns the number of regressions, or -1 if the baseline can't be
+   read */
+static int compare(const json_t *results) {
+    json_t *baseline_file, *baseline;
+    json_error_t error;
+    const json_t *result;
+    int regressions = 0;
+    size_t i;
+
+    baseline_file = json_load_file(conf.compare, 0, &error);
+    baseline = json_object_get(baseline_file, "results");
+    if (!json_is_array(baseline)) {
+        fprintf(stderr, "unable to read %s: %s\n", conf.compare,
+                baseline_file ? "no results" : error.text);
+        json_decref(baseline_file);
+        return -1;
+    }
+
+    json_array_foreach(results, i, result) {
+        const json_t *base = find_result(baseline, result);
+
+        if (!base)
+            continue;
+        regressions += regressed(result, base, "ns_per_op");
+        regressions += regressed(result, base, "allocs_per_op");
+    }
+
+    fprintf(stderr, "%d regression%s over %.0f%% compared to %s\n", regressions,
+            regressions == 1 ? "" : "s", conf.threshold, conf.compare);
+    json_decref(baseline_file);
+    return regressions;
+}
+
+/*** main ***/
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --time SECONDS     minimum time of each sample (default 0.1)\n"
+            "  --repeat N         samples per benchmark (default 5)\n"
+            "  --quick            one iteration of each, to check that they run\n"
+            "  --filter TEXT      only run benchmarks whose corpus/op contains TEXT\n"
+            "  --file PATH        also use the JSON text in PATH as a corpus\n"
+            "  --json             write the results as JSON\n"
+            "  --compare PATH     compare to the results of an earlier --json run\n"
+            "  --threshold PCT    allowed slowdown for --compare (default 10)\n",
+            prog);
+    exit(2);
+}
+
+static void parse_args(int argc, char *argv[]) {
+    int i;
+
+    conf.min_time = 0.1;
+    conf.repeat = 5;
+    conf.threshold = 10;
+
+    for (i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (!strcmp(arg, "--quick")) {
+            conf.min_time = 0;
+            conf.repeat = 1;
+            continue;
+        }
+        if (!strcmp(arg, "--json")) {
+            conf.json = 1;
+            continue;
+        }
+        if (!value)
+            usage(argv[0]);
+
+        i++;
+        if (!strcmp(arg, "--time"))
+            conf.min_time = atof(value);
+        else if (!strcmp(arg, "--repeat"))
+            conf.repeat = atoi(value);
+        else if (!strcmp(arg, "--filter"))
+            conf.filter = value;
+        else if (!strcmp(arg, "--file") && conf.nfiles < MAX_FILES)
+            conf.files[conf.nfiles++] = value;
+        else if (!strcmp(arg, "--compare"))
+            conf.compare = value;
+        else if (!strcmp(arg, "--threshold"))
+            conf.threshold = atof(value);
+        else
+            usage(argv[0]);
+    }
+
+    if (conf.repeat < 1 || conf.repeat > MAX_SAMPLES || conf.min_time < 0)
+        usage(argv[0]);
+}
+
+int main(int argc, char *argv[]) {
+    struct corpus corpora[7 + MAX_FILES];
+    json_t *results, *output;
+    size_t ncorpora = 0, i, j;
+    int status = 0;
+
+    parse_args(argc, argv);
+
+    /* before anything is allocated */
+    json_set_alloc_funcs(counting_malloc, counting_free);
+
+    if (corpus_init(&corpora[ncorpora++], "api", api_body(), NULL) ||
+        corpus_init(&corpora[ncorpora++], "numbers", numbers(), NULL) ||
+        corpus_init(&corpora[ncorpora++], "series", series(), NULL) ||
+        corpus_init(&corpora[ncorpora++], "logs", logs(), NULL) ||
+        corpus_init(&corpora[ncorpora++], "blobs", blobs(), NULL) ||
+        corpus_init(&corpora[ncorpora++], "deep", deep(), NULL) ||
+        corpus_init(&corpora[ncorpora++], "wide", wide(), NULL)) {
+        fprintf(stderr, "unable to generate the corpora\n");
+        return 2;
+    }
+
+    for (i = 0; i < (size_t)conf.nfiles; i++) {
+        const char *name = strrchr(conf.files[i], '/');
+        char *text = load_file(conf.files[i]);
+
+        if (!text || corpus_init(&corpora[ncorpora++], name ? name + 1 : conf.files[i],
+                                 NULL, text)) {
+            fprintf(stderr, "unable to load %s\n", conf.files[i]);
+            return 2;
+        }
+    }
+
+    results = json_array();
+    if (!conf.json)
+        print_header();
+
+    for (i = 0; i < ncorpora; i++) {
+        for (j = 0; j < NBENCHES; j++) {
+            json_t *result = measure(&benches[j], &corpora[i]);
+
+            if (!result)
+                continue;
+            if (!conf.json)
+                print_result(result);
+            json_array_append_new(results, result);
+        }
+    }
+
+    if (conf.json) {
+        output = json_pack("{s:s, s:f, s:i, s:O}", "jansson", JANSSON_VERSION,
+                           "min_time", conf.min_time, "repeat", conf.repeat, "results",
+                           results);
+        json_dumpf(output, stdout, JSON_INDENT(2));
+        printf("\n");
+        json_decref(output);
+    }
+
+    if (conf.compare) {
+        int regressions = compare(results);
+        status = regressions < 0 ? 2 : regressions > 0;
+    }
+
+    json_decref(results);
+    for (i = 0; i < ncorpora; i++)
+        corpus_close(&corpora[i]);
+    return status;
+}
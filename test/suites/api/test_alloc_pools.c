@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "jansson_private_config.h"
+
+#include "util.h"
+#include <jansson.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#define NUM_VALUES 1000
+
+static json_t *values[NUM_VALUES];
+static int malloc_calls = 0;
+static int free_calls = 0;
+
+static void *counting_malloc(size_t size) {
+    malloc_calls++;
+    return malloc(size);
+}
+
+static void counting_free(void *ptr) {
+    free_calls++;
+    free(ptr);
+}
+
+static void create_values() {
+    int i;
+
+    for (i = 0; i < NUM_VALUES; i++) {
+        values[i] = i % 2 ? json_integer(i) : json_real(i + 0.5);
+        if (!values[i])
+            fail("unable to create a value");
+    }
+}
+
+static void check_and_free_values() {
+    int i;
+
+    for (i = 0; i < NUM_VALUES; i++) {
+        if (i % 2 ? json_integer_value(values[i]) != i
+                  : json_real_value(values[i]) != i + 0.5)
+            fail("a pooled value was overwritten");
+    }
+
+    /* free in a different order than allocated */
+    for (i = 0; i < NUM_VALUES; i += 2)
+        json_decref(values[i]);
+    for (i = 1; i < NUM_VALUES; i += 2)
+        json_decref(values[i]);
+}
+
+static void pools_reuse_memory() {
+    int calls;
+
+    malloc_calls = free_calls = 0;
+    create_values();
+    calls = malloc_calls;
+
+    /* slabs hold hundreds of values */
+    if (calls == 0 || calls > NUM_VALUES / 100)
+        fail("pooled values were not allocated in slabs");
+
+    check_and_free_values();
+    if (free_calls)
+        fail("pooled values were released to the allocator");
+
+    /* the second round reuses the freed values */
+    create_values();
+    if (malloc_calls != calls)
+        fail("freed pooled values were not reused");
+    check_and_free_values();
+}
+
+static void pools_with_documents() {
+    const char *text = "{\"a\": [1, 2.5, \"three\", null, true], \"b\": {\"c\": {}},"
+                       " \"d\": \"some longer string value\"}";
+    json_t *json, *copy;
+    char *result;
+    int i;
+
+    for (i = 0; i < 100; i++) {
+        json = json_loads(text, 0, NULL);
+        if (!json)
+            fail("json_loads failed with pools");
+
+        copy = json_deep_copy(json);
+        if (!json_equal(json, copy))
+            fail("json_deep_copy failed with pools");
+
+        json_array_append_new(json_object_get(copy, "a"), json_integer(i));
+        json_object_set_new(copy, "e", json_string("e"));
+        json_object_del(json, "a");
+
+        result = json_dumps(json, JSON_SORT_KEYS);
+        if (!result || strcmp(result, "{\"b\": {\"c\": {}}, \"d\": \"some longer string "
+                                      "value\"}"))
+            fail("json_dumps failed with pools");
+        free(result);
+
+        json_decref(json);
+        json_decref(copy);
+    }
+}
+
+static void pools_with_arenas() {
+    json_arena_t *arena = json_arena_new();
+    const char *text = "[1, 2.5, \"three\"]";
+    json_t *json, *array;
+
+    json = json_loadb_arena(text, strlen(text), 0, arena, NULL);
+    if (!json)
+        fail("json_loadb_arena failed with pools");
+
+    array = json_array();
+    json_array_append(array, json);
+    json_array_append_new(array, json_integer(1));
+    json_decref(array);
+
+    json_arena_free(arena);
+}
+
+#ifdef HAVE_PTHREAD
+static void *create_and_free(void *arg) {
+    (void)arg;
+    json_decref(json_integer(1));
+    json_decref(json_real(1.5));
+    return NULL;
+}
+
+static void pools_with_threads() {
+    pthread_t thread;
+    int i, calls = 0;
+
+    /* each thread takes a batch of chunks for its cache, and gives
+       it back when it exits */
+    malloc_calls = 0;
+    for (i = 0; i < 100; i++) {
+        if (pthread_create(&thread, NULL, create_and_free, NULL))
+            fail("unable to start a thread");
+        pthread_join(thread, NULL);
+        if (i == 0)
+            calls = malloc_calls;
+    }
+    if (malloc_calls != calls)
+        fail("the caches of exited threads were not reused");
+}
+#endif
+
+static void run_tests() {
+    json_set_alloc_funcs(counting_malloc, counting_free);
+    if (json_set_alloc_pools(1)) {
+        /* not supported on this platform */
+        return;
+    }
+
+    pools_reuse_memory();
+    pools_with_documents();
+    pools_with_arenas();
+#ifdef HAVE_PTHREAD
+    pools_with_threads();
+#endif
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char text[] = "{\"name\": \"arena\", \"list\": [1, 2.5, \"three\", null],"
+                           " \"nested\": {\"a\": {\"b\": true}}}";
+
+static int malloc_calls = 0;
+static int free_calls = 0;
+
+static void *counting_malloc(size_t size) {
+    malloc_calls++;
+    return malloc(size);
+}
+
+static void counting_free(void *ptr) {
+    free_calls++;
+    free(ptr);
+}
+
+static void load_into_arena() {
+    json_arena_t *arena;
+    json_error_t error;
+    json_t *json, *list;
+
+    arena = json_arena_new();
+    if (!arena)
+        fail("json_arena_new failed");
+
+    json = json_loadb_arena(text, strlen(text), 0, arena, &error);
+    if (!json)
+        fail("json_loadb_arena failed");
+
+    if (strcmp(json_string_value(json_object_get(json, "name")), "arena"))
+        fail("json_loadb_arena returned a wrong string");
+
+    list = json_object_get(json, "list");
+    if (json_array_size(list) != 4 || json_integer_value(json_array_get(list, 0)) != 1 ||
+        json_real_value(json_array_get(list, 1)) != 2.5 ||
+        strcmp(json_string_value(json_array_get(list, 2)), "three") ||
+        !json_is_null(json_array_get(list, 3)))
+        fail("json_loadb_arena returned a wrong array");
+
+    if (!json_is_true(json_object_get(json_object_get(json_object_get(json, "nested"),
+                                                      "a"),
+                                      "b")))
+        fail("json_loadb_arena returned a wrong nested value");
+
+    /* reference counting has no effect on arena values */
+    json_incref(json);
+    json_decref(json);
+    json_decref(json);
+    json_decref(json);
+    if (json_object_size(json) != 3)
+        fail("json_decref released an arena value");
+
+    json_arena_free(arena);
+}
+
+static void arena_values_are_readonly() {
+    json_arena_t *arena = json_arena_new();
+    json_t *json, *list, *string, *integer, *real, *copy;
+
+    json = json_loadb_arena(text, strlen(text), 0, arena, NULL);
+    if (!json)
+        fail("json_loadb_arena failed");
+
+    list = json_object_get(json, "list");
+    integer = json_array_get(list, 0);
+    real = json_array_get(list, 1);
+    string = json_array_get(list, 2);
+
+    if (!json_object_set_new(json, "foo", json_integer(1)))
+        fail("json_object_set_new modified an arena object");
+    if (!json_object_del(json, "name"))
+        fail("json_object_del modified an arena object");
+    if (!json_object_clear(json))
+        fail("json_object_clear modified an arena object");
+    if (!json_object_iter_set_new(json, json_object_iter(json), json_null()))
+        fail("json_object_iter_set_new modified an arena object");
+    if (!json_array_append_new(list, json_integer(1)))
+        fail("json_array_append_new modified an arena array");
+    if (!json_array_insert_new(list, 0, json_integer(1)))
+        fail("json_array_insert_new modified an arena array");
+    if (!json_array_set_new(list, 0, json_integer(1)))
+        fail("json_array_set_new modified an arena array");
+    if (!json_array_remove(list, 0))
+        fail("json_array_remove modified an arena array");
+    if (!json_array_clear(list))
+        fail("json_array_clear modified an arena array");
+    if (!json_array_extend(list, list))
+        fail("json_array_extend modified an arena array");
+    if (!json_string_set(string, "four"))
+        fail("json_string_set modified an arena string");
+    if (!json_integer_set(integer, 2))
+        fail("json_integer_set modified an arena integer");
+    if (!json_real_set(real, 3.5))
+        fail("json_real_set modified an arena real");
+
+    if (json_object_size(json) != 3 || json_array_size(list) != 4 ||
+        strcmp(json_string_value(string), "three") || json_integer_value(integer) != 1 ||
+        json_real_value(real) != 2.5)
+        fail("an arena value was modified");
+
+    /* a deep copy is an ordinary value */
+    copy = json_deep_copy(json);
+    if (!copy || !json_equal(copy, json))
+        fail("json_deep_copy of an arena value failed");
+    if (json_object_set_new(copy, "foo", json_integer(1)))
+        fail("json_object_set_new failed on a copy of an arena value");
+    if (json_array_append_new(json_object_get(copy, "list"), json_integer(5)))
+        fail("json_array_append_new failed on a copy of an arena value");
+
+    /* arena values can be referenced from ordinary values */
+    if (json_object_set(copy, "original", json))
+        fail("json_object_set failed with an arena value");
+    json_decref(copy);
+
+    json_arena_free(arena);
+}
+
+static void arena_allocates_in_blocks() {
+    json_arena_t *arena;
+    json_t *json;
+    char *big;
+    size_t i, len = 0;
+    int calls;
+
+    /* an array of many small objects */
+    big = malloc(100 * 1000 + 3);
+    big[len++] = '[';
+    for (i = 0; i < 1000; i++)
+        len += sprintf(big + len, "%s{\"id\": %d, \"s\": \"value\"}", i ? "," : "",
+                       (int)i);
+    big[len++] = ']';
+    big[len] = '\0';
+
+    json_set_alloc_funcs(counting_malloc, counting_free);
+
+    arena = json_arena_new();
+    malloc_calls = free_calls = 0;
+    json = json_loadb_arena(big, len, 0, arena, NULL);
+    if (!json || json_array_size(json) != 1000)
+        fail("json_loadb_arena failed");
+    calls = malloc_calls;
+
+    /* the whole document takes only a few blocks */
+    if (calls > 20)
+        fail("json_loadb_arena allocated too many blocks");
+    if (free_calls)
+        fail("json_loadb_arena freed memory separately");
+
+    json_arena_free(arena);
+    if (free_calls != calls + 1)
+        fail("json_arena_free did not release all blocks");
+
+    json_set_alloc_funcs(malloc, free);
+    free(big);
+}
+
+static void arena_reset() {
+    json_arena_t *arena = json_arena_new();
+    json_t *json;
+    int i;
+
+    for (i = 0; i < 10; i++) {
+        json = json_loadb_arena(text, strlen(text), 0, arena, NULL);
+        if (!json || json_object_size(json) != 3)
+            fail("json_loadb_arena failed after json_arena_reset");
+        json_arena_reset(arena);
+    }
+
+    json_arena_reset(arena);
+    json_arena_free(arena);
+
+    /* resetting a fresh arena and freeing NULL are fine */
+    arena = json_arena_new();
+    json_arena_reset(arena);
+    json_arena_free(arena);
+    json_arena_free(NULL);
+}
+
+static void arena_errors() {
+    json_arena_t *arena = json_arena_new();
+    json_error_t error;
+    json_t *json, *array;
+
+    json = json_loadb_arena("[1, 2", 5, 0, arena, &error);
+    if (json)
+        fail("json_loadb_arena succeeded on invalid input");
+    check_error(json_error_premature_end_of_input, "']' expected near end of file",
+                "<buffer>", 1, 5, 5);
+
+    json = json_loadb_arena(text, strlen(text), 0, NULL, &error);
+    if (json)
+        fail("json_loadb_arena succeeded without an arena");
+    check_error(json_error_invalid_argument, "wrong arguments", "<buffer>", -1, -1, 0);
+
+    /* values created outside of json_loadb_arena() are unaffected */
+    json = json_loadb_arena(text, strlen(text), 0, arena, NULL);
+    array = json_array();
+    if (!array || json_array_append(array, json) || json_array_append(array, json))
+        fail("json_array_append failed with an arena value");
+    if (json_array_remove(array, 0) || json_array_size(array) != 1)
+        fail("json_array_remove failed on an ordinary array");
+    json_decref(array);
+
+    json_arena_free(arena);
+}
+
+static void run_tests() {
+    load_into_arena();
+    arena_values_are_readonly();
+    arena_allocates_in_blocks();
+    arena_reset();
+    arena_errors();
+}
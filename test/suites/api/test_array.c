@@ -337,6 +337,161 @@ static void test_extend(void) {
     json_decref(array2);
 }
 
+static void check_array(json_t *array, const char *expected, const char *message) {
+    json_t *json = json_loads(expected, 0, NULL);
+
+    if (!json_equal(array, json))
+        fail(message);
+    json_decref(json);
+}
+
+static void test_splice(void) {
+    json_t *array, *values[3], *frozen, *extra;
+    int i;
+
+    array = json_array();
+    for (i = 0; i < 3; i++)
+        values[i] = json_integer(i);
+
+    if (json_array_append_many(array, values, 3))
+        fail("json_array_append_many failed");
+    for (i = 0; i < 3; i++)
+        json_incref(values[i]);
+    if (json_array_append_many_new(array, values, 3))
+        fail("json_array_append_many_new failed");
+    check_array(array, "[0, 1, 2, 0, 1, 2]", "appending many went wrong");
+    if (values[0]->refcount != 3)
+        fail("json_array_append_many didn't count references");
+
+    /* grow in the middle, shrink and replace in place */
+    extra = json_string("x");
+    if (json_array_splice(array, 1, 1, values, 3))
+        fail("growing json_array_splice failed");
+    check_array(array, "[0, 0, 1, 2, 2, 0, 1, 2]", "growing splice went wrong");
+    if (json_array_splice_new(array, 2, 4, &extra, 1))
+        fail("shrinking json_array_splice_new failed");
+    check_array(array, "[0, 0, \"x\", 1, 2]", "shrinking splice went wrong");
+    if (json_array_splice(array, 0, 2, values + 1, 2))
+        fail("json_array_splice in place failed");
+    check_array(array, "[1, 2, \"x\", 1, 2]", "splice in place went wrong");
+    if (json_array_splice(array, 5, 0, values, 1))
+        fail("json_array_splice at the end failed");
+    check_array(array, "[1, 2, \"x\", 1, 2, 0]", "splice at the end went wrong");
+
+    if (json_array_remove_range(array, 1, 3))
+        fail("json_array_remove_range failed");
+    check_array(array, "[1, 2, 0]", "removing a range went wrong");
+    if (json_array_remove_range(array, 3, 0) || json_array_size(array) != 3)
+        fail("json_array_remove_range failed on an empty range");
+
+    /* errors leave the array as it is */
+    if (json_array_remove_range(array, 2, 2) != -1 ||
+        json_array_remove_range(array, 4, 0) != -1 ||
+        json_array_remove_range(array, 1, (size_t)-1) != -1)
+        fail("json_array_remove_range accepted a range outside the array");
+    if (json_array_splice(array, 0, 0, &array, 1) != -1)
+        fail("json_array_splice inserted the array into itself");
+    extra = NULL;
+    if (json_array_splice(array, 0, 0, &extra, 1) != -1)
+        fail("json_array_splice inserted NULL");
+    json_incref(values[2]);
+    if (json_array_append_many_new(json_null(), values + 2, 1) != -1)
+        fail("json_array_append_many_new accepted a non-array");
+    if (values[2]->refcount != 2)
+        fail("json_array_append_many_new didn't steal on error");
+    check_array(array, "[1, 2, 0]", "an error modified the array");
+
+    frozen = json_pack("[i, i]", 1, 2);
+    json_freeze(frozen);
+    if (json_array_remove_range(frozen, 0, 1) != -1 ||
+        json_array_splice(frozen, 0, 0, values, 1) != -1)
+        fail("a frozen array was spliced");
+    json_decref(json_thaw(frozen));
+
+    json_decref(array);
+    for (i = 0; i < 3; i++) {
+        if (values[i]->refcount != 1)
+            fail("splicing leaked references");
+        json_decref(values[i]);
+    }
+}
+
+static int keep_odd(json_t *value, size_t index, void *data) {
+    size_t *calls = (size_t *)data;
+
+    if (index != (*calls)++)
+        fail("json_array_filter passed the wrong index");
+    return json_integer_value(value) % 2;
+}
+
+static int keep_none(json_t *value, size_t index, void *data) {
+    (void)value;
+    (void)index;
+    (void)data;
+    return 0;
+}
+
+static void test_filter(void) {
+    json_t *array, *shared;
+    size_t calls = 0;
+    int i;
+
+    array = json_array();
+    shared = json_integer(7);
+    for (i = 0; i < 10; i++)
+        json_array_append_new(array, json_integer(i));
+    json_array_append(array, shared);
+
+    if (json_array_filter(array, keep_odd, &calls) || calls != 11)
+        fail("json_array_filter failed");
+    check_array(array, "[1, 3, 5, 7, 9, 7]", "json_array_filter went wrong");
+
+    if (json_array_filter(array, keep_none, NULL) || json_array_size(array) != 0)
+        fail("json_array_filter didn't remove everything");
+    if (shared->refcount != 1)
+        fail("json_array_filter didn't release removed values");
+
+    if (json_array_filter(array, NULL, NULL) != -1 ||
+        json_array_filter(shared, keep_none, NULL) != -1)
+        fail("json_array_filter accepted bad arguments");
+
+    json_decref(shared);
+    json_decref(array);
+}
+
+static void test_reserve(void) {
+    json_t *array, *other;
+    int i;
+
+    array = json_array_with_capacity(100);
+    if (!array || json_array_size(array) != 0)
+        fail("json_array_with_capacity failed");
+
+    for (i = 0; i < 100; i++) {
+        if (json_array_append_new(array, json_integer(i)))
+            fail("unable to append");
+    }
+
+    if (json_array_reserve(array, 10) || json_array_size(array) != 100)
+        fail("json_array_reserve failed with a smaller capacity");
+    if (json_array_reserve(array, 1000) || json_array_size(array) != 100)
+        fail("json_array_reserve failed");
+    for (i = 0; i < 100; i++) {
+        if (json_integer_value(json_array_get(array, i)) != i)
+            fail("json_array_reserve lost elements");
+    }
+
+    other = json_array_with_capacity(0);
+    if (!other || json_array_extend(other, array) || json_array_size(other) != 100)
+        fail("json_array_extend failed after json_array_with_capacity");
+
+    if (json_array_reserve(NULL, 10) != -1 || json_array_reserve(json_null(), 10) != -1)
+        fail("json_array_reserve succeeded with a non-array");
+
+    json_decref(other);
+    json_decref(array);
+}
+
 static void test_circular() {
     json_t *array1, *array2;
 
@@ -478,6 +633,9 @@ static void run_tests() {
     test_remove();
     test_clear();
     test_extend();
+    test_splice();
+    test_filter();
+    test_reserve();
     test_circular();
     test_array_foreach();
     test_bad_args();
@@ -0,0 +1,530 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CBOR    JSON_ENCODE_CBOR
+#define MSGPACK JSON_ENCODE_MSGPACK
+
+/* the decoding flag of an encoding flag */
+#define DECODE(format) ((format) == CBOR ? JSON_DECODE_CBOR : JSON_DECODE_MSGPACK)
+
+struct output {
+    unsigned char buffer[200000];
+    size_t len;
+};
+
+static size_t from_hex(const char *hex, unsigned char *bytes) {
+    size_t len = 0;
+    unsigned int byte;
+
+    while (*hex && sscanf(hex, "%2x", &byte) == 1) {
+        bytes[len++] = (unsigned char)byte;
+        hex += 2;
+    }
+    return len;
+}
+
+static void to_hex(const unsigned char *bytes, size_t len, char *hex) {
+    size_t i;
+    for (i = 0; i < len; i++)
+        sprintf(hex + 2 * i, "%02x", bytes[i]);
+    hex[2 * len] = '\0';
+}
+
+/* Check that the value that text encodes to is encoded to hex, and
+   that hex is decoded to it */
+static void check_encoding(const char *text, size_t format, const char *hex) {
+    json_t *json = json_loads(text, JSON_DECODE_ANY, NULL), *decoded;
+    unsigned char bytes[256], expected[128];
+    char dumped[512];
+    json_error_t error;
+    size_t len, expected_len = from_hex(hex, expected);
+
+    if (!json)
+        fail("unable to load the value");
+
+    len = json_dumpb(json, (char *)bytes, sizeof(bytes), format | JSON_ENCODE_ANY);
+    if (len != expected_len || memcmp(bytes, expected, len)) {
+        to_hex(bytes, len, dumped);
+        failhdr;
+        fprintf(stderr, "%s was encoded to %s, expected %s\n", text, dumped, hex);
+        exit(1);
+    }
+
+    decoded = json_loadb((const char *)bytes, len, DECODE(format) | JSON_DECODE_ANY,
+                         &error);
+    if (!json_equal(json, decoded)) {
+        failhdr;
+        fprintf(stderr, "%s was not decoded from %s: %s\n", text, hex, error.text);
+        exit(1);
+    }
+    if (error.position != (int)len)
+        fail("the position after decoding is wrong");
+
+    json_decref(decoded);
+    json_decref(json);
+}
+
+/* Check that hex is decoded to the value text encodes to */
+static void check_decoding(const char *hex, size_t flags, const char *text) {
+    json_t *json = json_loads(text, JSON_DECODE_ANY | JSON_ALLOW_NUL, NULL), *decoded;
+    unsigned char bytes[128];
+    size_t len = from_hex(hex, bytes);
+    json_error_t error;
+
+    decoded = json_loadb((const char *)bytes, len, flags | JSON_DECODE_ANY, &error);
+    if (!json || !json_equal(json, decoded)) {
+        failhdr;
+        fprintf(stderr, "%s was not decoded to %s: %s\n", hex, text, error.text);
+        exit(1);
+    }
+
+    json_decref(decoded);
+    json_decref(json);
+}
+
+/* Check that decoding hex fails with the error */
+static void check_fails(const char *hex, size_t flags, enum json_error_code code,
+                        const char *text, size_t position) {
+    unsigned char bytes[128];
+    size_t len = from_hex(hex, bytes);
+    json_error_t error;
+
+    if (json_loadb((const char *)bytes, len, flags | JSON_DECODE_ANY, &error)) {
+        failhdr;
+        fprintf(stderr, "%s was decoded\n", hex);
+        exit(1);
+    }
+    if (json_error_code(&error) != code || strcmp(error.text, text) ||
+        error.position != (int)position || error.line != -1 || error.column != -1) {
+        failhdr;
+        fprintf(stderr, "%s: got %d %s at %d, expected %d %s at %d\n", hex,
+                json_error_code(&error), error.text, error.position, code, text,
+                (int)position);
+        exit(1);
+    }
+}
+
+static void cbor() {
+    /* the examples of RFC 8949, appendix A, except that reals are
+       encoded in single precision at the shortest */
+    check_encoding("0", CBOR, "00");
+    check_encoding("23", CBOR, "17");
+    check_encoding("24", CBOR, "1818");
+    check_encoding("100", CBOR, "1864");
+    check_encoding("1000", CBOR, "1903e8");
+    check_encoding("1000000", CBOR, "1a000f4240");
+    check_encoding("1000000000000", CBOR, "1b000000e8d4a51000");
+    check_encoding("9223372036854775807", CBOR, "1b7fffffffffffffff");
+    check_encoding("-1", CBOR, "20");
+    check_encoding("-10", CBOR, "29");
+    check_encoding("-100", CBOR, "3863");
+    check_encoding("-1000", CBOR, "3903e7");
+    check_encoding("-9223372036854775808", CBOR, "3b7fffffffffffffff");
+    check_encoding("1.5", CBOR, "fa3fc00000");
+    check_encoding("1.1", CBOR, "fb3ff199999999999a");
+    check_encoding("100000.0", CBOR, "fa47c35000");
+    check_encoding("-4.1", CBOR, "fbc010666666666666");
+    check_encoding("1e300", CBOR, "fb7e37e43c8800759c");
+    check_encoding("false", CBOR, "f4");
+    check_encoding("true", CBOR, "f5");
+    check_encoding("null", CBOR, "f6");
+    check_encoding("\"\"", CBOR, "60");
+    check_encoding("\"a\"", CBOR, "6161");
+    check_encoding("\"IETF\"", CBOR, "6449455446");
+    check_encoding("\"\\\"\\\\\"", CBOR, "62225c");
+    check_encoding("\"\\u00fc\"", CBOR, "62c3bc");
+    check_encoding("\"\\u6c34\"", CBOR, "63e6b0b4");
+    check_encoding("[]", CBOR, "80");
+    check_encoding("[1, 2, 3]", CBOR, "83010203");
+    check_encoding("[1, [2, 3], [4, 5]]", CBOR, "8301820203820405");
+    check_encoding("{}", CBOR, "a0");
+    check_encoding("{\"a\": 1, \"b\": [2, 3]}", CBOR, "a26161016162820203");
+    check_encoding("[\"a\", {\"b\": \"c\"}]", CBOR, "826161a161626163");
+
+    /* half precision, indefinite lengths and tags */
+    check_decoding("f93c00", JSON_DECODE_CBOR, "1.0");
+    check_decoding("f97bff", JSON_DECODE_CBOR, "65504.0");
+    check_decoding("f90001", JSON_DECODE_CBOR, "5.960464477539063e-8");
+    check_decoding("f90400", JSON_DECODE_CBOR, "0.00006103515625");
+    check_decoding("f9c400", JSON_DECODE_CBOR, "-4.0");
+    check_decoding("f98000", JSON_DECODE_CBOR, "-0.0");
+    check_decoding("9fff", JSON_DECODE_CBOR, "[]");
+    check_decoding("9f018202039f0405ffff", JSON_DECODE_CBOR, "[1, [2, 3], [4, 5]]");
+    check_decoding("83018202039f0405ff", JSON_DECODE_CBOR, "[1, [2, 3], [4, 5]]");
+    check_decoding("bf61610161629f0203ffff", JSON_DECODE_CBOR,
+                   "{\"a\": 1, \"b\": [2, 3]}");
+    check_decoding("bfff", JSON_DECODE_CBOR, "{}");
+    check_decoding("7f657374726561646d696e67ff", JSON_DECODE_CBOR, "\"streaming\"");
+    check_decoding("7fff", JSON_DECODE_CBOR, "\"\"");
+    check_decoding("c11a514b67b0", JSON_DECODE_CBOR, "1363896240");
+    check_decoding("d82076687474703a2f2f7777772e6578616d706c652e636f6d", JSON_DECODE_CBOR,
+                   "\"http://www.example.com\"");
+    check_decoding("1864", JSON_DECODE_CBOR | JSON_DECODE_INT_AS_REAL, "100.0");
+
+    check_fails("", JSON_DECODE_CBOR, json_error_premature_end_of_input,
+                "unexpected end of input", 0);
+    check_fails("8301", JSON_DECODE_CBOR, json_error_premature_end_of_input,
+                "unexpected end of input", 2);
+    check_fails("19e8", JSON_DECODE_CBOR, json_error_premature_end_of_input,
+                "unexpected end of input", 2);
+    check_fails("6461", JSON_DECODE_CBOR, json_error_premature_end_of_input,
+                "unexpected end of input", 2);
+    check_fails("0000", JSON_DECODE_CBOR, json_error_end_of_input_expected,
+                "end of input expected", 1);
+    check_fails("1bffffffffffffffff", JSON_DECODE_CBOR, json_error_numeric_overflow,
+                "too big integer", 0);
+    check_fails("820a3b8000000000000000", JSON_DECODE_CBOR, json_error_numeric_overflow,
+                "too big negative integer", 2);
+    check_fails("4101", JSON_DECODE_CBOR, json_error_wrong_type,
+                "byte strings are not supported", 0);
+    check_fails("f7", JSON_DECODE_CBOR, json_error_wrong_type,
+                "simple value 23 is not supported", 0);
+    check_fails("f820", JSON_DECODE_CBOR, json_error_wrong_type,
+                "simple value 32 is not supported", 0);
+    check_fails("f97c00", JSON_DECODE_CBOR, json_error_numeric_overflow,
+                "real number is infinite or NaN", 0);
+    check_fails("fa7fc00000", JSON_DECODE_CBOR, json_error_numeric_overflow,
+                "real number is infinite or NaN", 0);
+    check_fails("1c", JSON_DECODE_CBOR, json_error_invalid_syntax,
+                "invalid CBOR item 0x1c", 0);
+    check_fails("1f", JSON_DECODE_CBOR, json_error_invalid_syntax,
+                "invalid CBOR item 0x1f", 0);
+    check_fails("ff", JSON_DECODE_CBOR, json_error_invalid_syntax, "unexpected break", 0);
+    check_fails("8201ff", JSON_DECODE_CBOR, json_error_invalid_syntax,
+                "unexpected break", 2);
+    check_fails("bf6161ff", JSON_DECODE_CBOR, json_error_invalid_syntax,
+                "unexpected break", 3);
+    check_fails("7f6161", JSON_DECODE_CBOR, json_error_premature_end_of_input,
+                "unexpected end of input", 3);
+    check_fails("7f01ff", JSON_DECODE_CBOR, json_error_invalid_syntax,
+                "invalid chunk of a string", 1);
+    check_fails("a10101", JSON_DECODE_CBOR, json_error_wrong_type,
+                "object key must be a string", 1);
+    check_fails("61ff", JSON_DECODE_CBOR, json_error_invalid_utf8,
+                "string is not valid UTF-8", 0);
+    check_fails("a161ff01", JSON_DECODE_CBOR, json_error_invalid_utf8,
+                "object key is not valid UTF-8", 1);
+    check_fails("6100", JSON_DECODE_CBOR, json_error_null_character,
+                "NUL byte is not allowed without JSON_ALLOW_NUL", 0);
+    check_decoding("6100", JSON_DECODE_CBOR | JSON_ALLOW_NUL, "\"\\u0000\"");
+    check_fails("a1610001", JSON_DECODE_CBOR, json_error_null_byte_in_key,
+                "NUL byte in object key not supported", 1);
+    check_fails("a2616101616102", JSON_DECODE_CBOR | JSON_REJECT_DUPLICATES,
+                json_error_duplicate_key, "duplicate object key", 4);
+    check_decoding("a2616101616102", JSON_DECODE_CBOR, "{\"a\": 2}");
+}
+
+static void msgpack() {
+    /* the formats of the MessagePack specification */
+    check_encoding("0", MSGPACK, "00");
+    check_encoding("127", MSGPACK, "7f");
+    check_encoding("128", MSGPACK, "cc80");
+    check_encoding("255", MSGPACK, "ccff");
+    check_encoding("256", MSGPACK, "cd0100");
+    check_encoding("65536", MSGPACK, "ce00010000");
+    check_encoding("4294967296", MSGPACK, "cf0000000100000000");
+    check_encoding("9223372036854775807", MSGPACK, "cf7fffffffffffffff");
+    check_encoding("-1", MSGPACK, "ff");
+    check_encoding("-32", MSGPACK, "e0");
+    check_encoding("-33", MSGPACK, "d0df");
+    check_encoding("-128", MSGPACK, "d080");
+    check_encoding("-129", MSGPACK, "d1ff7f");
+    check_encoding("-32769", MSGPACK, "d2ffff7fff");
+    check_encoding("-2147483648", MSGPACK, "d280000000");
+    check_encoding("-2147483649", MSGPACK, "d3ffffffff7fffffff");
+    check_encoding("-9223372036854775808", MSGPACK, "d38000000000000000");
+    check_encoding("1.5", MSGPACK, "ca3fc00000");
+    check_encoding("1.1", MSGPACK, "cb3ff199999999999a");
+    check_encoding("null", MSGPACK, "c0");
+    check_encoding("false", MSGPACK, "c2");
+    check_encoding("true", MSGPACK, "c3");
+    check_encoding("\"\"", MSGPACK, "a0");
+    check_encoding("\"IETF\"", MSGPACK, "a449455446");
+    check_encoding("\"0123456789012345678901234567890\"", MSGPACK,
+                   "bf30313233343536373839303132333435363738393031323334353637383930");
+    check_encoding("\"01234567890123456789012345678901\"", MSGPACK,
+                   "d920303132333435363738393031323334353637383930313233343536373839"
+                   "3031");
+    check_encoding("[]", MSGPACK, "90");
+    check_encoding("[1, [2, 3]]", MSGPACK, "9201920203");
+    check_encoding("[0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0]", MSGPACK,
+                   "dc001000000000000000000000000000000000");
+    check_encoding("{}", MSGPACK, "80");
+    check_encoding("{\"a\": 1, \"b\": [2, 3]}", MSGPACK, "82a16101a162920203");
+
+    /* formats that aren't used for encoding */
+    check_decoding("d0ff", JSON_DECODE_MSGPACK, "-1");
+    check_decoding("d101ff", JSON_DECODE_MSGPACK, "511");
+    check_decoding("d3ffffffffffffffff", JSON_DECODE_MSGPACK, "-1");
+    check_decoding("cc01", JSON_DECODE_MSGPACK, "1");
+    check_decoding("cb3ff8000000000000", JSON_DECODE_MSGPACK, "1.5");
+    check_decoding("da000161", JSON_DECODE_MSGPACK, "\"a\"");
+    check_decoding("db0000000161", JSON_DECODE_MSGPACK, "\"a\"");
+    check_decoding("dd0000000101", JSON_DECODE_MSGPACK, "[1]");
+    check_decoding("de0001a16101", JSON_DECODE_MSGPACK, "{\"a\": 1}");
+    check_decoding("df00000001a16101", JSON_DECODE_MSGPACK, "{\"a\": 1}");
+
+    check_fails("c1", JSON_DECODE_MSGPACK, json_error_invalid_syntax,
+                "invalid MessagePack format 0xc1", 0);
+    check_fails("c40100", JSON_DECODE_MSGPACK, json_error_wrong_type,
+                "binary data is not supported", 0);
+    check_fails("d40100", JSON_DECODE_MSGPACK, json_error_wrong_type,
+                "extension types are not supported", 0);
+    check_fails("cfffffffffffffffff", JSON_DECODE_MSGPACK, json_error_numeric_overflow,
+                "too big integer", 0);
+    check_fails("cb7ff0000000000000", JSON_DECODE_MSGPACK, json_error_numeric_overflow,
+                "real number is infinite or NaN", 0);
+    check_fails("92010101", JSON_DECODE_MSGPACK, json_error_end_of_input_expected,
+                "end of input expected", 3);
+    check_fails("92", JSON_DECODE_MSGPACK, json_error_premature_end_of_input,
+                "unexpected end of input", 1);
+    check_fails("dbffffffff", JSON_DECODE_MSGPACK, json_error_premature_end_of_input,
+                "unexpected end of input", 5);
+    check_fails("8101a0", JSON_DECODE_MSGPACK, json_error_wrong_type,
+                "object key must be a string", 1);
+}
+
+static json_t *sample() {
+    json_t *json = json_pack("{s:[i, I, I, f, f, b, b, n], s:{s:s, s:s, s:{}}, s:[]}",
+                             "numbers", 1, (json_int_t)-1234567890123LL,
+                             (json_int_t)4294967296LL, 0.25, 3.14159, 1, 0, "strings",
+                             "ascii", "plain", "utf-8", "\xc3\xa4\xe6\xb0\xb4", "empty",
+                             "nothing");
+    json_t *long_string, *big;
+    char text[70000];
+    int i;
+
+    /* lengths that need 16 and 32-bit heads */
+    memset(text, 'x', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    long_string = json_string(text);
+    json_object_set_new(json_object_get(json, "strings"), "long", long_string);
+
+    big = json_array();
+    for (i = 0; i < 70000; i++)
+        json_array_append_new(big, json_integer(i % 300 - 150));
+    json_object_set_new(json, "big", big);
+    return json;
+}
+
+static size_t bytes_left;
+
+/* feeds the input one byte at a time */
+static size_t read_bytes(void *buffer, size_t buflen, void *data) {
+    const unsigned char **p = data;
+
+    if (!bytes_left || !buflen)
+        return 0;
+
+    *(unsigned char *)buffer = **p;
+    (*p)++;
+    bytes_left--;
+    return 1;
+}
+
+static int write_bytes(const char *buffer, size_t size, void *data) {
+    struct output *out = data;
+
+    if (out->len + size > sizeof(out->buffer))
+        return -1;
+    memcpy(out->buffer + out->len, buffer, size);
+    out->len += size;
+    return 0;
+}
+
+static void round_trip(size_t format) {
+    json_t *json = sample(), *decoded;
+    const unsigned char *p;
+    struct output out;
+    json_error_t error;
+    size_t size;
+    char *text;
+    FILE *file;
+
+    size = json_dump_size(json, format);
+    out.len = 0;
+    if (json_dump_callback(json, write_bytes, &out, format) || out.len != size)
+        fail("json_dump_callback failed");
+    if (json_dumpb(json, NULL, 0, format) != size)
+        fail("json_dumpb returned the wrong size");
+
+    /* the size of the text is about twice as big */
+    text = json_dumps(json, JSON_COMPACT);
+    if (size >= strlen(text))
+        fail("binary encoding is bigger than the text");
+    free(text);
+
+    decoded = json_loadb((const char *)out.buffer, out.len, DECODE(format), &error);
+    if (!json_equal(json, decoded))
+        fail("round trip through a buffer failed");
+    json_decref(decoded);
+
+    /* the text isn't split for threads */
+    decoded = json_loadb_parallel((const char *)out.buffer, out.len, DECODE(format), 4,
+                                  &error);
+    if (!json_equal(json, decoded))
+        fail("round trip through json_loadb_parallel failed");
+    json_decref(decoded);
+
+    p = out.buffer;
+    bytes_left = out.len;
+    decoded = json_load_callback(read_bytes, &p, DECODE(format), &error);
+    if (!json_equal(json, decoded))
+        fail("round trip through a callback failed");
+    json_decref(decoded);
+
+    file = tmpfile();
+    if (!file)
+        fail("unable to open a temporary file");
+    if (json_dumpf(json, file, format))
+        fail("json_dumpf failed");
+    fputs("garbage", file);
+    rewind(file);
+    decoded = json_loadf(file, DECODE(format) | JSON_DISABLE_EOF_CHECK, &error);
+    if (!json_equal(json, decoded))
+        fail("round trip through a file failed");
+    if (fgetc(file) != 'g')
+        fail("json_loadf read past the end of the value");
+    json_decref(decoded);
+    fclose(file);
+
+    if (format == CBOR) {
+        if (json_dumpb_cbor(json, (char *)out.buffer, sizeof(out.buffer),
+                            JSON_ENCODE_MSGPACK) != size)
+            fail("json_dumpb_cbor failed");
+        decoded = json_loadb_cbor((const char *)out.buffer, size, 0, NULL);
+    } else {
+        if (json_dumpb_msgpack(json, (char *)out.buffer, sizeof(out.buffer), 0) != size)
+            fail("json_dumpb_msgpack failed");
+        decoded = json_loadb_msgpack((const char *)out.buffer, size, 0, NULL);
+    }
+    if (!json_equal(json, decoded))
+        fail("round trip through the buffer functions failed");
+    json_decref(decoded);
+
+    json_decref(json);
+}
+
+static void encoding_flags() {
+    json_t *json = json_pack("{s:i, s:i}", "b", 1, "a", 2), *lazy, *array;
+    unsigned char bytes[64];
+    char hex[129];
+    size_t len;
+
+    /* keys in the order of the object, or sorted */
+    len = json_dumpb(json, (char *)bytes, sizeof(bytes), CBOR);
+    to_hex(bytes, len, hex);
+    if (strcmp(hex, "a2616201616102"))
+        fail("CBOR keys are in the wrong order");
+    len = json_dumpb(json, (char *)bytes, sizeof(bytes), CBOR | JSON_SORT_KEYS);
+    to_hex(bytes, len, hex);
+    if (strcmp(hex, "a2616102616201"))
+        fail("CBOR keys are not sorted");
+
+    /* indentation and other text options don't apply */
+    len = json_dumpb(json, (char *)bytes, sizeof(bytes),
+                     MSGPACK | JSON_INDENT(4) | JSON_ENSURE_ASCII);
+    to_hex(bytes, len, hex);
+    if (strcmp(hex, "82a16201a16102"))
+        fail("MessagePack was encoded with text options");
+
+    /* scalars need JSON_ENCODE_ANY like with text, and the formats
+       can't be mixed */
+    if (json_dumpb(json_object_get(json, "a"), (char *)bytes, sizeof(bytes), CBOR))
+        fail("a scalar was encoded without JSON_ENCODE_ANY");
+    if (json_dumpb(json, (char *)bytes, sizeof(bytes), CBOR | MSGPACK))
+        fail("CBOR and MessagePack were used together");
+
+    /* the output contains null bytes, so it can't be a string */
+    if (json_dumps(json, CBOR) || json_dumps_parallel(json, MSGPACK, 2))
+        fail("json_dumps returned binary output");
+    if (json_writer_new(write_bytes, NULL, CBOR))
+        fail("a writer was created for binary output");
+
+    /* a lazily loaded container is encoded, not copied as text */
+    lazy = json_loads("[[1, 2], {\"a\": [3]}]", 0, NULL);
+    json_decref(json);
+    json = json_loadb_lazy("[[1, 2], {\"a\": [3]}]", 20, 0, NULL);
+    len = json_dumpb(json, (char *)bytes, sizeof(bytes), CBOR);
+    to_hex(bytes, len, hex);
+    if (strcmp(hex, "82820102a161618103"))
+        fail("a lazy container was not encoded");
+    json_decref(lazy);
+
+    /* records follow each other without newlines */
+    array = json_pack("[i, [], s]", 1, "x");
+    {
+        struct output out;
+        out.len = 0;
+        if (json_dump_lines_callback(array, write_bytes, &out, CBOR))
+            fail("json_dump_lines_callback failed");
+        to_hex(out.buffer, out.len, hex);
+        if (strcmp(hex, "01806178"))
+            fail("binary records were not concatenated");
+    }
+    json_decref(array);
+
+    json_decref(json);
+}
+
+static void decoding_flags() {
+    unsigned char bytes[64];
+    json_path_t *path;
+    json_t *json;
+    json_error_t error;
+    size_t len;
+
+    /* scalars need JSON_DECODE_ANY */
+    if (json_loadb("\x01", 1, JSON_DECODE_CBOR, &error))
+        fail("a scalar was decoded without JSON_DECODE_ANY");
+    check_error(json_error_invalid_syntax, "array or object expected", "<buffer>", -1, -1,
+                0);
+
+    /* the depth limit */
+    len = from_hex("8181818101", bytes);
+    json = json_loadb((const char *)bytes, len, JSON_DECODE_CBOR | JSON_PARSER_DEPTH(5),
+                      NULL);
+    if (!json)
+        fail("decoding failed within the depth limit");
+    json_decref(json);
+    if (json_loadb((const char *)bytes, len, JSON_DECODE_CBOR | JSON_PARSER_DEPTH(4),
+                   &error))
+        fail("the depth limit was exceeded");
+    check_error(json_error_stack_overflow, "maximum parsing depth reached", "<buffer>",
+                -1, -1, 4);
+
+    if (json_loadb((const char *)bytes, len, JSON_DECODE_CBOR | JSON_DECODE_MSGPACK,
+                   &error))
+        fail("CBOR and MessagePack were used together");
+    check_error(json_error_invalid_argument,
+                "JSON_DECODE_CBOR and JSON_DECODE_MSGPACK can't be used together",
+                "<buffer>", -1, -1, 0);
+
+    if (json_loads("\x81\x01", JSON_DECODE_CBOR, &error))
+        fail("json_loads decoded binary input");
+    check_error(json_error_invalid_argument, "wrong arguments", "<string>", -1, -1, 0);
+
+    path = json_path_compile("/0", 0, NULL);
+    if (json_path_loadb("\x81\x01", 2, JSON_DECODE_CBOR, path, &error))
+        fail("json_path_loadb decoded binary input");
+    check_error(json_error_invalid_argument, "wrong arguments", "<buffer>", -1, -1, 0);
+    json_path_free(path);
+}
+
+static void run_tests() {
+    cbor();
+    msgpack();
+    round_trip(CBOR);
+    round_trip(MSGPACK);
+    encoding_flags();
+    decoding_flags();
+}
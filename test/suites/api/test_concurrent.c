@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "jansson_private_config.h"
+
+#include <jansson.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "util.h"
+
+#define NKEYS 5000
+
+static void make_key(char *key, int i) { snprintf(key, 16, "key%d", i); }
+
+static void check_members(json_t *object, int begin, int end, int present) {
+    char key[16];
+    int i;
+
+    for (i = begin; i < end; i++) {
+        json_t *value;
+
+        make_key(key, i);
+        value = json_object_get(object, key);
+        if (present && (!value || json_integer_value(value) % NKEYS != i))
+            fail("a member of a concurrent object was lost");
+        if (!present && value)
+            fail("a removed member of a concurrent object was found");
+    }
+}
+
+static void basics() {
+    json_t *object, *other, *copy;
+    const char *key;
+    json_t *value;
+    char buf[16];
+    int i;
+
+    object = json_object_concurrent();
+    if (!object) {
+        /* thread-local storage and atomic operations are needed */
+        return;
+    }
+    if (!json_is_object(object) || json_object_size(object) != 0)
+        fail("json_object_concurrent didn't return an empty object");
+
+    /* growing moves the members to larger tables a few at a time */
+    for (i = 0; i < NKEYS; i++) {
+        make_key(buf, i);
+        if (json_object_set_new(object, buf, json_integer(i)))
+            fail("json_object_set_new failed on a concurrent object");
+        if (i % 500 == 0)
+            check_members(object, 0, i + 1, 1);
+    }
+    if (json_object_size(object) != NKEYS)
+        fail("a concurrent object has a wrong size");
+    check_members(object, 0, NKEYS, 1);
+
+    /* replacing and removing */
+    for (i = 0; i < NKEYS; i += 2) {
+        make_key(buf, i);
+        if (json_object_del(object, buf))
+            fail("json_object_del failed on a concurrent object");
+    }
+    if (json_object_size(object) != NKEYS / 2)
+        fail("a concurrent object has a wrong size after removing");
+    for (i = 0; i < NKEYS; i += 2) {
+        make_key(buf, i);
+        if (json_object_get(object, buf) || !json_object_del(object, buf))
+            fail("a removed member of a concurrent object was found");
+        make_key(buf, i + 1);
+        if (json_integer_value(json_object_get(object, buf)) != i + 1)
+            fail("a member of a concurrent object was lost");
+    }
+    if (json_object_set_new(object, "key1", json_string("one")) ||
+        strcmp(json_string_value(json_object_get(object, "key1")), "one") ||
+        json_object_size(object) != NKEYS / 2)
+        fail("replacing a member of a concurrent object failed");
+    if (json_integer_value(json_object_get_key(object, json_key("key3"))) != 3)
+        fail("json_object_get_key failed on a concurrent object");
+
+    /* iterating, copying and comparing see the same members */
+    i = 0;
+    json_object_foreach(object, key, value) {
+        if (json_object_get(object, key) != value)
+            fail("iterating over a concurrent object returned a wrong value");
+        i++;
+    }
+    if (i != NKEYS / 2)
+        fail("iterating over a concurrent object returned wrong members");
+    if (strcmp(json_object_iter_key(json_object_iter(object)), "key1"))
+        fail("a concurrent object lost the order of its keys");
+
+    copy = json_copy(object);
+    if (!json_equal(copy, object) || !json_equal(object, copy))
+        fail("json_copy failed on a concurrent object");
+    json_decref(copy);
+
+    copy = json_deep_copy(object);
+    if (!json_equal(copy, object))
+        fail("json_deep_copy failed on a concurrent object");
+    json_decref(copy);
+
+    copy = json_deep_copy_cow(object);
+    if (!json_equal(copy, object))
+        fail("json_deep_copy_cow failed on a concurrent object");
+    json_decref(copy);
+
+    if (!json_freeze(object))
+        fail("a concurrent object was frozen");
+
+    if (json_object_iter_set_new(object, json_object_iter_at(object, "key3"),
+                                 json_true()) ||
+        !json_is_true(json_object_get(object, "key3")))
+        fail("json_object_iter_set_new failed on a concurrent object");
+
+    other = json_pack("{s:i, s:i}", "key3", 33, "new", 1);
+    if (json_object_update(object, other) ||
+        json_integer_value(json_object_get(object, "key3")) != 33 ||
+        json_integer_value(json_object_get(object, "new")) != 1)
+        fail("json_object_update failed on a concurrent object");
+    json_decref(other);
+
+    if (json_object_clear(object) || json_object_size(object) != 0 ||
+        json_object_get(object, "key3") || json_object_iter(object))
+        fail("json_object_clear failed on a concurrent object");
+    if (json_object_reserve(object, 10 * NKEYS))
+        fail("json_object_reserve failed on a concurrent object");
+    if (json_object_set_new(object, "key3", json_null()) ||
+        !json_is_null(json_object_get(object, "key3")))
+        fail("a concurrent object failed after clearing");
+
+    json_decref(object);
+}
+
+static void deferred_release() {
+    json_t *object, *value;
+    char buf[16];
+    int i;
+
+    object = json_object_concurrent();
+    if (!object)
+        return;
+
+    value = json_integer(42);
+    json_object_set(object, "value", value);
+
+    /* a replaced value stays valid until the readers have left */
+    json_concurrent_enter();
+    if (json_object_get(object, "value") != value)
+        fail("json_object_get returned a wrong value");
+    json_object_set_new(object, "value", json_integer(43));
+    for (i = 0; i < 100; i++)
+        json_object_set_new(object, "other", json_integer(i));
+    if (value->refcount != 2 || json_integer_value(value) != 42)
+        fail("a value was released while it was being read");
+    json_concurrent_leave();
+
+    /* and it's released afterwards by the writes that follow */
+    for (i = 0; i < 100; i++)
+        json_object_set_new(object, "other", json_integer(i));
+    if (value->refcount != 1)
+        fail("a replaced value wasn't released");
+
+    /* removing the last member doesn't leave anything behind either */
+    for (i = 0; i < 100; i++) {
+        make_key(buf, i);
+        json_object_set_new(object, buf, json_integer(i));
+    }
+    json_object_set(object, "value", value);
+    json_object_del(object, "value");
+    for (i = 0; i < 100; i++) {
+        make_key(buf, i);
+        json_object_del(object, buf);
+    }
+    if (value->refcount != 1)
+        fail("a removed value wasn't released");
+
+    /* nested sections */
+    json_concurrent_enter();
+    json_concurrent_enter();
+    json_concurrent_leave();
+    json_object_set(object, "value", value);
+    json_object_set_new(object, "value", json_null());
+    for (i = 0; i < 100; i++)
+        json_object_set_new(object, "other", json_integer(i));
+    if (value->refcount != 2)
+        fail("a value was released in a nested section");
+    json_concurrent_leave();
+
+    /* an unbalanced leave does nothing */
+    json_concurrent_leave();
+
+    json_decref(object);
+    if (value->refcount != 1)
+        fail("deleting a concurrent object didn't release its values");
+    json_decref(value);
+}
+
+/* The readers are only started where concurrent objects are supported */
+#if defined(HAVE_PTHREAD) && (JSON_HAVE_ATOMIC_BUILTINS || JSON_HAVE_SYNC_BUILTINS)
+#define THREADED_TESTS 1
+#define NREADERS       4
+#define STABLE         (NKEYS / 2) /* the members below this are never removed */
+
+#if JSON_HAVE_ATOMIC_BUILTINS
+#define is_done()  __atomic_load_n(&done, __ATOMIC_ACQUIRE)
+#define set_done() __atomic_store_n(&done, 1, __ATOMIC_RELEASE)
+#else
+#define is_done()  __sync_fetch_and_add(&done, 0)
+#define set_done() __sync_lock_test_and_set(&done, 1)
+#endif
+
+static json_t *shared;
+static int done;
+
+static void *reader(void *arg) {
+    char buf[16];
+    unsigned int i = 0, *failures = arg;
+
+    while (!is_done()) {
+        int k = (int)(i++ % NKEYS);
+        json_t *value;
+
+        make_key(buf, k);
+        json_concurrent_enter();
+        value = json_object_get(shared, buf);
+        if (k < STABLE && !value)
+            (*failures)++;
+        if (value && json_integer_value(value) % NKEYS != k)
+            (*failures)++;
+        json_concurrent_leave();
+    }
+    return NULL;
+}
+
+static void readers_and_a_writer() {
+    pthread_t threads[NREADERS];
+    unsigned int failures[NREADERS];
+    char buf[16];
+    int i, round;
+
+    shared = json_object_concurrent();
+    if (!shared)
+        return;
+
+    for (i = 0; i < STABLE; i++) {
+        make_key(buf, i);
+        json_object_set_new(shared, buf, json_integer(i));
+    }
+
+    done = 0;
+    for (i = 0; i < NREADERS; i++) {
+        failures[i] = 0;
+        if (pthread_create(&threads[i], NULL, reader, &failures[i]))
+            fail("unable to start a thread");
+    }
+
+    /* replace the stable members and keep adding and removing the other
+       ones, which grows the tables while the readers look at them */
+    for (round = 1; round <= 20; round++) {
+        for (i = 0; i < NKEYS; i++) {
+            make_key(buf, i);
+            if (i < STABLE || round % 2)
+                json_object_set_new(shared, buf, json_integer(round * NKEYS + i));
+            else
+                json_object_del(shared, buf);
+        }
+    }
+
+    set_done();
+    for (i = 0; i < NREADERS; i++) {
+        pthread_join(threads[i], NULL);
+        if (failures[i])
+            fail("a reader saw a wrong value");
+    }
+
+    check_members(shared, 0, STABLE, 1);
+    check_members(shared, STABLE, NKEYS, 0);
+    json_decref(shared);
+}
+#endif
+
+static void run_tests() {
+    basics();
+    deferred_release();
+#ifdef THREADED_TESTS
+    readers_and_a_writer();
+#endif
+}
@@ -364,6 +364,99 @@ static void test_deep_copy_circular_references(void) {
     json_decref(json);
 }
 
+static void test_deep_copy_cow(void) {
+    const char *template = "{\"status\": \"ok\", \"page\": {\"title\": \"t\","
+                           " \"items\": [{\"id\": 1}, {\"id\": 2}], \"n\": 2},"
+                           " \"defaults\": {\"x\": [1, 2, 3]}}";
+    json_t *json, *orig, *copy, *copy2, *items, *item;
+    char *dumped, *expected;
+
+    if (json_deep_copy_cow(NULL))
+        fail("copying NULL doesn't return NULL");
+
+    json = json_loads(template, 0, NULL);
+    orig = json_deep_copy(json);
+
+    /* nothing is copied until it's used */
+    copy = json_deep_copy_cow(json);
+    if (!copy || copy == json || json->refcount != 2)
+        fail("json_deep_copy_cow failed");
+
+    dumped = json_dumps(copy, JSON_SORT_KEYS);
+    expected = json_dumps(json, JSON_SORT_KEYS);
+    if (!dumped || strcmp(dumped, expected))
+        fail("dumping an unused copy-on-write copy failed");
+    free(dumped);
+    free(expected);
+    if (json->refcount != 2)
+        fail("dumping a copy-on-write copy copied it");
+
+    if (!json_equal(copy, json))
+        fail("a copy-on-write copy isn't equal to the original");
+    if (json_object_size(copy) != 3 || json->refcount != 2)
+        fail("getting the size of a copy-on-write copy copied it");
+
+    /* modify the copy from the root down */
+    items = json_object_get(json_object_get(copy, "page"), "items");
+    item = json_array_get(items, 1);
+    if (!item || item == json_array_get(json_object_get(json_object_get(json, "page"),
+                                                        "items"),
+                                        1))
+        fail("a copy-on-write copy returned a value of the original");
+    if (json_object_set_new(item, "id", json_integer(3)) ||
+        json_string_set(json_object_get(json_object_get(copy, "page"), "title"), "u") ||
+        json_array_append_new(items, json_null()) ||
+        json_object_del(copy, "status"))
+        fail("unable to modify a copy-on-write copy");
+
+    if (!json_equal(json, orig))
+        fail("modifying a copy-on-write copy modified the original");
+    if (json_integer_value(json_object_get(item, "id")) != 3 ||
+        json_array_size(items) != 3 || json_object_get(copy, "status"))
+        fail("a copy-on-write copy wasn't modified");
+
+    /* the members that weren't used still refer to the original */
+    if (json_object_get(json, "defaults")->refcount != 2 || json->refcount != 1)
+        fail("a copy-on-write copy copied more than it had to");
+
+    /* a copy of a copy */
+    copy2 = json_deep_copy_cow(copy);
+    json_object_clear(json_object_get(copy2, "defaults"));
+    json_array_clear(json_object_get(json_object_get(copy2, "page"), "items"));
+    if (json_array_size(items) != 3 ||
+        json_array_size(json_object_get(json_object_get(copy, "defaults"), "x")) != 3 ||
+        !json_equal(json, orig))
+        fail("modifying a copy of a copy-on-write copy modified the others");
+    json_decref(copy2);
+
+    /* the original can go before the copy does */
+    json_decref(json);
+    if (json_integer_value(json_array_get(
+            json_object_get(json_object_get(copy, "defaults"), "x"), 2)) != 3)
+        fail("a copy-on-write copy lost its original");
+    json_decref(copy);
+
+    /* scalars are copied immediately */
+    json = json_string("foo");
+    copy = json_deep_copy_cow(json);
+    if (copy == json || !json_equal(copy, json))
+        fail("copying a string failed");
+    json_decref(copy);
+    json_decref(json);
+
+    /* a frozen original is shared without reference counting */
+    json = json_loads(template, 0, NULL);
+    json_freeze(json);
+    copy = json_deep_copy_cow(json);
+    if (json_array_set_new(json_object_get(json_object_get(copy, "defaults"), "x"), 0,
+                           json_integer(0)) ||
+        !json_equal(json, orig))
+        fail("modifying a copy-on-write copy of a frozen value failed");
+    json_decref(copy);
+    json_decref(json_thaw(json));
+    json_decref(orig);
+}
+
 static void run_tests() {
     test_copy_simple();
     test_deep_copy_simple();
@@ -372,4 +465,5 @@ static void run_tests() {
     test_copy_object();
     test_deep_copy_object();
     test_deep_copy_circular_references();
+    test_deep_copy_cow();
 }
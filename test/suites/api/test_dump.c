@@ -8,6 +8,8 @@
 #include "jansson_private_config.h"
 
 #include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -32,6 +34,9 @@ static void encode_null() {
     if (json_dumpb(NULL, NULL, 0, JSON_ENCODE_ANY) != 0)
         fail("json_dumpb didn't fail for NULL");
 
+    if (json_dump_size(NULL, JSON_ENCODE_ANY) != 0)
+        fail("json_dump_size didn't fail for NULL");
+
     if (json_dumpf(NULL, stderr, JSON_ENCODE_ANY) != -1)
         fail("json_dumpf didn't fail for NULL");
 
@@ -130,6 +135,69 @@ static void circular_references() {
     json_decref(json);
 }
 
+static void deep_circular_references() {
+    /* Circular references at all depths of a deeply nested value, to
+       and from the levels after the ones searched linearly */
+    static const int targets[] = {0, 5, 30, 31, 32, 33, 60, 98};
+    json_t *json, *levels[100], *copy;
+    char *result, *expected;
+    size_t i, j;
+
+    json = json_array();
+    levels[0] = json;
+    for (i = 1; i < 100; i++) {
+        levels[i] = i % 2 ? json_object() : json_array();
+        if (i % 2 == 0)
+            json_object_set_new(levels[i - 1], "x", levels[i]);
+        else
+            json_array_append_new(levels[i - 1], levels[i]);
+    }
+
+    expected = json_dumps(json, JSON_COMPACT);
+    if (!expected)
+        fail("json_dumps failed on a deep value");
+    result = json_dumps(json, JSON_COMPACT | JSON_NO_CYCLE_CHECK);
+    if (!result || strcmp(result, expected))
+        fail("json_dumps(JSON_NO_CYCLE_CHECK) returned an invalid value");
+    free(result);
+
+    copy = json_deep_copy(json);
+    if (!json_equal(copy, json))
+        fail("json_deep_copy failed on a deep value");
+    json_decref(copy);
+
+    for (i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+        for (j = targets[i] + 1; j < 100; j += 17) {
+            if (json_is_array(levels[j]))
+                json_array_append(levels[j], levels[targets[i]]);
+            else
+                json_object_set(levels[j], "loop", levels[targets[i]]);
+
+            if (json_dumps(json, 0))
+                fail("json_dumps encoded a deep circular reference!");
+            if (json_deep_copy(json))
+                fail("json_deep_copy copied a deep circular reference!");
+
+            if (json_is_array(levels[j]))
+                json_array_remove(levels[j], json_array_size(levels[j]) - 1);
+            else
+                json_object_del(levels[j], "loop");
+        }
+    }
+
+    /* the same value may appear many times, as long as it's not in
+       itself */
+    json_array_append(levels[98], levels[99]);
+    json_array_append(levels[2], levels[99]);
+    free(expected);
+    expected = json_dumps(json, JSON_COMPACT);
+    if (!expected || json_array_size(levels[98]) != 2 || json_array_size(levels[2]) != 2)
+        fail("json_dumps failed on a repeated value");
+    free(expected);
+
+    json_decref(json);
+}
+
 static void encode_other_than_array_or_object() {
     /* Encoding anything other than array or object should only
      * succeed if the JSON_ENCODE_ANY flag is used */
@@ -192,6 +260,41 @@ static void escape_slashes() {
     json_decref(json);
 }
 
+static void escape_positions() {
+    /* Characters that need escaping at every offset of a string that is
+       long enough to be scanned in blocks */
+    const char *special[] = {"\"", "\\", "/", "\n", "\x01", "\xc3\xa4"};
+    const char *escaped[] = {"\\\"", "\\\\", "\\/", "\\n", "\\u0001", "\\u00E4"};
+    const char *x = "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx";
+    size_t flags = JSON_ENCODE_ANY | JSON_ESCAPE_SLASH | JSON_ENSURE_ASCII;
+    char plain[80], expected[80];
+    int i, j;
+
+    for (i = 0; i < (int)(sizeof(special) / sizeof(special[0])); i++) {
+        for (j = 0; j < 64; j++) {
+            json_t *json, *loaded;
+            char *result;
+
+            snprintf(plain, sizeof(plain), "%.*s%s%.*s", j, x, special[i], 63 - j, x);
+            snprintf(expected, sizeof(expected), "\"%.*s%s%.*s\"", j, x, escaped[i],
+                     63 - j, x);
+
+            json = json_string(plain);
+            result = json_dumps(json, flags);
+            if (!result || strcmp(result, expected))
+                fail("json_dumps escaped a long string incorrectly");
+
+            loaded = json_loads(result, JSON_DECODE_ANY, NULL);
+            if (!loaded || !json_equal(json, loaded))
+                fail("json_loads did not round-trip a long escaped string");
+
+            json_decref(loaded);
+            json_decref(json);
+            free(result);
+        }
+    }
+}
+
 static void encode_nul_byte() {
     json_t *json;
     char *result;
@@ -243,6 +346,107 @@ static void dumpb() {
     json_decref(obj);
 }
 
+static void dump_size() {
+    static const size_t flags[] = {0,
+                                   JSON_COMPACT,
+                                   JSON_INDENT(4) | JSON_SORT_KEYS,
+                                   JSON_ENSURE_ASCII | JSON_ESCAPE_SLASH,
+                                   JSON_REAL_PRECISION(3) | JSON_EMBED};
+    json_t *json, *loop;
+    char *plain, *exact;
+    size_t i;
+
+    json = json_pack("{s:[i,f,n,b],s:s,s:{s:s},s:[]}", "list", 1, 2.5, 1, "str",
+                     "a/\u00e4\u20ac\"\n", "nested", "foo", "bar", "empty");
+    if (!json)
+        fail("json_pack failed");
+
+    for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+        plain = json_dumps(json, flags[i]);
+        exact = json_dumps(json, flags[i] | JSON_EXACT_SIZE);
+        if (!plain || !exact)
+            fail("json_dumps failed");
+
+        if (strcmp(plain, exact))
+            fail("json_dumps(JSON_EXACT_SIZE) returned a different value");
+        if (json_dump_size(json, flags[i]) != strlen(plain))
+            fail("json_dump_size returned a wrong size");
+        if (json_dumpb(json, NULL, 0, flags[i]) != strlen(plain))
+            fail("json_dumpb returned a wrong size");
+
+        free(plain);
+        free(exact);
+    }
+    json_decref(json);
+
+    /* an empty output */
+    json = json_array();
+    exact = json_dumps(json, JSON_EMBED | JSON_EXACT_SIZE);
+    if (!exact || exact[0] != '\0')
+        fail("json_dumps(JSON_EXACT_SIZE) failed for an empty output");
+    free(exact);
+
+    /* errors */
+    loop = json_array();
+    json_array_append_new(loop, json_array());
+    json_array_append(json_array_get(loop, 0), loop);
+    if (json_dump_size(loop, 0) != 0)
+        fail("json_dump_size didn't fail for a circular reference");
+    if (json_dumps(loop, JSON_EXACT_SIZE) != NULL)
+        fail("json_dumps(JSON_EXACT_SIZE) didn't fail for a circular reference");
+    json_array_clear(json_array_get(loop, 0));
+    json_decref(loop);
+
+    if (json_dump_size(json_null(), 0) != 0)
+        fail("json_dump_size didn't fail for null");
+    if (json_dump_size(json, JSON_ENCODE_ANY) != 2)
+        fail("json_dump_size failed for an empty array");
+    json_decref(json);
+}
+
+static void dump_numbers() {
+    json_int_t integers[40];
+    char expected[32];
+    size_t i, n = 0;
+    json_int_t p;
+    double d;
+
+    /* every power of ten, one less and the extremes */
+    for (p = 1; p <= (json_int_t)((~(unsigned long long)0 >> 1) / 10); p *= 10) {
+        integers[n++] = p - 1;
+        integers[n++] = -p;
+    }
+    integers[n++] = (json_int_t)(~(unsigned long long)0 >> 1);
+    integers[n] = -integers[n - 1] - 1;
+    n++;
+
+    for (i = 0; i < n; i++) {
+        json_t *json = json_integer(integers[i]);
+        char *result = json_dumps(json, JSON_ENCODE_ANY);
+
+        snprintf(expected, sizeof(expected), "%" JSON_INTEGER_FORMAT, integers[i]);
+        if (!result || strcmp(result, expected))
+            fail("json_dumps encoded an integer incorrectly");
+
+        free(result);
+        json_decref(json);
+    }
+
+    /* reals read back as the same value */
+    for (d = 1e-310, i = 0; i < 1000; d *= -1.7320508075688772, i++) {
+        json_t *json = json_real(d), *copy;
+        char *result = json_dumps(json, JSON_ENCODE_ANY);
+
+        copy = json_loads(result, JSON_DECODE_ANY, NULL);
+        if (!copy || json_real_value(copy) != d)
+            fail("json_dumps encoded a real incorrectly");
+
+        free(result);
+        json_decref(copy);
+        json_decref(json);
+    }
+}
+
 static void dumpfd() {
 #ifdef HAVE_UNISTD_H
     int fds[2] = {-1, -1};
@@ -270,6 +474,110 @@ static void dumpfd() {
 #endif
 }
 
+static char *join_iov(const json_dumpv_t *dv) {
+    const json_iovec_t *iov = json_dumpv_iov(dv);
+    size_t i, len = 0;
+    char *result = malloc(json_dumpv_size(dv) + 1);
+
+    if (!result)
+        fail("malloc failed");
+    for (i = 0; i < json_dumpv_count(dv); i++) {
+        memcpy(result + len, iov[i].base, iov[i].len);
+        len += iov[i].len;
+    }
+    if (len != json_dumpv_size(dv))
+        fail("json_dumpv_size returned a wrong size");
+    result[len] = '\0';
+    return result;
+}
+
+static void check_dumpv(const json_t *json, size_t flags) {
+    json_dumpv_t *dv = json_dumpv(json, flags);
+    char *result, *expected = json_dumps(json, flags);
+
+    if (!dv || !expected)
+        fail("json_dumpv failed");
+    result = join_iov(dv);
+    if (strcmp(result, expected))
+        fail("json_dumpv returned different output than json_dumps");
+    free(result);
+    free(expected);
+    json_dumpv_free(dv);
+}
+
+static void dumpv() {
+    char text[1001];
+    const json_iovec_t *iov;
+    json_dumpv_t *dv;
+    json_t *json, *value;
+    size_t i;
+    int referred = 0;
+
+    memset(text, 'a', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    value = json_string(text);
+    text[500] = '"';
+    json = json_pack("{s:o, s:s, s:[i, s]}", "long", value, "escaped", text, "short",
+                     1, "x");
+
+    check_dumpv(json, 0);
+    check_dumpv(json, JSON_INDENT(2) | JSON_SORT_KEYS);
+    check_dumpv(json, JSON_ENSURE_ASCII | JSON_ESCAPE_SLASH);
+    check_dumpv(json_object_get(json, "short"), JSON_EMBED);
+
+    /* the long string is referred to instead of copied */
+    dv = json_dumpv(json, JSON_COMPACT);
+    iov = json_dumpv_iov(dv);
+    for (i = 0; i < json_dumpv_count(dv); i++) {
+        if (iov[i].base == json_string_value(value) && iov[i].len == 1000)
+            referred = 1;
+    }
+    if (!referred)
+        fail("json_dumpv copied a long string");
+    json_dumpv_free(dv);
+
+    if (json_dumpv(json_object_get(json, "escaped"), 0) ||
+        json_dumpv(NULL, JSON_ENCODE_ANY))
+        fail("json_dumpv encoded a string or NULL");
+    if (json_dumpv_count(NULL) != 0 || json_dumpv_iov(NULL) || json_dumpv_size(NULL))
+        fail("json_dumpv accessors failed for NULL");
+    json_dumpv_free(NULL);
+    json_decref(json);
+}
+
+static void dumpfd_writev() {
+#ifdef HAVE_UNISTD_H
+    char text[1001];
+    int fds[2] = {-1, -1};
+    json_t *a, *b;
+
+    if (pipe(fds))
+        fail("pipe() failed");
+
+    memset(text, 'b', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    a = json_pack("[s, s, i]", text, "short", 42);
+
+    if (json_dumpfd_writev(a, fds[1], 0))
+        fail("json_dumpfd_writev() failed");
+    close(fds[1]);
+
+    b = json_loadfd(fds[0], 0, NULL);
+    if (!b)
+        fail("json_loadfd() failed");
+    close(fds[0]);
+
+    if (!json_equal(a, b))
+        fail("json_equal() failed for writev test");
+
+    if (json_dumpfd_writev(a, -1, 0) == 0)
+        fail("json_dumpfd_writev() wrote to an invalid descriptor");
+
+    json_decref(a);
+    json_decref(b);
+#endif
+}
+
 static void embed() {
     static const char *plains[] = {"{\"bar\":[],\"foo\":{}}", "[[],{}]", "{}", "[]",
                                    NULL};
@@ -297,15 +605,95 @@ static void embed() {
     }
 }
 
+struct sort_key {
+    char key[16];
+    size_t len;
+};
+
+static int compare_sort_keys(const void *a, const void *b) {
+    const struct sort_key *k1 = a, *k2 = b;
+    int res = memcmp(k1->key, k2->key, k1->len < k2->len ? k1->len : k2->len);
+    if (res)
+        return res;
+    return k1->len < k2->len ? -1 : k1->len > k2->len;
+}
+
+static void sort_keys() {
+    static const char *pieces[] = {"a", "b", "\x7f", "\xc3\xa4", "\xc3\xa5", ""};
+    struct sort_key keys[1000];
+    json_t *shuffled, *sorted, *nested;
+    char *dumped, *expected;
+    size_t i, j, n = 0, count, piece;
+    unsigned int seed = 1;
+
+    /* keys with common prefixes, NUL bytes and bytes above 0x7f */
+    while (n < sizeof(keys) / sizeof(keys[0])) {
+        seed = seed * 1103515245 + 12345;
+        count = (seed >> 16) % 6;
+        keys[n].len = 0;
+        for (j = 0; j < count; j++) {
+            seed = seed * 1103515245 + 12345;
+            piece = (seed >> 16) % 6;
+            /* the empty piece is a NUL byte */
+            memcpy(keys[n].key + keys[n].len, pieces[piece], strlen(pieces[piece]) + 1);
+            keys[n].len += piece == 5 ? 1 : strlen(pieces[piece]);
+        }
+        for (i = 0; i < n; i++) {
+            if (keys[i].len == keys[n].len &&
+                !memcmp(keys[i].key, keys[n].key, keys[n].len))
+                break;
+        }
+        if (i == n)
+            n++;
+    }
+
+    shuffled = json_object();
+    for (i = 0; i < n; i++) {
+        nested = json_pack("{s:i, s:i, s:i}", "y", (int)i, "x", 1, "xy", 2);
+        json_object_setn_new(shuffled, keys[i].key, keys[i].len, nested);
+    }
+    if (json_object_size(shuffled) != n)
+        fail("json_object_setn_new failed");
+
+    /* objects keep the insertion order */
+    qsort(keys, n, sizeof(keys[0]), compare_sort_keys);
+    sorted = json_object();
+    for (i = 0; i < n; i++) {
+        nested = json_object_getn(shuffled, keys[i].key, keys[i].len);
+        json_object_setn_new(sorted, keys[i].key, keys[i].len,
+                             json_pack("{s:O, s:O, s:O}", "x",
+                                       json_object_get(nested, "x"), "xy",
+                                       json_object_get(nested, "xy"), "y",
+                                       json_object_get(nested, "y")));
+    }
+
+    dumped = json_dumps(shuffled, JSON_SORT_KEYS | JSON_INDENT(1));
+    expected = json_dumps(sorted, JSON_INDENT(1));
+    if (!dumped || !expected || strcmp(dumped, expected))
+        fail("json_dumps(JSON_SORT_KEYS) returned wrongly sorted keys");
+
+    free(dumped);
+    free(expected);
+    json_decref(shuffled);
+    json_decref(sorted);
+}
+
 static void run_tests() {
     encode_null();
     encode_twice();
     circular_references();
+    deep_circular_references();
     encode_other_than_array_or_object();
     escape_slashes();
+    escape_positions();
     encode_nul_byte();
     dump_file();
     dumpb();
+    dump_size();
+    dump_numbers();
     dumpfd();
+    dumpv();
+    dumpfd_writev();
     embed();
+    sort_keys();
 }
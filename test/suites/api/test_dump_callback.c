@@ -26,6 +26,67 @@ static int my_writer(const char *buffer, size_t len, void *data) {
     return 0;
 }
 
+struct counting_sink {
+    struct my_sink sink;
+    int calls;
+    size_t max_len;
+    int split_utf8;
+};
+
+static int counting_writer(const char *buffer, size_t len, void *data) {
+    struct counting_sink *c = data;
+
+    c->calls++;
+    if (len > c->max_len)
+        c->max_len = len;
+    if (len && ((unsigned char)buffer[0] & 0xC0) == 0x80)
+        c->split_utf8 = 1;
+    return my_writer(buffer, len, &c->sink);
+}
+
+static void test_buffered_output() {
+    struct counting_sink c;
+    json_t *json;
+    char *dumped_to_string;
+    int i;
+
+    /* thousands of small tokens, some of them with multi-byte characters */
+    json = json_array();
+    for (i = 0; i < 2000; i++) {
+        json_array_append_new(json, json_integer(i));
+        json_array_append_new(json, json_string("\xc3\xa4\xe2\x82\xac"));
+    }
+
+    dumped_to_string = json_dumps(json, JSON_INDENT(2));
+    if (!dumped_to_string)
+        fail("json_dumps failed");
+
+    c.sink.off = 0;
+    c.sink.cap = strlen(dumped_to_string);
+    c.sink.buf = malloc(c.sink.cap);
+    c.calls = 0;
+    c.max_len = 0;
+    c.split_utf8 = 0;
+
+    if (json_dump_callback(json, counting_writer, &c, JSON_INDENT(2)))
+        fail("json_dump_callback failed");
+
+    if (c.sink.off != c.sink.cap || memcmp(dumped_to_string, c.sink.buf, c.sink.off))
+        fail("buffered json_dump_callback output differs from json_dumps");
+
+    /* the output is passed in blocks that are mostly full, unless
+       buffering has been disabled at build time */
+    if (c.max_len > 64 && (size_t)c.calls > c.sink.off / (c.max_len / 2) + 1)
+        fail("json_dump_callback didn't fill its output blocks");
+
+    if (c.split_utf8)
+        fail("json_dump_callback split a UTF-8 sequence");
+
+    free(c.sink.buf);
+    free(dumped_to_string);
+    json_decref(json);
+}
+
 static void run_tests() {
     struct my_sink s;
     json_t *json;
@@ -79,4 +140,6 @@ static void run_tests() {
     json_decref(json);
     free(dumped_to_string);
     free(s.buf);
+
+    test_buffered_output();
 }
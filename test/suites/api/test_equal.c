@@ -7,6 +7,7 @@
 
 #include "util.h"
 #include <jansson.h>
+#include <string.h>
 
 static void test_equal_simple() {
     json_t *value1, *value2;
@@ -194,9 +195,81 @@ static void test_equal_complex() {
     json_decref(value3);
 }
 
+static void test_hash(void) {
+    const char *text = "{\"a\": [1, 2.5, \"x\"], \"b\": {\"c\": null, \"d\": -0.0}}";
+    const char *reordered = "{\"b\": {\"d\": 0.0, \"c\": null}, \"a\": [1, 2.5, \"x\"]}";
+    json_t *value1, *value2, *copy;
+    json_keys_t *keys;
+    size_t hash;
+
+    if (json_hash(NULL) != 0)
+        fail("json_hash of NULL isn't 0");
+
+    /* equal values have equal hashes */
+    value1 = json_loads(text, 0, NULL);
+    value2 = json_loads(reordered, 0, NULL);
+    hash = json_hash(value1);
+    if (!hash || json_hash(value2) != hash)
+        fail("json_hash depends on the order of the members");
+    json_decref(value2);
+
+    keys = json_keys_new();
+    value2 = json_loadb_interned(text, strlen(text), 0, keys, NULL);
+    if (json_hash(value2) != hash)
+        fail("json_hash of an object with shared keys differs");
+    json_decref(value2);
+    json_keys_free(keys);
+
+    copy = json_deep_copy_cow(value1);
+    if (json_hash(copy) != hash)
+        fail("json_hash of a copy-on-write copy differs");
+    json_decref(copy);
+
+    /* the hash depends on the order of elements and on the types */
+    value2 = json_pack("[i, i]", 1, 2);
+    copy = json_pack("[i, i]", 2, 1);
+    if (json_hash(value2) == json_hash(copy))
+        fail("json_hash doesn't depend on the order of elements");
+    json_decref(value2);
+    json_decref(copy);
+
+    value2 = json_integer(1);
+    copy = json_real(1.0);
+    if (json_hash(value2) == json_hash(copy))
+        fail("json_hash doesn't depend on the type");
+    json_decref(value2);
+    json_decref(copy);
+
+    /* a mutable value's hash follows its changes */
+    json_array_set_new(json_object_get(value1, "a"), 0, json_integer(2));
+    if (json_hash(value1) == hash)
+        fail("json_hash didn't change");
+    json_array_set_new(json_object_get(value1, "a"), 0, json_integer(1));
+    if (json_hash(value1) != hash)
+        fail("json_hash didn't change back");
+
+    /* a frozen value remembers its hash until it's thawed */
+    value2 = json_loads(reordered, 0, NULL);
+    json_freeze(value1);
+    json_freeze(value2);
+    if (json_hash(value1) != hash || json_hash(value1) != hash ||
+        !json_equal(value1, value2))
+        fail("json_hash of a frozen value differs");
+    json_thaw(value2);
+    json_object_set_new(json_object_get(value2, "b"), "c", json_false());
+    json_freeze(value2);
+    if (json_hash(value2) == hash || json_equal(value1, value2) ||
+        json_equal(value2, value1))
+        fail("a thawed value kept its hash");
+
+    json_decref(json_thaw(value1));
+    json_decref(json_thaw(value2));
+}
+
 static void run_tests() {
     test_equal_simple();
     test_equal_array();
     test_equal_object();
     test_equal_complex();
+    test_hash();
 }
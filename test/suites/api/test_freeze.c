@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <string.h>
+
+static const char text[] =
+    "{\"name\": \"config\", \"limits\": {\"rate\": 100, \"burst\": 2.5},"
+    " \"hosts\": [\"a\", \"b\", null], \"debug\": false}";
+
+static void test_freeze_simple(void) {
+    json_t *json, *limits, *hosts, *name, *response, *copy;
+
+    if (json_freeze(NULL) != -1)
+        fail("json_freeze accepted NULL");
+    if (json_thaw(NULL))
+        fail("json_thaw didn't return NULL for NULL");
+    if (json_freeze(json_true()) || json_freeze(json_null()))
+        fail("freezing a singleton failed");
+
+    json = json_loads(text, 0, NULL);
+    if (!json)
+        fail("unable to parse the document");
+    if (json_freeze(json))
+        fail("json_freeze failed");
+    if (json_freeze(json) != -1)
+        fail("a frozen value was frozen again");
+
+    limits = json_object_get(json, "limits");
+    hosts = json_object_get(json, "hosts");
+    name = json_object_get(json, "name");
+
+    /* reference counting doesn't touch frozen values */
+    json_incref(limits);
+    json_decref(limits);
+    json_decref(limits);
+    json_decref(json);
+    if (limits->refcount != (size_t)-1 || json->refcount != (size_t)-1)
+        fail("reference counting touched a frozen value");
+
+    /* nothing can be modified */
+    if (!json_object_set_new(json, "new", json_integer(1)) ||
+        !json_object_del(json, "name") || !json_object_clear(json) ||
+        !json_object_update(limits, json))
+        fail("a frozen object was modified");
+    if (!json_array_append_new(hosts, json_null()) || !json_array_remove(hosts, 0) ||
+        !json_array_clear(hosts) || !json_array_set_new(hosts, 0, json_false()))
+        fail("a frozen array was modified");
+    if (!json_string_set(name, "other") ||
+        !json_integer_set(json_object_get(limits, "rate"), 1) ||
+        !json_real_set(json_object_get(limits, "burst"), 1.0))
+        fail("a frozen scalar was modified");
+    if (json_object_size(json) != 4 || json_array_size(hosts) != 3 ||
+        strcmp(json_string_value(name), "config"))
+        fail("a frozen value changed");
+
+    /* pieces can be attached to other values and released with them */
+    response = json_pack("{s:O, s:[O, O]}", "limits", limits, "hosts", name, name);
+    if (!response)
+        fail("unable to attach frozen values");
+    json_decref(response);
+    if (json_integer_value(json_object_get(limits, "rate")) != 100)
+        fail("releasing a value released the frozen values in it");
+
+    /* copies can be modified */
+    copy = json_deep_copy(json);
+    if (!json_equal(copy, json))
+        fail("deep copying a frozen value failed");
+    if (json_object_set_new(json_object_get(copy, "limits"), "rate", json_integer(1)) ||
+        json_array_clear(json_object_get(copy, "hosts")))
+        fail("unable to modify a deep copy of a frozen value");
+    json_decref(copy);
+
+    copy = json_copy(json);
+    if (json_object_del(copy, "hosts") || json_object_size(copy) != 3)
+        fail("unable to modify a shallow copy of a frozen value");
+    if (!json_object_set_new(json_object_get(copy, "limits"), "rate", json_integer(1)))
+        fail("a frozen value shared by a shallow copy was modified");
+    json_decref(copy);
+
+    /* thawing makes the document usable and releasable again */
+    if (json_thaw(json) != json || json->refcount != 1 || limits->refcount != 1)
+        fail("json_thaw failed");
+    if (json_object_set_new(limits, "rate", json_integer(5)) ||
+        json_array_append_new(hosts, json_string("c")))
+        fail("unable to modify a thawed document");
+    json_decref(json);
+}
+
+static void test_freeze_shared(void) {
+    json_t *json, *value;
+
+    /* the caller must have the only reference */
+    json = json_loads(text, 0, NULL);
+    json_incref(json);
+    if (json_freeze(json) != -1)
+        fail("a value referenced twice was frozen");
+    json_decref(json);
+
+    /* and the values in it must only be referenced by their parents */
+    value = json_incref(json_object_get(json, "limits"));
+    if (json_freeze(json) != -1)
+        fail("a document with a shared value was frozen");
+    if (json_object_set_new(json, "new", json_true()) ||
+        json_object_set_new(value, "new", json_true()))
+        fail("a failed json_freeze froze something");
+    json_decref(value);
+
+    value = json_array();
+    json_array_append(value, json_object_get(json, "limits"));
+    json_array_append(value, json_object_get(json, "limits"));
+    if (json_freeze(value) != -1)
+        fail("an array with the same value twice was frozen");
+    json_decref(value);
+
+    if (json_freeze(json))
+        fail("unable to freeze after the other references were released");
+    json_decref(json_thaw(json));
+}
+
+static void test_freeze_lazy(void) {
+    const char lazy[] = "{\"a\": [1, {\"b\": [2, 3]}], \"c\": {\"d\": \"e\"}}";
+    const char bad[] = "{\"a\": [1, {\"b\": [2, 3]}], \"c\": {\"d\" \"e\"}}";
+    json_t *json, *expected;
+
+    /* containers that haven't been decoded yet are decoded */
+    json = json_loadb_lazy(lazy, strlen(lazy), 0, NULL);
+    expected = json_loads(lazy, 0, NULL);
+    if (!json || json_freeze(json))
+        fail("unable to freeze a lazily decoded document");
+    if (!json_equal(json, expected))
+        fail("a frozen lazily decoded document is wrong");
+    json_decref(json_thaw(json));
+    json_decref(expected);
+
+    /* and nothing invalid is left for freezing to find */
+    json = json_loadb_lazy(bad, strlen(bad), 0, NULL);
+    if (json)
+        fail("json_loadb_lazy succeeded on an invalid container");
+}
+
+static void run_tests() {
+    test_freeze_simple();
+    test_freeze_shared();
+    test_freeze_lazy();
+}
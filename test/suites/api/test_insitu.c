@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char text[] =
+    "{\"plain\": \"value\", \"esc\\taped\": \"a\\\"b\\\\c\\n\","
+    " \"unicode\": [\"\\u00e4\\ud834\\udd1e\", \"\xc3\xa4x\", \"\"],"
+    " \"other\": [1, 2.5, true, null]}";
+
+static int malloc_calls = 0;
+
+static void *counting_malloc(size_t size) {
+    malloc_calls++;
+    return malloc(size);
+}
+
+static int in_buffer(const char *value, const char *buffer, size_t buflen) {
+    return value >= buffer && value < buffer + buflen;
+}
+
+static void decode_in_place() {
+    char buffer[sizeof(text) + 7];
+    size_t len = strlen(text);
+    json_t *json, *expected, *list, *copy;
+    json_error_t error;
+    size_t i;
+
+    /* bytes after buflen are not part of the input */
+    memcpy(buffer, text, len);
+    memcpy(buffer + len, "garbage", 7);
+
+    expected = json_loadb(text, len, 0, NULL);
+    json = json_loadb_insitu(buffer, len, 0, &error);
+    if (!json)
+        fail("json_loadb_insitu failed");
+    if (!json_equal(json, expected))
+        fail("json_loadb_insitu returned a different value than json_loadb");
+    if (memcmp(buffer + len, "garbage", 7))
+        fail("json_loadb_insitu modified the buffer after buflen");
+    if ((size_t)error.position != len)
+        fail("json_loadb_insitu returned a wrong position");
+
+    if (!json_object_get(json, "esc\taped"))
+        fail("json_loadb_insitu returned a wrong key");
+
+    list = json_object_get(json, "unicode");
+    if (json_string_length(json_array_get(list, 0)) != 6 ||
+        strcmp(json_string_value(json_array_get(list, 0)), "\xc3\xa4\xf0\x9d\x84\x9e"))
+        fail("json_loadb_insitu returned a wrong Unicode string");
+
+    /* all string values refer to the buffer */
+    if (!in_buffer(json_string_value(json_object_get(json, "plain")), buffer, len) ||
+        !in_buffer(json_string_value(json_object_get(json, "esc\taped")), buffer, len))
+        fail("json_loadb_insitu copied a string");
+    for (i = 0; i < json_array_size(list); i++) {
+        if (!in_buffer(json_string_value(json_array_get(list, i)), buffer, len))
+            fail("json_loadb_insitu copied a string");
+    }
+
+    /* copies and new values don't */
+    copy = json_deep_copy(json);
+    if (json_string_set(json_array_get(list, 1), "new value"))
+        fail("json_string_set failed on an in situ string");
+    if (in_buffer(json_string_value(json_array_get(list, 1)), buffer, len))
+        fail("json_string_set kept referring to the buffer");
+
+    memset(buffer, 'x', len);
+    if (!json_equal(copy, expected))
+        fail("json_deep_copy referred to the buffer");
+    if (strcmp(json_string_value(json_array_get(list, 1)), "new value"))
+        fail("json_string_set referred to the buffer");
+
+    json_decref(copy);
+    json_decref(json);
+    json_decref(expected);
+}
+
+static void errors_match_loadb() {
+    static const char *const inputs[] = {
+        "[\"abc", "[\"abc\\", "[\"a\\x\"]", "[\"\\u12\"]", "[\"\\udc00\"]", "[\"a\xff\"]",
+        "[\"a\"b]", "{\"a\" 1}", "{\"a\": 1, \"a\": 2}", "[\"\\u0000\"]",
+        "[\"a\", \"b\"] x", "{\"a\\u0000\": 1}",
+        "[\"a long string that does not fit into the error context\" x]"};
+    json_error_t expected, error;
+    json_t *json;
+    size_t i;
+
+    for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        size_t len = strlen(inputs[i]);
+        char *buffer = malloc(len);
+
+        memcpy(buffer, inputs[i], len);
+        if (json_loadb(inputs[i], len, JSON_REJECT_DUPLICATES, &expected))
+            fail("json_loadb succeeded on invalid input");
+
+        json = json_loadb_insitu(buffer, len, JSON_REJECT_DUPLICATES, &error);
+        if (json)
+            fail("json_loadb_insitu succeeded on invalid input");
+        if (strcmp(error.text, expected.text) || strcmp(error.source, expected.source) ||
+            error.line != expected.line || error.column != expected.column ||
+            error.position != expected.position)
+            fail("json_loadb_insitu returned a different error than json_loadb");
+        free(buffer);
+    }
+
+    json = json_loadb_insitu(NULL, 0, 0, &error);
+    if (json)
+        fail("json_loadb_insitu succeeded without a buffer");
+    check_error(json_error_invalid_argument, "wrong arguments", "<buffer>", -1, -1, 0);
+}
+
+static void saves_allocations() {
+    char *big, *copy;
+    size_t i, len = 0;
+    int loadb_calls, insitu_calls;
+    json_t *json;
+
+    /* strings that are too long to be stored inline in the values */
+    big = malloc(1000 * 50 + 3);
+    big[len++] = '[';
+    for (i = 0; i < 1000; i++)
+        len += sprintf(big + len, "%s\"a string with a long value %d\"", i ? "," : "",
+                       (int)i);
+    big[len++] = ']';
+    copy = malloc(len);
+    memcpy(copy, big, len);
+
+    json_set_alloc_funcs(counting_malloc, free);
+
+    malloc_calls = 0;
+    json = json_loadb(big, len, 0, NULL);
+    loadb_calls = malloc_calls;
+    json_decref(json);
+
+    malloc_calls = 0;
+    json = json_loadb_insitu(copy, len, 0, NULL);
+    insitu_calls = malloc_calls;
+    if (json_array_size(json) != 1000 ||
+        strcmp(json_string_value(json_array_get(json, 999)),
+               "a string with a long value 999"))
+        fail("json_loadb_insitu failed");
+    json_decref(json);
+
+    json_set_alloc_funcs(malloc, free);
+
+    /* one allocation less for each string */
+    if (insitu_calls + 1000 > loadb_calls)
+        fail("json_loadb_insitu allocated the strings");
+
+    free(copy);
+    free(big);
+}
+
+static void run_tests() {
+    decode_in_place();
+    errors_match_loadb();
+    saves_allocations();
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char text[] = "[{\"id\": 1, \"name\": \"a\", \"tags\": {\"id\": true}},"
+                           " {\"name\": \"b\", \"id\": 2}, {}]";
+
+static void load_interned() {
+    json_keys_t *keys;
+    json_t *json, *expected, *first, *second, *value;
+    json_error_t error;
+    const char *key;
+    size_t count;
+
+    keys = json_keys_new();
+    if (!keys || json_keys_size(keys) != 0)
+        fail("json_keys_new failed");
+
+    expected = json_loadb(text, strlen(text), 0, NULL);
+    json = json_loadb_interned(text, strlen(text), 0, keys, &error);
+    if (!json)
+        fail("json_loadb_interned failed");
+    if ((size_t)error.position != strlen(text))
+        fail("json_loadb_interned returned a wrong position");
+    if (!json_equal(json, expected))
+        fail("json_loadb_interned returned a different value than json_loadb");
+    if (json_keys_size(keys) != 3)
+        fail("json_loadb_interned added a wrong number of keys");
+
+    /* equal keys of different objects are the same string */
+    first = json_array_get(json, 0);
+    second = json_array_get(json, 1);
+    if (json_object_iter_key(json_object_iter_at(first, "name")) !=
+            json_object_iter_key(json_object_iter_at(second, "name")) ||
+        json_object_iter_key(json_object_iter_at(first, "id")) !=
+            json_object_iter_key(
+                json_object_iter_at(json_object_get(first, "tags"), "id")))
+        fail("json_loadb_interned didn't share a key");
+
+    /* iteration works */
+    count = 0;
+    json_object_foreach(second, key, value) {
+        if (count == 0 && (strcmp(key, "name") || strcmp(json_string_value(value), "b")))
+            fail("json_object_foreach returned a wrong first member");
+        if (count == 1 && (strcmp(key, "id") || json_integer_value(value) != 2))
+            fail("json_object_foreach returned a wrong second member");
+        count++;
+    }
+    if (count != 2)
+        fail("json_object_foreach returned a wrong number of members");
+
+    key = json_object_iter_key(json_object_iter(second));
+    if (json_object_key_to_iter(key))
+        fail("json_object_key_to_iter returned an iterator for a shared key");
+    if (json_object_iter_from_key(second, key) != json_object_iter(second) ||
+        json_object_iter_from_key(json_array_get(json, 2), key))
+        fail("json_object_iter_from_key failed");
+
+    /* the keys stay valid without the table */
+    json_keys_free(keys);
+    if (!json_equal(json, expected))
+        fail("freeing the key table changed the value");
+
+    json_decref(json);
+    json_decref(expected);
+}
+
+static void set_interned() {
+    json_keys_t *keys = json_keys_new();
+    json_t *object, *other, *copy, *array;
+    json_key_t key;
+    void *iter;
+    char name[32];
+    int i;
+
+    object = json_object();
+    other = json_object();
+    if (json_object_set_new_interned(object, keys, "key", json_integer(1)) ||
+        json_object_set_new_interned(other, keys, "key", json_integer(2)) ||
+        json_object_setn_new_interned(object, keys, "key2", 3, json_integer(3)))
+        fail("json_object_set_new_interned failed");
+    if (json_keys_size(keys) != 1 || json_object_size(object) != 1 ||
+        json_integer_value(json_object_get(object, "key")) != 3)
+        fail("json_object_set_new_interned didn't replace a member");
+
+    array = json_array();
+    if (!json_object_set_new_interned(object, keys, "\xff", json_integer(1)) ||
+        !json_object_set_new_interned(object, NULL, "key", json_integer(1)) ||
+        !json_object_set_new_interned(object, keys, NULL, json_integer(1)) ||
+        !json_object_set_new_interned(array, keys, "key", json_integer(1)))
+        fail("json_object_set_new_interned accepted wrong arguments");
+    json_decref(array);
+
+    /* a key from the table finds the member without hashing */
+    key = json_keys_intern(keys, "key", 3);
+    if (json_integer_value(json_object_get_key(other, key)) != 2)
+        fail("json_object_get_key failed with an interned key");
+    if (json_keys_intern(NULL, "key", 3).key)
+        fail("json_keys_intern succeeded without a table");
+
+    /* large objects have an index */
+    for (i = 0; i < 100; i++) {
+        snprintf(name, sizeof(name), "member %d", i);
+        if (json_object_set_new_interned(other, keys, name, json_integer(i)))
+            fail("json_object_set_new_interned failed");
+    }
+    if (json_object_size(other) != 101 ||
+        json_integer_value(json_object_get(other, "member 50")) != 50)
+        fail("a large object with shared keys is wrong");
+    key = json_keys_intern(keys, "member 99", 9);
+    if (json_integer_value(json_object_get_key(other, key)) != 99)
+        fail("json_object_get_key failed with an interned key");
+    iter = json_object_iter_at(other, "member 70");
+    if (json_object_iter_from_key(other, json_object_iter_key(iter)) != iter)
+        fail("json_object_iter_from_key failed on a large object");
+
+    /* copies share the keys too, and the members can be deleted */
+    copy = json_deep_copy(other);
+    if (!json_equal(copy, other) ||
+        json_object_iter_key(json_object_iter(copy)) !=
+            json_object_iter_key(json_object_iter(other)))
+        fail("json_deep_copy didn't share the keys");
+    if (json_object_del(copy, "member 10") || json_object_size(copy) != 100 ||
+        json_object_get(copy, "member 10"))
+        fail("json_object_del failed with a shared key");
+    json_decref(copy);
+
+    copy = json_copy(object);
+    if (json_object_update(copy, other) || json_object_size(copy) != 101)
+        fail("json_object_update failed with shared keys");
+    json_decref(copy);
+
+    /* an object that didn't ask for shared keys doesn't get them */
+    copy = json_object();
+    if (json_object_update(copy, other) || !json_equal(copy, other))
+        fail("json_object_update failed with shared keys");
+    iter = json_object_iter(copy);
+    if (json_object_key_to_iter(json_object_iter_key(iter)) != iter)
+        fail("json_object_update shared a key with an ordinary object");
+    json_object_clear(copy);
+    if (json_object_update_missing(copy, other) ||
+        json_object_update_existing(copy, other) ||
+        json_object_key_to_iter(json_object_iter_key(json_object_iter(copy))) !=
+            json_object_iter(copy))
+        fail("json_object_update_missing shared a key with an ordinary object");
+    json_decref(copy);
+
+    json_keys_free(keys);
+    json_keys_free(NULL);
+    json_decref(object);
+    json_decref(other);
+}
+
+static void interned_errors() {
+    json_keys_t *keys = json_keys_new();
+    const char *input = "[{\"a\": 1}, {\"a\": 1, \"a\": 2}]";
+    json_error_t error;
+
+    if (json_loadb_interned(input, strlen(input), JSON_REJECT_DUPLICATES, keys, &error))
+        fail("json_loadb_interned accepted a duplicate key");
+    check_error(json_error_duplicate_key, "duplicate object key near '\"a\"'", "<buffer>",
+                1, 23, 23);
+
+    if (json_loadb_interned(input, strlen(input), 0, NULL, &error))
+        fail("json_loadb_interned succeeded without a key table");
+    check_error(json_error_invalid_argument, "wrong arguments", "<buffer>", -1, -1, 0);
+
+    json_keys_free(keys);
+}
+
+static void run_tests() {
+    load_interned();
+    set_interned();
+    interned_errors();
+}
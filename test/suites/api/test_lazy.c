@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char text[] =
+    "{\"id\": 1, \"route\": \"/a\", \"body\": {\"items\": [1, 2.5, \"]\\\"}\", "
+    "{\"[\": \"{\"}], \"s\": \"\\\\\"}, \"list\": [[], {}, [null, true]]}";
+
+static void check_dump(const json_t *json, size_t flags, const char *expected) {
+    char *result = json_dumps(json, flags);
+
+    if (!result || strcmp(result, expected)) {
+        failhdr;
+        fprintf(stderr, "json_dumps returned %s, expected %s\n", result, expected);
+        exit(1);
+    }
+    free(result);
+}
+
+static void load_lazily() {
+    json_t *json, *expected, *body, *copy;
+    json_error_t error;
+    char *buffer;
+
+    expected = json_loads(text, 0, NULL);
+    json = json_loadb_lazy(text, strlen(text), 0, &error);
+    if (!json)
+        fail("json_loadb_lazy failed");
+    if ((size_t)error.position != strlen(text))
+        fail("json_loadb_lazy returned a wrong position");
+
+    if (json_integer_value(json_object_get(json, "id")) != 1 ||
+        strcmp(json_string_value(json_object_get(json, "route")), "/a"))
+        fail("json_loadb_lazy returned a wrong top-level value");
+
+    body = json_object_get(json, "body");
+    if (json_object_size(body) != 2 ||
+        json_array_size(json_object_get(body, "items")) != 4 ||
+        strcmp(json_string_value(json_array_get(json_object_get(body, "items"), 2)),
+               "]\"}"))
+        fail("json_loadb_lazy returned a wrong nested value");
+
+    if (!json_equal(json, expected))
+        fail("json_loadb_lazy returned a different value than json_loads");
+    json_decref(json);
+
+    /* a deep copy doesn't refer to the input */
+    buffer = strdup(text);
+    json = json_loadb_lazy(buffer, strlen(buffer), 0, NULL);
+    copy = json_deep_copy(json);
+    json_decref(json);
+    memset(buffer, ' ', strlen(buffer));
+    free(buffer);
+    if (!json_equal(copy, expected))
+        fail("json_deep_copy of a lazy value failed");
+    json_decref(copy);
+
+    json_decref(expected);
+}
+
+static void dump_verbatim() {
+    const char *input = "{\"a\": 1, \"b\": {\"x\" :  [1,2 ], \"y\":{}}, \"c\": [ ]}";
+    json_t *json;
+
+    json = json_loadb_lazy(input, strlen(input), 0, NULL);
+    if (!json)
+        fail("json_loadb_lazy failed");
+
+    /* what hasn't been looked at is written as it was */
+    check_dump(json, 0, "{\"a\": 1, \"b\": {\"x\" :  [1,2 ], \"y\":{}}, \"c\": [ ]}");
+    check_dump(json_object_get(json, "b"), JSON_EMBED, "\"x\" :  [1,2 ], \"y\":{}");
+
+    /* looking at a member decodes its container only */
+    if (!json_object_get(json_object_get(json, "b"), "y"))
+        fail("json_object_get failed on a lazy object");
+    check_dump(json, JSON_COMPACT, "{\"a\":1,\"b\":{\"x\":[1,2 ],\"y\":{}},\"c\":[ ]}");
+
+    /* unless it has to be changed */
+    check_dump(json, JSON_SORT_KEYS,
+               "{\"a\": 1, \"b\": {\"x\": [1, 2], \"y\": {}}, \"c\": []}");
+    check_dump(json, JSON_INDENT(1) | JSON_COMPACT,
+               "{\n \"a\":1,\n \"b\":{\n  \"x\":[\n   1,\n   2\n  ],\n  \"y\":{}\n },\n"
+               " \"c\":[]\n}");
+
+    json_decref(json);
+
+    /* integers are written as they were decoded */
+    json = json_loadb_lazy(input, strlen(input), JSON_DECODE_INT_AS_REAL, NULL);
+    check_dump(json_object_get(json, "b"), JSON_COMPACT, "{\"x\":[1.0,2.0],\"y\":{}}");
+    json_decref(json);
+}
+
+static void modify_lazily() {
+    const char *input = "[[1, 2], {\"a\": 1}, [3], {\"b\": 2}]";
+    json_t *json, *copy;
+
+    json = json_loadb_lazy(input, strlen(input), 0, NULL);
+    if (!json)
+        fail("json_loadb_lazy failed");
+
+    if (json_array_append_new(json_array_get(json, 0), json_integer(3)))
+        fail("json_array_append_new failed on a lazy array");
+    if (json_object_set_new(json_array_get(json, 1), "b", json_integer(2)))
+        fail("json_object_set_new failed on a lazy object");
+    if (json_array_clear(json_array_get(json, 2)))
+        fail("json_array_clear failed on a lazy array");
+    if (json_object_clear(json_array_get(json, 3)))
+        fail("json_object_clear failed on a lazy object");
+
+    check_dump(json, JSON_COMPACT, "[[1,2,3],{\"a\":1,\"b\":2},[],{}]");
+
+    /* a shallow copy shares the members */
+    json_decref(json);
+    json = json_loadb_lazy(input, strlen(input), 0, NULL);
+    copy = json_copy(json_array_get(json, 1));
+    if (json_object_size(copy) != 1 ||
+        json_integer_value(json_object_get(copy, "a")) != 1)
+        fail("json_copy of a lazy object failed");
+    json_decref(copy);
+    json_decref(json);
+}
+
+static void compare_errors(const char *input, size_t flags) {
+    json_error_t expected, error;
+    json_t *json;
+
+    if (json_loadb(input, strlen(input), flags, &expected))
+        fail("json_loadb succeeded on invalid input");
+
+    json = json_loadb_lazy(input, strlen(input), flags, &error);
+    if (json && json_expand(json, &error) == 0)
+        fail("json_expand succeeded on invalid input");
+    json_decref(json);
+
+    if (strcmp(error.text, expected.text) || strcmp(error.source, expected.source) ||
+        error.line != expected.line || error.column != expected.column ||
+        error.position != expected.position ||
+        json_error_code(&error) != json_error_code(&expected)) {
+        failhdr;
+        fprintf(stderr, "%s: got %d:%d:%d %s, expected %d:%d:%d %s\n", input, error.line,
+                error.column, error.position, error.text, expected.line, expected.column,
+                expected.position, expected.text);
+        exit(1);
+    }
+}
+
+static void deferred_errors() {
+    const char *input = "{\"a\": [1, tru], \"b\": 2}";
+    json_error_t error;
+    json_t *json;
+    char *deep;
+    int i;
+
+    /* the text of a nested container is checked before it's deferred */
+    json = json_loadb_lazy(input, strlen(input), 0, &error);
+    if (json)
+        fail("json_loadb_lazy succeeded on an invalid nested container");
+    check_error(json_error_invalid_syntax, "invalid token near 'tru'", "<buffer>", 1, 13,
+                13);
+
+    /* errors are the same as when decoding at once */
+    compare_errors(input, 0);
+    compare_errors("{\"body\":{\"x\": 1 2 3,\"y\":[tru]}}", 0);
+    compare_errors("{\"a\": [[1], {\"b\": [1, 2,]}]}", 0);
+    compare_errors("{\"a\": {\"b\": 1e999}}", 0);
+    compare_errors("{\"a\": {\"b\": [1, 1e999]}}", JSON_DECODE_INT_AS_REAL);
+    compare_errors("{\"a\": [1, 2}", 0);
+    compare_errors("{\"a\": {\"b\": \"x}", 0);
+    compare_errors("[1, [2, [3", 0);
+    compare_errors("[1, {\"a\": \"b\\\"}]", 0);
+    compare_errors("{\"a\":\n  {\"b\": [],\n   \"c\": [1,\n    {\"\xc3\xa4\": 1x}]}}", 0);
+    compare_errors("{\"a\":\n {\"b\": 1\n, \"b\": 2}}", JSON_REJECT_DUPLICATES);
+    compare_errors("[[\"a\\u0000\"]]", 0);
+    compare_errors("[[1]] x", 0);
+
+    deep = malloc(2 * 3000 + 1);
+    for (i = 0; i < 3000; i++) {
+        deep[i] = '[';
+        deep[2 * 3000 - 1 - i] = ']';
+    }
+    deep[2 * 3000] = '\0';
+    compare_errors(deep, 0);
+    free(deep);
+
+    json = json_loadb_lazy(NULL, 0, 0, &error);
+    if (json)
+        fail("json_loadb_lazy succeeded without a buffer");
+    check_error(json_error_invalid_argument, "wrong arguments", "<buffer>", -1, -1, 0);
+
+    if (json_expand(NULL, &error) == 0)
+        fail("json_expand succeeded without a value");
+    check_error(json_error_invalid_argument, "wrong arguments", "<buffer>", -1, -1, 0);
+}
+
+static void run_tests() {
+    load_lazily();
+    dump_verbatim();
+    modify_lazily();
+    deferred_errors();
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char text[] = "{\"name\": \"limits\", \"list\": [1, 2.5, \"three\", null],"
+                           " \"nested\": {\"a\": {\"b\": true}}}";
+
+static json_t *load(const char *input, const json_load_limits_t *limits,
+                    json_error_t *error) {
+    return json_loadb_limited(input, strlen(input), 0, limits, error);
+}
+
+static void check_exceeded(const char *input, const json_load_limits_t *limits,
+                           const char *message) {
+    json_error_t error;
+
+    if (load(input, limits, &error))
+        fail("json_loadb_limited accepted input over its limits");
+    if (json_error_code(&error) != json_error_limit_exceeded)
+        fail("json_loadb_limited returned a wrong error code");
+    if (strncmp(error.text, message, strlen(message))) {
+        failhdr;
+        fprintf(stderr, "json_loadb_limited returned \"%s\", expected \"%s\"\n",
+                error.text, message);
+        exit(1);
+    }
+}
+
+static void no_limits() {
+    json_load_limits_t limits = {0, 0, 0, 0};
+    json_error_t error;
+    json_t *json, *expected;
+
+    json = load(text, &limits, &error);
+    expected = json_loads(text, 0, NULL);
+    if (!json || !json_equal(json, expected))
+        fail("json_loadb_limited failed without limits");
+    if ((size_t)error.position != strlen(text))
+        fail("json_loadb_limited returned a wrong position");
+    json_decref(json);
+    json_decref(expected);
+
+    if (json_loadb_limited(text, strlen(text), 0, NULL, &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_loadb_limited accepted NULL limits");
+    if (json_loadb_limited(NULL, 0, 0, &limits, NULL))
+        fail("json_loadb_limited accepted NULL");
+}
+
+static void values() {
+    json_load_limits_t limits = {0, 10, 0, 0};
+    json_t *json;
+
+    /* the object, its 3 members, 4 array elements, "a" and true */
+    json = load(text, &limits, NULL);
+    if (!json)
+        fail("json_loadb_limited failed with enough values");
+    json_decref(json);
+
+    limits.max_values = 9;
+    check_exceeded(text, &limits, "maximum number of values reached");
+
+    limits.max_values = 1;
+    check_exceeded("[1]", &limits, "maximum number of values reached");
+}
+
+static void strings() {
+    json_load_limits_t limits = {0, 0, 6, 0};
+    json_t *json;
+
+    json = load("{\"limits\": \"sixsix\", \"esc\\n\": \"\\u00e4\\u00e4\\u00e4\"}", &limits,
+                NULL);
+    if (!json)
+        fail("json_loadb_limited failed with short enough strings");
+    json_decref(json);
+
+    check_exceeded("[\"seven!!\"]", &limits, "maximum string length reached");
+    check_exceeded("{\"seven!!\": 1}", &limits, "maximum string length reached");
+    check_exceeded("[\"\\u00e4\\u00e4\\u00e4\\u00e4\"]", &limits,
+                   "maximum string length reached");
+    check_exceeded("[\"\\n\\n\\n\\n\\n\\n\\n\"]", &limits, "maximum string length reached");
+
+    /* a long string is rejected before it ends */
+    check_exceeded("[\"a\\nbcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyz", &limits,
+                   "maximum string length reached");
+}
+
+static void containers() {
+    json_load_limits_t limits = {0, 0, 0, 3};
+    json_t *json;
+
+    json = load("[[1, 2, 3], {\"a\": 1, \"b\": 2, \"c\": 3}]", &limits, NULL);
+    if (!json)
+        fail("json_loadb_limited failed with small enough containers");
+    json_decref(json);
+
+    check_exceeded("[1, 2, 3, 4]", &limits, "maximum container size reached");
+    check_exceeded("{\"a\": 1, \"b\": 2, \"c\": 3, \"d\": 4}", &limits,
+                   "maximum container size reached");
+    check_exceeded("[[1, 2, 3, 4], 5]", &limits, "maximum container size reached");
+}
+
+static void memory() {
+    json_load_limits_t limits = {0, 0, 0, 0};
+    json_error_t error;
+    json_t *json;
+    char big[4096];
+    int i;
+
+    strcpy(big, "[");
+    for (i = 0; i < 400; i++)
+        strcat(big, i ? ", [1]" : "[1]");
+    strcat(big, "]");
+
+    limits.max_bytes = 1024 * 1024;
+    json = load(big, &limits, &error);
+    if (!json) {
+        /* thread-local storage is needed for memory limits */
+        if (json_error_code(&error) == json_error_invalid_argument)
+            return;
+        fail("json_loadb_limited failed with enough memory");
+    }
+    json_decref(json);
+
+    limits.max_bytes = 1024;
+    check_exceeded(big, &limits, "maximum memory size reached");
+
+    /* the limit is per call, and other loads are not affected */
+    json = json_loads(big, 0, NULL);
+    if (!json || json_array_size(json) != 400)
+        fail("a memory limit affected json_loads");
+    json_decref(json);
+}
+
+typedef struct {
+    const char *data;
+    size_t size;
+} chunks_t;
+
+static size_t read_chunk(void *buffer, size_t buflen, void *arg) {
+    chunks_t *chunks = (chunks_t *)arg;
+    size_t len = buflen < 3 ? buflen : 3;
+
+    if (len > chunks->size)
+        len = chunks->size;
+    memcpy(buffer, chunks->data, len);
+    chunks->data += len;
+    chunks->size -= len;
+    return len;
+}
+
+static void callback() {
+    json_load_limits_t limits = {0, 0, 4, 0};
+    json_error_t error;
+    chunks_t chunks;
+    json_t *json;
+
+    chunks.data = "[\"four\", 5]";
+    chunks.size = strlen(chunks.data);
+    json = json_load_callback_limited(read_chunk, &chunks, 0, &limits, &error);
+    if (!json || json_array_size(json) != 2)
+        fail("json_load_callback_limited failed");
+    json_decref(json);
+
+    chunks.data = "[\"five!\", 5]";
+    chunks.size = strlen(chunks.data);
+    if (json_load_callback_limited(read_chunk, &chunks, 0, &limits, &error) ||
+        json_error_code(&error) != json_error_limit_exceeded)
+        fail("json_load_callback_limited accepted a long string");
+
+    if (json_load_callback_limited(NULL, NULL, 0, &limits, NULL))
+        fail("json_load_callback_limited accepted NULL");
+}
+
+static void run_tests() {
+    no_limits();
+    values();
+    strings();
+    containers();
+    memory();
+    callback();
+}
@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NRECORDS 60000
+
+struct records {
+    json_t *array;
+    json_t *positions;
+    int stop_at;
+};
+
+static int collect(json_t *record, size_t position, void *data) {
+    struct records *records = data;
+
+    if (records->stop_at >= 0 &&
+        json_array_size(records->array) == (size_t)records->stop_at)
+        return -1;
+
+    json_array_append(records->array, record);
+    json_array_append_new(records->positions, json_integer((json_int_t)position));
+    return 0;
+}
+
+static void records_init(struct records *records) {
+    records->array = json_array();
+    records->positions = json_array();
+    records->stop_at = -1;
+}
+
+static void records_close(struct records *records) {
+    json_decref(records->array);
+    json_decref(records->positions);
+}
+
+static const char text[] = "{\"a\": 1}\n[1, 2]\n\n  \"str\"  \r\n3\ntrue\n";
+
+static void load_lines() {
+    struct records records;
+    json_error_t error;
+    json_t *expected;
+
+    records_init(&records);
+    if (json_loadb_lines(text, strlen(text), 0, collect, &records, &error))
+        fail("json_loadb_lines failed");
+
+    expected = json_loads("[{\"a\": 1}, [1, 2], \"str\", 3, true]", 0, NULL);
+    if (!json_equal(records.array, expected))
+        fail("json_loadb_lines returned wrong records");
+    json_decref(expected);
+
+    expected = json_loads("[0, 9, 19, 28, 30]", 0, NULL);
+    if (!json_equal(records.positions, expected))
+        fail("json_loadb_lines passed wrong positions");
+    json_decref(expected);
+
+    if (error.position != (int)strlen(text))
+        fail("json_loadb_lines returned a wrong position");
+    records_close(&records);
+
+    /* no records at all */
+    records_init(&records);
+    if (json_loadb_lines("\n \n", 3, 0, collect, &records, &error) ||
+        json_array_size(records.array))
+        fail("json_loadb_lines failed on empty input");
+    records_close(&records);
+
+    /* flags apply to every record */
+    records_init(&records);
+    if (!json_loadb_lines("{}\n{\"a\": 1, \"a\": 2}\n", 20, JSON_REJECT_DUPLICATES,
+                          collect, &records, &error))
+        fail("json_loadb_lines accepted a duplicate key");
+    check_error(json_error_duplicate_key, "duplicate object key near '\"a\"'", "<buffer>",
+                2, 12, 15);
+    records_close(&records);
+}
+
+static void load_lines_errors() {
+    struct records records;
+    json_error_t error;
+
+    records_init(&records);
+    if (!json_loadb_lines("1\n2 3\n", 6, 0, collect, &records, &error))
+        fail("json_loadb_lines accepted two records on a line");
+    check_error(json_error_end_of_input_expected, "end of line expected near '3'",
+                "<buffer>", 2, 3, 5);
+    if (json_array_size(records.array) != 2)
+        fail("json_loadb_lines didn't pass the records before an error");
+    records_close(&records);
+
+    records_init(&records);
+    if (!json_loadb_lines("[1,\n2]\n", 7, 0, collect, &records, &error))
+        fail("json_loadb_lines accepted a record on two lines");
+    check_error(json_error_invalid_syntax, "record spans more than one line near ']'",
+                "<buffer>", 2, 2, 6);
+    records_close(&records);
+
+    records_init(&records);
+    if (!json_loadb_lines("{}\n{}\n[1,\n", 10, 0, collect, &records, &error))
+        fail("json_loadb_lines accepted an invalid record");
+    check_error(json_error_premature_end_of_input, "']' expected near end of file",
+                "<buffer>", 4, 0, 10);
+    records_close(&records);
+
+    records_init(&records);
+    records.stop_at = 1;
+    if (!json_loadb_lines(text, strlen(text), 0, collect, &records, &error))
+        fail("json_loadb_lines didn't stop");
+    check_error(json_error_unknown, "stopped by callback", "<buffer>", 2, 0, 9);
+    records_close(&records);
+
+    if (!json_loadb_lines(NULL, 0, 0, collect, NULL, &error) ||
+        !json_loadb_lines(text, 1, 0, NULL, NULL, &error))
+        fail("json_loadb_lines accepted wrong arguments");
+    check_error(json_error_invalid_argument, "wrong arguments", "<buffer>", -1, -1, 0);
+}
+
+static int to_strbuffer(const char *buffer, size_t size, void *data) {
+    json_t *string = data;
+    char *value;
+
+    value = malloc(json_string_length(string) + size);
+    memcpy(value, json_string_value(string), json_string_length(string));
+    memcpy(value + json_string_length(string), buffer, size);
+    json_string_setn(string, value, json_string_length(string) + size);
+    free(value);
+    return 0;
+}
+
+static void dump_lines() {
+    json_t *records = json_loads("[{\"a\": [1, 2]}, \"x/y\", 1.5, null]", 0, NULL);
+    json_t *output = json_string("");
+    struct records loaded;
+    json_error_t error;
+
+    if (json_dump_lines_callback(records, to_strbuffer, output, JSON_INDENT(4)))
+        fail("json_dump_lines_callback failed");
+    if (strcmp(json_string_value(output), "{\"a\": [1, 2]}\n\"x/y\"\n1.5\nnull\n"))
+        fail("json_dump_lines_callback wrote wrong output");
+
+    json_string_set(output, "");
+    if (json_dump_lines_callback(records, to_strbuffer, output,
+                                 JSON_COMPACT | JSON_ESCAPE_SLASH))
+        fail("json_dump_lines_callback failed");
+    if (strcmp(json_string_value(output), "{\"a\":[1,2]}\n\"x\\/y\"\n1.5\nnull\n"))
+        fail("json_dump_lines_callback didn't apply the flags");
+
+    records_init(&loaded);
+    if (json_loadb_lines(json_string_value(output), json_string_length(output), 0,
+                         collect, &loaded, &error) ||
+        !json_equal(loaded.array, records))
+        fail("records didn't survive a round trip");
+    records_close(&loaded);
+
+    json_decref(output);
+    output = json_object();
+    if (!json_dump_lines_callback(output, to_strbuffer, NULL, 0) ||
+        !json_dump_lines_callback(records, NULL, NULL, 0))
+        fail("json_dump_lines_callback accepted wrong arguments");
+
+    json_decref(output);
+    json_decref(records);
+}
+
+static void files() {
+    json_t *records = json_loads("[[1], {\"b\": false}, \"z\"]", 0, NULL);
+    struct records loaded;
+    json_error_t error;
+    FILE *fp;
+
+    if (json_dump_file_lines(records, "json_lines.ndjson", 0))
+        fail("json_dump_file_lines failed");
+
+    records_init(&loaded);
+    if (json_load_file_lines("json_lines.ndjson", 0, collect, &loaded, &error) ||
+        !json_equal(loaded.array, records))
+        fail("json_load_file_lines failed");
+    records_close(&loaded);
+
+    fp = fopen("json_lines.ndjson", "rb");
+    records_init(&loaded);
+    if (json_loadf_lines(fp, 0, collect, &loaded, &error) ||
+        !json_equal(loaded.array, records))
+        fail("json_loadf_lines failed");
+    records_close(&loaded);
+
+#ifdef HAVE_UNISTD_H
+    rewind(fp);
+    records_init(&loaded);
+    if (json_loadfd_lines(fileno(fp), 0, collect, &loaded, &error) ||
+        !json_equal(loaded.array, records))
+        fail("json_loadfd_lines failed");
+    records_close(&loaded);
+#endif
+    fclose(fp);
+    remove("json_lines.ndjson");
+
+    if (!json_load_file_lines("/path/to/nonexistent/file.ndjson", 0, collect, NULL,
+                              &error))
+        fail("json_load_file_lines succeeded with a nonexistent file");
+    if (json_error_code(&error) != json_error_cannot_open_file)
+        fail("json_load_file_lines returned a wrong error");
+
+    json_decref(records);
+}
+
+/* Many records, to be split to several chunks */
+static char *big_input(size_t *len, int invalid_at) {
+    char *buffer = malloc(NRECORDS * 64);
+    int i;
+
+    *len = 0;
+    for (i = 0; i < NRECORDS; i++) {
+        if (i == invalid_at)
+            *len += sprintf(buffer + *len, "{\"id\": %d, \"x\": [1, 2,]}\n", i);
+        else
+            *len += sprintf(buffer + *len, "{\"id\": %d, \"name\": \"record %d\"}\n", i,
+                            i);
+    }
+    return buffer;
+}
+
+static char seen[NRECORDS];
+
+static int mark_seen(json_t *record, size_t position, void *data) {
+    const char *buffer = data;
+    json_int_t id = json_integer_value(json_object_get(record, "id"));
+
+    if (id < 0 || id >= NRECORDS || seen[id] ||
+        strncmp(buffer + position, "{\"id\": ", 7))
+        return -1;
+
+    /* Records may arrive on several threads, but each id only once */
+    seen[id] = 1;
+    return 0;
+}
+
+static void check_parallel(const char *buffer, size_t len, int stop_at, size_t nthreads,
+                           size_t flags) {
+    struct records records, expected;
+    json_error_t error, expected_error;
+    int rv, expected_rv;
+
+    records_init(&expected);
+    expected.stop_at = stop_at;
+    expected_rv = json_loadb_lines(buffer, len, flags, collect, &expected,
+                                   &expected_error);
+
+    records_init(&records);
+    records.stop_at = stop_at;
+    rv = json_loadb_lines_parallel(buffer, len, flags, nthreads, collect, &records,
+                                   &error);
+    if (rv != expected_rv)
+        fail("json_loadb_lines_parallel returned a wrong value");
+    if (!json_equal(records.array, expected.array) ||
+        !json_equal(records.positions, expected.positions))
+        fail("json_loadb_lines_parallel delivered wrong records");
+    if (rv && (json_error_code(&error) != json_error_code(&expected_error) ||
+               strcmp(error.text, expected_error.text) ||
+               error.line != expected_error.line ||
+               error.column != expected_error.column ||
+               error.position != expected_error.position))
+        fail("json_loadb_lines_parallel returned a wrong error");
+    if (error.position != expected_error.position)
+        fail("json_loadb_lines_parallel returned a wrong position");
+
+    records_close(&records);
+    records_close(&expected);
+}
+
+static void load_lines_parallel() {
+    json_error_t error;
+    char *buffer;
+    size_t len;
+    int i;
+
+    buffer = big_input(&len, -1);
+    check_parallel(buffer, len, -1, 4, 0);
+    check_parallel(buffer, len, -1, 0, 0);
+    check_parallel(buffer, len, -1, 1, 0);
+    check_parallel(buffer, len, NRECORDS / 2, 4, 0);
+
+    memset(seen, 0, sizeof(seen));
+    if (json_loadb_lines_parallel(buffer, len, JSON_LINES_UNORDERED, 4, mark_seen, buffer,
+                                  &error))
+        fail("json_loadb_lines_parallel failed with unordered delivery");
+    for (i = 0; i < NRECORDS; i++) {
+        if (!seen[i])
+            fail("json_loadb_lines_parallel didn't deliver every record");
+    }
+    free(buffer);
+
+    /* the error is the first one in the input, with its line number */
+    buffer = big_input(&len, NRECORDS * 2 / 3);
+    check_parallel(buffer, len, -1, 4, 0);
+    check_parallel(buffer, len, NRECORDS / 3, 3, 0);
+
+    memset(seen, 0, sizeof(seen));
+    if (!json_loadb_lines_parallel(buffer, len, JSON_LINES_UNORDERED, 4, mark_seen,
+                                   buffer, &error))
+        fail("json_loadb_lines_parallel succeeded on invalid input");
+    check_error(json_error_invalid_syntax, "unexpected token near ']'", "<buffer>",
+                NRECORDS * 2 / 3 + 1, 26, (int)(strstr(buffer, ",]}") - buffer) + 2);
+    free(buffer);
+
+    if (!json_loadb_lines_parallel(NULL, 0, 0, 4, collect, NULL, &error))
+        fail("json_loadb_lines_parallel accepted wrong arguments");
+}
+
+static void run_tests() {
+    load_lines();
+    load_lines_errors();
+    dump_lines();
+    files();
+    load_lines_parallel();
+}
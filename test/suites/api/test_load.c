@@ -5,9 +5,19 @@
  * it under the terms of the MIT license. See LICENSE for details.
  */
 
-#include "util.h"
+#include "jansson_private_config.h"
+
 #include <jansson.h>
+#include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include "util.h"
+#ifdef __MINGW32__
+#include <fcntl.h>
+#define pipe(fds) _pipe(fds, 1024, _O_BINARY)
+#endif
 
 static void file_not_found() {
     json_t *json;
@@ -145,6 +155,57 @@ static void decode_int_as_real() {
     json_decref(json);
 }
 
+static void number_limits() {
+    static const struct {
+        const char *text;
+        double value;
+    } reals[] = {
+        /* halfway between two doubles, rounds to even */
+        {"9007199254740993", 9007199254740992.0},
+        {"9007199254740995", 9007199254740996.0},
+        {"1e23", 1e23},
+        {"7.3177701707893310e+15", 7.3177701707893310e+15},
+        {"2.2250738585072014e-308", 2.2250738585072014e-308},
+        {"1.7976931348623157e308", 1.7976931348623157e308},
+        {"0.1", 0.1},
+        {"-0.000001234", -0.000001234},
+        {"12345678901234567890123", 12345678901234567890123.0},
+    };
+    json_error_t error;
+    json_t *json;
+    size_t i;
+
+    for (i = 0; i < sizeof(reals) / sizeof(reals[0]); i++) {
+        json = json_loads(reals[i].text, JSON_DECODE_INT_AS_REAL | JSON_DECODE_ANY,
+                          &error);
+        if (!json || json_real_value(json) != reals[i].value)
+            fail("json_loads returned a wrong real");
+        json_decref(json);
+    }
+
+    json = json_loads("1.7976931348623159e308", JSON_DECODE_ANY, &error);
+    if (json || json_error_code(&error) != json_error_numeric_overflow)
+        fail("json_loads didn't fail on real overflow");
+
+#if JSON_INTEGER_IS_LONG_LONG
+    json = json_loads("[9223372036854775807, -9223372036854775808]", 0, &error);
+    if (!json || json_integer_value(json_array_get(json, 0)) != 9223372036854775807ll ||
+        json_integer_value(json_array_get(json, 1)) != -9223372036854775807ll - 1)
+        fail("json_loads failed on the integer limits");
+    json_decref(json);
+
+    json = json_loads("-9223372036854775809", JSON_DECODE_ANY, &error);
+    if (json || json_error_code(&error) != json_error_numeric_overflow ||
+        strncmp(error.text, "too big negative integer", 24))
+        fail("json_loads didn't fail on negative integer overflow");
+#endif
+
+    json = json_loads("123456789012345678901234567890", JSON_DECODE_ANY, &error);
+    if (json || json_error_code(&error) != json_error_numeric_overflow ||
+        strncmp(error.text, "too big integer", 15))
+        fail("json_loads didn't fail on integer overflow");
+}
+
 static void allow_nul() {
     const char *text = "\"nul byte \\u0000 in string\"";
     const char *expected = "nul byte \0 in string";
@@ -205,6 +266,284 @@ static void position() {
     json_decref(json);
 }
 
+static void error_context() {
+    json_error_t error;
+    const char long_key[] = "{\"a rather long key name\": 1, \"a rather long key name\": 2}";
+    const char buffer[] = "[\"\xc3\xa4\xc3\xb6\", 12, \"x\x01\"]";
+
+    /* only short tokens are shown as context */
+    if (json_loads(long_key, JSON_REJECT_DUPLICATES, &error))
+        fail("json_loads did not detect a duplicate key");
+    check_error(json_error_duplicate_key, "duplicate object key", "<string>", 1, 54, 54);
+
+    /* columns count characters, positions count bytes */
+    if (json_loadb(buffer, sizeof(buffer) - 1, 0, &error))
+        fail("json_loadb did not detect a control character");
+    check_error(json_error_invalid_syntax, "control character 0x1 near '\"x'",
+                "<buffer>", 1, 13, 15);
+
+    if (json_loadb(buffer, 10, 0, &error))
+        fail("json_loadb did not detect a truncated buffer");
+    check_error(json_error_premature_end_of_input,
+                "']' expected near end of file", "<buffer>", 1, 8, 10);
+}
+
+static const char consecutive_text[] = "[1, 2] {\"foo\": \"bar\"}\n[3]";
+
+static void check_consecutive(json_t *json, int n) {
+    switch (n) {
+        case 0:
+            if (json_array_size(json) != 2 ||
+                json_integer_value(json_array_get(json, 1)) != 2)
+                fail("wrong value for the first consecutive text");
+            break;
+        case 1:
+            if (strcmp(json_string_value(json_object_get(json, "foo")), "bar"))
+                fail("wrong value for the second consecutive text");
+            break;
+        default:
+            if (json_array_size(json) != 1 ||
+                json_integer_value(json_array_get(json, 0)) != 3)
+                fail("wrong value for the third consecutive text");
+    }
+}
+
+static void load_consecutive_file() {
+    json_t *json;
+    json_error_t error;
+    FILE *fp;
+    int i;
+
+    fp = tmpfile();
+    if (!fp)
+        fail("tmpfile() failed");
+    fputs(consecutive_text, fp);
+    rewind(fp);
+
+    for (i = 0; i < 3; i++) {
+        json = json_loadf(fp, JSON_DISABLE_EOF_CHECK, &error);
+        if (!json)
+            fail("json_loadf failed on consecutive JSON texts");
+        check_consecutive(json, i);
+        json_decref(json);
+    }
+
+    json = json_loadf(fp, 0, &error);
+    if (json || json_error_code(&error) != json_error_premature_end_of_input)
+        fail("json_loadf did not detect end of consecutive JSON texts");
+
+    fclose(fp);
+}
+
+static void load_consecutive_fd() {
+#ifdef HAVE_UNISTD_H
+    json_t *json;
+    json_error_t error;
+    int fds[2] = {-1, -1};
+    FILE *fp;
+    int i;
+
+    /* seekable file descriptor */
+    fp = tmpfile();
+    if (!fp)
+        fail("tmpfile() failed");
+    fputs(consecutive_text, fp);
+    fflush(fp);
+    lseek(fileno(fp), 0, SEEK_SET);
+
+    for (i = 0; i < 3; i++) {
+        json = json_loadfd(fileno(fp), JSON_DISABLE_EOF_CHECK, &error);
+        if (!json)
+            fail("json_loadfd failed on consecutive JSON texts");
+        check_consecutive(json, i);
+        json_decref(json);
+    }
+    fclose(fp);
+
+    /* pipe */
+    if (pipe(fds))
+        fail("pipe() failed");
+    if (write(fds[1], consecutive_text, strlen(consecutive_text)) !=
+        (ssize_t)strlen(consecutive_text))
+        fail("write() failed");
+    close(fds[1]);
+
+    for (i = 0; i < 3; i++) {
+        json = json_loadfd(fds[0], JSON_DISABLE_EOF_CHECK, &error);
+        if (!json)
+            fail("json_loadfd failed on consecutive JSON texts in a pipe");
+        check_consecutive(json, i);
+        json_decref(json);
+    }
+    close(fds[0]);
+#endif
+}
+
+static int ignore_record(json_t *record, size_t position, void *data) {
+    (void)record;
+    (void)position;
+    (void)data;
+    return 0;
+}
+
+static void check_same_error(const json_error_t *error, const json_error_t *expected,
+                             const char *what) {
+    if (strcmp(error->source, expected->source) || strcmp(error->text, expected->text) ||
+        error->line != expected->line || error->column != expected->column ||
+        error->position != expected->position)
+        fail(what);
+}
+
+static void load_large_file() {
+    const char *path = "json_load_large_file.json";
+    json_sax_callbacks_t callbacks;
+    json_t *json;
+    json_error_t error, expected;
+    char *text;
+    size_t i, len = 0;
+    FILE *fp;
+
+    /* large enough to be mapped to memory instead of read */
+    text = malloc(1024 * 1024);
+    text[len++] = '[';
+    for (i = 0; i < 100000; i++)
+        len += sprintf(text + len, "%d,\n", (int)i);
+    len += sprintf(text + len, "\"end\"]");
+
+    fp = fopen(path, "wb");
+    if (!fp || fwrite(text, 1, len, fp) != len || fclose(fp))
+        fail("unable to write a large file");
+
+    json = json_load_file(path, 0, &error);
+    if (json_array_size(json) != 100001 ||
+        json_integer_value(json_array_get(json, 99999)) != 99999)
+        fail("json_load_file failed on a large file");
+    if (error.position != (int)len)
+        fail("json_load_file returned a wrong position for a large file");
+    json_decref(json);
+
+    /* errors are reported the same way as when reading */
+    text[len - 2] = ',';
+    fp = fopen(path, "wb");
+    if (!fp || fwrite(text, 1, len, fp) != len || fclose(fp))
+        fail("unable to write a large file");
+
+    fp = fopen(path, "rb");
+    json = json_loadf(fp, 0, &expected);
+    fclose(fp);
+    if (json || strcmp(expected.source, "<stream>"))
+        fail("json_loadf returned a wrong error for a large file");
+
+    json = json_load_file(path, 0, &error);
+    if (json)
+        fail("json_load_file succeeded on an invalid large file");
+    check_same_error(&error, &expected, "json_load_file returned a wrong error for a "
+                                        "large file");
+
+    memset(&callbacks, 0, sizeof(callbacks));
+    if (!json_sax_load_file(path, 0, &callbacks, NULL, &error))
+        fail("json_sax_load_file succeeded on an invalid large file");
+    check_same_error(&error, &expected, "json_sax_load_file returned a wrong error for a "
+                                        "large file");
+
+    fp = fopen(path, "rb");
+    if (!json_loadf_lines(fp, 0, ignore_record, NULL, &expected))
+        fail("json_loadf_lines succeeded on an invalid large file");
+    fclose(fp);
+    if (!json_load_file_lines(path, 0, ignore_record, NULL, &error))
+        fail("json_load_file_lines succeeded on an invalid large file");
+    check_same_error(&error, &expected, "json_load_file_lines returned a wrong error for "
+                                        "a large file");
+
+    /* and the same as for a small file */
+    fp = fopen(path, "wb");
+    if (!fp || fwrite(text + len - 10, 1, 10, fp) != 10 || fclose(fp))
+        fail("unable to write a small file");
+    json = json_load_file(path, 0, &error);
+    if (json || strcmp(error.source, "<stream>"))
+        fail("json_load_file returned a wrong error for a small file");
+
+    remove(path);
+    free(text);
+}
+
+static void parsing_depth() {
+    const int depth = 20000;
+    json_error_t error;
+    json_tape_t *tape;
+    json_t *json;
+    char *text, *dumped;
+    int i, len = 0;
+
+    /* the nesting limit is set per call, and a deep document doesn't
+       need a deep stack */
+    text = malloc(depth * 6 + 2);
+    for (i = 0; i < depth; i++)
+        len += sprintf(text + len, i % 2 ? "[" : "{\"a\":");
+    text[len++] = '1';
+    for (i = depth - 1; i >= 0; i--)
+        text[len++] = i % 2 ? ']' : '}';
+
+    json = json_loadb(text, len, JSON_PARSER_DEPTH(depth + 1), &error);
+    if (!json)
+        fail("json_loadb failed on a deep document");
+    dumped = json_dumps(json, JSON_COMPACT);
+    if (!dumped || strlen(dumped) != (size_t)len || memcmp(dumped, text, len))
+        fail("json_dumps failed on a deep value");
+    free(dumped);
+    json_decref(json);
+
+    tape = json_tape_loadb(text, len, JSON_PARSER_DEPTH(depth + 1), &error);
+    if (!tape)
+        fail("json_tape_loadb failed on a deep document");
+    json_tape_free(tape);
+
+    /* the scalar at the bottom is one level deeper than its array */
+    json = json_loadb(text, len, JSON_PARSER_DEPTH(depth), &error);
+    if (json)
+        fail("json_loadb exceeded the nesting limit");
+    check_error(json_error_stack_overflow, "maximum parsing depth reached near '1'",
+                "<buffer>", 1, len - depth, len - depth);
+
+    tape = json_tape_loadb(text, len, JSON_PARSER_DEPTH(depth), &error);
+    if (tape)
+        fail("json_tape_loadb exceeded the nesting limit");
+    check_error(json_error_stack_overflow, "maximum parsing depth reached near '1'",
+                "<buffer>", 1, len - depth, len - depth);
+
+    /* the default limit */
+    json = json_loadb(text, len, 0, &error);
+    if (json)
+        fail("json_loadb exceeded the default nesting limit");
+    if (json_error_code(&error) != json_error_stack_overflow)
+        fail("json_loadb returned a wrong error for a too deep document");
+
+    json = json_loads("[[[1]]]", JSON_PARSER_DEPTH(4), &error);
+    if (!json)
+        fail("json_loads failed within the nesting limit");
+    json_decref(json);
+
+    json = json_loads("[{\"a\": [1]}, [[2]]]", JSON_PARSER_DEPTH(3), &error);
+    if (json)
+        fail("json_loads exceeded the nesting limit");
+    check_error(json_error_stack_overflow, "maximum parsing depth reached near '1'",
+                "<string>", 1, 9, 9);
+
+    /* errors are reported where they are found in nested values */
+    json = json_loads("[{\"a\": [1, }]", 0, &error);
+    if (json)
+        fail("json_loads accepted an invalid document");
+    check_error(json_error_invalid_syntax, "unexpected token near '}'", "<string>", 1, 12,
+                12);
+
+    json = json_loads("{\"a\": {\"b\" 1}}", 0, &error);
+    if (json)
+        fail("json_loads accepted an invalid document");
+    check_error(json_error_invalid_syntax, "':' expected near '1'", "<string>", 1, 12, 12);
+
+    free(text);
+}
+
 static void error_code() {
     json_error_t error;
     json_t *json = json_loads("[123] garbage", 0, &error);
@@ -231,8 +570,14 @@ static void run_tests() {
     disable_eof_check();
     decode_any();
     decode_int_as_real();
+    number_limits();
     allow_nul();
     load_wrong_args();
     position();
+    error_context();
+    load_consecutive_file();
+    load_consecutive_fd();
+    load_large_file();
+    parsing_depth();
     error_code();
 }
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *documents[] = {
+    "{\"a\": [1, 2.5, true, null], \"b\": \"esc\\u00e4ped \\\"text\\\"\"}",
+    "[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[1]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]",
+    "{}",
+    "[\"\\t\\n\", -1e10, 12345678901234]",
+};
+
+#define NDOCUMENTS (sizeof(documents) / sizeof(documents[0]))
+
+static size_t string_read(void *buffer, size_t buflen, void *data) {
+    const char **text = (const char **)data;
+    size_t len = strlen(*text);
+
+    /* a few bytes at a time */
+    if (len > buflen)
+        len = buflen;
+    if (len > 7)
+        len = 7;
+    memcpy(buffer, *text, len);
+    *text += len;
+    return len;
+}
+
+static void check(json_t *json, const char *text, const char *what) {
+    json_t *expected = json_loads(text, 0, NULL);
+
+    if (!json || !json_equal(json, expected))
+        fail(what);
+    json_decref(json);
+    json_decref(expected);
+}
+
+static void test_buffers(void) {
+    json_load_ctx_t *ctx = json_load_ctx_new();
+    json_error_t error, expected;
+    json_t *json, *copy;
+    char *big;
+    size_t i, j;
+
+    if (!ctx)
+        fail("json_load_ctx_new failed");
+    json_load_ctx_free(NULL);
+
+    for (i = 0; i < 100; i++) {
+        const char *text = documents[i % NDOCUMENTS];
+        check(json_loadb_ctx(text, strlen(text), 0, ctx, NULL), text,
+              "json_loadb_ctx failed");
+    }
+
+    /* errors are reported as usual, and the context can be used after
+       them */
+    for (i = 0; i < NDOCUMENTS; i++) {
+        const char *text = documents[i];
+        size_t len = strlen(text) - 1;
+
+        json_decref(json_loadb(text, len, 0, &expected));
+        if (json_loadb_ctx(text, len, 0, ctx, &error))
+            fail("json_loadb_ctx succeeded with a truncated document");
+        if (error.position != expected.position || strcmp(error.text, expected.text))
+            fail("json_loadb_ctx reported a different error");
+        check(json_loadb_ctx(text, len + 1, 0, ctx, NULL), text,
+              "json_loadb_ctx failed after an error");
+    }
+
+    if (json_loadb_ctx(NULL, 0, 0, ctx, &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_loadb_ctx accepted NULL");
+
+    /* a string that makes the buffers grow past what's kept */
+    big = malloc(200002);
+    big[0] = '"';
+    for (j = 1; j < 200001; j++)
+        big[j] = j % 2 ? '\\' : 'n';
+    big[200001] = '"';
+    json = json_loadb_ctx(big, 200002, JSON_DECODE_ANY, ctx, NULL);
+    copy = json_loadb(big, 200002, JSON_DECODE_ANY, NULL);
+    if (!json || !json_equal(json, copy))
+        fail("json_loadb_ctx failed with a long string");
+    json_decref(json);
+    json_decref(copy);
+    free(big);
+
+    check(json_loadb_ctx(documents[0], strlen(documents[0]), 0, ctx, NULL), documents[0],
+          "json_loadb_ctx failed after a long string");
+
+    json_load_ctx_free(ctx);
+}
+
+static void test_streams(void) {
+    json_load_ctx_t *ctx = json_load_ctx_new();
+    const char *text, *rest;
+    json_t *big, *json, *loaded;
+    FILE *file;
+    size_t i;
+
+    for (i = 0; i < 3 * NDOCUMENTS; i++) {
+        text = rest = documents[i % NDOCUMENTS];
+        check(json_load_callback_ctx(string_read, &rest, 0, ctx, NULL), text,
+              "json_load_callback_ctx failed");
+    }
+
+    for (i = 0; i < NDOCUMENTS; i++) {
+        text = documents[i];
+        file = tmpfile();
+        if (!file)
+            fail("tmpfile failed");
+        fputs(text, file);
+        fputs("\n      ", file);
+        fflush(file);
+
+        /* before the FILE has buffered anything */
+        rewind(file);
+        check(json_loadfd_ctx(fileno(file), 0, ctx, NULL), text,
+              "json_loadfd_ctx failed");
+
+        rewind(file);
+        check(json_loadf_ctx(file, 0, ctx, NULL), text, "json_loadf_ctx failed");
+
+        /* what follows the value is given back to the file */
+        rewind(file);
+        check(json_loadf_ctx(file, JSON_DISABLE_EOF_CHECK, ctx, NULL), text,
+              "json_loadf_ctx failed without the EOF check");
+        if (ftell(file) != (long)strlen(text))
+            fail("json_loadf_ctx didn't give back the rest of the file");
+        fclose(file);
+    }
+
+    if (json_load_file_ctx("/path/to/nonexistent/file.json", 0, ctx, NULL))
+        fail("json_load_file_ctx succeeded with a missing file");
+
+    /* read, and mapped to memory */
+    json = json_loads(documents[0], 0, NULL);
+    big = json_array();
+    for (i = 0; i < 2000; i++)
+        json_array_append(big, json);
+
+    json_dump_file(json, "json_load_file_ctx.json", 0);
+    loaded = json_load_file_ctx("json_load_file_ctx.json", 0, ctx, NULL);
+    if (!json_equal(loaded, json))
+        fail("json_load_file_ctx failed");
+    json_decref(loaded);
+
+    json_dump_file(big, "json_load_file_ctx.json", 0);
+    loaded = json_load_file_ctx("json_load_file_ctx.json", 0, ctx, NULL);
+    if (!json_equal(loaded, big))
+        fail("json_load_file_ctx failed with a large file");
+    json_decref(loaded);
+    remove("json_load_file_ctx.json");
+
+    json_decref(json);
+    json_decref(big);
+    json_load_ctx_free(ctx);
+}
+
+static void run_tests() {
+    test_buffers();
+    test_streams();
+}
@@ -34,4 +34,10 @@ static void run_tests() {
         fail("json_loadb returned an invalid error message for an unclosed "
              "top-level array");
     }
+
+    /* a null byte after a number is reported with the token after it */
+    json = json_loadb("[7947\0" "467]", 9, 0, &error);
+    if (json || strcmp(error.text, "']' expected near '467'") != 0 ||
+        json_error_code(&error) != json_error_invalid_syntax || error.column != 8)
+        fail("json_loadb returned an invalid error for a null byte after a number");
 }
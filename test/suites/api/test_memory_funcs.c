@@ -102,6 +102,41 @@ static void test_secure_funcs(void) {
     create_and_free_complex_object();
 }
 
+static int mallocs = 0;
+
+static void *counting_malloc(size_t size) {
+    mallocs++;
+    return malloc(size);
+}
+
+static void test_short_strings(void) {
+    const char *long_value = "a value that is too long to be stored inline";
+    json_t *string;
+
+    json_set_alloc_funcs(counting_malloc, free);
+
+    /* short values are stored with the string */
+    mallocs = 0;
+    string = json_string("id-1234");
+    if (!string || mallocs != 1)
+        fail("a short string took more than one allocation");
+    if (json_string_set(string, "abc") || mallocs != 1)
+        fail("setting a short value allocated");
+    if (json_string_set(string, long_value) || mallocs != 2 ||
+        strcmp(json_string_value(string), long_value))
+        fail("setting a long value failed");
+    if (json_string_set(string, "xyz") || mallocs != 2 ||
+        strcmp(json_string_value(string), "xyz"))
+        fail("setting a short value after a long one allocated");
+    json_decref(string);
+
+    mallocs = 0;
+    string = json_string(long_value);
+    if (!string || mallocs != 2)
+        fail("a long string wasn't allocated separately");
+    json_decref(string);
+}
+
 static void test_bad_args(void) {
     /* The result of this test is not crashing. */
     json_get_alloc_funcs(NULL, NULL);
@@ -111,5 +146,6 @@ static void run_tests() {
     test_simple();
     test_secure_funcs();
     test_oom();
+    test_short_strings();
     test_bad_args();
 }
@@ -168,6 +168,141 @@ static void test_set_many_keys() {
     json_decref(value);
 }
 
+static void test_grow_and_shrink() {
+    json_t *object;
+    const char *key;
+    json_t *value;
+    char buf[8];
+    int i, j;
+
+    object = json_object();
+    if (!object)
+        fail("unable to create object");
+
+    /* small objects are searched linearly, larger ones are indexed */
+    for (i = 0; i < 100; i++) {
+        snprintf(buf, sizeof(buf), "k%d", i);
+        if (json_object_set_new(object, buf, json_integer(i)))
+            fail("unable to set object key");
+
+        for (j = 0; j <= i; j++) {
+            snprintf(buf, sizeof(buf), "k%d", j);
+            if (json_integer_value(json_object_get(object, buf)) != j)
+                fail("json_object_get failed while growing");
+        }
+    }
+
+    /* delete every other key and check that the order is preserved */
+    for (i = 0; i < 100; i += 2) {
+        snprintf(buf, sizeof(buf), "k%d", i);
+        if (json_object_del(object, buf))
+            fail("unable to delete object key");
+    }
+
+    i = 1;
+    json_object_foreach(object, key, value) {
+        snprintf(buf, sizeof(buf), "k%d", i);
+        if (strcmp(key, buf) || json_integer_value(value) != i)
+            fail("object order changed after deleting keys");
+        i += 2;
+    }
+    if (i != 101 || json_object_size(object) != 50)
+        fail("json_object_foreach failed after deleting keys");
+
+    if (json_object_get(object, "k0") || json_object_iter_at(object, "k0"))
+        fail("a deleted key was found");
+
+    json_decref(object);
+}
+
+static int malloc_calls = 0;
+
+static void *counting_malloc(size_t size) {
+    malloc_calls++;
+    return malloc(size);
+}
+
+static void test_reserve() {
+    json_t *object, *other;
+    char buf[8];
+    int i;
+
+    object = json_object_with_capacity(100);
+    if (!object || json_object_size(object) != 0)
+        fail("json_object_with_capacity failed");
+
+    /* only the pairs are allocated */
+    json_set_alloc_funcs(counting_malloc, free);
+    for (i = 0; i < 100; i++) {
+        snprintf(buf, sizeof(buf), "k%d", i);
+        if (json_object_set_new(object, buf, json_null()))
+            fail("unable to set object key");
+    }
+    json_set_alloc_funcs(malloc, free);
+    if (malloc_calls != 100)
+        fail("json_object_with_capacity didn't make room for all keys");
+
+    if (json_object_reserve(object, 50) || json_object_size(object) != 100)
+        fail("json_object_reserve failed with a smaller capacity");
+    if (json_object_reserve(object, 1000) || json_object_size(object) != 100)
+        fail("json_object_reserve failed");
+    if (!json_is_null(json_object_get(object, "k99")) ||
+        !json_is_null(json_object_get(object, "k42")))
+        fail("json_object_reserve lost keys");
+
+    if (json_object_reserve(NULL, 10) != -1 || json_object_reserve(json_null(), 10) != -1)
+        fail("json_object_reserve succeeded with a non-object");
+
+    /* json_object_update reserves for all keys of other */
+    other = json_object();
+    json_object_set_new(other, "k0", json_true());
+    json_object_set_new(other, "new", json_true());
+    if (json_object_update(object, other) || json_object_size(object) != 101 ||
+        !json_is_true(json_object_get(object, "k0")))
+        fail("json_object_update failed after json_object_reserve");
+
+    json_decref(other);
+    json_decref(object);
+}
+
+static void test_prehashed_keys() {
+    json_t *small, *large;
+    json_key_t key, missing, nul_key;
+    char buf[8];
+    int i;
+
+    key = json_key("k7");
+    missing = json_key("missing");
+    nul_key = json_keyn("a\0b", 3);
+
+    small = json_object();
+    large = json_object();
+    for (i = 0; i < 100; i++) {
+        snprintf(buf, sizeof(buf), "k%d", i);
+        json_object_set_new(large, buf, json_integer(i));
+        if (i < 8)
+            json_object_set_new(small, buf, json_integer(i));
+    }
+    json_object_setn_new(small, "a\0b", 3, json_true());
+    json_object_setn_new(large, "a\0b", 3, json_true());
+
+    if (json_integer_value(json_object_get_key(small, key)) != 7 ||
+        json_integer_value(json_object_get_key(large, key)) != 7)
+        fail("json_object_get_key failed");
+    if (!json_is_true(json_object_get_key(small, nul_key)) ||
+        !json_is_true(json_object_get_key(large, nul_key)))
+        fail("json_object_get_key failed with a fixed-length key");
+    if (json_object_get_key(small, missing) || json_object_get_key(large, missing))
+        fail("json_object_get_key found a missing key");
+
+    if (json_object_get_key(NULL, key) || json_object_get_key(json_null(), key) ||
+        json_object_get_key(large, json_key(NULL)))
+        fail("json_object_get_key succeeded with bad arguments");
+
+    json_decref(small);
+    json_decref(large);
+}
+
 static void test_conditional_updates() {
     json_t *object, *other;
 
@@ -785,6 +920,9 @@ static void run_tests() {
     test_clear();
     test_update();
     test_set_many_keys();
+    test_grow_and_shrink();
+    test_reserve();
+    test_prehashed_keys();
     test_conditional_updates();
     test_recursive_updates();
     test_circular();
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <math.h>
+#include <stdarg.h>
+#include <string.h>
+
+#define WRITER_FLAGS (JSON_COMPACT | JSON_ENCODE_ANY)
+
+struct output {
+    char buffer[4096];
+    size_t len;
+};
+
+static int to_output(const char *buffer, size_t size, void *data) {
+    struct output *out = data;
+    if (out->len + size >= sizeof(out->buffer))
+        return -1;
+    memcpy(out->buffer + out->len, buffer, size);
+    out->len += size;
+    out->buffer[out->len] = '\0';
+    return 0;
+}
+
+static int same_error(const json_error_t *error, const json_error_t *expected) {
+    return !strcmp(error->text, expected->text) &&
+           !strcmp(error->source, expected->source) && error->line == expected->line &&
+           error->column == expected->column && error->position == expected->position &&
+           json_error_code(error) == json_error_code(expected);
+}
+
+/* Pack with json_vpack_ex(), with a compiled plan and with a compiled
+   plan to a writer, and check that the results are the same. The
+   arguments are used three times, so they can't contain 'o' values. */
+static void compare(const char *fmt, ...) {
+    json_error_t expected_error, error;
+    json_pack_plan_t *plan;
+    json_writer_t *writer;
+    json_t *expected, *value;
+    struct output out;
+    char *dumped;
+    va_list ap;
+    int ret;
+
+    plan = json_pack_compile(fmt, &error);
+    if (!plan)
+        fail("json_pack_compile failed");
+
+    va_start(ap, fmt);
+    expected = json_vpack_ex(&expected_error, 0, fmt, ap);
+    va_end(ap);
+
+    va_start(ap, fmt);
+    value = json_vpack_plan_ex(&error, 0, plan, ap);
+    va_end(ap);
+
+    if (expected ? !json_equal(value, expected)
+                 : value || !same_error(&error, &expected_error)) {
+        failhdr;
+        fprintf(stderr, "%s: got %d:%d:%d %s %s, expected %d:%d:%d %s %s\n", fmt,
+                error.line, error.column, error.position, error.source, error.text,
+                expected_error.line, expected_error.column, expected_error.position,
+                expected_error.source, expected_error.text);
+        exit(1);
+    }
+
+    out.len = 0;
+    out.buffer[0] = '\0';
+    writer = json_writer_new(to_output, &out, WRITER_FLAGS);
+    va_start(ap, fmt);
+    ret = json_vpack_plan_write(writer, &error, plan, ap);
+    va_end(ap);
+
+    if (expected) {
+        dumped = json_dumps(expected, WRITER_FLAGS);
+        if (ret || json_writer_finish(writer) || strcmp(out.buffer, dumped)) {
+            failhdr;
+            fprintf(stderr, "%s: wrote %s, expected %s\n", fmt, out.buffer, dumped);
+            exit(1);
+        }
+        free(dumped);
+    } else if (ret != -1 || !same_error(&error, &expected_error) ||
+               json_writer_null(writer) != -1) {
+        failhdr;
+        fprintf(stderr, "%s: writing got %d:%d:%d %s, expected %s\n", fmt, error.line,
+                error.column, error.position, error.text, expected_error.text);
+        exit(1);
+    }
+
+    json_writer_free(writer);
+    json_decref(expected);
+    json_decref(value);
+    json_pack_plan_free(plan);
+}
+
+static void same_as_pack() {
+    json_t *object = json_pack("{s:[i, n]}", "x", 1);
+
+    compare("{s:i, s:s, s:b, s:n, s:f, s:I}", "a", 1, "b", "str", "c", 1, "d", "e", 0.5,
+            "f", (json_int_t)12345678901LL);
+    compare("[i, [s, {}], {s:[]}, b]", 1, "x", "key", 0);
+    compare("{s:{s:{s:i}}, s:[[[s]]]}", "a", "b", "c", 1, "d", "deep");
+    compare("{s:O, s:[O, O?]}", "o", object, "a", object, NULL);
+    compare("[s#, s%, s++, s#+%]", "abcdef", 3, "xyz", (size_t)2, "a", "b", "c", "12", 1,
+            "345", (size_t)2);
+    compare("{s#:i, s+:i}", "keyabc", 3, 1, "con", "cat", 2);
+    compare("{s:s?, s:s?, s:O?, s:O*, s:s*, s:s*}", "a", "x", "b", NULL, "c", NULL, "d",
+            NULL, "e", NULL, "f", "y");
+    compare("[s?, s*, O*, O?, s*]", NULL, NULL, NULL, NULL, "z");
+    compare("  [ i , \n i ] ", 1, 2);
+    compare("s", "plain");
+    compare("s#", "\xc3\xa4\xc3\xb6", 2);
+    compare("i", 5);
+    compare("n");
+    compare("{}");
+
+    /* argument errors are reported at the same positions */
+    compare("{s:i}", NULL, 1);
+    compare("{s:s}", "a", NULL);
+    compare("{s:s, s:i}", "a", NULL, "b", 2);
+    compare("{s:i, s:s, s:s}", "a", 1, "b", "\xff", "c", NULL);
+    compare("{s:s?}", "a", "\xff\xff");
+    compare("{s:s*}", "a", "\xff\xff");
+    compare("{s+:i}", "\xff\xff", "concat", 1);
+    compare("[s++]", "a", NULL, "c");
+    compare("[s#+%]", "ab", 1, "\xff", (size_t)1);
+    compare("{s#:i}", "\xff", 1, 1);
+    compare("[s#]", NULL, 1);
+    compare("{s:O}", "a", NULL);
+    compare("[i, O, i]", 1, NULL, 2);
+    compare("[s, [s, [s]]]", "a", "b", NULL);
+#ifdef INFINITY
+    compare("{s:f}", "a", INFINITY);
+    compare("[f, f]", 1.0, INFINITY);
+#endif
+
+    json_decref(object);
+}
+
+static void stealing() {
+    json_pack_plan_t *plan = json_pack_compile("{s:s, s:o}", NULL);
+    json_writer_t *writer;
+    struct output out;
+    json_t *value, *object = json_object();
+
+    /* 'o' steals the reference also when packing fails */
+    if (json_pack_plan(plan, "a", NULL, "b", json_incref(object)))
+        fail("json_pack_plan succeeded with a NULL string");
+    if (object->refcount != 1)
+        fail("json_pack_plan didn't steal a reference after an error");
+
+    value = json_pack_plan(plan, "a", "x", "b", json_incref(object));
+    if (!value || json_object_get(value, "b") != object || object->refcount != 2)
+        fail("json_pack_plan didn't steal a reference");
+    json_decref(value);
+
+    out.len = 0;
+    writer = json_writer_new(to_output, &out, WRITER_FLAGS);
+    if (json_pack_plan_write(writer, NULL, plan, "a", "x", "b", json_incref(object)) ||
+        json_writer_finish(writer) || strcmp(out.buffer, "{\"a\":\"x\",\"b\":{}}"))
+        fail("json_pack_plan_write failed");
+    if (object->refcount != 1)
+        fail("json_pack_plan_write didn't steal a reference");
+    json_writer_free(writer);
+
+    writer = json_writer_new(to_output, &out, WRITER_FLAGS);
+    if (!json_pack_plan_write(writer, NULL, plan, NULL, "x", "b", json_incref(object)))
+        fail("json_pack_plan_write succeeded with a NULL key");
+    if (object->refcount != 1)
+        fail("json_pack_plan_write didn't steal a reference after an error");
+    json_writer_free(writer);
+
+    json_pack_plan_free(plan);
+    json_decref(object);
+}
+
+static void streaming() {
+    json_pack_plan_t *plan = json_pack_compile("{s:i, s:s}", NULL);
+    json_writer_t *writer;
+    json_error_t error;
+    struct output out;
+    int i;
+
+    /* a plan can write the members of a document written with the
+       writer functions */
+    out.len = 0;
+    writer = json_writer_new(to_output, &out, JSON_COMPACT);
+    json_writer_begin_array(writer);
+    for (i = 0; i < 3; i++) {
+        if (json_pack_plan_write(writer, &error, plan, "id", i, "name", "n"))
+            fail("json_pack_plan_write failed");
+    }
+    json_writer_end_array(writer);
+    if (json_writer_finish(writer) ||
+        strcmp(out.buffer, "[{\"id\":0,\"name\":\"n\"},{\"id\":1,\"name\":\"n\"},"
+                           "{\"id\":2,\"name\":\"n\"}]"))
+        fail("json_pack_plan_write wrote wrong output");
+    json_writer_free(writer);
+
+    /* repeated keys are written as they're given */
+    json_pack_plan_free(plan);
+    plan = json_pack_compile("{s:i, s:i}", NULL);
+    out.len = 0;
+    writer = json_writer_new(to_output, &out, JSON_COMPACT);
+    if (json_pack_plan_write(writer, &error, plan, "a", 1, "a", 2) ||
+        json_writer_finish(writer) || strcmp(out.buffer, "{\"a\":1,\"a\":2}"))
+        fail("json_pack_plan_write didn't write a repeated key");
+    json_writer_free(writer);
+    json_pack_plan_free(plan);
+    plan = json_pack_compile("{s:i, s:s}", NULL);
+
+    /* the writer refuses a value where a key is expected */
+    out.len = 0;
+    writer = json_writer_new(to_output, &out, JSON_COMPACT);
+    json_writer_begin_object(writer);
+    if (!json_pack_plan_write(writer, &error, plan, "id", 1, "name", "n"))
+        fail("json_pack_plan_write wrote a value without a key");
+    check_error(json_error_unknown, "Unable to write output", "<output>", 1, 1, 1);
+    if (json_writer_key(writer, "a") != -1)
+        fail("the writer works after json_pack_plan_write failed");
+    json_writer_free(writer);
+
+    /* an error in the arguments fails the writer */
+    writer = json_writer_new(to_output, &out, JSON_COMPACT);
+    if (!json_pack_plan_write(writer, &error, plan, "id", 1, "name", NULL))
+        fail("json_pack_plan_write succeeded with a NULL string");
+    check_error(json_error_null_value, "NULL string", "<args>", 1, 9, 9);
+    if (json_writer_finish(writer) != -1)
+        fail("the writer works after json_pack_plan_write failed");
+    json_writer_free(writer);
+
+    if (!json_pack_plan_write(NULL, &error, plan, "id", 1, "name", "n"))
+        fail("json_pack_plan_write succeeded without a writer");
+    check_error(json_error_invalid_argument, "NULL writer", "<output>", -1, -1, 0);
+
+    json_pack_plan_free(plan);
+}
+
+static void format_errors() {
+    json_error_t error;
+
+    /* format errors are found when compiling */
+    if (json_pack_compile("{s:i*}", &error))
+        fail("json_pack_compile accepted an invalid format");
+    check_error(json_error_invalid_format, "Expected format 's', got '*'", "<format>", 1,
+                5, 5);
+
+    if (json_pack_compile("[i*]", &error))
+        fail("json_pack_compile accepted an invalid format");
+    check_error(json_error_invalid_format, "Unexpected format character '*'", "<format>",
+                1, 3, 3);
+
+    if (json_pack_compile("{s: s*#}", &error))
+        fail("json_pack_compile accepted an invalid format");
+    check_error(json_error_invalid_format, "Cannot use '#' on optional strings",
+                "<format>", 1, 6, 6);
+
+    if (json_pack_compile("s?+", &error))
+        fail("json_pack_compile accepted an invalid format");
+    check_error(json_error_invalid_format, "Cannot use '+' on optional strings",
+                "<format>", 1, 2, 2);
+
+    if (json_pack_compile("{\n\n1", &error))
+        fail("json_pack_compile accepted an invalid format");
+    check_error(json_error_invalid_format, "Expected format 's', got '1'", "<format>", 3,
+                1, 4);
+
+    if (json_pack_compile("{ s: {},  s:[ii{} }", &error))
+        fail("json_pack_compile accepted an invalid format");
+    check_error(json_error_invalid_format, "Unexpected format character '}'", "<format>",
+                1, 19, 19);
+
+    if (json_pack_compile("[", &error))
+        fail("json_pack_compile accepted an invalid format");
+    check_error(json_error_invalid_format, "Unexpected end of format string", "<format>",
+                1, 2, 2);
+
+    if (json_pack_compile("[i]a", &error))
+        fail("json_pack_compile accepted garbage");
+    check_error(json_error_invalid_format, "Garbage after format string", "<format>", 1,
+                4, 4);
+
+    if (json_pack_compile(NULL, &error))
+        fail("json_pack_compile accepted a NULL format");
+    check_error(json_error_invalid_argument, "NULL or empty format string", "<format>",
+                -1, -1, 0);
+
+    if (json_pack_plan_ex(&error, 0, NULL))
+        fail("json_pack_plan_ex succeeded without a plan");
+    check_error(json_error_invalid_argument, "NULL plan", "<format>", -1, -1, 0);
+
+    json_pack_plan_free(NULL);
+}
+
+static void run_tests() {
+    same_as_pack();
+    stealing();
+    streaming();
+    format_errors();
+}
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char text[] =
+    "{\"ints\": [1, -2, 3], \"reals\": [1.5, -0.0, 2e3], \"strings\": [1, \"x\"], "
+    "\"mixed\": [1, 2.5, 3], \"empty\": [], \"nested\": [[1, 2], [3.5], [null]]}";
+
+#define is_packed(json_) (json_array_int_data(json_) || json_array_real_data(json_))
+
+static void check_dumps(const json_t *packed, const json_t *boxed, size_t flags) {
+    char *result = json_dumps(packed, flags), *expected = json_dumps(boxed, flags);
+
+    if (!result || !expected || strcmp(result, expected)) {
+        failhdr;
+        fprintf(stderr, "json_dumps returned %s, expected %s\n", result, expected);
+        exit(1);
+    }
+    free(result);
+    free(expected);
+}
+
+static void check_binary(const json_t *packed, const json_t *boxed,
+                         size_t (*dumpb)(const json_t *, char *, size_t, size_t)) {
+    char result[256], expected[256];
+    size_t size = dumpb(boxed, expected, sizeof(expected), 0);
+
+    if (size == 0 || size > sizeof(expected))
+        fail("unable to encode the boxed values");
+    if (dumpb(packed, result, sizeof(result), 0) != size ||
+        memcmp(result, expected, size))
+        fail("a packed array was encoded differently");
+}
+
+static void constructors() {
+    const json_int_t ints[] = {1, 2, -3};
+    const double reals[] = {0.5, -1.0};
+    const double nan_reals[] = {0.5, NAN};
+    json_t *json, *value;
+
+    json = json_array_of_integers(ints, 3);
+    if (!json || json_array_size(json) != 3 || !json_array_int_data(json) ||
+        json_array_int_data(json)[2] != -3 || json_array_real_data(json))
+        fail("json_array_of_integers failed");
+
+    /* the size is known without boxing */
+    if (!json_array_int_data(json))
+        fail("json_array_size boxed a packed array");
+
+    value = json_array_get(json, 1);
+    if (json_integer_value(value) != 2 || json_array_int_data(json))
+        fail("json_array_get didn't box a packed array");
+    if (json_integer_value(json_array_get(json, 2)) != -3 || json_array_size(json) != 3)
+        fail("boxing changed the array");
+    json_decref(json);
+
+    json = json_array_of_reals(reals, 2);
+    if (!json || json_array_size(json) != 2 || !json_array_real_data(json) ||
+        json_array_real_data(json)[0] != 0.5 || json_array_int_data(json))
+        fail("json_array_of_reals failed");
+    if (json_array_append_new(json, json_string("x")) || json_array_size(json) != 3 ||
+        json_real_value(json_array_get(json, 1)) != -1.0 || is_packed(json))
+        fail("appending to a packed array failed");
+    json_decref(json);
+
+    if (json_array_of_reals(nan_reals, 2))
+        fail("json_array_of_reals accepted NaN");
+    if (json_array_of_integers(NULL, 1) || json_array_of_reals(NULL, 1))
+        fail("a packed array was made of NULL");
+
+    json = json_array_of_integers(NULL, 0);
+    if (!json || json_array_size(json) != 0 || !json_array_int_data(json))
+        fail("json_array_of_integers failed without values");
+    if (json_array_append_new(json, json_integer(5)) || json_array_size(json) != 1)
+        fail("appending to an empty packed array failed");
+    json_decref(json);
+
+    if (json_array_int_data(NULL) || json_array_real_data(json_null()))
+        fail("a non-array had packed numbers");
+}
+
+static void loading() {
+    json_t *json, *boxed, *nested;
+    json_error_t error;
+
+    boxed = json_loads(text, 0, NULL);
+    json = json_loadb_packed(text, strlen(text), 0, &error);
+    if (!json)
+        fail("json_loadb_packed failed");
+    if ((size_t)error.position != strlen(text))
+        fail("json_loadb_packed returned a wrong position");
+
+    if (!json_array_int_data(json_object_get(json, "ints")) ||
+        !json_array_real_data(json_object_get(json, "reals")))
+        fail("json_loadb_packed didn't pack arrays of numbers");
+    if (is_packed(json_object_get(json, "strings")) ||
+        is_packed(json_object_get(json, "mixed")) ||
+        is_packed(json_object_get(json, "empty")))
+        fail("json_loadb_packed packed other arrays");
+    nested = json_object_get(json, "nested");
+    if (is_packed(nested) || !json_array_int_data(json_array_get(nested, 0)) ||
+        !json_array_real_data(json_array_get(nested, 1)))
+        fail("json_loadb_packed didn't pack nested arrays");
+
+    /* encoding, comparing and hashing don't box them */
+    check_dumps(json, boxed, 0);
+    check_dumps(json, boxed, JSON_COMPACT | JSON_SORT_KEYS);
+    check_dumps(json, boxed, JSON_INDENT(2) | JSON_REAL_PRECISION(3));
+    check_dumps(json_object_get(json, "ints"), json_object_get(boxed, "ints"),
+                JSON_EMBED);
+    check_binary(json, boxed, json_dumpb_cbor);
+    check_binary(json, boxed, json_dumpb_msgpack);
+    if (!json_equal(json, boxed) || !json_equal(boxed, json))
+        fail("packed arrays weren't equal to boxed ones");
+    if (json_hash(json) != json_hash(boxed))
+        fail("packed arrays were hashed differently");
+    if (!json_array_int_data(json_object_get(json, "ints")))
+        fail("a packed array was boxed");
+
+    json_decref(json);
+    json_decref(boxed);
+
+    json = json_loadb_packed("[1, 2]", 6, JSON_DECODE_INT_AS_REAL, NULL);
+    if (!json_array_real_data(json) || json_array_real_data(json)[1] != 2.0)
+        fail("json_loadb_packed didn't honor JSON_DECODE_INT_AS_REAL");
+    json_decref(json);
+}
+
+static void check_same_error(const char *input, size_t flags) {
+    json_error_t error, expected;
+
+    if (json_loadb_packed(input, strlen(input), flags, &error))
+        fail("json_loadb_packed accepted invalid input");
+    if (json_loads(input, flags, &expected))
+        fail("json_loads accepted invalid input");
+    if (strcmp(error.text, expected.text) || error.position != expected.position)
+        fail("json_loadb_packed returned a different error than json_loads");
+}
+
+static void errors() {
+    check_same_error("[1, 2,]", 0);
+    check_same_error("[1 2]", 0);
+    check_same_error("[1, 2", 0);
+    check_same_error("[1.5, ", 0);
+    check_same_error("[1, 2.5, x]", 0);
+    check_same_error("[[1]]", JSON_PARSER_DEPTH(1));
+    check_same_error("[1]", JSON_PARSER_DEPTH(1) | JSON_DECODE_ANY);
+
+    if (json_loadb_packed(NULL, 0, 0, NULL))
+        fail("json_loadb_packed accepted NULL");
+}
+
+static void copying() {
+    const json_int_t ints[] = {4, 5, 6};
+    json_t *json, *copy;
+
+    json = json_array_of_integers(ints, 3);
+
+    copy = json_copy(json);
+    if (!json_array_int_data(copy) || !json_equal(copy, json) ||
+        json_array_int_data(copy) == json_array_int_data(json))
+        fail("json_copy didn't copy a packed array");
+    json_decref(copy);
+
+    copy = json_deep_copy(json);
+    if (!json_array_int_data(copy) || !json_equal(copy, json))
+        fail("json_deep_copy didn't copy a packed array");
+    json_decref(copy);
+
+    copy = json_deep_copy_cow(json);
+    if (!json_array_int_data(copy) || !json_equal(copy, json))
+        fail("json_deep_copy_cow didn't copy a packed array");
+    json_decref(copy);
+
+    if (json_array_clear(json) || json_array_size(json) != 0 || is_packed(json))
+        fail("json_array_clear failed on a packed array");
+    if (json_array_append_new(json, json_true()) || json_array_size(json) != 1)
+        fail("appending to a cleared packed array failed");
+    json_decref(json);
+
+    /* frozen arrays can be read from several threads */
+    json = json_array_of_integers(ints, 3);
+    if (json_freeze(json) || is_packed(json) ||
+        json_integer_value(json_array_get(json, 2)) != 6)
+        fail("json_freeze didn't box a packed array");
+    json_decref(json_thaw(json));
+}
+
+static void run_tests() {
+    constructors();
+    loading();
+    errors();
+    copying();
+}
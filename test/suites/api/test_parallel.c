@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The number of members of a document that's split to several chunks
+   when decoding, of one that's just split to two, even when compact,
+   and of one that's encoded in chunks */
+#define MEMBERS      40000
+#define FEW_MEMBERS  8000
+#define DUMP_MEMBERS 1000
+
+static json_t *member(int i) {
+    return json_pack("{s:i, s:s, s:[i, f, b, n], s:{s:s}}", "id", i, "name",
+                     "a \"quoted\", [bracketed] {name}\\", "list", i, i / 3.0, i % 2,
+                     "nested", "text", "\xc3\xa4 / \\\\\"");
+}
+
+static json_t *large_array(int members) {
+    json_t *array = json_array();
+    int i;
+
+    for (i = 0; i < members; i++)
+        json_array_append_new(array, member(i));
+    return array;
+}
+
+static json_t *large_object(int members) {
+    json_t *object = json_object();
+    char key[32];
+    int i;
+
+    for (i = 0; i < members; i++) {
+        sprintf(key, "key \"%d\"", members - i);
+        json_object_set_new(object, key, member(i));
+    }
+    return object;
+}
+
+static int same_error(const json_error_t *error, const json_error_t *expected) {
+    return !strcmp(error->text, expected->text) &&
+           !strcmp(error->source, expected->source) && error->line == expected->line &&
+           error->column == expected->column && error->position == expected->position &&
+           json_error_code(error) == json_error_code(expected);
+}
+
+/* Decode with json_loadb() and json_loadb_parallel(), and check that
+   the results are the same */
+static void compare_load(const char *text, size_t len, size_t flags) {
+    json_error_t expected_error, error;
+    json_t *expected, *value;
+
+    expected = json_loadb(text, len, flags, &expected_error);
+    value = json_loadb_parallel(text, len, flags, 4, &error);
+
+    if (expected ? !json_equal(value, expected) ||
+                       error.position != expected_error.position
+                 : value || !same_error(&error, &expected_error)) {
+        failhdr;
+        fprintf(stderr, "got %d:%d:%d %s, expected %d:%d:%d %s\n", error.line,
+                error.column, error.position, error.text, expected_error.line,
+                expected_error.column, expected_error.position, expected_error.text);
+        exit(1);
+    }
+
+    json_decref(expected);
+    json_decref(value);
+}
+
+static void load_parallel() {
+    json_t *values[2];
+    char *text, *copy;
+    size_t len;
+    int i;
+
+    /* many chunks */
+    values[0] = large_array(MEMBERS);
+    text = json_dumps(values[0], JSON_INDENT(2));
+    compare_load(text, strlen(text), 0);
+    free(text);
+    json_decref(values[0]);
+
+    /* and the rest with a few of them */
+    values[0] = large_array(FEW_MEMBERS);
+    values[1] = large_object(FEW_MEMBERS);
+
+    for (i = 0; i < 2; i++) {
+        text = json_dumps(values[i], JSON_INDENT(2));
+        len = strlen(text);
+        compare_load(text, len, 0);
+        compare_load(text, len, JSON_REJECT_DUPLICATES);
+
+        copy = malloc(len + 16);
+
+        /* an error after the first chunk */
+        memcpy(copy, text, len);
+        copy[len - len / 4] = '!';
+        compare_load(copy, len, 0);
+
+        /* an unclosed string makes the pre-scan fail */
+        copy[len - len / 4] = '"';
+        compare_load(copy, len, 0);
+
+        /* garbage after the value */
+        memcpy(copy + len, "  x", 3);
+        memcpy(copy, text, len);
+        compare_load(copy, len + 3, 0);
+        compare_load(copy, len + 3, JSON_DISABLE_EOF_CHECK);
+
+        /* an unclosed container */
+        compare_load(copy, len - 1, 0);
+
+        free(copy);
+        free(text);
+    }
+
+    /* a duplicate key in different chunks */
+    text = json_dumps(values[1], JSON_COMPACT);
+    len = strlen(text);
+    copy = malloc(len + 32);
+    memcpy(copy, text, len - 1);
+    strcpy(copy + len - 1, ",\"key \\\"1\\\"\":[1]}");
+    len = strlen(copy);
+    compare_load(copy, len, 0);
+    compare_load(copy, len, JSON_REJECT_DUPLICATES);
+    free(copy);
+    free(text);
+
+    /* small inputs */
+    compare_load("[1, 2]", 6, 0);
+    compare_load("[1, 2", 5, 0);
+    compare_load("3", 1, JSON_DECODE_ANY);
+
+    if (json_loadb_parallel(NULL, 0, 0, 0, NULL))
+        fail("json_loadb_parallel accepted a NULL buffer");
+
+    json_decref(values[0]);
+    json_decref(values[1]);
+}
+
+static void compare_dump(const json_t *json, size_t flags) {
+    static const size_t nthreads[] = {0, 1, 2, 4, 7};
+    char *expected, *dumped;
+    size_t i;
+
+    expected = json_dumps(json, flags);
+    for (i = 0; i < sizeof(nthreads) / sizeof(nthreads[0]); i++) {
+        dumped = json_dumps_parallel(json, flags, nthreads[i]);
+        if (expected ? !dumped || strcmp(dumped, expected) : dumped != NULL) {
+            failhdr;
+            fprintf(stderr, "flags 0x%x, %d threads: different output\n", (int)flags,
+                    (int)nthreads[i]);
+            exit(1);
+        }
+        free(dumped);
+    }
+    free(expected);
+}
+
+static int fail_after(const char *buffer, size_t size, void *data) {
+    size_t *left = data;
+    (void)buffer;
+    if (size > *left)
+        return -1;
+    *left -= size;
+    return 0;
+}
+
+static void dump_parallel() {
+    static const size_t flags[] = {0,
+                                   JSON_INDENT(2),
+                                   JSON_INDENT(4) | JSON_SORT_KEYS,
+                                   JSON_COMPACT,
+                                   JSON_COMPACT | JSON_SORT_KEYS,
+                                   JSON_SORT_KEYS,
+                                   JSON_EMBED,
+                                   JSON_EMBED | JSON_INDENT(1),
+                                   JSON_ENSURE_ASCII | JSON_ESCAPE_SLASH,
+                                   JSON_REAL_PRECISION(3) | JSON_COMPACT};
+    json_t *values[5], *large, *loop;
+    size_t i, j, left;
+
+    values[0] = large_array(DUMP_MEMBERS);
+    values[1] = large_object(DUMP_MEMBERS);
+    values[2] = json_pack("[i, {s:i}]", 1, "a", 2);
+    values[3] = json_pack("{s:[], s:{}}", "b", "a");
+    values[4] = json_array();
+
+    for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        for (j = 0; j < sizeof(flags) / sizeof(flags[0]); j++)
+            compare_dump(values[i], flags[j]);
+    }
+
+    compare_dump(json_array_get(values[2], 0), 0);
+    compare_dump(json_array_get(values[2], 0), JSON_ENCODE_ANY);
+
+    /* many members per chunk */
+    large = large_array(MEMBERS);
+    compare_dump(large, JSON_INDENT(2));
+    json_decref(large);
+
+    /* errors are returned */
+    loop = json_pack("[i, i, []]", 1, 2);
+    json_array_append(json_array_get(loop, 2), loop);
+    if (json_dumps_parallel(loop, 0, 4))
+        fail("json_dumps_parallel encoded a circular reference");
+    json_array_clear(json_array_get(loop, 2));
+    json_decref(loop);
+
+    left = 100000;
+    if (json_dump_callback_parallel(values[0], fail_after, &left, 0, 4) != -1)
+        fail("json_dump_callback_parallel ignored an error from the callback");
+    if (json_dump_callback_parallel(values[0], NULL, NULL, 0, 4) != -1)
+        fail("json_dump_callback_parallel accepted a NULL callback");
+
+    for (i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+        json_decref(values[i]);
+}
+
+static void run_tests() {
+    load_parallel();
+    dump_parallel();
+}
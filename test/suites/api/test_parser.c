@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <string.h>
+
+static const char *valid[] = {
+    "{\"name\": \"parser\", \"list\": [1, -2.5e3, \"three\", null, true, false],"
+    " \"nested\": {\"a\": {\"b\": [[], {}]}}}",
+    "[\"\\u00e4\\ud834\\udd1e\\n\\\"\\\\\", \"\xc3\xa4\xe2\x82\xac\xf0\x9d\x84\x9e\"]",
+    "  [ 123456789012 , 0.1 , -0 , 1E+2 ]\n",
+    "{}",
+    "[[[[[[[[[[1]]]]]]]]]]",
+};
+
+static const char *invalid[] = {
+    "[1, 2",
+    "{\"a\" 1}",
+    "{\"a\": 1,}",
+    "[1, 2,]",
+    "[1 2]",
+    "{1: 2}",
+    "[\"abc",
+    "[\"a\\q\"]",
+    "[tru]",
+    "[1.]",
+    "[1-2]",
+    "[\xc3\xa4]",
+    "[\xff]",
+    "{\"a\": 1, \"a\": 2}",
+    "{\"a\\u0000\": 1}",
+    "[\"\\u0000\"]",
+    "[1] x",
+    "[1] [2]",
+    "42",
+    "",
+    "  ",
+};
+
+static json_t *feed_in_chunks(const char *text, size_t chunk, size_t flags,
+                              json_error_t *error) {
+    json_parser_t *parser = json_parser_new(flags);
+    size_t len = strlen(text), i;
+    int status = JSON_PARSER_NEED_MORE;
+    json_t *json;
+
+    if (!parser)
+        fail("json_parser_new failed");
+
+    for (i = 0; i < len && status != JSON_PARSER_ERROR; i += chunk)
+        status = json_parser_feed(parser, text + i, len - i < chunk ? len - i : chunk);
+
+    if (status != JSON_PARSER_ERROR)
+        json_parser_finish(parser);
+
+    json = json_parser_result(parser, error);
+    json_parser_free(parser);
+    return json;
+}
+
+static void same_as_loadb(const char *text, size_t flags) {
+    json_error_t expected, error;
+    json_t *reference = json_loadb(text, strlen(text), flags, &expected);
+    size_t chunk;
+
+    for (chunk = 1; chunk <= strlen(text) + 1; chunk++) {
+        json_t *json = feed_in_chunks(text, chunk, flags, &error);
+
+        if (reference ? !json_equal(json, reference) : json != NULL) {
+            fprintf(stderr, "%s (chunk %d)\n", text, (int)chunk);
+            fail("json_parser_feed returned a different value than json_loadb");
+        }
+        if (strcmp(error.text, expected.text) || error.line != expected.line ||
+            error.column != expected.column || error.position != expected.position ||
+            (!reference && json_error_code(&error) != json_error_code(&expected))) {
+            fprintf(stderr, "%s (chunk %d): \"%s\" %d:%d:%d != \"%s\" %d:%d:%d\n", text,
+                    (int)chunk, error.text, error.line, error.column, error.position,
+                    expected.text, expected.line, expected.column, expected.position);
+            fail("json_parser_feed returned a different error than json_loadb");
+        }
+        json_decref(json);
+    }
+    json_decref(reference);
+}
+
+static void compare_with_loadb() {
+    size_t i;
+
+    for (i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+        same_as_loadb(valid[i], 0);
+        same_as_loadb(valid[i], JSON_DECODE_INT_AS_REAL);
+    }
+    for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        same_as_loadb(invalid[i], 0);
+        same_as_loadb(invalid[i], JSON_DECODE_ANY);
+    }
+
+    same_as_loadb("\"\\u0000\"", JSON_DECODE_ANY | JSON_ALLOW_NUL);
+    same_as_loadb(" -12.5e-1 ", JSON_DECODE_ANY);
+    same_as_loadb("nul", JSON_DECODE_ANY);
+}
+
+static void top_level_scalar() {
+    json_parser_t *parser = json_parser_new(JSON_DECODE_ANY);
+    json_error_t error;
+    json_t *json;
+
+    /* a number may continue until the end of input */
+    if (json_parser_feed(parser, "12", 2) != JSON_PARSER_NEED_MORE ||
+        json_parser_feed(parser, "34", 2) != JSON_PARSER_NEED_MORE)
+        fail("json_parser_feed finished a number too early");
+    if (json_parser_finish(parser) != JSON_PARSER_DONE)
+        fail("json_parser_finish failed");
+
+    json = json_parser_result(parser, &error);
+    if (json_integer_value(json) != 1234 || error.position != 4)
+        fail("json_parser_result returned a wrong value");
+    json_decref(json);
+
+    if (json_parser_result(parser, NULL))
+        fail("json_parser_result returned the value twice");
+    json_parser_free(parser);
+}
+
+static void stop_after_value() {
+    const char text[] = "{\"id\": 1}\n{\"id\": 2}";
+    json_parser_t *parser = json_parser_new(JSON_DISABLE_EOF_CHECK);
+    json_error_t error;
+    json_t *json;
+
+    if (json_parser_feed(parser, text, 4) != JSON_PARSER_NEED_MORE ||
+        json_parser_feed(parser, text + 4, sizeof(text) - 5) != JSON_PARSER_DONE)
+        fail("json_parser_feed failed with JSON_DISABLE_EOF_CHECK");
+    if (json_parser_feed(parser, "garbage", 7) != JSON_PARSER_DONE)
+        fail("json_parser_feed consumed input after the value");
+
+    json = json_parser_result(parser, &error);
+    if (json_integer_value(json_object_get(json, "id")) != 1 || error.position != 9)
+        fail("json_parser_result returned a wrong value or position");
+    json_decref(json);
+    json_parser_free(parser);
+
+    /* trailing garbage is still an error without the flag */
+    parser = json_parser_new(0);
+    if (json_parser_feed(parser, text, 9) != JSON_PARSER_DONE ||
+        json_parser_feed(parser, " \n", 2) != JSON_PARSER_DONE ||
+        json_parser_feed(parser, "{", 1) != JSON_PARSER_ERROR ||
+        json_parser_feed(parser, "}", 1) != JSON_PARSER_ERROR ||
+        json_parser_finish(parser) != JSON_PARSER_ERROR)
+        fail("json_parser_feed accepted trailing garbage");
+    if (json_parser_result(parser, &error))
+        fail("json_parser_result returned a value after an error");
+    check_error(json_error_end_of_input_expected, "end of file expected near '{'",
+                "<buffer>", 2, 1, 12);
+    json_parser_free(parser);
+}
+
+static void long_split_string() {
+    json_parser_t *parser = json_parser_new(0);
+    size_t i, len = 100000;
+    char *text = malloc(len + 5);
+    json_t *json;
+
+    text[0] = '[';
+    text[1] = '"';
+    for (i = 2; i < len + 2; i++)
+        text[i] = "ab\\\\"[i % 4];
+    strcpy(text + len + 2, "\"]");
+
+    for (i = 0; i < len + 4; i += 7)
+        if (json_parser_feed(parser, text + i, len + 4 - i < 7 ? len + 4 - i : 7) ==
+            JSON_PARSER_ERROR)
+            fail("json_parser_feed failed on a long string");
+
+    json = json_parser_result(parser, NULL);
+    if (!json || json_string_length(json_array_get(json, 0)) != len / 4 * 3)
+        fail("json_parser_feed decoded a long string wrong");
+    json_decref(json);
+    json_parser_free(parser);
+    free(text);
+}
+
+static void too_deep() {
+    json_parser_t *parser = json_parser_new(0);
+    json_error_t error;
+    int i;
+
+    for (i = 0; i <= JSON_PARSER_MAX_DEPTH; i++)
+        if (json_parser_feed(parser, "[", 1) == JSON_PARSER_ERROR)
+            break;
+    if (json_parser_result(parser, &error))
+        fail("json_parser_feed succeeded on a too deep document");
+    check_error(json_error_stack_overflow, "maximum parsing depth reached near '['",
+                "<buffer>", 1, JSON_PARSER_MAX_DEPTH + 1, JSON_PARSER_MAX_DEPTH + 1);
+    json_parser_free(parser);
+
+    /* the limit can be set per parser */
+    parser = json_parser_new(JSON_PARSER_DEPTH(2));
+    if (json_parser_feed(parser, "[[], [[", 7) != JSON_PARSER_ERROR ||
+        json_parser_result(parser, &error))
+        fail("json_parser_feed exceeded the nesting limit");
+    check_error(json_error_stack_overflow, "maximum parsing depth reached near '['",
+                "<buffer>", 1, 7, 7);
+    json_parser_free(parser);
+
+    /* releasing a parser in the middle of a document */
+    parser = json_parser_new(0);
+    json_parser_feed(parser, "{\"a\": [1, {\"b\": \"c", 18);
+    json_parser_free(parser);
+    json_parser_free(NULL);
+}
+
+static void wrong_arguments() {
+    json_parser_t *parser = json_parser_new(0);
+    json_error_t error;
+
+    if (json_parser_feed(NULL, "[]", 2) != JSON_PARSER_ERROR ||
+        json_parser_finish(NULL) != JSON_PARSER_ERROR)
+        fail("json_parser_feed accepted a NULL parser");
+
+    if (json_parser_result(NULL, &error))
+        fail("json_parser_result returned a value for a NULL parser");
+    check_error(json_error_invalid_argument, "wrong arguments", "<buffer>", -1, -1, 0);
+
+    if (json_parser_feed(parser, NULL, 0) != JSON_PARSER_NEED_MORE)
+        fail("json_parser_feed failed on empty input");
+    if (json_parser_feed(parser, NULL, 1) != JSON_PARSER_ERROR)
+        fail("json_parser_feed accepted a NULL buffer");
+    if (json_parser_result(parser, &error))
+        fail("json_parser_result returned a value after an error");
+    check_error(json_error_invalid_argument, "wrong arguments", "<buffer>", -1, -1, 0);
+    json_parser_free(parser);
+}
+
+static void run_tests() {
+    compare_with_loadb();
+    top_level_scalar();
+    stop_after_value();
+    long_split_string();
+    too_deep();
+    wrong_arguments();
+}
@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdlib.h>
+#include <string.h>
+
+static json_t *load(const char *text) {
+    json_t *json = json_loads(text, JSON_DECODE_ANY, NULL);
+    if (!json)
+        fail("json_loads failed");
+    return json;
+}
+
+/* Check that the diff of source and target turns a copy of source
+   into target */
+static void round_trip(const char *source_text, const char *target_text) {
+    json_t *source = load(source_text), *target = load(target_text), *patch, *copy;
+    json_error_t error;
+
+    patch = json_diff(source, target);
+    copy = json_deep_copy(source);
+    if (!patch || json_patch_apply(copy, patch, &error) || !json_equal(copy, target)) {
+        char *dumped = patch ? json_dumps(patch, JSON_ENCODE_ANY) : NULL;
+        failhdr;
+        fprintf(stderr, "%s -> %s: patch %s failed\n", source_text, target_text,
+                dumped ? dumped : "NULL");
+        exit(1);
+    }
+    json_decref(patch);
+    json_decref(copy);
+
+    /* the merge patch works for objects without nulls */
+    if (json_is_object(source) && json_is_object(target) &&
+        !strstr(target_text, "null")) {
+        patch = json_merge_diff(source, target);
+        copy = json_deep_copy(source);
+        if (!patch || json_merge_patch_apply(copy, patch) || !json_equal(copy, target)) {
+            failhdr;
+            fprintf(stderr, "%s -> %s: merge patch failed\n", source_text,
+                    target_text);
+            exit(1);
+        }
+        json_decref(patch);
+        json_decref(copy);
+    }
+
+    json_decref(source);
+    json_decref(target);
+}
+
+static void diff() {
+    json_t *source, *target, *patch, *expected;
+
+    round_trip("{}", "{}");
+    round_trip("{\"a\": 1}", "{\"a\": 2}");
+    round_trip("{\"a\": 1, \"b\": 2}", "{\"b\": 2, \"c\": 3}");
+    round_trip("{\"a\": {\"b\": {\"c\": [1, 2]}}}", "{\"a\": {\"b\": {\"c\": [1, 3]}}}");
+    round_trip("{\"a/b\": 1, \"c~d\": {\"~\": 2}}", "{\"a/b\": 3, \"c~d\": {\"~\": 4}}");
+    round_trip("{\"a\": [1, 2, 3]}", "{\"a\": {\"0\": 1}}");
+    round_trip("{\"a\": 1}", "{\"a\": 1.0}");
+    round_trip("[1, 2, 3, 4, 5]", "[1, 2, 9, 4, 5]");
+    round_trip("[1, 2, 3, 4, 5]", "[0, 1, 2, 3, 4, 5]");
+    round_trip("[1, 2, 3, 4, 5]", "[1, 4, 5]");
+    round_trip("[1, 2, 3]", "[1, 7, 8, 9, 2, 3]");
+    round_trip("[1, 2, 3]", "[]");
+    round_trip("[]", "[{\"a\": null}]");
+    round_trip("[[1, [2]], {\"x\": [3]}]", "[[1, [2, 3]], {\"x\": [], \"y\": null}]");
+    round_trip("[1, 2]", "[2, 1]");
+    round_trip("[1, 1, 1]", "[1, 1]");
+
+    /* a change of the root type can't be applied in place, but the
+       patch describes it */
+    source = load("[1]");
+    target = load("{\"a\": 1}");
+    patch = json_diff(source, target);
+    expected = load("[{\"op\": \"replace\", \"path\": \"\", \"value\": {\"a\": 1}}]");
+    if (!json_equal(patch, expected))
+        fail("json_diff returned a wrong patch for a new root");
+    json_decref(source);
+    json_decref(target);
+    json_decref(patch);
+    json_decref(expected);
+
+    /* the patch is minimal for simple changes */
+    source = load("{\"a\": 1, \"b\": [1, 2, 3], \"c\": {\"d\": true}}");
+    target = json_deep_copy(source);
+    json_object_set_new(target, "a", json_integer(2));
+    json_array_remove(json_object_get(target, "b"), 1);
+    json_object_set_new(json_object_get(target, "c"), "e/f", json_null());
+    patch = json_diff(source, target);
+    expected = load("[{\"op\": \"replace\", \"path\": \"/a\", \"value\": 2},"
+                    " {\"op\": \"remove\", \"path\": \"/b/1\"},"
+                    " {\"op\": \"add\", \"path\": \"/c/e~1f\", \"value\": null}]");
+    if (!json_equal(patch, expected))
+        fail("json_diff returned a wrong patch");
+    json_decref(patch);
+    json_decref(expected);
+
+    /* equal documents give an empty patch */
+    patch = json_diff(source, source);
+    if (!json_is_array(patch) || json_array_size(patch) != 0)
+        fail("json_diff returned a non-empty patch for the same value");
+    json_decref(patch);
+
+    patch = json_merge_diff(source, target);
+    expected = load("{\"a\": 2, \"b\": [1, 3], \"c\": {\"e/f\": null}}");
+    if (!json_equal(patch, expected))
+        fail("json_merge_diff returned a wrong patch");
+    json_decref(patch);
+    json_decref(expected);
+
+    if (json_diff(NULL, source) || json_diff(source, NULL) ||
+        json_merge_diff(NULL, source))
+        fail("json_diff accepted NULL");
+
+    json_decref(source);
+    json_decref(target);
+}
+
+/* Apply a patch to a document, and check the result */
+static void apply(const char *document, const char *patch_text, const char *expected) {
+    json_t *json = load(document), *patch = load(patch_text), *result = load(expected);
+    json_error_t error;
+
+    if (json_patch_apply(json, patch, &error) || !json_equal(json, result)) {
+        char *dumped = json_dumps(json, JSON_ENCODE_ANY);
+        failhdr;
+        fprintf(stderr, "%s with %s: got %s (%s)\n", document, patch_text, dumped,
+                error.text);
+        exit(1);
+    }
+
+    json_decref(json);
+    json_decref(patch);
+    json_decref(result);
+}
+
+static void patch_operations() {
+    apply("{\"foo\": \"bar\"}",
+          "[{\"op\": \"add\", \"path\": \"/baz\", \"value\": \"qux\"}]",
+          "{\"baz\": \"qux\", \"foo\": \"bar\"}");
+    apply("{\"foo\": [\"bar\", \"baz\"]}",
+          "[{\"op\": \"add\", \"path\": \"/foo/1\", \"value\": \"qux\"}]",
+          "{\"foo\": [\"bar\", \"qux\", \"baz\"]}");
+    apply("{\"foo\": [1]}", "[{\"op\": \"add\", \"path\": \"/foo/-\", \"value\": 2}]",
+          "{\"foo\": [1, 2]}");
+    apply("{\"baz\": \"qux\", \"foo\": \"bar\"}",
+          "[{\"op\": \"remove\", \"path\": \"/baz\"}]", "{\"foo\": \"bar\"}");
+    apply("{\"foo\": [\"bar\", \"qux\", \"baz\"]}",
+          "[{\"op\": \"remove\", \"path\": \"/foo/1\"}]",
+          "{\"foo\": [\"bar\", \"baz\"]}");
+    apply("{\"baz\": \"qux\", \"foo\": \"bar\"}",
+          "[{\"op\": \"replace\", \"path\": \"/baz\", \"value\": \"boo\"}]",
+          "{\"baz\": \"boo\", \"foo\": \"bar\"}");
+    apply("{\"foo\": {\"bar\": \"baz\", \"waldo\": \"fred\"}, \"qux\": {\"corge\": 1}}",
+          "[{\"op\": \"move\", \"from\": \"/foo/waldo\", \"path\": \"/qux/thud\"}]",
+          "{\"foo\": {\"bar\": \"baz\"}, \"qux\": {\"corge\": 1, \"thud\": \"fred\"}}");
+    apply("{\"foo\": [\"all\", \"grass\", \"cows\", \"eat\"]}",
+          "[{\"op\": \"move\", \"from\": \"/foo/1\", \"path\": \"/foo/3\"}]",
+          "{\"foo\": [\"all\", \"cows\", \"eat\", \"grass\"]}");
+    apply("{\"a\": {\"b\": 1}}",
+          "[{\"op\": \"copy\", \"from\": \"/a\", \"path\": \"/c\"},"
+          " {\"op\": \"replace\", \"path\": \"/c/b\", \"value\": 2}]",
+          "{\"a\": {\"b\": 1}, \"c\": {\"b\": 2}}");
+    apply("{\"baz\": \"qux\", \"foo\": [\"a\", 2, \"c\"]}",
+          "[{\"op\": \"test\", \"path\": \"/baz\", \"value\": \"qux\"},"
+          " {\"op\": \"test\", \"path\": \"/foo/1\", \"value\": 2}]",
+          "{\"baz\": \"qux\", \"foo\": [\"a\", 2, \"c\"]}");
+    apply("{\"/\": 9, \"~1\": 10}",
+          "[{\"op\": \"test\", \"path\": \"/~01\", \"value\": 10},"
+          " {\"op\": \"remove\", \"path\": \"/~1\"}]",
+          "{\"~1\": 10}");
+    apply("{\"\": {\"\": 1}}", "[{\"op\": \"replace\", \"path\": \"//\", \"value\": 2}]",
+          "{\"\": {\"\": 2}}");
+
+    /* values added by the patch are copied, so later operations don't
+       change the patch */
+    apply("{}", "[{\"op\": \"add\", \"path\": \"/a\", \"value\": {\"b\": []}},"
+                " {\"op\": \"add\", \"path\": \"/a/b/0\", \"value\": 1},"
+                " {\"op\": \"add\", \"path\": \"/c\", \"value\": {\"b\": []}}]",
+          "{\"a\": {\"b\": [1]}, \"c\": {\"b\": []}}");
+
+    /* the root is replaced in place if the type stays the same */
+    apply("{\"a\": 1}", "[{\"op\": \"replace\", \"path\": \"\", \"value\": {\"b\": 2}}]",
+          "{\"b\": 2}");
+    apply("{\"a\": {\"b\": [1]}}",
+          "[{\"op\": \"move\", \"from\": \"/a\", \"path\": \"\"}]",
+          "{\"b\": [1]}");
+    apply("[1, 2]", "[{\"op\": \"test\", \"path\": \"\", \"value\": [1, 2]}]", "[1, 2]");
+}
+
+static void patch_error(const char *patch_text, enum json_error_code code,
+                        const char *text, int position) {
+    const char *document = "{\"a\": {\"b\": [1, 2]}, \"c\": \"d\"}";
+    json_t *json = load(document), *original = load(document), *patch = load(patch_text);
+    json_error_t error;
+
+    if (!json_patch_apply(json, patch, &error))
+        fail("json_patch_apply succeeded with an invalid patch");
+    if (json_error_code(&error) != code || strcmp(error.text, text) ||
+        strcmp(error.source, "<patch>") || error.position != position) {
+        failhdr;
+        fprintf(stderr, "%s: got %d %s at %d\n", patch_text, json_error_code(&error),
+                error.text, error.position);
+        exit(1);
+    }
+
+    /* the document is left as it was */
+    if (!json_equal(json, original)) {
+        char *dumped = json_dumps(json, 0);
+        failhdr;
+        fprintf(stderr, "%s: the document was changed to %s\n", patch_text, dumped);
+        exit(1);
+    }
+
+    json_decref(json);
+    json_decref(original);
+    json_decref(patch);
+}
+
+static void patch_errors() {
+    json_error_t error;
+    json_t *json;
+
+    patch_error("[{\"op\": \"add\", \"path\": \"/x\", \"value\": 1},"
+                " {\"op\": \"test\", \"path\": \"/c\", \"value\": \"e\"}]",
+                json_error_test_failed, "test of '/c' failed", 1);
+    patch_error("[{\"op\": \"remove\", \"path\": \"/a/b/0\"},"
+                " {\"op\": \"replace\", \"path\": \"/a/b/1\", \"value\": 3}]",
+                json_error_index_out_of_range, "'/a/b/1' is not a valid array index", 1);
+    patch_error("[{\"op\": \"add\", \"path\": \"/a/b/-\", \"value\": 3},"
+                " {\"op\": \"add\", \"path\": \"/a/b/0\", \"value\": 0},"
+                " {\"op\": \"replace\", \"path\": \"/c\", \"value\": 1},"
+                " {\"op\": \"move\", \"from\": \"/a\", \"path\": \"/e\"},"
+                " {\"op\": \"copy\", \"from\": \"/e\", \"path\": \"/f\"},"
+                " {\"op\": \"remove\", \"path\": \"/e/b/3\"},"
+                " {\"op\": \"replace\", \"path\": \"\", \"value\": {}},"
+                " {\"op\": \"remove\", \"path\": \"/x\"}]",
+                json_error_item_not_found, "'/x' not found", 7);
+    patch_error("[{\"op\": \"remove\", \"path\": \"/a/x/y\"}]", json_error_item_not_found,
+                "'/a/x/y' not found", 0);
+    patch_error("[{\"op\": \"remove\", \"path\": \"/a/b/01\"}]",
+                json_error_item_not_found, "'/a/b/01' not found", 0);
+    patch_error("[{\"op\": \"add\", \"path\": \"/a/b/3\", \"value\": 1}]",
+                json_error_index_out_of_range, "'/a/b/3' is not a valid array index", 0);
+    patch_error("[{\"op\": \"add\", \"path\": \"/c/d\", \"value\": 1}]",
+                json_error_item_not_found, "'/c/d' not found", 0);
+    patch_error("[{\"op\": \"add\", \"path\": \"a\", \"value\": 1}]",
+                json_error_invalid_format, "invalid JSON Pointer 'a'", 0);
+    patch_error("[{\"op\": \"add\", \"path\": \"/a~2\", \"value\": 1}]",
+                json_error_invalid_format, "invalid JSON Pointer '/a~2'", 0);
+    patch_error("[{\"op\": \"move\", \"from\": \"/a\", \"path\": \"/a/x\"}]",
+                json_error_invalid_argument, "'/a' can't be moved into itself", 0);
+    patch_error("[{\"op\": \"remove\", \"path\": \"\"}]", json_error_invalid_argument,
+                "the root can't be removed", 0);
+    patch_error("[{\"op\": \"add\", \"path\": \"\", \"value\": []}]",
+                json_error_wrong_type,
+                "the root can only be replaced with a value of the same type", 0);
+    patch_error("[{\"op\": \"add\", \"path\": \"/x\"}]", json_error_item_not_found,
+                "'add' operation without 'value'", 0);
+    patch_error("[{\"op\": \"copy\", \"path\": \"/x\"}]", json_error_item_not_found,
+                "'copy' operation without string 'from'", 0);
+    patch_error("[{\"op\": \"frob\", \"path\": \"/x\"}]", json_error_invalid_format,
+                "unknown operation 'frob'", 0);
+    patch_error("[{\"path\": \"/x\"}]", json_error_wrong_type,
+                "an operation must be an object with string 'op' and 'path'", 0);
+    patch_error("[1]", json_error_wrong_type,
+                "an operation must be an object with string 'op' and 'path'", 0);
+
+    json = json_object();
+    if (!json_patch_apply(json, json, &error))
+        fail("json_patch_apply accepted an object as the patch");
+    check_error(json_error_invalid_argument, "wrong arguments", "<patch>", -1, -1, 0);
+    if (!json_patch_apply(NULL, json, NULL))
+        fail("json_patch_apply accepted a NULL document");
+    json_decref(json);
+}
+
+static void merge_patch(const char *document, const char *patch_text,
+                        const char *expected) {
+    json_t *json = load(document), *patch = load(patch_text), *result = load(expected);
+
+    if (json_merge_patch_apply(json, patch) || !json_equal(json, result)) {
+        char *dumped = json_dumps(json, JSON_ENCODE_ANY);
+        failhdr;
+        fprintf(stderr, "%s with %s: got %s\n", document, patch_text, dumped);
+        exit(1);
+    }
+
+    json_decref(json);
+    json_decref(patch);
+    json_decref(result);
+}
+
+static void merge_patches() {
+    json_t *object, *array, *inner, *target;
+
+    /* the examples of RFC 7396 */
+    merge_patch("{\"a\": \"b\"}", "{\"a\": \"c\"}", "{\"a\": \"c\"}");
+    merge_patch("{\"a\": \"b\"}", "{\"b\": \"c\"}", "{\"a\": \"b\", \"b\": \"c\"}");
+    merge_patch("{\"a\": \"b\"}", "{\"a\": null}", "{}");
+    merge_patch("{\"a\": \"b\", \"b\": \"c\"}", "{\"a\": null}", "{\"b\": \"c\"}");
+    merge_patch("{\"a\": [\"b\"]}", "{\"a\": \"c\"}", "{\"a\": \"c\"}");
+    merge_patch("{\"a\": \"c\"}", "{\"a\": [\"b\"]}", "{\"a\": [\"b\"]}");
+    merge_patch("{\"a\": {\"b\": \"c\"}}", "{\"a\": {\"b\": \"d\", \"c\": null}}",
+                "{\"a\": {\"b\": \"d\"}}");
+    merge_patch("{\"a\": [{\"b\": \"c\"}]}", "{\"a\": [1]}", "{\"a\": [1]}");
+    merge_patch("{\"e\": null}", "{\"a\": 1}", "{\"e\": null, \"a\": 1}");
+    merge_patch("{}", "{\"a\": {\"bb\": {\"ccc\": null}}}", "{\"a\": {\"bb\": {}}}");
+    merge_patch("{\"a\": 1}", "{\"a\": {\"b\": 2, \"c\": null}}", "{\"a\": {\"b\": 2}}");
+
+    /* the patch must be an object applied to an object */
+    object = json_object();
+    array = json_array();
+    if (json_merge_patch_apply(object, array) != -1 ||
+        json_merge_patch_apply(array, object) != -1 ||
+        json_merge_patch_apply(NULL, object) != -1)
+        fail("json_merge_patch_apply accepted wrong arguments");
+
+    /* a patch that contains itself is refused */
+    inner = json_object();
+    json_object_set(object, "a", inner);
+    json_object_set(inner, "b", object);
+    target = json_object();
+    if (json_merge_patch_apply(target, object) != -1)
+        fail("json_merge_patch_apply accepted a circular patch");
+    json_object_del(inner, "b");
+
+    json_decref(target);
+    json_decref(inner);
+    json_decref(object);
+    json_decref(array);
+}
+
+static void run_tests() {
+    diff();
+    patch_operations();
+    patch_errors();
+    merge_patches();
+}
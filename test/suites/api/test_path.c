@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <string.h>
+
+/* The example document of RFC 6901 */
+static const char rfc_document[] = "{\"foo\": [\"bar\", \"baz\"], \"\": 0, \"a/b\": 1, "
+                                   "\"c%d\": 2, \"e^f\": 3, \"g|h\": 4, \"i\\\\j\": 5, "
+                                   "\"k\\\"l\": 6, \" \": 7, \"m~n\": 8}";
+
+/* Check that path refers to the value expected encodes to, or to
+   nothing if expected is NULL, in a tree, in a lazily loaded tree and
+   in the text */
+static void check(const char *text, const char *path_text, size_t flags,
+                  const char *expected_text) {
+    json_t *json, *lazy, *expected = NULL, *value;
+    json_path_t *path;
+    json_error_t error;
+
+    path = json_path_compile(path_text, flags, &error);
+    if (!path)
+        fail("json_path_compile failed");
+
+    json = json_loads(text, JSON_DECODE_ANY, NULL);
+    lazy = json_loadb_lazy(text, strlen(text), JSON_DECODE_ANY, NULL);
+    if (!json || !lazy)
+        fail("unable to load the document");
+
+    if (expected_text) {
+        expected = json_loads(expected_text, JSON_DECODE_ANY, NULL);
+        if (!expected)
+            fail("unable to load the expected value");
+    }
+
+    value = json_path_eval(json, path);
+    if (expected ? !json_equal(value, expected) : value != NULL) {
+        failhdr;
+        fprintf(stderr, "%s: json_path_eval returned the wrong value\n", path_text);
+        exit(1);
+    }
+
+    value = json_path_eval(lazy, path);
+    if (expected ? !json_equal(value, expected) : value != NULL) {
+        failhdr;
+        fprintf(stderr, "%s: wrong value in a lazily loaded tree\n", path_text);
+        exit(1);
+    }
+
+    value = json_path_loadb(text, strlen(text), JSON_DECODE_ANY, path, &error);
+    if (expected ? !json_equal(value, expected) : value != NULL) {
+        failhdr;
+        fprintf(stderr, "%s: json_path_loadb returned the wrong value\n", path_text);
+        exit(1);
+    }
+    if (!expected && json_error_code(&error) != json_error_item_not_found) {
+        failhdr;
+        fprintf(stderr, "%s: json_path_loadb failed with %s\n", path_text, error.text);
+        exit(1);
+    }
+
+    json_decref(value);
+    json_decref(expected);
+    json_decref(lazy);
+    json_decref(json);
+    json_path_free(path);
+}
+
+static void pointers() {
+    const char *doc = "{\"a\": {\"b\": [10, {\"c\": true}, [1, 2]]}, \"1\": \"one\","
+                      " \"*\": \"star\", \"-\": null, \"01\": 1}";
+
+    check(rfc_document, "", 0, rfc_document);
+    check(rfc_document, "/foo", 0, "[\"bar\", \"baz\"]");
+    check(rfc_document, "/foo/0", 0, "\"bar\"");
+    check(rfc_document, "/", 0, "0");
+    check(rfc_document, "/a~1b", 0, "1");
+    check(rfc_document, "/c%d", 0, "2");
+    check(rfc_document, "/e^f", 0, "3");
+    check(rfc_document, "/g|h", 0, "4");
+    check(rfc_document, "/i\\j", 0, "5");
+    check(rfc_document, "/k\"l", 0, "6");
+    check(rfc_document, "/ ", 0, "7");
+    check(rfc_document, "/m~0n", 0, "8");
+
+    check(doc, "/a/b/1/c", 0, "true");
+    check(doc, "/a/b/2/1", 0, "2");
+    check(doc, "/1", 0, "\"one\"");
+    check(doc, "/*", 0, "\"star\"");
+    check(doc, "/-", 0, "null");
+    check(doc, "/01", 0, "1");
+
+    /* things that aren't there */
+    check(doc, "/x", 0, NULL);
+    check(doc, "/a/b/3", 0, NULL);
+    check(doc, "/a/b/-", 0, NULL);
+    check(doc, "/a/b/01", 0, NULL);
+    check(doc, "/a/b/c", 0, NULL);
+    check(doc, "/a/b/0/x", 0, NULL);
+    check(doc, "/a/b/99999999999999999999999", 0, NULL);
+    check(doc, "/1/x", 0, NULL);
+    check("[]", "/0", 0, NULL);
+    check("5", "/0", 0, NULL);
+    check("5", "", 0, "5");
+}
+
+static void wildcards() {
+    const char *doc = "{\"users\": [{\"id\": 1, \"tags\": [\"a\"]}, {\"name\": \"x\"},"
+                      " {\"id\": 3, \"tags\": [\"b\", \"c\"]}], \"*\": 0}";
+    json_path_t *path;
+    json_t *json, *matches, *expected;
+
+    check(doc, "/users/*/id", JSON_PATH_WILDCARDS, "1");
+    check(doc, "/users/*/tags/1", JSON_PATH_WILDCARDS, "\"c\"");
+    check(doc, "/*/1/name", JSON_PATH_WILDCARDS, "\"x\"");
+    check(doc, "/users/*/none", JSON_PATH_WILDCARDS, NULL);
+    check(doc, "/*", 0, "0");
+
+    json = json_loads(doc, 0, NULL);
+
+    path = json_path_compile("/users/*/tags/*", JSON_PATH_WILDCARDS, NULL);
+    matches = json_path_eval_all(json, path);
+    expected = json_pack("[s, s, s]", "a", "b", "c");
+    if (!json_equal(matches, expected))
+        fail("json_path_eval_all returned the wrong matches");
+    if (json_array_get(matches, 0) !=
+        json_array_get(json_object_get(json_array_get(json_object_get(json, "users"), 0),
+                                       "tags"),
+                       0))
+        fail("json_path_eval_all didn't return the values themselves");
+    json_decref(expected);
+    json_decref(matches);
+    json_path_free(path);
+
+    path = json_path_compile("/users/*/id", JSON_PATH_WILDCARDS, NULL);
+    matches = json_path_eval_all(json, path);
+    expected = json_pack("[i, i]", 1, 3);
+    if (!json_equal(matches, expected))
+        fail("json_path_eval_all returned the wrong matches");
+    json_decref(expected);
+    json_decref(matches);
+    json_path_free(path);
+
+    path = json_path_compile("/nothing/*", JSON_PATH_WILDCARDS, NULL);
+    matches = json_path_eval_all(json, path);
+    if (!json_is_array(matches) || json_array_size(matches) != 0)
+        fail("json_path_eval_all didn't return an empty array");
+    json_decref(matches);
+
+    if (json_path_eval(NULL, path) || json_path_eval_all(NULL, path) ||
+        json_path_eval(json, NULL) || json_path_eval_all(json, NULL))
+        fail("evaluating with NULL arguments succeeded");
+    json_path_free(path);
+
+    json_decref(json);
+}
+
+static void compile_errors() {
+    json_error_t error;
+
+    if (json_path_compile("a/b", 0, &error))
+        fail("json_path_compile accepted a path without a slash");
+    check_error(json_error_invalid_format, "'/' expected", "<path>", 1, 1, 1);
+
+    if (json_path_compile("/a/b~2", 0, &error))
+        fail("json_path_compile accepted an invalid escape");
+    check_error(json_error_invalid_format, "'~' must be followed by 0 or 1", "<path>", 1,
+                5, 5);
+
+    if (json_path_compile("/a~", 0, &error))
+        fail("json_path_compile accepted an incomplete escape");
+    check_error(json_error_invalid_format, "'~' must be followed by 0 or 1", "<path>", 1,
+                3, 3);
+
+    if (json_path_compile(NULL, 0, &error))
+        fail("json_path_compile accepted NULL");
+    check_error(json_error_invalid_argument, "NULL path", "<path>", -1, -1, 0);
+
+    json_path_free(NULL);
+}
+
+static void loading() {
+    const char *text = "{\"skip\": [1, {\"x\": \"]\\\"}\"}, [[]]], \"data\": {\"n\": 1},"
+                       " \"rest\": [";
+    json_path_t *path = json_path_compile("/data/n", 0, NULL);
+    json_error_t error;
+    json_t *value;
+
+    /* reading stops at the value, so garbage after it doesn't matter */
+    value = json_path_loadb(text, strlen(text), 0, path, &error);
+    if (!json_is_integer(value) || json_integer_value(value) != 1)
+        fail("json_path_loadb returned the wrong value");
+    if (error.position != 50)
+        fail("json_path_loadb set the wrong position");
+    json_decref(value);
+
+    /* errors before the value are reported */
+    text = "{\"skip\": [1, 2}, \"data\": {\"n\": 1}}";
+    if (json_path_loadb(text, strlen(text), 0, path, &error))
+        fail("json_path_loadb accepted mismatched brackets");
+    check_error(json_error_invalid_syntax, "']' expected near '}'", "<buffer>", 1, 15,
+                15);
+
+    text = "{\"skip\": tru, \"data\": {\"n\": 1}}";
+    if (json_path_loadb(text, strlen(text), 0, path, &error))
+        fail("json_path_loadb accepted an invalid token");
+    check_error(json_error_invalid_syntax, "invalid token near 'tru'", "<buffer>", 1, 12,
+                12);
+
+    text = "{\"data\" {\"n\": 1}}";
+    if (json_path_loadb(text, strlen(text), 0, path, &error))
+        fail("json_path_loadb accepted a missing colon");
+    check_error(json_error_invalid_syntax, "':' expected near '{'", "<buffer>", 1, 9, 9);
+
+    text = "{\"data\": {\"m\": 1}}";
+    if (json_path_loadb(text, strlen(text), 0, path, &error))
+        fail("json_path_loadb found a value that isn't there");
+    check_error(json_error_item_not_found, "'/data/n' not found", "<buffer>", -1, -1, 0);
+
+    text = "[1]";
+    if (json_path_loadb(text, strlen(text), 0, path, &error))
+        fail("json_path_loadb found a value that isn't there");
+    check_error(json_error_item_not_found, "'/data/n' not found", "<buffer>", -1, -1, 0);
+
+    text = "\"data\"";
+    if (json_path_loadb(text, strlen(text), 0, path, &error))
+        fail("json_path_loadb accepted a string without JSON_DECODE_ANY");
+    check_error(json_error_invalid_syntax, "'[' or '{' expected near '\"data\"'",
+                "<buffer>", 1, 6, 6);
+
+    /* the depth limit applies to the path and to the skipped values */
+    text = "{\"data\": {\"n\": [[1]]}}";
+    if (json_path_loadb(text, strlen(text), JSON_PARSER_DEPTH(3), path, &error))
+        fail("json_path_loadb exceeded the depth limit");
+    check_error(json_error_stack_overflow, "maximum parsing depth reached near '['",
+                "<buffer>", 1, 17, 17);
+
+    text = "{\"skip\": [[[]]], \"data\": {\"n\": 1}}";
+    if (json_path_loadb(text, strlen(text), JSON_PARSER_DEPTH(3), path, &error))
+        fail("json_path_loadb exceeded the depth limit");
+    check_error(json_error_stack_overflow, "maximum parsing depth reached near '['",
+                "<buffer>", 1, 12, 12);
+
+    if (json_path_loadb(NULL, 0, 0, path, &error))
+        fail("json_path_loadb accepted a NULL buffer");
+    check_error(json_error_invalid_argument, "wrong arguments", "<buffer>", -1, -1, 0);
+
+    if (json_path_loadb("{}", 2, 0, NULL, &error))
+        fail("json_path_loadb accepted a NULL path");
+    check_error(json_error_invalid_argument, "wrong arguments", "<buffer>", -1, -1, 0);
+
+    json_path_free(path);
+}
+
+static void run_tests() {
+    pointers();
+    wildcards();
+    compile_errors();
+    loading();
+}
@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <string.h>
+
+static const char text[] = "{\"name\": \"sax\", \"list\": [1, -2.5, \"three\", null,"
+                           " true, false], \"nested\": {\"a\": {\"b\": [[], {}]}}}";
+
+/* Rebuilds the tree from events */
+struct builder {
+    json_t *stack[16];
+    char keys[16][32];
+    int depth;
+    json_t *result;
+    int events;
+    int stop_at;
+};
+
+static int add(struct builder *b, json_t *value) {
+    b->events++;
+    if (b->stop_at && b->events == b->stop_at) {
+        json_decref(value);
+        return -1;
+    }
+
+    if (!b->depth) {
+        b->result = value;
+        return 0;
+    }
+    if (json_is_object(b->stack[b->depth - 1]))
+        return json_object_set_new(b->stack[b->depth - 1], b->keys[b->depth - 1], value);
+    return json_array_append_new(b->stack[b->depth - 1], value);
+}
+
+static int start(struct builder *b, json_t *container) {
+    if (add(b, container))
+        return -1;
+    b->stack[b->depth++] = container;
+    return 0;
+}
+
+static int on_start_object(void *data) { return start(data, json_object()); }
+static int on_start_array(void *data) { return start(data, json_array()); }
+
+static int on_end(void *data) {
+    struct builder *b = data;
+    b->depth--;
+    return 0;
+}
+
+static int on_key(void *data, const char *key, size_t len) {
+    struct builder *b = data;
+    if (len != strlen(key) || len >= sizeof(b->keys[0]))
+        fail("a key callback got a wrong length");
+    strcpy(b->keys[b->depth - 1], key);
+    return 0;
+}
+
+static int on_string(void *data, const char *value, size_t len) {
+    return add(data, json_stringn(value, len));
+}
+
+static int on_integer(void *data, json_int_t value) {
+    return add(data, json_integer(value));
+}
+
+static int on_real(void *data, double value) { return add(data, json_real(value)); }
+
+static int on_boolean(void *data, int value) { return add(data, json_boolean(value)); }
+
+static int on_null(void *data) { return add(data, json_null()); }
+
+static const json_sax_callbacks_t callbacks = {
+    on_start_object, on_end,     on_key,  on_start_array, on_end,
+    on_string,       on_integer, on_real, on_boolean,     on_null};
+
+static void builder_init(struct builder *b) {
+    memset(b, 0, sizeof(*b));
+}
+
+static void builds_same_tree() {
+    const char *texts[] = {text, "[]", "{}", "[\"\\u00e4\\n\", 123456789012, 1e300]"};
+    struct builder b;
+    json_error_t error;
+    json_t *expected;
+    size_t i;
+
+    for (i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+        builder_init(&b);
+        expected = json_loads(texts[i], 0, NULL);
+        if (json_sax_loadb(texts[i], strlen(texts[i]), 0, &callbacks, &b, &error))
+            fail("json_sax_loadb failed");
+        if (!json_equal(b.result, expected))
+            fail("json_sax_loadb produced wrong events");
+        if (error.position != (int)strlen(texts[i]))
+            fail("json_sax_loadb returned a wrong position");
+        json_decref(b.result);
+        json_decref(expected);
+    }
+
+    /* top level scalars */
+    builder_init(&b);
+    if (json_sax_loadb("\"x\"", 3, JSON_DECODE_ANY, &callbacks, &b, NULL) ||
+        strcmp(json_string_value(b.result), "x"))
+        fail("json_sax_loadb failed with JSON_DECODE_ANY");
+    json_decref(b.result);
+}
+
+static void same_errors_as_loadb() {
+    const char *invalid[] = {"[1, 2",
+                             "{\"a\" 1}",
+                             "[1 2]",
+                             "{\"a\": }",
+                             "[\"a\\q\"]",
+                             "[1] x",
+                             "42",
+                             "[\"\\u0000\"]",
+                             "{\"a\\u0000\": 1}",
+                             "{\"a\": 1, \"a\": 2}",
+                             "[\xff]"};
+    json_error_t error, expected;
+    struct builder b;
+    size_t i;
+
+    for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        builder_init(&b);
+        if (json_loadb(invalid[i], strlen(invalid[i]), JSON_REJECT_DUPLICATES, &expected))
+            fail("json_loadb succeeded on invalid input");
+        if (!json_sax_loadb(invalid[i], strlen(invalid[i]), JSON_REJECT_DUPLICATES,
+                            &callbacks, &b, &error))
+            fail("json_sax_loadb succeeded on invalid input");
+        if (strcmp(error.text, expected.text) || error.position != expected.position ||
+            json_error_code(&error) != json_error_code(&expected)) {
+            fprintf(stderr, "%s: \"%s\" != \"%s\"\n", invalid[i], error.text,
+                    expected.text);
+            fail("json_sax_loadb returned a different error than json_loadb");
+        }
+        json_decref(b.result);
+    }
+}
+
+static void stop_from_callback() {
+    struct builder b;
+    json_error_t error;
+
+    builder_init(&b);
+    b.stop_at = 3; /* "list": [ */
+    if (!json_sax_loadb(text, strlen(text), 0, &callbacks, &b, &error))
+        fail("json_sax_loadb did not stop when a callback failed");
+    check_error(json_error_unknown, "stopped by callback near '['", "<buffer>", 1, 25,
+                25);
+    json_decref(b.result);
+}
+
+static int count_integers(void *data, json_int_t value) {
+    (void)value;
+    (*(int *)data)++;
+    return 0;
+}
+
+static void missing_callbacks() {
+    json_sax_callbacks_t only_integers;
+    int count = 0;
+
+    memset(&only_integers, 0, sizeof(only_integers));
+    only_integers.integer = count_integers;
+    if (json_sax_loadb("[1, {\"a\": [2, \"x\", 3.5]}, 4]", 28, 0, &only_integers, &count,
+                       NULL) ||
+        count != 3)
+        fail("json_sax_loadb failed with missing callbacks");
+}
+
+static void sources() {
+    struct builder b;
+    json_error_t error;
+    json_parser_t *parser;
+    json_t *expected = json_loads(text, 0, NULL);
+    size_t i;
+    FILE *fp;
+
+    /* a file */
+    fp = tmpfile();
+    if (!fp)
+        fail("tmpfile failed");
+    fputs(text, fp);
+    fputs(" [1]", fp);
+    rewind(fp);
+
+    builder_init(&b);
+    if (json_sax_loadf(fp, JSON_DISABLE_EOF_CHECK, &callbacks, &b, &error) ||
+        !json_equal(b.result, expected))
+        fail("json_sax_loadf failed");
+    if (ftell(fp) != (long)strlen(text))
+        fail("json_sax_loadf did not give back the rest of the stream");
+    json_decref(b.result);
+    fclose(fp);
+
+    /* fed byte by byte */
+    builder_init(&b);
+    parser = json_parser_new_sax(0, &callbacks, &b);
+    for (i = 0; i < strlen(text); i++)
+        if (json_parser_feed(parser, text + i, 1) == JSON_PARSER_ERROR)
+            fail("json_parser_feed failed with callbacks");
+    if (json_parser_finish(parser) != JSON_PARSER_DONE)
+        fail("json_parser_finish failed with callbacks");
+    if (json_parser_result(parser, NULL))
+        fail("json_parser_result returned a value with callbacks");
+    if (!json_equal(b.result, expected))
+        fail("json_parser_feed produced wrong events");
+    json_decref(b.result);
+    json_parser_free(parser);
+
+    /* releasing in the middle of a document */
+    builder_init(&b);
+    parser = json_parser_new_sax(JSON_REJECT_DUPLICATES, &callbacks, &b);
+    json_parser_feed(parser, text, 30);
+    json_parser_free(parser);
+    json_decref(b.result);
+
+    json_decref(expected);
+}
+
+static void wrong_arguments() {
+    json_error_t error;
+
+    if (!json_sax_loadb(text, strlen(text), 0, NULL, NULL, &error))
+        fail("json_sax_loadb succeeded without callbacks");
+    check_error(json_error_invalid_argument, "wrong arguments", "<buffer>", -1, -1, 0);
+
+    if (!json_sax_loadb(NULL, 0, 0, &callbacks, NULL, &error))
+        fail("json_sax_loadb succeeded without a buffer");
+    check_error(json_error_invalid_argument, "wrong arguments", "<buffer>", -1, -1, 0);
+
+    if (!json_sax_loadf(NULL, 0, &callbacks, NULL, &error))
+        fail("json_sax_loadf succeeded without a stream");
+    check_error(json_error_invalid_argument, "wrong arguments", "<stream>", -1, -1, 0);
+
+    if (!json_sax_load_callback(NULL, NULL, 0, &callbacks, NULL, &error))
+        fail("json_sax_load_callback succeeded without a callback");
+    check_error(json_error_invalid_argument, "wrong arguments", "<callback>", -1, -1, 0);
+
+    if (!json_sax_load_file("/path/to/nonexistent/file.json", 0, &callbacks, NULL,
+                            &error))
+        fail("json_sax_load_file succeeded on a nonexistent file");
+    if (json_error_code(&error) != json_error_cannot_open_file)
+        fail("json_sax_load_file returned a wrong error");
+
+    if (json_parser_new_sax(0, NULL, NULL))
+        fail("json_parser_new_sax succeeded without callbacks");
+}
+
+static void run_tests() {
+    builds_same_tree();
+    same_errors_as_loadb();
+    stop_from_callback();
+    missing_callbacks();
+    sources();
+    wrong_arguments();
+}
@@ -58,7 +58,98 @@ static void test_bad_args(void) {
     json_decref(txt);
 }
 
-/* Call the simple functions not covered by other tests of the public API */
+/* Put offset bytes of valid text at the start of buffer, using ASCII
+   only or mostly two-byte sequences */
+static size_t utf8_prefix(char *buffer, size_t offset, int ascii) {
+    size_t len = 0;
+
+    while (!ascii && len + 2 <= offset) {
+        memcpy(buffer + len, "\xc3\xa4", 2);
+        len += 2;
+    }
+    while (len < offset)
+        buffer[len++] = 'a';
+
+    buffer[len] = '\0';
+    return len;
+}
+
+static void test_utf8_validation(void) {
+    /* Sequences at every offset of strings long enough to be validated
+       in blocks, with ASCII and non-ASCII text around them */
+    const char *valid[] = {"\xc3\xa4", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xef\xbf\xbf",
+                           "\xf4\x8f\xbf\xbf"};
+    const char *invalid[] = {"\x80",         "\xc0\x80",         "\xc3",
+                             "\xe0\x80\x80", "\xed\xa0\x80",     "\xe2\x82",
+                             "\xf0\x80\x80\x80", "\xf4\x90\x80\x80", "\xf5\x80\x80\x80"};
+    char buffer[160];
+    size_t i, j, len;
+    int ascii;
+    json_t *value;
+
+    for (ascii = 0; ascii <= 1; ascii++) {
+        for (j = 0; j < 70; j++) {
+            for (i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+                len = utf8_prefix(buffer, j, ascii);
+                strcpy(buffer + len, valid[i]);
+                utf8_prefix(buffer + strlen(buffer), 40, ascii);
+
+                value = json_string(buffer);
+                if (!value)
+                    fail("json_string failed for valid UTF-8");
+                json_decref(value);
+            }
+
+            for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+                len = utf8_prefix(buffer, j, ascii);
+                strcpy(buffer + len, invalid[i]);
+
+                value = json_string(buffer);
+                if (value)
+                    fail("json_string accepted a truncated or invalid UTF-8 sequence");
+
+                utf8_prefix(buffer + strlen(buffer), 40, ascii);
+                value = json_string(buffer);
+                if (value)
+                    fail("json_string accepted invalid UTF-8");
+            }
+        }
+    }
+}
+
+/* Short and long values are stored differently */
+static void test_string_storage(void) {
+    const char *long_value = "a value that is too long to be stored inline";
+    json_t *value, *copy;
+
+    value = json_string("short");
+    if (json_string_setn(value, json_string_value(value) + 1, 3) ||
+        strcmp(json_string_value(value), "hor"))
+        fail("json_string_setn failed with a part of the old value");
+    if (json_string_set(value, long_value) ||
+        json_string_length(value) != strlen(long_value))
+        fail("json_string_set failed with a long value");
+    if (json_string_setn(value, json_string_value(value) + 2, 5) ||
+        strcmp(json_string_value(value), "value"))
+        fail("json_string_setn failed with a part of a long value");
+
+    copy = json_copy(value);
+    if (!json_equal(copy, value) || json_string_value(copy) == json_string_value(value))
+        fail("json_copy failed");
+    json_decref(copy);
+    json_decref(value);
+
+    value = json_stringn("", 0);
+    if (!value || json_string_length(value) != 0 || *json_string_value(value))
+        fail("json_stringn failed with an empty value");
+    json_decref(value);
+
+    value = json_sprintf("%s-%d", "id", 42);
+    if (!value || strcmp(json_string_value(value), "id-42"))
+        fail("json_sprintf failed with a short value");
+    json_decref(value);
+}
+
 static void run_tests() {
     json_t *value;
 
@@ -284,4 +375,6 @@ static void run_tests() {
 #endif
 
     test_bad_args();
+    test_utf8_validation();
+    test_string_storage();
 }
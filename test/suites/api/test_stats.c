@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <string.h>
+
+static json_stats_t before, after;
+
+static void disabled() {
+    json_stats_t stats;
+
+    memset(&stats, 0xff, sizeof(stats));
+    if (json_get_stats(&stats) != -1)
+        fail("json_get_stats succeeded without statistics");
+    if (stats.allocs[json_stats_nodes] || stats.parse_calls || stats.dump_bytes)
+        fail("json_get_stats didn't clear the statistics");
+}
+
+#define delta(field) (after.field - before.field)
+
+static void loading_and_dumping() {
+    /* two objects, an array, an integer, a real and a string */
+    const char *text = "{\"a\": [1, 2.5, \"three\", null], \"b\": {\"c\": true}}";
+    json_t *json;
+    char *dumped;
+    size_t size;
+
+    json_get_stats(&before);
+    json = json_loads(text, 0, NULL);
+    json_get_stats(&after);
+
+    if (delta(parse_calls) != 1 || delta(parse_bytes) != strlen(text))
+        fail("parsing wasn't counted");
+    if (after.parse_seconds < before.parse_seconds)
+        fail("parsing time went backwards");
+    if (delta(allocs[json_stats_nodes]) != 6 || delta(alloc_bytes[json_stats_nodes]) == 0)
+        fail("values weren't counted as nodes");
+    if (delta(allocs[json_stats_strings]) < 1)
+        fail("the string value wasn't counted");
+    if (delta(allocs[json_stats_pairs]) != 3)
+        fail("the members of objects weren't counted as pairs");
+    if (delta(allocs[json_stats_buckets]) < 2)
+        fail("the hash tables weren't counted as buckets");
+    if (delta(allocs[json_stats_arrays]) < 1)
+        fail("the table of the array wasn't counted");
+    if (delta(allocs[json_stats_buffers]) < 1)
+        fail("the buffers of the decoder weren't counted");
+
+    json_get_stats(&before);
+    dumped = json_dumps(json, JSON_COMPACT);
+    json_get_stats(&after);
+
+    if (delta(dump_calls) != 1 || delta(dump_bytes) != strlen(dumped))
+        fail("dumping wasn't counted");
+    if (delta(parse_calls) || delta(allocs[json_stats_nodes]))
+        fail("dumping was counted as something else");
+    free(dumped);
+
+    json_get_stats(&before);
+    size = json_dump_size(json, 0);
+    json_get_stats(&after);
+    if (delta(dump_calls) != 1 || delta(dump_bytes) != size)
+        fail("measuring wasn't counted");
+
+    json_get_stats(&before);
+    json_decref(json);
+    json_get_stats(&after);
+    if (delta(frees) < 10)
+        fail("frees weren't counted");
+}
+
+static void growing() {
+    json_t *array = json_array(), *object = json_object();
+    char key[16];
+    int i;
+
+    json_get_stats(&before);
+    for (i = 0; i < 1000; i++) {
+        json_array_append_new(array, json_integer(i));
+        sprintf(key, "%d", i);
+        json_object_set_new(object, key, json_null());
+    }
+    json_get_stats(&after);
+
+    /* growing by doubling */
+    if (delta(array_grows) < 5 || delta(array_grows) > 20)
+        fail("array regrowths weren't counted");
+    if (delta(rehashes) < 5 || delta(rehashes) > 20)
+        fail("rehashes weren't counted");
+
+    json_get_stats(&before);
+    json_array_append_new(array, json_integer(i));
+    json_get_stats(&after);
+    if (delta(array_grows) > 1)
+        fail("an append was counted as several regrowths");
+
+    json_decref(array);
+    json_decref(object);
+}
+
+static void threads() {
+    json_t *json = json_array(), *loaded;
+    char *text;
+    int i;
+
+    for (i = 0; i < 20000; i++)
+        json_array_append_new(json, json_pack("{s:i, s:[i, i]}", "id", i, "v", i, -i));
+    text = json_dumps(json, 0);
+
+    /* the counters of the threads that did the work are included */
+    json_get_stats(&before);
+    loaded = json_loadb_parallel(text, strlen(text), 0, 4, NULL);
+    json_get_stats(&after);
+
+    if (!json_equal(json, loaded))
+        fail("json_loadb_parallel failed");
+    if (delta(allocs[json_stats_nodes]) < 20000 * 4)
+        fail("the allocations of other threads weren't counted");
+    if (delta(parse_bytes) < strlen(text) / 2)
+        fail("the parsing of other threads wasn't counted");
+
+    free(text);
+    json_decref(loaded);
+    json_decref(json);
+}
+
+static void run_tests() {
+    if (json_get_stats(&before)) {
+        disabled();
+        return;
+    }
+
+    if (json_get_stats(NULL) != -1)
+        fail("json_get_stats accepted NULL");
+
+    loading_and_dumping();
+    growing();
+    threads();
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <string.h>
+
+static const char text[] =
+    "{\"name\": \"tape\", \"port\": 8080, \"ratio\": 0.25, \"on\": true, \"off\": false,"
+    " \"none\": null, \"routes\": [{\"path\": \"/a\", \"to\": [1, 2]}, {}, [], \"x\"],"
+    " \"nested\": {\"a\": {\"b\": {\"c\": -9223372036854775807}}}, \"\\u00e4\": \"\"}";
+
+static void load_tape() {
+    json_tape_t *tape;
+    json_t *json, *expected;
+    json_error_t error;
+    json_cursor_t root, routes;
+
+    tape = json_tape_loadb(text, strlen(text), 0, &error);
+    if (!tape)
+        fail("json_tape_loadb failed");
+    if ((size_t)error.position != strlen(text))
+        fail("json_tape_loadb returned a wrong position");
+
+    expected = json_loadb(text, strlen(text), 0, NULL);
+    root = json_tape_root(tape);
+    json = json_tape_to_value(root);
+    if (!json || !json_equal(json, expected))
+        fail("json_tape_to_value returned a different value than json_loadb");
+    json_decref(json);
+
+    /* any part can be converted */
+    routes = json_cursor_get(root, "routes");
+    json = json_tape_to_value(routes);
+    if (!json_equal(json, json_object_get(expected, "routes")))
+        fail("json_tape_to_value failed on a nested value");
+    json_decref(json);
+
+    json = json_tape_to_value(json_cursor_get(root, "name"));
+    if (!json_equal(json, json_object_get(expected, "name")))
+        fail("json_tape_to_value failed on a string");
+    json_decref(json);
+
+    json_decref(expected);
+    json_tape_free(tape);
+}
+
+static void walk_tape() {
+    json_tape_t *tape = json_tape_loadb(text, strlen(text), 0, NULL);
+    json_cursor_t root, routes, cursor, nested;
+    size_t count;
+
+    root = json_tape_root(tape);
+    if (json_cursor_type(root) != JSON_OBJECT || json_cursor_size(root) != 9)
+        fail("the root of a tape is wrong");
+    if (json_cursor_valid(json_cursor_next(root)))
+        fail("the root of a tape has a sibling");
+
+    if (strcmp(json_cursor_string_value(json_cursor_get(root, "name")), "tape") ||
+        json_cursor_string_length(json_cursor_get(root, "name")) != 4)
+        fail("json_cursor_get returned a wrong string");
+    if (json_cursor_integer_value(json_cursor_get(root, "port")) != 8080 ||
+        json_cursor_number_value(json_cursor_get(root, "port")) != 8080.0)
+        fail("json_cursor_get returned a wrong integer");
+    if (json_cursor_real_value(json_cursor_get(root, "ratio")) != 0.25 ||
+        json_cursor_number_value(json_cursor_get(root, "ratio")) != 0.25)
+        fail("json_cursor_get returned a wrong real");
+    if (json_cursor_type(json_cursor_get(root, "on")) != JSON_TRUE ||
+        json_cursor_type(json_cursor_get(root, "off")) != JSON_FALSE ||
+        json_cursor_type(json_cursor_get(root, "none")) != JSON_NULL)
+        fail("json_cursor_get returned a wrong constant");
+    if (strcmp(json_cursor_string_value(json_cursor_get(root, "\xc3\xa4")), ""))
+        fail("json_cursor_get returned a wrong empty string");
+    if (json_cursor_valid(json_cursor_get(root, "missing")) ||
+        json_cursor_valid(json_cursor_getn(root, "name", 3)))
+        fail("json_cursor_get found a missing key");
+
+    nested = json_cursor_get(json_cursor_get(root, "nested"), "a");
+    nested = json_cursor_get(json_cursor_get(nested, "b"), "c");
+    if (json_cursor_integer_value(nested) != -9223372036854775807LL)
+        fail("json_cursor_get returned a wrong nested value");
+
+    /* members are in document order */
+    cursor = json_cursor_first(root);
+    if (strcmp(json_cursor_key(cursor), "name") || json_cursor_key_len(cursor) != 4)
+        fail("json_cursor_first returned a wrong member");
+    cursor = json_cursor_next(json_cursor_next(cursor));
+    if (strcmp(json_cursor_key(cursor), "ratio"))
+        fail("json_cursor_next returned a wrong member");
+
+    count = 0;
+    json_cursor_foreach(root, cursor) {
+        if (!json_cursor_key(cursor))
+            fail("json_cursor_foreach returned a member without a key");
+        count++;
+    }
+    if (count != 9)
+        fail("json_cursor_foreach returned a wrong number of members");
+
+    routes = json_cursor_get(root, "routes");
+    if (json_cursor_type(routes) != JSON_ARRAY || json_cursor_size(routes) != 4)
+        fail("json_cursor_get returned a wrong array");
+    if (json_cursor_key(json_cursor_at(routes, 0)))
+        fail("an array element has a key");
+    cursor = json_cursor_at(routes, 0);
+    if (strcmp(json_cursor_string_value(json_cursor_get(cursor, "path")), "/a") ||
+        json_cursor_integer_value(json_cursor_at(json_cursor_get(cursor, "to"), 1)) != 2)
+        fail("json_cursor_at returned a wrong element");
+    if (json_cursor_size(json_cursor_at(routes, 1)) != 0 ||
+        json_cursor_valid(json_cursor_first(json_cursor_at(routes, 1))) ||
+        json_cursor_valid(json_cursor_first(json_cursor_at(routes, 2))))
+        fail("an empty container has members");
+    if (strcmp(json_cursor_string_value(json_cursor_at(routes, 3)), "x") ||
+        json_cursor_valid(json_cursor_next(json_cursor_at(routes, 3))) ||
+        json_cursor_valid(json_cursor_at(routes, 4)))
+        fail("json_cursor_at returned a wrong last element");
+
+    /* cursors of the wrong type */
+    if (json_cursor_valid(json_cursor_get(routes, "path")) ||
+        json_cursor_valid(json_cursor_at(root, 0)) ||
+        json_cursor_valid(json_cursor_first(json_cursor_get(root, "name"))) ||
+        json_cursor_string_value(json_cursor_get(root, "port")) ||
+        json_cursor_integer_value(json_cursor_get(root, "name")) ||
+        json_cursor_real_value(json_cursor_get(root, "port")) != 0.0)
+        fail("a cursor of the wrong type was accepted");
+
+    /* invalid cursors */
+    cursor = json_cursor_get(root, "missing");
+    if (json_cursor_type(cursor) != -1 || json_cursor_size(cursor) ||
+        json_cursor_valid(json_cursor_next(cursor)) ||
+        json_cursor_valid(json_cursor_first(cursor)) || json_cursor_key(cursor) ||
+        json_cursor_key_len(cursor) || json_cursor_string_value(cursor) ||
+        json_tape_to_value(cursor))
+        fail("an invalid cursor was accepted");
+    if (json_cursor_valid(json_tape_root(NULL)))
+        fail("json_tape_root returned a valid cursor without a tape");
+
+    json_tape_free(tape);
+    json_tape_free(NULL);
+}
+
+static void decoding_flags() {
+    json_tape_t *tape;
+    json_cursor_t root;
+    json_t *json;
+
+    /* the last one of duplicate keys wins, like with json_loads() */
+    tape = json_tape_loadb("{\"a\": 1, \"b\": 2, \"a\": 3}", 24, 0, NULL);
+    root = json_tape_root(tape);
+    if (json_cursor_integer_value(json_cursor_get(root, "a")) != 3 ||
+        json_cursor_size(root) != 3)
+        fail("json_cursor_get returned a wrong duplicate");
+    json = json_tape_to_value(root);
+    if (json_integer_value(json_object_get(json, "a")) != 3 ||
+        json_object_size(json) != 2)
+        fail("json_tape_to_value returned wrong duplicates");
+    json_decref(json);
+    json_tape_free(tape);
+
+    tape = json_tape_loadb("\"a\\u0000b\"", 10, JSON_DECODE_ANY | JSON_ALLOW_NUL, NULL);
+    root = json_tape_root(tape);
+    if (json_cursor_string_length(root) != 3 ||
+        memcmp(json_cursor_string_value(root), "a\0b", 4))
+        fail("json_tape_loadb returned a wrong string with a NUL byte");
+    json_tape_free(tape);
+
+    tape = json_tape_loadb("[1] [2]", 7, JSON_DISABLE_EOF_CHECK | JSON_DECODE_INT_AS_REAL,
+                           NULL);
+    root = json_tape_root(tape);
+    if (json_cursor_size(root) != 1 ||
+        json_cursor_real_value(json_cursor_at(root, 0)) != 1.0)
+        fail("json_tape_loadb ignored flags");
+    json_tape_free(tape);
+}
+
+static void compare_errors(const char *input, size_t flags) {
+    json_error_t expected, error;
+
+    if (json_loadb(input, strlen(input), flags, &expected))
+        fail("json_loadb succeeded on invalid input");
+    if (json_tape_loadb(input, strlen(input), flags, &error))
+        fail("json_tape_loadb succeeded on invalid input");
+
+    if (strcmp(error.text, expected.text) || strcmp(error.source, expected.source) ||
+        error.line != expected.line || error.column != expected.column ||
+        error.position != expected.position ||
+        json_error_code(&error) != json_error_code(&expected)) {
+        failhdr;
+        fprintf(stderr, "%s: got %d:%d:%d %s, expected %d:%d:%d %s\n", input, error.line,
+                error.column, error.position, error.text, expected.line, expected.column,
+                expected.position, expected.text);
+        exit(1);
+    }
+}
+
+static void tape_errors() {
+    json_error_t error;
+    char deep[2 * 3000 + 1];
+    int i;
+
+    compare_errors("", 0);
+    compare_errors("1", 0);
+    compare_errors("[1, 2", 0);
+    compare_errors("[1,]", 0);
+    compare_errors("{\"a\" 1}", 0);
+    compare_errors("{\"a\": 1,}", 0);
+    compare_errors("{1: 2}", 0);
+    compare_errors("{\"a\": 1 \"b\": 2}", 0);
+    compare_errors("{\"a\\u0000\": 1}", 0);
+    compare_errors("[\"a\\u0000\"]", 0);
+    compare_errors("{\"a\": 1, \"b\": {\"a\": 2}, \"a\": 3}", JSON_REJECT_DUPLICATES);
+    compare_errors("[1] x", 0);
+    compare_errors("[\n  {\"a\": [tru]}]", 0);
+
+    for (i = 0; i < 3000; i++) {
+        deep[i] = '[';
+        deep[2 * 3000 - 1 - i] = ']';
+    }
+    deep[2 * 3000] = '\0';
+    compare_errors(deep, 0);
+
+    if (json_tape_loadb(NULL, 0, 0, &error))
+        fail("json_tape_loadb succeeded without a buffer");
+    check_error(json_error_invalid_argument, "wrong arguments", "<buffer>", -1, -1, 0);
+}
+
+static void run_tests() {
+    load_tape();
+    walk_tape();
+    decoding_flags();
+    tape_errors();
+}
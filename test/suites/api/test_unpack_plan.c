@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdarg.h>
+#include <string.h>
+
+/* Unpack with json_vunpack_ex() and a compiled plan, and check that
+   the results are the same */
+static void compare(const char *text, size_t flags, const char *fmt, ...) {
+    json_error_t expected, error;
+    json_unpack_plan_t *plan;
+    json_t *root;
+    va_list ap;
+    int ret1, ret2;
+
+    root = json_loads(text, JSON_DECODE_ANY, NULL);
+    if (!root)
+        fail("json_loads failed");
+
+    plan = json_unpack_compile(fmt, &error);
+    if (!plan)
+        fail("json_unpack_compile failed");
+
+    va_start(ap, fmt);
+    ret1 = json_vunpack_ex(root, &expected, flags, fmt, ap);
+    va_end(ap);
+
+    va_start(ap, fmt);
+    ret2 = json_vunpack_plan_ex(root, &error, flags, plan, ap);
+    va_end(ap);
+
+    if (ret1 != ret2 ||
+        (ret1 && (strcmp(error.text, expected.text) ||
+                  strcmp(error.source, expected.source) ||
+                  error.line != expected.line || error.column != expected.column ||
+                  error.position != expected.position ||
+                  json_error_code(&error) != json_error_code(&expected)))) {
+        failhdr;
+        fprintf(stderr, "%s with %s: got %d %d:%d:%d %s %s, expected %d %d:%d:%d %s %s\n",
+                fmt, text, ret2, error.line, error.column, error.position, error.source,
+                error.text, ret1, expected.line, expected.column, expected.position,
+                expected.source, expected.text);
+        exit(1);
+    }
+
+    json_unpack_plan_free(plan);
+    json_decref(root);
+}
+
+static void unpack_values() {
+    json_unpack_plan_t *plan;
+    json_t *root, *object = NULL;
+    const char *name = NULL;
+    size_t length = 0;
+    int port = 0, on = 0, count = 5;
+    json_int_t big = 0;
+    double ratio = 0, number = 0;
+
+    plan = json_unpack_compile("{s:s%, s?i, s:{s:f, s:F}, s:b, s:[I, o], s?n, s?i}",
+                               NULL);
+    if (!plan)
+        fail("json_unpack_compile failed");
+
+    root = json_loads("{\"name\": \"a\\u0000b\", \"port\": 80, \"ratio\": {\"x\": 0.5,"
+                      " \"y\": 2}, \"on\": true, \"list\": [12345678901, {}],"
+                      " \"none\": null}",
+                      JSON_ALLOW_NUL, NULL);
+    if (json_unpack_plan(root, plan, "name", &name, &length, "port", &port, "ratio", "x",
+                         &ratio, "y", &number, "on", &on, "list", &big, &object, "none",
+                         "count", &count))
+        fail("json_unpack_plan failed");
+    if (memcmp(name, "a\0b", 4) || length != 3 || port != 80 || ratio != 0.5 ||
+        number != 2.0 || !on || big != 12345678901LL || !json_is_object(object) ||
+        count != 5)
+        fail("json_unpack_plan returned wrong values");
+
+    /* the same plan works for another value */
+    json_decref(root);
+    root = json_loads("{\"name\": \"b\", \"ratio\": {\"x\": 1.5, \"y\": 3.5},"
+                      " \"on\": false, \"list\": [1, []], \"count\": 9}",
+                      0, NULL);
+    port = -1;
+    if (json_unpack_plan(root, plan, "name", &name, &length, "port", &port, "ratio", "x",
+                         &ratio, "y", &number, "on", &on, "list", &big, &object, "none",
+                         "count", &count))
+        fail("json_unpack_plan failed");
+    if (strcmp(name, "b") || port != -1 || ratio != 1.5 || number != 3.5 || on ||
+        big != 1 || !json_is_array(object) || count != 9)
+        fail("json_unpack_plan returned wrong values");
+
+    /* 'O' takes a reference */
+    json_unpack_plan_free(plan);
+    plan = json_unpack_compile("[O]", NULL);
+    json_decref(root);
+    root = json_pack("[{}]");
+    if (json_unpack_plan(root, plan, &object) || object->refcount != 2)
+        fail("json_unpack_plan didn't take a reference with 'O'");
+    json_decref(object);
+    json_decref(root);
+    json_unpack_plan_free(plan);
+    json_unpack_plan_free(NULL);
+}
+
+static void same_as_unpack() {
+    const char *str;
+    size_t len;
+    int i1, i2;
+    double f;
+    json_t *j;
+
+    compare("{\"a\": 1, \"b\": \"x\"}", 0, "{s:i, s:s}", "a", &i1, "b", &str);
+    compare("{\"a\": 1, \"b\": \"x\"}", 0, "{s:i, s:i}", "a", &i1, "b", &i2);
+    compare("{\"a\": 1}", 0, "{s:i, s:i}", "a", &i1, "b", &i2);
+    compare("{\"a\": 1}", 0, "{s:i, s?i}", "a", &i1, "b", &i2);
+    compare("{\"a\": 1}", 0, "{s:i, s:i}", "a", &i1, NULL, &i2);
+    compare("[1, 2]", 0, "{s:i}", "a", &i1);
+    compare("{}", 0, "[i]", &i1);
+    compare("[1]", 0, "[i, i]", &i1, &i2);
+    compare("[1, 2]", 0, "[i]", &i1);
+    compare("[1, 2]", 0, "[i!]", &i1);
+    compare("[1, 2]", JSON_STRICT, "[i]", &i1);
+    compare("[1, 2]", JSON_STRICT, "[i*]", &i1);
+    compare("[1, [2]]", 0, "[i, [s]]", &i1, &str);
+    compare("{\"a\": 1, \"b\": 2}", 0, "{s:i!}", "a", &i1);
+    compare("{\"a\": 1, \"b\": 2, \"c\": 3}", JSON_STRICT, "{s:i}", "b", &i1);
+    compare("{\"a\": 1, \"b\": 2}", JSON_STRICT, "{s:i, s:i}", "a", &i1, "a", &i2);
+    compare("{\"a\": 1, \"b\": 2}", JSON_STRICT, "{s:i, s:i}", "a", &i1, "b", &i2);
+    compare("{\"a\": 1}", JSON_STRICT, "{s:i, s?i}", "a", &i1, "b", &i2);
+    compare("{\"a\": 1, \"b\": 2}", JSON_STRICT, "{s:i, s?i*}", "a", &i1, "c", &i2);
+    compare("{\"a\": {\"b\": 1, \"c\": 2}}", JSON_STRICT, "{s:{s:i}}", "a", "b", &i1);
+    compare("{}", 0, "{s?{s:i, s:[s, i]}}", "a", "b", &i1, "c", &str, &i2);
+    compare("\"x\"", 0, "i", &i1);
+    compare("1", 0, "s", &str);
+    compare("1", 0, "s", NULL);
+    compare("\"x\"", 0, "s%", &str, NULL);
+    compare("\"x\"", 0, "s%", &str, &len);
+    compare("1", 0, "b", &i1);
+    compare("1", 0, "f", &f);
+    compare("\"x\"", 0, "F", &f);
+    compare("1", 0, "n");
+    compare("null", 0, "o", &j);
+    compare("[1, \"x\", true]", JSON_VALIDATE_ONLY, "[i, s, b]");
+    compare("[1, \"x\", true]", JSON_VALIDATE_ONLY, "[i, i, b]");
+    compare("[1, \"x\", {\"a\": 1}]", JSON_VALIDATE_ONLY, "[i, s, {s:i}]", "a");
+    compare("{\"a\": {\"b\": 1}}", 0, "\n{s:\n  {s: s}}", "a", "b", &str);
+}
+
+static void many_keys() {
+    char keys[20][4];
+    int values[20], i;
+    json_t *root = json_object();
+    json_unpack_plan_t *plan;
+    json_error_t error;
+
+    /* more keys than fit on the stack in strict mode */
+    for (i = 0; i < 20; i++) {
+        sprintf(keys[i], "k%d", i);
+        json_object_set_new(root, keys[i], json_integer(i));
+    }
+    json_object_set_new(root, "extra", json_null());
+
+    plan = json_unpack_compile("{s:i, s:i, s:i, s:i, s:i, s:i, s:i, s:i, s:i, s:i,"
+                               " s:i, s:i, s:i, s:i, s:i, s:i, s:i, s:i, s:i, s:i}",
+                               NULL);
+    if (json_unpack_plan_ex(root, &error, JSON_STRICT, plan, keys[0], &values[0],
+                            keys[1], &values[1], keys[2], &values[2], keys[3],
+                            &values[3], keys[4], &values[4], keys[5], &values[5],
+                            keys[6], &values[6], keys[7], &values[7], keys[8],
+                            &values[8], keys[9], &values[9], keys[10], &values[10],
+                            keys[11], &values[11], keys[12], &values[12], keys[13],
+                            &values[13], keys[14], &values[14], keys[15], &values[15],
+                            keys[16], &values[16], keys[17], &values[17], keys[18],
+                            &values[18], keys[19], &values[19]) == 0)
+        fail("json_unpack_plan_ex accepted an unpacked key");
+    check_error(json_error_end_of_input_expected, "1 object item(s) left unpacked: extra",
+                "<validation>", 1, 100, 100);
+
+    json_object_del(root, "extra");
+    if (json_unpack_plan_ex(root, NULL, JSON_STRICT, plan, keys[0], &values[0], keys[1],
+                            &values[1], keys[2], &values[2], keys[3], &values[3],
+                            keys[4], &values[4], keys[5], &values[5], keys[6],
+                            &values[6], keys[7], &values[7], keys[8], &values[8],
+                            keys[9], &values[9], keys[10], &values[10], keys[11],
+                            &values[11], keys[12], &values[12], keys[13], &values[13],
+                            keys[14], &values[14], keys[15], &values[15], keys[16],
+                            &values[16], keys[17], &values[17], keys[18], &values[18],
+                            keys[19], &values[19]))
+        fail("json_unpack_plan_ex failed");
+    for (i = 0; i < 20; i++) {
+        if (values[i] != i)
+            fail("json_unpack_plan_ex returned a wrong value");
+    }
+
+    json_unpack_plan_free(plan);
+    json_decref(root);
+}
+
+static void format_errors() {
+    json_error_t error;
+    json_t *root = json_object();
+
+    /* format errors are found when compiling */
+    if (json_unpack_compile("{s:i", &error))
+        fail("json_unpack_compile accepted an invalid format");
+    check_error(json_error_invalid_format, "Unexpected end of format string", "<format>",
+                1, 5, 5);
+
+    if (json_unpack_compile("[i] x", &error))
+        fail("json_unpack_compile accepted garbage");
+    check_error(json_error_invalid_format, "Garbage after format string", "<format>", 1,
+                5, 5);
+
+    if (json_unpack_compile("{s:i!s:i}", &error))
+        fail("json_unpack_compile accepted a key after '!'");
+    check_error(json_error_invalid_format, "Expected '}' after '!', got 's'", "<format>",
+                1, 6, 6);
+
+    if (json_unpack_compile("[z]", &error))
+        fail("json_unpack_compile accepted an invalid character");
+    check_error(json_error_invalid_format, "Unexpected format character 'z'", "<format>",
+                1, 2, 2);
+
+    if (json_unpack_compile("", &error))
+        fail("json_unpack_compile accepted an empty format");
+    check_error(json_error_invalid_argument, "NULL or empty format string", "<format>",
+                -1, -1, 0);
+
+    if (json_unpack_plan_ex(root, &error, 0, NULL) == 0)
+        fail("json_unpack_plan_ex succeeded without a plan");
+    check_error(json_error_invalid_argument, "NULL plan", "<format>", -1, -1, 0);
+
+    json_decref(root);
+}
+
+static void run_tests() {
+    unpack_values();
+    same_as_unpack();
+    many_keys();
+    format_errors();
+}
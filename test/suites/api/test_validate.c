@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t mallocs = 0;
+static long live = 0, peak_live = 0; /* blocks allocated and not freed */
+
+static void *counting_malloc(size_t size) {
+    mallocs++;
+    if (++live > peak_live)
+        peak_live = live;
+    return malloc(size);
+}
+
+static void counting_free(void *ptr) {
+    if (ptr)
+        live--;
+    free(ptr);
+}
+
+/* Check that json_validate() agrees with json_loadb() on input, and
+   reports the same error */
+static void check_same(const char *input, size_t len, size_t flags) {
+    json_error_t error, expected;
+    json_t *json = json_loadb(input, len, flags, &expected);
+    int result = json_validate(input, len, flags, &error);
+
+    if (result != (json ? 0 : -1)) {
+        failhdr;
+        fprintf(stderr, "json_validate returned %d for %s\n", result, input);
+        exit(1);
+    }
+    if (strcmp(error.text, expected.text) || strcmp(error.source, expected.source) ||
+        error.line != expected.line || error.column != expected.column ||
+        error.position != expected.position ||
+        (!json && json_error_code(&error) != json_error_code(&expected))) {
+        failhdr;
+        fprintf(stderr, "json_validate reported '%s' at %d, expected '%s' at %d for %s\n",
+                error.text, error.position, expected.text, expected.position, input);
+        exit(1);
+    }
+    json_decref(json);
+}
+
+#define check(input_, flags_) check_same(input_, strlen(input_), flags_)
+
+static void valid() {
+    check("[]", 0);
+    check(" {} ", 0);
+    check("[1, -2, 0, 3.5, -0.25e+10, 1E-3, true, false, null]", 0);
+    check("{\"a\": {\"b\": [{}, []]}, \"c\": \"d\"}", 0);
+    check("[\"plain\", \"esc\\\"aped\\\\\\/\\b\\f\\n\\r\\t\"]", 0);
+    check("[\"\\u00e9\\uD834\\uDD1E\"]", 0);
+    check("[\"caf\xc3\xa9 \xe6\xb0\xb4 \xf0\x9f\x98\x80\"]", 0);
+    check("[9223372036854775807, -9223372036854775808]", 0);
+    check("[1e308, 123456789012345678901234567890]", 0);
+    check("\n[\n1\n]\n", 0);
+
+    check("1", JSON_DECODE_ANY);
+    check("\"x\"", JSON_DECODE_ANY);
+    check("null", JSON_DECODE_ANY);
+    check("[1] [2]", JSON_DISABLE_EOF_CHECK);
+    check("12abc", JSON_DISABLE_EOF_CHECK | JSON_DECODE_ANY);
+    check("[\"\\u0000\"]", JSON_ALLOW_NUL);
+    check("[1]", JSON_DECODE_INT_AS_REAL);
+    check("{\"a\": 1, \"b\": {\"a\": 2}, \"c\": 3}", JSON_REJECT_DUPLICATES);
+    check("[[1]]", JSON_PARSER_DEPTH(3));
+}
+
+static void invalid() {
+    check("", 0);
+    check("   ", 0);
+    check("1", 0);
+    check("[", 0);
+    check("[1,]", 0);
+    check("[1 2]", 0);
+    check("{\"a\" 1}", 0);
+    check("{\"a\": 1,}", 0);
+    check("{1: 2}", 0);
+    check("[01]", 0);
+    check("[1.]", 0);
+    check("[1e]", 0);
+    check("[-]", 0);
+    check("[truex]", 0);
+    check("[nul]", 0);
+    check("[1] x", 0);
+    check("[\"unterminated]", 0);
+    check("[\"new\nline\"]", 0);
+    check("[\"\\x\"]", 0);
+    check("[\"\\u12\"]", 0);
+    check("[\"\\uqqqq\"]", 0);
+    check("[\"\\uD834\\uqqqq\"]", 0);
+    check("[\"\\uD834\"]", 0);
+    check("[\"\\uDD1E\"]", 0);
+    check("[\"\\uD834\\u0041\"]", 0);
+    check("[\"\xff\"]", 0);
+    check("[\xc3\xa9]", 0);
+    check("[9223372036854775808]", 0);
+    check("[-9223372036854775809]", 0);
+    check("[1e400]", 0);
+    check("[1] [2]", 0);
+    check("truex", JSON_DECODE_ANY);
+    check("[\"\\u0000\"]", 0);
+    check("{\"\\u0000\": 1}", JSON_ALLOW_NUL);
+    check("[1]", JSON_PARSER_DEPTH(1));
+    check("[[1]]", JSON_PARSER_DEPTH(2));
+    check("{\"a\": 1, \"a\": 2}", JSON_REJECT_DUPLICATES);
+    check("{\"a\": {\"b\": 1, \"b\": 2}}", JSON_REJECT_DUPLICATES);
+    check("{\"a\": 1, \"\\u0061\": 2}", JSON_REJECT_DUPLICATES);
+    check_same("[\"a\0b\"]", 7, 0);
+    check_same("[1]\0", 4, 0);
+
+    if (json_validate(NULL, 0, 0, NULL) != -1)
+        fail("json_validate accepted NULL");
+}
+
+static void many_keys() {
+    char text[20000];
+    size_t i, len = 0;
+
+    /* more keys than can be tracked without the parser */
+    text[len++] = '{';
+    for (i = 0; i < 1000; i++)
+        len += sprintf(text + len, "%s\"key%d\": %d", i ? ", " : "", (int)i, (int)i);
+    strcpy(text + len, "}");
+    check(text, JSON_REJECT_DUPLICATES);
+
+    strcpy(text + len, ", \"key999\": 1}");
+    check(text, JSON_REJECT_DUPLICATES);
+}
+
+static void deep() {
+    char text[2 * 3000 + 1];
+    size_t i;
+
+    for (i = 0; i < 3000; i++) {
+        text[i] = '[';
+        text[2 * 3000 - 1 - i] = ']';
+    }
+    text[2 * 3000] = '\0';
+    check(text, 0);
+    check(text, JSON_PARSER_DEPTH(3000));
+    check(text + 1000, 0);
+}
+
+static void no_allocations() {
+    static const char text[] =
+        "{\"id\": 1, \"name\": \"a string long enough to be allocated by the lexer\", "
+        "\"tags\": [\"x\", \"y\\n\"], \"score\": 1.5e3, \"nested\": {\"ok\": true}}";
+
+    json_set_alloc_funcs(counting_malloc, counting_free);
+    if (json_validate(text, strlen(text), JSON_REJECT_DUPLICATES, NULL) ||
+        json_validate(text, strlen(text), JSON_ALLOW_NUL | JSON_DECODE_INT_AS_REAL, NULL))
+        fail("json_validate rejected valid input");
+    if (mallocs != 0)
+        fail("json_validate allocated memory");
+}
+
+static void invalid_without_tree() {
+    char text[40000];
+    size_t i, len = 0;
+
+    /* the error is found by the parser, but no values are built */
+    text[len++] = '[';
+    for (i = 0; i < 1000; i++)
+        len += sprintf(text + len, "%s{\"key\\n\": \"value %d\"}", i ? ", " : "", (int)i);
+    strcpy(text + len, ", tru]");
+
+    check(text, 0);
+    live = peak_live = 0;
+    if (json_validate(text, strlen(text), 0, NULL) != -1)
+        fail("json_validate accepted invalid input");
+    if (peak_live > 10 || live != 0)
+        fail("json_validate decoded invalid input to a tree");
+}
+
+static void run_tests() {
+    valid();
+    invalid();
+    many_keys();
+    deep();
+    no_allocations();
+    invalid_without_tree();
+}
@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <string.h>
+
+struct output {
+    char buffer[4096];
+    size_t len;
+    int calls;
+};
+
+static int to_output(const char *buffer, size_t size, void *data) {
+    struct output *out = data;
+    if (out->len + size >= sizeof(out->buffer))
+        return -1;
+    memcpy(out->buffer + out->len, buffer, size);
+    out->len += size;
+    out->buffer[out->len] = '\0';
+    out->calls++;
+    return 0;
+}
+
+/* Write json with the writer calls, or with json_writer_value() from
+   the given depth on */
+static int write_tree(json_writer_t *writer, const json_t *json, int value_depth) {
+    const char *key;
+    json_t *value;
+    size_t i;
+
+    if (value_depth == 0)
+        return json_writer_value(writer, json);
+
+    switch (json_typeof(json)) {
+        case JSON_OBJECT:
+            if (json_writer_begin_object(writer))
+                return -1;
+            json_object_foreach((json_t *)json, key, value) {
+                if (json_writer_key(writer, key) ||
+                    write_tree(writer, value, value_depth - 1))
+                    return -1;
+            }
+            return json_writer_end_object(writer);
+
+        case JSON_ARRAY:
+            if (json_writer_begin_array(writer))
+                return -1;
+            json_array_foreach(json, i, value) {
+                if (write_tree(writer, value, value_depth - 1))
+                    return -1;
+            }
+            return json_writer_end_array(writer);
+
+        case JSON_STRING:
+            return json_writer_stringn(writer, json_string_value(json),
+                                       json_string_length(json));
+        case JSON_INTEGER:
+            return json_writer_integer(writer, json_integer_value(json));
+        case JSON_REAL:
+            return json_writer_real(writer, json_real_value(json));
+        case JSON_TRUE:
+        case JSON_FALSE:
+            return json_writer_boolean(writer, json_is_true(json));
+        default:
+            return json_writer_null(writer);
+    }
+}
+
+static void same_as_dumps() {
+    const char *texts[] = {
+        "{\"name\": \"w\\u00e4/\\n\", \"list\": [1, -2.5, 0.1, [], {}, null, true,"
+        " false], \"nested\": {\"a\": {\"b\": [[1, 2], {\"c\": \"\\ud834\\udd1e\"}]}}}",
+        "[]",
+        "{}",
+        "[[[]], [{}], 1e300]"};
+    size_t flags[] = {0,
+                      JSON_COMPACT,
+                      JSON_INDENT(2),
+                      JSON_INDENT(4) | JSON_COMPACT,
+                      JSON_ENSURE_ASCII | JSON_ESCAPE_SLASH,
+                      JSON_REAL_PRECISION(3),
+                      JSON_EMBED,
+                      JSON_EMBED | JSON_INDENT(1),
+                      JSON_PRESERVE_ORDER};
+    size_t i, j;
+    int depth;
+
+    for (i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+        json_t *json = json_loads(texts[i], 0, NULL);
+        if (!json)
+            fail("json_loads failed");
+
+        for (j = 0; j < sizeof(flags) / sizeof(flags[0]); j++) {
+            char *expected = json_dumps(json, flags[j]);
+
+            for (depth = -1; depth < 4; depth++) {
+                struct output out;
+                json_writer_t *writer;
+
+                out.len = 0;
+                out.buffer[0] = '\0';
+                writer = json_writer_new(to_output, &out, flags[j]);
+                if (!writer)
+                    fail("json_writer_new failed");
+                if (write_tree(writer, json, depth) || json_writer_finish(writer))
+                    fail("writing a tree failed");
+                json_writer_free(writer);
+
+                if (strcmp(out.buffer, expected)) {
+                    fprintf(stderr, "flags 0x%x depth %d:\n%s\n%s\n", (int)flags[j],
+                            depth, out.buffer, expected);
+                    fail("json_writer output differs from json_dumps");
+                }
+            }
+            free(expected);
+        }
+        json_decref(json);
+    }
+}
+
+static void sort_keys_in_values() {
+    json_t *json = json_pack("{s:i, s:i, s:i}", "c", 3, "a", 1, "b", 2);
+    struct output out;
+    json_writer_t *writer;
+
+    out.len = 0;
+    writer = json_writer_new(to_output, &out, JSON_SORT_KEYS | JSON_COMPACT);
+    if (json_writer_begin_array(writer) || json_writer_value(writer, json) ||
+        json_writer_end_array(writer) || json_writer_finish(writer))
+        fail("json_writer_value failed");
+    if (strcmp(out.buffer, "[{\"a\":1,\"b\":2,\"c\":3}]"))
+        fail("json_writer_value did not sort keys");
+    json_writer_free(writer);
+    json_decref(json);
+}
+
+static json_writer_t *new_writer(struct output *out, size_t flags) {
+    out->len = 0;
+    out->buffer[0] = '\0';
+    return json_writer_new(to_output, out, flags);
+}
+
+static void misuse() {
+    struct output out;
+    json_writer_t *writer;
+    json_t *loop;
+
+    /* a value in an object needs a key */
+    writer = new_writer(&out, 0);
+    if (json_writer_begin_object(writer) || !json_writer_integer(writer, 1))
+        fail("json_writer_integer succeeded without a key");
+    /* errors are sticky */
+    if (!json_writer_end_object(writer) || !json_writer_finish(writer))
+        fail("json_writer continued after an error");
+    json_writer_free(writer);
+
+    writer = new_writer(&out, 0);
+    if (json_writer_begin_array(writer) || !json_writer_key(writer, "a"))
+        fail("json_writer_key succeeded in an array");
+    json_writer_free(writer);
+
+    writer = new_writer(&out, 0);
+    if (json_writer_begin_object(writer) || json_writer_key(writer, "a") ||
+        !json_writer_key(writer, "b"))
+        fail("json_writer_key succeeded twice");
+    json_writer_free(writer);
+
+    writer = new_writer(&out, 0);
+    if (json_writer_begin_object(writer) || json_writer_key(writer, "a") ||
+        !json_writer_end_object(writer))
+        fail("json_writer_end_object succeeded without a value");
+    json_writer_free(writer);
+
+    writer = new_writer(&out, 0);
+    if (json_writer_begin_array(writer) || !json_writer_end_object(writer))
+        fail("json_writer_end_object closed an array");
+    json_writer_free(writer);
+
+    writer = new_writer(&out, 0);
+    if (!json_writer_end_array(writer))
+        fail("json_writer_end_array succeeded without an array");
+    json_writer_free(writer);
+
+    writer = new_writer(&out, 0);
+    if (json_writer_begin_array(writer) || json_writer_end_array(writer) ||
+        !json_writer_begin_array(writer))
+        fail("json_writer wrote two top level values");
+    json_writer_free(writer);
+
+    writer = new_writer(&out, 0);
+    if (json_writer_begin_array(writer) || !json_writer_finish(writer))
+        fail("json_writer_finish succeeded with an open array");
+    json_writer_free(writer);
+
+    writer = new_writer(&out, 0);
+    if (!json_writer_finish(writer))
+        fail("json_writer_finish succeeded without a value");
+    json_writer_free(writer);
+
+    /* scalars at the top level need JSON_ENCODE_ANY */
+    writer = new_writer(&out, 0);
+    if (!json_writer_string(writer, "x"))
+        fail("json_writer_string succeeded at the top level");
+    json_writer_free(writer);
+
+    writer = new_writer(&out, JSON_ENCODE_ANY);
+    if (json_writer_string(writer, "x") || json_writer_finish(writer) ||
+        strcmp(out.buffer, "\"x\""))
+        fail("json_writer_string failed with JSON_ENCODE_ANY");
+    json_writer_free(writer);
+
+    writer = new_writer(&out, 0);
+    if (json_writer_begin_array(writer) || !json_writer_real(writer, 0.0 / 0.0))
+        fail("json_writer_real accepted NaN");
+    json_writer_free(writer);
+
+    writer = new_writer(&out, 0);
+    if (json_writer_begin_array(writer) || !json_writer_string(writer, "\xff") ||
+        !json_writer_string(NULL, "x") || !json_writer_value(NULL, NULL))
+        fail("json_writer_string accepted invalid UTF-8");
+    json_writer_free(writer);
+
+    /* circular references in a subtree */
+    loop = json_array();
+    json_array_append_new(loop, json_array());
+    json_array_append(json_array_get(loop, 0), loop);
+    writer = new_writer(&out, 0);
+    if (json_writer_begin_array(writer) || !json_writer_value(writer, loop))
+        fail("json_writer_value accepted a circular reference");
+    json_writer_free(writer);
+    json_array_clear(json_array_get(loop, 0));
+    json_decref(loop);
+
+    if (json_writer_new(NULL, NULL, 0) || json_writer_newf(NULL, 0) ||
+        json_writer_newfd(-1, 0))
+        fail("json_writer_new accepted a missing output");
+    json_writer_free(NULL);
+}
+
+static int count_output(const char *buffer, size_t size, void *data) {
+    size_t *count = data;
+    (void)buffer;
+    *count += size;
+    return 0;
+}
+
+static void streams_in_blocks() {
+    size_t count = 0;
+    json_writer_t *writer = json_writer_new(count_output, &count, JSON_COMPACT);
+    int i;
+
+    if (json_writer_begin_array(writer))
+        fail("json_writer_begin_array failed");
+    for (i = 0; i < 100000 && count == 0; i++)
+        json_writer_string(writer, "0123456789");
+    if (!count)
+        fail("json_writer kept everything in memory");
+
+    if (json_writer_string(writer, "x") || json_writer_flush(writer) ||
+        count != 1 + (size_t)i * 13 + 3)
+        fail("json_writer_flush failed");
+    json_writer_free(writer);
+}
+
+static void file_and_fd() {
+    FILE *fp = tmpfile();
+    json_writer_t *writer;
+    char buffer[64];
+    size_t len;
+
+    if (!fp)
+        fail("tmpfile failed");
+
+    writer = json_writer_newf(fp, JSON_COMPACT);
+    if (json_writer_begin_object(writer) || json_writer_key(writer, "a") ||
+        json_writer_null(writer) || json_writer_end_object(writer) ||
+        json_writer_finish(writer))
+        fail("json_writer_newf failed");
+    json_writer_free(writer);
+
+#ifdef HAVE_UNISTD_H
+    fflush(fp);
+    writer = json_writer_newfd(fileno(fp), JSON_COMPACT);
+    if (json_writer_begin_array(writer) || json_writer_end_array(writer) ||
+        json_writer_finish(writer))
+        fail("json_writer_newfd failed");
+    json_writer_free(writer);
+#endif
+
+    rewind(fp);
+    len = fread(buffer, 1, sizeof(buffer) - 1, fp);
+    buffer[len] = '\0';
+#ifdef HAVE_UNISTD_H
+    if (strcmp(buffer, "{\"a\":null}[]"))
+#else
+    if (strcmp(buffer, "{\"a\":null}"))
+#endif
+        fail("json_writer wrote wrong output to a file");
+    fclose(fp);
+}
+
+static void run_tests() {
+    same_as_dumps();
+    sort_keys_in_values();
+    misuse();
+    streams_in_blocks();
+    file_and_fd();
+}